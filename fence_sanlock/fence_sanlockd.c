@@ -36,6 +36,7 @@
 
 #define LIVE_INTERVAL 5
 #define EXPIRE_INTERVAL 20
+#define DEAD_WAIT_TIMEOUT 10
 
 #define DAEMON_RUN_DIR "/var/run/fence_sanlockd"
 #define AGENT_RUN_DIR "/var/run/fence_sanlock"
@@ -369,7 +370,12 @@ static int send_options(void)
 
 	memset(fifo_line, 0, sizeof(fifo_line));
 
-	snprintf(fifo_line, PATH_MAX-1, "-p %s -i %d", lease_path, our_host_id);
+	rv = snprintf(fifo_line, sizeof(fifo_line), "-p %s -i %d", lease_path, our_host_id);
+	if (rv < 0 || rv >= sizeof(fifo_line)) {
+		fprintf(stderr, "path too long %s\n", lease_path);
+		close(fd);
+		return -1;
+	}
 
 	rv = write(fd, fifo_line, sizeof(fifo_line));
 	if (rv < 0) {
@@ -402,6 +408,127 @@ static int send_signal(int sig)
 	return rv;
 }
 
+/*
+ * Used by the fence_sanlock agent between attempts to acquire the
+ * victim's lease.  Instead of sleeping for a fixed time, wait for the
+ * sanlock daemon to report that the victim's host_id is dead (or free)
+ * in the fence lockspace, which is when its lease can be acquired.
+ * The daemon sends a host state event when that happens.  Returns 0
+ * when the host is dead, 1 if it is not by the timeout.
+ */
+
+#define STATE_EVENT_RECS 16
+
+static int host_is_dead(int host_id)
+{
+	struct sanlk_host *hss = NULL;
+	uint32_t state;
+	int count = 0;
+	int rv;
+
+	rv = sanlock_get_hosts("fence", host_id, &hss, &count, 0);
+	if (rv < 0 || !hss || !count) {
+		log_debug("get_hosts %d error %d", host_id, rv);
+		free(hss);
+		return 0;
+	}
+
+	state = hss->flags & SANLK_HOST_MASK;
+	free(hss);
+
+	log_debug("host_id %d state %x", host_id, state);
+
+	return (state == SANLK_HOST_DEAD || state == SANLK_HOST_FREE);
+}
+
+static int wait_host_dead(int host_id, int timeout)
+{
+	struct sanlk_event_filter ef;
+	struct sanlk_event_rec recs[STATE_EVENT_RECS];
+	struct pollfd pfd;
+	uint64_t end, now;
+	uint32_t state;
+	int fd, rv, count, i;
+	int dead = 0;
+
+	openlog("fence_sanlockd-d", LOG_CONS | LOG_PID, LOG_DAEMON);
+
+	memset(&ef, 0, sizeof(ef));
+	ef.flags = SANLK_EVF_HOST_IDS | SANLK_EVF_HOST_STATE;
+	ef.host_ids[(host_id - 1) / 8] |= 1 << ((host_id - 1) % 8);
+
+	/* an older daemon without state events: wait for the timeout */
+
+	fd = sanlock_reg_event_filter("fence", &ef, 0);
+	if (fd < 0)
+		log_debug("reg_event_filter error %d", fd);
+
+	/* register first so a change after this check is not missed */
+
+	if (host_is_dead(host_id)) {
+		dead = 1;
+		goto out;
+	}
+
+	end = monotime() + timeout;
+
+	while (!dead) {
+		now = monotime();
+		if (now >= end)
+			break;
+
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		rv = poll(&pfd, 1, (end - now) * 1000);
+		if (rv == -1 && errno == EINTR)
+			continue;
+		if (rv <= 0)
+			break;
+
+		if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			log_debug("event fd error %x", pfd.revents);
+			break;
+		}
+
+		while (1) {
+			rv = sanlock_get_events(fd, 0, recs, STATE_EVENT_RECS, &count);
+			if (rv < 0)
+				break;
+
+			for (i = 0; i < count; i++) {
+				if (recs[i].he.event != SANLK_HOST_EVENT_STATE)
+					continue;
+				if (recs[i].from_host_id != (uint64_t)host_id)
+					continue;
+
+				state = recs[i].he.data & SANLK_HOST_MASK;
+
+				log_debug("host_id %d gen %llu state event %x", host_id,
+					  (unsigned long long)recs[i].from_generation, state);
+
+				if (state == SANLK_HOST_DEAD || state == SANLK_HOST_FREE)
+					dead = 1;
+			}
+
+			if (count < STATE_EVENT_RECS)
+				break;
+		}
+	}
+
+	if (!dead)
+		dead = host_is_dead(host_id);
+ out:
+	if (fd >= 0)
+		sanlock_end_event(fd, "fence", 0);
+
+	if (dead)
+		syslog(LOG_INFO, "host_id %d is dead", host_id);
+
+	return dead ? 0 : 1;
+}
+
 /*
  * A running fence_sanlock agent has a pid file we can read.
  * We use this to check what host_id it's fencing, so we can
@@ -515,6 +642,8 @@ static void print_usage(void)
 	printf("  -w            Wait for fence_sanlockd -s to send options (p,i)\n");
 	printf("  -s            Send options (p,i) to waiting fence_sanlockd -w\n");
 	printf("  -1            Send SIGUSR1 to running fence_sanlockd\n");
+	printf("  -d <host_id>  Wait for host_id to be dead in the fence lockspace\n");
+	printf("  -t <seconds>  Time to wait with -d (default %d)\n", DEAD_WAIT_TIMEOUT);
 	printf("  -h            Print this help, then exit\n");
 	printf("  -V            Print program version information, then exit\n");
 }
@@ -528,6 +657,8 @@ int main(int argc, char *argv[])
 	int sleep_seconds;
 	int send_opts = 0, wait_opts = 0;
 	int send_sigusr1 = 0;
+	int wait_dead_host_id = 0;
+	int wait_dead_timeout = DEAD_WAIT_TIMEOUT;
 	int cont = 1;
 	int optchar;
 	int sock, con, rv, i;
@@ -535,7 +666,7 @@ int main(int argc, char *argv[])
 	int victim_host_id;
 
 	while (cont) {
-		optchar = getopt(argc, argv, "Dp:i:hVws1");
+		optchar = getopt(argc, argv, "Dp:i:hVws1d:t:");
 
 		switch (optchar) {
 		case 'D':
@@ -561,6 +692,17 @@ int main(int argc, char *argv[])
 		case '1':
 			send_sigusr1 = 1;
 			break;
+		case 'd':
+			wait_dead_host_id = atoi(optarg);
+			if (wait_dead_host_id < 1 || wait_dead_host_id > MAX_HOSTS) {
+				fprintf(stderr, "invalid host_id %d, use 1-%d\n",
+					wait_dead_host_id, MAX_HOSTS);
+				exit(1);
+			}
+			break;
+		case 't':
+			wait_dead_timeout = atoi(optarg);
+			break;
 		case 'h':
 			print_usage();
 			exit(0);
@@ -582,6 +724,11 @@ int main(int argc, char *argv[])
 		return rv;
 	}
 
+	if (wait_dead_host_id) {
+		rv = wait_host_dead(wait_dead_host_id, wait_dead_timeout);
+		return rv;
+	}
+
 	if (wait_opts && send_opts) {
 		fprintf(stderr, "-w and -s options cannot be used together\n");
 		exit(1);
@@ -657,7 +804,11 @@ int main(int argc, char *argv[])
 	}
 
 	memset(&disk, 0, sizeof(disk));
-	sprintf(disk.path, "%s", lease_path);
+	rv = snprintf(disk.path, sizeof(disk.path), "%s", lease_path);
+	if (rv < 0 || rv >= sizeof(disk.path)) {
+		log_error("lease path too long %s", lease_path);
+		goto out_refcount;
+	}
 
 	align = sanlock_direct_align(&disk);
 	if (align < 0) {
@@ -666,7 +817,7 @@ int main(int argc, char *argv[])
 	}
 
 	memset(&ls, 0, sizeof(ls));
-	sprintf(ls.host_id_disk.path, "%s", lease_path);
+	memcpy(ls.host_id_disk.path, disk.path, sizeof(ls.host_id_disk.path));
 	strcpy(ls.name, "fence");
 	ls.host_id = our_host_id;
 
@@ -697,7 +848,7 @@ int main(int argc, char *argv[])
 	r = (struct sanlk_resource *)&rdbuf;
 	strcpy(r->lockspace_name, "fence");
 	sprintf(r->name, "h%d", our_host_id);
-	sprintf(r->disks[0].path, "%s", lease_path);
+	memcpy(r->disks[0].path, disk.path, sizeof(r->disks[0].path));
 	r->disks[0].offset = our_host_id * align;
 	r->num_disks = 1;
 	r->flags = SANLK_RES_PERSISTENT;
@@ -178,6 +178,28 @@ add_align_flag(long align, uint32_t *flags)
     return 0;
 }
 
+static int
+add_lvb_flag(int lvb, uint32_t *flags)
+{
+    switch (lvb) {
+    case 0:
+	break;
+    case 4096:
+        *flags |= SANLK_RES_LVB4K;
+	break;
+    case 8192:
+        *flags |= SANLK_RES_LVB8K;
+	break;
+    case 16384:
+        *flags |= SANLK_RES_LVB16K;
+	break;
+    default:
+	PyErr_Format(PyExc_ValueError, "Invalid lvb value: %d", lvb);
+	return -1;
+    }
+    return 0;
+}
+
 static PyObject *
 __hosts_to_list(struct sanlk_host *hss, int hss_count)
 {
@@ -247,6 +269,50 @@ exit_fail:
     return NULL;
 }
 
+/*
+ * Pack the hosts of n lockspaces or resources into the buffers returned
+ * by the bulk functions: the records of all the hosts one after another in
+ * HOST_RECORD_FORMAT, and an int32 per item, the number of its records or
+ * a negative error.
+ */
+static PyObject *
+__hosts_to_buffers(struct sanlk_host **hss, int32_t *counts, int n)
+{
+    int i, total = 0;
+    char *p;
+    PyObject *records = NULL, *cbuf = NULL, *result = NULL;
+
+    for (i = 0; i < n; i++) {
+        if (counts[i] > 0)
+            total += counts[i];
+    }
+
+    records = PyByteArray_FromStringAndSize(NULL,
+                                    total * sizeof(struct sanlk_host));
+    if (records == NULL)
+        goto exit_fail;
+
+    p = PyByteArray_AsString(records);
+
+    for (i = 0; i < n; i++) {
+        if (counts[i] <= 0)
+            continue;
+        memcpy(p, hss[i], counts[i] * sizeof(struct sanlk_host));
+        p += counts[i] * sizeof(struct sanlk_host);
+    }
+
+    cbuf = PyByteArray_FromStringAndSize((char *)counts, n * sizeof(int32_t));
+    if (cbuf == NULL)
+        goto exit_fail;
+
+    result = PyTuple_Pack(2, records, cbuf);
+
+exit_fail:
+    Py_XDECREF(records);
+    Py_XDECREF(cbuf);
+    return result;
+}
+
 /* register */
 PyDoc_STRVAR(pydoc_register, "\
 register() -> int\n\
@@ -631,18 +697,21 @@ exit_fail:
 /* write_resource */
 PyDoc_STRVAR(pydoc_write_resource, "\
 write_resource(lockspace, resource, disks, max_hosts=0, num_hosts=0, \
-clear=False, align=1048576, sector=512)\n\
+clear=False, align=1048576, sector=512, lvb=0)\n\
 Initialize a device to be used as sanlock resource.\n\
 The disks must be in the format: [(path, offset), ... ].\n\
 If clear is True, the resource is cleared so subsequent read will\n\
 return an error.\n\
 Align can be one of (1048576, 2097152, 4194304, 8388608).\n\
-Sector can be one of (512, 4096).");
+Sector can be one of (512, 4096).\n\
+Lvb is the size of a multi-sector lvb region, one of (4096, 8192, 16384),\n\
+or 0 for the single sector lvb.");
 
 static PyObject *
 py_write_resource(PyObject *self __unused, PyObject *args, PyObject *keywds)
 {
     int rv, max_hosts = 0, num_hosts = 0, clear = 0, sector = SECTOR_SIZE_512;
+    int lvb = 0;
     long align = ALIGNMENT_1M;
     const char *lockspace, *resource;
     struct sanlk_resource *rs;
@@ -650,12 +719,13 @@ py_write_resource(PyObject *self __unused, PyObject *args, PyObject *keywds)
     uint32_t flags = 0;
 
     static char *kwlist[] = {"lockspace", "resource", "disks", "max_hosts",
-                                "num_hosts", "clear", "align", "sector", NULL};
+                                "num_hosts", "clear", "align", "sector", "lvb",
+                                NULL};
 
     /* parse python tuple */
-    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!|iiili",
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!|iiilii",
         kwlist, &lockspace, &resource, &PyList_Type, &disks, &max_hosts,
-        &num_hosts, &clear, &align, &sector)) {
+        &num_hosts, &clear, &align, &sector, &lvb)) {
         return NULL;
     }
 
@@ -675,6 +745,9 @@ py_write_resource(PyObject *self __unused, PyObject *args, PyObject *keywds)
     if (add_sector_flag(sector, &rs->flags) == -1)
         goto exit_fail;
 
+    if (add_lvb_flag(lvb, &rs->flags) == -1)
+        goto exit_fail;
+
     if (clear) {
         flags |= SANLK_WRITE_CLEAR;
     }
@@ -951,6 +1024,196 @@ exit_fail:
     return NULL;
 }
 
+/* get_stats */
+PyDoc_STRVAR(pydoc_get_stats, "\
+get_stats() -> list\n\
+Return the disk i/o latency stats kept by sanlock, one dictionary for each\n\
+disk path and type of i/o (IO_DELTA_READ, IO_DELTA_WRITE, IO_LEADER_READ,\n\
+IO_LEADER_WRITE, IO_DBLOCK_READ, IO_DBLOCK_WRITE, IO_MBLOCK_WRITE,\n\
+IO_LVB_READ, IO_LVB_WRITE, IO_OTHER_READ, IO_OTHER_WRITE). The dictionary\n\
+contains: path, op, count, errors, total_us, max_us, p50_us, p99_us and\n\
+p999_us.\n");
+
+static PyObject *
+py_get_stats(PyObject *self __unused, PyObject *args, PyObject *keywds)
+{
+    int rv, i, stats_count = 0;
+    struct sanlk_io_stats *stats = NULL;
+    PyObject *st_list = NULL, *st_entry = NULL;
+
+    /* get all the stats (gil disabled) */
+    Py_BEGIN_ALLOW_THREADS
+    rv = sanlock_get_stats(&stats, &stats_count, 0);
+    Py_END_ALLOW_THREADS
+
+    if (rv < 0 && rv != -ENOSPC) {
+        __set_exception(rv, "Sanlock get stats failure");
+        goto exit_fail;
+    }
+
+    if ((st_list = PyList_New(0)) == NULL)
+        goto exit_fail;
+
+    for (i = 0; i < stats_count; i++) {
+        st_entry = Py_BuildValue(
+            "{s:s,s:I,s:K,s:K,s:K,s:K,s:K,s:K,s:K}",
+            "path", stats[i].path,
+            "op", stats[i].op,
+            "count", (unsigned long long)stats[i].count,
+            "errors", (unsigned long long)stats[i].errors,
+            "total_us", (unsigned long long)stats[i].total_us,
+            "max_us", (unsigned long long)stats[i].max_us,
+            "p50_us", (unsigned long long)stats[i].p50_us,
+            "p99_us", (unsigned long long)stats[i].p99_us,
+            "p999_us", (unsigned long long)stats[i].p999_us);
+        if (st_entry == NULL)
+            goto exit_fail;
+
+        if (PyList_Append(st_list, st_entry) != 0)
+            goto exit_fail;
+
+        Py_DECREF(st_entry);
+        st_entry = NULL;
+    }
+
+    /* success */
+    free(stats);
+    return st_list;
+
+    /* failure */
+exit_fail:
+    if (stats) free(stats);
+    Py_XDECREF(st_entry);
+    Py_XDECREF(st_list);
+    return NULL;
+}
+
+/* get_state */
+PyDoc_STRVAR(pydoc_get_state, "\
+get_state() -> dict\n\
+Return the state snapshot published by the sanlock daemon, read from shared\n\
+memory without a request to the daemon. The dictionary contains: the\n\
+update_time of the snapshot, the lockspaces list (as in get_lockspaces,\n\
+each with a hosts list as returned by get_hosts) and the resources list\n\
+with the lockspace, resource, version, pid and shared values of each\n\
+held lease.\n");
+
+static struct sanlk_state_map *state_map;
+
+static int
+__state_read(char **buf, int *len)
+{
+    int rv, retry;
+
+    for (retry = 0; retry < 2; retry++) {
+        if (!state_map) {
+            rv = sanlock_state_open(&state_map, 0);
+            if (rv < 0)
+                return rv;
+        }
+
+        rv = sanlock_state_read(state_map, buf, len);
+        if (rv != -EAGAIN)
+            return rv;
+
+        /* the daemon may have been restarted with a new snapshot */
+        sanlock_state_close(state_map);
+        state_map = NULL;
+    }
+
+    return rv;
+}
+
+static PyObject *
+py_get_state(PyObject *self __unused, PyObject *args, PyObject *keywds)
+{
+    int rv, len;
+    uint32_t i;
+    char *buf = NULL;
+    struct sanlk_state_header *hdr;
+    struct sanlk_state_lockspace *sl;
+    struct sanlk_state_resource *sr;
+    struct sanlk_host *hss;
+    PyObject *state = NULL, *ls_list = NULL, *res_list = NULL;
+    PyObject *entry = NULL, *hosts = NULL;
+
+    /* read the snapshot (gil disabled) */
+    Py_BEGIN_ALLOW_THREADS
+    rv = __state_read(&buf, &len);
+    Py_END_ALLOW_THREADS
+
+    if (rv < 0) {
+        __set_exception(rv, "Sanlock get state failure");
+        goto exit_fail;
+    }
+
+    hdr = (struct sanlk_state_header *)buf;
+    hss = (struct sanlk_host *)(buf + hdr->host_offset);
+
+    if ((ls_list = PyList_New(0)) == NULL)
+        goto exit_fail;
+
+    for (i = 0; i < hdr->ls_count; i++) {
+        sl = (struct sanlk_state_lockspace *)(buf + hdr->ls_offset) + i;
+
+        if ((hosts = __hosts_to_list(hss + sl->host_first, sl->host_count)) == NULL)
+            goto exit_fail;
+
+        entry = Py_BuildValue(
+            "{s:s,s:K,s:s,s:K,s:I,s:O}",
+            "lockspace", sl->ls.name,
+            "host_id", (unsigned long long)sl->ls.host_id,
+            "path", sl->ls.host_id_disk.path,
+            "offset", (unsigned long long)sl->ls.host_id_disk.offset,
+            "flags", sl->ls.flags,
+            "hosts", hosts);
+        Py_CLEAR(hosts);
+        if (entry == NULL)
+            goto exit_fail;
+
+        if (PyList_Append(ls_list, entry) != 0)
+            goto exit_fail;
+
+        Py_CLEAR(entry);
+    }
+
+    if ((res_list = PyList_New(0)) == NULL)
+        goto exit_fail;
+
+    for (i = 0; i < hdr->res_count; i++) {
+        sr = (struct sanlk_state_resource *)(buf + hdr->res_offset) + i;
+
+        entry = Py_BuildValue(
+            "{s:s,s:s,s:K,s:I,s:O}",
+            "lockspace", sr->lockspace_name,
+            "resource", sr->name,
+            "version", (unsigned long long)sr->lver,
+            "pid", sr->pid,
+            "shared", (sr->flags & SANLK_RES_SHARED) ? Py_True : Py_False);
+        if (entry == NULL)
+            goto exit_fail;
+
+        if (PyList_Append(res_list, entry) != 0)
+            goto exit_fail;
+
+        Py_CLEAR(entry);
+    }
+
+    state = Py_BuildValue(
+        "{s:K,s:O,s:O}",
+        "update_time", (unsigned long long)hdr->update_time,
+        "lockspaces", ls_list,
+        "resources", res_list);
+
+    /* success or failure of the last build */
+exit_fail:
+    if (buf) free(buf);
+    Py_XDECREF(entry);
+    Py_XDECREF(ls_list);
+    Py_XDECREF(res_list);
+    return state;
+}
+
 /* get_hosts */
 PyDoc_STRVAR(pydoc_get_hosts, "\
 get_hosts(lockspace, host_id=0) -> list\n\
@@ -997,31 +1260,119 @@ exit_fail:
     return ls_list;
 }
 
+/* get_hosts_bulk */
+PyDoc_STRVAR(pydoc_get_hosts_bulk, "\
+get_hosts_bulk(lockspaces) -> (bytearray, bytearray)\n\
+Return the hosts of each lockspace in the lockspaces list, as get_hosts\n\
+does, without creating an object per host. The first buffer holds the host\n\
+records of all the lockspaces, in order, each in HOST_RECORD_FORMAT\n\
+(host_id, generation, timestamp, io_timeout, flags). The second holds an\n\
+int32 per lockspace: the number of its records, or a negative error\n\
+number if its hosts are not available. The buffers can be read with\n\
+struct.iter_unpack, or with numpy.frombuffer without copying.\n");
+
+static PyObject *
+py_get_hosts_bulk(PyObject *self __unused, PyObject *args)
+{
+    int i, n, rv, hss_count;
+    PyObject *lockspaces, *item, *result = NULL;
+    const char **names = NULL;
+    struct sanlk_host **hss = NULL;
+    int32_t *counts = NULL;
+
+    if (!PyArg_ParseTuple(args, "O!", &PyList_Type, &lockspaces))
+        return NULL;
+
+    n = PyList_Size(lockspaces);
+
+    names = calloc(n + 1, sizeof(char *));
+    hss = calloc(n + 1, sizeof(struct sanlk_host *));
+    counts = calloc(n + 1, sizeof(int32_t));
+
+    if (!names || !hss || !counts) {
+        PyErr_NoMemory();
+        goto exit_fail;
+    }
+
+    for (i = 0; i < n; i++) {
+        item = PyList_GetItem(lockspaces, i);
+
+        if (!PyString_Check(item)) {
+            __set_exception(EINVAL, "Invalid lockspace name");
+            goto exit_fail;
+        }
+
+        names[i] = PyString_AsString(item);
+        if (names[i] == NULL)
+            goto exit_fail;
+    }
+
+    /* get the hosts of all the lockspaces (gil disabled) */
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; i < n; i++) {
+        hss_count = 0;
+        rv = sanlock_get_hosts(names[i], 0, &hss[i], &hss_count, 0);
+        counts[i] = (rv < 0) ? rv : hss_count;
+    }
+    Py_END_ALLOW_THREADS
+
+    result = __hosts_to_buffers(hss, counts, n);
+
+exit_fail:
+    for (i = 0; hss && i < n; i++)
+        free(hss[i]);
+    free(hss);
+    free(counts);
+    free(names);
+    return result;
+}
+
+/* the breakdown of an acquire or release, see struct sanlk_op_times */
+static PyObject *
+__op_times_to_dict(struct sanlk_op_times *t)
+{
+    return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:k,s:k}",
+                         "queue_us", (unsigned long long)t->queue_us,
+                         "open_us", (unsigned long long)t->open_us,
+                         "leader_read_us", (unsigned long long)t->leader_read_us,
+                         "phase1_us", (unsigned long long)t->phase1_us,
+                         "phase2_us", (unsigned long long)t->phase2_us,
+                         "commit_us", (unsigned long long)t->commit_us,
+                         "owner_wait_us", (unsigned long long)t->owner_wait_us,
+                         "total_us", (unsigned long long)t->total_us,
+                         "ballots", (unsigned long)t->ballots,
+                         "retries", (unsigned long)t->retries);
+}
+
 /* acquire */
 PyDoc_STRVAR(pydoc_acquire, "\
 acquire(lockspace, resource, disks \
-[, slkfd=fd, pid=owner, shared=False, version=None])\n\
+[, slkfd=fd, pid=owner, shared=False, version=None, times=False])\n\
 Acquire a resource lease for the current process (using the slkfd argument\n\
 to specify the sanlock file descriptor) or for an other process (using the\n\
 pid argument). If shared is True the resource will be acquired in the shared\n\
 mode. The version is the version of the lease that must be acquired or fail.\n\
+If times is True, a dict with the time spent in each part of the acquire\n\
+is returned, with the keys queue_us, open_us, leader_read_us, phase1_us,\n\
+phase2_us, commit_us, owner_wait_us, total_us, ballots and retries.\n\
 The disks must be in the format: [(path, offset), ... ]\n");
 
 static PyObject *
 py_acquire(PyObject *self __unused, PyObject *args, PyObject *keywds)
 {
-    int rv, sanlockfd = -1, pid = -1, shared = 0;
+    int rv, sanlockfd = -1, pid = -1, shared = 0, times = 0;
     const char *lockspace, *resource;
     struct sanlk_resource *res;
+    struct sanlk_op_times ot;
     PyObject *disks, *version = Py_None;
 
     static char *kwlist[] = {"lockspace", "resource", "disks", "slkfd",
-                                "pid", "shared", "version", NULL};
+                                "pid", "shared", "version", "times", NULL};
 
     /* parse python tuple */
-    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!|iiiO", kwlist,
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!|iiiOi", kwlist,
         &lockspace, &resource, &PyList_Type, &disks, &sanlockfd, &pid,
-        &shared, &version)) {
+        &shared, &version, &times)) {
         return NULL;
     }
 
@@ -1057,7 +1408,10 @@ py_acquire(PyObject *self __unused, PyObject *args, PyObject *keywds)
 
     /* acquire sanlock resource (gil disabled) */
     Py_BEGIN_ALLOW_THREADS
-    rv = sanlock_acquire(sanlockfd, pid, 0, 1, &res, 0);
+    if (times)
+        rv = sanlock_acquire_times(sanlockfd, pid, 0, 1, &res, 0, &ot);
+    else
+        rv = sanlock_acquire(sanlockfd, pid, 0, 1, &res, 0);
     Py_END_ALLOW_THREADS
 
     if (rv != 0) {
@@ -1066,6 +1420,9 @@ py_acquire(PyObject *self __unused, PyObject *args, PyObject *keywds)
     }
 
     free(res);
+
+    if (times)
+        return __op_times_to_dict(&ot);
     Py_RETURN_NONE;
 
 exit_fail:
@@ -1075,24 +1432,28 @@ exit_fail:
 
 /* release */
 PyDoc_STRVAR(pydoc_release, "\
-release(lockspace, resource, disks [, slkfd=fd, pid=owner])\n\
+release(lockspace, resource, disks [, slkfd=fd, pid=owner, times=False])\n\
 Release a resource lease for the current process.\n\
+If times is True, a dict with the time spent in each part of the release\n\
+is returned, with the same keys as for acquire.\n\
 The disks must be in the format: [(path, offset), ... ]");
 
 static PyObject *
 py_release(PyObject *self __unused, PyObject *args, PyObject *keywds)
 {
-    int rv, sanlockfd = -1, pid = -1;
+    int rv, sanlockfd = -1, pid = -1, times = 0;
     const char *lockspace, *resource;
     struct sanlk_resource *res;
+    struct sanlk_op_times ot;
     PyObject *disks;
 
     static char *kwlist[] = {"lockspace", "resource", "disks", "slkfd",
-                                "pid", NULL};
+                                "pid", "times", NULL};
 
     /* parse python tuple */
-    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!|ii", kwlist,
-        &lockspace, &resource, &PyList_Type, &disks, &sanlockfd, &pid)) {
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!|iii", kwlist,
+        &lockspace, &resource, &PyList_Type, &disks, &sanlockfd, &pid,
+        &times)) {
         return NULL;
     }
 
@@ -1107,7 +1468,10 @@ py_release(PyObject *self __unused, PyObject *args, PyObject *keywds)
 
     /* release sanlock resource (gil disabled) */
     Py_BEGIN_ALLOW_THREADS
-    rv = sanlock_release(sanlockfd, pid, 0, 1, &res);
+    if (times)
+        rv = sanlock_release_times(sanlockfd, pid, 0, 1, &res, &ot);
+    else
+        rv = sanlock_release(sanlockfd, pid, 0, 1, &res);
     Py_END_ALLOW_THREADS
 
     if (rv != 0) {
@@ -1116,6 +1480,9 @@ py_release(PyObject *self __unused, PyObject *args, PyObject *keywds)
     }
 
     free(res);
+
+    if (times)
+        return __op_times_to_dict(&ot);
     Py_RETURN_NONE;
 
 exit_fail:
@@ -1123,30 +1490,33 @@ exit_fail:
     return NULL;
 }
 
-/* request */
-PyDoc_STRVAR(pydoc_request, "\
-request(lockspace, resource, disks [, action=REQ_GRACEFUL, version=None])\n\
-Request the owner of a resource to do something specified by action.\n\
-The possible values for action are: REQ_GRACEFUL to request a graceful\n\
-release of the resource and REQ_FORCE to sigkill the owner of the\n\
-resource (forcible release). The version should be either the next version\n\
-to acquire or None (which automatically uses the next version).\n\
-The disks must be in the format: [(path, offset), ... ]");
+/* acquire_async */
+PyDoc_STRVAR(pydoc_acquire_async, "\
+acquire_async(lockspace, resource, disks, slkfd=fd \
+[, pid=owner, shared=False, version=None]) -> int\n\
+Send an acquire request for a resource lease on the registered sanlock\n\
+file descriptor slkfd and return the request id without waiting for the\n\
+result. The lease is acquired for the registering process, or for an\n\
+other process using the pid argument. When slkfd becomes readable, use\n\
+async_result to get the completion.\n\
+The disks must be in the format: [(path, offset), ... ]\n");
 
 static PyObject *
-py_request(PyObject *self __unused, PyObject *args, PyObject *keywds)
+py_acquire_async(PyObject *self __unused, PyObject *args, PyObject *keywds)
 {
-    int rv, action = SANLK_REQ_GRACEFUL, flags = 0;
+    int rv, sanlockfd = -1, pid = -1, shared = 0;
     const char *lockspace, *resource;
     struct sanlk_resource *res;
     PyObject *disks, *version = Py_None;
+    uint32_t req_id = 0;
 
-    static char *kwlist[] = {"lockspace", "resource", "disks", "action",
-                                "version", NULL};
+    static char *kwlist[] = {"lockspace", "resource", "disks", "slkfd",
+                                "pid", "shared", "version", NULL};
 
     /* parse python tuple */
-    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!|iO", kwlist,
-        &lockspace, &resource, &PyList_Type, &disks, &action, &version)) {
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!i|iiO", kwlist,
+        &lockspace, &resource, &PyList_Type, &disks, &sanlockfd, &pid,
+        &shared, &version)) {
         return NULL;
     }
 
@@ -1159,10 +1529,13 @@ py_request(PyObject *self __unused, PyObject *args, PyObject *keywds)
     strncpy(res->lockspace_name, lockspace, SANLK_NAME_LEN);
     strncpy(res->name, resource, SANLK_NAME_LEN);
 
+    /* prepare sanlock flags */
+    if (shared) {
+        res->flags |= SANLK_RES_SHARED;
+    }
+
     /* prepare the resource version */
-    if (version == Py_None) {
-        flags = SANLK_REQUEST_NEXT_LVER;
-    } else {
+    if (version != Py_None) {
         res->flags |= SANLK_RES_LVER;
         res->lver = PyInt_AsUnsignedLongMask(version);
         if (res->lver == -1) {
@@ -1171,46 +1544,48 @@ py_request(PyObject *self __unused, PyObject *args, PyObject *keywds)
         }
     }
 
-    /* request sanlock resource (gil disabled) */
+    /* send the acquire request (gil disabled) */
     Py_BEGIN_ALLOW_THREADS
-    rv = sanlock_request(flags, action, res);
+    rv = sanlock_acquire_async(sanlockfd, pid, 0, 1, &res, 0, &req_id);
     Py_END_ALLOW_THREADS
 
     if (rv != 0) {
-        __set_exception(rv, "Sanlock request not submitted");
+        __set_exception(rv, "Sanlock acquire request not sent");
         goto exit_fail;
     }
 
     free(res);
-    Py_RETURN_NONE;
+    return PyLong_FromUnsignedLong(req_id);
 
 exit_fail:
     free(res);
     return NULL;
 }
 
-/* read_resource_owners */
-PyDoc_STRVAR(pydoc_read_resource_owners, "\
-read_resource_owners(lockspace, resource, disks) -> list\n\
-Returns the list of hosts owning a resource, the list is not filtered and\n\
-it might contain hosts that are currently failing or dead. The hosts are\n\
-returned in the same format used by get_hosts.\n\
+/* release_async */
+PyDoc_STRVAR(pydoc_release_async, "\
+release_async(lockspace, resource, disks, slkfd=fd [, pid=owner]) -> int\n\
+Send a release request for a resource lease on the registered sanlock\n\
+file descriptor slkfd and return the request id without waiting for the\n\
+result. When slkfd becomes readable, use async_result to get the\n\
+completion.\n\
 The disks must be in the format: [(path, offset), ... ]");
 
 static PyObject *
-py_read_resource_owners(PyObject *self __unused, PyObject *args, PyObject *keywds)
+py_release_async(PyObject *self __unused, PyObject *args, PyObject *keywds)
 {
-    int rv, hss_count = 0;
+    int rv, sanlockfd = -1, pid = -1;
     const char *lockspace, *resource;
-    struct sanlk_resource *res = NULL;
-    struct sanlk_host *hss = NULL;
-    PyObject *disks, *ls_list = NULL;
+    struct sanlk_resource *res;
+    PyObject *disks;
+    uint32_t req_id = 0;
 
-    static char *kwlist[] = {"lockspace", "resource", "disks", NULL};
+    static char *kwlist[] = {"lockspace", "resource", "disks", "slkfd",
+                                "pid", NULL};
 
     /* parse python tuple */
-    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!", kwlist,
-        &lockspace, &resource, &PyList_Type, &disks)) {
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!i|i", kwlist,
+        &lockspace, &resource, &PyList_Type, &disks, &sanlockfd, &pid)) {
         return NULL;
     }
 
@@ -1223,68 +1598,500 @@ py_read_resource_owners(PyObject *self __unused, PyObject *args, PyObject *keywd
     strncpy(res->lockspace_name, lockspace, SANLK_NAME_LEN);
     strncpy(res->name, resource, SANLK_NAME_LEN);
 
-    /* read resource owners (gil disabled) */
+    /* send the release request (gil disabled) */
     Py_BEGIN_ALLOW_THREADS
-    rv = sanlock_read_resource_owners(res, 0, &hss, &hss_count);
+    rv = sanlock_release_async(sanlockfd, pid, 0, 1, &res, &req_id);
     Py_END_ALLOW_THREADS
 
     if (rv != 0) {
-        __set_exception(rv, "Unable to read resource owners");
+        __set_exception(rv, "Sanlock release request not sent");
         goto exit_fail;
     }
 
-    ls_list = __hosts_to_list(hss, hss_count);
+    free(res);
+    return PyLong_FromUnsignedLong(req_id);
 
 exit_fail:
-    if (res) free(res);
-    if (hss) free(hss);
-    return ls_list;
+    free(res);
+    return NULL;
 }
 
-/* killpath */
-PyDoc_STRVAR(pydoc_killpath, "\
-killpath(path, args [, slkfd=fd])\n\
-Configure the path and arguments of the executable used to fence a\n\
-process either by causing the pid to exit (kill) or putting it into\n\
-a safe state (resources released).\n\
-The arguments must be in the format: [\"arg1\", \"arg2\", ...]");
+/* async_result */
+PyDoc_STRVAR(pydoc_async_result, "\
+async_result(slkfd) -> dict\n\
+Read the completion of one request sent with acquire_async or\n\
+release_async on the registered sanlock file descriptor slkfd. The call\n\
+blocks until a completion is available, so it is normally used when slkfd\n\
+is readable.\n\
+\n\
+The completion is a dictionary with the following keys:\n\
+  req_id            request id returned when sending the request (int)\n\
+  cmd               ASYNC_ACQUIRE or ASYNC_RELEASE (int)\n\
+  result            0 on success, or a negative error number (int)\n\
+  versions          lease version of each acquired resource (list)\n\
+");
 
 static PyObject *
-py_killpath(PyObject *self __unused, PyObject *args, PyObject *keywds)
+py_async_result(PyObject *self __unused, PyObject *args)
 {
-    int rv, i, j, n, num_args, sanlockfd = -1;
-    char kpargs[SANLK_HELPER_ARGS_LEN];
-    const char *p, *path;
-    PyObject *argslist, *item;
+    int rv, sanlockfd = -1;
+    uint32_t i;
+    struct sanlk_async_result ar;
+    PyObject *versions = NULL, *value = NULL, *result;
 
-    static char *kwlist[] = {"path", "args", "slkfd", NULL};
+    if (!PyArg_ParseTuple(args, "i", &sanlockfd))
+        return NULL;
 
-    /* parse python tuple */
-    if (!PyArg_ParseTupleAndKeywords(args, keywds, "sO!|i", kwlist,
-        &path, &PyList_Type, &argslist, &sanlockfd)) {
+    memset(&ar, 0, sizeof(ar));
+
+    Py_BEGIN_ALLOW_THREADS
+    rv = sanlock_async_result(sanlockfd, &ar);
+    Py_END_ALLOW_THREADS
+
+    if (rv != 0) {
+        __set_exception(rv, "Unable to get async result");
         return NULL;
     }
 
-    /* checking the path length */
-    if (strlen(path) + 1 > SANLK_HELPER_PATH_LEN) {
-        __set_exception(EINVAL, "Killpath path argument too long");
+    if ((versions = PyList_New(0)) == NULL)
         return NULL;
-    }
 
-    num_args = PyList_Size(argslist);
-    memset(kpargs, 0, SANLK_HELPER_ARGS_LEN);
+    for (i = 0; i < ar.res_count && ar.cmd == SANLK_ASYNC_ACQUIRE; i++) {
+        if ((value = PyLong_FromUnsignedLongLong(ar.lver[i])) == NULL)
+            goto exit_fail;
+        rv = PyList_Append(versions, value);
+        Py_DECREF(value);
+        if (rv != 0)
+            goto exit_fail;
+    }
 
-    /* creating the arguments string from a python list */
-    for (i = 0, n = 0; i < num_args; i++) {
-        size_t arg_len;
+    result = Py_BuildValue("{s:k,s:k,s:i,s:O}",
+                           "req_id", (unsigned long)ar.req_id,
+                           "cmd", (unsigned long)ar.cmd,
+                           "result", ar.result,
+                           "versions", versions);
+    Py_DECREF(versions);
+    return result;
 
-        item = PyList_GetItem(argslist, i);
-        p = PyString_AsString(item);
+exit_fail:
+    Py_XDECREF(versions);
+    return NULL;
+}
 
-        if (p == NULL) {
-            __set_exception(EINVAL, "Killpath argument not a string");
-            return NULL;
-        }
+/* pipeline_open */
+PyDoc_STRVAR(pydoc_pipeline_open, "\
+pipeline_open() -> int\n\
+Open a pipelined connection to the sanlock daemon and return its file\n\
+descriptor. Many requests can be outstanding on the connection at once,\n\
+and replies are read with pipeline_recv as they complete, possibly out of\n\
+order. Close the file descriptor with os.close when done.");
+
+static PyObject *
+py_pipeline_open(PyObject *self __unused, PyObject *args __unused)
+{
+    int fd;
+
+    Py_BEGIN_ALLOW_THREADS
+    fd = sanlock_pipeline_open();
+    Py_END_ALLOW_THREADS
+
+    if (fd < 0) {
+        __set_exception(fd, "Unable to open pipeline connection");
+        return NULL;
+    }
+
+    return PyInt_FromLong(fd);
+}
+
+/* pipeline_inq_lockspace */
+PyDoc_STRVAR(pydoc_pipeline_inq_lockspace, "\
+pipeline_inq_lockspace(fd, lockspace, host_id, path, offset=0) -> int\n\
+Send an inq_lockspace request on the pipelined connection fd and return\n\
+the request id. The reply result is 0 if the daemon owns the host_id,\n\
+-ENOENT if it does not, and -EINPROGRESS while the host_id is being\n\
+acquired or released.");
+
+static PyObject *
+py_pipeline_inq_lockspace(PyObject *self __unused, PyObject *args, PyObject *keywds)
+{
+    int rv, fd = -1;
+    const char *lockspace, *path;
+    struct sanlk_lockspace ls;
+    uint32_t req_id = 0;
+
+    static char *kwlist[] = {"fd", "lockspace", "host_id", "path", "offset",
+                                NULL};
+
+    /* initialize lockspace structure */
+    memset(&ls, 0, sizeof(struct sanlk_lockspace));
+
+    /* parse python tuple */
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "isks|k", kwlist,
+        &fd, &lockspace, &ls.host_id, &path, &ls.host_id_disk.offset)) {
+        return NULL;
+    }
+
+    /* prepare sanlock names */
+    strncpy(ls.name, lockspace, SANLK_NAME_LEN);
+    strncpy(ls.host_id_disk.path, path, SANLK_PATH_LEN - 1);
+
+    Py_BEGIN_ALLOW_THREADS
+    rv = sanlock_pipeline_inq_lockspace(fd, &ls, 0, &req_id);
+    Py_END_ALLOW_THREADS
+
+    if (rv != 0) {
+        __set_exception(rv, "Sanlock inq_lockspace request not sent");
+        return NULL;
+    }
+
+    return PyLong_FromUnsignedLong(req_id);
+}
+
+/* pipeline_recv */
+PyDoc_STRVAR(pydoc_pipeline_recv, "\
+pipeline_recv(fd) -> dict\n\
+Read the next reply from the pipelined connection fd. The call blocks\n\
+until a reply is available, so it is normally used when fd is readable.\n\
+\n\
+The reply is a dictionary with the following keys:\n\
+  req_id            request id returned when sending the request (int)\n\
+  result            result of the request (int)\n\
+  data              reply data (bytearray)\n\
+");
+
+static PyObject *
+py_pipeline_recv(PyObject *self __unused, PyObject *args)
+{
+    int rv, fd = -1;
+    struct sanlk_pipeline_reply rep;
+    char *data = NULL;
+    PyObject *buf, *result;
+
+    if (!PyArg_ParseTuple(args, "i", &fd))
+        return NULL;
+
+    memset(&rep, 0, sizeof(rep));
+
+    Py_BEGIN_ALLOW_THREADS
+    rv = sanlock_pipeline_recv(fd, &rep, &data);
+    Py_END_ALLOW_THREADS
+
+    if (rv != 0) {
+        __set_exception(rv, "Unable to get pipeline reply");
+        return NULL;
+    }
+
+    buf = PyByteArray_FromStringAndSize(data ? data : "",
+                                        data ? rep.data_len : 0);
+    free(data);
+
+    if (buf == NULL)
+        return NULL;
+
+    result = Py_BuildValue("{s:k,s:i,s:O}",
+                           "req_id", (unsigned long)rep.req_id,
+                           "result", rep.result,
+                           "data", buf);
+    Py_DECREF(buf);
+    return result;
+}
+
+/* request */
+PyDoc_STRVAR(pydoc_request, "\
+request(lockspace, resource, disks [, action=REQ_GRACEFUL, version=None])\n\
+Request the owner of a resource to do something specified by action.\n\
+The possible values for action are: REQ_GRACEFUL to request a graceful\n\
+release of the resource, REQ_FORCE to sigkill the owner of the\n\
+resource (forcible release) and REQ_HANDOFF to have the owner hand the\n\
+resource to this host when it releases it. The version should be either the next version\n\
+to acquire or None (which automatically uses the next version).\n\
+The disks must be in the format: [(path, offset), ... ]");
+
+static PyObject *
+py_request(PyObject *self __unused, PyObject *args, PyObject *keywds)
+{
+    int rv, action = SANLK_REQ_GRACEFUL, flags = 0;
+    const char *lockspace, *resource;
+    struct sanlk_resource *res;
+    PyObject *disks, *version = Py_None;
+
+    static char *kwlist[] = {"lockspace", "resource", "disks", "action",
+                                "version", NULL};
+
+    /* parse python tuple */
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!|iO", kwlist,
+        &lockspace, &resource, &PyList_Type, &disks, &action, &version)) {
+        return NULL;
+    }
+
+    /* parse and check sanlock resource */
+    if (__parse_resource(disks, &res) < 0) {
+        return NULL;
+    }
+
+    /* prepare sanlock names */
+    strncpy(res->lockspace_name, lockspace, SANLK_NAME_LEN);
+    strncpy(res->name, resource, SANLK_NAME_LEN);
+
+    /* prepare the resource version */
+    if (version == Py_None) {
+        flags = SANLK_REQUEST_NEXT_LVER;
+    } else {
+        res->flags |= SANLK_RES_LVER;
+        res->lver = PyInt_AsUnsignedLongMask(version);
+        if (res->lver == -1) {
+            __set_exception(EINVAL, "Unable to convert the version value");
+            goto exit_fail;
+        }
+    }
+
+    /* request sanlock resource (gil disabled) */
+    Py_BEGIN_ALLOW_THREADS
+    rv = sanlock_request(flags, action, res);
+    Py_END_ALLOW_THREADS
+
+    if (rv != 0) {
+        __set_exception(rv, "Sanlock request not submitted");
+        goto exit_fail;
+    }
+
+    free(res);
+    Py_RETURN_NONE;
+
+exit_fail:
+    free(res);
+    return NULL;
+}
+
+/* read_resource_owners */
+PyDoc_STRVAR(pydoc_read_resource_owners, "\
+read_resource_owners(lockspace, resource, disks) -> list\n\
+Returns the list of hosts owning a resource, the list is not filtered and\n\
+it might contain hosts that are currently failing or dead. The hosts are\n\
+returned in the same format used by get_hosts.\n\
+The disks must be in the format: [(path, offset), ... ]");
+
+static PyObject *
+py_read_resource_owners(PyObject *self __unused, PyObject *args, PyObject *keywds)
+{
+    int rv, hss_count = 0;
+    const char *lockspace, *resource;
+    struct sanlk_resource *res = NULL;
+    struct sanlk_host *hss = NULL;
+    PyObject *disks, *ls_list = NULL;
+
+    static char *kwlist[] = {"lockspace", "resource", "disks", NULL};
+
+    /* parse python tuple */
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!", kwlist,
+        &lockspace, &resource, &PyList_Type, &disks)) {
+        return NULL;
+    }
+
+    /* parse and check sanlock resource */
+    if (__parse_resource(disks, &res) < 0) {
+        return NULL;
+    }
+
+    /* prepare sanlock names */
+    strncpy(res->lockspace_name, lockspace, SANLK_NAME_LEN);
+    strncpy(res->name, resource, SANLK_NAME_LEN);
+
+    /* read resource owners (gil disabled) */
+    Py_BEGIN_ALLOW_THREADS
+    rv = sanlock_read_resource_owners(res, 0, &hss, &hss_count);
+    Py_END_ALLOW_THREADS
+
+    if (rv != 0) {
+        __set_exception(rv, "Unable to read resource owners");
+        goto exit_fail;
+    }
+
+    ls_list = __hosts_to_list(hss, hss_count);
+
+exit_fail:
+    if (res) free(res);
+    if (hss) free(hss);
+    return ls_list;
+}
+
+/* read_resource_owners_bulk */
+PyDoc_STRVAR(pydoc_read_resource_owners_bulk, "\
+read_resource_owners_bulk(resources) -> (bytearray, bytearray)\n\
+Return the owners of each resource in the resources list, as\n\
+read_resource_owners does, without creating an object per host. Each\n\
+resource is a (lockspace, resource, disks) tuple, and the daemon reads\n\
+the resources concurrently. The buffers have the same format as those of\n\
+get_hosts_bulk, with an int32 count (or negative error) per resource.\n\
+The disks must be in the format: [(path, offset), ... ]");
+
+/* requests outstanding at once on the pipelined connection */
+#define BULK_OWNERS_WINDOW 32
+
+static PyObject *
+py_read_resource_owners_bulk(PyObject *self __unused, PyObject *args)
+{
+    int i, n, fd = -1, rv = 0, sent = 0, done = 0;
+    const char *lockspace, *resource;
+    PyObject *resources, *item, *disks, *result = NULL;
+    struct sanlk_resource **res = NULL;
+    struct sanlk_pipeline_reply rep;
+    struct sanlk_host **hss = NULL;
+    char **data = NULL;
+    uint32_t *req_ids = NULL;
+    int32_t *counts = NULL;
+    char *buf;
+
+    if (!PyArg_ParseTuple(args, "O!", &PyList_Type, &resources))
+        return NULL;
+
+    n = PyList_Size(resources);
+
+    res = calloc(n + 1, sizeof(struct sanlk_resource *));
+    hss = calloc(n + 1, sizeof(struct sanlk_host *));
+    data = calloc(n + 1, sizeof(char *));
+    req_ids = calloc(n + 1, sizeof(uint32_t));
+    counts = calloc(n + 1, sizeof(int32_t));
+
+    if (!res || !hss || !data || !req_ids || !counts) {
+        PyErr_NoMemory();
+        goto exit_fail;
+    }
+
+    for (i = 0; i < n; i++) {
+        item = PyList_GetItem(resources, i);
+
+        if (!PyTuple_Check(item) ||
+            !PyArg_ParseTuple(item, "ssO!", &lockspace, &resource,
+                              &PyList_Type, &disks)) {
+            PyErr_Clear();
+            __set_exception(EINVAL, "Invalid resource tuple");
+            goto exit_fail;
+        }
+
+        /* parse and check sanlock resource */
+        if (__parse_resource(disks, &res[i]) < 0)
+            goto exit_fail;
+
+        strncpy(res[i]->lockspace_name, lockspace, SANLK_NAME_LEN);
+        strncpy(res[i]->name, resource, SANLK_NAME_LEN);
+    }
+
+    /* read the owners of all the resources (gil disabled) */
+    Py_BEGIN_ALLOW_THREADS
+    if (n)
+        fd = sanlock_pipeline_open();
+
+    if (fd < 0 && n)
+        rv = fd;
+
+    while (!rv && done < n) {
+        if (sent < n && sent - done < BULK_OWNERS_WINDOW) {
+            rv = sanlock_pipeline_read_resource_owners(fd, res[sent], 0,
+                                                       &req_ids[sent]);
+            sent++;
+            continue;
+        }
+
+        buf = NULL;
+        rv = sanlock_pipeline_recv(fd, &rep, &buf);
+        if (rv < 0)
+            break;
+
+        for (i = 0; i < sent; i++) {
+            if (req_ids[i] == rep.req_id)
+                break;
+        }
+
+        if (i == sent) {
+            free(buf);
+            continue;
+        }
+
+        if (rep.result < 0) {
+            counts[i] = rep.result;
+        } else if (buf && rep.data_len >= sizeof(struct sanlk_resource) +
+                   rep.data2 * sizeof(struct sanlk_host)) {
+            hss[i] = (struct sanlk_host *)(buf + sizeof(struct sanlk_resource));
+            counts[i] = rep.data2;
+        }
+
+        /* req ids are nonzero, clearing it marks the resource done */
+        req_ids[i] = 0;
+        data[i] = buf;
+        done++;
+    }
+
+    if (fd >= 0)
+        close(fd);
+    Py_END_ALLOW_THREADS
+
+    if (rv < 0) {
+        __set_exception(rv, "Unable to read resource owners");
+        goto exit_fail;
+    }
+
+    result = __hosts_to_buffers(hss, counts, n);
+
+exit_fail:
+    for (i = 0; i < n; i++) {
+        if (data)
+            free(data[i]);
+        if (res)
+            free(res[i]);
+    }
+    free(res);
+    free(hss);
+    free(data);
+    free(req_ids);
+    free(counts);
+    return result;
+}
+
+/* killpath */
+PyDoc_STRVAR(pydoc_killpath, "\
+killpath(path, args [, slkfd=fd])\n\
+Configure the path and arguments of the executable used to fence a\n\
+process either by causing the pid to exit (kill) or putting it into\n\
+a safe state (resources released).\n\
+The arguments must be in the format: [\"arg1\", \"arg2\", ...]");
+
+static PyObject *
+py_killpath(PyObject *self __unused, PyObject *args, PyObject *keywds)
+{
+    int rv, i, j, n, num_args, sanlockfd = -1;
+    char kpargs[SANLK_HELPER_ARGS_LEN];
+    const char *p, *path;
+    PyObject *argslist, *item;
+
+    static char *kwlist[] = {"path", "args", "slkfd", NULL};
+
+    /* parse python tuple */
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "sO!|i", kwlist,
+        &path, &PyList_Type, &argslist, &sanlockfd)) {
+        return NULL;
+    }
+
+    /* checking the path length */
+    if (strlen(path) + 1 > SANLK_HELPER_PATH_LEN) {
+        __set_exception(EINVAL, "Killpath path argument too long");
+        return NULL;
+    }
+
+    num_args = PyList_Size(argslist);
+    memset(kpargs, 0, SANLK_HELPER_ARGS_LEN);
+
+    /* creating the arguments string from a python list */
+    for (i = 0, n = 0; i < num_args; i++) {
+        size_t arg_len;
+
+        item = PyList_GetItem(argslist, i);
+        p = PyString_AsString(item);
+
+        if (p == NULL) {
+            __set_exception(EINVAL, "Killpath argument not a string");
+            return NULL;
+        }
 
         /* computing the argument length considering the escape chars */
         for (j = 0, arg_len = 0; p[j]; j++, arg_len++) {
@@ -1343,23 +2150,72 @@ py_exception_errno(PyObject *self, PyBaseExceptionObject *exc_obj)
 
 /* reg_event */
 PyDoc_STRVAR(pydoc_reg_event, "\
-reg_event(lockspace) -> int\n\
+reg_event(lockspace, event_mask=0, generation=0, host_ids=None) -> int\n\
 Register an event listener for lockspace and return an open file descriptor\n\
 for waiting for lockspace events. When the file descriptor becomes readable,\n\
 you can use get_event to get pending events. When you are done, you must\n\
-unregister the event listener using end_event.");
+unregister the event listener using end_event.\n\
+The daemon only sends the events matching the optional filter:\n\
+  event_mask        events with any of these bits set (0 for all)\n\
+  generation        events for this generation of my host id (0 for all)\n\
+  host_ids          list of host ids sending the events (None for all)");
 
 static PyObject *
-py_reg_event(PyObject *self __unused, PyObject *args)
+py_reg_event(PyObject *self __unused, PyObject *args, PyObject *keywds)
 {
     const char *lockspace = NULL;
+    unsigned long long event_mask = 0;
+    unsigned long long generation = 0;
+    PyObject *host_ids = Py_None;
+    PyObject *item;
+    struct sanlk_event_filter ef;
+    Py_ssize_t i, num;
+    long host_id;
     int fd = -1;
 
-    if (!PyArg_ParseTuple(args, "s", &lockspace))
+    static char *kwlist[] = {"lockspace", "event_mask", "generation",
+                                "host_ids", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "s|KKO", kwlist,
+        &lockspace, &event_mask, &generation, &host_ids)) {
         return NULL;
+    }
+
+    memset(&ef, 0, sizeof(ef));
+    ef.event_mask = event_mask;
+    ef.generation = generation;
+
+    if (host_ids != Py_None) {
+        if (!PyList_Check(host_ids)) {
+            __set_exception(EINVAL, "Invalid host_ids, expected list");
+            return NULL;
+        }
+
+        num = PyList_Size(host_ids);
+
+        for (i = 0; i < num; i++) {
+            item = PyList_GetItem(host_ids, i);
+            host_id = PyLong_AsLong(item);
+
+            if (host_id == -1 && PyErr_Occurred())
+                return NULL;
+
+            if (host_id < 1 || host_id > (long)sizeof(ef.host_ids) * 8) {
+                __set_exception(EINVAL, "Invalid host_id in host_ids");
+                return NULL;
+            }
+
+            ef.host_ids[(host_id - 1) / 8] |= 1 << ((host_id - 1) % 8);
+        }
+
+        ef.flags |= SANLK_EVF_HOST_IDS;
+    }
 
     Py_BEGIN_ALLOW_THREADS
-    fd = sanlock_reg_event(lockspace, NULL /* event */, 0 /* flags */);
+    if (!ef.event_mask && !ef.generation && !ef.flags)
+        fd = sanlock_reg_event(lockspace, NULL /* event */, 0 /* flags */);
+    else
+        fd = sanlock_reg_event_filter(lockspace, &ef, 0 /* flags */);
     Py_END_ALLOW_THREADS
 
     if (fd < 0) {
@@ -1388,13 +2244,13 @@ static PyObject *
 py_get_event(PyObject *self __unused, PyObject *args)
 {
     int fd = -1;
-    struct sanlk_host_event he;
-    uint64_t from_host_id;
-    uint64_t from_generation;
+    struct sanlk_event_rec recs[64];
+    struct sanlk_event_rec *rec;
     PyObject *events = NULL;
     PyObject *item = NULL;
     PyObject *value = NULL;
-    int rv;
+    int count = 0;
+    int i, rv;
 
     if (!PyArg_ParseTuple(args, "i", &fd))
         return NULL;
@@ -1404,7 +2260,7 @@ py_get_event(PyObject *self __unused, PyObject *args)
 
     for (;;) {
         Py_BEGIN_ALLOW_THREADS
-        rv = sanlock_get_event(fd, 0, &he, &from_host_id, &from_generation);
+        rv = sanlock_get_events(fd, 0, recs, 64, &count);
         Py_END_ALLOW_THREADS
 
         if (rv == -EAGAIN)
@@ -1415,62 +2271,66 @@ py_get_event(PyObject *self __unused, PyObject *args)
             goto exit_fail;
         }
 
-        if ((item = PyDict_New()) == NULL)
-            goto exit_fail;
+        for (i = 0; i < count; i++) {
+            rec = &recs[i];
 
-        /* from_host_id */
-        if ((value = PyLong_FromUnsignedLongLong(from_host_id)) == NULL)
-            goto exit_fail;
-        rv = PyDict_SetItemString(item, "from_host_id", value);
-        Py_DECREF(value);
-        if (rv != 0)
-            goto exit_fail;
+            if ((item = PyDict_New()) == NULL)
+                goto exit_fail;
 
-        /* from_generation */
-        if ((value = PyLong_FromUnsignedLongLong(from_generation)) == NULL)
-            goto exit_fail;
-        rv = PyDict_SetItemString(item, "from_generation", value);
-        Py_DECREF(value);
-        if (rv != 0)
-            goto exit_fail;
+            /* from_host_id */
+            if ((value = PyLong_FromUnsignedLongLong(rec->from_host_id)) == NULL)
+                goto exit_fail;
+            rv = PyDict_SetItemString(item, "from_host_id", value);
+            Py_DECREF(value);
+            if (rv != 0)
+                goto exit_fail;
 
-        /* host_id */
-        if ((value = PyLong_FromUnsignedLongLong(he.host_id)) == NULL)
-            goto exit_fail;
-        rv = PyDict_SetItemString(item, "host_id", value);
-        Py_DECREF(value);
-        if (rv != 0)
-            goto exit_fail;
+            /* from_generation */
+            if ((value = PyLong_FromUnsignedLongLong(rec->from_generation)) == NULL)
+                goto exit_fail;
+            rv = PyDict_SetItemString(item, "from_generation", value);
+            Py_DECREF(value);
+            if (rv != 0)
+                goto exit_fail;
 
-        /* generation */
-        if ((value = PyLong_FromUnsignedLongLong(he.generation)) == NULL)
-            goto exit_fail;
-        rv = PyDict_SetItemString(item, "generation", value);
-        Py_DECREF(value);
-        if (rv != 0)
-            goto exit_fail;
+            /* host_id */
+            if ((value = PyLong_FromUnsignedLongLong(rec->he.host_id)) == NULL)
+                goto exit_fail;
+            rv = PyDict_SetItemString(item, "host_id", value);
+            Py_DECREF(value);
+            if (rv != 0)
+                goto exit_fail;
 
-        /* event */
-        if ((value = PyLong_FromUnsignedLongLong(he.event)) == NULL)
-            goto exit_fail;
-        rv = PyDict_SetItemString(item, "event", value);
-        Py_DECREF(value);
-        if (rv != 0)
-            goto exit_fail;
+            /* generation */
+            if ((value = PyLong_FromUnsignedLongLong(rec->he.generation)) == NULL)
+                goto exit_fail;
+            rv = PyDict_SetItemString(item, "generation", value);
+            Py_DECREF(value);
+            if (rv != 0)
+                goto exit_fail;
 
-        /* data */
-        if ((value = PyLong_FromUnsignedLongLong(he.data)) == NULL)
-            goto exit_fail;
-        rv = PyDict_SetItemString(item, "data", value);
-        Py_DECREF(value);
-        if (rv != 0)
-            goto exit_fail;
+            /* event */
+            if ((value = PyLong_FromUnsignedLongLong(rec->he.event)) == NULL)
+                goto exit_fail;
+            rv = PyDict_SetItemString(item, "event", value);
+            Py_DECREF(value);
+            if (rv != 0)
+                goto exit_fail;
 
-        if (PyList_Append(events, item) != 0)
-            goto exit_fail;
+            /* data */
+            if ((value = PyLong_FromUnsignedLongLong(rec->he.data)) == NULL)
+                goto exit_fail;
+            rv = PyDict_SetItemString(item, "data", value);
+            Py_DECREF(value);
+            if (rv != 0)
+                goto exit_fail;
+
+            if (PyList_Append(events, item) != 0)
+                goto exit_fail;
 
-        Py_DECREF(item);
-        item = NULL;
+            Py_DECREF(item);
+            item = NULL;
+        }
     }
 
     return events;
@@ -1589,6 +2449,268 @@ py_set_event(PyObject *self __unused, PyObject *args, PyObject *keywds)
     Py_RETURN_NONE;
 }
 
+/*
+ * Resource objects hold a sanlk_resource that is parsed and checked once,
+ * and is then passed as is to each acquire and release of the lease.
+ */
+
+typedef struct {
+    PyObject_HEAD
+    struct sanlk_resource *res;
+} ResourceObject;
+
+static void
+resource_dealloc(ResourceObject *self)
+{
+    free(self->res);
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static int
+resource_init(ResourceObject *self, PyObject *args, PyObject *keywds)
+{
+    int shared = 0;
+    const char *lockspace, *resource;
+    struct sanlk_resource *res;
+    PyObject *disks;
+
+    static char *kwlist[] = {"lockspace", "resource", "disks", "shared", NULL};
+
+    /* parse python tuple */
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "ssO!|i", kwlist,
+        &lockspace, &resource, &PyList_Type, &disks, &shared)) {
+        return -1;
+    }
+
+    if (strlen(lockspace) > SANLK_NAME_LEN || strlen(resource) > SANLK_NAME_LEN) {
+        PyErr_SetString(PyExc_ValueError, "Invalid lockspace or resource name");
+        return -1;
+    }
+
+    if (PyList_Size(disks) < 1 || PyList_Size(disks) > SANLK_MAX_DISKS) {
+        PyErr_SetString(PyExc_ValueError, "Invalid number of disks");
+        return -1;
+    }
+
+    /* parse and check sanlock resource */
+    if (__parse_resource(disks, &res) < 0) {
+        return -1;
+    }
+
+    /* prepare sanlock names */
+    strncpy(res->lockspace_name, lockspace, SANLK_NAME_LEN);
+    strncpy(res->name, resource, SANLK_NAME_LEN);
+
+    /* prepare sanlock flags */
+    if (shared) {
+        res->flags |= SANLK_RES_SHARED;
+    }
+
+    free(self->res);
+    self->res = res;
+    return 0;
+}
+
+/* Resource.acquire */
+PyDoc_STRVAR(pydoc_resource_acquire, "\
+acquire([slkfd=fd, pid=owner, version=None])\n\
+Acquire the resource lease, as acquire() does with the lockspace,\n\
+resource, disks and shared values of the Resource.");
+
+static PyObject *
+resource_acquire(ResourceObject *self, PyObject *args, PyObject *keywds)
+{
+    int rv, sanlockfd = -1, pid = -1;
+    char buf[sizeof(struct sanlk_resource) +
+             SANLK_MAX_DISKS * sizeof(struct sanlk_disk)];
+    struct sanlk_resource *res = self->res;
+    PyObject *version = Py_None;
+
+    static char *kwlist[] = {"slkfd", "pid", "version", NULL};
+
+    /* parse python tuple */
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "|iiO", kwlist,
+        &sanlockfd, &pid, &version)) {
+        return NULL;
+    }
+
+    /* check if any of the slkfd or pid parameters was given */
+    if (sanlockfd == -1 && pid == -1) {
+        __set_exception(EINVAL, "Invalid slkfd and pid values");
+        return NULL;
+    }
+
+    /* the version is set in a copy, so the Resource itself is
+       never changed and can be used from several threads */
+    if (version != Py_None) {
+        memcpy(buf, self->res, sizeof(struct sanlk_resource) +
+               self->res->num_disks * sizeof(struct sanlk_disk));
+        res = (struct sanlk_resource *) buf;
+        res->flags |= SANLK_RES_LVER;
+        res->lver = PyInt_AsUnsignedLongMask(version);
+        if (res->lver == -1) {
+            __set_exception(EINVAL, "Unable to convert the version value");
+            return NULL;
+        }
+    }
+
+    /* acquire sanlock resource (gil disabled) */
+    Py_BEGIN_ALLOW_THREADS
+    rv = sanlock_acquire(sanlockfd, pid, 0, 1, &res, 0);
+    Py_END_ALLOW_THREADS
+
+    if (rv != 0) {
+        __set_exception(rv, "Sanlock resource not acquired");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+/* Resource.release */
+PyDoc_STRVAR(pydoc_resource_release, "\
+release([slkfd=fd, pid=owner])\n\
+Release the resource lease, as release() does with the lockspace,\n\
+resource and disks values of the Resource.");
+
+static PyObject *
+resource_release(ResourceObject *self, PyObject *args, PyObject *keywds)
+{
+    int rv, sanlockfd = -1, pid = -1;
+    struct sanlk_resource *res = self->res;
+
+    static char *kwlist[] = {"slkfd", "pid", NULL};
+
+    /* parse python tuple */
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "|ii", kwlist,
+        &sanlockfd, &pid)) {
+        return NULL;
+    }
+
+    /* release sanlock resource (gil disabled) */
+    Py_BEGIN_ALLOW_THREADS
+    rv = sanlock_release(sanlockfd, pid, 0, 1, &res);
+    Py_END_ALLOW_THREADS
+
+    if (rv != 0) {
+        __set_exception(rv, "Sanlock resource not released");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+resource_get_lockspace(ResourceObject *self, void *closure __unused)
+{
+    return PyString_FromStringAndSize(self->res->lockspace_name,
+                strnlen(self->res->lockspace_name, SANLK_NAME_LEN));
+}
+
+static PyObject *
+resource_get_name(ResourceObject *self, void *closure __unused)
+{
+    return PyString_FromStringAndSize(self->res->name,
+                strnlen(self->res->name, SANLK_NAME_LEN));
+}
+
+static PyObject *
+resource_get_disks(ResourceObject *self, void *closure __unused)
+{
+    int i;
+    PyObject *list, *disk;
+
+    if ((list = PyList_New(0)) == NULL)
+        return NULL;
+
+    for (i = 0; i < self->res->num_disks; i++) {
+        disk = Py_BuildValue("(sK)", self->res->disks[i].path,
+                             (unsigned long long) self->res->disks[i].offset);
+        if (disk == NULL || PyList_Append(list, disk) != 0) {
+            Py_XDECREF(disk);
+            Py_DECREF(list);
+            return NULL;
+        }
+        Py_DECREF(disk);
+    }
+
+    return list;
+}
+
+static PyObject *
+resource_get_shared(ResourceObject *self, void *closure __unused)
+{
+    return PyBool_FromLong(self->res->flags & SANLK_RES_SHARED);
+}
+
+static PyMethodDef
+resource_methods[] = {
+    {"acquire", (PyCFunction) resource_acquire,
+                METH_VARARGS|METH_KEYWORDS, pydoc_resource_acquire},
+    {"release", (PyCFunction) resource_release,
+                METH_VARARGS|METH_KEYWORDS, pydoc_resource_release},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef
+resource_getset[] = {
+    {"lockspace", (getter) resource_get_lockspace, NULL, "lockspace name", NULL},
+    {"resource", (getter) resource_get_name, NULL, "resource name", NULL},
+    {"disks", (getter) resource_get_disks, NULL, "[(path, offset), ... ]", NULL},
+    {"shared", (getter) resource_get_shared, NULL, "shared mode", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+/* Resource */
+PyDoc_STRVAR(pydoc_resource, "\
+Resource(lockspace, resource, disks [, shared=False])\n\
+A resource lease whose names and disks are checked once when it is\n\
+created, and are then used by each Resource.acquire and\n\
+Resource.release without being parsed again.\n\
+The disks must be in the format: [(path, offset), ... ]");
+
+static PyTypeObject
+ResourceType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "sanlock.Resource",                 /* tp_name */
+    sizeof(ResourceObject),             /* tp_basicsize */
+    0,                                  /* tp_itemsize */
+    (destructor) resource_dealloc,      /* tp_dealloc */
+    0,                                  /* tp_print */
+    0,                                  /* tp_getattr */
+    0,                                  /* tp_setattr */
+    0,                                  /* tp_compare */
+    0,                                  /* tp_repr */
+    0,                                  /* tp_as_number */
+    0,                                  /* tp_as_sequence */
+    0,                                  /* tp_as_mapping */
+    0,                                  /* tp_hash */
+    0,                                  /* tp_call */
+    0,                                  /* tp_str */
+    0,                                  /* tp_getattro */
+    0,                                  /* tp_setattro */
+    0,                                  /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                 /* tp_flags */
+    pydoc_resource,                     /* tp_doc */
+    0,                                  /* tp_traverse */
+    0,                                  /* tp_clear */
+    0,                                  /* tp_richcompare */
+    0,                                  /* tp_weaklistoffset */
+    0,                                  /* tp_iter */
+    0,                                  /* tp_iternext */
+    resource_methods,                   /* tp_methods */
+    0,                                  /* tp_members */
+    resource_getset,                    /* tp_getset */
+    0,                                  /* tp_base */
+    0,                                  /* tp_dict */
+    0,                                  /* tp_descr_get */
+    0,                                  /* tp_descr_set */
+    0,                                  /* tp_dictoffset */
+    (initproc) resource_init,           /* tp_init */
+    0,                                  /* tp_alloc */
+    PyType_GenericNew,                  /* tp_new */
+};
+
 static PyMethodDef
 sanlock_methods[] = {
     {"register", py_register, METH_NOARGS, pydoc_register},
@@ -1615,17 +2737,34 @@ sanlock_methods[] = {
                         METH_VARARGS|METH_KEYWORDS, pydoc_get_lockspaces},
     {"get_hosts", (PyCFunction) py_get_hosts,
                         METH_VARARGS|METH_KEYWORDS, pydoc_get_hosts},
+    {"get_hosts_bulk", py_get_hosts_bulk, METH_VARARGS, pydoc_get_hosts_bulk},
+    {"get_stats", (PyCFunction) py_get_stats,
+                        METH_VARARGS|METH_KEYWORDS, pydoc_get_stats},
+    {"get_state", (PyCFunction) py_get_state,
+                        METH_VARARGS|METH_KEYWORDS, pydoc_get_state},
     {"read_resource_owners", (PyCFunction) py_read_resource_owners,
                 METH_VARARGS|METH_KEYWORDS, pydoc_read_resource_owners},
+    {"read_resource_owners_bulk", py_read_resource_owners_bulk,
+                METH_VARARGS, pydoc_read_resource_owners_bulk},
     {"acquire", (PyCFunction) py_acquire,
                 METH_VARARGS|METH_KEYWORDS, pydoc_acquire},
     {"release", (PyCFunction) py_release,
                 METH_VARARGS|METH_KEYWORDS, pydoc_release},
+    {"acquire_async", (PyCFunction) py_acquire_async,
+                METH_VARARGS|METH_KEYWORDS, pydoc_acquire_async},
+    {"release_async", (PyCFunction) py_release_async,
+                METH_VARARGS|METH_KEYWORDS, pydoc_release_async},
+    {"async_result", py_async_result, METH_VARARGS, pydoc_async_result},
+    {"pipeline_open", py_pipeline_open, METH_NOARGS, pydoc_pipeline_open},
+    {"pipeline_inq_lockspace", (PyCFunction) py_pipeline_inq_lockspace,
+                METH_VARARGS|METH_KEYWORDS, pydoc_pipeline_inq_lockspace},
+    {"pipeline_recv", py_pipeline_recv, METH_VARARGS, pydoc_pipeline_recv},
     {"request", (PyCFunction) py_request,
                 METH_VARARGS|METH_KEYWORDS, pydoc_request},
     {"killpath", (PyCFunction) py_killpath,
                 METH_VARARGS|METH_KEYWORDS, pydoc_killpath},
-    {"reg_event", (PyCFunction) py_reg_event, METH_VARARGS, pydoc_reg_event},
+    {"reg_event", (PyCFunction) py_reg_event,
+                        METH_VARARGS|METH_KEYWORDS, pydoc_reg_event},
     {"get_event", (PyCFunction) py_get_event, METH_VARARGS, pydoc_get_event},
     {"end_event", (PyCFunction) py_end_event, METH_VARARGS, pydoc_end_event},
     {"set_event", (PyCFunction) py_set_event,
@@ -1691,6 +2830,15 @@ initsanlock(void)
         return;
     }
 
+    if (PyType_Ready(&ResourceType) < 0)
+        return;
+
+    Py_INCREF(&ResourceType);
+    if (PyModule_AddObject(py_module, "Resource", (PyObject *) &ResourceType)) {
+        Py_DECREF(&ResourceType);
+        return;
+    }
+
 #define PYSNLK_INIT_ADD_CONSTANT(x, y) \
     if ((sk_constant = PyInt_FromLong(x)) != NULL) { \
         if (PyModule_AddObject(py_module, y, sk_constant)) { \
@@ -1705,6 +2853,11 @@ initsanlock(void)
     /* resource request flags */
     PYSNLK_INIT_ADD_CONSTANT(SANLK_REQ_FORCE, "REQ_FORCE");
     PYSNLK_INIT_ADD_CONSTANT(SANLK_REQ_GRACEFUL, "REQ_GRACEFUL");
+    PYSNLK_INIT_ADD_CONSTANT(SANLK_REQ_HANDOFF, "REQ_HANDOFF");
+
+    /* async request commands */
+    PYSNLK_INIT_ADD_CONSTANT(SANLK_ASYNC_ACQUIRE, "ASYNC_ACQUIRE");
+    PYSNLK_INIT_ADD_CONSTANT(SANLK_ASYNC_RELEASE, "ASYNC_RELEASE");
 
     /* hosts list flags */
     PYSNLK_INIT_ADD_CONSTANT(SANLK_HOST_FREE, "HOST_FREE");
@@ -1720,6 +2873,19 @@ initsanlock(void)
     PYSNLK_INIT_ADD_CONSTANT(SANLK_SETEV_REPLACE_EVENT,  "SETEV_REPLACE_EVENT");
     PYSNLK_INIT_ADD_CONSTANT(SANLK_SETEV_ALL_HOSTS,      "SETEV_ALL_HOSTS");
 
+    /* i/o stats types */
+    PYSNLK_INIT_ADD_CONSTANT(SANLK_IO_DELTA_READ,   "IO_DELTA_READ");
+    PYSNLK_INIT_ADD_CONSTANT(SANLK_IO_DELTA_WRITE,  "IO_DELTA_WRITE");
+    PYSNLK_INIT_ADD_CONSTANT(SANLK_IO_LEADER_READ,  "IO_LEADER_READ");
+    PYSNLK_INIT_ADD_CONSTANT(SANLK_IO_LEADER_WRITE, "IO_LEADER_WRITE");
+    PYSNLK_INIT_ADD_CONSTANT(SANLK_IO_DBLOCK_READ,  "IO_DBLOCK_READ");
+    PYSNLK_INIT_ADD_CONSTANT(SANLK_IO_DBLOCK_WRITE, "IO_DBLOCK_WRITE");
+    PYSNLK_INIT_ADD_CONSTANT(SANLK_IO_MBLOCK_WRITE, "IO_MBLOCK_WRITE");
+    PYSNLK_INIT_ADD_CONSTANT(SANLK_IO_LVB_READ,     "IO_LVB_READ");
+    PYSNLK_INIT_ADD_CONSTANT(SANLK_IO_LVB_WRITE,    "IO_LVB_WRITE");
+    PYSNLK_INIT_ADD_CONSTANT(SANLK_IO_OTHER_READ,   "IO_OTHER_READ");
+    PYSNLK_INIT_ADD_CONSTANT(SANLK_IO_OTHER_WRITE,  "IO_OTHER_WRITE");
+
     /* Sector and align size flags */
     PYSNLK_INIT_ADD_CONSTANT(SANLK_RES_SECTOR512, "SECTOR512");
     PYSNLK_INIT_ADD_CONSTANT(SANLK_RES_SECTOR4K, "SECTOR4K");
@@ -1730,6 +2896,13 @@ initsanlock(void)
 
 #undef PYSNLK_INIT_ADD_CONSTANT
 
+    /* Record formats of the get_hosts_bulk and read_resource_owners_bulk
+       buffers, for the struct module and numpy */
+    if (PyModule_AddStringConstant(py_module, "HOST_RECORD_FORMAT", "=QQQII"))
+        return;
+    if (PyModule_AddStringConstant(py_module, "HOST_COUNT_FORMAT", "=i"))
+        return;
+
     /* Tuples with supported sector size and alignment values */
     PyObject *sector = Py_BuildValue("ii", SECTOR_SIZE_512, SECTOR_SIZE_4K);
     if (!sector)
@@ -0,0 +1,225 @@
+# Copyright 2026 Red Hat, Inc.
+#
+# This copyrighted material is made available to anyone wishing to use,
+# modify, copy, or redistribute it subject to the terms and conditions
+# of the GNU General Public License v.2.
+
+"""
+asyncio support for the sanlock python binding.
+
+Client sends acquire and release requests on a registered sanlock fd, and
+Pipeline sends inq_lockspace requests on a pipelined connection.  Both
+watch their fd with the event loop and complete an asyncio.Future for each
+request, so many lease operations can be outstanding from a single thread:
+
+    client = sanlock_aio.Client()
+    versions = await client.acquire("ls_name", "res_name", disks)
+    await client.release("ls_name", "res_name", disks)
+
+    pipeline = sanlock_aio.Pipeline()
+    await pipeline.add_lockspace("ls_name", 1, path)
+"""
+
+import asyncio
+import errno
+import os
+
+import sanlock
+
+
+def _exception(result, msg):
+    # Same errno and err_name as the exceptions raised by the sync api.
+    if -200 < result < 0:
+        return sanlock.SanlockException(-result, msg, os.strerror(-result))
+    return sanlock.SanlockException(result, msg, "Sanlock error %d" % result)
+
+
+class _Connection(object):
+
+    def __init__(self, fd, loop):
+        self._fd = fd
+        self._loop = loop
+        self._pending = {}
+        self._loop.add_reader(self._fd, self._readable)
+
+    def fileno(self):
+        return self._fd
+
+    def close(self):
+        """
+        Stop watching and close the fd, failing the outstanding requests.
+        """
+        if self._fd == -1:
+            return
+        self._loop.remove_reader(self._fd)
+        os.close(self._fd)
+        self._fd = -1
+        self._fail_pending(errno.ENOTCONN)
+
+    def _add_request(self, req_id, msg, complete):
+        future = self._loop.create_future()
+        self._pending[req_id] = (future, msg, complete)
+        return future
+
+    def _readable(self):
+        try:
+            reply = self._recv()
+        except sanlock.SanlockException as e:
+            # The daemon closed the connection, nothing more will complete.
+            self._loop.remove_reader(self._fd)
+            self._fail_pending(e.errno)
+            return
+
+        entry = self._pending.pop(reply["req_id"], None)
+        if entry is None:
+            return
+
+        future, msg, complete = entry
+        if future.cancelled():
+            return
+
+        try:
+            value = complete(reply)
+        except sanlock.SanlockException as e:
+            future.set_exception(e)
+        else:
+            future.set_result(value)
+
+    def _fail_pending(self, en):
+        pending, self._pending = self._pending, {}
+        for future, msg, complete in pending.values():
+            if not future.done():
+                future.set_exception(_exception(-en, msg))
+
+
+class Client(_Connection):
+    """
+    Acquire and release resource leases for the registered process (or
+    for other processes with the pid argument) without blocking the event
+    loop.  Requests complete in the order they were sent.
+    """
+
+    def __init__(self, slkfd=None, loop=None):
+        if slkfd is None:
+            slkfd = sanlock.register()
+        if loop is None:
+            loop = asyncio.get_event_loop()
+        _Connection.__init__(self, slkfd, loop)
+
+    def _recv(self):
+        return sanlock.async_result(self._fd)
+
+    def acquire(self, lockspace, resource, disks, pid=-1, shared=False,
+                version=None):
+        """
+        Return a future with the list of acquired lease versions.
+        """
+        req_id = sanlock.acquire_async(lockspace, resource, disks,
+                                       slkfd=self._fd, pid=pid,
+                                       shared=shared, version=version)
+        return self._add_request(req_id, "Sanlock resource not acquired",
+                                 self._complete_acquire)
+
+    def release(self, lockspace, resource, disks, pid=-1):
+        """
+        Return a future completed when the lease is released.
+        """
+        req_id = sanlock.release_async(lockspace, resource, disks,
+                                       slkfd=self._fd, pid=pid)
+        return self._add_request(req_id, "Sanlock resource not released",
+                                 self._complete_release)
+
+    def _complete_acquire(self, reply):
+        if reply["result"] != 0:
+            raise _exception(reply["result"], "Sanlock resource not acquired")
+        return reply["versions"]
+
+    def _complete_release(self, reply):
+        if reply["result"] != 0:
+            raise _exception(reply["result"], "Sanlock resource not released")
+        return None
+
+
+class Pipeline(_Connection):
+    """
+    Lockspace requests on a pipelined connection.  The daemon runs the
+    requests concurrently and they complete in any order.
+    """
+
+    def __init__(self, loop=None):
+        if loop is None:
+            loop = asyncio.get_event_loop()
+        _Connection.__init__(self, sanlock.pipeline_open(), loop)
+
+    def _recv(self):
+        return sanlock.pipeline_recv(self._fd)
+
+    def inq_lockspace(self, lockspace, host_id, path, offset=0):
+        """
+        Return a future with the same result as sanlock.inq_lockspace:
+        True if the host_id is owned, False if not, and None while it is
+        being acquired or released.
+        """
+        req_id = sanlock.pipeline_inq_lockspace(self._fd, lockspace, host_id,
+                                                path, offset=offset)
+        return self._add_request(req_id, "Sanlock lockspace inquire failure",
+                                 self._complete_inq)
+
+    def _complete_inq(self, reply):
+        if reply["result"] == 0:
+            return True
+        if reply["result"] == -errno.ENOENT:
+            return False
+        if reply["result"] == -errno.EINPROGRESS:
+            return None
+        raise _exception(reply["result"], "Sanlock lockspace inquire failure")
+
+    def add_lockspace(self, lockspace, host_id, path, offset=0, iotimeout=0,
+                      interval=1.0):
+        """
+        Start adding the lockspace with add_lockspace(async=True), and
+        return a future completed when the host_id is acquired, checking
+        it with inq_lockspace every interval seconds.
+        """
+        sanlock.add_lockspace(lockspace, host_id, path, offset=offset,
+                              iotimeout=iotimeout, **{"async": True})
+        return self._wait_lockspace(lockspace, host_id, path, offset,
+                                    interval, True,
+                                    "Sanlock lockspace add failure")
+
+    def rem_lockspace(self, lockspace, host_id, path, offset=0, unused=False,
+                      interval=1.0):
+        """
+        Start removing the lockspace with rem_lockspace(async=True), and
+        return a future completed when the host_id is released.
+        """
+        sanlock.rem_lockspace(lockspace, host_id, path, offset=offset,
+                              unused=unused, **{"async": True})
+        return self._wait_lockspace(lockspace, host_id, path, offset,
+                                    interval, False,
+                                    "Sanlock lockspace remove failure")
+
+    def _wait_lockspace(self, lockspace, host_id, path, offset, interval,
+                        wanted, msg):
+        done = self._loop.create_future()
+
+        def check():
+            inq = self.inq_lockspace(lockspace, host_id, path, offset=offset)
+            inq.add_done_callback(checked)
+
+        def checked(inq):
+            if done.cancelled():
+                return
+            if inq.exception() is not None:
+                done.set_exception(inq.exception())
+            elif inq.result() == wanted:
+                done.set_result(None)
+            elif inq.result() is None or not wanted:
+                # Still in transition, or the removal has not started.
+                self._loop.call_later(interval, check)
+            else:
+                # An async add failed and the lockspace went away.
+                done.set_exception(_exception(-errno.ENOENT, msg))
+
+        check()
+        return done
@@ -4,6 +4,8 @@
 # modify, copy, or redistribute it subject to the terms and conditions
 # of the GNU General Public License v.2.
 
+import sys
+
 from distutils.core import setup, Extension
 
 sanlocklib = ['sanlock']
@@ -18,7 +20,13 @@ version = None
 with open('../VERSION') as f:
     version = f.readline()
 
+# sanlock_aio uses asyncio, which is only in python 3.
+py_modules = []
+if sys.version_info[0] >= 3:
+    py_modules.append('sanlock_aio')
+
 setup(name='sanlock-python',
       version=version,
       description='Python bindings for the sanlock library',
-      ext_modules=[sanlock])
+      ext_modules=[sanlock],
+      py_modules=py_modules)
@@ -27,6 +27,7 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/wait.h>
+#include <pthread.h>
 #include <sys/signalfd.h>
 
 #include "sanlock.h"
@@ -40,6 +41,7 @@ static socklen_t update_addrlen;
 
 #define EXIT_USAGE 2
 #define MAX_LS 64
+#define MAX_HOSTS 2000
 
 /*
  * native timeout: calculate directly when a host's watchdog
@@ -133,24 +135,53 @@ static int use_watchdog = 1;
 static int use_sysrq_reboot = 0;
 static int resource_mode;
 static int debug_mode;
-static int target_host_id;
+static int target_host_ids[MAX_HOSTS];
+static int target_host_count;
 static uint64_t target_generation;
 static int native_timeout = NATIVE_TIMEOUT_SECONDS;
 static int native_renewal = NATIVE_RENEWAL_SECONDS;
-static int watchdog_failed_to_fire;
 static int ls_count;
 static char *ls_names[MAX_LS];
-static int ls_hostids[MAX_LS];
+static char *first_ls_name;
 static int ls_fd[MAX_LS];
-static uint64_t ls_resetting_begin_timestamp[MAX_LS];
-static uint64_t ls_resetting_begin_local[MAX_LS];
-static uint64_t ls_timestamp[MAX_LS];
-static uint32_t ls_host_flags[MAX_LS];
-static int ls_is_resetting[MAX_LS];
-static int ls_is_dead[MAX_LS];
-static int ls_is_free[MAX_LS];
-static int ls_renewals[MAX_LS];
 
+/*
+ * One or more hosts are reset at once, each through every lockspace
+ * given.  A target is one host in one lockspace, target(h, i) for host
+ * h in lockspace i.  The same host can have a different host_id in each
+ * lockspace.  A host is done when it is done in any lockspace, and failed
+ * when it has failed in all of them (see host_done, host_fail).
+ */
+
+struct target {
+	int host_id;
+	int set_failed;
+	int is_resetting;
+	int is_dead;
+	int is_free;
+	int renewals;
+	int io_timeout;
+	uint32_t host_flags;
+	uint64_t timestamp;
+	uint64_t resetting_begin_timestamp;
+	uint64_t resetting_begin_local;
+	uint64_t next_check;		/* local time to get_hosts again */
+};
+
+struct host {
+	int done;
+	int failed;
+	int watchdog_failed_to_fire;
+};
+
+static struct target *targets;
+static struct host *hosts;
+static int host_count;
+
+static inline struct target *target(int h, int i)
+{
+	return &targets[h * MAX_LS + i];
+}
 
 #define errlog(fmt, args...) \
 do { \
@@ -296,25 +327,30 @@ static const char *host_flag_str(uint32_t flags)
  * skew, io delays, scheduling delays, that affect the count.
  */
 
-static int reset_fail(void)
+static int host_fail(int h)
 {
+	struct target *t;
 	int cmd_fail = 0;
 	int cmd_wait = 0;
 	int i;
 
-	if (watchdog_failed_to_fire)
+	if (hosts[h].watchdog_failed_to_fire)
 		return 1;
 
 	for (i = 0; i < MAX_LS; i++) {
 		if (!ls_names[i])
 			continue;
 
-		if (ls_is_resetting[i]) {
+		t = target(h, i);
+		if (t->set_failed)
+			continue;
+
+		if (t->is_resetting) {
 			/*
 			 * sanlk-resetd on the host has replied that
 			 * it has set up its watchdog to reset it, so
 			 * in time it should become DEAD and be counted
-			 * as done in reset_done().  The time for the host
+			 * as done in host_done().  The time for the host
 			 * to be reported as DEAD is not something we can
 			 * compute exactly here, (and it depends on things
 			 * like io timeout).
@@ -330,7 +366,7 @@ static int reset_fail(void)
 
 			if (monotime() - begin > 300) {
 				log_error("host watchdog reset failed in %s:%d",
-					  ls_names[i], ls_hostids[i]);
+					  ls_names[i], t->host_id);
 				cmd_fail++;
 			} else {
 				cmd_wait++;
@@ -351,22 +387,22 @@ static int reset_fail(void)
 		 * 9. sanlk-resetd is not watching events in the ls where the event was set
 		 */
 
-		if (ls_is_dead[i]) {
+		if (t->is_dead) {
 			/* case 3, case 4, case 5 */
 			log_error("host is dead with no reply in %s:%d",
-				  ls_names[i], ls_hostids[i]);
+				  ls_names[i], t->host_id);
 			cmd_fail++;
 
-		} else if (ls_is_free[i]) {
+		} else if (t->is_free) {
 			/* case 7, case 8 */
 			log_error("host is free with no reply in %s:%d",
-				  ls_names[i], ls_hostids[i]);
+				  ls_names[i], t->host_id);
 			cmd_fail++;
 
-		} else if (ls_renewals[i] >= 4) {
+		} else if (t->renewals >= 4) {
 			/* case 2, case 6, case 9 */
 			log_error("host renewals %d with no reply in %s:%d",
-				  ls_renewals[i], ls_names[i], ls_hostids[i]);
+				  t->renewals, ls_names[i], t->host_id);
 			cmd_fail++;
 
 		} else {
@@ -380,63 +416,168 @@ static int reset_fail(void)
 		return 1;
 	}
 
+	if (!cmd_wait) {
+		log_error("reset failed: no lockspaces");
+		return 1;
+	}
+
 	return 0;
 }
 
-static int reset_done(void)
+/*
+ * When to get the host state again.  The state of a host changes when
+ * it renews, which is seen at most an io_timeout late, or when it has
+ * not renewed for some time: FAIL follows LIVE after many renewal
+ * intervals, while DEAD, which completes the reset, can follow FAIL at
+ * any time, so a FAIL host is checked every second.  A resetting host
+ * is also checked when the native timeout or the 300 second limit would
+ * end.  A resetting reply from the host sets next_check to now.
+ */
+
+static void set_next_check(struct target *t, uint64_t now)
 {
-	struct sanlk_host *hs;
-	uint64_t now;
-	uint64_t host_id;
-	uint32_t state;
-	int hs_count;
-	int ls_is_done;
-	int is_done = 0;
-	int i, rv;
+	uint64_t next;
+	int interval = t->io_timeout ? t->io_timeout : 10;
 
-	/*
-	 * Get the state of the host in each lockspace.
-	 */
+	if ((t->host_flags & SANLK_HOST_MASK) == SANLK_HOST_FAIL)
+		interval = 1;
+
+	next = now + interval;
+
+	if (t->is_resetting && t->resetting_begin_local && native_timeout &&
+	    t->resetting_begin_local + native_timeout + 1 < next)
+		next = t->resetting_begin_local + native_timeout + 1;
+
+	if (t->is_resetting && begin + 301 < next)
+		next = begin + 301;
+
+	if (next <= now)
+		next = now + 1;
+
+	t->next_check = next;
+}
+
+static int host_active(int h)
+{
+	return !hosts[h].done && !hosts[h].failed;
+}
+
+static void update_target(int h, int i, struct sanlk_host *hs)
+{
+	struct target *t = target(h, i);
+
+	if (t->timestamp && (t->timestamp != hs->timestamp))
+		t->renewals++;
+
+	t->timestamp = hs->timestamp;
+	t->host_flags = hs->flags;
+	t->io_timeout = hs->io_timeout;
+
+	log_debug("%04u state %s reply %d timestamp %llu ls %s:%d",
+		  (uint32_t)(monotime() - begin),
+		  host_flag_str(t->host_flags),
+		  t->is_resetting,
+		  (unsigned long long)hs->timestamp,
+		  ls_names[i], t->host_id);
+
+	if (hs->timestamp && (hs->io_timeout != 10) && native_timeout) {
+		log_error("disable native_timeout due to zero io_timeout in %s:%d",
+			  ls_names[i], t->host_id);
+		native_timeout = 0;
+	}
+}
+
+/*
+ * Get the state of the hosts in each lockspace where one of them is due
+ * to be checked, with one get_hosts for all of them.
+ */
+
+static void get_host_states(uint64_t now)
+{
+	struct sanlk_host *hss, *hs;
+	struct sanlk_host free_hs;
+	struct target *t;
+	uint64_t host_id;
+	int hs_count, due, want;
+	int h, i, j, rv;
 
 	for (i = 0; i < MAX_LS; i++) {
 		if (!ls_names[i])
 			continue;
 
-		hs_count = 0;
-		hs = NULL;
-		host_id = (uint64_t)ls_hostids[i];
+		due = 0;
+		want = 0;
+		host_id = 0;
 
-		rv = sanlock_get_hosts(ls_names[i], host_id, &hs, &hs_count, 0);
+		for (h = 0; h < host_count; h++) {
+			t = target(h, i);
+			if (!host_active(h) || t->set_failed)
+				continue;
+			want++;
+			host_id = t->host_id;
+			if (t->next_check <= now)
+				due++;
+		}
 
-		if ((rv < 0) || (hs == NULL) || (hs_count != 1) || (hs->host_id != host_id)) {
-			log_error("sanlock_get_hosts error %d ls %s:%d",
-				  rv, ls_names[i], ls_hostids[i]);
-			if (hs)
-				free(hs);
+		if (!due)
 			continue;
+
+		/* all hosts in one reply unless there is only one */
+		if (want > 1)
+			host_id = 0;
+
+		hs_count = 0;
+		hss = NULL;
+
+		rv = sanlock_get_hosts(ls_names[i], host_id, &hss, &hs_count, 0);
+		if ((rv < 0) || (hss == NULL) || !hs_count) {
+			log_error("sanlock_get_hosts error %d ls %s:%llu",
+				  rv, ls_names[i], (unsigned long long)host_id);
+			if (hss)
+				free(hss);
+			hss = NULL;
+			hs_count = 0;
 		}
 
-		if (ls_timestamp[i] && (ls_timestamp[i] != hs->timestamp))
-			ls_renewals[i]++;
+		for (h = 0; h < host_count; h++) {
+			t = target(h, i);
+			if (!host_active(h) || t->set_failed)
+				continue;
+
+			hs = NULL;
+			for (j = 0; j < hs_count; j++) {
+				if (hss[j].host_id == (uint64_t)t->host_id) {
+					hs = &hss[j];
+					break;
+				}
+			}
 
-		ls_timestamp[i] = hs->timestamp;
-		ls_host_flags[i] = hs->flags;
+			/* all hosts leaves out those with a zero timestamp */
+			if (!hs && hss && !host_id) {
+				memset(&free_hs, 0, sizeof(free_hs));
+				free_hs.host_id = t->host_id;
+				free_hs.flags = SANLK_HOST_FREE;
+				hs = &free_hs;
+			}
 
-		log_debug("%04u state %s reply %d timestamp %llu ls %s:%d",
-			  (uint32_t)(monotime() - begin),
-			  host_flag_str(ls_host_flags[i]),
-			  ls_is_resetting[i],
-			  (unsigned long long)hs->timestamp,
-			  ls_names[i], ls_hostids[i]);
+			if (hs)
+				update_target(h, i, hs);
 
-		if (hs->timestamp && (hs->io_timeout != 10) && native_timeout) {
-			log_error("disable native_timeout due to zero io_timeout in %s:%d",
-				  ls_names[i], ls_hostids[i]);
-			native_timeout = 0;
+			set_next_check(t, now);
 		}
 
-		free(hs);
+		free(hss);
 	}
+}
+
+static int host_done(int h)
+{
+	struct target *t;
+	uint64_t now;
+	uint32_t state;
+	int ls_is_done;
+	int is_done = 0;
+	int i;
 
 	/*
 	 * The native timeout check.
@@ -449,51 +590,54 @@ static int reset_done(void)
 		if (!ls_names[i])
 			continue;
 
-		if (!ls_is_resetting[i])
+		t = target(h, i);
+
+		if (t->set_failed || !t->is_resetting)
 			continue;
 
 		now = monotime();
 
-		if (!ls_resetting_begin_local[i]) {
-			ls_resetting_begin_timestamp[i] = ls_timestamp[i];
-			ls_resetting_begin_local[i] = now;
+		if (!t->resetting_begin_local) {
+			t->resetting_begin_timestamp = t->timestamp;
+			t->resetting_begin_local = now;
+			set_next_check(t, now);
 
 			log_debug("resetting begin local %llu timestamp %llu in ls %s:%d",
-				  (unsigned long long)ls_resetting_begin_local[i],
-				  (unsigned long long)ls_resetting_begin_timestamp[i],
-				  ls_names[i], ls_hostids[i]);
+				  (unsigned long long)t->resetting_begin_local,
+				  (unsigned long long)t->resetting_begin_timestamp,
+				  ls_names[i], t->host_id);
 		}
 
-		if (now - ls_resetting_begin_local[i] > native_timeout) {
-			if (ls_timestamp[i] - ls_resetting_begin_timestamp[i] > native_renewal) {
+		if (now - t->resetting_begin_local > native_timeout) {
+			if (t->timestamp - t->resetting_begin_timestamp > native_renewal) {
 				/*
 				 * This should never happen.
 				 */
-				log_error("watchdog failed to fire in ls %s:%d", ls_names[i], ls_hostids[i]);
+				log_error("watchdog failed to fire in ls %s:%d", ls_names[i], t->host_id);
 				log_error("resetting_begin_local %llu now %llu "
 					  "resetting_begin_timestamp %llu timestamp %llu "
 					  "native_timeout %d native_renewal %d "
 					  "ls %s:%d",
-					  (unsigned long long)ls_resetting_begin_local[i],
+					  (unsigned long long)t->resetting_begin_local,
 					  (unsigned long long)now,
-					  (unsigned long long)ls_resetting_begin_timestamp[i],
-					  (unsigned long long)ls_timestamp[i],
+					  (unsigned long long)t->resetting_begin_timestamp,
+					  (unsigned long long)t->timestamp,
 					  native_timeout, native_renewal,
-					  ls_names[i], ls_hostids[i]);
+					  ls_names[i], t->host_id);
 
-				watchdog_failed_to_fire = 1;
+				hosts[h].watchdog_failed_to_fire = 1;
 			} else {
-				log_info("reset done by native_timeout in ls %s:%d", ls_names[i], ls_hostids[i]);
+				log_info("reset done by native_timeout in ls %s:%d", ls_names[i], t->host_id);
 				is_done = 1;
 			}
 		} else {
 			log_debug("native timeout seconds remaining %d in ls %s:%d",
-				  native_timeout - (int)(now - ls_resetting_begin_local[i]),
-				  ls_names[i], ls_hostids[i]);
+				  native_timeout - (int)(now - t->resetting_begin_local),
+				  ls_names[i], t->host_id);
 		}
 	}
 
-	if (watchdog_failed_to_fire)
+	if (hosts[h].watchdog_failed_to_fire)
 		return 0;
 
  check_host_status:
@@ -528,47 +672,55 @@ static int reset_done(void)
 		if (!ls_names[i])
 			continue;
 
+		t = target(h, i);
+		if (t->set_failed)
+			continue;
+
 		ls_is_done = 0;
 
-		state = ls_host_flags[i] & SANLK_HOST_MASK;
+		state = t->host_flags & SANLK_HOST_MASK;
 
-		if (state == SANLK_HOST_DEAD && !ls_is_dead[i]) {
-			ls_is_dead[i] = 1;
-			log_info("host dead in ls %s:%d", ls_names[i], ls_hostids[i]);
+		if (state == SANLK_HOST_DEAD && !t->is_dead) {
+			t->is_dead = 1;
+			log_info("host dead in ls %s:%d", ls_names[i], t->host_id);
 		}
 
-		if (state == SANLK_HOST_FREE && !ls_is_free[i]) {
-			ls_is_free[i] = 1;
-			log_info("host free in ls %s:%d", ls_names[i], ls_hostids[i]);
+		if (state == SANLK_HOST_FREE && !t->is_free) {
+			t->is_free = 1;
+			log_info("host free in ls %s:%d", ls_names[i], t->host_id);
 		}
 
-		if (resource_mode && ls_is_dead[i]) {
+		if (resource_mode && t->is_dead) {
 			ls_is_done = 1;
 			is_done = 1;
 		}
 
-		if (!resource_mode && ls_is_dead[i] && ls_is_resetting[i]) {
+		if (!resource_mode && t->is_dead && t->is_resetting) {
 			ls_is_done = 1;
 			is_done = 1;
 		}
 
 		if (ls_is_done)
-			log_info("reset done by host_status in ls %s:%d", ls_names[i], ls_hostids[i]);
+			log_info("reset done by host_status in ls %s:%d", ls_names[i], t->host_id);
 	}
 
 	return is_done;
 }
 
+#define EVENT_RECS 64
+
 static void get_events(int i)
 {
-	struct sanlk_host_event from_he;
+	struct sanlk_event_rec recs[EVENT_RECS];
+	struct sanlk_event_rec *rec;
+	struct target *t;
 	uint64_t from_host, from_gen;
 	int resetting = 0;
 	int rebooting = 0;
-	int rv;
+	int count, h, n, rv;
 
 	while (1) {
-		rv = sanlock_get_event(ls_fd[i], 0, &from_he, &from_host, &from_gen);
+		rv = sanlock_get_events(ls_fd[i], 0, recs, EVENT_RECS, &count);
 		if (rv == -EAGAIN)
 			break;
 		if (rv < 0) {
@@ -578,27 +730,45 @@ static void get_events(int i)
 			break;
 		}
 
-		log_debug("got event %llx %llx from host %llu %llu in ls %s:%d",
-			  (unsigned long long)from_he.event,
-			  (unsigned long long)from_he.data,
-			  (unsigned long long)from_host,
-			  (unsigned long long)from_gen,
-			  ls_names[i],
-			  ls_hostids[i]);
+		for (n = 0; n < count; n++) {
+			rec = &recs[n];
+			from_host = rec->from_host_id;
+			from_gen = rec->from_generation;
+
+			log_debug("got event %llx %llx from host %llu %llu in ls %s",
+				  (unsigned long long)rec->he.event,
+				  (unsigned long long)rec->he.data,
+				  (unsigned long long)from_host,
+				  (unsigned long long)from_gen,
+				  ls_names[i]);
 
-		resetting = from_he.event & EVENT_RESETTING;
-		rebooting = from_he.event & EVENT_REBOOTING;
+			resetting = rec->he.event & EVENT_RESETTING;
+			rebooting = rec->he.event & EVENT_REBOOTING;
 
-		if ((from_host == ls_hostids[i]) && (resetting || rebooting)) {
-			log_info("host %s%sin ls %s:%d",
-				 resetting ? "resetting " : "",
-				 rebooting ? "rebooting " : "",
-				 ls_names[i],
-				 ls_hostids[i]);
+			if (!resetting && !rebooting)
+				continue;
 
-			if (resetting)
-				ls_is_resetting[i] = 1;
+			for (h = 0; h < host_count; h++) {
+				t = target(h, i);
+				if (t->set_failed || from_host != (uint64_t)t->host_id)
+					continue;
+
+				log_info("host %s%sin ls %s:%d",
+					 resetting ? "resetting " : "",
+					 rebooting ? "rebooting " : "",
+					 ls_names[i],
+					 t->host_id);
+
+				if (resetting && !t->is_resetting) {
+					t->is_resetting = 1;
+					/* begin the native timeout from a current timestamp */
+					t->next_check = 0;
+				}
+			}
 		}
+
+		if (count < EVENT_RECS)
+			break;
 	}
 }
 
@@ -650,11 +820,11 @@ static void usage(void)
 	printf("Update the local sanlk-resetd to clear all lockspaces being watched:\n");
 	printf("%s clear all\n", prog_name);
 	printf("\n");
-	printf("Reset another host through a lockspace it is watching:\n");
-	printf("%s reset lockspace_name:host_id ...\n", prog_name);
+	printf("Reset other hosts through lockspaces they are watching:\n");
+	printf("%s reset lockspace_name:host_id[,host_id...] ...\n", prog_name);
 	printf("\n");
-	printf("  --host-id | -i <num>\n");
-	printf("        Host id to reset.\n");
+	printf("  --host-id | -i <num>[,<num>...]\n");
+	printf("        Host ids to reset.\n");
 	printf("\n");
 	printf("  --generation | -g <num>\n");
 	printf("        Generation of host id (default 0 for current generation).\n");
@@ -678,23 +848,165 @@ static void usage(void)
 	printf("\n");
 	printf("  The event will be set in each lockspace_name (max %d).\n", MAX_LS);
 	printf("  The -i and -g options can only be used with a single lockspace_name arg.\n");
+	printf("  The -g option can only be used with a single host_id.\n");
+	printf("  Each lockspace_name lists the same number of host_ids, the Nth is the same host.\n");
 	printf("\n");
 }
 
+/*
+ * The event is set in all lockspaces at once, one thread per lockspace,
+ * each setting it for every host in its lockspace in turn.
+ */
+
+struct set_event_args {
+	pthread_t thread;
+	int ls;
+	int started;
+};
+
+static void *set_event_thread(void *arg)
+{
+	struct set_event_args *sa = arg;
+	struct sanlk_host_event he;
+	struct target *t;
+	uint32_t flags;
+	int i = sa->ls;
+	int h, rv;
+
+	for (h = 0; h < host_count; h++) {
+		t = target(h, i);
+
+		memset(&he, 0, sizeof(he));
+		if (use_watchdog)
+			he.event |= EVENT_RESET;
+		if (use_sysrq_reboot)
+			he.event |= EVENT_REBOOT;
+
+		/* a host can have different host_ids in different lockspaces */
+		he.host_id = t->host_id;
+		he.generation = target_generation;
+
+		flags = target_generation ? SANLK_SETEV_CUR_GENERATION : 0;
+
+		rv = sanlock_set_event(ls_names[i], &he, flags);
+		if (rv < 0) {
+			log_error("set_event error %d ls %s:%d", rv, ls_names[i], t->host_id);
+			t->set_failed = 1;
+			continue;
+		}
+
+		log_debug("set event %llx %llx for host %llu %llu in ls %s:%d",
+			  (unsigned long long)he.event,
+			  (unsigned long long)he.data,
+			  (unsigned long long)he.host_id,
+			  (unsigned long long)he.generation,
+			  ls_names[i],
+			  t->host_id);
+
+		log_info("asked host to %s%sin ls %s:%d",
+			 (he.event & EVENT_RESET) ? "reset " : "",
+			 (he.event & EVENT_REBOOT) ? "reboot " : "",
+			 ls_names[i],
+			 t->host_id);
+	}
+
+	return NULL;
+}
+
+static void set_events(void)
+{
+	struct set_event_args sa[MAX_LS];
+	int i, rv;
+
+	memset(sa, 0, sizeof(sa));
+
+	for (i = 0; i < MAX_LS; i++) {
+		if (!ls_names[i])
+			continue;
+
+		sa[i].ls = i;
+
+		rv = pthread_create(&sa[i].thread, NULL, set_event_thread, &sa[i]);
+		if (rv) {
+			log_error("set_event thread error %d ls %s", rv, ls_names[i]);
+			set_event_thread(&sa[i]);
+			continue;
+		}
+		sa[i].started = 1;
+	}
+
+	for (i = 0; i < MAX_LS; i++) {
+		if (sa[i].started)
+			pthread_join(sa[i].thread, NULL);
+	}
+}
+
+/* only the replies from the hosts being reset */
+
+static int register_ls(int i)
+{
+	struct sanlk_event_filter ef;
+	int h, id, fd;
+
+	memset(&ef, 0, sizeof(ef));
+	ef.event_mask = EVENT_RESETTING | EVENT_REBOOTING;
+	ef.flags = SANLK_EVF_HOST_IDS;
+
+	for (h = 0; h < host_count; h++) {
+		id = target(h, i)->host_id;
+		ef.host_ids[(id - 1) / 8] |= 1 << ((id - 1) % 8);
+	}
+
+	fd = sanlock_reg_event_filter(ls_names[i], &ef, 0);
+	if (fd == -EINVAL || fd == -EPROTO)
+		fd = sanlock_reg_event(ls_names[i], NULL, 0);
+	return fd;
+}
+
+static int parse_host_ids(char *str, int *ids, int max)
+{
+	char *p, *end;
+	long val;
+	int count = 0;
+
+	p = str;
+
+	while (1) {
+		val = strtol(p, &end, 10);
+		if (end == p || val < 1 || val > 2000) {
+			fprintf(stderr, "invalid host_id %s\n", str);
+			exit(EXIT_USAGE);
+		}
+		if (count == max) {
+			fprintf(stderr, "too many host_ids (max %d)\n", max);
+			exit(EXIT_USAGE);
+		}
+		ids[count++] = val;
+
+		if (*end == '\0')
+			break;
+		if (*end != ',') {
+			fprintf(stderr, "invalid host_id %s\n", str);
+			exit(EXIT_USAGE);
+		}
+		p = end + 1;
+	}
+
+	return count;
+}
+
 int main(int argc, char *argv[])
 {
 	char *ls_name, *colon, *cmd;
-	struct sanlk_host_event he;
-	uint32_t flags = 0;
-	int i, fd, rv;
+	int *ids;
+	uint64_t now, next;
+	int i, h, fd, rv, count, timeout;
 	int done = 0;
 	int fail = 0;
 
 	prog_name = argv[0];
 	begin = monotime();
 
-	memset(&he, 0, sizeof(he));
-
 	if (argc < 2) {
 		usage();
 		exit(EXIT_USAGE);
@@ -732,7 +1044,7 @@ int main(int argc, char *argv[])
 			printf("%s version: " VERSION "\n", prog_name);
 			exit(EXIT_SUCCESS);
 		case 'i':
-			target_host_id = atoi(optarg);
+			target_host_count = parse_host_ids(optarg, target_host_ids, MAX_HOSTS);
 			break;
 		case 'g':
 			target_generation = strtoull(optarg, NULL, 0);
@@ -798,7 +1110,7 @@ int main(int argc, char *argv[])
 	}
 
 	/*
-	 * Reset another host.
+	 * Reset other hosts.
 	 */
 
 	if (strcmp(cmd, "reset")) {
@@ -806,25 +1118,58 @@ int main(int argc, char *argv[])
 		exit(EXIT_USAGE);
 	}
 
-	if ((ls_count > 1) && (target_host_id || target_generation)) {
+	if ((ls_count > 1) && (target_host_count || target_generation)) {
 		fprintf(stderr, "-i and -g options are only allowed with a single lockspace_name\n");
 		exit(EXIT_USAGE);
 	}
 
+	ids = malloc(MAX_HOSTS * sizeof(int));
+	if (!ids)
+		return -ENOMEM;
+
+	/*
+	 * The Nth host_id in each lockspace arg is the same host.
+	 */
+
 	for (i = 0; i < ls_count; i++) {
 		ls_name = ls_names[i];
 		colon = strstr(ls_name, ":");
 		if (!colon) {
-			ls_hostids[i] = target_host_id;
+			memcpy(ids, target_host_ids, sizeof(int) * target_host_count);
+			count = target_host_count;
 		} else {
-			ls_hostids[i] = atoi(colon+1);
 			*colon = '\0';
+			count = parse_host_ids(colon + 1, ids, MAX_HOSTS);
 		}
 
-		if (ls_hostids[i] < 1 || ls_hostids[i] > 2000) {
-			fprintf(stderr, "invalid host_id %d", ls_hostids[i]);
+		if (!count) {
+			fprintf(stderr, "host_id is required for %s\n", ls_name);
 			exit(EXIT_USAGE);
 		}
+
+		if (!i) {
+			host_count = count;
+			targets = calloc(host_count * MAX_LS, sizeof(struct target));
+			hosts = calloc(host_count, sizeof(struct host));
+			if (!targets || !hosts)
+				return -ENOMEM;
+		} else if (count != host_count) {
+			fprintf(stderr, "each lockspace_name needs the same number of host_ids\n");
+			exit(EXIT_USAGE);
+		}
+
+		for (h = 0; h < host_count; h++)
+			target(h, i)->host_id = ids[h];
+	}
+
+	free(ids);
+
+	/* hosts are named by their host_id in the first lockspace */
+	first_ls_name = ls_names[0];
+
+	if ((host_count > 1) && target_generation) {
+		fprintf(stderr, "-g option is only allowed with a single host_id\n");
+		exit(EXIT_USAGE);
 	}
 
 	openlog(prog_name, LOG_CONS | LOG_PID, LOG_DAEMON);
@@ -846,7 +1191,7 @@ int main(int argc, char *argv[])
 		if (!ls_names[i])
 			continue;
 
-		fd = sanlock_reg_event(ls_names[i], NULL, 0);
+		fd = register_ls(i);
 		if (fd < 0) {
 			log_error("reg_event error %d ls %s", fd, ls_names[i]);
 			ls_names[i] = NULL;
@@ -863,42 +1208,19 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	if (use_watchdog)
-		he.event |= EVENT_RESET;
-	if (use_sysrq_reboot)
-		he.event |= EVENT_REBOOT;
+	set_events();
 
 	for (i = 0; i < MAX_LS; i++) {
 		if (!ls_names[i])
 			continue;
-		if (ls_fd[i] == -1)
-			continue;
 
-		/* a host can have different host_ids in different lockspaces */
-		he.host_id = ls_hostids[i];
-		he.generation = target_generation;
-
-		flags = target_generation ? SANLK_SETEV_CUR_GENERATION : 0;
-
-		rv = sanlock_set_event(ls_names[i], &he, flags);
-		if (rv < 0) {
-			log_error("set_event error %d ls %s", rv, ls_names[i]);
-			unregister_ls(i);
-		} else {
-			log_debug("set event %llx %llx for host %llu %llu in ls %s:%d",
-				  (unsigned long long)he.event,
-				  (unsigned long long)he.data,
-				  (unsigned long long)he.host_id,
-				  (unsigned long long)he.generation,
-				  ls_names[i],
-				  ls_hostids[i]);
-
-			log_info("asked host to %s%sin ls %s:%d",
-				 (he.event & EVENT_RESET) ? "reset " : "",
-				 (he.event & EVENT_REBOOT) ? "reboot " : "",
-				 ls_names[i],
-				 ls_hostids[i]);
+		count = 0;
+		for (h = 0; h < host_count; h++) {
+			if (!target(h, i)->set_failed)
+				count++;
 		}
+		if (!count)
+			unregister_ls(i);
 	}
 
 	if (!ls_count) {
@@ -906,19 +1228,74 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	while (1) {
-		rv = poll(pollfd, MAX_LS, 2000);
-		if (rv == -1 && errno == EINTR)
-			continue;
-		if (rv < 0)
-			break;
+	for (h = 0; h < host_count; h++) {
+		count = 0;
+		for (i = 0; i < MAX_LS; i++) {
+			if (ls_names[i] && !target(h, i)->set_failed)
+				count++;
+		}
+		if (!count) {
+			log_error("Event could not be set for host %s:%d in any lockspace.",
+				  first_ls_name, target(h, 0)->host_id);
+			hosts[h].failed = 1;
+			fail++;
+		}
+	}
 
-		done = reset_done();
-		if (done)
+	/*
+	 * Wait for a reply or the next host state check that is due,
+	 * rather than checking every host every few seconds.  The first
+	 * check is due immediately.
+	 */
+
+	while (done + fail < host_count) {
+		now = monotime();
+
+		get_host_states(now);
+
+		for (h = 0; h < host_count; h++) {
+			if (!host_active(h))
+				continue;
+
+			if (host_done(h)) {
+				hosts[h].done = 1;
+				done++;
+				if (host_count > 1)
+					log_info("reset done for host %s:%d in %u seconds",
+						 first_ls_name, target(h, 0)->host_id,
+						 (uint32_t)(monotime() - begin));
+			} else if (host_fail(h)) {
+				hosts[h].failed = 1;
+				fail++;
+				if (host_count > 1)
+					log_error("reset failed for host %s:%d in %u seconds",
+						  first_ls_name, target(h, 0)->host_id,
+						  (uint32_t)(monotime() - begin));
+			}
+		}
+
+		if (done + fail >= host_count || !ls_count)
 			break;
 
-		fail = reset_fail();
-		if (fail)
+		next = 0;
+		for (i = 0; i < MAX_LS; i++) {
+			if (!ls_names[i])
+				continue;
+			for (h = 0; h < host_count; h++) {
+				if (!host_active(h) || target(h, i)->set_failed)
+					continue;
+				if (!next || target(h, i)->next_check < next)
+					next = target(h, i)->next_check;
+			}
+		}
+
+		now = monotime();
+		timeout = (next > now) ? (next - now) * 1000 : 0;
+
+		rv = poll(pollfd, MAX_LS, timeout);
+		if (rv == -1 && errno == EINTR)
+			continue;
+		if (rv < 0)
 			break;
 
 		for (i = 0; i < MAX_LS; i++) {
@@ -928,6 +1305,9 @@ int main(int argc, char *argv[])
 			if (pollfd[i].revents & POLLIN)
 				get_events(i);
 
+			if (pollfd[i].fd < 0)
+				continue;
+
 			if (pollfd[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
 				log_debug("unregister fd %d poll %x ls %s",
 					  ls_fd[i], pollfd[i].revents, ls_names[i]);
@@ -944,7 +1324,11 @@ int main(int argc, char *argv[])
 		unregister_ls(i);
 	}
 
-	if (done) {
+	if (host_count > 1)
+		log_info("reset done for %d of %d hosts in %u seconds",
+			 done, host_count, (uint32_t)(monotime() - begin));
+
+	if (done == host_count) {
 		log_info("reset done in %u seconds", (uint32_t)(monotime() - begin));
 		exit(EXIT_SUCCESS);
 	} else {
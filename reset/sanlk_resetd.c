@@ -27,6 +27,7 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
 #include <sys/signalfd.h>
 
 #include "sanlock.h"
@@ -55,16 +56,35 @@ static int we_are_rebooting;
 static int wd_reset_failed;
 static uint64_t rebooting_time;
 
-#define MAX_LS        64
-#define POLLFD_COUNT  (MAX_LS+2)
+#define MAX_LS        1024
 #define SIGNAL_INDEX  (MAX_LS)
 #define UPDATE_INDEX  (MAX_LS+1)
 
 static char *ls_names[MAX_LS];
 static int ls_fd[MAX_LS];
+static int ls_polled[MAX_LS];
 static int ls_count;
 
-static struct pollfd *pollfd;
+/*
+ * All lockspace fds, the signal fd and the update fd are in one epoll
+ * set, with the ls index (or SIGNAL_INDEX, UPDATE_INDEX) as the data.
+ * The events read from all the ready lockspaces are handled together;
+ * see process_events.
+ */
+
+#define EPOLL_EVENTS  64
+#define EVENT_RECS    64
+
+struct ls_event {
+	int i;
+	struct sanlk_event_rec rec;
+};
+
+static struct ls_event *cycle_events;
+static int cycle_count;
+static int cycle_size;
+
+static int epoll_fd;
 static int update_fd;
 static int signal_fd;
 static int wdmd_fd;
@@ -266,14 +286,48 @@ static int find_ls(char *name)
 	return -1;
 }
 
+static int epoll_add(int fd, uint32_t index)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = index;
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		return -errno;
+	return 0;
+}
+
+static void epoll_del(int fd)
+{
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static void unpoll_ls(int i)
+{
+	if (!ls_polled[i])
+		return;
+	epoll_del(ls_fd[i]);
+	ls_polled[i] = 0;
+}
+
 static int register_ls(int i)
 {
+	struct sanlk_event_filter ef;
 	int fd;
 
 	if (!ls_names[i])
 		return -ENOMEM;
 
-	fd = sanlock_reg_event(ls_names[i], NULL, 0);
+	/* the daemon does not send us the events we ignore */
+
+	memset(&ef, 0, sizeof(ef));
+	ef.event_mask = EVENT_RESET | EVENT_RESETTING | EVENT_REBOOT | EVENT_REBOOTING;
+
+	fd = sanlock_reg_event_filter(ls_names[i], &ef, 0);
+	if (fd == -EINVAL || fd == -EPROTO)
+		fd = sanlock_reg_event(ls_names[i], NULL, 0);
 	if (fd < 0) {
 		log_error("reg_event %d error %d ls %s", i, fd, ls_names[i]);
 		free(ls_names[i]);
@@ -282,9 +336,11 @@ static int register_ls(int i)
 	} else {
 		log_debug("reg_event %d fd %d ls %s", i, fd, ls_names[i]);
 		ls_fd[i] = fd;
-		pollfd[i].fd = fd;
-		pollfd[i].events = POLLIN;
 		ls_count++;
+		if (epoll_add(fd, i) < 0)
+			log_error("reg_event %d fd %d epoll error %d", i, fd, errno);
+		else
+			ls_polled[i] = 1;
 		return 0;
 	}
 }
@@ -292,25 +348,41 @@ static int register_ls(int i)
 static void unregister_ls(int i)
 {
 	log_debug("end_event %d fd %d ls %s", i, ls_fd[i], ls_names[i]);
+	unpoll_ls(i);
 	sanlock_end_event(ls_fd[i], ls_names[i], 0);
 	free(ls_names[i]);
 	ls_names[i] = NULL;
 	ls_fd[i] = -1;
-	pollfd[i].fd = -1;
-	pollfd[i].events = 0;
 	ls_count--;
 }
 
+static int cycle_add(int i, struct sanlk_event_rec *rec)
+{
+	struct ls_event *tmp;
+
+	if (cycle_count == cycle_size) {
+		tmp = realloc(cycle_events, (cycle_size + 256) * sizeof(struct ls_event));
+		if (!tmp)
+			return -ENOMEM;
+		cycle_events = tmp;
+		cycle_size += 256;
+	}
+
+	cycle_events[cycle_count].i = i;
+	memcpy(&cycle_events[cycle_count].rec, rec, sizeof(struct sanlk_event_rec));
+	cycle_count++;
+	return 0;
+}
+
+/* read all the pending events from the lockspace, a batch at a time */
+
 static void get_events(int i)
 {
-	struct sanlk_host_event from_he;
-	uint64_t from_host, from_gen;
-	uint64_t event, event_out;
-	int set_config_failed;
-	int rv;
+	struct sanlk_event_rec recs[EVENT_RECS];
+	int count, n, rv;
 
 	while (1) {
-		rv = sanlock_get_event(ls_fd[i], 0, &from_he, &from_host, &from_gen);
+		rv = sanlock_get_events(ls_fd[i], 0, recs, EVENT_RECS, &count);
 		if (rv == -EAGAIN)
 			break;
 		if (rv < 0) {
@@ -320,38 +392,136 @@ static void get_events(int i)
 			break;
 		}
 
-		event = from_he.event;
-		event_out = 0;
-		set_config_failed = 0;
+		for (n = 0; n < count; n++) {
+			if (cycle_add(i, &recs[n]) < 0) {
+				log_error("no memory for events ls %s", ls_names[i]);
+				return;
+			}
+		}
+
+		if (count < EVENT_RECS)
+			break;
+	}
+}
+
+static int cmp_event(const void *a, const void *b)
+{
+	const struct ls_event *ea = a, *eb = b;
+
+	if (ea->rec.from_host_id != eb->rec.from_host_id)
+		return ea->rec.from_host_id < eb->rec.from_host_id ? -1 : 1;
+	if (ea->rec.from_generation != eb->rec.from_generation)
+		return ea->rec.from_generation < eb->rec.from_generation ? -1 : 1;
+	if (ea->rec.he.event != eb->rec.he.event)
+		return ea->rec.he.event < eb->rec.he.event ? -1 : 1;
+	if (ea->rec.he.data != eb->rec.he.data)
+		return ea->rec.he.data < eb->rec.he.data ? -1 : 1;
+	return ea->i - eb->i;
+}
+
+static int same_event(struct ls_event *ea, struct ls_event *eb)
+{
+	return ea->rec.from_host_id == eb->rec.from_host_id &&
+	       ea->rec.from_generation == eb->rec.from_generation &&
+	       ea->rec.he.event == eb->rec.he.event &&
+	       ea->rec.he.data == eb->rec.he.data;
+}
+
+/*
+ * Handle the events read from all lockspaces in this cycle.  In a
+ * fencing storm the same request from a host arrives through every
+ * lockspace it shares with us, and from many hosts at once, so the
+ * events are sorted and each distinct host/generation/event is logged
+ * once, with the number of lockspaces it came through.  The actions
+ * are done once, and the per lockspace steps (set_config and the reply)
+ * once for each lockspace with events.
+ */
+
+static void process_events(void)
+{
+	static uint32_t ls_event[MAX_LS];
+	static uint32_t ls_seen[MAX_LS];
+	static uint64_t ls_from_host[MAX_LS];
+	static uint64_t ls_from_gen[MAX_LS];
+	static uint32_t cycle_seq;
+	struct ls_event *le;
+	uint64_t event, event_out;
+	char more[32];
+	int a, b, i, n, rv;
+	uint32_t all_events = 0;
+
+	if (!cycle_count)
+		return;
+
+	/* a new seq for this cycle marks the lockspaces that had events */
+	cycle_seq++;
+
+	qsort(cycle_events, cycle_count, sizeof(struct ls_event), cmp_event);
+
+	for (a = 0; a < cycle_count; a = b) {
+		for (b = a + 1; b < cycle_count && same_event(&cycle_events[a], &cycle_events[b]); b++)
+			;
+
+		le = &cycle_events[a];
+		event = le->rec.he.event;
+
+		/* the number of lockspaces, the entries for one are adjacent */
+		for (n = 1, i = a + 1; i < b; i++) {
+			if (cycle_events[i].i != cycle_events[i - 1].i)
+				n++;
+		}
+
+		memset(more, 0, sizeof(more));
+		if (n > 1)
+			snprintf(more, sizeof(more), " and %d more", n - 1);
 
 		if (event & (EVENT_RESET | EVENT_REBOOT)) {
-			log_notice("request to %s%s(%llx %llx) from host %llu %llu ls %s",
+			log_notice("request to %s%s(%llx %llx) from host %llu %llu ls %s%s",
 				   (event & EVENT_RESET) ? "reset " : "",
 				   (event & EVENT_REBOOT) ? "reboot " : "",
-				   (unsigned long long)from_he.event,
-				   (unsigned long long)from_he.data,
-				   (unsigned long long)from_host,
-				   (unsigned long long)from_gen,
-				   ls_names[i]);
+				   (unsigned long long)le->rec.he.event,
+				   (unsigned long long)le->rec.he.data,
+				   (unsigned long long)le->rec.from_host_id,
+				   (unsigned long long)le->rec.from_generation,
+				   ls_names[le->i] ? ls_names[le->i] : "-", more);
 		}
 
 		if (event & (EVENT_RESETTING | EVENT_REBOOTING)) {
-			log_notice("notice of %s%s(%llx %llx) from host %llu %llu ls %s",
+			log_notice("notice of %s%s(%llx %llx) from host %llu %llu ls %s%s",
 				   (event & EVENT_RESETTING) ? "resetting " : "",
 				   (event & EVENT_REBOOTING) ? "rebooting " : "",
-				   (unsigned long long)from_he.event,
-				   (unsigned long long)from_he.data,
-				   (unsigned long long)from_host,
-				   (unsigned long long)from_gen,
-				   ls_names[i]);
+				   (unsigned long long)le->rec.he.event,
+				   (unsigned long long)le->rec.he.data,
+				   (unsigned long long)le->rec.from_host_id,
+				   (unsigned long long)le->rec.from_generation,
+				   ls_names[le->i] ? ls_names[le->i] : "-", more);
 		}
 
-		if ((event & EVENT_REBOOT) && !use_sysrq_reboot) {
-			event &= ~EVENT_REBOOT;
-			log_error("ignore reboot request sysrq_reboot not enabled");
+		for (i = a; i < b; i++) {
+			le = &cycle_events[i];
+			if (ls_seen[le->i] != cycle_seq) {
+				ls_seen[le->i] = cycle_seq;
+				ls_event[le->i] = 0;
+			}
+			ls_event[le->i] |= (uint32_t)event;
+			ls_from_host[le->i] = le->rec.from_host_id;
+			ls_from_gen[le->i] = le->rec.from_generation;
 		}
 
-		if ((event & EVENT_RESET) && !resource_mode) {
+		all_events |= (uint32_t)event;
+	}
+
+	cycle_count = 0;
+
+	if ((all_events & EVENT_REBOOT) && !use_sysrq_reboot) {
+		all_events &= ~EVENT_REBOOT;
+		log_error("ignore reboot request sysrq_reboot not enabled");
+	}
+
+	for (i = 0; i < MAX_LS; i++) {
+		if (ls_seen[i] != cycle_seq || !ls_names[i])
+			continue;
+		if ((ls_event[i] & EVENT_RESET) && !resource_mode) {
 			/* prevent lockspaces from cleanly exiting from lost storage,
 			   if this cannot be done, then do not set_event_out. */
 
@@ -359,50 +529,55 @@ static void get_events(int i)
 			if (rv < 0) {
 				log_error("sanlock_set_config error %d ls %s",
 					  rv, ls_names[i]);
-				set_config_failed = 1;
+				/* then no reply from this lockspace */
+				ls_seen[i] = 0;
 			}
 		}
+	}
 
-		if ((event & EVENT_RESET) && !we_are_resetting) {
-			we_are_resetting = 1;
-			poll_timeout = 1000;
-			wd_reset_failed = watchdog_reset_self();
-		}
+	if ((all_events & EVENT_RESET) && !we_are_resetting) {
+		we_are_resetting = 1;
+		poll_timeout = 1000;
+		wd_reset_failed = watchdog_reset_self();
+	}
 
+	if ((all_events & EVENT_REBOOT) && !we_are_rebooting) {
+		we_are_rebooting = 1;
+		poll_timeout = 1000;
+		rebooting_time = monotime();
+	}
 
-		if ((event & EVENT_REBOOT) && !we_are_rebooting) {
-			we_are_rebooting = 1;
-			poll_timeout = 1000;
-			rebooting_time = monotime();
-		}
+	/*
+	 * We attempt to reply to reset requests in any lockspace
+	 * where we get one, even though we initiate the reset only
+	 * the first time we get the request.  The first lockspace
+	 * through which we get the request is most likely to get
+	 * our reply.  Our reply through subsequent lockspaces are
+	 * less likely to have time to be written out before the
+	 * reset/reboot actually occur.
+	 *
+	 * Our resetting reply is addressed to all hosts.  Multiple
+	 * hosts could ask us to reset, and all will get the reply
+	 * to the first we receive.
+	 */
 
-		/*
-		 * We attempt to reply to reset requests in any lockspace
-		 * where we get one, even though we initiate the reset only
-		 * the first time we get the request.  The first lockspace
-		 * through which we get the request is most likely to get
-		 * our reply.  Our reply through subsequent lockspaces are
-		 * less likely to have time to be written out before the
-		 * reset/reboot actually occur.
-		 *
-		 * Our resetting reply is addressed to all hosts.  Multiple
-		 * hosts could ask us to reset, and all will get the reply
-		 * to the first we receive.
-		 */
-
-		if (we_are_resetting && !wd_reset_failed)
-			event_out |= EVENT_RESETTING;
-		if (we_are_rebooting)
-			event_out |= EVENT_REBOOTING;
-
-		if (event_out && !set_config_failed) {
-			set_event_out(ls_names[i], event_out, from_host, from_gen);
-
-			/* No further events from this lockspace are useful. */
-			pollfd[i].fd = -1;
-			pollfd[i].events = 0;
-			return;
-		}
+	event_out = 0;
+	if (we_are_resetting && !wd_reset_failed)
+		event_out |= EVENT_RESETTING;
+	if (we_are_rebooting)
+		event_out |= EVENT_REBOOTING;
+
+	if (!event_out)
+		return;
+
+	for (i = 0; i < MAX_LS; i++) {
+		if (ls_seen[i] != cycle_seq || !ls_names[i] || !ls_polled[i])
+			continue;
+
+		set_event_out(ls_names[i], event_out, ls_from_host[i], ls_from_gen[i]);
+
+		/* No further events from this lockspace are useful. */
+		unpoll_ls(i);
 	}
 }
 
@@ -565,8 +740,10 @@ static void usage(void)
 
 int main(int argc, char *argv[])
 {
+	struct epoll_event events[EPOLL_EVENTS];
+	uint32_t index;
 	int ls_argc = 0;
-	int i, rv;
+	int i, n, count, rv;
 
 	static struct option long_options[] = {
 		{"help",	  no_argument,	    0, 'h' },
@@ -662,22 +839,17 @@ int main(int argc, char *argv[])
 		goto out;
 	}
 
-	/*
-	 * MAX_LS+2: MAX_LS fd's for lockspace, 1 fd for signal_fd, 1 fd for update_fd.
-	 */
-
-	pollfd = malloc(POLLFD_COUNT * sizeof(struct pollfd));
-	if (!pollfd)
-		return -ENOMEM;
-	memset(pollfd, 0, POLLFD_COUNT * sizeof(struct pollfd));
-
-	for (i = 0; i < POLLFD_COUNT; i++)
-		pollfd[i].fd = -1;
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		log_error("failed to set up epoll fd %d", errno);
+		goto out;
+	}
 
-	pollfd[SIGNAL_INDEX].fd = signal_fd;
-	pollfd[SIGNAL_INDEX].events = POLLIN;
-	pollfd[UPDATE_INDEX].fd = update_fd;
-	pollfd[UPDATE_INDEX].events = POLLIN;
+	if (epoll_add(signal_fd, SIGNAL_INDEX) < 0 ||
+	    epoll_add(update_fd, UPDATE_INDEX) < 0) {
+		log_error("failed to add epoll fds %d", errno);
+		goto out;
+	}
 
 	/*
 	 * register with sanlock for each initial lockspace
@@ -692,23 +864,33 @@ int main(int argc, char *argv[])
 	poll_timeout = -1;
 
 	while (1) {
-		rv = poll(pollfd, POLLFD_COUNT, poll_timeout);
+		rv = epoll_wait(epoll_fd, events, EPOLL_EVENTS, poll_timeout);
 		if (rv == -1 && errno == EINTR)
 			continue;
 		if (rv < 0)
 			break;
 
-		if (pollfd[SIGNAL_INDEX].revents & POLLIN)
-			process_signal(pollfd[SIGNAL_INDEX].fd);
+		count = rv;
 
-		if (pollfd[UPDATE_INDEX].revents & POLLIN)
-			process_update(pollfd[UPDATE_INDEX].fd);
+		for (n = 0; n < count; n++) {
+			index = events[n].data.u32;
+
+			if (index == SIGNAL_INDEX) {
+				if (events[n].events & EPOLLIN)
+					process_signal(signal_fd);
+				continue;
+			}
 
-		if (pollfd[UPDATE_INDEX].revents & (POLLERR | POLLHUP | POLLNVAL)) {
-			close(update_fd);
-			pollfd[UPDATE_INDEX].fd = -1;
-			pollfd[UPDATE_INDEX].events = 0;
-			pollfd[UPDATE_INDEX].revents = 0;
+			if (index == UPDATE_INDEX) {
+				if (events[n].events & EPOLLIN)
+					process_update(update_fd);
+
+				if (events[n].events & (EPOLLERR | EPOLLHUP)) {
+					epoll_del(update_fd);
+					close(update_fd);
+				}
+				continue;
+			}
 		}
 
 		if (daemon_quit)
@@ -718,18 +900,31 @@ int main(int argc, char *argv[])
 			sysrq_reboot();
 		}
 
-		for (i = 0; i < MAX_LS; i++) {
-			if (pollfd[i].revents & POLLIN)
-				get_events(i);
-
-			if (pollfd[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
-				log_debug("unregister %d ls_fd %d pollfd %d %x %x ls %s",
-					  i, ls_fd[i], pollfd[i].fd,
-					  pollfd[i].events, pollfd[i].revents,
-					  ls_names[i]);
-				unregister_ls(i);
+		for (n = 0; n < count; n++) {
+			index = events[n].data.u32;
+
+			if (index >= MAX_LS)
+				continue;
+
+			/* process_update may have ended or replaced it */
+			if (!ls_names[index] || !ls_polled[index])
+				continue;
+
+			if (events[n].events & EPOLLIN)
+				get_events(index);
+
+			if (!ls_names[index])
+				continue;
+
+			if (events[n].events & (EPOLLERR | EPOLLHUP)) {
+				log_debug("unregister %d ls_fd %d events %x ls %s",
+					  index, ls_fd[index], events[n].events,
+					  ls_names[index]);
+				unregister_ls(index);
 			}
 		}
+
+		process_events();
 	}
 
 	log_debug("unregister daemon_quit=%d ls_count=%d", daemon_quit, ls_count);
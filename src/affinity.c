@@ -0,0 +1,298 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <syslog.h>
+
+#include "sanlock_internal.h"
+#include "log.h"
+#include "affinity.h"
+
+/*
+ * A thread created by a thread of another class inherits the creator's
+ * cpus and policy, e.g. lockspace threads are started by workers.  So
+ * when any class sets cpus or a policy, the threads of classes that
+ * don't set them are given the daemon's own, saved from the main thread
+ * after setup_priority.  The log thread is started before setup_priority
+ * and keeps what it has unless log_cpus or log_sched is set.
+ */
+
+#define THREAD_CPUS_LEN 64
+
+struct thread_class {
+	const char *name;
+	char cpus_str[THREAD_CPUS_LEN];
+	cpu_set_t cpus;
+	int cpus_set;
+	int policy;
+	int priority;
+	int sched_set;
+	struct thread_wake_stats wake;
+};
+
+static struct thread_class thread_classes[THREAD_CLASSES] = {
+	[THREAD_CLASS_MAIN]     = { .name = "main" },
+	[THREAD_CLASS_RENEWAL]  = { .name = "renewal" },
+	[THREAD_CLASS_WORKER]   = { .name = "worker" },
+	[THREAD_CLASS_RESOURCE] = { .name = "resource" },
+	[THREAD_CLASS_LOG]      = { .name = "log" },
+};
+
+static cpu_set_t default_cpus;
+static int default_policy;
+static struct sched_param default_param;
+static int any_cpus;
+static int any_sched;
+static int classes_ready;
+
+/* "0-3,8" */
+
+static int parse_cpus(const char *val, cpu_set_t *cpus)
+{
+	const char *p = val;
+	char *end;
+	long a, b, i;
+
+	CPU_ZERO(cpus);
+
+	while (*p) {
+		a = strtol(p, &end, 10);
+		if (end == p || a < 0 || a >= CPU_SETSIZE)
+			return -EINVAL;
+		b = a;
+		p = end;
+
+		if (*p == '-') {
+			p++;
+			b = strtol(p, &end, 10);
+			if (end == p || b < a || b >= CPU_SETSIZE)
+				return -EINVAL;
+			p = end;
+		}
+
+		for (i = a; i <= b; i++)
+			CPU_SET(i, cpus);
+
+		if (*p == ',')
+			p++;
+		else if (*p)
+			return -EINVAL;
+	}
+
+	return CPU_COUNT(cpus) ? 0 : -EINVAL;
+}
+
+/* "rr:N", "fifo:N" or "other" */
+
+static int parse_sched(const char *val, int *policy, int *priority)
+{
+	const char *p;
+	int min, max, prio = 0;
+
+	if (!strcmp(val, "other")) {
+		*policy = SCHED_OTHER;
+		*priority = 0;
+		return 0;
+	}
+
+	if (!strncmp(val, "rr", 2))
+		*policy = SCHED_RR;
+	else if (!strncmp(val, "fifo", 4))
+		*policy = SCHED_FIFO;
+	else
+		return -EINVAL;
+
+	min = sched_get_priority_min(*policy);
+	max = sched_get_priority_max(*policy);
+
+	/* no priority is the max, like high_priority */
+	p = strchr(val, ':');
+	if (p)
+		prio = atoi(p + 1);
+	else
+		prio = max;
+
+	if (prio < min)
+		prio = min;
+	if (prio > max)
+		prio = max;
+
+	*priority = prio;
+	return 0;
+}
+
+int thread_class_config(const char *key, const char *val)
+{
+	struct thread_class *tc;
+	const char *opt;
+	int class, len;
+
+	for (class = 0; class < THREAD_CLASSES; class++) {
+		tc = &thread_classes[class];
+		len = strlen(tc->name);
+		if (!strncmp(key, tc->name, len) && key[len] == '_')
+			break;
+	}
+	if (class == THREAD_CLASSES)
+		return 0;
+
+	opt = key + len + 1;
+
+	if (!strcmp(opt, "cpus")) {
+		if (parse_cpus(val, &tc->cpus) < 0)
+			return -EINVAL;
+		snprintf(tc->cpus_str, THREAD_CPUS_LEN, "%s", val);
+		tc->cpus_set = 1;
+		any_cpus = 1;
+		return 1;
+	}
+
+	if (!strcmp(opt, "sched")) {
+		if (parse_sched(val, &tc->policy, &tc->priority) < 0)
+			return -EINVAL;
+		tc->sched_set = 1;
+		any_sched = 1;
+		return 1;
+	}
+
+	return 0;
+}
+
+void thread_class_apply(int class, pthread_t th)
+{
+	struct thread_class *tc;
+	struct sched_param param;
+	cpu_set_t *cpus = NULL;
+	int policy = -1;
+	int rv;
+
+	if (!classes_ready || class < 0 || class >= THREAD_CLASSES)
+		return;
+
+	tc = &thread_classes[class];
+
+	if (tc->cpus_set)
+		cpus = &tc->cpus;
+	else if (any_cpus && class != THREAD_CLASS_LOG)
+		cpus = &default_cpus;
+
+	if (tc->sched_set) {
+		policy = tc->policy;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = tc->priority;
+	} else if (any_sched && class != THREAD_CLASS_LOG) {
+		policy = default_policy;
+		param = default_param;
+	}
+
+	if (cpus) {
+		rv = pthread_setaffinity_np(th, sizeof(cpu_set_t), cpus);
+		if (rv)
+			log_error("thread class %s set cpus error %d", tc->name, rv);
+	}
+
+	if (policy < 0)
+		return;
+
+	/* helpers are forked from the main thread, see setup_priority */
+	if (pthread_equal(th, pthread_self())) {
+		rv = sched_setscheduler(0, policy | SCHED_RESET_ON_FORK, &param);
+		if (rv < 0)
+			rv = errno;
+	} else {
+		rv = pthread_setschedparam(th, policy, &param);
+	}
+
+	if (rv)
+		log_error("thread class %s set policy %d priority %d error %d",
+			  tc->name, policy, param.sched_priority, rv);
+}
+
+void thread_class_setup(int class)
+{
+	thread_class_apply(class, pthread_self());
+}
+
+void setup_thread_classes(void)
+{
+	struct thread_class *tc;
+	int class;
+
+	if (!any_cpus && !any_sched)
+		return;
+
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &default_cpus) < 0) {
+		log_error("thread classes get cpus error %d", errno);
+		any_cpus = 0;
+	}
+
+	default_policy = sched_getscheduler(0);
+	if (default_policy < 0 || sched_getparam(0, &default_param) < 0) {
+		log_error("thread classes get policy error %d", errno);
+		any_sched = 0;
+	}
+	default_policy &= ~SCHED_RESET_ON_FORK;
+
+	for (class = 0; class < THREAD_CLASSES; class++) {
+		tc = &thread_classes[class];
+		if (!tc->cpus_set && !tc->sched_set)
+			continue;
+		log_warn("thread class %s cpus %s policy %d priority %d",
+			 tc->name, tc->cpus_set ? tc->cpus_str : "default",
+			 tc->sched_set ? tc->policy : -1, tc->priority);
+	}
+
+	classes_ready = 1;
+
+	thread_class_setup(THREAD_CLASS_MAIN);
+}
+
+void thread_class_wake(int class, uint64_t due, uint64_t now)
+{
+	struct thread_wake_stats *ws;
+	uint64_t late, max;
+
+	if (class < 0 || class >= THREAD_CLASSES)
+		return;
+
+	ws = &thread_classes[class].wake;
+	late = (now > due) ? now - due : 0;
+
+	__atomic_add_fetch(&ws->wakes, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ws->late_us, late, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&ws->late_max_us, __ATOMIC_RELAXED);
+	while (late > max &&
+	       !__atomic_compare_exchange_n(&ws->late_max_us, &max, late, 1,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+void thread_class_wake_stats(int class, struct thread_wake_stats *st)
+{
+	struct thread_wake_stats *ws;
+
+	memset(st, 0, sizeof(struct thread_wake_stats));
+
+	if (class < 0 || class >= THREAD_CLASSES)
+		return;
+
+	ws = &thread_classes[class].wake;
+	st->wakes = __atomic_load_n(&ws->wakes, __ATOMIC_RELAXED);
+	st->late_us = __atomic_load_n(&ws->late_us, __ATOMIC_RELAXED);
+	st->late_max_us = __atomic_load_n(&ws->late_max_us, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#ifndef __AFFINITY_H__
+#define __AFFINITY_H__
+
+#include <pthread.h>
+
+/*
+ * Daemon threads are grouped in classes, and sanlock.conf can set the
+ * cpus and scheduling policy of each class with <class>_cpus and
+ * <class>_sched.  Each thread sets up its own class when it starts.
+ */
+
+#define THREAD_CLASS_MAIN     0
+#define THREAD_CLASS_RENEWAL  1	/* lockspace and renewal threads */
+#define THREAD_CLASS_WORKER   2
+#define THREAD_CLASS_RESOURCE 3
+#define THREAD_CLASS_LOG      4
+#define THREAD_CLASSES        5
+
+/*
+ * How late threads of a class run after the time they were due: the
+ * renewal due time, the time a cmd was queued for a worker, or the end
+ * of the main loop's wait.
+ */
+
+struct thread_wake_stats {
+	uint64_t wakes;
+	uint64_t late_us;	/* total */
+	uint64_t late_max_us;
+};
+
+/* returns 1 if key is a thread class option, -EINVAL for a bad value */
+
+int thread_class_config(const char *key, const char *val);
+
+/* called by the main thread after setup_priority */
+
+void setup_thread_classes(void);
+
+void thread_class_setup(int class);
+void thread_class_apply(int class, pthread_t th);
+
+/* due and now are from trace_begin() */
+
+void thread_class_wake(int class, uint64_t due, uint64_t now);
+
+void thread_class_wake_stats(int class, struct thread_wake_stats *st);
+
+#endif
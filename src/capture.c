@@ -0,0 +1,316 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <syslog.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#include "sanlock_internal.h"
+#include "log.h"
+#include "crc32c.h"
+#include "iostats.h"
+#include "trace.h"
+#include "capture.h"
+
+/*
+ * Records are appended to one of two buffers under capture_mutex.  The
+ * capture thread swaps the buffers and writes the full one to the file
+ * every second, or sooner when the buffer is half full, so i/o threads
+ * never write to the file.  If the thread falls behind and the buffer
+ * fills, records are dropped and the number is logged.
+ */
+
+static char *capture_buf[2];
+static int capture_cur;
+static int capture_len;
+static uint32_t capture_dropped;
+static int capture_file_fd = -1;
+static int capture_on;
+static int capture_stop;
+static uint64_t capture_start_us;
+static char *capture_paths[CAPTURE_DISKS];
+static int capture_paths_count;
+static uint16_t capture_fd_disk[IO_STATS_FDS]; /* capture_paths index + 1 */
+static pthread_t capture_thread;
+static pthread_mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t capture_cond = PTHREAD_COND_INITIALIZER;
+static __thread uint32_t capture_tid;
+
+/* called with capture_mutex */
+
+static void capture_append(void *data, int len)
+{
+	if (capture_len + len > CAPTURE_BUF_SIZE) {
+		capture_dropped++;
+		return;
+	}
+
+	memcpy(capture_buf[capture_cur] + capture_len, data, len);
+	capture_len += len;
+
+	if (capture_len >= CAPTURE_BUF_SIZE / 2)
+		pthread_cond_signal(&capture_cond);
+}
+
+static int write_all(int fd, char *buf, int len)
+{
+	int rv, pos = 0;
+
+	while (pos < len) {
+		rv = write(fd, buf + pos, len - pos);
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv < 0)
+			return -errno;
+		pos += rv;
+	}
+	return 0;
+}
+
+static void *capture_thread_main(void *arg GNUC_UNUSED)
+{
+	struct timespec ts;
+	uint32_t dropped;
+	char *out;
+	int out_len, stop, rv;
+
+	pthread_mutex_lock(&capture_mutex);
+	while (1) {
+		if (!capture_stop && capture_len < CAPTURE_BUF_SIZE / 2) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += 1;
+			pthread_cond_timedwait(&capture_cond, &capture_mutex, &ts);
+		}
+
+		out = capture_buf[capture_cur];
+		out_len = capture_len;
+		dropped = capture_dropped;
+		stop = capture_stop;
+		capture_cur ^= 1;
+		capture_len = 0;
+		capture_dropped = 0;
+		pthread_mutex_unlock(&capture_mutex);
+
+		if (dropped)
+			log_error("io capture dropped %u records", dropped);
+
+		if (out_len) {
+			rv = write_all(capture_file_fd, out, out_len);
+			if (rv < 0) {
+				log_error("io capture write error %d, stopping capture", rv);
+				__atomic_store_n(&capture_on, 0, __ATOMIC_RELEASE);
+				break;
+			}
+		}
+
+		if (stop)
+			break;
+
+		pthread_mutex_lock(&capture_mutex);
+	}
+
+	return NULL;
+}
+
+void capture_open(int fd, const char *path)
+{
+	struct capture_rec rec;
+	char rec_path[SANLK_PATH_LEN];
+	int i;
+
+	if (!__atomic_load_n(&capture_on, __ATOMIC_ACQUIRE))
+		return;
+
+	if (fd < 0 || fd >= IO_STATS_FDS)
+		return;
+
+	pthread_mutex_lock(&capture_mutex);
+	for (i = 0; i < capture_paths_count; i++) {
+		if (!strncmp(capture_paths[i], path, SANLK_PATH_LEN))
+			break;
+	}
+
+	if (i == capture_paths_count) {
+		if (capture_paths_count == CAPTURE_DISKS)
+			goto out;
+
+		capture_paths[i] = strndup(path, SANLK_PATH_LEN - 1);
+		if (!capture_paths[i])
+			goto out;
+		capture_paths_count++;
+
+		memset(&rec, 0, sizeof(rec));
+		rec.time_us = trace_begin() - capture_start_us;
+		rec.op = CAPTURE_DISK;
+		rec.disk = i;
+
+		memset(rec_path, 0, sizeof(rec_path));
+		strncpy(rec_path, path, SANLK_PATH_LEN - 1);
+
+		if (capture_len + sizeof(rec) + sizeof(rec_path) > CAPTURE_BUF_SIZE) {
+			/* the disk record must not be lost */
+			pthread_cond_signal(&capture_cond);
+			while (capture_len + sizeof(rec) + sizeof(rec_path) > CAPTURE_BUF_SIZE &&
+			       __atomic_load_n(&capture_on, __ATOMIC_ACQUIRE)) {
+				pthread_mutex_unlock(&capture_mutex);
+				usleep(1000);
+				pthread_mutex_lock(&capture_mutex);
+			}
+		}
+		capture_append(&rec, sizeof(rec));
+		capture_append(rec_path, sizeof(rec_path));
+	}
+
+	__atomic_store_n(&capture_fd_disk[fd], i + 1, __ATOMIC_RELEASE);
+ out:
+	pthread_mutex_unlock(&capture_mutex);
+}
+
+void capture_close(int fd)
+{
+	if (fd < 0 || fd >= IO_STATS_FDS)
+		return;
+
+	__atomic_store_n(&capture_fd_disk[fd], 0, __ATOMIC_RELEASE);
+}
+
+void capture_io(struct task *task, int fd, int cmd, uint64_t offset, int len,
+		const char *buf, uint64_t begin, int result)
+{
+	struct capture_rec rec;
+	uint64_t now;
+	int disk;
+
+	if (!__atomic_load_n(&capture_on, __ATOMIC_ACQUIRE))
+		return;
+
+	if (fd < 0 || fd >= IO_STATS_FDS)
+		return;
+
+	disk = __atomic_load_n(&capture_fd_disk[fd], __ATOMIC_ACQUIRE);
+	if (!disk)
+		return;
+
+	if (!capture_tid)
+		capture_tid = syscall(SYS_gettid);
+
+	now = trace_begin();
+
+	memset(&rec, 0, sizeof(rec));
+	rec.time_us = (begin > capture_start_us) ? begin - capture_start_us : 0;
+	rec.offset = offset;
+	rec.len = len;
+	rec.latency_us = (now > begin) ? (uint32_t)(now - begin) : 0;
+	rec.result = result;
+	rec.tid = capture_tid;
+	rec.op = (cmd == IO_CMD_PWRITE) ? CAPTURE_WRITE : CAPTURE_READ;
+	rec.disk = disk - 1;
+	rec.io_op = task ? task->io_op : 0;
+
+	if (cmd == IO_CMD_PWRITE && buf)
+		rec.hash = crc32c((uint32_t)~1, (uint8_t *)buf, len);
+
+	pthread_mutex_lock(&capture_mutex);
+	capture_append(&rec, sizeof(rec));
+	pthread_mutex_unlock(&capture_mutex);
+}
+
+/* capture is not essential, so errors are logged and not returned */
+
+int setup_capture(void)
+{
+	struct capture_header hdr;
+	struct timespec ts;
+	int fd, rv;
+
+	if (!com.io_capture_file || !com.io_capture_file[0])
+		return 0;
+
+	capture_buf[0] = malloc(CAPTURE_BUF_SIZE);
+	capture_buf[1] = malloc(CAPTURE_BUF_SIZE);
+	if (!capture_buf[0] || !capture_buf[1]) {
+		log_error("io capture no mem");
+		goto fail;
+	}
+
+	fd = open(com.io_capture_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		log_error("io capture open %s error %d", com.io_capture_file, errno);
+		goto fail;
+	}
+	capture_file_fd = fd;
+
+	capture_start_us = trace_begin();
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = CAPTURE_MAGIC;
+	hdr.version = CAPTURE_VERSION;
+	hdr.rec_size = sizeof(struct capture_rec);
+	hdr.start_real_us = ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+	hdr.start_us = capture_start_us;
+
+	rv = write_all(fd, (char *)&hdr, sizeof(hdr));
+	if (rv < 0) {
+		log_error("io capture write %s error %d", com.io_capture_file, rv);
+		goto fail;
+	}
+
+	rv = pthread_create(&capture_thread, NULL, capture_thread_main, NULL);
+	if (rv) {
+		log_error("io capture thread error %d", rv);
+		goto fail;
+	}
+
+	log_warn("io capture to %s", com.io_capture_file);
+	__atomic_store_n(&capture_on, 1, __ATOMIC_RELEASE);
+	return 0;
+
+ fail:
+	if (capture_file_fd != -1) {
+		close(capture_file_fd);
+		capture_file_fd = -1;
+	}
+	free(capture_buf[0]);
+	free(capture_buf[1]);
+	capture_buf[0] = NULL;
+	capture_buf[1] = NULL;
+	return 0;
+}
+
+/* the remaining records are written before the thread exits */
+
+void close_capture(void)
+{
+	if (capture_file_fd == -1)
+		return;
+
+	pthread_mutex_lock(&capture_mutex);
+	if (__atomic_load_n(&capture_on, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&capture_on, 0, __ATOMIC_RELEASE);
+		capture_stop = 1;
+		pthread_cond_signal(&capture_cond);
+	}
+	pthread_mutex_unlock(&capture_mutex);
+
+	pthread_join(capture_thread, NULL);
+
+	close(capture_file_fd);
+	capture_file_fd = -1;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+/*
+ * Capture of every disk i/o done by the daemon, written to the file set
+ * by io_capture_file, and replayed by tests/sanlk_replay.
+ *
+ * The file begins with a capture_header, followed by capture_rec
+ * records.  A CAPTURE_DISK record is written the first time a disk path
+ * is opened, and is followed by SANLK_PATH_LEN bytes of path.  i/o
+ * records refer to the path by that disk number.
+ */
+
+#define CAPTURE_MAGIC   0x53434150 /* "SCAP" */
+#define CAPTURE_VERSION 1
+
+#define CAPTURE_DISK  1
+#define CAPTURE_READ  2
+#define CAPTURE_WRITE 3
+
+#define CAPTURE_DISKS    1024
+#define CAPTURE_BUF_SIZE (1024 * 1024)
+
+struct capture_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t rec_size;
+	uint32_t pad;
+	uint64_t start_real_us;	/* CLOCK_REALTIME at start */
+	uint64_t start_us;	/* CLOCK_MONOTONIC at start, rec time_us is from this */
+};
+
+struct capture_rec {
+	uint64_t time_us;	/* when the i/o was started */
+	uint64_t offset;
+	uint32_t len;
+	uint32_t latency_us;
+	uint32_t hash;		/* crc32c of the data written */
+	int32_t result;		/* 0 or -errno, SANLK_AIO_TIMEOUT */
+	uint32_t tid;
+	uint16_t op;		/* CAPTURE_ */
+	uint16_t disk;
+	uint16_t io_op;		/* SANLK_IO_ */
+	uint16_t pad[3];
+};
+
+int setup_capture(void);
+void close_capture(void);
+
+void capture_open(int fd, const char *path);
+void capture_close(int fd);
+
+/* begin is from trace_begin() */
+
+void capture_io(struct task *task, int fd, int cmd, uint64_t offset, int len,
+		const char *buf, uint64_t begin, int result);
+
+#endif
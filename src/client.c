@@ -21,12 +21,14 @@
 #include <syslog.h>
 #include <pthread.h>
 #include <poll.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/un.h>
+#include <sys/mman.h>
 
 #include "sanlock.h"
 #include "sanlock_internal.h"
@@ -70,8 +72,8 @@ static int connect_socket(int *sock_fd)
 	return 0;
 }
 
-static int send_header(int sock, int cmd, uint32_t cmd_flags, int datalen,
-		       uint32_t data, uint32_t data2)
+static int send_header_seq(int sock, int cmd, uint32_t cmd_flags, int datalen,
+			   uint32_t data, uint32_t data2, uint32_t seq)
 {
 	struct sm_header header;
 	int rv;
@@ -82,6 +84,7 @@ static int send_header(int sock, int cmd, uint32_t cmd_flags, int datalen,
 	header.cmd = cmd;
 	header.cmd_flags = cmd_flags;
 	header.length = sizeof(header) + datalen;
+	header.seq = seq;
 	header.data = data;
 	header.data2 = data2;
 
@@ -96,6 +99,12 @@ retry:
 	return 0;
 }
 
+static int send_header(int sock, int cmd, uint32_t cmd_flags, int datalen,
+		       uint32_t data, uint32_t data2)
+{
+	return send_header_seq(sock, cmd, cmd_flags, datalen, data, data2, 0);
+}
+
 static ssize_t send_data(int sockfd, const void *buf, size_t len, int flags)
 {
 	ssize_t rv;
@@ -153,6 +162,68 @@ retry:
 	return (int)h.data;
 }
 
+/*
+ * With a TIMES flag, the daemon follows the reply header with struct
+ * sanlk_op_times.  Anything beyond the size known here is discarded.
+ */
+
+static int recv_result_times(int fd, struct sanlk_op_times *times)
+{
+	struct sm_header h;
+	char skip[64];
+	int extra, len, rv;
+
+	memset(times, 0, sizeof(struct sanlk_op_times));
+	memset(&h, 0, sizeof(h));
+
+	rv = recv_data(fd, &h, sizeof(h), MSG_WAITALL);
+	if (rv < 0)
+		return -errno;
+	if (rv != sizeof(h))
+		return -1;
+
+	extra = (h.length > sizeof(h)) ? h.length - sizeof(h) : 0;
+
+	len = extra;
+	if (len > (int)sizeof(struct sanlk_op_times))
+		len = sizeof(struct sanlk_op_times);
+
+	if (len) {
+		rv = recv_data(fd, times, len, MSG_WAITALL);
+		if (rv != len)
+			return -1;
+		extra -= len;
+	}
+
+	while (extra > 0) {
+		len = (extra > (int)sizeof(skip)) ? (int)sizeof(skip) : extra;
+		rv = recv_data(fd, skip, len, MSG_WAITALL);
+		if (rv != len)
+			return -1;
+		extra -= len;
+	}
+
+	return (int)h.data;
+}
+
+/*
+ * Async requests are told apart from the blocking ones by a nonzero
+ * header seq, which the daemon copies into the reply.
+ */
+
+static uint32_t async_req_id;
+
+static uint32_t next_req_id(void)
+{
+	uint32_t id;
+
+	do {
+		id = __atomic_add_fetch(&async_req_id, 1, __ATOMIC_RELAXED);
+	} while (!id);
+
+	return id;
+}
+
 static int cmd_lockspace(int cmd, struct sanlk_lockspace *ls, uint32_t flags, uint32_t data)
 {
 	int rv, fd;
@@ -197,6 +268,70 @@ int sanlock_rem_lockspace(struct sanlk_lockspace *ls, uint32_t flags)
 	return cmd_lockspace(SM_CMD_REM_LOCKSPACE, ls, flags, 0);
 }
 
+/*
+ * send an array of lockspaces, and get back the result for each
+ */
+
+static int cmd_lockspaces(int cmd, struct sanlk_lockspace *ls, int ls_count,
+			  uint32_t flags, uint32_t data, int *results)
+{
+	int ls_len, res_len;
+	int rv, fd;
+
+	if (!ls || !results || ls_count < 1 || ls_count > 4096)
+		return -EINVAL;
+
+	ls_len = ls_count * sizeof(struct sanlk_lockspace);
+	res_len = ls_count * sizeof(int);
+
+	rv = connect_socket(&fd);
+	if (rv < 0)
+		return rv;
+
+	rv = send_header(fd, cmd, flags, ls_len, data, ls_count);
+	if (rv < 0)
+		goto out;
+
+	rv = send_data(fd, ls, ls_len, 0);
+	if (rv < 0) {
+		rv = -errno;
+		goto out;
+	}
+
+	rv = recv_result(fd);
+	if (rv < 0)
+		goto out;
+
+	rv = recv_data(fd, results, res_len, MSG_WAITALL);
+	if (rv < 0) {
+		rv = -errno;
+		goto out;
+	}
+
+	if (rv != res_len) {
+		rv = -1;
+		goto out;
+	}
+
+	rv = 0;
+ out:
+	close(fd);
+	return rv;
+}
+
+int sanlock_add_lockspaces(struct sanlk_lockspace *ls, int ls_count,
+			   uint32_t flags, uint32_t io_timeout, int *results)
+{
+	return cmd_lockspaces(SM_CMD_ADD_LOCKSPACES, ls, ls_count, flags,
+			      io_timeout, results);
+}
+
+int sanlock_rem_lockspaces(struct sanlk_lockspace *ls, int ls_count,
+			   uint32_t flags, int *results)
+{
+	return cmd_lockspaces(SM_CMD_REM_LOCKSPACES, ls, ls_count, flags, 0, results);
+}
+
 int sanlock_get_lockspaces(struct sanlk_lockspace **lss, int *lss_count,
 			   uint32_t flags)
 {
@@ -268,6 +403,358 @@ int sanlock_get_lockspaces(struct sanlk_lockspace **lss, int *lss_count,
 	return rv;
 }
 
+int sanlock_get_stats(struct sanlk_io_stats **stats, int *stats_count,
+		      uint32_t flags)
+{
+	struct sanlk_io_stats *stbuf, *st;
+	struct sm_header h;
+	int rv, fd, i, ret, recv_count;
+
+	rv = connect_socket(&fd);
+	if (rv < 0)
+		return rv;
+
+	rv = send_header(fd, SM_CMD_GET_STATS, flags, 0, 0, 0);
+	if (rv < 0)
+		goto out;
+
+	memset(&h, 0, sizeof(h));
+
+	rv = recv_data(fd, &h, sizeof(h), MSG_WAITALL);
+	if (rv < 0) {
+		rv = -errno;
+		goto out;
+	}
+
+	if (rv != sizeof(h)) {
+		rv = -1;
+		goto out;
+	}
+
+	/* -ENOSPC means that the daemon's send buffer ran out of space */
+
+	rv = (int)h.data;
+	if (rv < 0 && rv != -ENOSPC)
+		goto out;
+
+	*stats_count = h.data2;
+	recv_count = h.data2;
+
+	if (!stats || !recv_count)
+		goto out;
+
+	stbuf = malloc(recv_count * sizeof(struct sanlk_io_stats));
+	if (!stbuf) {
+		rv = -ENOMEM;
+		goto out;
+	}
+
+	st = stbuf;
+
+	for (i = 0; i < recv_count; i++) {
+		ret = recv_data(fd, st, sizeof(struct sanlk_io_stats), MSG_WAITALL);
+		if (ret < 0) {
+			rv = -errno;
+			free(stbuf);
+			goto out;
+		}
+
+		if (ret != sizeof(struct sanlk_io_stats)) {
+			rv = -1;
+			free(stbuf);
+			goto out;
+		}
+
+		st++;
+	}
+
+	*stats = stbuf;
+ out:
+	close(fd);
+	return rv;
+}
+
+int sanlock_pipeline_open(void)
+{
+	int rv, fd;
+
+	rv = connect_socket(&fd);
+	if (rv < 0)
+		return rv;
+
+	rv = send_header(fd, SM_CMD_PIPELINE, 0, 0, 0, 0);
+	if (rv < 0)
+		goto fail;
+
+	rv = recv_result(fd);
+	if (rv < 0)
+		goto fail;
+
+	return fd;
+ fail:
+	close(fd);
+	return rv;
+}
+
+int sanlock_pipeline_inq_lockspace(int fd, struct sanlk_lockspace *ls,
+				   uint32_t flags, uint32_t *req_id)
+{
+	uint32_t id;
+	int rv;
+
+	if (fd < 0 || !ls || !req_id)
+		return -EINVAL;
+
+	id = next_req_id();
+
+	rv = send_header_seq(fd, SM_CMD_INQ_LOCKSPACE, flags,
+			     sizeof(struct sanlk_lockspace), 0, 0, id);
+	if (rv < 0)
+		return rv;
+
+	rv = send_data(fd, ls, sizeof(struct sanlk_lockspace), 0);
+	if (rv < 0)
+		return -errno;
+
+	*req_id = id;
+	return 0;
+}
+
+int sanlock_pipeline_read_resource_owners(int fd, struct sanlk_resource *res,
+					  uint32_t flags, uint32_t *req_id)
+{
+	uint32_t id;
+	int rv;
+
+	if (fd < 0 || !req_id || !res || !res->num_disks ||
+	    res->num_disks > SANLK_MAX_DISKS || !res->disks[0].path[0])
+		return -EINVAL;
+
+	id = next_req_id();
+
+	rv = send_header_seq(fd, SM_CMD_READ_RESOURCE_OWNERS, flags,
+			     sizeof(struct sanlk_resource) +
+			     sizeof(struct sanlk_disk) * res->num_disks,
+			     0, 0, id);
+	if (rv < 0)
+		return rv;
+
+	rv = send_data(fd, res, sizeof(struct sanlk_resource), 0);
+	if (rv < 0)
+		return -errno;
+
+	rv = send_data(fd, res->disks, sizeof(struct sanlk_disk) * res->num_disks, 0);
+	if (rv < 0)
+		return -errno;
+
+	*req_id = id;
+	return 0;
+}
+
+int sanlock_pipeline_get_lvb(int fd, struct sanlk_resource *res, int lvblen,
+			     uint32_t flags, uint32_t *req_id)
+{
+	uint32_t id;
+	int rv;
+
+	if (fd < 0 || !res || !req_id || lvblen < 0)
+		return -EINVAL;
+
+	id = next_req_id();
+
+	rv = send_header_seq(fd, SM_CMD_GET_LVB, flags,
+			     sizeof(struct sanlk_resource), 0, lvblen, id);
+	if (rv < 0)
+		return rv;
+
+	rv = send_data(fd, res, sizeof(struct sanlk_resource), 0);
+	if (rv < 0)
+		return -errno;
+
+	*req_id = id;
+	return 0;
+}
+
+int sanlock_pipeline_recv(int fd, struct sanlk_pipeline_reply *rep, char **data)
+{
+	struct sm_header h;
+	char *buf = NULL;
+	int len, rv;
+
+	if (!rep)
+		return -EINVAL;
+
+	memset(rep, 0, sizeof(struct sanlk_pipeline_reply));
+	memset(&h, 0, sizeof(h));
+
+	rv = recv_data(fd, &h, sizeof(h), MSG_WAITALL);
+	if (rv < 0)
+		return -errno;
+	if (rv != sizeof(h))
+		return -ENOTCONN;
+
+	if (h.magic != SM_MAGIC || h.length < sizeof(h) ||
+	    h.length - sizeof(h) > MAX_CLIENT_MSG)
+		return -EPROTO;
+
+	len = h.length - sizeof(h);
+
+	if (len) {
+		buf = malloc(len);
+		if (!buf)
+			return -ENOMEM;
+
+		rv = recv_data(fd, buf, len, MSG_WAITALL);
+		if (rv != len) {
+			free(buf);
+			return (rv < 0) ? -errno : -ENOTCONN;
+		}
+	}
+
+	rep->req_id = h.seq;
+	rep->result = (int)h.data;
+	rep->data2 = h.data2;
+	rep->data_len = len;
+
+	if (data)
+		*data = buf;
+	else
+		free(buf);
+	return 0;
+}
+
+struct sanlk_state_map {
+	int fd;
+	char *map;
+};
+
+#define STATE_READ_TRIES 64
+
+int sanlock_state_open(struct sanlk_state_map **st_out, uint32_t flags GNUC_UNUSED)
+{
+	struct sanlk_state_map *st;
+	struct stat sb;
+	const char *run_dir;
+	char path[PATH_MAX];
+	int rv;
+
+	st = malloc(sizeof(struct sanlk_state));
+	if (!st)
+		return -ENOMEM;
+
+	run_dir = env_get("SANLOCK_RUN_DIR", DEFAULT_RUN_DIR);
+	snprintf(path, sizeof(path) - 1, "%s/%s", run_dir, SANLK_STATE_NAME);
+
+	st->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (st->fd < 0) {
+		rv = -errno;
+		goto out_free;
+	}
+
+	rv = fstat(st->fd, &sb);
+	if (rv < 0) {
+		rv = -errno;
+		goto out_close;
+	}
+
+	if (sb.st_size < SANLK_STATE_SIZE) {
+		rv = -EINVAL;
+		goto out_close;
+	}
+
+	st->map = mmap(NULL, SANLK_STATE_SIZE, PROT_READ, MAP_SHARED, st->fd, 0);
+	if (st->map == MAP_FAILED) {
+		rv = -errno;
+		goto out_close;
+	}
+
+	*st_out = st;
+	return 0;
+
+ out_close:
+	close(st->fd);
+ out_free:
+	free(st);
+	return rv;
+}
+
+void sanlock_state_close(struct sanlk_state_map *st)
+{
+	if (!st)
+		return;
+	munmap(st->map, SANLK_STATE_SIZE);
+	close(st->fd);
+	free(st);
+}
+
+/*
+ * A daemon that is restarted creates a new file, so an unlinked file, or
+ * one left by a daemon that is gone, means the caller should reopen.
+ */
+
+static int state_stale(struct sanlk_state_map *st, uint32_t daemon_pid)
+{
+	struct stat sb;
+
+	if (fstat(st->fd, &sb) < 0 || !sb.st_nlink)
+		return 1;
+
+	if (kill(daemon_pid, 0) < 0 && errno == ESRCH)
+		return 1;
+
+	return 0;
+}
+
+int sanlock_state_read(struct sanlk_state_map *st, char **buf_out, int *len_out)
+{
+	struct sanlk_state_header *map_hdr = (struct sanlk_state_header *)st->map;
+	struct sanlk_state_header *hdr;
+	uint64_t seq1, seq2;
+	uint32_t len;
+	char *buf;
+	int i;
+
+	buf = malloc(SANLK_STATE_SIZE);
+	if (!buf)
+		return -ENOMEM;
+
+	for (i = 0; i < STATE_READ_TRIES; i++) {
+		seq1 = __atomic_load_n(&map_hdr->seq, __ATOMIC_ACQUIRE);
+		if (seq1 & 1) {
+			usleep(100);
+			continue;
+		}
+
+		len = __atomic_load_n(&map_hdr->len, __ATOMIC_RELAXED);
+		if (len < sizeof(struct sanlk_state_header) || len > SANLK_STATE_SIZE)
+			len = sizeof(struct sanlk_state_header);
+
+		memcpy(buf, st->map, len);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seq2 = __atomic_load_n(&map_hdr->seq, __ATOMIC_RELAXED);
+		if (seq1 != seq2)
+			continue;
+
+		hdr = (struct sanlk_state_header *)buf;
+
+		if (hdr->magic != SANLK_STATE_MAGIC ||
+		    hdr->version != SANLK_STATE_VERSION ||
+		    hdr->len != len)
+			break;
+
+		if (state_stale(st, hdr->daemon_pid))
+			break;
+
+		*buf_out = buf;
+		*len_out = len;
+		return 0;
+	}
+
+	free(buf);
+	return -EAGAIN;
+}
+
 int sanlock_get_hosts(const char *ls_name, uint64_t host_id,
 		      struct sanlk_host **hss, int *hss_count,
 		      uint32_t flags)
@@ -356,6 +843,103 @@ int sanlock_get_hosts(const char *ls_name, uint64_t host_id,
 	return rv;
 }
 
+int sanlock_get_hosts_changed(const char *ls_name, uint64_t since, uint64_t *seq,
+			      struct sanlk_host **hss, int *hss_count,
+			      uint32_t flags)
+{
+	struct sm_header h;
+	struct sanlk_lockspace ls;
+	struct sanlk_host *hsbuf;
+	uint64_t seq_recv;
+	int rv, fd, ret, recv_count, recv_len;
+
+	if (!ls_name || !seq || !hss_count)
+		return -EINVAL;
+
+	if (hss)
+		*hss = NULL;
+
+	memset(&ls, 0, sizeof(struct sanlk_lockspace));
+	strncpy(ls.name, ls_name, SANLK_NAME_LEN);
+
+	rv = connect_socket(&fd);
+	if (rv < 0)
+		return rv;
+
+	rv = send_header(fd, SM_CMD_GET_HOSTS_CHANGED, flags,
+			 sizeof(struct sanlk_lockspace) + sizeof(since),
+			 0, 0);
+	if (rv < 0)
+		goto out;
+
+	rv = send_data(fd, &ls, sizeof(struct sanlk_lockspace), 0);
+	if (rv < 0) {
+		rv = -errno;
+		goto out;
+	}
+
+	rv = send_data(fd, &since, sizeof(since), 0);
+	if (rv < 0) {
+		rv = -errno;
+		goto out;
+	}
+
+	/* receive result, seq and host structs */
+
+	memset(&h, 0, sizeof(h));
+
+	rv = recv_data(fd, &h, sizeof(h), MSG_WAITALL);
+	if (rv < 0) {
+		rv = -errno;
+		goto out;
+	}
+
+	if (rv != sizeof(h)) {
+		rv = -1;
+		goto out;
+	}
+
+	/* -ENOSPC means that the daemon's send buffer ran out of space */
+
+	rv = (int)h.data;
+	if (rv < 0 && rv != -ENOSPC)
+		goto out;
+
+	ret = recv_data(fd, &seq_recv, sizeof(seq_recv), MSG_WAITALL);
+	if (ret != sizeof(seq_recv)) {
+		rv = (ret < 0) ? -errno : -1;
+		goto out;
+	}
+	*seq = seq_recv;
+
+	/* with -ENOSPC, fewer than count were sent */
+
+	recv_len = h.length - sizeof(h) - sizeof(seq_recv);
+	recv_count = recv_len / sizeof(struct sanlk_host);
+	*hss_count = h.data2;
+
+	if (!hss || !recv_count)
+		goto out;
+
+	hsbuf = malloc(recv_len);
+	if (!hsbuf) {
+		rv = -ENOMEM;
+		goto out;
+	}
+
+	ret = recv_data(fd, hsbuf, recv_len, MSG_WAITALL);
+	if (ret != recv_len) {
+		rv = (ret < 0) ? -errno : -1;
+		free(hsbuf);
+		goto out;
+	}
+
+	*hss = hsbuf;
+ out:
+	close(fd);
+	return rv;
+}
+
 int sanlock_set_config(const char *ls_name, uint32_t flags, uint32_t cmd, GNUC_UNUSED void *data)
 {
 	struct sanlk_lockspace ls;
@@ -427,6 +1011,50 @@ int sanlock_align(struct sanlk_disk *disk)
 	return rv;
 }
 
+int sanlock_next_free(struct sanlk_disk *disk, uint32_t flags, uint64_t *offset)
+{
+	struct sanlk_disk disk_recv;
+	int rv, fd;
+
+	if (!disk || !disk->path[0] || !offset)
+		return -EINVAL;
+
+	rv = connect_socket(&fd);
+	if (rv < 0)
+		return rv;
+
+	rv = send_header(fd, SM_CMD_NEXT_FREE, flags, sizeof(struct sanlk_disk), 0, 0);
+	if (rv < 0)
+		goto out;
+
+	rv = send_data(fd, (void *)disk, sizeof(struct sanlk_disk), 0);
+	if (rv < 0) {
+		rv = -errno;
+		goto out;
+	}
+
+	rv = recv_result(fd);
+	if (rv < 0)
+		goto out;
+
+	rv = recv_data(fd, &disk_recv, sizeof(struct sanlk_disk), MSG_WAITALL);
+	if (rv < 0) {
+		rv = -errno;
+		goto out;
+	}
+
+	if (rv != sizeof(struct sanlk_disk)) {
+		rv = -1;
+		goto out;
+	}
+
+	*offset = disk_recv.offset;
+	rv = 0;
+ out:
+	close(fd);
+	return rv;
+}
+
 int sanlock_read_lockspace(struct sanlk_lockspace *ls, uint32_t flags, uint32_t *io_timeout)
 {
 	struct sm_header h;
@@ -778,11 +1406,13 @@ int sanlock_test_resource_owners(struct sanlk_resource *res GNUC_UNUSED,
 	return 0;
 }
 
-int sanlock_reg_event(const char *ls_name, struct sanlk_host_event *he, uint32_t flags)
+static int _reg_event(const char *ls_name, struct sanlk_host_event *he,
+		      struct sanlk_event_filter *ef, uint32_t flags)
 {
 	struct sm_header h;
 	struct sanlk_lockspace ls;
 	struct sanlk_host_event ev;
+	int datalen;
 	int rv, reg_fd;
 
 	if (!ls_name)
@@ -795,11 +1425,19 @@ int sanlock_reg_event(const char *ls_name, struct sanlk_host_event *he, uint32_t
 	if (he)
 		memcpy(&ev, he, sizeof(ev));
 
+	datalen = sizeof(ls) + sizeof(ev);
+	if (ef) {
+		flags |= SANLK_REG_EVENT_FILTER;
+		datalen += sizeof(struct sanlk_event_filter);
+	} else {
+		flags &= ~SANLK_REG_EVENT_FILTER;
+	}
+
 	rv = connect_socket(&reg_fd);
 	if (rv < 0)
 		return rv;
 
-	rv = send_header(reg_fd, SM_CMD_REG_EVENT, flags, sizeof(ls) + sizeof(ev), 0, 0);
+	rv = send_header(reg_fd, SM_CMD_REG_EVENT, flags, datalen, 0, 0);
 	if (rv < 0)
 		goto fail;
 
@@ -811,6 +1449,12 @@ int sanlock_reg_event(const char *ls_name, struct sanlk_host_event *he, uint32_t
 	if (rv < 0)
 		goto fail;
 
+	if (ef) {
+		rv = send_data(reg_fd, ef, sizeof(struct sanlk_event_filter), 0);
+		if (rv < 0)
+			goto fail;
+	}
+
 	memset(&h, 0, sizeof(h));
 
 	rv = recv_data(reg_fd, &h, sizeof(h), MSG_WAITALL);
@@ -834,6 +1478,19 @@ fail:
 	return rv;
 }
 
+int sanlock_reg_event(const char *ls_name, struct sanlk_host_event *he, uint32_t flags)
+{
+	return _reg_event(ls_name, he, NULL, flags);
+}
+
+int sanlock_reg_event_filter(const char *ls_name, struct sanlk_event_filter *ef, uint32_t flags)
+{
+	if (!ef)
+		return -EINVAL;
+
+	return _reg_event(ls_name, NULL, ef, flags);
+}
+
 int sanlock_end_event(int reg_fd, const char *ls_name, uint32_t flags)
 {
 	struct sm_header h;
@@ -986,6 +1643,52 @@ int sanlock_get_event(int reg_fd, GNUC_UNUSED uint32_t flags, struct sanlk_host_
 	return 0;
 }
 
+#define GET_EVENTS_MAX 64
+
+int sanlock_get_events(int reg_fd, GNUC_UNUSED uint32_t flags, struct sanlk_event_rec *recs,
+		       int max, int *count)
+{
+	struct event_cb cbs[GET_EVENTS_MAX];
+	int rv, rem, len, n, i;
+
+	if (!recs || max <= 0 || !count)
+		return -EINVAL;
+
+	*count = 0;
+
+	if (max > GET_EVENTS_MAX)
+		max = GET_EVENTS_MAX;
+
+	rv = recv_data(reg_fd, cbs, max * sizeof(struct event_cb), MSG_DONTWAIT);
+	if (rv < 0)
+		return -errno;
+	if (!rv)
+		return -1;
+
+	len = rv;
+
+	/* the daemon sends whole records, so any partial one follows shortly */
+
+	rem = len % sizeof(struct event_cb);
+	if (rem) {
+		rv = recv_data(reg_fd, (char *)cbs + len, sizeof(struct event_cb) - rem, MSG_WAITALL);
+		if (rv != (int)(sizeof(struct event_cb) - rem))
+			return -1;
+		len += rv;
+	}
+
+	n = len / sizeof(struct event_cb);
+
+	for (i = 0; i < n; i++) {
+		memcpy(&recs[i].he, &cbs[i].he, sizeof(struct sanlk_host_event));
+		recs[i].from_host_id = cbs[i].from_host_id;
+		recs[i].from_generation = cbs[i].from_generation;
+	}
+
+	*count = n;
+	return 0;
+}
+
 /* old api */
 int sanlock_init(struct sanlk_lockspace *ls,
 		 struct sanlk_resource *res,
@@ -1101,16 +1804,18 @@ int sanlock_killpath(int sock, uint32_t flags, const char *path, char *args)
 	return rv;
 }
 
-int sanlock_acquire(int sock, int pid, uint32_t flags, int res_count,
-		    struct sanlk_resource *res_args[],
-		    struct sanlk_options *opt_in)
+/* send an acquire request, the result is read by the caller */
+
+static int send_acquire(int fd, int data2, uint32_t flags, int res_count,
+			struct sanlk_resource *res_args[],
+			struct sanlk_options *opt_in, uint32_t seq)
 {
 	struct sanlk_resource *res;
 	struct sanlk_options opt;
-	int rv, i, fd, data2;
+	int rv, i;
 	int datalen = 0;
 
-	if (res_count > SANLK_MAX_RESOURCES)
+	if (res_count > SANLK_MAX_ACQUIRE_RESOURCES)
 		return -EINVAL;
 
 	for (i = 0; i < res_count; i++) {
@@ -1131,6 +1836,44 @@ int sanlock_acquire(int sock, int pid, uint32_t flags, int res_count,
 		memset(&opt, 0, sizeof(opt));
 	}
 
+	rv = send_header_seq(fd, SM_CMD_ACQUIRE, flags, datalen, res_count, data2, seq);
+	if (rv < 0)
+		return rv;
+
+	for (i = 0; i < res_count; i++) {
+		res = res_args[i];
+		rv = send_data(fd, res, sizeof(struct sanlk_resource), 0);
+		if (rv < 0)
+			return -1;
+
+		rv = send_data(fd, res->disks, sizeof(struct sanlk_disk) * res->num_disks, 0);
+		if (rv < 0)
+			return -1;
+	}
+
+	rv = send_data(fd, &opt, sizeof(struct sanlk_options), 0);
+	if (rv < 0)
+		return -1;
+
+	if (opt.len) {
+		rv = send_data(fd, opt_in->str, opt.len, 0);
+		if (rv < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int do_acquire(int sock, int pid, uint32_t flags, int res_count,
+		      struct sanlk_resource *res_args[],
+		      struct sanlk_options *opt_in,
+		      struct sanlk_op_times *times)
+{
+	int rv, fd, data2;
+
+	if (res_count > SANLK_MAX_ACQUIRE_RESOURCES)
+		return -EINVAL;
+
 	if (sock == -1) {
 		/* connect to daemon and ask it to acquire a lease for
 		   another registered pid */
@@ -1148,44 +1891,64 @@ int sanlock_acquire(int sock, int pid, uint32_t flags, int res_count,
 		fd = sock;
 	}
 
-	rv = send_header(fd, SM_CMD_ACQUIRE, flags, datalen, res_count, data2);
+	if (times)
+		flags |= SANLK_ACQUIRE_TIMES;
+
+	rv = send_acquire(fd, data2, flags, res_count, res_args, opt_in, 0);
 	if (rv < 0)
-		return rv;
+		goto out;
 
-	for (i = 0; i < res_count; i++) {
-		res = res_args[i];
-		rv = send_data(fd, res, sizeof(struct sanlk_resource), 0);
-		if (rv < 0) {
-			rv = -1;
-			goto out;
-		}
+	if (times)
+		rv = recv_result_times(fd, times);
+	else
+		rv = recv_result(fd);
+ out:
+	if (sock == -1)
+		close(fd);
+	return rv;
+}
 
-		rv = send_data(fd, res->disks, sizeof(struct sanlk_disk) * res->num_disks, 0);
-		if (rv < 0) {
-			rv = -1;
-			goto out;
-		}
-	}
+int sanlock_acquire(int sock, int pid, uint32_t flags, int res_count,
+		    struct sanlk_resource *res_args[],
+		    struct sanlk_options *opt_in)
+{
+	return do_acquire(sock, pid, flags & ~SANLK_ACQUIRE_TIMES, res_count,
+			  res_args, opt_in, NULL);
+}
+
+int sanlock_acquire_times(int sock, int pid, uint32_t flags, int res_count,
+			  struct sanlk_resource *res_args[],
+			  struct sanlk_options *opt_in,
+			  struct sanlk_op_times *times)
+{
+	if (!times)
+		return -EINVAL;
+
+	return do_acquire(sock, pid, flags, res_count, res_args, opt_in, times);
+}
+
+int sanlock_acquire_async(int sock, int pid, uint32_t flags, int res_count,
+			  struct sanlk_resource *res_args[],
+			  struct sanlk_options *opt_in, uint32_t *req_id)
+{
+	uint32_t id;
+	int rv;
+
+	if (sock < 0 || !req_id)
+		return -EINVAL;
+
+	/* the lvers are returned in sanlk_async_result */
+	if (res_count > SANLK_MAX_RESOURCES)
+		return -EINVAL;
 
-	rv = send_data(fd, &opt, sizeof(struct sanlk_options), 0);
-	if (rv < 0) {
-		rv = -1;
-		goto out;
-	}
+	id = next_req_id();
 
-	if (opt.len) {
-		rv = send_data(fd, opt_in->str, opt.len, 0);
-		if (rv < 0) {
-			rv = -1;
-			goto out;
-		}
-	}
+	rv = send_acquire(sock, pid, flags, res_count, res_args, opt_in, id);
+	if (rv < 0)
+		return rv;
 
-	rv = recv_result(fd);
- out:
-	if (sock == -1)
-		close(fd);
-	return rv;
+	*req_id = id;
+	return 0;
 }
 
 int sanlock_inquire(int sock, int pid, uint32_t flags, int *res_count,
@@ -1263,7 +2026,8 @@ int sanlock_inquire(int sock, int pid, uint32_t flags, int *res_count,
 	return rv;
 }
 
-int sanlock_convert(int sock, int pid, uint32_t flags, struct sanlk_resource *res)
+static int do_convert(int sock, int pid, uint32_t flags, struct sanlk_resource *res,
+		      struct sanlk_op_times *times)
 {
 	int fd, rv, data2, datalen;
 
@@ -1289,6 +2053,9 @@ int sanlock_convert(int sock, int pid, uint32_t flags, struct sanlk_resource *re
 
 	datalen = sizeof(struct sanlk_resource);
 
+	if (times)
+		flags |= SANLK_CONVERT_TIMES;
+
 	rv = send_header(fd, SM_CMD_CONVERT, flags, datalen, 0, data2);
 	if (rv < 0)
 		goto out;
@@ -1299,21 +2066,59 @@ int sanlock_convert(int sock, int pid, uint32_t flags, struct sanlk_resource *re
 		goto out;
 	}
 
-	rv = recv_result(fd);
+	if (times)
+		rv = recv_result_times(fd, times);
+	else
+		rv = recv_result(fd);
  out:
 	if (sock == -1)
 		close(fd);
 	return rv;
 }
 
+int sanlock_convert(int sock, int pid, uint32_t flags, struct sanlk_resource *res)
+{
+	return do_convert(sock, pid, flags & ~SANLK_CONVERT_TIMES, res, NULL);
+}
+
+int sanlock_convert_times(int sock, int pid, uint32_t flags, struct sanlk_resource *res,
+			  struct sanlk_op_times *times)
+{
+	if (!times)
+		return -EINVAL;
+
+	return do_convert(sock, pid, flags, res, times);
+}
+
 /* tell daemon to release lease(s) for given pid.
    I don't think the pid itself will usually tell sm to release leases,
    but it will be requested by a manager overseeing the pid */
 
-int sanlock_release(int sock, int pid, uint32_t flags, int res_count,
-		    struct sanlk_resource *res_args[])
+static int send_release(int fd, int data2, uint32_t flags, int res_count,
+			struct sanlk_resource *res_args[], uint32_t seq)
+{
+	int rv, i, datalen;
+
+	datalen = res_count * sizeof(struct sanlk_resource);
+
+	rv = send_header_seq(fd, SM_CMD_RELEASE, flags, datalen, res_count, data2, seq);
+	if (rv < 0)
+		return rv;
+
+	for (i = 0; i < res_count; i++) {
+		rv = send_data(fd, res_args[i], sizeof(struct sanlk_resource), 0);
+		if (rv < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int do_release(int sock, int pid, uint32_t flags, int res_count,
+		      struct sanlk_resource *res_args[],
+		      struct sanlk_op_times *times)
 {
-	int fd, rv, i, data2, datalen;
+	int fd, rv, data2;
 
 	if (sock == -1) {
 		/* connect to daemon and ask it to acquire a lease for
@@ -1332,27 +2137,106 @@ int sanlock_release(int sock, int pid, uint32_t flags, int res_count,
 		fd = sock;
 	}
 
-	datalen = res_count * sizeof(struct sanlk_resource);
+	if (times)
+		flags |= SANLK_REL_TIMES;
 
-	rv = send_header(fd, SM_CMD_RELEASE, flags, datalen, res_count, data2);
+	rv = send_release(fd, data2, flags, res_count, res_args, 0);
 	if (rv < 0)
 		goto out;
 
-	for (i = 0; i < res_count; i++) {
-		rv = send_data(fd, res_args[i], sizeof(struct sanlk_resource), 0);
-		if (rv < 0) {
-			rv = -1;
-			goto out;
-		}
-	}
-
-	rv = recv_result(fd);
+	if (times)
+		rv = recv_result_times(fd, times);
+	else
+		rv = recv_result(fd);
  out:
 	if (sock == -1)
 		close(fd);
 	return rv;
 }
 
+int sanlock_release(int sock, int pid, uint32_t flags, int res_count,
+		    struct sanlk_resource *res_args[])
+{
+	return do_release(sock, pid, flags & ~SANLK_REL_TIMES, res_count, res_args, NULL);
+}
+
+int sanlock_release_times(int sock, int pid, uint32_t flags, int res_count,
+			  struct sanlk_resource *res_args[],
+			  struct sanlk_op_times *times)
+{
+	if (!times)
+		return -EINVAL;
+
+	return do_release(sock, pid, flags, res_count, res_args, times);
+}
+
+int sanlock_release_async(int sock, int pid, uint32_t flags, int res_count,
+			  struct sanlk_resource *res_args[], uint32_t *req_id)
+{
+	uint32_t id;
+	int rv;
+
+	if (sock < 0 || !req_id)
+		return -EINVAL;
+
+	id = next_req_id();
+
+	rv = send_release(sock, pid, flags, res_count, res_args, id);
+	if (rv < 0)
+		return rv;
+
+	*req_id = id;
+	return 0;
+}
+
+/*
+ * The reply to an async acquire carries the lver of each acquired
+ * resource after the header, data2 is the number of lvers.  A request
+ * that fails before the acquire starts is answered with the header only.
+ */
+
+int sanlock_async_result(int sock, struct sanlk_async_result *ar)
+{
+	struct sm_header h;
+	uint32_t extra, count;
+	int rv;
+
+	if (!ar)
+		return -EINVAL;
+
+	memset(ar, 0, sizeof(struct sanlk_async_result));
+	memset(&h, 0, sizeof(h));
+
+	rv = recv_data(sock, &h, sizeof(h), MSG_WAITALL);
+	if (rv < 0)
+		return -errno;
+	if (rv != sizeof(h))
+		return -ENOTCONN;
+
+	if (h.magic != SM_MAGIC || !h.seq || h.length < sizeof(h))
+		return -EPROTO;
+
+	extra = h.length - sizeof(h);
+	count = extra / sizeof(uint64_t);
+
+	if (count > SANLK_MAX_RESOURCES || extra != count * sizeof(uint64_t))
+		return -EPROTO;
+
+	if (count) {
+		rv = recv_data(sock, ar->lver, extra, MSG_WAITALL);
+		if (rv < 0)
+			return -errno;
+		if (rv != (int)extra)
+			return -ENOTCONN;
+	}
+
+	ar->req_id = h.seq;
+	ar->cmd = (h.cmd == SM_CMD_ACQUIRE) ? SANLK_ASYNC_ACQUIRE : SANLK_ASYNC_RELEASE;
+	ar->result = (int)h.data;
+	ar->res_count = count;
+	return 0;
+}
+
 int sanlock_request(uint32_t flags, uint32_t force_mode,
 		    struct sanlk_resource *res)
 {
@@ -1813,6 +2697,89 @@ int sanlock_delete_resource(struct sanlk_rindex *rx, uint32_t flags,
 	return rv;
 }
 
+/*
+ * send a batch of rentries for create/delete, and get back the rentries
+ * with the resource lease offsets
+ */
+
+static int rindex_batch_cmd(int cmd, struct sanlk_rindex *rx, uint32_t flags,
+			    struct sanlk_rentry *re, int re_count,
+			    int max_hosts, int num_hosts)
+{
+	struct sanlk_rentry *re_recv;
+	int re_len;
+	int rv, fd;
+
+	if (!rx || !rx->lockspace_name[0] || !rx->disk.path[0] || !re || re_count < 1)
+		return -EINVAL;
+
+	re_len = re_count * sizeof(struct sanlk_rentry);
+
+	re_recv = malloc(re_len);
+	if (!re_recv)
+		return -ENOMEM;
+
+	rv = connect_socket(&fd);
+	if (rv < 0) {
+		free(re_recv);
+		return rv;
+	}
+
+	rv = send_header(fd, cmd, flags,
+			 sizeof(struct sanlk_rindex) + re_len,
+			 max_hosts, num_hosts);
+	if (rv < 0)
+		goto out;
+
+	rv = send_data(fd, rx, sizeof(struct sanlk_rindex), 0);
+	if (rv < 0) {
+		rv = -errno;
+		goto out;
+	}
+
+	rv = send_data(fd, re, re_len, 0);
+	if (rv < 0) {
+		rv = -1;
+		goto out;
+	}
+
+	rv = recv_result(fd);
+	if (rv < 0)
+		goto out;
+
+	rv = recv_data(fd, re_recv, re_len, MSG_WAITALL);
+	if (rv < 0) {
+		rv = -errno;
+		goto out;
+	}
+
+	if (rv != re_len) {
+		rv = -1;
+		goto out;
+	}
+
+	memcpy(re, re_recv, re_len);
+	rv = 0;
+ out:
+	free(re_recv);
+	close(fd);
+	return rv;
+}
+
+int sanlock_create_resources(struct sanlk_rindex *rx, uint32_t flags,
+			     struct sanlk_rentry *re, int re_count,
+			     int max_hosts, int num_hosts)
+{
+	return rindex_batch_cmd(SM_CMD_CREATE_RESOURCES, rx, flags, re, re_count,
+				max_hosts, num_hosts);
+}
+
+int sanlock_delete_resources(struct sanlk_rindex *rx, uint32_t flags,
+			     struct sanlk_rentry *re, int re_count)
+{
+	return rindex_batch_cmd(SM_CMD_DELETE_RESOURCES, rx, flags, re, re_count, 0, 0);
+}
+
 /*
  * src may have colons/spaces escaped (with backslash) or unescaped.
  * if unescaped colons/spaces are found, insert backslash before them.
@@ -2225,6 +3192,175 @@ int sanlock_state_to_args(char *res_state,
 	return rv;
 }
 
+/*
+ * Check the header and the size of each record in binary inquire
+ * state, so the records can be used in place by the caller.
+ */
+
+static int check_inquire(char *inq_state)
+{
+	struct sanlk_inquire_header *ih = (struct sanlk_inquire_header *)inq_state;
+	struct sanlk_resource *res;
+	uint32_t pos, i;
+
+	if (!inq_state)
+		return -EINVAL;
+
+	if (ih->magic != SANLK_INQUIRE_MAGIC)
+		return -EINVAL;
+
+	if (ih->version != SANLK_INQUIRE_VERSION)
+		return -EPROTONOSUPPORT;
+
+	if (ih->length < sizeof(struct sanlk_inquire_header))
+		return -EINVAL;
+
+	pos = sizeof(struct sanlk_inquire_header);
+
+	for (i = 0; i < ih->res_count; i++) {
+		if (ih->length - pos < sizeof(struct sanlk_resource))
+			return -EINVAL;
+
+		res = (struct sanlk_resource *)(inq_state + pos);
+
+		if (!res->num_disks || res->num_disks > SANLK_MAX_DISKS)
+			return -EINVAL;
+
+		pos += sizeof(struct sanlk_resource);
+
+		if (ih->length - pos < res->num_disks * sizeof(struct sanlk_disk))
+			return -EINVAL;
+
+		pos += res->num_disks * sizeof(struct sanlk_disk);
+	}
+
+	return 0;
+}
+
+/*
+ * convert from binary inquire state (SANLK_INQUIRE_BINARY)
+ * to array of struct sanlk_resource *.  The resources are
+ * not copied: each res_args entry points into inq_state,
+ * and the caller frees only res_args.
+ */
+
+int sanlock_inquire_to_args(char *inq_state,
+			    int *res_count,
+			    struct sanlk_resource ***res_args)
+{
+	struct sanlk_inquire_header *ih = (struct sanlk_inquire_header *)inq_state;
+	struct sanlk_resource **args;
+	struct sanlk_resource *res;
+	char *pos;
+	int i, rv;
+
+	rv = check_inquire(inq_state);
+	if (rv < 0)
+		return rv;
+
+	args = malloc((ih->res_count + 1) * sizeof(*args));
+	if (!args)
+		return -ENOMEM;
+	memset(args, 0, (ih->res_count + 1) * sizeof(*args));
+
+	pos = inq_state + sizeof(struct sanlk_inquire_header);
+
+	for (i = 0; i < ih->res_count; i++) {
+		res = (struct sanlk_resource *)pos;
+		args[i] = res;
+		pos += sizeof(struct sanlk_resource) + res->num_disks * sizeof(struct sanlk_disk);
+	}
+
+	/* caller to free args, but not the res it points to */
+	*res_count = ih->res_count;
+	*res_args = args;
+	return 0;
+}
+
+/*
+ * convert from binary inquire state (SANLK_INQUIRE_BINARY)
+ * to the state string used by sanlock_state_to_args().
+ */
+
+int sanlock_inquire_to_state(char *inq_state, char **res_state)
+{
+	struct sanlk_resource **args = NULL;
+	int count = 0;
+	int rv;
+
+	rv = sanlock_inquire_to_args(inq_state, &count, &args);
+	if (rv < 0)
+		return rv;
+
+	if (!count) {
+		/* matches sanlock_inquire with no resources */
+		*res_state = NULL;
+		free(args);
+		return 0;
+	}
+
+	rv = sanlock_args_to_state(count, args, res_state);
+	free(args);
+	return rv;
+}
+
+/*
+ * convert from state string to binary inquire state
+ * (SANLK_INQUIRE_BINARY).
+ */
+
+int sanlock_state_to_inquire(char *res_state, char **inq_state)
+{
+	struct sanlk_inquire_header *ih;
+	struct sanlk_resource **args = NULL;
+	struct sanlk_resource *res;
+	char *state, *pos;
+	int count = 0;
+	int i, len, rv;
+
+	if (res_state && res_state[0]) {
+		rv = sanlock_state_to_args(res_state, &count, &args);
+		if (rv < 0)
+			return rv;
+	}
+
+	len = sizeof(struct sanlk_inquire_header);
+
+	for (i = 0; i < count; i++)
+		len += sizeof(struct sanlk_resource) + args[i]->num_disks * sizeof(struct sanlk_disk);
+
+	state = malloc(len);
+	if (!state) {
+		rv = -ENOMEM;
+		goto out;
+	}
+	memset(state, 0, len);
+
+	ih = (struct sanlk_inquire_header *)state;
+	ih->magic = SANLK_INQUIRE_MAGIC;
+	ih->version = SANLK_INQUIRE_VERSION;
+	ih->res_count = count;
+	ih->length = len;
+
+	pos = state + sizeof(struct sanlk_inquire_header);
+
+	for (i = 0; i < count; i++) {
+		res = (struct sanlk_resource *)pos;
+		len = sizeof(struct sanlk_resource) + args[i]->num_disks * sizeof(struct sanlk_disk);
+		memcpy(res, args[i], len);
+		pos += len;
+	}
+
+	/* caller to free inq_state */
+	*inq_state = state;
+	rv = 0;
+ out:
+	for (i = 0; i < count; i++)
+		free(args[i]);
+	free(args);
+	return rv;
+}
+
 /*
  * convert to struct sanlk_lockspace from string with format:
  * <lockspace_name>:<host_id>:<path>:<offset>
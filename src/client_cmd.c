@@ -692,6 +692,125 @@ int sanlock_log_dump(int max_size)
 	return rv;
 }
 
+static const char *trace_op_str(uint32_t op)
+{
+	switch (op) {
+	case SANLK_TRACE_AIO_READ:
+		return "aio_read";
+	case SANLK_TRACE_AIO_WRITE:
+		return "aio_write";
+	case SANLK_TRACE_BALLOT_PHASE1:
+		return "ballot_phase1";
+	case SANLK_TRACE_BALLOT_PHASE2:
+		return "ballot_phase2";
+	case SANLK_TRACE_DELTA_RENEW:
+		return "delta_renew";
+	case SANLK_TRACE_ACQUIRE:
+		return "acquire";
+	case SANLK_TRACE_RELEASE:
+		return "release";
+	default:
+		return "unknown";
+	};
+}
+
+#define TRACE_OP_MAX 8
+
+/*
+ * Print one line per trace record, then a latency summary for each op.
+ * The fields are in fixed positions for processing with awk/sort.
+ */
+
+int sanlock_trace(int max_size)
+{
+	struct sm_header h;
+	struct sanlk_trace *tr;
+	uint64_t total_us[TRACE_OP_MAX];
+	uint32_t max_us[TRACE_OP_MAX];
+	uint32_t count[TRACE_OP_MAX];
+	uint32_t errors[TRACE_OP_MAX];
+	char *buf;
+	int fd, rv, i, num;
+
+	buf = malloc(max_size);
+	if (!buf)
+		return -ENOMEM;
+
+	memset(total_us, 0, sizeof(total_us));
+	memset(max_us, 0, sizeof(max_us));
+	memset(count, 0, sizeof(count));
+	memset(errors, 0, sizeof(errors));
+
+	fd = send_command(SM_CMD_TRACE, 0);
+	if (fd < 0) {
+		free(buf);
+		return fd;
+	}
+
+	memset(&h, 0, sizeof(h));
+
+	rv = recv(fd, &h, sizeof(h), MSG_WAITALL);
+	if (rv < 0) {
+		rv = -errno;
+		goto out;
+	}
+	if (rv != sizeof(h)) {
+		rv = -1;
+		goto out;
+	}
+
+	rv = 0;
+
+	if (!h.data || h.data > (uint32_t)max_size)
+		goto out;
+
+	rv = recv(fd, buf, h.data, MSG_WAITALL);
+	if (rv < 0) {
+		rv = -errno;
+		goto out;
+	}
+	if (rv != (int)h.data) {
+		rv = -1;
+		goto out;
+	}
+
+	num = h.data / sizeof(struct sanlk_trace);
+
+	printf("# time_us tid op space_id res_id lver disk offset latency_us result\n");
+
+	for (i = 0; i < num; i++) {
+		tr = (struct sanlk_trace *)(buf + (i * sizeof(struct sanlk_trace)));
+
+		printf("%llu %u %s %u %u %llu %u %llu %u %d\n",
+		       (unsigned long long)tr->time_us, tr->tid, trace_op_str(tr->op),
+		       tr->space_id, tr->res_id, (unsigned long long)tr->lver,
+		       tr->disk, (unsigned long long)tr->offset,
+		       tr->latency_us, tr->result);
+
+		if (tr->op >= TRACE_OP_MAX)
+			continue;
+		count[tr->op]++;
+		total_us[tr->op] += tr->latency_us;
+		if (tr->latency_us > max_us[tr->op])
+			max_us[tr->op] = tr->latency_us;
+		if (tr->result < 0)
+			errors[tr->op]++;
+	}
+
+	for (i = 1; i < TRACE_OP_MAX; i++) {
+		if (!count[i])
+			continue;
+		printf("# %s count %u errors %u avg_us %llu max_us %u\n",
+		       trace_op_str(i), count[i], errors[i],
+		       (unsigned long long)(total_us[i] / count[i]), max_us[i]);
+	}
+	rv = 0;
+ out:
+	close(fd);
+	free(buf);
+	return rv;
+}
+
 int sanlock_shutdown(uint32_t force, int wait_result)
 {
 	struct sm_header h;
@@ -47,27 +47,79 @@
 #include "task.h"
 #include "cmd.h"
 #include "rindex.h"
+#include "trace.h"
+#include "iostats.h"
+#include "hash.h"
+#include "freemap.h"
+#include "slab.h"
+#include "affinity.h"
+#include "readflight.h"
 
 /* from main.c */
 void client_resume(int ci);
 void client_free(int ci);
 void client_recv_all(int ci, struct sm_header *h_recv, int pos);
+void client_send_reply(int ci, char *buf, int len);
 void client_pid_dead(int ci);
 void send_result(int fd, struct sm_header *h_recv, int result);
 
 static uint32_t token_id_counter = 1;
 
+/*
+ * Each lockspace keeps a list of the tokens that clients hold in it, so
+ * that kill_pids and all_pids_dead only look at the clients using a
+ * failed lockspace instead of every client.  The list is protected by
+ * spaces_mutex.  A token is linked when it is added to cl->tokens, with
+ * both spaces_mutex and cl->mutex held, and unlinked before it is freed.
+ * Between being removed from cl->tokens and being unlinked, a token may
+ * still be found on the list, so its user checks that cl->tokens holds it.
+ */
+
+/* called with both spaces_mutex and cl->mutex held */
+
+static void link_client_tokens(int ci, struct token *new_tokens[], int count)
+{
+	struct space *sp;
+	struct token *token;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		token = new_tokens[i];
+		sp = find_lockspace(token->r.lockspace_name);
+		if (!sp)
+			continue;
+		token->client_ci = ci;
+		list_add_tail(&token->client_list, &sp->client_tokens);
+	}
+}
+
+void unlink_client_tokens(struct token *tokens[], int count)
+{
+	struct token *token;
+	int i;
+
+	pthread_mutex_lock(&spaces_mutex);
+	for (i = 0; i < count; i++) {
+		token = tokens[i];
+		if (token && !list_empty(&token->client_list))
+			list_del_init(&token->client_list);
+	}
+	pthread_mutex_unlock(&spaces_mutex);
+}
+
 static void release_cl_tokens(struct task *task, struct client *cl)
 {
 	struct token *token;
 	int j;
 
+	unlink_client_tokens(cl->tokens, cl->tokens_slots);
+
 	for (j = 0; j < cl->tokens_slots; j++) {
 		token = cl->tokens[j];
 		if (!token)
 			continue;
 		release_token(task, token, NULL);
-		free(token);
+		slab_free(token);
 	}
 }
 
@@ -80,7 +132,154 @@ static void release_new_tokens(struct task *task, struct token *new_tokens[],
 		release_token(task, new_tokens[i], NULL);
 
 	for (i = 0; i < alloc_count; i++)
-		free(new_tokens[i]);
+		slab_free(new_tokens[i]);
+}
+
+/*
+ * cl->tokens is an array of token pointers with empty (NULL) slots, grown
+ * by an acquire that needs more empty slots.  Each token records its slot.
+ * Once a client has CL_TOKENS_HASH_MIN slots, its tokens are also hashed
+ * by lockspace and resource name, so that release and convert of one
+ * resource don't compare every token's names.  Called with cl->mutex held.
+ */
+
+static struct list_head *client_token_bucket(struct client *cl,
+					     const char *space_name,
+					     const char *res_name)
+{
+	uint32_t h = resource_name_hash(space_name, res_name);
+
+	return &cl->tokens_hash[h & (cl->tokens_hash_size - 1)];
+}
+
+static int client_tokens_rehash(struct client *cl, int size)
+{
+	struct list_head *hash;
+	struct token *token;
+	int i;
+
+	hash = malloc(size * sizeof(struct list_head));
+	if (!hash)
+		return -ENOMEM;
+
+	for (i = 0; i < size; i++)
+		INIT_LIST_HEAD(&hash[i]);
+
+	free(cl->tokens_hash);
+	cl->tokens_hash = hash;
+	cl->tokens_hash_size = size;
+
+	for (i = 0; i < cl->tokens_slots; i++) {
+		token = cl->tokens[i];
+		if (!token)
+			continue;
+		list_add(&token->client_hash,
+			 client_token_bucket(cl, token->r.lockspace_name, token->r.name));
+	}
+	return 0;
+}
+
+static int client_tokens_reserve(struct client *cl, int count)
+{
+	struct token **grow_tokens;
+	int grow_slots, size;
+
+	if (cl->tokens_slots - cl->tokens_count >= count)
+		return 0;
+
+	grow_slots = cl->tokens_slots * 2;
+	if (grow_slots < cl->tokens_count + count)
+		grow_slots = cl->tokens_count + count;
+
+	log_debug("client_tokens_reserve slots %d used %d new %d grow %d",
+		  cl->tokens_slots, cl->tokens_count, count, grow_slots);
+
+	grow_tokens = malloc(grow_slots * sizeof(struct token *));
+	if (!grow_tokens) {
+		log_error("client_tokens_reserve ENOMEM slots %d used %d new %d",
+			  cl->tokens_slots, cl->tokens_count, count);
+		return -ENOMEM;
+	}
+	memset(grow_tokens, 0, grow_slots * sizeof(struct token *));
+	memcpy(grow_tokens, cl->tokens, cl->tokens_slots * sizeof(struct token *));
+	free(cl->tokens);
+	cl->tokens = grow_tokens;
+	cl->tokens_slots = grow_slots;
+
+	if (grow_slots >= CL_TOKENS_HASH_MIN && cl->tokens_hash_size < grow_slots) {
+		size = CL_TOKENS_HASH_MIN;
+		while (size < grow_slots)
+			size *= 2;
+
+		/* the existing hash (or none) still works, only slower */
+		if (client_tokens_rehash(cl, size) < 0)
+			log_error("client_tokens_reserve ENOMEM hash %d", size);
+	}
+	return 0;
+}
+
+/* client_tokens_reserve has been called for the token */
+
+static void client_token_add(struct client *cl, struct token *token)
+{
+	int i;
+
+	for (i = 0; i < cl->tokens_slots; i++) {
+		if (cl->tokens[i])
+			continue;
+
+		cl->tokens[i] = token;
+		cl->tokens_count++;
+		token->client_slot = i;
+
+		if (cl->tokens_hash)
+			list_add(&token->client_hash,
+				 client_token_bucket(cl, token->r.lockspace_name, token->r.name));
+		return;
+	}
+
+	/* shouldn't ever happen */
+	log_error("client_token_add no empty slot %d", cl->tokens_slots);
+}
+
+static void client_token_del(struct client *cl, struct token *token)
+{
+	cl->tokens[token->client_slot] = NULL;
+	cl->tokens_count--;
+
+	if (cl->tokens_hash)
+		list_del_init(&token->client_hash);
+}
+
+static struct token *client_token_find(struct client *cl,
+				       const char *space_name,
+				       const char *res_name)
+{
+	struct token *token;
+	int i;
+
+	if (cl->tokens_hash) {
+		list_for_each_entry(token, client_token_bucket(cl, space_name, res_name), client_hash) {
+			if (memcmp(token->r.lockspace_name, space_name, NAME_ID_SIZE))
+				continue;
+			if (memcmp(token->r.name, res_name, NAME_ID_SIZE))
+				continue;
+			return token;
+		}
+		return NULL;
+	}
+
+	for (i = 0; i < cl->tokens_slots; i++) {
+		token = cl->tokens[i];
+		if (!token)
+			continue;
+		if (memcmp(token->r.lockspace_name, space_name, NAME_ID_SIZE))
+			continue;
+		if (memcmp(token->r.name, res_name, NAME_ID_SIZE))
+			continue;
+		return token;
+	}
+	return NULL;
 }
 
 /* called with both spaces_mutex and cl->mutex held */
@@ -91,12 +290,9 @@ static int check_new_tokens_space(struct client *cl,
 {
 	struct space_info spi;
 	struct token *token;
-	int i, rv, empty_slots = 0;
+	int i, rv, empty_slots;
 
-	for (i = 0; i < cl->tokens_slots; i++) {
-		if (!cl->tokens[i])
-			empty_slots++;
-	}
+	empty_slots = cl->tokens_slots - cl->tokens_count;
 
 	if (empty_slots < new_tokens_count) {
 		/* shouldn't ever happen */
@@ -156,26 +352,344 @@ static const char *acquire_error_str(int error)
 	};
 }
 
+/*
+ * The cmds run by the thread pool receive request data and send replies
+ * through these, which use the connection directly, or for a pipelined
+ * connection, the request data read by main_loop and a reply buffer
+ * that is sent by pipeline_reply().
+ */
+
+static ssize_t ca_recv(struct cmd_args *ca, int fd, void *buf, size_t len)
+{
+	size_t rem;
+
+	if (!ca->pipeline)
+		return recv(fd, buf, len, MSG_WAITALL);
+
+	rem = ca->body_len - ca->body_pos;
+	if (len > rem)
+		len = rem;
+
+	memcpy(buf, ca->body + ca->body_pos, len);
+	ca->body_pos += len;
+	return len;
+}
+
+static void ca_send(struct cmd_args *ca, int fd, const void *buf, size_t len)
+{
+	char *reply;
+	int size;
+
+	if (!ca->pipeline) {
+		send(fd, buf, len, MSG_NOSIGNAL);
+		return;
+	}
+
+	if (ca->reply_len + len > ca->reply_size) {
+		size = ca->reply_size ? ca->reply_size : 256;
+		while (size < ca->reply_len + len)
+			size *= 2;
+
+		reply = realloc(ca->reply, size);
+		if (!reply) {
+			log_error("pipeline reply ci %d len %zu no mem", ca->ci_in, len);
+			return;
+		}
+		ca->reply = reply;
+		ca->reply_size = size;
+	}
+
+	memcpy(ca->reply + ca->reply_len, buf, len);
+	ca->reply_len += len;
+}
+
+static void ca_send_result(struct cmd_args *ca, int fd, int result)
+{
+	struct sm_header h;
+
+	if (!ca->pipeline) {
+		send_result(fd, &ca->header, result);
+		return;
+	}
+
+	memcpy(&h, &ca->header, sizeof(struct sm_header));
+	h.version = SM_PROTO;
+	h.length = sizeof(h);
+	h.data = result;
+	h.data2 = 0;
+	ca_send(ca, fd, &h, sizeof(h));
+}
+
+/*
+ * The reply begins with the header copied from the request, set its
+ * length to what was actually collected so the client can always read
+ * the whole reply.
+ */
+
+static void pipeline_reply(struct cmd_args *ca)
+{
+	struct sm_header *h = (struct sm_header *)ca->reply;
+	struct sm_header err;
+
+	if (ca->reply_len >= (int)sizeof(struct sm_header)) {
+		h->seq = ca->header.seq;
+		h->length = ca->reply_len;
+		client_send_reply(ca->ci_in, ca->reply, ca->reply_len);
+	} else {
+		/* the reply buffer could not be allocated */
+		memcpy(&err, &ca->header, sizeof(struct sm_header));
+		err.version = SM_PROTO;
+		err.length = sizeof(err);
+		err.data = -ENOMEM;
+		err.data2 = 0;
+		client_send_reply(ca->ci_in, (char *)&err, sizeof(err));
+	}
+
+	free(ca->reply);
+	free(ca->body);
+	ca->reply = NULL;
+	ca->body = NULL;
+}
+
+/*
+ * The reply to an async acquire (nonzero header seq) is followed by the
+ * lver of each acquired resource, see sanlock_async_result().
+ */
+
+static void send_acquire_result(struct cmd_args *ca, int fd, int result,
+				uint64_t *lvers, int count)
+{
+	char buf[sizeof(struct sm_header) + SANLK_MAX_RESOURCES * sizeof(uint64_t)];
+	struct sm_header *h = (struct sm_header *)buf;
+	struct sm_header *h_recv = &ca->header;
+	int len;
+
+	if (!h_recv->seq || result < 0 || !count || count > SANLK_MAX_RESOURCES) {
+		ca_send_result(ca, fd, result);
+		return;
+	}
+
+	len = sizeof(struct sm_header) + count * sizeof(uint64_t);
+
+	memcpy(h, h_recv, sizeof(struct sm_header));
+	h->version = SM_PROTO;
+	h->length = len;
+	h->data = result;
+	h->data2 = count;
+	memcpy(buf + sizeof(struct sm_header), lvers, count * sizeof(uint64_t));
+
+	ca_send(ca, fd, buf, len);
+}
+
+/*
+ * With SANLK_ACQUIRE_TIMES, SANLK_REL_TIMES or SANLK_CONVERT_TIMES, the
+ * reply to a blocking request is followed by struct sanlk_op_times, see
+ * sanlock_acquire_times().  The times are collected in task->op_times
+ * while the cmd runs.
+ */
+
+static void op_times_begin(struct task *task, struct cmd_args *ca, uint32_t flag,
+			   struct sanlk_op_times *times)
+{
+	task->op_times = NULL;
+
+	if (!(ca->header.cmd_flags & flag) || ca->header.seq || ca->pipeline)
+		return;
+
+	memset(times, 0, sizeof(struct sanlk_op_times));
+	times->queue_us = trace_begin() - ca->queued;
+	task->op_times = times;
+}
+
+static void send_times_result(struct task *task, struct cmd_args *ca, int fd, int result)
+{
+	char buf[sizeof(struct sm_header) + sizeof(struct sanlk_op_times)];
+	struct sm_header *h = (struct sm_header *)buf;
+	struct sanlk_op_times *times = task->op_times;
+
+	task->op_times = NULL;
+
+	if (!times) {
+		ca_send_result(ca, fd, result);
+		return;
+	}
+
+	times->total_us = trace_begin() - ca->queued;
+
+	memcpy(h, &ca->header, sizeof(struct sm_header));
+	h->version = SM_PROTO;
+	h->length = sizeof(buf);
+	h->data = result;
+	h->data2 = 0;
+	memcpy(buf + sizeof(struct sm_header), times, sizeof(struct sanlk_op_times));
+
+	ca_send(ca, fd, buf, sizeof(buf));
+}
+
+static void log_acquire_error(struct cmd_args *ca, struct token *token, int rv)
+{
+	int lvl;
+
+	switch (rv) {
+	case -EEXIST:
+	case -EAGAIN:
+	case -EBUSY:
+		lvl = LOG_DEBUG;
+		break;
+	case SANLK_ACQUIRE_IDLIVE:
+	case SANLK_ACQUIRE_OWNED:
+	case SANLK_ACQUIRE_OTHER:
+	case SANLK_ACQUIRE_OWNED_RETRY:
+		lvl = com.quiet_fail ? LOG_DEBUG : LOG_ERR;
+		break;
+	default:
+		lvl = LOG_ERR;
+	}
+
+	if (token->res_id)
+		log_level(token->space_id, token->res_id, NULL, lvl,
+			  "cmd_acquire %d,%d,%d acquire_token %d %s",
+			  ca->ci_target, ca->cl_fd, ca->cl_pid, rv, acquire_error_str(rv));
+	else
+		log_level(token->space_id, 0, NULL, lvl,
+			  "cmd_acquire %d,%d,%d acquire_token %s %d %s",
+			  ca->ci_target, ca->cl_fd, ca->cl_pid,
+			  token->r.name, rv, acquire_error_str(rv));
+}
+
+/*
+ * SANLK_ACQUIRE_PARALLEL: each token after the first is acquired by a
+ * thread with its own task (and aio context), while this worker acquires
+ * the first.  If a thread can't be created, its token is acquired here
+ * after the others complete.  A large acquire is done in groups of
+ * ACQUIRE_PARALLEL_MAX tokens at a time.
+ */
+
+#define ACQUIRE_PARALLEL_MAX 32
+
+struct acquire_parallel {
+	pthread_t thread;
+	struct task task;
+	struct token *token;
+	uint32_t cmd_flags;
+	char *killpath;
+	char *killargs;
+	int started;
+	int rv;
+};
+
+static void *acquire_parallel_thread(void *arg)
+{
+	struct acquire_parallel *ap = arg;
+
+	setup_task_aio(&ap->task, main_task.use_aio, WORKER_AIO_CB_SIZE);
+	snprintf(ap->task.name, NAME_ID_SIZE, "acquire%u", ap->token->token_id);
+
+	ap->rv = acquire_token(&ap->task, ap->token, ap->cmd_flags,
+			       ap->killpath, ap->killargs);
+
+	close_task_aio(&ap->task);
+	return NULL;
+}
+
+/*
+ * On failure, new_tokens is reordered with the acquired tokens first, so
+ * release_new_tokens() releases the acquire_count acquired tokens.
+ */
+
+static int acquire_tokens_parallel(struct task *task, struct cmd_args *ca,
+				   struct token *new_tokens[], int count,
+				   char *killpath, char *killargs,
+				   int *acquire_count)
+{
+	struct acquire_parallel *aps;
+	struct token **sorted;
+	int i, base, end, n = 0, result = 0;
+
+	aps = calloc(count, sizeof(struct acquire_parallel));
+	if (!aps)
+		return -ENOMEM;
+
+	sorted = malloc(count * sizeof(struct token *));
+	if (!sorted) {
+		free(aps);
+		return -ENOMEM;
+	}
+
+	for (base = 0; base < count; base += ACQUIRE_PARALLEL_MAX) {
+		end = base + ACQUIRE_PARALLEL_MAX;
+		if (end > count)
+			end = count;
+
+		for (i = base; i < end; i++) {
+			aps[i].token = new_tokens[i];
+			aps[i].cmd_flags = ca->header.cmd_flags;
+			aps[i].killpath = killpath;
+			aps[i].killargs = killargs;
+			aps[i].task.op_times = task->op_times;
+
+			if (i > base && !pthread_create(&aps[i].thread, NULL, acquire_parallel_thread, &aps[i]))
+				aps[i].started = 1;
+		}
+
+		aps[base].rv = acquire_token(task, new_tokens[base], ca->header.cmd_flags,
+					     killpath, killargs);
+
+		for (i = base + 1; i < end; i++) {
+			if (aps[i].started)
+				pthread_join(aps[i].thread, NULL);
+			else
+				aps[i].rv = acquire_token(task, new_tokens[i], ca->header.cmd_flags,
+							  killpath, killargs);
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (aps[i].rv >= 0)
+			sorted[n++] = new_tokens[i];
+	}
+	*acquire_count = n;
+
+	for (i = 0; i < count; i++) {
+		if (aps[i].rv >= 0)
+			continue;
+		log_acquire_error(ca, new_tokens[i], aps[i].rv);
+		if (!result)
+			result = aps[i].rv;
+		sorted[n++] = new_tokens[i];
+	}
+
+	if (result)
+		memcpy(new_tokens, sorted, count * sizeof(struct token *));
+
+	log_debug("cmd_acquire %d,%d,%d parallel count %d acquired %d result %d",
+		  ca->ci_target, ca->cl_fd, ca->cl_pid, count, *acquire_count, result);
+
+	free(sorted);
+	free(aps);
+	return result;
+}
+
 static void cmd_acquire(struct task *task, struct cmd_args *ca)
 {
 	struct client *cl;
 	struct token *token = NULL;
-	struct token *new_tokens[SANLK_MAX_RESOURCES];
-	struct token **grow_tokens;
+	struct token **new_tokens = NULL;
+	uint64_t *lvers = NULL;
 	struct sanlk_resource res;
 	struct sanlk_options opt;
+	struct sanlk_op_times times;
 	struct space_info spi;
 	char killpath[SANLK_HELPER_PATH_LEN];
 	char killargs[SANLK_HELPER_ARGS_LEN];
 	char *opt_str;
 	int token_len, disks_len;
-	int fd, rv, i, j, empty_slots, lvl;
+	int fd, rv, i, j;
 	int alloc_count = 0, acquire_count = 0;
 	int pos = 0, pid_dead = 0;
 	int new_tokens_count;
 	int recv_done = 0;
 	int result = 0;
-	int grow_size;
 	int cl_ci = ca->ci_target;
 	int cl_fd = ca->cl_fd;
 	int cl_pid = ca->cl_pid;
@@ -188,13 +702,22 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 	log_debug("cmd_acquire %d,%d,%d ci_in %d fd %d count %d flags %x",
 		  cl_ci, cl_fd, cl_pid, ca->ci_in, fd, new_tokens_count, ca->header.cmd_flags);
 
-	if (new_tokens_count > SANLK_MAX_RESOURCES) {
+	op_times_begin(task, ca, SANLK_ACQUIRE_TIMES, &times);
+
+	if (new_tokens_count < 0 || new_tokens_count > com.max_acquire_resources) {
 		log_error("cmd_acquire %d,%d,%d new %d max %d",
-			  cl_ci, cl_fd, cl_pid, new_tokens_count, SANLK_MAX_RESOURCES);
+			  cl_ci, cl_fd, cl_pid, new_tokens_count, com.max_acquire_resources);
 		result = -E2BIG;
 		goto done;
 	}
 
+	new_tokens = calloc(new_tokens_count + 1, sizeof(struct token *));
+	lvers = calloc(new_tokens_count + 1, sizeof(uint64_t));
+	if (!new_tokens || !lvers) {
+		result = -ENOMEM;
+		goto done;
+	}
+
 	pthread_mutex_lock(&cl->mutex);
 	if (cl->pid_dead) {
 		result = -ESTALE;
@@ -202,42 +725,16 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 		goto done;
 	}
 
-	empty_slots = 0;
-	for (i = 0; i < cl->tokens_slots; i++) {
-		if (!cl->tokens[i])
-			empty_slots++;
-	}
-
-	if (empty_slots < new_tokens_count) {
-		log_debug("cmd_acquire grow tokens slots %d empty %d new %d",
-			  cl->tokens_slots, empty_slots, new_tokens_count);
-
-		grow_size = (cl->tokens_slots + (SANLK_MAX_RESOURCES * 2)) * sizeof(struct token *);
-		grow_tokens = malloc(grow_size);
-		if (!grow_tokens) {
-			log_error("cmd_acquire ENOMEM grow tokens slots %d empty %d new %d grow_size %d",
-				  cl->tokens_slots, empty_slots, new_tokens_count, grow_size);
-			result = -ENOMEM;
-			pthread_mutex_unlock(&cl->mutex);
-			goto done;
-		} else {
-			memset(grow_tokens, 0, grow_size);
-			memcpy(grow_tokens, cl->tokens, cl->tokens_slots * sizeof(struct token *));
-			free(cl->tokens);
-			cl->tokens = grow_tokens;
-			cl->tokens_slots += (SANLK_MAX_RESOURCES * 2);
-			empty_slots += (SANLK_MAX_RESOURCES * 2);
-		}
-	}
+	rv = client_tokens_reserve(cl, new_tokens_count);
 
 	memcpy(killpath, cl->killpath, SANLK_HELPER_PATH_LEN);
 	memcpy(killargs, cl->killargs, SANLK_HELPER_ARGS_LEN);
 	pthread_mutex_unlock(&cl->mutex);
 
-	if (empty_slots < new_tokens_count) {
-		log_error("cmd_acquire %d,%d,%d new %d slots %d",
-			  cl_ci, cl_fd, cl_pid, new_tokens_count, empty_slots);
-		result = -ENOENT;
+	if (rv < 0) {
+		log_error("cmd_acquire %d,%d,%d new %d reserve %d",
+			  cl_ci, cl_fd, cl_pid, new_tokens_count, rv);
+		result = rv;
 		goto done;
 	}
 
@@ -251,7 +748,7 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 		 * receive sanlk_resource, create token for it
 		 */
 
-		rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+		rv = ca_recv(ca, fd, &res, sizeof(struct sanlk_resource));
 		if (rv > 0)
 			pos += rv;
 		if (rv != sizeof(struct sanlk_resource)) {
@@ -269,12 +766,13 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 		disks_len = res.num_disks * sizeof(struct sync_disk);
 		token_len = sizeof(struct token) + disks_len;
 
-		token = malloc(token_len);
+		token = slab_alloc(SLAB_TOKEN, res.num_disks);
 		if (!token) {
 			result = -ENOMEM;
 			goto done;
 		}
 		memset(token, 0, token_len);
+		INIT_LIST_HEAD(&token->client_list);
 		token->disks = (struct sync_disk *)&token->r.disks[0]; /* shorthand */
 		token->r.num_disks = res.num_disks;
 		memcpy(token->r.lockspace_name, res.lockspace_name, SANLK_NAME_LEN);
@@ -295,13 +793,13 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 		 * in sanlk_disk (TODO: let these differ?)
 		 */
 
-		rv = recv(fd, token->disks, disks_len, MSG_WAITALL);
+		rv = ca_recv(ca, fd, token->disks, disks_len);
 		if (rv > 0)
 			pos += rv;
 		if (rv != disks_len) {
 			log_error("cmd_acquire %d,%d,%d recv disks %d %d",
 				  cl_ci, cl_fd, cl_pid, rv, errno);
-			free(token);
+			slab_free(token);
 			result = -ENOTCONN;
 			goto done;
 		}
@@ -317,7 +815,7 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 		alloc_count++;
 	}
 
-	rv = recv(fd, &opt, sizeof(struct sanlk_options), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &opt, sizeof(struct sanlk_options));
 	if (rv > 0)
 		pos += rv;
 	if (rv != sizeof(struct sanlk_options)) {
@@ -336,7 +834,7 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 			goto done;
 		}
 
-		rv = recv(fd, opt_str, opt.len, MSG_WAITALL);
+		rv = ca_recv(ca, fd, opt_str, opt.len);
 		if (rv > 0)
 			pos += rv;
 		if (rv != opt.len) {
@@ -380,41 +878,30 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 
 	}
 
+	if ((ca->header.cmd_flags & SANLK_ACQUIRE_PARALLEL) && new_tokens_count > 1) {
+		result = acquire_tokens_parallel(task, ca, new_tokens, new_tokens_count,
+						 killpath, killargs, &acquire_count);
+		if (result < 0)
+			goto done;
+
+		for (i = 0; i < new_tokens_count; i++)
+			lvers[i] = new_tokens[i]->r.lver;
+		goto acquired;
+	}
+
 	for (i = 0; i < new_tokens_count; i++) {
 		token = new_tokens[i];
 
 		rv = acquire_token(task, token, ca->header.cmd_flags, killpath, killargs);
 		if (rv < 0) {
-			switch (rv) {
-			case -EEXIST:
-			case -EAGAIN:
-			case -EBUSY:
-				lvl = LOG_DEBUG;
-				break;
-			case SANLK_ACQUIRE_IDLIVE:
-			case SANLK_ACQUIRE_OWNED:
-			case SANLK_ACQUIRE_OTHER:
-			case SANLK_ACQUIRE_OWNED_RETRY:
-				lvl = com.quiet_fail ? LOG_DEBUG : LOG_ERR;
-				break;
-			default:
-				lvl = LOG_ERR;
-			}
-
-			if (token->res_id)
-				log_level(token->space_id, token->res_id, NULL, lvl,
-					  "cmd_acquire %d,%d,%d acquire_token %d %s",
-					  cl_ci, cl_fd, cl_pid, rv, acquire_error_str(rv));
-			else
-				log_level(token->space_id, 0, NULL, lvl,
-					  "cmd_acquire %d,%d,%d acquire_token %s %d %s",
-					  cl_ci, cl_fd, cl_pid,
-					  token->r.name, rv, acquire_error_str(rv));
+			log_acquire_error(ca, token, rv);
 			result = rv;
 			goto done;
 		}
+		lvers[i] = token->r.lver;
 		acquire_count++;
 	}
+ acquired:
 
 	/*
 	 * Success acquiring the leases:
@@ -452,14 +939,8 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 	 * cl->mutex.  So, lock spaces_mutex first, then cl->mutex to avoid the
 	 * deadlock.
 	 *
-	 * Other approaches:
-	 * A solution may be to record in each sp all the pids/cis using it
-	 * prior to starting the acquire.  Then we would not need to do this
-	 * check here to see if the lockspace has been killed (if it was, the
-	 * pid for this ci would have been killed in kill_pids), and
-	 * all_pids_dead() and kill_pids() would not need to go through each cl
-	 * and each cl->token to check if it's using the sp (it would know by
-	 * just looking at sp->pids[] and killing each).
+	 * The new tokens are linked on sp->client_tokens in the same critical
+	 * section, which is how kill_pids() and all_pids_dead() find the pid.
 	 */
 
  done:
@@ -483,14 +964,9 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
 	/* 1. Success acquiring leases, and pid is live */
 
 	if (!result && !pid_dead) {
-		for (i = 0; i < new_tokens_count; i++) {
-			for (j = 0; j < cl->tokens_slots; j++) {
-				if (!cl->tokens[j]) {
-					cl->tokens[j] = new_tokens[i];
-					break;
-				}
-			}
-		}
+		for (i = 0; i < new_tokens_count; i++)
+			client_token_add(cl, new_tokens[i]);
+		link_client_tokens(cl_ci, new_tokens, new_tokens_count);
 		/* goto reply after mutex unlock */
 	}
 	pthread_mutex_unlock(&cl->mutex);
@@ -533,19 +1009,26 @@ static void cmd_acquire(struct task *task, struct cmd_args *ca)
  reply:
 	if (!recv_done)
 		client_recv_all(ca->ci_in, &ca->header, pos);
-	send_result(fd, &ca->header, result);
+	if (task->op_times)
+		send_times_result(task, ca, fd, result);
+	else
+		send_acquire_result(ca, fd, result, lvers, acquire_count);
 	client_resume(ca->ci_in);
+	free(new_tokens);
+	free(lvers);
 }
 
 static void cmd_release(struct task *task, struct cmd_args *ca)
 {
 	struct client *cl;
 	struct token *token;
-	struct token *rem_tokens[SANLK_MAX_RESOURCES];
+	struct token **rem_tokens = NULL;
 	struct sanlk_resource res;
 	struct sanlk_resource new;
 	struct sanlk_resource *resrename = NULL;
+	struct sanlk_op_times times;
 	int fd, rv, i, j, found, pid_dead;
+	int rem_tokens_size;
 	int rem_tokens_count = 0;
 	int result = 0;
 	int cl_ci = ca->ci_target;
@@ -559,6 +1042,20 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 		  cl_ci, cl_fd, cl_pid, ca->ci_in, fd,
 		  ca->header.data, ca->header.cmd_flags);
 
+	op_times_begin(task, ca, SANLK_REL_TIMES, &times);
+
+	/* cl->tokens doesn't grow while this cmd is active */
+
+	pthread_mutex_lock(&cl->mutex);
+	rem_tokens_size = cl->tokens_count;
+	pthread_mutex_unlock(&cl->mutex);
+
+	rem_tokens = calloc(rem_tokens_size + 1, sizeof(struct token *));
+	if (!rem_tokens) {
+		result = -ENOMEM;
+		goto out;
+	}
+
 	/* caller wants to release all resources */
 
 	if (ca->header.cmd_flags & SANLK_REL_ALL) {
@@ -568,14 +1065,14 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 			if (!token)
 				continue;
 			rem_tokens[rem_tokens_count++] = token;
-			cl->tokens[j] = NULL;
+			client_token_del(cl, token);
 		}
 		pthread_mutex_unlock(&cl->mutex);
 		goto do_remove;
 	}
 
 	if (ca->header.cmd_flags & SANLK_REL_ORPHAN) {
-		rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+		rv = ca_recv(ca, fd, &res, sizeof(struct sanlk_resource));
 		if (rv != sizeof(struct sanlk_resource)) {
 			log_error("cmd_release %d,%d,%d recv res %d %d",
 				  cl_ci, cl_fd, cl_pid, rv, errno);
@@ -588,7 +1085,7 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 	}
 
 	if (ca->header.cmd_flags & SANLK_REL_RENAME) {
-		rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+		rv = ca_recv(ca, fd, &res, sizeof(struct sanlk_resource));
 		if (rv != sizeof(struct sanlk_resource)) {
 			log_error("cmd_release %d,%d,%d recv res %d %d",
 				  cl_ci, cl_fd, cl_pid, rv, errno);
@@ -597,7 +1094,7 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 		}
 
 		/* second res struct has new name for first res */
-		rv = recv(fd, &new, sizeof(struct sanlk_resource), MSG_WAITALL);
+		rv = ca_recv(ca, fd, &new, sizeof(struct sanlk_resource));
 		if (rv != sizeof(struct sanlk_resource)) {
 			log_error("cmd_release %d,%d,%d recv new %d %d",
 				  cl_ci, cl_fd, cl_pid, rv, errno);
@@ -608,20 +1105,11 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 		found = 0;
 
 		pthread_mutex_lock(&cl->mutex);
-		for (j = 0; j < cl->tokens_slots; j++) {
-			token = cl->tokens[j];
-			if (!token)
-				continue;
-
-			if (memcmp(token->r.lockspace_name, res.lockspace_name, NAME_ID_SIZE))
-				continue;
-			if (memcmp(token->r.name, res.name, NAME_ID_SIZE))
-				continue;
-
+		token = client_token_find(cl, res.lockspace_name, res.name);
+		if (token) {
 			rem_tokens[rem_tokens_count++] = token;
-			cl->tokens[j] = NULL;
+			client_token_del(cl, token);
 			found = 1;
-			break;
 		}
 		pthread_mutex_unlock(&cl->mutex);
 
@@ -638,7 +1126,7 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 	/* caller is specifying specific resources to release */
 
 	for (i = 0; i < ca->header.data; i++) {
-		rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+		rv = ca_recv(ca, fd, &res, sizeof(struct sanlk_resource));
 		if (rv != sizeof(struct sanlk_resource)) {
 			log_error("cmd_release %d,%d,%d recv res %d %d",
 				  cl_ci, cl_fd, cl_pid, rv, errno);
@@ -649,20 +1137,11 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 		found = 0;
 
 		pthread_mutex_lock(&cl->mutex);
-		for (j = 0; j < cl->tokens_slots; j++) {
-			token = cl->tokens[j];
-			if (!token)
-				continue;
-
-			if (memcmp(token->r.lockspace_name, res.lockspace_name, NAME_ID_SIZE))
-				continue;
-			if (memcmp(token->r.name, res.name, NAME_ID_SIZE))
-				continue;
-
+		token = client_token_find(cl, res.lockspace_name, res.name);
+		if (token) {
 			rem_tokens[rem_tokens_count++] = token;
-			cl->tokens[j] = NULL;
+			client_token_del(cl, token);
 			found = 1;
-			break;
 		}
 		pthread_mutex_unlock(&cl->mutex);
 
@@ -675,12 +1154,17 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 
  do_remove:
 
+	unlink_client_tokens(rem_tokens, rem_tokens_count);
+
 	for (i = 0; i < rem_tokens_count; i++) {
 		token = rem_tokens[i];
-		rv = release_token(task, token, resrename);
+		if ((ca->header.cmd_flags & SANLK_REL_LAZY) && !resrename)
+			rv = release_token_lazy(task, token);
+		else
+			rv = release_token(task, token, resrename);
 		if (rv < 0)
 			result = rv;
-		free(token);
+		slab_free(token);
 	}
 
  out:
@@ -701,19 +1185,10 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 		 * may be re-acquired for this same cl/pid.
 		 */
 
-		found = 0;
-
-		for (j = 0; j < cl->tokens_slots; j++) {
-			if (!cl->tokens[j])
-				continue;
-			found = 1;
-			break;
-		}
-
-		if (!found) {
+		if (!cl->tokens_count) {
 			cl->kill_count = 0;
 			cl->kill_last = 0;
-			cl->flags &= ~CL_RUNPATH_SENT;
+			cl->flags &= ~(CL_RUNPATH_SENT | CL_RUNPATH_FAILED);
 
 			log_debug("cmd_release %d,%d,%d clear kill state",
 				  cl_ci, cl_fd, cl_pid);
@@ -727,8 +1202,85 @@ static void cmd_release(struct task *task, struct cmd_args *ca)
 		client_free(cl_ci);
 	}
 
-	send_result(fd, &ca->header, result);
+	send_times_result(task, ca, fd, result);
 	client_resume(ca->ci_in);
+	free(rem_tokens);
+}
+
+/*
+ * SANLK_INQUIRE_BINARY: the same resources that are in the text state,
+ * as a sanlk_inquire_header followed by a sanlk_resource and its disks
+ * for each.  Only SHARED or LVER are set in the flags, which is what the
+ * text state can represent, so the two formats convert without loss.
+ */
+
+static int inquire_binary(struct client *cl, int res_count, char **state_ret, int *len_ret)
+{
+	struct sanlk_inquire_header *ih;
+	struct sanlk_resource *res;
+	struct token *token;
+	char *state, *pos;
+	int len, i, d, count = 0;
+
+	len = sizeof(struct sanlk_inquire_header);
+
+	for (i = 0; i < cl->tokens_slots; i++) {
+		token = cl->tokens[i];
+		if (!token)
+			continue;
+		len += sizeof(struct sanlk_resource);
+		len += token->r.num_disks * sizeof(struct sanlk_disk);
+	}
+
+	state = malloc(len);
+	if (!state)
+		return -ENOMEM;
+	memset(state, 0, len);
+
+	ih = (struct sanlk_inquire_header *)state;
+	pos = state + sizeof(struct sanlk_inquire_header);
+
+	for (i = 0; i < cl->tokens_slots; i++) {
+		token = cl->tokens[i];
+		if (!token)
+			continue;
+
+		if (count >= res_count) {
+			free(state);
+			return -ENOENT;
+		}
+
+		res = (struct sanlk_resource *)pos;
+		memcpy(res->lockspace_name, token->r.lockspace_name, SANLK_NAME_LEN);
+		memcpy(res->name, token->r.name, SANLK_NAME_LEN);
+		res->num_disks = token->r.num_disks;
+
+		if (token->r.flags & SANLK_RES_SHARED) {
+			res->flags = SANLK_RES_SHARED;
+		} else {
+			res->flags = SANLK_RES_LVER;
+			res->lver = token->r.lver;
+		}
+
+		/* sync_disk sector_size and fd are not copied into pad1/pad2 */
+
+		for (d = 0; d < token->r.num_disks; d++) {
+			memcpy(res->disks[d].path, token->disks[d].path, SANLK_PATH_LEN);
+			res->disks[d].offset = token->disks[d].offset;
+		}
+
+		pos += sizeof(struct sanlk_resource) + res->num_disks * sizeof(struct sanlk_disk);
+		count++;
+	}
+
+	ih->magic = SANLK_INQUIRE_MAGIC;
+	ih->version = SANLK_INQUIRE_VERSION;
+	ih->res_count = count;
+	ih->length = len;
+
+	*state_ret = state;
+	*len_ret = len;
+	return 0;
 }
 
 static void cmd_inquire(struct task *task, struct cmd_args *ca)
@@ -737,7 +1289,7 @@ static void cmd_inquire(struct task *task, struct cmd_args *ca)
 	struct token *token;
 	struct client *cl;
 	char *state = NULL, *str;
-	int state_maxlen = 0, state_strlen = 0;
+	int state_maxlen = 0, state_strlen = 0, state_len = 0;
 	int res_count = 0, cat_count = 0;
 	int fd, i, rv, pid_dead;
 	int result = 0;
@@ -758,16 +1310,19 @@ static void cmd_inquire(struct task *task, struct cmd_args *ca)
 		goto done;
 	}
 
-	for (i = 0; i < cl->tokens_slots; i++) {
-		if (cl->tokens[i])
-			res_count++;
-	}
+	res_count = cl->tokens_count;
 
 	if (!res_count) {
 		result = 0;
 		goto done;
 	}
 
+	if (ca->header.cmd_flags & SANLK_INQUIRE_BINARY) {
+		result = inquire_binary(cl, res_count, &state, &state_len);
+		cat_count = res_count;
+		goto done;
+	}
+
 	state_maxlen = res_count * (SANLK_MAX_RES_STR + 1);
 
 	state = malloc(state_maxlen);
@@ -830,6 +1385,7 @@ static void cmd_inquire(struct task *task, struct cmd_args *ca)
 
 	state[state_maxlen - 1] = '\0';
 	state_strlen = strlen(state);
+	state_len = state_strlen + 1;
 	result = 0;
  done:
 	pid_dead = cl->pid_dead;
@@ -850,13 +1406,13 @@ static void cmd_inquire(struct task *task, struct cmd_args *ca)
 	h.data2 = res_count;
 
 	if (state) {
-		h.length = sizeof(h) + state_strlen + 1;
-		send(fd, &h, sizeof(h), MSG_NOSIGNAL);
-		send(fd, state, state_strlen + 1, MSG_NOSIGNAL);
+		h.length = sizeof(h) + state_len;
+		ca_send(ca, fd, &h, sizeof(h));
+		ca_send(ca, fd, state, state_len);
 		free(state);
 	} else {
 		h.length = sizeof(h);
-		send(fd, &h, sizeof(h), MSG_NOSIGNAL);
+		ca_send(ca, fd, &h, sizeof(h));
 	}
 
 	client_resume(ca->ci_in);
@@ -883,6 +1439,7 @@ static void cmd_inquire(struct task *task, struct cmd_args *ca)
 static void cmd_convert(struct task *task, struct cmd_args *ca)
 {
 	struct sanlk_resource res;
+	struct sanlk_op_times times;
 	struct token *token;
 	struct client *cl;
 	int cl_ci = ca->ci_target;
@@ -891,7 +1448,7 @@ static void cmd_convert(struct task *task, struct cmd_args *ca)
 	int pid_dead = 0;
 	int result = 0;
 	int found = 0;
-	int fd, i, rv;
+	int fd, rv;
 
 	cl = &client[cl_ci];
 	fd = client[ca->ci_in].fd;
@@ -899,24 +1456,18 @@ static void cmd_convert(struct task *task, struct cmd_args *ca)
 	log_debug("cmd_convert %d,%d,%d ci_in %d fd %d",
 		  cl_ci, cl_fd, cl_pid, ca->ci_in, fd);
 
-	rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+	op_times_begin(task, ca, SANLK_CONVERT_TIMES, &times);
+
+	rv = ca_recv(ca, fd, &res, sizeof(struct sanlk_resource));
 	if (rv != sizeof(struct sanlk_resource)) {
 		result = -ENOTCONN;
 		goto reply;
 	}
 
 	pthread_mutex_lock(&cl->mutex);
-	for (i = 0; i < cl->tokens_slots; i++) {
-		token = cl->tokens[i];
-		if (!token)
-			continue;
-		if (memcmp(token->r.lockspace_name, res.lockspace_name, NAME_ID_SIZE))
-			continue;
-		if (memcmp(token->r.name, res.name, NAME_ID_SIZE))
-			continue;
+	token = client_token_find(cl, res.lockspace_name, res.name);
+	if (token)
 		found = 1;
-		break;
-	}
 	pthread_mutex_unlock(&cl->mutex);
 
 	if (!found) {
@@ -943,7 +1494,7 @@ static void cmd_convert(struct task *task, struct cmd_args *ca)
 		client_free(cl_ci);
 	}
 
-	send_result(fd, &ca->header, result);
+	send_times_result(task, ca, fd, result);
 	client_resume(ca->ci_in);
 }
 
@@ -963,7 +1514,7 @@ static void cmd_request(struct task *task, struct cmd_args *ca)
 
 	/* receiving and setting up token copied from cmd_acquire */
 
-	rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &res, sizeof(struct sanlk_resource));
 	if (rv != sizeof(struct sanlk_resource)) {
 		log_error("cmd_request %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -979,7 +1530,7 @@ static void cmd_request(struct task *task, struct cmd_args *ca)
 	disks_len = res.num_disks * sizeof(struct sync_disk);
 	token_len = sizeof(struct token) + disks_len;
 
-	token = malloc(token_len);
+	token = slab_alloc(SLAB_TOKEN, res.num_disks);
 	if (!token) {
 		result = -ENOMEM;
 		goto reply;
@@ -1004,7 +1555,7 @@ static void cmd_request(struct task *task, struct cmd_args *ca)
 	 * in sanlk_disk (TODO: let these differ?)
 	 */
 
-	rv = recv(fd, token->disks, disks_len, MSG_WAITALL);
+	rv = ca_recv(ca, fd, token->disks, disks_len);
 	if (rv != disks_len) {
 		result = -ENOTCONN;
 		goto reply_free;
@@ -1032,6 +1583,8 @@ static void cmd_request(struct task *task, struct cmd_args *ca)
 	token->io_timeout = spi.io_timeout;
 	token->sector_size = spi.sector_size;
 	token->align_size = spi.align_size;
+	token->host_id = spi.host_id;
+	token->host_generation = spi.host_generation;
 
 	error = request_token(task, token, force_mode, &owner_id,
 			      (ca->header.cmd_flags & SANLK_REQUEST_NEXT_LVER));
@@ -1046,13 +1599,14 @@ static void cmd_request(struct task *task, struct cmd_args *ca)
 		goto reply_free;
 
 	if (owner_id)
-		host_status_set_bit(token->r.lockspace_name, owner_id);
+		host_status_set_request(token->r.lockspace_name, owner_id,
+					resource_name_hash(token->r.lockspace_name, token->r.name));
  reply_free:
-	free(token);
+	slab_free(token);
  reply:
 	log_debug("cmd_request %d,%d done %d", ca->ci_in, fd, result);
 
-	send_result(fd, &ca->header, result);
+	ca_send_result(ca, fd, result);
 	client_resume(ca->ci_in);
 }
 
@@ -1078,7 +1632,7 @@ static void cmd_examine(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 		ls = &buf.s;
 	}
 
-	rv = recv(fd, &buf, datalen, MSG_WAITALL);
+	rv = ca_recv(ca, fd, &buf, datalen);
 	if (rv != datalen) {
 		log_error("cmd_examine %d,%d recv %d %d",
 			  ca->ci_in, fd, rv, errno);
@@ -1101,11 +1655,11 @@ static void cmd_examine(struct task *task GNUC_UNUSED, struct cmd_args *ca)
  reply:
 	log_debug("cmd_examine %d,%d done %d", ca->ci_in, fd, count);
 
-	send_result(fd, &ca->header, result);
+	ca_send_result(ca, fd, result);
 	client_resume(ca->ci_in);
 }
 
-static void cmd_set_lvb(struct task *task GNUC_UNUSED, struct cmd_args *ca)
+static void cmd_set_lvb(struct task *task, struct cmd_args *ca)
 {
 	struct sanlk_resource res;
 	char *lvb = NULL;
@@ -1113,7 +1667,7 @@ static void cmd_set_lvb(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &res, sizeof(struct sanlk_resource));
 	if (rv != sizeof(struct sanlk_resource)) {
 		log_error("cmd_set_lvb %d,%d recv %d %d", ca->ci_in, fd, rv, errno);
 		result = -ENOTCONN;
@@ -1122,10 +1676,10 @@ static void cmd_set_lvb(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 
 	lvblen = ca->header.length - sizeof(struct sm_header) - sizeof(struct sanlk_resource);
 
-	/* 4096 is the max sector size we handle, it is compared
-	   against the actual 512/4K sector size in res_set_lvb. */
+	/* 16384 is the largest lvb region (SANLK_RES_LVB16K), it is
+	   compared against the actual lvb size in res_set_lvb. */
 
-	if (lvblen > 4096) {
+	if (lvblen > 16384) {
 		log_error("cmd_set_lvb %d,%d lvblen %d too big", ca->ci_in, fd, lvblen);
 		result = -E2BIG;
 		goto reply;
@@ -1137,7 +1691,7 @@ static void cmd_set_lvb(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 		goto reply;
 	}
 
-	rv = recv(fd, lvb, lvblen, MSG_WAITALL);
+	rv = ca_recv(ca, fd, lvb, lvblen);
 	if (rv != lvblen) {
 		log_error("cmd_set_lvb %d,%d recv lvblen %d lvb %d %d",
 			  ca->ci_in, fd, lvblen, rv, errno);
@@ -1145,7 +1699,7 @@ static void cmd_set_lvb(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 		goto reply;
 	}
 
-	result = res_set_lvb(&res, lvb, lvblen);
+	result = res_set_lvb(task, &res, lvb, lvblen, ca->header.cmd_flags);
 
 	log_debug("cmd_set_lvb ci %d fd %d result %d res %s:%s",
 		  ca->ci_in, fd, result, res.lockspace_name, res.name);
@@ -1153,7 +1707,7 @@ static void cmd_set_lvb(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 	if (lvb)
 		free(lvb);
 
-	send_result(fd, &ca->header, result);
+	ca_send_result(ca, fd, result);
 	client_resume(ca->ci_in);
 }
 
@@ -1166,7 +1720,7 @@ static void cmd_get_lvb(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &res, sizeof(struct sanlk_resource));
 	if (rv != sizeof(struct sanlk_resource)) {
 		log_error("cmd_get_lvb %d,%d recv %d %d", ca->ci_in, fd, rv, errno);
 		result = -ENOTCONN;
@@ -1187,10 +1741,10 @@ static void cmd_get_lvb(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 	h.data2 = 0;
 	h.length = sizeof(h) + lvblen;
 
-	send(fd, &h, sizeof(h), MSG_NOSIGNAL);
+	ca_send(ca, fd, &h, sizeof(h));
 
 	if (lvb) {
-		send(fd, lvb, lvblen, MSG_NOSIGNAL);
+		ca_send(ca, fd, lvb, lvblen);
 		free(lvb);
 	}
 
@@ -1242,7 +1796,7 @@ static void cmd_shutdown_wait(struct task *task GNUC_UNUSED, struct cmd_args *ca
 	if (!result)
 		return;
 
-	send_result(fd, &ca->header, result);
+	ca_send_result(ca, fd, result);
 	client_resume(ca->ci_in);
 }
 
@@ -1275,7 +1829,7 @@ static void cmd_add_lockspace(struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &lockspace, sizeof(struct sanlk_lockspace), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &lockspace, sizeof(struct sanlk_lockspace));
 	if (rv != sizeof(struct sanlk_lockspace)) {
 		log_error("cmd_add_lockspace %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -1303,7 +1857,7 @@ static void cmd_add_lockspace(struct cmd_args *ca)
 	if (async) {
 		result = rv;
 		log_debug("cmd_add_lockspace %d,%d async done %d", ca->ci_in, fd, result);
-		send_result(fd, &ca->header, result);
+		ca_send_result(ca, fd, result);
 		client_resume(ca->ci_in);
 		add_lockspace_wait(sp);
 		return;
@@ -1312,7 +1866,7 @@ static void cmd_add_lockspace(struct cmd_args *ca)
 	result = add_lockspace_wait(sp);
  reply:
 	log_debug("cmd_add_lockspace %d,%d done %d", ca->ci_in, fd, result);
-	send_result(fd, &ca->header, result);
+	ca_send_result(ca, fd, result);
 	client_resume(ca->ci_in);
 }
 
@@ -1324,7 +1878,7 @@ static void cmd_inq_lockspace(struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &lockspace, sizeof(struct sanlk_lockspace), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &lockspace, sizeof(struct sanlk_lockspace));
 	if (rv != sizeof(struct sanlk_lockspace)) {
 		log_error("cmd_inq_lockspace %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -1352,7 +1906,7 @@ static void cmd_inq_lockspace(struct cmd_args *ca)
  reply:
 	/* log_debug("cmd_inq_lockspace %d,%d done %d", ca->ci_in, fd, result); */
 
-	send_result(fd, &ca->header, result);
+	ca_send_result(ca, fd, result);
 	client_resume(ca->ci_in);
 }
 
@@ -1401,53 +1955,248 @@ static void cmd_inq_lockspace(struct cmd_args *ca)
  * resources list?
  */
 
-static void cmd_rem_lockspace(struct cmd_args *ca)
+static void cmd_rem_lockspace(struct cmd_args *ca)
+{
+	struct sanlk_lockspace lockspace;
+	int async = ca->header.cmd_flags & SANLK_REM_ASYNC;
+	int fd, rv, result;
+	unsigned int space_id;
+
+	fd = client[ca->ci_in].fd;
+
+	rv = ca_recv(ca, fd, &lockspace, sizeof(struct sanlk_lockspace));
+	if (rv != sizeof(struct sanlk_lockspace)) {
+		log_error("cmd_rem_lockspace %d,%d recv %d %d",
+			  ca->ci_in, fd, rv, errno);
+		result = -ENOTCONN;
+		goto reply;
+	}
+
+	log_debug("cmd_rem_lockspace %d,%d %.48s flags %x",
+		  ca->ci_in, fd, lockspace.name, ca->header.cmd_flags);
+
+	if (ca->header.cmd_flags & SANLK_REM_UNUSED) {
+		if (lockspace_is_used(&lockspace)) {
+			result = -EBUSY;
+			goto reply;
+		}
+	}
+
+	rv = rem_lockspace_start(&lockspace, &space_id);
+	if (rv < 0) {
+		result = rv;
+		goto reply;
+	}
+
+	if (async) {
+		result = rv;
+		log_debug("cmd_rem_lockspace %d,%d async done %d", ca->ci_in, fd, result);
+		ca_send_result(ca, fd, result);
+		client_resume(ca->ci_in);
+		rem_lockspace_wait(&lockspace, space_id);
+		return;
+	}
+
+	result = rem_lockspace_wait(&lockspace, space_id);
+ reply:
+	log_debug("cmd_rem_lockspace %d,%d done %d", ca->ci_in, fd, result);
+	ca_send_result(ca, fd, result);
+	client_resume(ca->ci_in);
+}
+
+/*
+ * add_lockspaces/rem_lockspaces: the lockspace threads for all the
+ * lockspaces are started before waiting for any of them, so the delta
+ * lease acquires (or releases) run concurrently, and the time for the
+ * batch is about the time for one lockspace rather than the sum.
+ * The reply is followed by the result for each lockspace.
+ */
+
+static int recv_lockspaces(struct cmd_args *ca, const char *cmd,
+			   struct sanlk_lockspace **lss_out, int **results_out,
+			   int *count_out)
+{
+	struct sanlk_lockspace *lss;
+	int *results;
+	int fd, rv, count, len = 0;
+
+	fd = client[ca->ci_in].fd;
+
+	if (ca->header.length > sizeof(struct sm_header))
+		len = ca->header.length - sizeof(struct sm_header);
+	count = len / sizeof(struct sanlk_lockspace);
+
+	if (!count || (len % sizeof(struct sanlk_lockspace)) ||
+	    count > LOCKSPACE_MAX_BATCH || count != ca->header.data2) {
+		log_error("%s %d,%d bad length %u count %u", cmd, ca->ci_in, fd,
+			  ca->header.length, ca->header.data2);
+		return -EINVAL;
+	}
+
+	lss = malloc(len);
+	results = calloc(count, sizeof(int));
+	if (!lss || !results) {
+		free(lss);
+		free(results);
+		return -ENOMEM;
+	}
+
+	rv = ca_recv(ca, fd, lss, len);
+	if (rv != len) {
+		log_error("%s %d,%d recv %d %d", cmd, ca->ci_in, fd, rv, errno);
+		free(lss);
+		free(results);
+		return -ENOTCONN;
+	}
+
+	*lss_out = lss;
+	*results_out = results;
+	*count_out = count;
+	return 0;
+}
+
+static void send_lockspaces_result(struct cmd_args *ca, int fd, int result,
+				   int *results, int count)
+{
+	struct sm_header h;
+
+	memcpy(&h, &ca->header, sizeof(struct sm_header));
+	h.version = SM_PROTO;
+	h.data = result;
+	h.data2 = 0;
+	h.length = sizeof(h) + (result < 0 ? 0 : count * sizeof(int));
+	ca_send(ca, fd, &h, sizeof(h));
+	if (result >= 0)
+		ca_send(ca, fd, results, count * sizeof(int));
+}
+
+static void cmd_add_lockspaces(struct cmd_args *ca)
 {
-	struct sanlk_lockspace lockspace;
-	int async = ca->header.cmd_flags & SANLK_REM_ASYNC;
-	int fd, rv, result;
-	unsigned int space_id;
+	struct sanlk_lockspace *lss = NULL;
+	struct space **sps = NULL;
+	int *results = NULL;
+	uint32_t io_timeout;
+	int async = ca->header.cmd_flags & SANLK_ADD_ASYNC;
+	int fd, i, rv, result, count = 0, fail = 0;
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &lockspace, sizeof(struct sanlk_lockspace), MSG_WAITALL);
-	if (rv != sizeof(struct sanlk_lockspace)) {
-		log_error("cmd_rem_lockspace %d,%d recv %d %d",
-			  ca->ci_in, fd, rv, errno);
-		result = -ENOTCONN;
+	result = recv_lockspaces(ca, "cmd_add_lockspaces", &lss, &results, &count);
+	if (result < 0)
+		goto reply;
+
+	log_debug("cmd_add_lockspaces %d,%d count %d flags %x timeout %u",
+		  ca->ci_in, fd, count, ca->header.cmd_flags, ca->header.data);
+
+	sps = calloc(count, sizeof(struct space *));
+	if (!sps) {
+		result = -ENOMEM;
 		goto reply;
 	}
 
-	log_debug("cmd_rem_lockspace %d,%d %.48s flags %x",
-		  ca->ci_in, fd, lockspace.name, ca->header.cmd_flags);
+	io_timeout = ca->header.data;
+	if (!io_timeout)
+		io_timeout = DEFAULT_IO_TIMEOUT;
 
-	if (ca->header.cmd_flags & SANLK_REM_UNUSED) {
-		if (lockspace_is_used(&lockspace)) {
-			result = -EBUSY;
-			goto reply;
+	for (i = 0; i < count; i++) {
+		rv = add_lockspace_start(&lss[i], io_timeout, &sps[i]);
+		if (rv < 0) {
+			log_debug("cmd_add_lockspaces %d,%d %.48s start %d",
+				  ca->ci_in, fd, lss[i].name, rv);
+			results[i] = rv;
+			sps[i] = NULL;
 		}
 	}
 
-	rv = rem_lockspace_start(&lockspace, &space_id);
-	if (rv < 0) {
-		result = rv;
+	if (async) {
+		log_debug("cmd_add_lockspaces %d,%d async done", ca->ci_in, fd);
+		send_lockspaces_result(ca, fd, 0, results, count);
+		client_resume(ca->ci_in);
+	}
+
+	/* each wait returns when its lockspace thread has finished acquiring */
+	for (i = 0; i < count; i++) {
+		if (!sps[i])
+			continue;
+		results[i] = add_lockspace_wait(sps[i]);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (results[i] < 0)
+			fail++;
+	}
+	log_debug("cmd_add_lockspaces %d,%d count %d failed %d",
+		  ca->ci_in, fd, count, fail);
+
+	if (async)
+		goto out;
+ reply:
+	log_debug("cmd_add_lockspaces %d,%d done %d", ca->ci_in, fd, result);
+	send_lockspaces_result(ca, fd, result, results, count);
+	client_resume(ca->ci_in);
+ out:
+	free(sps);
+	free(lss);
+	free(results);
+}
+
+static void cmd_rem_lockspaces(struct cmd_args *ca)
+{
+	struct sanlk_lockspace *lss = NULL;
+	unsigned int *space_ids = NULL;
+	int *results = NULL;
+	int async = ca->header.cmd_flags & SANLK_REM_ASYNC;
+	int fd, i, rv, result, count = 0;
+
+	fd = client[ca->ci_in].fd;
+
+	result = recv_lockspaces(ca, "cmd_rem_lockspaces", &lss, &results, &count);
+	if (result < 0)
+		goto reply;
+
+	log_debug("cmd_rem_lockspaces %d,%d count %d flags %x",
+		  ca->ci_in, fd, count, ca->header.cmd_flags);
+
+	space_ids = calloc(count, sizeof(unsigned int));
+	if (!space_ids) {
+		result = -ENOMEM;
 		goto reply;
 	}
 
+	for (i = 0; i < count; i++) {
+		if ((ca->header.cmd_flags & SANLK_REM_UNUSED) &&
+		    lockspace_is_used(&lss[i])) {
+			results[i] = -EBUSY;
+			continue;
+		}
+
+		rv = rem_lockspace_start(&lss[i], &space_ids[i]);
+		if (rv < 0)
+			results[i] = rv;
+	}
+
 	if (async) {
-		result = rv;
-		log_debug("cmd_rem_lockspace %d,%d async done %d", ca->ci_in, fd, result);
-		send_result(fd, &ca->header, result);
+		log_debug("cmd_rem_lockspaces %d,%d async done", ca->ci_in, fd);
+		send_lockspaces_result(ca, fd, 0, results, count);
 		client_resume(ca->ci_in);
-		rem_lockspace_wait(&lockspace, space_id);
-		return;
 	}
 
-	result = rem_lockspace_wait(&lockspace, space_id);
+	for (i = 0; i < count; i++) {
+		if (results[i] < 0)
+			continue;
+		results[i] = rem_lockspace_wait(&lss[i], space_ids[i]);
+	}
+
+	if (async)
+		goto out;
  reply:
-	log_debug("cmd_rem_lockspace %d,%d done %d", ca->ci_in, fd, result);
-	send_result(fd, &ca->header, result);
+	log_debug("cmd_rem_lockspaces %d,%d done %d", ca->ci_in, fd, result);
+	send_lockspaces_result(ca, fd, result, results, count);
 	client_resume(ca->ci_in);
+ out:
+	free(space_ids);
+	free(lss);
+	free(results);
 }
 
 static void cmd_align(struct task *task GNUC_UNUSED, struct cmd_args *ca)
@@ -1458,7 +2207,7 @@ static void cmd_align(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &disk, sizeof(struct sanlk_disk), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &disk, sizeof(struct sanlk_disk));
 	if (rv != sizeof(struct sanlk_disk)) {
 		log_error("cmd_align %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -1489,7 +2238,63 @@ static void cmd_align(struct task *task GNUC_UNUSED, struct cmd_args *ca)
  reply:
 	log_debug("cmd_align %d,%d done %d", ca->ci_in, fd, result);
 
-	send_result(fd, &ca->header, result);
+	ca_send_result(ca, fd, result);
+	client_resume(ca->ci_in);
+}
+
+static void cmd_next_free(struct task *task, struct cmd_args *ca)
+{
+	struct sm_header h;
+	struct sanlk_disk disk;
+	struct sync_disk sd;
+	uint64_t offset = 0;
+	int fd, rv, result;
+
+	fd = client[ca->ci_in].fd;
+
+	rv = ca_recv(ca, fd, &disk, sizeof(struct sanlk_disk));
+	if (rv != sizeof(struct sanlk_disk)) {
+		log_error("cmd_next_free %d,%d recv %d %d",
+			   ca->ci_in, fd, rv, errno);
+		result = -ENOTCONN;
+		goto reply;
+	}
+
+	log_debug("cmd_next_free %d,%d %.256s:%llu flags %x",
+		  ca->ci_in, fd, disk.path, (unsigned long long)disk.offset,
+		  ca->header.cmd_flags);
+
+	if (!disk.path[0]) {
+		result = -ENODEV;
+		goto reply;
+	}
+
+	memset(&sd, 0, sizeof(struct sync_disk));
+	memcpy(&sd, &disk, sizeof(struct sanlk_disk));
+	sd.fd = -1;
+
+	rv = open_disk(&sd);
+	if (rv < 0) {
+		result = -ENODEV;
+		goto reply;
+	}
+
+	result = freemap_cache_next(task, &sd, ca->header.cmd_flags, &offset);
+
+	close_disks(&sd, 1);
+ reply:
+	log_debug("cmd_next_free %d,%d done %d %llu", ca->ci_in, fd, result,
+		  (unsigned long long)offset);
+
+	disk.offset = offset;
+
+	memcpy(&h, &ca->header, sizeof(struct sm_header));
+	h.version = SM_PROTO;
+	h.data = result;
+	h.data2 = 0;
+	h.length = sizeof(h) + sizeof(disk);
+	ca_send(ca, fd, &h, sizeof(h));
+	ca_send(ca, fd, &disk, sizeof(disk));
 	client_resume(ca->ci_in);
 }
 
@@ -1506,7 +2311,7 @@ static void cmd_read_lockspace(struct task *task, struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &lockspace, sizeof(struct sanlk_lockspace), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &lockspace, sizeof(struct sanlk_lockspace));
 	if (rv != sizeof(struct sanlk_lockspace)) {
 		log_error("cmd_read_lockspace %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -1543,6 +2348,9 @@ static void cmd_read_lockspace(struct task *task, struct cmd_args *ca)
 	sector_size = sanlk_lsf_sector_flag_to_size(lockspace.flags);
 	align_size = sanlk_lsf_align_flag_to_size(lockspace.flags);
 
+	/* concurrent reads of the same lockspace share the i/o */
+	task->read_shared = 1;
+
 	if (!sector_size) {
 		/* reads the first leader record to get sector size */
 		result = delta_read_lockspace_sizes(task, &sd, DEFAULT_IO_TIMEOUT, &sector_size, &align_size);
@@ -1561,6 +2369,7 @@ static void cmd_read_lockspace(struct task *task, struct cmd_args *ca)
 		result = 0;
 
  out_close:
+	task->read_shared = 0;
 	close_disks(&sd, 1);
  reply:
 	log_debug("cmd_read_lockspace %d,%d done %d", ca->ci_in, fd, result);
@@ -1570,8 +2379,8 @@ static void cmd_read_lockspace(struct task *task, struct cmd_args *ca)
 	h.data = result;
 	h.data2 = io_timeout;
 	h.length = sizeof(h) + sizeof(lockspace);
-	send(fd, &h, sizeof(h), MSG_NOSIGNAL);
-	send(fd, &lockspace, sizeof(lockspace), MSG_NOSIGNAL);
+	ca_send(ca, fd, &h, sizeof(h));
+	ca_send(ca, fd, &lockspace, sizeof(lockspace));
 	client_resume(ca->ci_in);
 }
 
@@ -1587,7 +2396,7 @@ static void cmd_read_resource(struct task *task, struct cmd_args *ca)
 
 	/* receiving and setting up token copied from cmd_acquire */
 
-	rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &res, sizeof(struct sanlk_resource));
 	if (rv != sizeof(struct sanlk_resource)) {
 		log_error("cmd_read_resource %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -1603,7 +2412,7 @@ static void cmd_read_resource(struct task *task, struct cmd_args *ca)
 	disks_len = res.num_disks * sizeof(struct sync_disk);
 	token_len = sizeof(struct token) + disks_len;
 
-	token = malloc(token_len);
+	token = slab_alloc(SLAB_TOKEN, res.num_disks);
 	if (!token) {
 		result = -ENOMEM;
 		goto reply;
@@ -1622,7 +2431,7 @@ static void cmd_read_resource(struct task *task, struct cmd_args *ca)
 	 * in sanlk_disk (TODO: let these differ?)
 	 */
 
-	rv = recv(fd, token->disks, disks_len, MSG_WAITALL);
+	rv = ca_recv(ca, fd, token->disks, disks_len);
 	if (rv != disks_len) {
 		result = -ENOTCONN;
 		goto reply;
@@ -1655,14 +2464,16 @@ static void cmd_read_resource(struct task *task, struct cmd_args *ca)
 	token->align_size = sanlk_res_align_flag_to_size(res.flags);
 
 	/* sets res.lockspace_name, res.name, res.lver, res.flags */
+	task->read_shared = 1;
 	result = paxos_read_resource(task, token, &res);
+	task->read_shared = 0;
 	if (result == SANLK_OK)
 		result = 0;
 
 	close_disks(token->disks, token->r.num_disks);
  reply:
 	if (token)
-		free(token);
+		slab_free(token);
 	log_debug("cmd_read_resource %d,%d done %d", ca->ci_in, fd, result);
 
 	memcpy(&h, &ca->header, sizeof(struct sm_header));
@@ -1670,8 +2481,8 @@ static void cmd_read_resource(struct task *task, struct cmd_args *ca)
 	h.data = result;
 	h.data2 = 0;
 	h.length = sizeof(h) + sizeof(res);
-	send(fd, &h, sizeof(h), MSG_NOSIGNAL);
-	send(fd, &res, sizeof(res), MSG_NOSIGNAL);
+	ca_send(ca, fd, &h, sizeof(h));
+	ca_send(ca, fd, &res, sizeof(res));
 	client_resume(ca->ci_in);
 }
 
@@ -1688,7 +2499,7 @@ static void cmd_read_resource_owners(struct task *task, struct cmd_args *ca)
 
 	/* receiving and setting up token copied from cmd_acquire */
 
-	rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &res, sizeof(struct sanlk_resource));
 	if (rv != sizeof(struct sanlk_resource)) {
 		log_error("cmd_read_resource_owners %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -1704,7 +2515,7 @@ static void cmd_read_resource_owners(struct task *task, struct cmd_args *ca)
 	disks_len = res.num_disks * sizeof(struct sync_disk);
 	token_len = sizeof(struct token) + disks_len;
 
-	token = malloc(token_len);
+	token = slab_alloc(SLAB_TOKEN, res.num_disks);
 	if (!token) {
 		result = -ENOMEM;
 		goto reply;
@@ -1723,7 +2534,7 @@ static void cmd_read_resource_owners(struct task *task, struct cmd_args *ca)
 	 * in sanlk_disk (TODO: let these differ?)
 	 */
 
-	rv = recv(fd, token->disks, disks_len, MSG_WAITALL);
+	rv = ca_recv(ca, fd, token->disks, disks_len);
 	if (rv != disks_len) {
 		result = -ENOTCONN;
 		goto reply;
@@ -1758,14 +2569,16 @@ static void cmd_read_resource_owners(struct task *task, struct cmd_args *ca)
 	send_buf = NULL;
 	send_len = 0;
 
+	task->read_shared = 1;
 	result = read_resource_owners(task, token, &res, &send_buf, &send_len, &count);
+	task->read_shared = 0;
 	if (result == SANLK_OK)
 		result = 0;
 
 	close_disks(token->disks, token->r.num_disks);
  reply:
 	if (token)
-		free(token);
+		slab_free(token);
 	log_debug("cmd_read_resource_owners %d,%d count %d done %d", ca->ci_in, fd, count, result);
 
 	memcpy(&h, &ca->header, sizeof(struct sm_header));
@@ -1773,10 +2586,10 @@ static void cmd_read_resource_owners(struct task *task, struct cmd_args *ca)
 	h.data = result;
 	h.data2 = count;
 	h.length = sizeof(h) + sizeof(res) + send_len;
-	send(fd, &h, sizeof(h), MSG_NOSIGNAL);
-	send(fd, &res, sizeof(res), MSG_NOSIGNAL);
+	ca_send(ca, fd, &h, sizeof(h));
+	ca_send(ca, fd, &res, sizeof(res));
 	if (send_len && send_buf) {
-		send(fd, send_buf, send_len, MSG_NOSIGNAL);
+		ca_send(ca, fd, send_buf, send_len);
 		free(send_buf);
 	}
 
@@ -1792,7 +2605,7 @@ static void cmd_write_lockspace(struct task *task, struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &lockspace, sizeof(struct sanlk_lockspace), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &lockspace, sizeof(struct sanlk_lockspace));
 	if (rv != sizeof(struct sanlk_lockspace)) {
 		log_error("cmd_write_lockspace %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -1834,7 +2647,7 @@ static void cmd_write_lockspace(struct task *task, struct cmd_args *ca)
  reply:
 	log_debug("cmd_write_lockspace %d,%d done %d", ca->ci_in, fd, result);
 
-	send_result(fd, &ca->header, result);
+	ca_send_result(ca, fd, result);
 	client_resume(ca->ci_in);
 }
 
@@ -1851,7 +2664,7 @@ static void cmd_write_resource(struct task *task, struct cmd_args *ca)
 
 	/* receiving and setting up token copied from cmd_acquire */
 
-	rv = recv(fd, &res, sizeof(struct sanlk_resource), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &res, sizeof(struct sanlk_resource));
 	if (rv != sizeof(struct sanlk_resource)) {
 		log_error("cmd_write_resource %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -1867,7 +2680,7 @@ static void cmd_write_resource(struct task *task, struct cmd_args *ca)
 	disks_len = res.num_disks * sizeof(struct sync_disk);
 	token_len = sizeof(struct token) + disks_len;
 
-	token = malloc(token_len);
+	token = slab_alloc(SLAB_TOKEN, res.num_disks);
 	if (!token) {
 		result = -ENOMEM;
 		goto reply;
@@ -1887,7 +2700,7 @@ static void cmd_write_resource(struct task *task, struct cmd_args *ca)
 	 * in sanlk_disk (TODO: let these differ?)
 	 */
 
-	rv = recv(fd, token->disks, disks_len, MSG_WAITALL);
+	rv = ca_recv(ca, fd, token->disks, disks_len);
 	if (rv != disks_len) {
 		result = -ENOTCONN;
 		goto reply;
@@ -1928,9 +2741,9 @@ static void cmd_write_resource(struct task *task, struct cmd_args *ca)
 	close_disks(token->disks, token->r.num_disks);
  reply:
 	if (token)
-		free(token);
+		slab_free(token);
 
-	send_result(fd, &ca->header, result);
+	ca_send_result(ca, fd, result);
 	client_resume(ca->ci_in);
 }
 
@@ -2003,13 +2816,13 @@ static void cmd_set_event(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &lockspace, sizeof(struct sanlk_lockspace), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &lockspace, sizeof(struct sanlk_lockspace));
 	if (rv != sizeof(struct sanlk_lockspace)) {
 	        result = -ENOTCONN;
 	        goto reply;
 	}
 
-	rv = recv(fd, &he, sizeof(struct sanlk_host_event), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &he, sizeof(struct sanlk_host_event));
 	if (rv != sizeof(struct sanlk_host_event)) {
 	        result = -ENOTCONN;
 	        goto reply;
@@ -2021,7 +2834,7 @@ static void cmd_set_event(struct task *task GNUC_UNUSED, struct cmd_args *ca)
 
 	log_debug("cmd_set_event result %d", result);
 reply:
-	send_result(fd, &ca->header, result);
+	ca_send_result(ca, fd, result);
 	client_resume(ca->ci_in);
 }
 
@@ -2032,7 +2845,7 @@ static void cmd_format_rindex(struct task *task, struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &ri, sizeof(struct sanlk_rindex), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &ri, sizeof(struct sanlk_rindex));
 	if (rv != sizeof(struct sanlk_rindex)) {
 		log_error("cmd_format_rindex %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -2049,7 +2862,7 @@ static void cmd_format_rindex(struct task *task, struct cmd_args *ca)
  reply:
 	log_debug("cmd_format_rindex %d,%d done %d", ca->ci_in, fd, result);
 
-	send_result(fd, &ca->header, result);
+	ca_send_result(ca, fd, result);
 	client_resume(ca->ci_in);
 }
 
@@ -2060,7 +2873,7 @@ static void cmd_rebuild_rindex(struct task *task, struct cmd_args *ca)
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &ri, sizeof(struct sanlk_rindex), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &ri, sizeof(struct sanlk_rindex));
 	if (rv != sizeof(struct sanlk_rindex)) {
 		log_error("cmd_rebuild_rindex %d,%d recv %d %d",
 			   ca->ci_in, fd, rv, errno);
@@ -2077,7 +2890,7 @@ static void cmd_rebuild_rindex(struct task *task, struct cmd_args *ca)
  reply:
 	log_debug("cmd_rebuild_rindex %d,%d done %d", ca->ci_in, fd, result);
 
-	send_result(fd, &ca->header, result);
+	ca_send_result(ca, fd, result);
 	client_resume(ca->ci_in);
 }
 
@@ -2093,14 +2906,14 @@ static void rindex_op(struct task *task, struct cmd_args *ca, const char *cmd, i
 
 	fd = client[ca->ci_in].fd;
 
-	rv = recv(fd, &ri, sizeof(struct sanlk_rindex), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &ri, sizeof(struct sanlk_rindex));
 	if (rv != sizeof(struct sanlk_rindex)) {
 		log_error("%s %d,%d recv %d %d", cmd, ca->ci_in, fd, rv, errno);
 		result = -ENOTCONN;
 		goto reply;
 	}
 
-	rv = recv(fd, &re, sizeof(struct sanlk_rentry), MSG_WAITALL);
+	rv = ca_recv(ca, fd, &re, sizeof(struct sanlk_rentry));
 	if (rv != sizeof(struct sanlk_rentry)) {
 		log_error("%s %d,%d recv %d %d", cmd, ca->ci_in, fd, rv, errno);
 		result = -ENOTCONN;
@@ -2131,9 +2944,85 @@ static void rindex_op(struct task *task, struct cmd_args *ca, const char *cmd, i
 	h.data = result;
 	h.data2 = 0;
 	h.length = sizeof(h) + sizeof(re_ret);
-	send(fd, &h, sizeof(h), MSG_NOSIGNAL);
-	send(fd, &re_ret, sizeof(re), MSG_NOSIGNAL);
+	ca_send(ca, fd, &h, sizeof(h));
+	ca_send(ca, fd, &re_ret, sizeof(re));
+
+	client_resume(ca->ci_in);
+}
+
+/* create/delete a batch of resources, the rentries follow the rindex */
+
+static void rindex_batch_op(struct task *task, struct cmd_args *ca, const char *cmd, int op)
+{
+	struct sanlk_rindex ri;
+	struct sanlk_rentry *re = NULL;
+	struct sanlk_rentry *re_ret = NULL;
+	struct sm_header h;
+	int fd, rv, result, count = 0, re_len = 0;
+
+	fd = client[ca->ci_in].fd;
+
+	rv = ca_recv(ca, fd, &ri, sizeof(struct sanlk_rindex));
+	if (rv != sizeof(struct sanlk_rindex)) {
+		log_error("%s %d,%d recv %d %d", cmd, ca->ci_in, fd, rv, errno);
+		result = -ENOTCONN;
+		goto reply;
+	}
+
+	if (ca->header.length > sizeof(struct sm_header) + sizeof(struct sanlk_rindex))
+		re_len = ca->header.length - sizeof(struct sm_header) - sizeof(struct sanlk_rindex);
+	count = re_len / sizeof(struct sanlk_rentry);
+
+	if (!count || (re_len % sizeof(struct sanlk_rentry)) || count > RINDEX_MAX_BATCH) {
+		log_error("%s %d,%d bad length %u", cmd, ca->ci_in, fd, ca->header.length);
+		count = 0;
+		result = -EINVAL;
+		goto reply;
+	}
+
+	re = malloc(re_len);
+	re_ret = malloc(re_len);
+	if (!re || !re_ret) {
+		count = 0;
+		result = -ENOMEM;
+		goto reply;
+	}
+	memset(re_ret, 0, re_len);
+
+	rv = ca_recv(ca, fd, re, re_len);
+	if (rv != re_len) {
+		log_error("%s %d,%d recv %d %d", cmd, ca->ci_in, fd, rv, errno);
+		count = 0;
+		result = -ENOTCONN;
+		goto reply;
+	}
+
+	log_debug("%s %d,%d %.48s %s:%llu count %d", cmd,
+		  ca->ci_in, fd, ri.lockspace_name,
+		  ri.disk.path,
+		  (unsigned long long)ri.disk.offset, count);
+
+	if (op == RX_OP_CREATE)
+		result = rindex_create_batch(task, &ri, re, re_ret, count, ca->header.data, ca->header.data2);
+	else if (op == RX_OP_DELETE)
+		result = rindex_delete_batch(task, &ri, re, re_ret, count);
+	else
+		result = -EINVAL;
 
+ reply:
+	log_debug("%s %d,%d done %d", cmd, ca->ci_in, fd, result);
+
+	memcpy(&h, &ca->header, sizeof(struct sm_header));
+	h.version = SM_PROTO;
+	h.data = result;
+	h.data2 = 0;
+	h.length = sizeof(h) + (count * sizeof(struct sanlk_rentry));
+	ca_send(ca, fd, &h, sizeof(h));
+	if (count)
+		ca_send(ca, fd, re_ret, count * sizeof(struct sanlk_rentry));
+
+	free(re);
+	free(re_ret);
 	client_resume(ca->ci_in);
 }
 
@@ -2167,9 +3056,20 @@ void call_cmd_thread(struct task *task, struct cmd_args *ca)
 		strcpy(client[ca->ci_in].owner_name, "rem_lockspace");
 		cmd_rem_lockspace(ca);
 		break;
+	case SM_CMD_ADD_LOCKSPACES:
+		strcpy(client[ca->ci_in].owner_name, "add_lockspaces");
+		cmd_add_lockspaces(ca);
+		break;
+	case SM_CMD_REM_LOCKSPACES:
+		strcpy(client[ca->ci_in].owner_name, "rem_lockspaces");
+		cmd_rem_lockspaces(ca);
+		break;
 	case SM_CMD_ALIGN:
 		cmd_align(task, ca);
 		break;
+	case SM_CMD_NEXT_FREE:
+		cmd_next_free(task, ca);
+		break;
 	case SM_CMD_WRITE_LOCKSPACE:
 		cmd_write_lockspace(task, ca);
 		break;
@@ -2222,7 +3122,16 @@ void call_cmd_thread(struct task *task, struct cmd_args *ca)
 	case SM_CMD_DELETE_RESOURCE:
 		rindex_op(task, ca, "cmd_delete_resource", RX_OP_DELETE);
 		break;
+	case SM_CMD_CREATE_RESOURCES:
+		rindex_batch_op(task, ca, "cmd_create_resources", RX_OP_CREATE);
+		break;
+	case SM_CMD_DELETE_RESOURCES:
+		rindex_batch_op(task, ca, "cmd_delete_resources", RX_OP_DELETE);
+		break;
 	};
+
+	if (ca->pipeline)
+		pipeline_reply(ca);
 }
 
 /*
@@ -2247,6 +3156,23 @@ void call_cmd_thread(struct task *task, struct cmd_args *ca)
 
 static int print_state_daemon(char *str)
 {
+	struct iobuf_pool_stats st;
+	struct log_stats ls;
+	struct slab_stats tst, rst;
+	struct thread_wake_stats mw, rw, ww;
+	struct read_flight_stats fs;
+	uint64_t io_waits, io_wait_ms, io_wait_timeouts;
+
+	task_iobuf_stats(&st);
+	get_log_stats(&ls);
+	slab_get_stats(SLAB_TOKEN, &tst);
+	slab_get_stats(SLAB_RESOURCE, &rst);
+	get_io_sched_stats(&io_waits, &io_wait_ms, &io_wait_timeouts);
+	thread_class_wake_stats(THREAD_CLASS_MAIN, &mw);
+	thread_class_wake_stats(THREAD_CLASS_RENEWAL, &rw);
+	thread_class_wake_stats(THREAD_CLASS_WORKER, &ww);
+	read_flight_get_stats(&fs);
+
 	memset(str, 0, SANLK_STATE_MAXSTR);
 
 	snprintf(str, SANLK_STATE_MAXSTR-1,
@@ -2264,6 +3190,48 @@ static int print_state_daemon(char *str)
 		 "max_sectors_kb_align=%d "
 		 "max_sectors_kb_num=%d "
 		 "use_aio=%d "
+		 "iobuf_pool_bufs=%d "
+		 "iobuf_pool_bytes=%llu "
+		 "iobuf_pool_gets=%llu "
+		 "iobuf_pool_allocs=%llu "
+		 "iobuf_pool_unpooled=%llu "
+		 "iobuf_pool_aio_held=%d "
+		 "slab_token_allocs=%llu "
+		 "slab_token_used=%llu "
+		 "slab_token_objs=%llu "
+		 "slab_token_chunks=%llu "
+		 "slab_token_cache_hits=%llu "
+		 "slab_resource_allocs=%llu "
+		 "slab_resource_used=%llu "
+		 "slab_resource_objs=%llu "
+		 "slab_resource_chunks=%llu "
+		 "slab_resource_cache_hits=%llu "
+		 "log_ring_entries=%d "
+		 "log_dropped=%llu "
+		 "log_writes=%llu "
+		 "log_write_entries=%llu "
+		 "log_backlog_max=%u "
+		 "io_worker_max=%d "
+		 "io_sched_waits=%llu "
+		 "io_sched_wait_ms=%llu "
+		 "io_sched_wait_timeouts=%llu "
+		 "main_wakes=%llu "
+		 "main_wake_late_avg_us=%llu "
+		 "main_wake_late_max_us=%llu "
+		 "renewal_wakes=%llu "
+		 "renewal_wake_late_avg_us=%llu "
+		 "renewal_wake_late_max_us=%llu "
+		 "worker_wakes=%llu "
+		 "worker_wake_late_avg_us=%llu "
+		 "worker_wake_late_max_us=%llu "
+		 "read_coalesce=%d "
+		 "read_cache_ms=%d "
+		 "pipeline_queue_max=%d "
+		 "release_verify=%d "
+		 "paxos_fast_ballot=%d "
+		 "read_flight_reads=%llu "
+		 "read_flight_shared=%llu "
+		 "read_flight_cached=%llu "
 		 "kill_grace_seconds=%d "
 		 "helper_pid=%d "
 		 "helper_kill_fd=%d "
@@ -2288,6 +3256,48 @@ static int print_state_daemon(char *str)
 		 com.max_sectors_kb_align,
 		 com.max_sectors_kb_num,
 		 main_task.use_aio,
+		 st.bufs,
+		 (unsigned long long)st.bytes,
+		 (unsigned long long)st.gets,
+		 (unsigned long long)st.allocs,
+		 (unsigned long long)st.unpooled,
+		 st.aio_held,
+		 (unsigned long long)tst.allocs,
+		 (unsigned long long)(tst.allocs - tst.frees),
+		 (unsigned long long)tst.objs,
+		 (unsigned long long)tst.chunks,
+		 (unsigned long long)tst.cache_hits,
+		 (unsigned long long)rst.allocs,
+		 (unsigned long long)(rst.allocs - rst.frees),
+		 (unsigned long long)rst.objs,
+		 (unsigned long long)rst.chunks,
+		 (unsigned long long)rst.cache_hits,
+		 ls.ring_entries,
+		 (unsigned long long)ls.dropped,
+		 (unsigned long long)ls.writes,
+		 (unsigned long long)ls.write_entries,
+		 ls.backlog_max,
+		 com.io_worker_max,
+		 (unsigned long long)io_waits,
+		 (unsigned long long)io_wait_ms,
+		 (unsigned long long)io_wait_timeouts,
+		 (unsigned long long)mw.wakes,
+		 (unsigned long long)(mw.wakes ? mw.late_us / mw.wakes : 0),
+		 (unsigned long long)mw.late_max_us,
+		 (unsigned long long)rw.wakes,
+		 (unsigned long long)(rw.wakes ? rw.late_us / rw.wakes : 0),
+		 (unsigned long long)rw.late_max_us,
+		 (unsigned long long)ww.wakes,
+		 (unsigned long long)(ww.wakes ? ww.late_us / ww.wakes : 0),
+		 (unsigned long long)ww.late_max_us,
+		 com.read_coalesce,
+		 com.read_cache_ms,
+		 com.pipeline_queue_max,
+		 com.release_verify,
+		 com.paxos_fast_ballot,
+		 (unsigned long long)fs.reads,
+		 (unsigned long long)fs.shared,
+		 (unsigned long long)fs.cached,
 		 kill_grace_seconds,
 		 helper_pid,
 		 helper_kill_fd,
@@ -2339,6 +3349,10 @@ static int print_state_client(struct client *cl, int ci, char *str)
 
 static int print_state_lockspace(struct space *sp, char *str, const char *list_name)
 {
+	struct io_tune tune;
+
+	io_tune_get(sp->host_id_disk.fd, &tune);
+
 	memset(str, 0, SANLK_STATE_MAXSTR);
 
 	snprintf(str, SANLK_STATE_MAXSTR-1,
@@ -2355,13 +3369,24 @@ static int print_state_lockspace(struct space *sp, char *str, const char *list_n
 		 "external_used=%d "
 		 "used_by_orphans=%d "
 		 "renewal_read_extend_sec=%u "
+		 "renewal_sweep_interval=%u "
 		 "corrupt_result=%d "
 		 "acquire_last_result=%d "
 		 "renewal_last_result=%d "
 		 "acquire_last_attempt=%llu "
 		 "acquire_last_success=%llu "
 		 "renewal_last_attempt=%llu "
-		 "renewal_last_success=%llu",
+		 "renewal_last_success=%llu "
+		 "lease_paths=%d "
+		 "lease_path_best=%s "
+		 "host_id_read_split=%d "
+		 "host_id_read_us=%u,%u,%u "
+		 "dblock_read_split=%d "
+		 "dblock_read_us=%u,%u,%u "
+		 "rindex_op=%u "
+		 "rindex_rebuild_slots=%u "
+		 "rindex_rebuild_done=%u "
+		 "rindex_rebuild_found=%u",
 		 list_name,
 		 sp->space_id,
 		 sp->io_timeout,
@@ -2375,13 +3400,24 @@ static int print_state_lockspace(struct space *sp, char *str, const char *list_n
 		 (sp->flags & SP_EXTERNAL_USED) ? 1 : 0,
 		 (sp->flags & SP_USED_BY_ORPHANS) ? 1 : 0,
 		 sp->renewal_read_extend_sec,
+		 sp->renewal_sweep_interval,
 		 sp->lease_status.corrupt_result,
 		 sp->lease_status.acquire_last_result,
 		 sp->lease_status.renewal_last_result,
 		 (unsigned long long)sp->lease_status.acquire_last_attempt,
 		 (unsigned long long)sp->lease_status.acquire_last_success,
 		 (unsigned long long)sp->lease_status.renewal_last_attempt,
-		 (unsigned long long)sp->lease_status.renewal_last_success);
+		 (unsigned long long)sp->lease_status.renewal_last_success,
+		 sp->lease_paths ? sp->lease_paths->count : 0,
+		 sp->lease_paths ? lease_paths_best(sp->lease_paths) : "none",
+		 tune.host_id_split,
+		 tune.host_id_us[0], tune.host_id_us[1], tune.host_id_us[2],
+		 tune.dblock_split,
+		 tune.dblock_us[0], tune.dblock_us[1], tune.dblock_us[2],
+		 sp->rindex_op,
+		 sp->rindex_rebuild_slots,
+		 sp->rindex_rebuild_done,
+		 sp->rindex_rebuild_found);
 
 	return strlen(str) + 1;
 }
@@ -2399,7 +3435,12 @@ static int print_state_resource(struct resource *r, char *str, const char *list_
 		 "lver=%llu "
 		 "reused=%u "
 		 "res_id=%u "
-		 "token_id=%u",
+		 "token_id=%u "
+		 "ballots=%llu "
+		 "ballot_aborts=%llu "
+		 "ballot_us=%u "
+		 "backoffs=%llu "
+		 "backoff_us=%llu",
 		 list_name,
 		 r->flags,
 		 r->sector_size,
@@ -2407,12 +3448,17 @@ static int print_state_resource(struct resource *r, char *str, const char *list_
 		 (unsigned long long)r->leader.lver,
 		 r->reused,
 		 r->res_id,
-		 token_id);
+		 token_id,
+		 (unsigned long long)r->ballots,
+		 (unsigned long long)r->ballot_aborts,
+		 r->ballot_us,
+		 (unsigned long long)r->backoff_count,
+		 (unsigned long long)r->backoff_us);
 
 	return strlen(str) + 1;
 }
 
-static int print_state_host(struct host_status *hs, char *str)
+static int print_state_host(struct host_status *hs, char *owner_name, char *str)
 {
 	memset(str, 0, SANLK_STATE_MAXSTR);
 
@@ -2432,7 +3478,7 @@ static int print_state_host(struct host_status *hs, char *str)
 		 (unsigned long long)hs->owner_generation,
 		 (unsigned long long)hs->timestamp,
 		 hs->io_timeout,
-		 hs->owner_name);
+		 owner_name);
 
 	return strlen(str) + 1;
 }
@@ -2559,7 +3605,7 @@ void send_state_resource(int fd, struct resource *r, const char *list_name,
 	}
 }
 
-static void send_state_host(int fd, struct host_status *hs, int host_id)
+static void send_state_host(int fd, struct host_status *hs, char *owner_name, int host_id)
 {
 	struct sanlk_state st;
 	char str[SANLK_STATE_MAXSTR];
@@ -2571,7 +3617,7 @@ static void send_state_host(int fd, struct host_status *hs, int host_id)
 	st.data32 = host_id;
 	st.data64 = hs->timestamp;
 
-	str_len = print_state_host(hs, str);
+	str_len = print_state_host(hs, owner_name, str);
 
 	st.str_len = str_len;
 
@@ -2658,7 +3704,8 @@ static void cmd_host_status(int fd, struct sm_header *h_recv)
 	struct sanlk_lockspace lockspace;
 	struct space *sp;
 	struct host_status *hs, *status = NULL;
-	int status_len;
+	char (*names)[NAME_ID_SIZE] = NULL;
+	int max_hosts = 0;
 	int i, rv;
 
 	memset(&h, 0, sizeof(h));
@@ -2667,10 +3714,9 @@ static void cmd_host_status(int fd, struct sm_header *h_recv)
 	h.length = sizeof(h);
 	h.data = 0;
 
-	status_len = sizeof(struct host_status) * DEFAULT_MAX_HOSTS;
-
-	status = malloc(status_len);
-	if (!status) {
+	status = malloc(sizeof(struct host_status) * DEFAULT_MAX_HOSTS);
+	names = malloc(NAME_ID_SIZE * DEFAULT_MAX_HOSTS);
+	if (!status || !names) {
 		h.data = -ENOMEM;
 		goto fail;
 	}
@@ -2683,8 +3729,11 @@ static void cmd_host_status(int fd, struct sm_header *h_recv)
 
 	pthread_mutex_lock(&spaces_mutex);
 	sp = find_lockspace(lockspace.name);
-	if (sp)
-		memcpy(status, &sp->host_status, status_len);
+	if (sp && sp->host_status) {
+		max_hosts = sp->max_hosts;
+		memcpy(status, sp->host_status, sizeof(struct host_status) * max_hosts);
+		memcpy(names, sp->host_names, NAME_ID_SIZE * max_hosts);
+	}
 	pthread_mutex_unlock(&spaces_mutex);
 
 	if (!sp) {
@@ -2694,21 +3743,21 @@ static void cmd_host_status(int fd, struct sm_header *h_recv)
 
 	send(fd, &h, sizeof(h), MSG_NOSIGNAL);
 
-	for (i = 0; i < DEFAULT_MAX_HOSTS; i++) {
+	for (i = 0; i < max_hosts; i++) {
 		hs = &status[i];
 		if (!hs->last_live && !hs->owner_id)
 			continue;
-		send_state_host(fd, hs, i+1);
+		send_state_host(fd, hs, names[i], i+1);
 	}
 
-	if (status)
-		free(status);
+	free(status);
+	free(names);
 	return;
  fail:
 	send(fd, &h, sizeof(h), MSG_NOSIGNAL);
 
-	if (status)
-		free(status);
+	free(status);
+	free(names);
 }
 
 static void cmd_renewal(int fd, struct sm_header *h_recv)
@@ -2817,6 +3866,53 @@ static void cmd_log_dump(int fd, struct sm_header *h_recv)
 	send(fd, send_data_buf, len, MSG_NOSIGNAL);
 }
 
+static void cmd_trace(int fd, struct sm_header *h_recv)
+{
+	int len;
+
+	len = copy_trace(send_data_buf, LOG_DUMP_SIZE);
+
+	h_recv->version = SM_PROTO;
+	h_recv->data = len;
+
+	send(fd, h_recv, sizeof(struct sm_header), MSG_NOSIGNAL);
+	send(fd, send_data_buf, len, MSG_NOSIGNAL);
+}
+
+static void cmd_get_stats(int fd, struct sm_header *h_recv)
+{
+	int count, len, rv;
+
+	rv = copy_io_stats(send_data_buf, &len, &count, LOG_DUMP_SIZE);
+
+	h_recv->version = SM_PROTO;
+	h_recv->length = sizeof(struct sm_header) + len;
+	h_recv->data = rv;
+	h_recv->data2 = count;
+
+	send(fd, h_recv, sizeof(struct sm_header), MSG_NOSIGNAL);
+	send(fd, send_data_buf, len, MSG_NOSIGNAL);
+}
+
+/* a registered connection is tied to its pid and can't be pipelined */
+
+static void cmd_pipeline(int ci, int fd, struct sm_header *h_recv)
+{
+	struct client *cl = &client[ci];
+	int result = 0;
+
+	pthread_mutex_lock(&cl->mutex);
+	if (cl->pid != -1)
+		result = -EINVAL;
+	else
+		cl->pipeline = 1;
+	pthread_mutex_unlock(&cl->mutex);
+
+	log_debug("cmd_pipeline ci %d fd %d result %d", ci, fd, result);
+
+	send_result(fd, h_recv, result);
+}
+
 static void cmd_get_lockspaces(int fd, struct sm_header *h_recv)
 {
 	int count, len, rv;
@@ -2861,6 +3957,48 @@ out:
 		send(fd, send_data_buf, len, MSG_NOSIGNAL);
 }
 
+/* the body is the seq from get_hosts_changed followed by the hosts */
+
+static void cmd_get_hosts_changed(int fd, struct sm_header *h_recv)
+{
+	struct sm_header h;
+	struct sanlk_lockspace lockspace;
+	uint64_t since, seq = 0;
+	int count = 0, len = 0, rv;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(&h, h_recv, sizeof(struct sm_header));
+	h.version = SM_PROTO;
+	h.length = sizeof(h);
+	h.data = 0;
+
+	rv = recv(fd, &lockspace, sizeof(struct sanlk_lockspace), MSG_WAITALL);
+	if (rv != sizeof(struct sanlk_lockspace)) {
+		h.data = -ENOTCONN;
+		goto out;
+	}
+
+	rv = recv(fd, &since, sizeof(since), MSG_WAITALL);
+	if (rv != sizeof(since)) {
+		h.data = -ENOTCONN;
+		goto out;
+	}
+
+	rv = get_hosts_changed(&lockspace, since, &seq, send_data_buf + sizeof(seq),
+			       &len, &count, LOG_DUMP_SIZE - sizeof(seq));
+
+	memcpy(send_data_buf, &seq, sizeof(seq));
+	len += sizeof(seq);
+
+	h.length = sizeof(struct sm_header) + len;
+	h.data = rv;
+	h.data2 = count;
+out:
+	send(fd, &h, sizeof(struct sm_header), MSG_NOSIGNAL);
+	if (len)
+		send(fd, send_data_buf, len, MSG_NOSIGNAL);
+}
+
 static void cmd_restrict(int ci, int fd, struct sm_header *h_recv)
 {
 	log_debug("cmd_restrict ci %d fd %d pid %d flags %x",
@@ -2891,6 +4029,7 @@ static void cmd_reg_event(int fd, struct sm_header *h_recv)
 	struct sm_header h;
 	struct sanlk_lockspace lockspace;
 	struct sanlk_host_event he;
+	struct sanlk_event_filter ef;
 	int rv;
 
 	memcpy(&h, h_recv, sizeof(struct sm_header));
@@ -2910,7 +4049,16 @@ static void cmd_reg_event(int fd, struct sm_header *h_recv)
 		goto out;
 	}
 
-	rv = lockspace_reg_event(&lockspace, fd, h_recv->cmd_flags);
+	if (h_recv->cmd_flags & SANLK_REG_EVENT_FILTER) {
+		rv = recv(fd, &ef, sizeof(ef), MSG_WAITALL);
+		if (rv != sizeof(ef)) {
+			h.data = -ENOTCONN;
+			goto out;
+		}
+	}
+
+	rv = lockspace_reg_event(&lockspace, fd, h_recv->cmd_flags,
+				 (h_recv->cmd_flags & SANLK_REG_EVENT_FILTER) ? &ef : NULL);
 
 	h.data = rv;
 out:
@@ -2999,6 +4147,9 @@ void call_cmd_daemon(int ci, struct sm_header *h_recv, int client_maxi)
 			log_error("cmd_register ci %d fd %d tokens exist slots %d",
 				  ci, fd, client[ci].tokens_slots);
 			free(client[ci].tokens);
+			free(client[ci].tokens_hash);
+			client[ci].tokens_hash = NULL;
+			client[ci].tokens_hash_size = 0;
 		}
 		client[ci].tokens_slots = SANLK_MAX_RESOURCES;
 		client[ci].tokens = malloc(sizeof(struct token *) * SANLK_MAX_RESOURCES);
@@ -3008,6 +4159,7 @@ void call_cmd_daemon(int ci, struct sm_header *h_recv, int client_maxi)
 			break;
 		}
 		memset(client[ci].tokens, 0, sizeof(struct token *) * SANLK_MAX_RESOURCES);
+		client[ci].tokens_count = 0;
 		auto_close = 0;
 		break;
 	case SM_CMD_RESTRICT:
@@ -3050,6 +4202,19 @@ void call_cmd_daemon(int ci, struct sm_header *h_recv, int client_maxi)
 		strcpy(client[ci].owner_name, "log_dump");
 		cmd_log_dump(fd, h_recv);
 		break;
+	case SM_CMD_TRACE:
+		strcpy(client[ci].owner_name, "trace");
+		cmd_trace(fd, h_recv);
+		break;
+	case SM_CMD_GET_STATS:
+		strcpy(client[ci].owner_name, "get_stats");
+		cmd_get_stats(fd, h_recv);
+		break;
+	case SM_CMD_PIPELINE:
+		strcpy(client[ci].owner_name, "pipeline");
+		cmd_pipeline(ci, fd, h_recv);
+		auto_close = 0;
+		break;
 	case SM_CMD_GET_LOCKSPACES:
 		strcpy(client[ci].owner_name, "get_lockspaces");
 		cmd_get_lockspaces(fd, h_recv);
@@ -3058,6 +4223,10 @@ void call_cmd_daemon(int ci, struct sm_header *h_recv, int client_maxi)
 		strcpy(client[ci].owner_name, "get_hosts");
 		cmd_get_hosts(fd, h_recv);
 		break;
+	case SM_CMD_GET_HOSTS_CHANGED:
+		strcpy(client[ci].owner_name, "get_hosts_changed");
+		cmd_get_hosts_changed(fd, h_recv);
+		break;
 	case SM_CMD_REG_EVENT:
 		strcpy(client[ci].owner_name, "reg_event");
 		cmd_reg_event(fd, h_recv);
@@ -10,12 +10,27 @@
 #define __CMD_H__
 
 struct cmd_args {
-	struct list_head list; /* thread_pool data */
 	int ci_in;
 	int ci_target;
 	int cl_fd;
 	int cl_pid;
 	struct sm_header header;
+
+	/*
+	 * On a pipelined connection, main_loop has read the request data
+	 * into body, and the reply is collected in reply to be sent whole
+	 * when the cmd is done, so replies to cmds running concurrently on
+	 * the connection don't interleave.
+	 */
+	int pipeline;
+	char *body;
+	int body_len;
+	int body_pos;
+	char *reply;
+	int reply_len;
+	int reply_size;
+
+	uint64_t queued;	/* trace_begin() when given to a worker */
 };
 
 /* cmds processed by thread pool */
@@ -26,4 +41,7 @@ void call_cmd_daemon(int ci, struct sm_header *h_recv, int client_maxi);
 
 void daemon_shutdown_reply(void);
 
+/* remove tokens from sp->client_tokens before they are freed */
+void unlink_client_tokens(struct token *tokens[], int count);
+
 #endif
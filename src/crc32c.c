@@ -9,6 +9,19 @@
  */
 #include <unistd.h>
 #include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "crc32c.h"
 
 /*
  * This is the CRC-32C table
@@ -91,12 +104,190 @@ static const uint32_t crc32c_table[256] = {
  * crc using table.
  */
 
-uint32_t crc32c(uint32_t crc, uint8_t *data, size_t length);
-
-uint32_t crc32c(uint32_t crc, uint8_t *data, size_t length)
+static uint32_t crc32c_bytes(uint32_t crc, uint8_t *data, size_t length)
 {
 	while (length--)
 		crc = crc32c_table[(crc ^ *data++) & 0xFFL] ^ (crc >> 8);
 
 	return crc;
 }
+
+/*
+ * Slicing-by-8: eight tables, generated from crc32c_table at startup,
+ * give the crc of a byte followed by 0-7 zero bytes, so eight bytes are
+ * done with one 64 bit load and eight lookups.  The load is little
+ * endian, other machines use the byte table.
+ */
+
+static uint32_t crc32c_slice_table[8][256];
+
+static void crc32c_slice_init(void)
+{
+	uint32_t crc;
+	int i, k;
+
+	for (i = 0; i < 256; i++) {
+		crc = crc32c_table[i];
+		crc32c_slice_table[0][i] = crc;
+		for (k = 1; k < 8; k++) {
+			crc = crc32c_table[crc & 0xFF] ^ (crc >> 8);
+			crc32c_slice_table[k][i] = crc;
+		}
+	}
+}
+
+static uint32_t crc32c_slice8(uint32_t crc, uint8_t *data, size_t length)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint32_t (*t)[256] = crc32c_slice_table;
+	uint64_t v;
+
+	while (length >= 8) {
+		memcpy(&v, data, 8);
+		v ^= crc;
+		crc = t[7][v & 0xFF] ^
+		      t[6][(v >> 8) & 0xFF] ^
+		      t[5][(v >> 16) & 0xFF] ^
+		      t[4][(v >> 24) & 0xFF] ^
+		      t[3][(v >> 32) & 0xFF] ^
+		      t[2][(v >> 40) & 0xFF] ^
+		      t[1][(v >> 48) & 0xFF] ^
+		      t[0][v >> 56];
+		data += 8;
+		length -= 8;
+	}
+#endif
+	return crc32c_bytes(crc, data, length);
+}
+
+/*
+ * The SSE4.2 and ARMv8 crc32c instructions do the same reflected
+ * update as the table, with no inversion of their own, so they give
+ * bit-identical results.
+ */
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, uint8_t *data, size_t length)
+{
+	uint64_t crc64 = crc;
+	uint64_t v;
+
+	while (length && ((uintptr_t)data & 7)) {
+		crc64 = _mm_crc32_u8((uint32_t)crc64, *data++);
+		length--;
+	}
+
+	while (length >= 8) {
+		memcpy(&v, data, 8);
+		crc64 = _mm_crc32_u64(crc64, v);
+		data += 8;
+		length -= 8;
+	}
+
+	crc = (uint32_t)crc64;
+
+	while (length--)
+		crc = _mm_crc32_u8(crc, *data++);
+
+	return crc;
+}
+
+static int crc32c_sse42_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.2");
+}
+#endif
+
+#if defined(__aarch64__)
+__attribute__((target("+crc")))
+static uint32_t crc32c_armv8(uint32_t crc, uint8_t *data, size_t length)
+{
+	uint64_t v;
+
+	while (length && ((uintptr_t)data & 7)) {
+		crc = __crc32cb(crc, *data++);
+		length--;
+	}
+
+	while (length >= 8) {
+		memcpy(&v, data, 8);
+		crc = __crc32cd(crc, v);
+		data += 8;
+		length -= 8;
+	}
+
+	while (length--)
+		crc = __crc32cb(crc, *data++);
+
+	return crc;
+}
+
+static int crc32c_armv8_supported(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) ? 1 : 0;
+}
+#endif
+
+static struct crc32c_impl crc32c_impls[] = {
+#if defined(__x86_64__)
+	{ "sse4.2", crc32c_sse42, 0 },
+#endif
+#if defined(__aarch64__)
+	{ "armv8", crc32c_armv8, 0 },
+#endif
+	{ "slice8", crc32c_slice8, 1 },
+	{ "table", crc32c_bytes, 1 },
+};
+
+#define CRC32C_IMPLS (int)(sizeof(crc32c_impls) / sizeof(crc32c_impls[0]))
+
+static struct crc32c_impl *crc32c_impl = &crc32c_impls[CRC32C_IMPLS - 1];
+
+/*
+ * Pick the first supported implementation when the daemon or library is
+ * loaded, before any thread can compute a checksum.
+ */
+
+__attribute__((constructor))
+static void crc32c_init(void)
+{
+	int i;
+
+	crc32c_slice_init();
+
+	for (i = 0; i < CRC32C_IMPLS; i++) {
+#if defined(__x86_64__)
+		if (crc32c_impls[i].fn == crc32c_sse42)
+			crc32c_impls[i].supported = crc32c_sse42_supported();
+#endif
+#if defined(__aarch64__)
+		if (crc32c_impls[i].fn == crc32c_armv8)
+			crc32c_impls[i].supported = crc32c_armv8_supported();
+#endif
+	}
+
+	for (i = 0; i < CRC32C_IMPLS; i++) {
+		if (crc32c_impls[i].supported) {
+			crc32c_impl = &crc32c_impls[i];
+			break;
+		}
+	}
+}
+
+const char *crc32c_name(void)
+{
+	return crc32c_impl->name;
+}
+
+int crc32c_get_impls(struct crc32c_impl **impls)
+{
+	*impls = crc32c_impls;
+	return CRC32C_IMPLS;
+}
+
+uint32_t crc32c(uint32_t crc, uint8_t *data, size_t length)
+{
+	return crc32c_impl->fn(crc, data, length);
+}
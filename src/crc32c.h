@@ -0,0 +1,33 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#ifndef __CRC32C_H__
+#define __CRC32C_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* the fastest implementation this cpu supports */
+uint32_t crc32c(uint32_t crc, uint8_t *data, size_t length);
+
+const char *crc32c_name(void);
+
+/*
+ * All the compiled implementations, fastest first, ending with the byte
+ * table that the others must match (see tests/crc32c_bench).
+ */
+
+struct crc32c_impl {
+	const char *name;
+	uint32_t (*fn)(uint32_t crc, uint8_t *data, size_t length);
+	int supported;
+};
+
+int crc32c_get_impls(struct crc32c_impl **impls);
+
+#endif
@@ -23,6 +23,7 @@
 #include <sys/time.h>
 
 #include "sanlock_internal.h"
+#include "sanlock_admin.h"
 #include "sanlock.h"
 #include "diskio.h"
 #include "ondisk.h"
@@ -31,6 +32,8 @@
 #include "paxos_lease.h"
 #include "delta_lease.h"
 #include "timeouts.h"
+#include "task.h"
+#include "iostats.h"
 
 /* Based on "Light-Weight Leases for Storage-Centric Coordination"
    by Gregory Chockler and Dahlia Malkhi */
@@ -131,6 +134,7 @@ static int verify_leader(struct sync_disk *disk,
 
 	memset(&leader_end, 0, sizeof(leader_end));
 
+	set_io_op(task, SANLK_IO_DELTA_READ);
 	rv = read_sectors(disk, lr->sector_size, host_id - 1, 1, (char *)&leader_end,
 			  sizeof(struct leader_record),
 			  NULL, "delta_verify");
@@ -171,6 +175,7 @@ int delta_read_lockspace(struct task *task,
 	 * or not the sector_size_hint is wrong or not.
 	 */
 
+	set_io_op(task, SANLK_IO_DELTA_READ);
 	rv = read_sectors(disk, sector_size_hint, host_id - 1, 1, (char *)&leader_end, sizeof(struct leader_record),
 			  task, io_timeout, "read_lockspace");
 	if (rv < 0)
@@ -226,6 +231,7 @@ int delta_read_lockspace_sizes(struct task *task,
 	 * record to get to the sector size.
 	 */
 
+	set_io_op(task, SANLK_IO_DELTA_READ);
 	rv = read_sectors(disk, 4096, 0, 1, (char *)&leader_end, sizeof(struct leader_record),
 			  task, io_timeout, "read_lockspace_sector_size");
 	if (rv < 0)
@@ -270,6 +276,7 @@ int delta_lease_leader_read(struct task *task, int sector_size, int io_timeout,
 	memset(&leader_end, 0, sizeof(struct leader_record));
 	memset(leader_ret, 0, sizeof(struct leader_record));
 
+	set_io_op(task, SANLK_IO_DELTA_READ);
 	rv = read_sectors(disk, sector_size, host_id - 1, 1, (char *)&leader_end, sizeof(struct leader_record),
 			  task, io_timeout, "delta_leader");
 	if (rv < 0)
@@ -303,6 +310,7 @@ int delta_lease_leader_clobber(struct task *task, int io_timeout,
 
 	leader_record_out(leader, &leader_end);
 
+	set_io_op(task, SANLK_IO_DELTA_WRITE);
 	rv = write_sector(disk, leader->sector_size, host_id - 1, (char *)&leader_end, sizeof(struct leader_record),
 			  task, io_timeout, caller);
 	if (rv < 0)
@@ -466,6 +474,7 @@ int delta_lease_acquire(struct task *task,
 	leader.checksum = checksum;
 	leader_end.checksum = cpu_to_le32(checksum);
 
+	set_io_op(task, SANLK_IO_DELTA_WRITE);
 	rv = write_sector(disk, sp->sector_size, host_id - 1, (char *)&leader_end, sizeof(struct leader_record),
 			  task, sp->io_timeout, "delta_leader");
 	if (rv < 0) {
@@ -513,6 +522,119 @@ int delta_lease_acquire(struct task *task,
 	return SANLK_OK;
 }
 
+/*
+ * Sparse renewal reads (renewal_sweep_interval > 1)
+ *
+ * Between full reads of the host_id area, a renewal reads only the
+ * leases that were in use (not free) in the previous read, plus our
+ * own, coalesced into at most RENEWAL_READ_RANGES ranges.  The free
+ * leases keep their content from the last read in task->iobuf.  Every
+ * renewal_sweep_interval renewals, and after any failed renewal, the
+ * full area is read again, which is how hosts joining in a free host_id
+ * are found.  Until then a newly joined host is reported as unchecked
+ * by host_info().
+ */
+
+#define RENEWAL_READ_GAP 8 /* free leases read through to join ranges */
+
+static int plan_ranges(struct space *sp, char *iobuf, int gap, struct renewal_read *rr)
+{
+	struct leader_record *leader_end;
+	int i, n = 0, last = 0;
+
+	memset(rr, 0, sizeof(struct renewal_read));
+
+	for (i = 0; i < sp->max_hosts; i++) {
+		leader_end = (struct leader_record *)(iobuf + (i * sp->sector_size));
+
+		if ((i + 1 != sp->host_id) &&
+		    (le64_to_cpu(leader_end->timestamp) == LEASE_FREE))
+			continue;
+
+		if (n && (i - last - 1 <= gap)) {
+			rr->count[n-1] = i - rr->start[n-1] + 1;
+		} else {
+			if (n == RENEWAL_READ_RANGES)
+				return -1;
+			rr->start[n] = i;
+			rr->count[n] = 1;
+			n++;
+		}
+		last = i;
+	}
+
+	rr->num_ranges = n;
+	return n;
+}
+
+static void plan_renewal_read(struct space *sp, char *iobuf, struct renewal_read *rr)
+{
+	int gap, total = 0, i;
+
+	/* a large enough gap joins everything into one range */
+	for (gap = RENEWAL_READ_GAP; plan_ranges(sp, iobuf, gap, rr) < 0; gap *= 2)
+		;
+
+	for (i = 0; i < rr->num_ranges; i++)
+		total += rr->count[i];
+
+	/* not worth it */
+	if (total * 2 > sp->max_hosts)
+		rr->num_ranges = 0;
+}
+
+/*
+ * Each range is read into a buffer of its own which is copied into iobuf,
+ * so a timed out range read does not leave iobuf owned by the aio.
+ */
+
+static int read_renewal_ranges(struct task *task, struct space *sp,
+			       struct sync_disk *disk, char *iobuf,
+			       struct renewal_read *rr, int *rd_ms)
+{
+	struct iobuf_io ios[RENEWAL_READ_RANGES];
+	struct timespec begin, end, diff;
+	int sector_size = sp->sector_size;
+	int num = rr->num_ranges;
+	int i, rv = 0;
+
+	for (i = 0; i < num; i++) {
+		ios[i].fd = disk->fd;
+		ios[i].offset = disk->offset + ((uint64_t)rr->start[i] * sector_size);
+		ios[i].iobuf_len = rr->count[i] * sector_size;
+		ios[i].rv = 0;
+
+		if (task_iobuf_alloc(task, ios[i].iobuf_len, &ios[i].iobuf)) {
+			log_erros(sp, "delta_renew range iobuf alloc");
+			num = i;
+			rv = -ENOMEM;
+			goto out;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+
+	set_io_op(task, SANLK_IO_DELTA_READ);
+	read_iobufs(ios, num, num, task, sp->io_timeout);
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+	ts_diff(&begin, &end, &diff);
+	*rd_ms = (diff.tv_sec * 1000) + (diff.tv_nsec / 1000000);
+
+	for (i = 0; i < num; i++) {
+		if (!ios[i].rv)
+			memcpy(iobuf + (rr->start[i] * sector_size), ios[i].iobuf, ios[i].iobuf_len);
+		else if (!rv || ios[i].rv == SANLK_AIO_TIMEOUT)
+			rv = ios[i].rv;
+	}
+ out:
+	for (i = 0; i < num; i++) {
+		if (ios[i].rv != SANLK_AIO_TIMEOUT)
+			task_iobuf_free(task, ios[i].iobuf);
+	}
+	return rv;
+}
+
 int delta_lease_renew(struct task *task,
 		      struct space *sp,
 		      struct sync_disk *disk,
@@ -535,7 +657,7 @@ int delta_lease_renew(struct task *task,
 	uint32_t checksum;
 	uint32_t reap_timeout_msec;
 	uint64_t host_id, id_offset, new_ts, now;
-	int rv, iobuf_len, sector_size;
+	int rv, iobuf_len, sector_size, sparse;
 
 	if (!leader_last) {
 		log_erros(sp, "delta_renew no leader_last");
@@ -561,11 +683,26 @@ int delta_lease_renew(struct task *task,
 		return -EINVAL;
 	}
 
+	/* read only the leases in use, unless it's time for a full read, or
+	   the previous renewal failed */
+
+	sparse = (sp->renewal_sweep_interval > 1) &&
+		 (sp->renewal_sweep_count < sp->renewal_sweep_interval) &&
+		 (prev_result == SANLK_OK);
+
 	/* if the previous renew timed out in this initial read, and that read
 	   is now complete, we can use that result here instead of discarding
 	   it and doing another. */
 
-	if (prev_result == SANLK_AIO_TIMEOUT) {
+	if (prev_result == SANLK_AIO_TIMEOUT &&
+	    (sp->renewal_read_plan.num_ranges || sp->lease_paths ||
+	     sp->host_id_read_split > 1)) {
+		/* a timed out range, path or split read used its own
+		   buffer, which is freed when the read completes, task->iobuf
+		   is not involved */
+		task->read_iobuf_timeout_aicb = NULL;
+
+	} else if (prev_result == SANLK_AIO_TIMEOUT) {
 		if (!task->read_iobuf_timeout_aicb) {
 			/* shouldn't happen, when do_linux_aio returned AIO_TIMEOUT
 			   it should have set read_iobuf_timeout_aicb */
@@ -647,12 +784,36 @@ int delta_lease_renew(struct task *task,
 			log_erros(sp, "dela_renew memalign rv %d", rv);
 			rv = -ENOMEM;
 		}
+
+		/* nothing to plan a sparse read from */
+		sparse = 0;
 	}
 
-	if (log_renewal_level != -1)
-		log_level(sp->space_id, 0, NULL, log_renewal_level, "delta_renew begin read");
+	if (sparse)
+		plan_renewal_read(sp, task->iobuf, &sp->renewal_read_plan);
+	else
+		memset(&sp->renewal_read_plan, 0, sizeof(struct renewal_read));
+
+	if (!sp->renewal_read_plan.num_ranges)
+		sp->renewal_sweep_count = 0;
+	sp->renewal_sweep_count++;
 
-	rv = read_iobuf(disk->fd, disk->offset, task->iobuf, iobuf_len, task, sp->io_timeout, rd_ms);
+	if (log_renewal_level != -1)
+		log_level(sp->space_id, 0, NULL, log_renewal_level, "delta_renew begin read%s",
+			  sp->renewal_read_plan.num_ranges ? " ranges" : "");
+
+	set_io_op(task, SANLK_IO_DELTA_READ);
+
+	if (sp->renewal_read_plan.num_ranges)
+		rv = read_renewal_ranges(task, sp, disk, task->iobuf, &sp->renewal_read_plan, rd_ms);
+	else if (sp->lease_paths)
+		rv = read_iobuf_paths(sp->lease_paths, disk->offset, task->iobuf, iobuf_len,
+				      task, sp->io_timeout, com.renewal_hedge_ms, rd_ms);
+	else if (sp->host_id_read_split > 1)
+		rv = read_iobuf_split(disk->fd, disk->offset, task->iobuf, iobuf_len,
+				      sp->host_id_read_split, task, sp->io_timeout, rd_ms);
+	else
+		rv = read_iobuf(disk->fd, disk->offset, task->iobuf, iobuf_len, task, sp->io_timeout, rd_ms);
 	if (rv) {
 		/* the next time delta_lease_renew() is called, prev_result
 		   will be this rv.  If this rv is SANLK_AIO_TIMEOUT, we'll
@@ -729,9 +890,9 @@ int delta_lease_renew(struct task *task,
 	}
 
 	p_wbuf = &wbuf;
-	rv = posix_memalign((void *)p_wbuf, getpagesize(), sector_size);
+	rv = task_iobuf_alloc(task, sector_size, p_wbuf);
 	if (rv) {
-		log_erros(sp, "dela_renew write memalign rv %d", rv);
+		log_erros(sp, "dela_renew write iobuf alloc rv %d", rv);
 		return -ENOMEM;
 	}
 	memset(wbuf, 0, sector_size);
@@ -753,11 +914,16 @@ int delta_lease_renew(struct task *task,
 	   out.  there's nothing we would do but retry it, and timing out and
 	   retrying unnecessarily would probably be counter productive. */
 
-	rv = write_iobuf(disk->fd, disk->offset+id_offset, wbuf, sector_size, task,
-			 calc_host_dead_seconds(sp->io_timeout), wr_ms);
+	set_io_op(task, SANLK_IO_DELTA_WRITE);
+	if (sp->lease_paths)
+		rv = write_iobuf_paths(sp->lease_paths, disk->offset+id_offset, wbuf, sector_size,
+				       task, calc_host_dead_seconds(sp->io_timeout), wr_ms);
+	else
+		rv = write_iobuf(disk->fd, disk->offset+id_offset, wbuf, sector_size, task,
+				 calc_host_dead_seconds(sp->io_timeout), wr_ms);
 
 	if (rv != SANLK_AIO_TIMEOUT)
-		free(wbuf);
+		task_iobuf_free(task, wbuf);
 
 	now = monotime();
 
@@ -812,6 +978,7 @@ int delta_lease_release(struct task *task,
 	leader.checksum = checksum;
 	leader_end.checksum = cpu_to_le32(checksum);
 
+	set_io_op(task, SANLK_IO_DELTA_WRITE);
 	rv = write_sector(disk, sp->sector_size, host_id - 1, (char *)&leader_end, sizeof(struct leader_record),
 			  task, sp->io_timeout, "delta_leader");
 	if (rv < 0) {
@@ -865,7 +1032,7 @@ int delta_lease_init(struct task *task,
 
 	p_iobuf = &iobuf;
 
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
+	rv = task_iobuf_alloc(task, iobuf_len, p_iobuf);
 	if (rv)
 		return rv;
 
@@ -927,7 +1094,7 @@ int delta_lease_init(struct task *task,
 	rv = write_iobuf(disk->fd, disk->offset, iobuf, sector_size, task, io_timeout, NULL);
  out:
 	if (rv != SANLK_AIO_TIMEOUT)
-		free(iobuf);
+		task_iobuf_free(task, iobuf);
 
 	return rv;
 }
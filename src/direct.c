@@ -33,9 +33,11 @@
 #include "delta_lease.h"
 #include "timeouts.h"
 #include "rindex.h"
+#include "task.h"
+#include "freemap.h"
 
-static int direct_read_leader_sizes(struct task *task, struct sync_disk *sd,
-				    int *sector_size, int *align_size)
+int direct_read_leader_sizes(struct task *task, struct sync_disk *sd,
+			     int *sector_size, int *align_size)
 {
 	struct leader_record *lr_end;
 	struct leader_record lr_in;
@@ -546,35 +548,432 @@ int direct_write_leader(struct task *task,
 
 int test_id_bit(int host_id, char *bitmap);
 
-int direct_dump(struct task *task, char *dump_path, int force_mode)
+/*
+ * direct dump reads the disk in chunks of align_size, each holding the
+ * delta leases of a lockspace, a paxos lease, or an rindex.  A number of
+ * threads (-t) each read and decode the next chunk, formatting its output
+ * into memory, and the main thread prints the output of the chunks in
+ * disk order as they become ready.  Without a dump size, the dump ends at
+ * the first chunk that begins with no known magic number.
+ */
+
+struct dump_args {
+	struct sync_disk *sd;
+	int sector_size;
+	int sector_count;
+	int max_hosts;
+	int force_mode;
+	int json;
+	uint64_t changed_since;
+};
+
+struct dump_slot {
+	uint64_t chunk;
+	int done;
+	int known;
+	char *text;
+	size_t len;
+};
+
+struct dump_state {
+	struct dump_args *da;
+	int use_aio;
+	int window;
+	int stop_unknown;		/* no dump size, stop at unknown magic */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	uint64_t next_chunk;		/* next to read */
+	uint64_t print_chunk;		/* next to print */
+	uint64_t stop_chunk;		/* first not to print */
+	struct dump_slot *slots;	/* window of chunks from print_chunk */
+};
+
+static void dump_json_str(FILE *out, const char *key, const char *str)
+{
+	int i;
+
+	fprintf(out, ",\"%s\":\"", key);
+
+	for (i = 0; i < NAME_ID_SIZE && str[i]; i++) {
+		if (str[i] == '"' || str[i] == '\\')
+			fprintf(out, "\\%c", str[i]);
+		else if ((unsigned char)str[i] < 0x20 || (unsigned char)str[i] > 0x7e)
+			fprintf(out, "\\u%04x", (unsigned char)str[i]);
+		else
+			fputc(str[i], out);
+	}
+
+	fputc('"', out);
+}
+
+static void dump_delta(struct dump_args *da, FILE *out, char *data, uint64_t sector_nr)
 {
-	char *data, *bitmap;
-	char *colon, *off_str;
-	uint32_t magic;
-	struct rindex_header *rh_end;
-	struct rindex_header *rh;
-	struct rindex_header rh_in;
-	struct rindex_entry *re_end;
-	struct rindex_entry *re;
-	struct rindex_entry re_in;
 	struct leader_record *lr_end;
+	struct leader_record lr_in;
 	struct leader_record *lr;
+	char sname[NAME_ID_SIZE+1];
+	char rname[NAME_ID_SIZE+1];
+	char *bitmap;
+	int i, b, count;
+
+	for (i = 0; i < da->sector_count; i++) {
+		lr_end = (struct leader_record *)(data + (i * da->sector_size));
+
+		if (!lr_end->magic)
+			continue;
+
+		leader_record_in(lr_end, &lr_in);
+		lr = &lr_in;
+
+		/* has never been acquired, don't print */
+		if (!lr->owner_id && !lr->owner_generation)
+			continue;
+
+		if (lr->timestamp < da->changed_since)
+			continue;
+
+		memset(sname, 0, sizeof(sname));
+		memset(rname, 0, sizeof(rname));
+		strncpy(sname, lr->space_name, NAME_ID_SIZE);
+		strncpy(rname, lr->resource_name, NAME_ID_SIZE);
+
+		bitmap = (char *)lr_end + LEADER_RECORD_MAX;
+
+		if (da->json) {
+			fprintf(out, "{\"offset\":%llu,\"type\":\"delta\"",
+				(unsigned long long)((sector_nr + i) * da->sector_size));
+			dump_json_str(out, "lockspace", sname);
+			dump_json_str(out, "resource", rname);
+			fprintf(out, ",\"timestamp\":%llu,\"owner_id\":%llu,\"owner_generation\":%llu",
+				(unsigned long long)lr->timestamp,
+				(unsigned long long)lr->owner_id,
+				(unsigned long long)lr->owner_generation);
+
+			if (da->force_mode) {
+				fprintf(out, ",\"bitmap\":[");
+				for (b = 0, count = 0; b < da->max_hosts; b++) {
+					if (test_id_bit(b+1, bitmap))
+						fprintf(out, "%s%d", count++ ? "," : "", b+1);
+				}
+				fprintf(out, "]");
+			}
+			fprintf(out, "}\n");
+			continue;
+		}
+
+		fprintf(out, "%08llu %36s %48s %010llu %04llu %04llu",
+			(unsigned long long)((sector_nr + i) * da->sector_size),
+			sname, rname,
+			(unsigned long long)lr->timestamp,
+			(unsigned long long)lr->owner_id,
+			(unsigned long long)lr->owner_generation);
+
+		if (da->force_mode) {
+			for (b = 0; b < da->max_hosts; b++) {
+				if (test_id_bit(b+1, bitmap))
+					fprintf(out, " %d", b+1);
+			}
+		}
+		fprintf(out, "\n");
+	}
+}
+
+static void dump_paxos(struct dump_args *da, FILE *out, char *data, uint64_t sector_nr)
+{
+	struct leader_record *lr_end;
 	struct leader_record lr_in;
+	struct leader_record *lr;
 	struct request_record rr;
-	struct mode_block mb;
-	struct sync_disk sd;
 	struct paxos_dblock dblock;
+	struct mode_block mb;
 	char sname[NAME_ID_SIZE+1];
 	char rname[NAME_ID_SIZE+1];
-	uint64_t sector_nr;
+	uint64_t offset = sector_nr * da->sector_size;
+	int i;
+
+	lr_end = (struct leader_record *)data;
+	leader_record_in(lr_end, &lr_in);
+	lr = &lr_in;
+
+	if (lr->timestamp < da->changed_since)
+		return;
+
+	memset(sname, 0, sizeof(sname));
+	memset(rname, 0, sizeof(rname));
+	strncpy(sname, lr->space_name, NAME_ID_SIZE);
+	strncpy(rname, lr->resource_name, NAME_ID_SIZE);
+
+	if (da->force_mode) {
+		struct request_record *rr_end = (struct request_record *)(data + da->sd->sector_size);
+		request_record_in(rr_end, &rr);
+	}
+
+	if (da->json) {
+		fprintf(out, "{\"offset\":%llu,\"type\":\"paxos\"", (unsigned long long)offset);
+		dump_json_str(out, "lockspace", sname);
+		dump_json_str(out, "resource", rname);
+		fprintf(out, ",\"timestamp\":%llu,\"owner_id\":%llu,\"owner_generation\":%llu,\"lver\":%llu",
+			(unsigned long long)lr->timestamp,
+			(unsigned long long)lr->owner_id,
+			(unsigned long long)lr->owner_generation,
+			(unsigned long long)lr->lver);
+		if (da->force_mode)
+			fprintf(out, ",\"request_lver\":%llu,\"force_mode\":%u",
+				(unsigned long long)rr.lver, rr.force_mode);
+		fprintf(out, "}\n");
+	} else {
+		fprintf(out, "%08llu %36s %48s %010llu %04llu %04llu %llu",
+			(unsigned long long)offset,
+			sname, rname,
+			(unsigned long long)lr->timestamp,
+			(unsigned long long)lr->owner_id,
+			(unsigned long long)lr->owner_generation,
+			(unsigned long long)lr->lver);
+		if (da->force_mode)
+			fprintf(out, "/%llu/%u", (unsigned long long)rr.lver, rr.force_mode);
+		fprintf(out, "\n");
+	}
+
+	for (i = 0; i < lr->num_hosts; i++) {
+		char *pd_end = data + ((2 + i) * da->sector_size);
+		struct mode_block *mb_end = (struct mode_block *)(pd_end + MBLOCK_OFFSET);
+
+		/* a corrupt num_hosts would go past the chunk */
+		if (2 + i >= da->sector_count)
+			break;
+
+		if (da->force_mode > 1) {
+			paxos_dblock_in((struct paxos_dblock *)pd_end, &dblock);
+
+			if (dblock.mbal || dblock.inp || dblock.lver) {
+				if (da->json)
+					fprintf(out, "{\"offset\":%llu,\"type\":\"dblock\",\"index\":%d,"
+						"\"mbal\":%llu,\"bal\":%llu,\"inp\":%llu,\"inp2\":%llu,"
+						"\"inp3\":%llu,\"lver\":%llu,\"checksum\":%u}\n",
+						(unsigned long long)offset, i,
+						(unsigned long long)dblock.mbal,
+						(unsigned long long)dblock.bal,
+						(unsigned long long)dblock.inp,
+						(unsigned long long)dblock.inp2,
+						(unsigned long long)dblock.inp3,
+						(unsigned long long)dblock.lver,
+						dblock.checksum);
+				else
+					fprintf(out, "dblock[%04d] mbal %llu bal %llu inp %llu inp2 %llu inp3 %llu lver %llu sum %x\n",
+						i,
+						(unsigned long long)dblock.mbal,
+						(unsigned long long)dblock.bal,
+						(unsigned long long)dblock.inp,
+						(unsigned long long)dblock.inp2,
+						(unsigned long long)dblock.inp3,
+						(unsigned long long)dblock.lver,
+						dblock.checksum);
+			}
+		}
+
+		mode_block_in(mb_end, &mb);
+
+		if (!(mb.flags & MBLOCK_SHARED))
+			continue;
+
+		if (da->json) {
+			fprintf(out, "{\"offset\":%llu,\"type\":\"shared\",\"host_id\":%d,\"generation\":%llu}\n",
+				(unsigned long long)offset, i+1,
+				(unsigned long long)mb.generation);
+			continue;
+		}
+
+		fprintf(out, "                                                                                                          ");
+		fprintf(out, "%04u %04llu SH\n", i+1, (unsigned long long)mb.generation);
+	}
+}
+
+static void dump_rindex(struct dump_args *da, FILE *out, char *data, uint64_t sector_nr)
+{
+	struct rindex_header *rh_end;
+	struct rindex_header rh_in;
+	struct rindex_header *rh;
+	struct rindex_entry *re_end;
+	struct rindex_entry re_in;
+	struct rindex_entry *re;
+	char sname[NAME_ID_SIZE+1];
+	int entry_size = sizeof(struct rindex_entry);
+	int entries_per_sector = da->sector_size / entry_size;
+	uint64_t offset;
+	int i, j;
+
+	rh_end = (struct rindex_header *)data;
+	rindex_header_in(rh_end, &rh_in);
+	rh = &rh_in;
+
+	memset(sname, 0, sizeof(sname));
+	strncpy(sname, rh->lockspace_name, NAME_ID_SIZE);
+
+	if (da->json) {
+		fprintf(out, "{\"offset\":%llu,\"type\":\"rindex_header\"",
+			(unsigned long long)(sector_nr * da->sector_size));
+		dump_json_str(out, "lockspace", sname);
+		fprintf(out, ",\"flags\":%u,\"sector_size\":%d,\"max_resources\":%u,\"rx_offset\":%llu}\n",
+			rh->flags, rh->sector_size, rh->max_resources,
+			(unsigned long long)rh->rx_offset);
+	} else {
+		fprintf(out, "%08llu %36s rindex_header 0x%x %d %u %llu\n",
+			(unsigned long long)(sector_nr * da->sector_size),
+			sname,
+			rh->flags, rh->sector_size, rh->max_resources,
+			(unsigned long long)rh->rx_offset);
+	}
+
+	if (!da->force_mode)
+		return;
+
+	/* i begins with 1 to skip the first sector of the rindex which holds the header */
+
+	for (i = 1; i < da->sector_count; i++) {
+		/* bucket sectors, followed by the lease bitmap */
+		if ((rh->flags & RHF_HASHED) && (uint32_t)i > rh->buckets)
+			break;
+
+		for (j = 0; j < entries_per_sector; j++) {
+			/* the rindex_bucket */
+			if ((rh->flags & RHF_HASHED) && !j)
+				continue;
+
+			re_end = (struct rindex_entry *)(data + (i * da->sector_size) + (j * entry_size));
+			rindex_entry_in(re_end, &re_in);
+			re = &re_in;
+
+			if (!re->res_offset && !re->name[0])
+				continue;
+
+			offset = (sector_nr * da->sector_size) + (i * da->sector_size) + (j * entry_size);
+
+			if (da->json) {
+				fprintf(out, "{\"offset\":%llu,\"type\":\"rentry\"", (unsigned long long)offset);
+				dump_json_str(out, "lockspace", sname);
+				dump_json_str(out, "resource", re->name);
+				fprintf(out, ",\"res_offset\":%llu}\n", (unsigned long long)re->res_offset);
+				continue;
+			}
+
+			fprintf(out, "%08llu %36s rentry %s %llu\n",
+				(unsigned long long)offset,
+				sname,
+				re->name, (unsigned long long)re->res_offset);
+		}
+	}
+}
+
+/* returns 0 if the chunk does not begin with a known magic number */
+
+static int dump_chunk(struct dump_args *da, FILE *out, char *data, uint64_t sector_nr)
+{
+	uint32_t magic;
+
+	magic_in(data, &magic);
+
+	if (magic == DELTA_DISK_MAGIC)
+		dump_delta(da, out, data, sector_nr);
+	else if (magic == PAXOS_DISK_MAGIC)
+		dump_paxos(da, out, data, sector_nr);
+	else if (magic == RINDEX_DISK_MAGIC)
+		dump_rindex(da, out, data, sector_nr);
+	else
+		return 0;
+
+	return 1;
+}
+
+static void *dump_thread(void *arg)
+{
+	struct dump_state *ds = arg;
+	struct dump_args *da = ds->da;
+	struct dump_slot *slot;
+	struct task task;
+	uint64_t chunk;
+	FILE *out;
+	char *data;
+	char *text;
+	size_t len;
+	int datalen = da->sector_count * da->sector_size;
+	int known;
+
+	memset(&task, 0, sizeof(struct task));
+	setup_task_aio(&task, ds->use_aio, DIRECT_AIO_CB_SIZE);
+	sprintf(task.name, "%s", "dump");
+
+	data = malloc(datalen);
+
+	while (1) {
+		pthread_mutex_lock(&ds->mutex);
+		while (ds->next_chunk < ds->stop_chunk &&
+		       ds->next_chunk >= ds->print_chunk + ds->window)
+			pthread_cond_wait(&ds->cond, &ds->mutex);
+
+		if (ds->next_chunk >= ds->stop_chunk) {
+			pthread_mutex_unlock(&ds->mutex);
+			break;
+		}
+
+		chunk = ds->next_chunk++;
+		slot = &ds->slots[chunk % ds->window];
+		slot->chunk = chunk;
+		slot->done = 0;
+		pthread_mutex_unlock(&ds->mutex);
+
+		text = NULL;
+		len = 0;
+		known = 0;
+
+		if (data) {
+			memset(data, 0, datalen);
+
+			read_sectors(da->sd, da->sector_size, chunk * da->sector_count,
+				     da->sector_count, data, datalen,
+				     &task, DEFAULT_IO_TIMEOUT, "dump");
+
+			out = open_memstream(&text, &len);
+			if (out) {
+				known = dump_chunk(da, out, data, chunk * da->sector_count);
+				fclose(out);
+			}
+		}
+
+		pthread_mutex_lock(&ds->mutex);
+		slot->text = text;
+		slot->len = len;
+		slot->known = known;
+		slot->done = 1;
+		if (!known && ds->stop_unknown && chunk < ds->stop_chunk)
+			ds->stop_chunk = chunk;
+		pthread_cond_broadcast(&ds->cond);
+		pthread_mutex_unlock(&ds->mutex);
+	}
+
+	free(data);
+	close_task_aio(&task);
+	return NULL;
+}
+
+int direct_dump(struct task *task, char *dump_path, int force_mode)
+{
+	struct dump_args da;
+	struct dump_state ds;
+	struct dump_slot *slot;
+	struct sync_disk sd;
+	pthread_t *threads = NULL;
+	char *colon, *off_str;
+	char *text;
+	size_t len;
 	uint64_t dump_size = 0;
-	uint64_t end_sector_nr;
 	int sector_size = 0;
 	int align_size = 0;
-	int sector_count, datalen, max_hosts;
-	int i, j, rv, b;
+	int num_threads = com.dump_threads;
+	int i, rv, started = 0;
 
 	memset(&sd, 0, sizeof(struct sync_disk));
+	memset(&da, 0, sizeof(da));
+	memset(&ds, 0, sizeof(ds));
 
 	/* /path[:<offset>[:<size>]] */
 	colon = strstr(dump_path, ":");
@@ -606,227 +1005,215 @@ int direct_dump(struct task *task, char *dump_path, int force_mode)
 			return rv;
 	}
 
-	max_hosts = size_to_max_hosts(sector_size, align_size);
-
-	sector_count = align_size / sector_size;
-	datalen = align_size;
-
-	data = malloc(datalen);
-	if (!data) {
+	if (num_threads < 1)
+		num_threads = DEFAULT_DUMP_THREADS;
+
+	da.sd = &sd;
+	da.sector_size = sector_size;
+	da.sector_count = align_size / sector_size;
+	da.max_hosts = size_to_max_hosts(sector_size, align_size);
+	da.force_mode = force_mode;
+	da.json = com.dump_json;
+	da.changed_since = com.dump_changed_since;
+
+	ds.da = &da;
+	ds.use_aio = task->use_aio;
+	ds.window = 2 * num_threads;
+	ds.stop_unknown = dump_size ? 0 : 1;
+	ds.stop_chunk = dump_size ? (dump_size / sector_size + da.sector_count - 1) / da.sector_count : UINT64_MAX;
+	pthread_mutex_init(&ds.mutex, NULL);
+	pthread_cond_init(&ds.cond, NULL);
+
+	ds.slots = calloc(ds.window, sizeof(struct dump_slot));
+	threads = calloc(num_threads, sizeof(pthread_t));
+	if (!ds.slots || !threads) {
 		rv = -ENOMEM;
-		goto out_close;
+		goto out_free;
 	}
-	memset(data, 0, datalen);
-
-	printf("%8s %36s %48s %10s %4s %4s %s",
-	       "offset",
-	       "lockspace",
-	       "resource",
-	       "timestamp",
-	       "own",
-	       "gen",
-	       "lver");
-
-	if (force_mode)
-		printf("/req/mode");
-
-	printf("\n");
-
-	sector_nr = 0;
-	end_sector_nr = dump_size / sector_size;
-
-	while (end_sector_nr == 0 || sector_nr < end_sector_nr) {
-		memset(sname, 0, sizeof(rname));
-		memset(rname, 0, sizeof(rname));
-		memset(data, 0, sector_size);
 
-		rv = read_sectors(&sd, sector_size, sector_nr, sector_count, data, datalen,
-				  task, DEFAULT_IO_TIMEOUT, "dump");
+	if (!da.json) {
+		printf("%8s %36s %48s %10s %4s %4s %s",
+		       "offset",
+		       "lockspace",
+		       "resource",
+		       "timestamp",
+		       "own",
+		       "gen",
+		       "lver");
 
-		magic_in(data, &magic);
+		if (force_mode)
+			printf("/req/mode");
 
-		if (magic == DELTA_DISK_MAGIC) {
-			lr_end = (struct leader_record *)data;
-			leader_record_in(lr_end, &lr_in);
-			lr = &lr_in;
+		printf("\n");
+	}
 
-			for (i = 0; i < sector_count; i++) {
-				lr_end = (struct leader_record *)(data + (i * sector_size));
+	for (i = 0; i < num_threads; i++) {
+		rv = pthread_create(&threads[i], NULL, dump_thread, &ds);
+		if (rv) {
+			log_error("dump thread create error %d", rv);
+			break;
+		}
+		started++;
+	}
 
-				if (!lr_end->magic)
-					continue;
+	if (!started) {
+		rv = -ENOMEM;
+		goto out_free;
+	}
 
-				leader_record_in(lr_end, &lr_in);
-				lr = &lr_in;
+	pthread_mutex_lock(&ds.mutex);
+	while (ds.print_chunk < ds.stop_chunk) {
+		slot = &ds.slots[ds.print_chunk % ds.window];
 
-				/* has never been acquired, don't print */
-				if (!lr->owner_id && !lr->owner_generation)
-					continue;
+		if (slot->chunk != ds.print_chunk || !slot->done) {
+			pthread_cond_wait(&ds.cond, &ds.mutex);
+			continue;
+		}
 
-				strncpy(sname, lr->space_name, NAME_ID_SIZE);
-				strncpy(rname, lr->resource_name, NAME_ID_SIZE);
+		text = slot->text;
+		len = slot->len;
+		slot->text = NULL;
+		slot->done = 0;
+		ds.print_chunk++;
+		pthread_cond_broadcast(&ds.cond);
+		pthread_mutex_unlock(&ds.mutex);
+
+		if (text) {
+			fwrite(text, 1, len, stdout);
+			free(text);
+		}
 
-				printf("%08llu %36s %48s %010llu %04llu %04llu",
-					(unsigned long long)((sector_nr + i) * sector_size),
-					sname, rname,
-					(unsigned long long)lr->timestamp,
-					(unsigned long long)lr->owner_id,
-					(unsigned long long)lr->owner_generation);
+		pthread_mutex_lock(&ds.mutex);
+	}
+	pthread_cond_broadcast(&ds.cond);
+	pthread_mutex_unlock(&ds.mutex);
 
-				if (force_mode) {
-					bitmap = (char *)lr_end + LEADER_RECORD_MAX;
-					for (b = 0; b < max_hosts; b++) {
-						if (test_id_bit(b+1, bitmap))
-							printf(" %d", b+1);
-					}
-				}
-				printf("\n");
-			}
-		} else if (magic == PAXOS_DISK_MAGIC) {
-			lr_end = (struct leader_record *)data;
-			leader_record_in(lr_end, &lr_in);
-			lr = &lr_in;
-
-			strncpy(sname, lr->space_name, NAME_ID_SIZE);
-			strncpy(rname, lr->resource_name, NAME_ID_SIZE);
-
-			printf("%08llu %36s %48s %010llu %04llu %04llu %llu",
-			       (unsigned long long)(sector_nr * sector_size),
-			       sname, rname,
-			       (unsigned long long)lr->timestamp,
-			       (unsigned long long)lr->owner_id,
-			       (unsigned long long)lr->owner_generation,
-			       (unsigned long long)lr->lver);
-
-			if (force_mode) {
-				struct request_record *rr_end = (struct request_record *)(data + sd.sector_size);
-				request_record_in(rr_end, &rr);
-				printf("/%llu/%u",
-				       (unsigned long long)rr.lver, rr.force_mode);
-			}
-			printf("\n");
-
-			for (i = 0; i < lr->num_hosts; i++) {
-				char *pd_end = data + ((2 + i) * sector_size);
-				struct mode_block *mb_end = (struct mode_block *)(pd_end + MBLOCK_OFFSET);
-
-				if (force_mode > 1) {
-					paxos_dblock_in((struct paxos_dblock *)pd_end, &dblock);
-
-					if (dblock.mbal || dblock.inp || dblock.lver) {
-						printf("dblock[%04d] mbal %llu bal %llu inp %llu inp2 %llu inp3 %llu lver %llu sum %x\n",
-						       i,
-						       (unsigned long long)dblock.mbal,
-					               (unsigned long long)dblock.bal,
-					               (unsigned long long)dblock.inp,
-					               (unsigned long long)dblock.inp2,
-					               (unsigned long long)dblock.inp3,
-					               (unsigned long long)dblock.lver,
-					               dblock.checksum);
-					}
-				}
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
 
-				mode_block_in(mb_end, &mb);
+	/* chunks read past the end */
+	for (i = 0; i < ds.window; i++)
+		free(ds.slots[i].text);
 
-				if (!(mb.flags & MBLOCK_SHARED))
-					continue;
+	fflush(stdout);
+	rv = 0;
+ out_free:
+	free(threads);
+	free(ds.slots);
+	pthread_mutex_destroy(&ds.mutex);
+	pthread_cond_destroy(&ds.cond);
+	close_disks(&sd, 1);
+	return rv;
+}
 
-				printf("                                                                                                          ");
-				printf("%04u %04llu SH\n", i+1, (unsigned long long)mb.generation);
-			}
-		} else if (magic == RINDEX_DISK_MAGIC) {
-			rh_end = (struct rindex_header *)data;
-			rindex_header_in(rh_end, &rh_in);
-			rh = &rh_in;
+static int parse_disk_arg(char *path, struct sync_disk *sd, uint64_t *size)
+{
+	char *colon, *off_str;
 
-			strncpy(sname, rh->lockspace_name, NAME_ID_SIZE);
+	memset(sd, 0, sizeof(struct sync_disk));
 
-			printf("%08llu %36s rindex_header 0x%x %d %u %llu\n",
-			       (unsigned long long)(sector_nr * sector_size),
-			       sname,
-			       rh->flags, rh->sector_size, rh->max_resources,
-			       (unsigned long long)rh->rx_offset);
+	/* /path[:<offset>[:<size>]] */
+	colon = strstr(path, ":");
+	if (colon) {
+		off_str = colon + 1;
+		*colon = '\0';
+		sd->offset = atoll(off_str);
 
-			if (!force_mode)
-				goto next;
+		colon = strstr(off_str, ":");
+		if (colon && size)
+			*size = atoll(colon + 1);
+	}
 
-			/* i begins with 1 to skip the first sector of the rindex which holds the header */
+	strncpy(sd->path, path, SANLK_PATH_LEN);
+	sd->fd = -1;
 
-			for (i = 1; i < sector_count; i++) {
-				int entry_size = sizeof(struct rindex_entry);
-				int entries_per_sector = sector_size / entry_size;
+	return open_disk(sd);
+}
 
-				for (j = 0; j < entries_per_sector; j++) {
-					re_end = (struct rindex_entry *)(data + (i * sector_size) + (j * entry_size));
-					rindex_entry_in(re_end, &re_in);
-					re = &re_in;
+static int disk_sizes(struct task *task, struct sync_disk *sd,
+		      int *sector_size, int *align_size)
+{
+	*sector_size = com.sector_size;
+	*align_size = com.align_size;
 
-					if (!re->res_offset && !re->name[0])
-						continue;
+	if (!*sector_size || !*align_size)
+		return direct_read_leader_sizes(task, sd, sector_size, align_size);
+	return 0;
+}
 
-					printf("%08llu %36s rentry %s %llu\n",
-			       			(unsigned long long)((sector_nr * sector_size) + (i * sector_size) + (j * entry_size)),
-			       			sname,
-						re->name, (unsigned long long)re->res_offset);
-				}
-			}
+/*
+ * With a map file from direct freemap, the next free area is taken from
+ * the map, and the map is saved without it, so repeated next_free calls
+ * return different areas.  Without a map, or when the map has no more
+ * free areas, the areas are read one at a time from the start (or the
+ * end of the map) until one is not used.
+ */
 
+static struct freemap *next_free_map(struct task *task, struct sync_disk *sd,
+				     int sector_size, int align_size, char *map_path)
+{
+	struct freemap *fm = NULL;
+	int rv;
 
-		} else {
-			if (end_sector_nr == 0)
-				break;
-		}
- next:
-		sector_nr += sector_count;
+	rv = freemap_read(map_path, &fm);
+	if (!rv && (fm->offset != sd->offset || strncmp(fm->path, sd->path, SANLK_PATH_LEN) ||
+		    fm->sector_size != sector_size || fm->align_size != align_size)) {
+		log_tool("freemap %s is for %s:%llu", map_path, fm->path,
+			 (unsigned long long)fm->offset);
+		freemap_free(fm);
+		fm = NULL;
+		rv = -EINVAL;
 	}
 
-	rv = 0;
-	free(data);
- out_close:
-	close_disks(&sd, 1);
-	return rv;
+	if (rv < 0) {
+		rv = freemap_scan(task, sd, sector_size, align_size, 0, &fm);
+		if (rv < 0)
+			return NULL;
+	}
+	return fm;
 }
 
-int direct_next_free(struct task *task, char *path)
+int direct_next_free(struct task *task, char *path, char *map_path)
 {
 	char *data;
-	char *colon, *off_str;
 	struct leader_record *lr_end;
 	struct leader_record lr;
+	struct freemap *fm = NULL;
 	struct sync_disk sd;
-	uint64_t sector_nr;
-	int sector_size, sector_count, datalen, align_size;
+	uint64_t sector_nr, area;
+	int sector_size = 0, sector_count, datalen, align_size = 0;
 	int rv;
 
-	memset(&sd, 0, sizeof(struct sync_disk));
-
-	colon = strstr(path, ":");
-	if (colon) {
-		off_str = colon + 1;
-		*colon = '\0';
-		sd.offset = atoll(off_str);
-	}
-
-	strncpy(sd.path, path, SANLK_PATH_LEN);
-	sd.fd = -1;
-
-	rv = open_disk(&sd);
+	rv = parse_disk_arg(path, &sd, NULL);
 	if (rv < 0)
 		return -ENODEV;
 
-	if (com.sector_size)
-		sector_size = com.sector_size;
-        if (com.align_size)
-                align_size = com.align_size;
-
-	if (!sector_size || !align_size) {
-		rv = direct_read_leader_sizes(task, &sd, &sector_size, &align_size);
-		if (rv < 0)
-			return rv;
-	}
+	rv = disk_sizes(task, &sd, &sector_size, &align_size);
+	if (rv < 0)
+		goto out_close;
 
 	sector_count = align_size / sector_size;
 	datalen = sector_size;
+	sector_nr = 0;
+
+	if (map_path) {
+		fm = next_free_map(task, &sd, sector_size, align_size, map_path);
+		if (fm) {
+			rv = freemap_take(task, &sd, fm, &area);
+			if (!rv)
+				sector_nr = area * sector_count;
+			else
+				sector_nr = fm->count * sector_count;
+
+			freemap_write(fm, map_path);
+			freemap_free(fm);
+
+			if (!rv) {
+				printf("%llu\n", (unsigned long long)(sector_nr * sector_size));
+				goto out_close;
+			}
+		}
+	}
 
 	data = malloc(datalen);
 	if (!data) {
@@ -834,7 +1221,6 @@ int direct_next_free(struct task *task, char *path)
 		goto out_close;
 	}
 
-	sector_nr = 0;
 	rv = -ENOSPC;
 
 	while (1) {
@@ -862,6 +1248,60 @@ int direct_next_free(struct task *task, char *path)
 	return rv;
 }
 
+/*
+ * Scan the lease areas of a disk and print the ranges of free areas,
+ * saving the map to map_path for next_free.
+ */
+
+int direct_freemap(struct task *task, char *path, char *map_path)
+{
+	struct freemap *fm = NULL;
+	struct sync_disk sd;
+	uint64_t size = 0;
+	uint64_t area, start;
+	int sector_size = 0, align_size = 0;
+	int rv;
+
+	rv = parse_disk_arg(path, &sd, &size);
+	if (rv < 0)
+		return -ENODEV;
+
+	rv = disk_sizes(task, &sd, &sector_size, &align_size);
+	if (rv < 0)
+		goto out_close;
+
+	rv = freemap_scan(task, &sd, sector_size, align_size, size, &fm);
+	if (rv < 0)
+		goto out_close;
+
+	printf("areas %llu free %llu align_size %d\n",
+	       (unsigned long long)fm->count,
+	       (unsigned long long)freemap_count_free(fm),
+	       align_size);
+
+	for (area = 0; area < fm->count; ) {
+		if (!(fm->bits[area / 64] & (1ULL << (area % 64)))) {
+			area++;
+			continue;
+		}
+		start = area;
+		while (area < fm->count && (fm->bits[area / 64] & (1ULL << (area % 64))))
+			area++;
+		printf("%llu %llu\n", (unsigned long long)(start * align_size),
+		       (unsigned long long)(area - start));
+	}
+
+	if (map_path) {
+		rv = freemap_write(fm, map_path);
+		if (rv < 0)
+			log_tool("freemap %s write error %d", map_path, rv);
+	}
+
+	freemap_free(fm);
+ out_close:
+	close_disks(&sd, 1);
+	return rv;
+}
 
 int direct_rindex_format(struct task *task, struct sanlk_rindex *ri)
 {
@@ -874,6 +1314,11 @@ int direct_rindex_rebuild(struct task *task, struct sanlk_rindex *ri,
 	return rindex_rebuild(task, ri, cmd_flags | SANLK_RX_NO_LOCKSPACE);
 }
 
+int direct_rindex_convert(struct task *task, struct sanlk_rindex *ri, int hashed)
+{
+	return rindex_convert(task, ri, hashed);
+}
+
 int direct_rindex_lookup(struct task *task, struct sanlk_rindex *ri,
 			 struct sanlk_rentry *re, uint32_t cmd_flags)
 {
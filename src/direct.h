@@ -53,11 +53,18 @@ int direct_write_leader(struct task *task,
 
 int direct_dump(struct task *task, char *dump_path, int force_mode);
 
-int direct_next_free(struct task *task, char *path);
+/* sizes from the leader record at the start of sd */
+int direct_read_leader_sizes(struct task *task, struct sync_disk *sd,
+			     int *sector_size, int *align_size);
+
+int direct_next_free(struct task *task, char *path, char *map_path);
+
+int direct_freemap(struct task *task, char *path, char *map_path);
 
 int direct_rindex_format(struct task *task, struct sanlk_rindex *ri);
 int direct_rindex_rebuild(struct task *task, struct sanlk_rindex *ri,
 			  uint32_t cmd_flags);
+int direct_rindex_convert(struct task *task, struct sanlk_rindex *ri, int hashed);
 int direct_rindex_lookup(struct task *task, struct sanlk_rindex *ri,
                          struct sanlk_rentry *re, uint32_t cmd_flags);
 int direct_rindex_update(struct task *task, struct sanlk_rindex *ri,
@@ -45,6 +45,13 @@ int lockspace_clear_rindex_op(char *space_name GNUC_UNUSED)
 	return -1;
 }
 
+void lockspace_rindex_progress(char *space_name GNUC_UNUSED, uint32_t slots GNUC_UNUSED,
+			       uint32_t done GNUC_UNUSED, uint32_t found GNUC_UNUSED);
+void lockspace_rindex_progress(char *space_name GNUC_UNUSED, uint32_t slots GNUC_UNUSED,
+			       uint32_t done GNUC_UNUSED, uint32_t found GNUC_UNUSED)
+{
+}
+
 int lockspace_disk(char *space_name GNUC_UNUSED, struct sync_disk *disk GNUC_UNUSED);
 
 int lockspace_disk(char *space_name GNUC_UNUSED, struct sync_disk *disk GNUC_UNUSED)
@@ -59,12 +66,107 @@ int host_info(char *space_name GNUC_UNUSED, uint64_t host_id GNUC_UNUSED, struct
 	return -1;
 }
 
+int host_info_wait(char *space_name, uint64_t host_id, uint64_t last_check,
+		   uint64_t deadline, struct host_status *hs_out);
+
+int host_info_wait(char *space_name GNUC_UNUSED, uint64_t host_id GNUC_UNUSED,
+		   uint64_t last_check GNUC_UNUSED, uint64_t deadline GNUC_UNUSED,
+		   struct host_status *hs_out GNUC_UNUSED)
+{
+	return -1;
+}
+
 struct token;
 
-void check_mode_block(struct token *token GNUC_UNUSED, int q GNUC_UNUSED, char *dblock GNUC_UNUSED);
+void check_mode_block(struct token *token GNUC_UNUSED, uint64_t next_lver GNUC_UNUSED,
+		      int q GNUC_UNUSED, struct mode_block *mb GNUC_UNUSED);
+
+void check_mode_block(struct token *token GNUC_UNUSED, uint64_t next_lver GNUC_UNUSED,
+		      int q GNUC_UNUSED, struct mode_block *mb GNUC_UNUSED)
+{
+}
+
+void trace_event(uint32_t op GNUC_UNUSED, uint32_t space_id GNUC_UNUSED,
+		 uint32_t res_id GNUC_UNUSED, uint64_t lver GNUC_UNUSED,
+		 uint32_t disk GNUC_UNUSED, uint64_t offset GNUC_UNUSED,
+		 uint64_t begin GNUC_UNUSED, int result GNUC_UNUSED);
+void trace_event(uint32_t op GNUC_UNUSED, uint32_t space_id GNUC_UNUSED,
+		 uint32_t res_id GNUC_UNUSED, uint64_t lver GNUC_UNUSED,
+		 uint32_t disk GNUC_UNUSED, uint64_t offset GNUC_UNUSED,
+		 uint64_t begin GNUC_UNUSED, int result GNUC_UNUSED)
+{
+}
+
+void metrics_add(uint32_t space_id GNUC_UNUSED, int counter GNUC_UNUSED,
+		 uint64_t val GNUC_UNUSED);
+void metrics_add(uint32_t space_id GNUC_UNUSED, int counter GNUC_UNUSED,
+		 uint64_t val GNUC_UNUSED)
+{
+}
+
+void io_stats_open(int fd GNUC_UNUSED, const char *path GNUC_UNUSED);
+void io_stats_open(int fd GNUC_UNUSED, const char *path GNUC_UNUSED)
+{
+}
+
+void io_stats_close(int fd GNUC_UNUSED);
+void io_stats_close(int fd GNUC_UNUSED)
+{
+}
+
+void io_stats_add(struct task *task GNUC_UNUSED, int fd GNUC_UNUSED, int cmd GNUC_UNUSED,
+		  uint64_t begin GNUC_UNUSED, int result GNUC_UNUSED);
+void io_stats_add(struct task *task GNUC_UNUSED, int fd GNUC_UNUSED, int cmd GNUC_UNUSED,
+		  uint64_t begin GNUC_UNUSED, int result GNUC_UNUSED)
+{
+}
+
+void capture_io(struct task *task GNUC_UNUSED, int fd GNUC_UNUSED, int cmd GNUC_UNUSED,
+		uint64_t offset GNUC_UNUSED, int len GNUC_UNUSED, const char *buf GNUC_UNUSED,
+		uint64_t begin GNUC_UNUSED, int result GNUC_UNUSED);
+void capture_io(struct task *task GNUC_UNUSED, int fd GNUC_UNUSED, int cmd GNUC_UNUSED,
+		uint64_t offset GNUC_UNUSED, int len GNUC_UNUSED, const char *buf GNUC_UNUSED,
+		uint64_t begin GNUC_UNUSED, int result GNUC_UNUSED)
+{
+}
+
+int fd_cache_get(const char *path GNUC_UNUSED, int *fd GNUC_UNUSED,
+		 uint32_t *sector_size GNUC_UNUSED);
+int fd_cache_get(const char *path GNUC_UNUSED, int *fd GNUC_UNUSED,
+		 uint32_t *sector_size GNUC_UNUSED)
+{
+	return -ENOENT;
+}
+
+void fd_cache_add(const char *path GNUC_UNUSED, int fd GNUC_UNUSED,
+		  uint32_t sector_size GNUC_UNUSED);
+void fd_cache_add(const char *path GNUC_UNUSED, int fd GNUC_UNUSED,
+		  uint32_t sector_size GNUC_UNUSED)
+{
+}
+
+void fd_cache_set_sector_size(int fd GNUC_UNUSED, uint32_t sector_size GNUC_UNUSED);
+void fd_cache_set_sector_size(int fd GNUC_UNUSED, uint32_t sector_size GNUC_UNUSED)
+{
+}
+
+int fd_cache_put(int fd GNUC_UNUSED);
+int fd_cache_put(int fd GNUC_UNUSED)
+{
+	return 0;
+}
+
+void fd_cache_invalidate(int fd GNUC_UNUSED, int err GNUC_UNUSED);
+void fd_cache_invalidate(int fd GNUC_UNUSED, int err GNUC_UNUSED)
+{
+}
 
-void check_mode_block(struct token *token GNUC_UNUSED, int q GNUC_UNUSED, char *dblock GNUC_UNUSED)
+int read_flight(const char *path GNUC_UNUSED, int fd, uint64_t offset, char *iobuf,
+		int iobuf_len, struct task *task, int ioto);
+int read_flight(const char *path GNUC_UNUSED, int fd, uint64_t offset, char *iobuf,
+		int iobuf_len, struct task *task, int ioto)
 {
+	return read_iobuf(fd, offset, iobuf, iobuf_len, task, ioto, NULL);
 }
 
 /* copied from host_id.c */
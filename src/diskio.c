@@ -16,11 +16,14 @@
 #include <string.h>
 #include <errno.h>
 #include <limits.h>
+#include <dirent.h>
 #include <time.h>
+#include <pthread.h>
 #include <syslog.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/sysmacros.h>
 #include <blkid/blkid.h>
 
@@ -31,6 +34,15 @@
 #include "diskio.h"
 #include "direct.h"
 #include "log.h"
+#include "task.h"
+#include "sanlock_sock.h"
+#include "trace.h"
+#include "iostats.h"
+#include "capture.h"
+#include "fdcache.h"
+#include "monotime.h"
+#include "simdisk.h"
+#include "readflight.h"
 
 int read_sysfs_size(const char *disk_path, const char *name, unsigned int *val)
 {
@@ -172,6 +184,380 @@ static int set_disk_properties(struct sync_disk *disk)
 	return 0;
 }
 
+/* the fd cache is only used by the daemon, see fd_cache */
+
+static int use_fd_cache(void)
+{
+	return com.fd_cache && com.type == COM_DAEMON;
+}
+
+static void io_error(int fd, int err)
+{
+	if (use_fd_cache())
+		fd_cache_invalidate(fd, err);
+}
+
+/*
+ * Per device scheduling of the daemon's aio.  Renewal i/o (from tasks
+ * with io_renewal set) is always submitted immediately, and while one is
+ * in progress on a device, other i/o to the device waits to be submitted.
+ * Other i/o is also limited to io_worker_max outstanding per device, so
+ * a renewal submitted to a busy device is queued behind at most that
+ * many.  A waiting i/o is submitted anyway after waiting its io timeout,
+ * so waiting never takes the place of an i/o timeout.  A device is
+ * identified by st_rdev for a block device, or st_dev for a file.
+ * io_worker_max 0 (the library and direct commands) disables this.
+ */
+
+#define IO_SCHED_DEVS 64
+
+struct io_sched_dev {
+	dev_t dev;
+	int renewal;
+	int worker;
+};
+
+struct io_sched {
+	int count;
+	int renewal;
+	dev_t devs[MAX_IOBUF_GROUP];
+};
+
+static struct io_sched_dev io_sched_devs[IO_SCHED_DEVS];
+static pthread_mutex_t io_sched_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t io_sched_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t io_sched_waits;
+static uint64_t io_sched_wait_ms;
+static uint64_t io_sched_wait_timeouts;
+
+static struct io_sched_dev *io_sched_find(dev_t dev, int create)
+{
+	struct io_sched_dev *free_sd = NULL;
+	struct io_sched_dev *sd;
+	int i;
+
+	for (i = 0; i < IO_SCHED_DEVS; i++) {
+		sd = &io_sched_devs[i];
+
+		if (!sd->renewal && !sd->worker) {
+			if (!free_sd)
+				free_sd = sd;
+			continue;
+		}
+		if (sd->dev == dev)
+			return sd;
+	}
+
+	if (!create || !free_sd)
+		return NULL;
+
+	free_sd->dev = dev;
+	return free_sd;
+}
+
+static int io_sched_busy(struct io_sched *is)
+{
+	struct io_sched_dev *sd;
+	int i;
+
+	for (i = 0; i < is->count; i++) {
+		sd = io_sched_find(is->devs[i], 0);
+		if (sd && (sd->renewal || sd->worker >= com.io_worker_max))
+			return 1;
+	}
+	return 0;
+}
+
+static void io_sched_begin(struct io_sched *is, struct task *task,
+			   int *fds, int count, int ioto)
+{
+	struct io_sched_dev *sd;
+	struct timespec deadline;
+	struct stat st;
+	uint64_t begin;
+	int waited = 0;
+	int i, rv;
+
+	is->count = 0;
+
+	if (!com.io_worker_max || !task)
+		return;
+
+	is->renewal = task->io_renewal;
+
+	for (i = 0; i < count && i < MAX_IOBUF_GROUP; i++) {
+		if (fstat(fds[i], &st) < 0)
+			continue;
+		is->devs[is->count++] = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+	}
+
+	/* all devices are admitted together so a group never holds
+	   one device while waiting for another */
+
+	pthread_mutex_lock(&io_sched_mutex);
+
+	if (!is->renewal && io_sched_busy(is)) {
+		begin = monotime_ms();
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += ioto;
+		waited = 1;
+
+		while (io_sched_busy(is)) {
+			rv = pthread_cond_timedwait(&io_sched_cond, &io_sched_mutex, &deadline);
+			if (rv == ETIMEDOUT) {
+				io_sched_wait_timeouts++;
+				break;
+			}
+		}
+
+		io_sched_waits++;
+		io_sched_wait_ms += monotime_ms() - begin;
+	}
+
+	for (i = 0; i < is->count; i++) {
+		sd = io_sched_find(is->devs[i], 1);
+		if (!sd) {
+			/* table full, this device is not scheduled */
+			is->devs[i--] = is->devs[--is->count];
+			continue;
+		}
+		if (is->renewal)
+			sd->renewal++;
+		else
+			sd->worker++;
+	}
+
+	pthread_mutex_unlock(&io_sched_mutex);
+
+	if (waited && com.debug_io_submit)
+		log_taskd(task, "io_sched waited for %d devices", is->count);
+}
+
+static void io_sched_end(struct io_sched *is)
+{
+	struct io_sched_dev *sd;
+	int i;
+
+	if (!is->count)
+		return;
+
+	pthread_mutex_lock(&io_sched_mutex);
+	for (i = 0; i < is->count; i++) {
+		sd = io_sched_find(is->devs[i], 0);
+		if (!sd)
+			continue;
+		if (is->renewal)
+			sd->renewal--;
+		else
+			sd->worker--;
+	}
+	pthread_cond_broadcast(&io_sched_cond);
+	pthread_mutex_unlock(&io_sched_mutex);
+
+	is->count = 0;
+}
+
+void get_io_sched_stats(uint64_t *waits, uint64_t *wait_ms, uint64_t *wait_timeouts)
+{
+	pthread_mutex_lock(&io_sched_mutex);
+	*waits = io_sched_waits;
+	*wait_ms = io_sched_wait_ms;
+	*wait_timeouts = io_sched_wait_timeouts;
+	pthread_mutex_unlock(&io_sched_mutex);
+}
+
+/*
+ * A write that do_linux_aio_group detaches (leaves outstanding once enough
+ * of its group completed) is put on detached_writes until its task reaps
+ * it.  Tasks have their own aio contexts and fds, so a detached write is
+ * identified by device and offset, and a group write to the same sector
+ * from another task waits up to its io timeout for the detached write to
+ * be reaped, and otherwise fails with -EBUSY.  This keeps a late write
+ * from an earlier ballot from landing on top of a newer one.  The task
+ * that owns a detached write reaps it with its next i/o, or with
+ * reap_detached_aio() when it has no more work.
+ */
+
+static LIST_HEAD(detached_writes);
+static pthread_mutex_t detached_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t detached_cond = PTHREAD_COND_INITIALIZER;
+
+static void detached_write_add(struct aicb *aicb, int fd)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) < 0)
+		return;
+
+	aicb->detached_dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+	aicb->detached_write = 1;
+
+	pthread_mutex_lock(&detached_mutex);
+	list_add_tail(&aicb->detached_list, &detached_writes);
+	pthread_mutex_unlock(&detached_mutex);
+}
+
+/* called for each reaped aicb, and for those destroyed with their task */
+
+void aio_collected(struct aicb *aicb)
+{
+	aicb->detached = 0;
+
+	if (!aicb->detached_write)
+		return;
+
+	pthread_mutex_lock(&detached_mutex);
+	list_del(&aicb->detached_list);
+	aicb->detached_write = 0;
+	pthread_cond_broadcast(&detached_cond);
+	pthread_mutex_unlock(&detached_mutex);
+}
+
+static int detached_write_find(struct task *task, dev_t dev, uint64_t offset)
+{
+	struct aicb *aicb;
+
+	list_for_each_entry(aicb, &detached_writes, detached_list) {
+		if (aicb->detached_dev != dev || aicb->iocb.u.c.offset != offset)
+			continue;
+		/* the task's own are found by the fd check in the caller */
+		if (aicb >= task->callbacks && aicb < task->callbacks + task->cb_size)
+			continue;
+		return 1;
+	}
+	return 0;
+}
+
+static int detached_write_wait(struct task *task, int fd, uint64_t offset, int ioto)
+{
+	struct timespec deadline;
+	struct stat st;
+	dev_t dev;
+	int waited = 0;
+	int rv = 0;
+
+	if (fstat(fd, &st) < 0)
+		return 0;
+	dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+
+	pthread_mutex_lock(&detached_mutex);
+	if (list_empty(&detached_writes))
+		goto out;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += ioto;
+
+	while (detached_write_find(task, dev, offset)) {
+		waited = 1;
+		if (pthread_cond_timedwait(&detached_cond, &detached_mutex, &deadline) == ETIMEDOUT) {
+			rv = detached_write_find(task, dev, offset) ? -EBUSY : 0;
+			break;
+		}
+	}
+ out:
+	pthread_mutex_unlock(&detached_mutex);
+
+	if (waited)
+		log_taskd(task, "aio group WR fd %d offset %llu waited for detached write rv %d",
+			  fd, (unsigned long long)offset, rv);
+	return rv;
+}
+
+/*
+ * Wait for a task's detached writes to complete before it waits for more
+ * work, so they don't hold up writes from other tasks to the same sectors.
+ */
+
+void reap_detached_aio(struct task *task, int ioto)
+{
+	struct aio_done events[MAX_IOBUF_GROUP];
+	struct timespec ts;
+	struct aicb *ev_aicb;
+	uint64_t end;
+	int i, rv, used;
+
+	if (!task->use_aio || !task->callbacks)
+		return;
+
+	end = monotime() + ioto;
+
+	while (1) {
+		used = 0;
+		for (i = 0; i < task->cb_size; i++) {
+			if (task->callbacks[i].used && task->callbacks[i].detached_write)
+				used++;
+		}
+		if (!used || monotime() >= end)
+			break;
+
+		memset(&ts, 0, sizeof(ts));
+		ts.tv_sec = end - monotime();
+
+		rv = task_aio_getevents(task, 1, MAX_IOBUF_GROUP, events, &ts);
+		if (rv == -EINTR)
+			continue;
+		if (rv <= 0)
+			break;
+
+		for (i = 0; i < rv; i++) {
+			ev_aicb = events[i].aicb;
+
+			log_taskd(task, "aio collect %p:%p:%p result %ld:%ld %s free idle",
+				  ev_aicb, &ev_aicb->iocb, ev_aicb->buf, events[i].res, events[i].res2,
+				  ev_aicb->detached ? "detached" : "old");
+
+			ev_aicb->used = 0;
+			aio_collected(ev_aicb);
+			task_iobuf_free(task, ev_aicb->buf);
+			ev_aicb->buf = NULL;
+		}
+	}
+}
+
+/*
+ * Give the i/o submitted by the calling thread the realtime i/o priority
+ * class, which the kernel uses for both libaio and io_uring requests that
+ * don't set their own priority.  This requires CAP_SYS_ADMIN, and without
+ * it the thread keeps the default priority.
+ */
+
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_CLASS_RT		1
+#define IOPRIO_WHO_PROCESS	1
+#define IOPRIO_PRIO_VALUE(class, data)	(((class) << IOPRIO_CLASS_SHIFT) | (data))
+
+void set_renewal_ioprio(void)
+{
+	static int warned;
+
+	if (!com.renewal_ioprio)
+		return;
+
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+		    IOPRIO_PRIO_VALUE(IOPRIO_CLASS_RT, 4)) < 0) {
+		if (!warned++)
+			log_warn("renewal ioprio_set error %d", errno);
+	}
+}
+
+/* a sim disk is opened by simdisk.c, see sim_open */
+
+static int open_disk_path(const char *path)
+{
+	if (sim_path(path))
+		return sim_open(path);
+
+	return open(path, O_RDWR | O_DIRECT | O_SYNC, 0);
+}
+
+void close_disk_fd(int fd)
+{
+	if (sim_disk_count)
+		sim_close(fd);
+	io_stats_close(fd);
+	close(fd);
+}
+
 void close_disks(struct sync_disk *disks, int num_disks)
 {
 	int d;
@@ -179,7 +565,8 @@ void close_disks(struct sync_disk *disks, int num_disks)
 	for (d = 0; d < num_disks; d++) {
 		if (disks[d].fd == -1)
 			continue;
-		close(disks[d].fd);
+		if (!use_fd_cache() || !fd_cache_put(disks[d].fd))
+			close_disk_fd(disks[d].fd);
 		disks[d].fd = -1;
 	}
 }
@@ -216,6 +603,7 @@ int open_disks_fd(struct sync_disk *disks, int num_disks)
 	struct sync_disk *disk;
 	int num_opens = 0;
 	int d, fd, rv = -1;
+	uint32_t ss;
 
 	for (d = 0; d < num_disks; d++) {
 		disk = &disks[d];
@@ -226,7 +614,13 @@ int open_disks_fd(struct sync_disk *disks, int num_disks)
 			goto fail;
 		}
 
-		fd = open(disk->path, O_RDWR | O_DIRECT | O_SYNC, 0);
+		if (use_fd_cache() && !fd_cache_get(disk->path, &fd, &ss)) {
+			disk->fd = fd;
+			num_opens++;
+			continue;
+		}
+
+		fd = open_disk_path(disk->path);
 		if (fd < 0) {
 			rv = -errno;
 			if (rv == -EACCES) {
@@ -239,6 +633,9 @@ int open_disks_fd(struct sync_disk *disks, int num_disks)
 		}
 
 		disk->fd = fd;
+		io_stats_open(fd, disk->path);
+		if (use_fd_cache())
+			fd_cache_add(disk->path, fd, 0);
 		num_opens++;
 	}
 
@@ -263,9 +660,21 @@ int open_disks_fd(struct sync_disk *disks, int num_disks)
 int open_disk(struct sync_disk *disk)
 {
 	struct stat st;
-	int fd, rv;
+	uint32_t ss = 0;
+	int fd, rv, cached = 0;
 
-	fd = open(disk->path, O_RDWR | O_DIRECT | O_SYNC, 0);
+	if (use_fd_cache() && !fd_cache_get(disk->path, &fd, &ss)) {
+		if (ss) {
+			disk->fd = fd;
+			disk->sector_size = ss;
+			return 0;
+		}
+		/* opened by open_disks_fd which does not get sector_size */
+		cached = 1;
+		goto props;
+	}
+
+	fd = open_disk_path(disk->path);
 	if (fd < 0) {
 		rv = -errno;
 		if (rv == -EACCES) {
@@ -277,26 +686,37 @@ int open_disk(struct sync_disk *disk)
 		goto fail;
 	}
 
+	io_stats_open(fd, disk->path);
+ props:
 	if (fstat(fd, &st) < 0) {
 		rv = -errno;
 		log_error("fstat error %d %s", rv, disk->path);
-		close(fd);
-		goto fail;
+		goto fail_close;
 	}
 
 	if (S_ISREG(st.st_mode)) {
 		disk->sector_size = 512;
 	} else {
 		rv = set_disk_properties(disk);
-		if (rv < 0) {
-			close(fd);
-			goto fail;
-		}
+		if (rv < 0)
+			goto fail_close;
 	}
 
 	disk->fd = fd;
+
+	if (cached)
+		fd_cache_set_sector_size(fd, disk->sector_size);
+	else if (use_fd_cache())
+		fd_cache_add(disk->path, fd, disk->sector_size);
 	return 0;
 
+ fail_close:
+	if (cached) {
+		disk->fd = fd;
+		close_disks(disk, 1);
+	} else {
+		close_disk_fd(fd);
+	}
  fail:
 	if (rv >= 0)
 		rv = -1;
@@ -355,7 +775,6 @@ int open_disks(struct sync_disk *disks, int num_disks)
 
 static int do_write(int fd, uint64_t offset, const char *buf, int len, struct task *task, int *wr_ms)
 {
-	off_t ret;
 	int rv;
 	int pos = 0;
 	int sys_error = 0; 
@@ -364,6 +783,7 @@ static int do_write(int fd, uint64_t offset, const char *buf, int len, struct ta
 	const char *len_str;
 	char off_str[16];
 	char ms_str[8];
+	uint64_t stats_start;
 
 	if (task)
 		task->io_count++;
@@ -378,17 +798,16 @@ static int do_write(int fd, uint64_t offset, const char *buf, int len, struct ta
 			log_taskd(task, "WR %d at %s", len, off_str);
 	}
 
-	ret = lseek(fd, offset, SEEK_SET);
-	if (ret != offset) {
-		log_taskw(task, "WR %d at %s seek error %llu", len, off_str, (unsigned long long)ret);
-		return -1;
-	}
-
 	if (wr_ms)
 		clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
 
+	stats_start = trace_begin();
+
  retry:
-	rv = write(fd, buf + pos, len);
+	if (sim_disk_count && sim_fd(fd))
+		rv = sim_pwrite(fd, buf + pos, len, offset + pos);
+	else
+		rv = pwrite(fd, buf + pos, len, offset + pos);
 	if (rv == -1 && errno == EINTR)
 		goto retry;
 	if (rv < 0) {
@@ -413,6 +832,9 @@ static int do_write(int fd, uint64_t offset, const char *buf, int len, struct ta
 		rv = 0;
 
  out:
+	capture_io(task, fd, IO_CMD_PWRITE, offset, pos + len, buf, stats_start, rv);
+	io_stats_add(task, fd, IO_CMD_PWRITE, stats_start, rv);
+
 	if (wr_ms) {
 		clock_gettime(CLOCK_MONOTONIC_RAW, &end);
 		ts_diff(&begin, &end, &diff);
@@ -440,12 +862,14 @@ static int do_write(int fd, uint64_t offset, const char *buf, int len, struct ta
 				  len, off_str, save_errno, wr_ms ? ms_str : "");
 	}
 
+	if (sys_error)
+		io_error(fd, -save_errno);
+
 	return rv;
 }
 
 static int do_read(int fd, uint64_t offset, char *buf, int len, struct task *task, int *rd_ms)
 {
-	off_t ret;
 	int rv, pos = 0;
 	int sys_error = 0;
 	int save_errno = 0;
@@ -453,6 +877,7 @@ static int do_read(int fd, uint64_t offset, char *buf, int len, struct task *tas
 	const char *len_str;
 	char off_str[16];
 	char ms_str[8];
+	uint64_t stats_start;
 
 	if (task)
 		task->io_count++;
@@ -467,17 +892,16 @@ static int do_read(int fd, uint64_t offset, char *buf, int len, struct task *tas
 			log_taskd(task, "RD %d at %s", len, off_str);
 	}
 
-	ret = lseek(fd, offset, SEEK_SET);
-	if (ret != offset) {
-		log_taskw(task, "RD %d at %s seek error %llu", len, off_str, (unsigned long long)ret);
-		return -1;
-	}
-
 	if (rd_ms)
 		clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
 
+	stats_start = trace_begin();
+
 	while (pos < len) {
-		rv = read(fd, buf + pos, len - pos);
+		if (sim_disk_count && sim_fd(fd))
+			rv = sim_pread(fd, buf + pos, len - pos, offset + pos);
+		else
+			rv = pread(fd, buf + pos, len - pos, offset + pos);
 		if (rv == 0) {
 			sys_error = 1;
 			save_errno = errno;
@@ -498,6 +922,9 @@ static int do_read(int fd, uint64_t offset, char *buf, int len, struct task *tas
 	else
 		rv = 0;
 
+	capture_io(task, fd, IO_CMD_PREAD, offset, len, buf, stats_start, rv);
+	io_stats_add(task, fd, IO_CMD_PREAD, stats_start, rv);
+
 	if (rd_ms) {
 		clock_gettime(CLOCK_MONOTONIC_RAW, &end);
 		ts_diff(&begin, &end, &diff);
@@ -525,13 +952,16 @@ static int do_read(int fd, uint64_t offset, char *buf, int len, struct task *tas
 				  len, off_str, save_errno, rd_ms ? ms_str : "");
 	}
 
+	if (sys_error)
+		io_error(fd, -save_errno);
+
 	return rv;
 }
 
 static struct aicb *find_callback_slot(struct task *task, int ioto)
 {
 	struct timespec ts;
-	struct io_event event;
+	struct aio_done event;
 	int cleared = 0;
 	int rv;
 	int i;
@@ -551,14 +981,14 @@ static struct aicb *find_callback_slot(struct task *task, int ioto)
  retry:
 	memset(&event, 0, sizeof(event));
 
-	rv = io_getevents(task->aio_ctx, 1, 1, &event, &ts);
+	rv = task_aio_getevents(task, 1, 1, &event, &ts);
 	if (rv == -EINTR)
 		goto retry;
 	if (rv < 0)
 		return NULL;
 	if (rv == 1) {
-		struct iocb *ev_iocb = event.obj;
-		struct aicb *ev_aicb = container_of(ev_iocb, struct aicb, iocb);
+		struct aicb *ev_aicb = event.aicb;
+		struct iocb *ev_iocb = &ev_aicb->iocb;
 		int op = ev_iocb ? ev_iocb->aio_lio_opcode : -1;
 		const char *op_str;
 
@@ -569,10 +999,15 @@ static struct aicb *find_callback_slot(struct task *task, int ioto)
 		else
 			op_str = "UK";
 
-		log_taskw(task, "aio collect %s %p:%p:%p result %ld:%ld old free",
-			  op_str, ev_aicb, ev_iocb, ev_aicb->buf, event.res, event.res2);
+		if (ev_aicb->detached)
+			log_taskd(task, "aio collect %s %p:%p:%p result %ld:%ld detached free",
+				  op_str, ev_aicb, ev_iocb, ev_aicb->buf, event.res, event.res2);
+		else
+			log_taskw(task, "aio collect %s %p:%p:%p result %ld:%ld old free",
+				  op_str, ev_aicb, ev_iocb, ev_aicb->buf, event.res, event.res2);
 		ev_aicb->used = 0;
-		free(ev_aicb->buf);
+		aio_collected(ev_aicb);
+		task_iobuf_free(task, ev_aicb->buf);
 		ev_aicb->buf = NULL;
 		goto find;
 	}
@@ -607,12 +1042,14 @@ static int do_linux_aio(int fd, uint64_t offset, char *buf, int len,
 	struct timespec ts;
 	struct aicb *aicb;
 	struct iocb *iocb;
-	struct io_event event;
+	struct aio_done event;
 	struct timespec begin, end, diff;
+	struct io_sched is;
 	const char *op_str;
 	const char *len_str;
 	char ms_str[8];
 	char off_str[16];
+	uint64_t trace_start;
 	int rv;
 
 	if (!ioto) {
@@ -626,6 +1063,8 @@ static int do_linux_aio(int fd, uint64_t offset, char *buf, int len,
 	if (!aicb)
 		return -ENOENT;
 
+	io_sched_begin(&is, task, &fd, 1, ioto);
+
 	iocb = &aicb->iocb;
 
 	memset(iocb, 0, sizeof(struct iocb));
@@ -655,7 +1094,9 @@ static int do_linux_aio(int fd, uint64_t offset, char *buf, int len,
 	if (ms)
 		clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
 
-	rv = io_submit(task->aio_ctx, 1, &iocb);
+	trace_start = trace_begin();
+
+	rv = task_aio_submit(task, 1, &aicb);
 	if (rv < 0) {
 		log_taske(task, "aio submit %d %p:%p:%p rv %d fd %d",
 			  cmd, aicb, iocb, buf, rv, fd);
@@ -673,7 +1114,7 @@ static int do_linux_aio(int fd, uint64_t offset, char *buf, int len,
  retry:
 	memset(&event, 0, sizeof(event));
 
-	rv = io_getevents(task->aio_ctx, 1, 1, &event, &ts);
+	rv = task_aio_getevents(task, 1, 1, &event, &ts);
 	if (rv == -EINTR)
 		goto retry;
 	if (rv < 0) {
@@ -682,8 +1123,8 @@ static int do_linux_aio(int fd, uint64_t offset, char *buf, int len,
 		goto out;
 	}
 	if (rv == 1) {
-		struct iocb *ev_iocb = event.obj;
-		struct aicb *ev_aicb = container_of(ev_iocb, struct aicb, iocb);
+		struct aicb *ev_aicb = event.aicb;
+		struct iocb *ev_iocb = &ev_aicb->iocb;
 		int op = ev_iocb ? ev_iocb->aio_lio_opcode : -1;
 
 		if (op == IO_CMD_PREAD)
@@ -702,9 +1143,14 @@ static int do_linux_aio(int fd, uint64_t offset, char *buf, int len,
 		ev_aicb->used = 0;
 
 		if (ev_iocb != iocb) {
-			log_taskw(task, "aio collect %s %p:%p:%p result %ld:%ld other free",
-				  op_str, ev_aicb, ev_iocb, ev_aicb->buf, event.res, event.res2);
-			free(ev_aicb->buf);
+			if (ev_aicb->detached)
+				log_taskd(task, "aio collect %s %p:%p:%p result %ld:%ld detached free",
+					  op_str, ev_aicb, ev_iocb, ev_aicb->buf, event.res, event.res2);
+			else
+				log_taskw(task, "aio collect %s %p:%p:%p result %ld:%ld other free",
+					  op_str, ev_aicb, ev_iocb, ev_aicb->buf, event.res, event.res2);
+			aio_collected(ev_aicb);
+			task_iobuf_free(task, ev_aicb->buf);
 			ev_aicb->buf = NULL;
 			goto retry;
 		}
@@ -712,6 +1158,7 @@ static int do_linux_aio(int fd, uint64_t offset, char *buf, int len,
 			log_taskw(task, "aio collect %s %p:%p:%p result %ld:%ld match res",
 				  op_str, ev_aicb, ev_iocb, ev_aicb->buf, event.res, event.res2);
 			rv = event.res;
+			io_error(fd, rv);
 			goto out;
 		}
 		if (event.res != len) {
@@ -767,18 +1214,24 @@ static int do_linux_aio(int fd, uint64_t offset, char *buf, int len,
 	log_taskw(task, "aio timeout %s %p:%p:%p ioto %d to_count %d",
 		  op_str, aicb, iocb, buf, ioto, task->to_count);
 
-	rv = io_cancel(task->aio_ctx, iocb, &event);
+	rv = task_aio_cancel(task, aicb);
 	if (!rv) {
 		aicb->used = 0;
 		rv = -ECANCELED;
 	} else {
 		/* aicb->used and aicb->buf both remain set */
 		rv = SANLK_AIO_TIMEOUT;
+		task_iobuf_aio_held(task, buf);
 
 		if (cmd == IO_CMD_PREAD)
 			task->read_iobuf_timeout_aicb = aicb;
 	}
  out:
+	io_sched_end(&is);
+	trace_event((cmd == IO_CMD_PREAD) ? SANLK_TRACE_AIO_READ : SANLK_TRACE_AIO_WRITE,
+		    0, 0, 0, fd, offset, trace_start, rv);
+	capture_io(task, fd, cmd, offset, len, buf, trace_start, rv);
+	io_stats_add(task, fd, cmd, trace_start, rv);
 	return rv;
 }
 
@@ -794,62 +1247,672 @@ static int do_read_aio_linux(int fd, uint64_t offset, char *buf, int len,
 	return do_linux_aio(fd, offset, buf, len, task, ioto, IO_CMD_PREAD, rd_ms);
 }
 
-/* write aligned io buffer */
+/*
+ * Submit a group of i/os at once, e.g. one to each disk of a lease, and
+ * wait for them.  Waiting ends when "needed" of them have completed
+ * successfully (e.g. a majority of disks), when none remain outstanding,
+ * or when ioto expires.  An i/o still outstanding when waiting ends gets
+ * rv SANLK_AIO_TIMEOUT, and as with a single timed out i/o, its buf now
+ * belongs to the callback slot and is freed when its event is reaped.
+ * If waiting ended because enough i/os completed, the remaining ones are
+ * "detached" and are not counted as timeouts.
+ *
+ * A new write is not submitted to an fd with an earlier write still
+ * outstanding, or to a sector with a detached write from another task
+ * still outstanding, so that an old write cannot land on top of a newer
+ * one.
+ */
 
-int write_iobuf(int fd, uint64_t offset, char *iobuf, int iobuf_len,
-		struct task *task, int ioto, int *wr_ms)
+static int do_linux_aio_group(struct iobuf_io *ios, int count, int needed,
+			      struct task *task, int ioto, int cmd)
 {
-	if (task && task->use_aio)
-		return do_write_aio_linux(fd, offset, iobuf, iobuf_len, task, ioto, wr_ms);
-	else
-		return do_write(fd, offset, iobuf, iobuf_len, task, wr_ms);
-}
+	struct aicb *submit_aicbs[MAX_IOBUF_GROUP];
+	struct aicb *aicbs[MAX_IOBUF_GROUP];
+	struct aio_done events[MAX_IOBUF_GROUP];
+	struct timespec ts, now, end;
+	struct aicb *aicb, *ev_aicb;
+	struct iocb *ev_iocb;
+	const char *op_str = (cmd == IO_CMD_PREAD) ? "RD" : "WR";
+	uint32_t trace_op = (cmd == IO_CMD_PREAD) ? SANLK_TRACE_AIO_READ : SANLK_TRACE_AIO_WRITE;
+	uint64_t trace_start;
+	int submit = 0, outstanding = 0, done = 0;
+	int i, j, rv;
+
+	/* free slots of earlier i/os that have since completed */
+
+	memset(&ts, 0, sizeof(ts));
+	rv = task_aio_getevents(task, 0, MAX_IOBUF_GROUP, events, &ts);
+	for (j = 0; j < rv; j++) {
+		ev_aicb = events[j].aicb;
+		ev_iocb = &ev_aicb->iocb;
+
+		log_taskd(task, "aio collect %p:%p:%p result %ld:%ld %s free",
+			  ev_aicb, ev_iocb, ev_aicb->buf, events[j].res, events[j].res2,
+			  ev_aicb->detached ? "detached" : "old");
 
-static int _write_sectors(const struct sync_disk *disk, int sector_size, uint64_t sector_nr,
-			  uint32_t sector_count GNUC_UNUSED,
-			  const char *data, int data_len, int iobuf_len,
-			  struct task *task, int ioto,
-			  const char *blktype)
-{
-	char *iobuf, **p_iobuf;
-	uint64_t offset;
-	int rv;
+		ev_aicb->used = 0;
+		aio_collected(ev_aicb);
+		task_iobuf_free(task, ev_aicb->buf);
+		ev_aicb->buf = NULL;
+	}
 
-	offset = disk->offset + (sector_nr * sector_size);
+	for (i = 0; i < count; i++) {
+		ios[i].rv = -ENOENT;
+		aicbs[i] = NULL;
+
+		if (cmd == IO_CMD_PWRITE) {
+			for (j = 0; j < task->cb_size; j++) {
+				aicb = &task->callbacks[j];
+				if (aicb->used &&
+				    aicb->iocb.aio_fildes == ios[i].fd &&
+				    aicb->iocb.aio_lio_opcode == IO_CMD_PWRITE)
+					break;
+			}
+			if (j < task->cb_size) {
+				log_taskw(task, "aio group WR fd %d busy with earlier write", ios[i].fd);
+				ios[i].rv = -EBUSY;
+				continue;
+			}
 
-	p_iobuf = &iobuf;
+			if (detached_write_wait(task, ios[i].fd, ios[i].offset, ioto) < 0) {
+				log_taskw(task, "aio group WR fd %d offset %llu busy with detached write",
+					  ios[i].fd, (unsigned long long)ios[i].offset);
+				ios[i].rv = -EBUSY;
+				continue;
+			}
+		}
 
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
-	if (rv) {
-		log_error("write_sectors %s posix_memalign rv %d %s",
-			  blktype, rv, disk->path);
-		rv = -ENOMEM;
-		goto out;
+		for (j = 0; j < task->cb_size; j++) {
+			if (!task->callbacks[j].used)
+				break;
+		}
+		if (j == task->cb_size) {
+			log_taskw(task, "aio group %s no free slot", op_str);
+			continue;
+		}
+
+		aicb = &task->callbacks[j];
+		aicb->used = 1;
+		aicb->detached = 0;
+		aicb->buf = ios[i].iobuf;
+
+		memset(&aicb->iocb, 0, sizeof(struct iocb));
+		aicb->iocb.aio_fildes = ios[i].fd;
+		aicb->iocb.aio_lio_opcode = cmd;
+		aicb->iocb.u.c.buf = ios[i].iobuf;
+		aicb->iocb.u.c.nbytes = ios[i].iobuf_len;
+		aicb->iocb.u.c.offset = ios[i].offset;
+
+		if (com.debug_io_submit)
+			log_taskd(task, "%s %d at %llu fd %d group", op_str, ios[i].iobuf_len,
+				  (unsigned long long)ios[i].offset, ios[i].fd);
+
+		aicbs[i] = aicb;
+		submit_aicbs[submit++] = aicb;
 	}
 
-	memset(iobuf, 0, iobuf_len);
-	memcpy(iobuf, data, data_len);
+	if (!submit)
+		return 0;
 
-	rv = write_iobuf(disk->fd, offset, iobuf, iobuf_len, task, ioto, NULL);
+	trace_start = trace_begin();
+
+	rv = task_aio_submit(task, submit, submit_aicbs);
 	if (rv < 0) {
-		log_error("write_sectors %s offset %llu rv %d %s",
-			  blktype, (unsigned long long)offset, rv, disk->path);
+		log_taske(task, "aio group submit %s %d rv %d", op_str, submit, rv);
+		rv = 0;
 	}
 
-	if (rv != SANLK_AIO_TIMEOUT)
-		free(iobuf);
- out:
-	return rv;
-}
+	/* the first rv i/os were submitted */
 
-/* sector_nr is logical sector number within the sync_disk.
-   the sync_disk itself begins at disk->offset (in bytes) from
-   the start of the block device identified by disk->path,
-   data_len must be <= sector_size */
+	for (i = 0, j = 0; i < count; i++) {
+		if (!aicbs[i])
+			continue;
+		if (j++ < rv) {
+			ios[i].rv = SANLK_AIO_TIMEOUT;
+			outstanding++;
+			task->io_count++;
+		} else {
+			aicbs[i]->used = 0;
+			aicbs[i]->buf = NULL;
+			aicbs[i] = NULL;
+		}
+	}
 
-int write_sector(const struct sync_disk *disk, int sector_size, uint64_t sector_nr,
-		 const char *data, int data_len,
-		 struct task *task, int ioto,
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += ioto;
+
+	while (outstanding && (done < needed)) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ts_diff(&now, &end, &ts);
+		if (ts.tv_sec < 0)
+			break;
+
+		memset(events, 0, sizeof(events));
+
+		rv = task_aio_getevents(task, 1, MAX_IOBUF_GROUP, events, &ts);
+		if (rv == -EINTR)
+			continue;
+		if (rv < 0) {
+			log_taske(task, "aio group getevents %s rv %d", op_str, rv);
+			break;
+		}
+		if (!rv)
+			break;
+
+		for (j = 0; j < rv; j++) {
+			ev_aicb = events[j].aicb;
+			ev_iocb = &ev_aicb->iocb;
+
+			for (i = 0; i < count; i++) {
+				if (aicbs[i] == ev_aicb)
+					break;
+			}
+
+			ev_aicb->used = 0;
+
+			if (i == count) {
+				/* an earlier i/o that is not part of this group */
+				log_taskd(task, "aio collect %p:%p:%p result %ld:%ld %s free",
+					  ev_aicb, ev_iocb, ev_aicb->buf, events[j].res, events[j].res2,
+					  ev_aicb->detached ? "detached" : "other");
+				aio_collected(ev_aicb);
+				task_iobuf_free(task, ev_aicb->buf);
+				ev_aicb->buf = NULL;
+				continue;
+			}
+
+			ev_aicb->buf = NULL;
+			aicbs[i] = NULL;
+			outstanding--;
+
+			if ((int)events[j].res < 0) {
+				log_taskw(task, "aio collect %s %p:%p result %ld:%ld group",
+					  op_str, ev_aicb, ev_iocb, events[j].res, events[j].res2);
+				ios[i].rv = events[j].res;
+				io_error(ios[i].fd, ios[i].rv);
+			} else if (events[j].res != ios[i].iobuf_len) {
+				log_taskw(task, "aio collect %s %p:%p result %ld:%ld group len %d",
+					  op_str, ev_aicb, ev_iocb, events[j].res, events[j].res2,
+					  ios[i].iobuf_len);
+				ios[i].rv = -EMSGSIZE;
+			} else {
+				if (com.debug_io_complete)
+					log_taskd(task, "%s %d at %llu fd %d group done", op_str,
+						  ios[i].iobuf_len, (unsigned long long)ios[i].offset,
+						  ios[i].fd);
+				ios[i].rv = 0;
+				done++;
+			}
+
+			trace_event(trace_op, 0, 0, 0, ios[i].fd, ios[i].offset,
+				    trace_start, ios[i].rv);
+			capture_io(task, ios[i].fd, cmd, ios[i].offset, ios[i].iobuf_len,
+				   ios[i].iobuf, trace_start, ios[i].rv);
+			io_stats_add(task, ios[i].fd, cmd, trace_start, ios[i].rv);
+		}
+	}
+
+	/* aicb->used and aicb->buf remain set for those still outstanding */
+
+	for (i = 0; i < count; i++) {
+		if (!aicbs[i])
+			continue;
+
+		task_iobuf_aio_held(task, ios[i].iobuf);
+
+		trace_event(trace_op, 0, 0, 0, ios[i].fd, ios[i].offset,
+			    trace_start, SANLK_AIO_TIMEOUT);
+		capture_io(task, ios[i].fd, cmd, ios[i].offset, ios[i].iobuf_len,
+			   ios[i].iobuf, trace_start, SANLK_AIO_TIMEOUT);
+		if (done < needed)
+			io_stats_add(task, ios[i].fd, cmd, trace_start, SANLK_AIO_TIMEOUT);
+
+		if (done >= needed) {
+			aicbs[i]->detached = 1;
+			if (cmd == IO_CMD_PWRITE)
+				detached_write_add(aicbs[i], ios[i].fd);
+			log_taskd(task, "aio group %s fd %d detached after %d of %d",
+				  op_str, ios[i].fd, done, count);
+		} else {
+			task->to_count++;
+			log_taskw(task, "aio timeout %s %p:%p:%p ioto %d to_count %d group",
+				  op_str, aicbs[i], &aicbs[i]->iocb, ios[i].iobuf,
+				  ioto, task->to_count);
+		}
+	}
+
+	return done;
+}
+
+static int do_sync_group(struct iobuf_io *ios, int count,
+			 struct task *task, int cmd)
+{
+	int i, done = 0;
+
+	for (i = 0; i < count; i++) {
+		if (cmd == IO_CMD_PWRITE)
+			ios[i].rv = do_write(ios[i].fd, ios[i].offset, ios[i].iobuf,
+					     ios[i].iobuf_len, task, NULL);
+		else
+			ios[i].rv = do_read(ios[i].fd, ios[i].offset, ios[i].iobuf,
+					    ios[i].iobuf_len, task, NULL);
+		if (!ios[i].rv)
+			done++;
+	}
+	return done;
+}
+
+static int do_linux_aio_each(struct iobuf_io *ios, int count,
+			     struct task *task, int ioto, int cmd)
+{
+	int i, done = 0;
+
+	for (i = 0; i < count; i++) {
+		ios[i].rv = do_linux_aio(ios[i].fd, ios[i].offset, ios[i].iobuf,
+					 ios[i].iobuf_len, task, ioto, cmd, NULL);
+		if (!ios[i].rv)
+			done++;
+	}
+	return done;
+}
+
+static int iobuf_group(struct iobuf_io *ios, int count, int needed,
+		       struct task *task, int ioto, int cmd)
+{
+	struct io_sched is;
+	int fds[MAX_IOBUF_GROUP];
+	int i, rv;
+
+	if (!task || !task->use_aio) {
+		rv = do_sync_group(ios, count, task, cmd);
+		goto out;
+	}
+
+	if (!ioto) {
+		log_taske(task, "aio group %d zero io timeout", cmd);
+		rv = 0;
+		goto out;
+	}
+
+	/* one i/o behaves exactly like write_iobuf/read_iobuf */
+
+	if ((count == 1) || (count > MAX_IOBUF_GROUP) || (task->cb_size < count)) {
+		rv = do_linux_aio_each(ios, count, task, ioto, cmd);
+	} else {
+		for (i = 0; i < count; i++)
+			fds[i] = ios[i].fd;
+
+		io_sched_begin(&is, task, fds, count, ioto);
+		rv = do_linux_aio_group(ios, count, needed, task, ioto, cmd);
+		io_sched_end(&is);
+	}
+ out:
+	set_io_op(task, 0);
+	return rv;
+}
+
+int write_iobufs(struct iobuf_io *ios, int count, int needed,
+		 struct task *task, int ioto)
+{
+	return iobuf_group(ios, count, needed, task, ioto, IO_CMD_PWRITE);
+}
+
+int read_iobufs(struct iobuf_io *ios, int count, int needed,
+		struct task *task, int ioto)
+{
+	return iobuf_group(ios, count, needed, task, ioto, IO_CMD_PREAD);
+}
+
+/*
+ * Read size tuning.  The host_id area and the dblock area are each read
+ * with one i/o, which some devices complete more slowly than the same
+ * area read with a few smaller i/os in parallel.  When a lockspace is
+ * added, io_tune_calibrate() times reads of each area on the lockspace
+ * device with one i/o and with 2 and 4 parallel i/os, and records the
+ * number of i/os (the split) that was fastest for the device.  A split
+ * is only used when it beats one i/o by IO_TUNE_MARGIN percent.  A device
+ * is identified as in io_sched.  The host_id_read_split and
+ * dblock_read_split config settings replace the calibrated values.
+ */
+
+#define IO_TUNE_DEVS 64
+#define IO_TUNE_ROUNDS 4
+#define IO_TUNE_MARGIN 10
+#define IO_TUNE_MIN_LEN 4096
+
+struct io_tune_dev {
+	dev_t dev;
+	int used;
+	struct io_tune tune;
+};
+
+static struct io_tune_dev io_tune_devs[IO_TUNE_DEVS];
+static pthread_mutex_t io_tune_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int fd_dev(int fd, dev_t *dev)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) < 0)
+		return errno ? -errno : -EIO;
+	*dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+	return 0;
+}
+
+static struct io_tune_dev *io_tune_find(dev_t dev)
+{
+	int i;
+
+	for (i = 0; i < IO_TUNE_DEVS; i++) {
+		if (io_tune_devs[i].used && io_tune_devs[i].dev == dev)
+			return &io_tune_devs[i];
+	}
+	return NULL;
+}
+
+static int free_callback_count(struct task *task)
+{
+	int i, count = 0;
+
+	for (i = 0; i < task->cb_size; i++) {
+		if (!task->callbacks[i].used)
+			count++;
+	}
+	return count;
+}
+
+/*
+ * Read iobuf with split parallel i/os.  With a split of 2 or more, each
+ * i/o reads into a buffer of its own which is copied into iobuf, so a
+ * timed out i/o does not leave iobuf owned by the aio, and the caller
+ * does not reap it.  A split of 1 is read_iobuf.
+ */
+
+int read_iobuf_split(int fd, uint64_t offset, char *iobuf, int iobuf_len,
+		     int split, struct task *task, int ioto, int *rd_ms)
+{
+	struct iobuf_io ios[IO_TUNE_MAX_SPLIT];
+	struct timespec begin, end;
+	int chunk_len, num, i, rv = 0;
+
+	if (split < 2 || !task)
+		return read_iobuf(fd, offset, iobuf, iobuf_len, task, ioto, rd_ms);
+
+	if (split > IO_TUNE_MAX_SPLIT)
+		split = IO_TUNE_MAX_SPLIT;
+
+	/* still one i/o into a buffer of its own */
+	if ((iobuf_len % (split * IO_TUNE_MIN_LEN)) ||
+	    (task->use_aio && free_callback_count(task) < split))
+		split = 1;
+
+	chunk_len = iobuf_len / split;
+
+	for (num = 0; num < split; num++) {
+		ios[num].fd = fd;
+		ios[num].offset = offset + ((uint64_t)num * chunk_len);
+		ios[num].iobuf_len = chunk_len;
+		ios[num].rv = 0;
+
+		if (task_iobuf_alloc(task, chunk_len, &ios[num].iobuf)) {
+			rv = -ENOMEM;
+			goto out;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	read_iobufs(ios, num, num, task, ioto);
+
+	if (rd_ms) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		*rd_ms = ((end.tv_sec - begin.tv_sec) * 1000) +
+			 ((end.tv_nsec - begin.tv_nsec) / 1000000);
+	}
+
+	for (i = 0; i < num; i++) {
+		if (!ios[i].rv)
+			memcpy(iobuf + ((uint64_t)i * chunk_len), ios[i].iobuf, chunk_len);
+		else if (!rv || ios[i].rv == SANLK_AIO_TIMEOUT)
+			rv = ios[i].rv;
+	}
+ out:
+	for (i = 0; i < num; i++) {
+		if (ios[i].rv != SANLK_AIO_TIMEOUT)
+			task_iobuf_free(task, ios[i].iobuf);
+	}
+	return rv;
+}
+
+/* the median time in usec of IO_TUNE_ROUNDS reads */
+
+static int time_split_read(struct task *task, struct sync_disk *disk, char *iobuf,
+			   int len, int split, int ioto, uint32_t *us_ret)
+{
+	uint32_t us[IO_TUNE_ROUNDS], tmp;
+	struct timespec begin, end;
+	int i, j, rv;
+
+	for (i = 0; i < IO_TUNE_ROUNDS; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		rv = read_iobuf_split(disk->fd, disk->offset, iobuf, len, split, task, ioto, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (rv)
+			return rv;
+
+		us[i] = ((end.tv_sec - begin.tv_sec) * 1000000) +
+			((end.tv_nsec - begin.tv_nsec) / 1000);
+		if (!us[i])
+			us[i] = 1;
+	}
+
+	for (i = 1; i < IO_TUNE_ROUNDS; i++) {
+		for (j = i; j > 0 && us[j - 1] > us[j]; j--) {
+			tmp = us[j];
+			us[j] = us[j - 1];
+			us[j - 1] = tmp;
+		}
+	}
+	*us_ret = us[IO_TUNE_ROUNDS / 2];
+	return 0;
+}
+
+static int calibrate_area(struct task *task, struct sync_disk *disk, char *iobuf,
+			  int len, int ioto, uint32_t *us, int *split_ret)
+{
+	int split, s, rv, best = 0;
+
+	for (s = 0, split = 1; s < IO_TUNE_SPLITS; s++, split *= 2) {
+		us[s] = 0;
+
+		if (split > 1 && (len % (split * IO_TUNE_MIN_LEN)))
+			continue;
+
+		rv = time_split_read(task, disk, iobuf, len, split, ioto, &us[s]);
+		if (rv)
+			return rv;
+	}
+
+	for (s = 1; s < IO_TUNE_SPLITS; s++) {
+		if (!us[s])
+			continue;
+		if ((uint64_t)us[s] * 100 >= (uint64_t)us[0] * (100 - IO_TUNE_MARGIN))
+			continue;
+		if (!best || us[s] < us[best])
+			best = s;
+	}
+	*split_ret = 1 << best;
+	return 0;
+}
+
+/*
+ * The iobuf must be able to hold host_id_len and dblock_len.  A device
+ * that has already been calibrated is not calibrated again.  A failed
+ * read ends the calibration, leaving the device uncalibrated, and when
+ * it is SANLK_AIO_TIMEOUT, the caller must not free iobuf.
+ */
+
+int io_tune_calibrate(struct task *task, struct sync_disk *disk, char *iobuf,
+		      int host_id_len, int dblock_len, int ioto)
+{
+	struct io_tune_dev *td;
+	struct io_tune tune;
+	dev_t dev = 0;
+	int i, rv;
+
+	rv = fd_dev(disk->fd, &dev);
+	if (rv < 0)
+		return rv;
+
+	pthread_mutex_lock(&io_tune_mutex);
+	td = io_tune_find(dev);
+	pthread_mutex_unlock(&io_tune_mutex);
+	if (td)
+		return 0;
+
+	memset(&tune, 0, sizeof(tune));
+
+	tune.host_id_len = host_id_len;
+	rv = calibrate_area(task, disk, iobuf, host_id_len, ioto, tune.host_id_us, &tune.host_id_split);
+	if (rv)
+		return rv;
+
+	tune.dblock_len = dblock_len;
+	if (dblock_len == host_id_len) {
+		tune.dblock_split = tune.host_id_split;
+		memcpy(tune.dblock_us, tune.host_id_us, sizeof(tune.dblock_us));
+	} else {
+		rv = calibrate_area(task, disk, iobuf, dblock_len, ioto, tune.dblock_us, &tune.dblock_split);
+		if (rv)
+			return rv;
+	}
+
+	log_taskd(task, "io_tune %s host_id %d us %u %u %u split %d dblock %d us %u %u %u split %d",
+		  disk->path,
+		  host_id_len, tune.host_id_us[0], tune.host_id_us[1], tune.host_id_us[2], tune.host_id_split,
+		  dblock_len, tune.dblock_us[0], tune.dblock_us[1], tune.dblock_us[2], tune.dblock_split);
+
+	pthread_mutex_lock(&io_tune_mutex);
+	if (!io_tune_find(dev)) {
+		for (i = 0; i < IO_TUNE_DEVS; i++) {
+			if (io_tune_devs[i].used)
+				continue;
+			io_tune_devs[i].used = 1;
+			io_tune_devs[i].dev = dev;
+			memcpy(&io_tune_devs[i].tune, &tune, sizeof(tune));
+			break;
+		}
+	}
+	pthread_mutex_unlock(&io_tune_mutex);
+	return 0;
+}
+
+/* copy the tuning of the device of fd, returns 0 if it was calibrated */
+
+int io_tune_get(int fd, struct io_tune *tune)
+{
+	struct io_tune_dev *td;
+	dev_t dev;
+	int rv = -ENOENT;
+
+	memset(tune, 0, sizeof(struct io_tune));
+	tune->host_id_split = 1;
+	tune->dblock_split = 1;
+
+	if (fd >= 0 && !fd_dev(fd, &dev)) {
+		pthread_mutex_lock(&io_tune_mutex);
+		td = io_tune_find(dev);
+		if (td) {
+			memcpy(tune, &td->tune, sizeof(struct io_tune));
+			rv = 0;
+		}
+		pthread_mutex_unlock(&io_tune_mutex);
+	}
+
+	if (com.host_id_read_split)
+		tune->host_id_split = com.host_id_read_split;
+	if (com.dblock_read_split)
+		tune->dblock_split = com.dblock_read_split;
+	return rv;
+}
+
+int io_tune_split(int fd, int area)
+{
+	struct io_tune tune;
+
+	if (area == IO_TUNE_HOST_ID && com.host_id_read_split)
+		return com.host_id_read_split;
+	if (area == IO_TUNE_DBLOCK && com.dblock_read_split)
+		return com.dblock_read_split;
+	if (!com.io_tune)
+		return 1;
+
+	io_tune_get(fd, &tune);
+
+	return (area == IO_TUNE_HOST_ID) ? tune.host_id_split : tune.dblock_split;
+}
+
+/* write aligned io buffer */
+
+int write_iobuf(int fd, uint64_t offset, char *iobuf, int iobuf_len,
+		struct task *task, int ioto, int *wr_ms)
+{
+	int rv;
+
+	if (task && task->use_aio)
+		rv = do_write_aio_linux(fd, offset, iobuf, iobuf_len, task, ioto, wr_ms);
+	else
+		rv = do_write(fd, offset, iobuf, iobuf_len, task, wr_ms);
+
+	set_io_op(task, 0);
+	return rv;
+}
+
+static int _write_sectors(const struct sync_disk *disk, int sector_size, uint64_t sector_nr,
+			  uint32_t sector_count GNUC_UNUSED,
+			  const char *data, int data_len, int iobuf_len,
+			  struct task *task, int ioto,
+			  const char *blktype)
+{
+	char *iobuf, **p_iobuf;
+	uint64_t offset;
+	int rv;
+
+	offset = disk->offset + (sector_nr * sector_size);
+
+	p_iobuf = &iobuf;
+
+	rv = task_iobuf_alloc(task, iobuf_len, p_iobuf);
+	if (rv) {
+		log_error("write_sectors %s iobuf alloc rv %d %s",
+			  blktype, rv, disk->path);
+		rv = -ENOMEM;
+		goto out;
+	}
+
+	memset(iobuf, 0, iobuf_len);
+	memcpy(iobuf, data, data_len);
+
+	rv = write_iobuf(disk->fd, offset, iobuf, iobuf_len, task, ioto, NULL);
+	if (rv < 0) {
+		log_error("write_sectors %s offset %llu rv %d %s",
+			  blktype, (unsigned long long)offset, rv, disk->path);
+	}
+
+	if (rv != SANLK_AIO_TIMEOUT)
+		task_iobuf_free(task, iobuf);
+ out:
+	return rv;
+}
+
+/* sector_nr is logical sector number within the sync_disk.
+   the sync_disk itself begins at disk->offset (in bytes) from
+   the start of the block device identified by disk->path,
+   data_len must be <= sector_size */
+
+int write_sector(const struct sync_disk *disk, int sector_size, uint64_t sector_nr,
+		 const char *data, int data_len,
+		 struct task *task, int ioto,
 		 const char *blktype)
 {
 	int iobuf_len = sector_size;
@@ -898,10 +1961,15 @@ int write_sectors(const struct sync_disk *disk, int sector_size, uint64_t sector
 int read_iobuf(int fd, uint64_t offset, char *iobuf, int iobuf_len,
 	       struct task *task, int ioto, int *rd_ms)
 {
+	int rv;
+
 	if (task && task->use_aio)
-		return do_read_aio_linux(fd, offset, iobuf, iobuf_len, task, ioto, rd_ms);
+		rv = do_read_aio_linux(fd, offset, iobuf, iobuf_len, task, ioto, rd_ms);
 	else
-		return do_read(fd, offset, iobuf, iobuf_len, task, rd_ms);
+		rv = do_read(fd, offset, iobuf, iobuf_len, task, rd_ms);
+
+	set_io_op(task, 0);
+	return rv;
 }
 
 /* read sector_count sectors starting with sector_nr, where sector_nr
@@ -930,9 +1998,9 @@ int read_sectors(const struct sync_disk *disk, int sector_size, uint64_t sector_
 
 	p_iobuf = &iobuf;
 
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
+	rv = task_iobuf_alloc(task, iobuf_len, p_iobuf);
 	if (rv) {
-		log_error("read_sectors %s posix_memalign rv %d %s",
+		log_error("read_sectors %s iobuf alloc rv %d %s",
 			  blktype, rv, disk->path);
 		rv = -ENOMEM;
 		goto out;
@@ -940,7 +2008,10 @@ int read_sectors(const struct sync_disk *disk, int sector_size, uint64_t sector_
 
 	memset(iobuf, 0, iobuf_len);
 
-	rv = read_iobuf(disk->fd, offset, iobuf, iobuf_len, task, ioto, NULL);
+	if (task && task->read_shared)
+		rv = read_flight(disk->path, disk->fd, offset, iobuf, iobuf_len, task, ioto);
+	else
+		rv = read_iobuf(disk->fd, offset, iobuf, iobuf_len, task, ioto, NULL);
 	if (!rv) {
 		memcpy(data, iobuf, data_len);
 	} else {
@@ -949,7 +2020,7 @@ int read_sectors(const struct sync_disk *disk, int sector_size, uint64_t sector_
 	}
 
 	if (rv != SANLK_AIO_TIMEOUT)
-		free(iobuf);
+		task_iobuf_free(task, iobuf);
  out:
 	return rv;
 }
@@ -964,7 +2035,7 @@ int read_iobuf_reap(int fd, uint64_t offset, char *iobuf, int iobuf_len,
 	struct timespec ts;
 	struct aicb *aicb;
 	struct iocb *iocb;
-	struct io_event event;
+	struct aio_done event;
 	int rv;
 
 	aicb = task->read_iobuf_timeout_aicb;
@@ -989,7 +2060,7 @@ int read_iobuf_reap(int fd, uint64_t offset, char *iobuf, int iobuf_len,
  retry:
 	memset(&event, 0, sizeof(event));
 
-	rv = io_getevents(task->aio_ctx, 1, 1, &event, &ts);
+	rv = task_aio_getevents(task, 1, 1, &event, &ts);
 	if (rv == -EINTR)
 		goto retry;
 	if (rv < 0) {
@@ -998,8 +2069,8 @@ int read_iobuf_reap(int fd, uint64_t offset, char *iobuf, int iobuf_len,
 		goto out;
 	}
 	if (rv == 1) {
-		struct iocb *ev_iocb = event.obj;
-		struct aicb *ev_aicb = container_of(ev_iocb, struct aicb, iocb);
+		struct aicb *ev_aicb = event.aicb;
+		struct iocb *ev_iocb = &ev_aicb->iocb;
 		int op = ev_iocb ? ev_iocb->aio_lio_opcode : -1;
 		const char *op_str;
 
@@ -1015,7 +2086,8 @@ int read_iobuf_reap(int fd, uint64_t offset, char *iobuf, int iobuf_len,
 		if (ev_iocb != iocb) {
 			log_taskw(task, "aio collect %s %p:%p:%p result %ld:%ld other free r",
 				  op_str, ev_aicb, ev_iocb, ev_aicb->buf, event.res, event.res2);
-			free(ev_aicb->buf);
+			aio_collected(ev_aicb);
+			task_iobuf_free(task, ev_aicb->buf);
 			ev_aicb->buf = NULL;
 			goto retry;
 		}
@@ -1023,6 +2095,7 @@ int read_iobuf_reap(int fd, uint64_t offset, char *iobuf, int iobuf_len,
 			log_taskw(task, "aio collect %s %p:%p:%p result %ld:%ld match res r",
 				  op_str, ev_aicb, ev_iocb, ev_aicb->buf, event.res, event.res2);
 			rv = event.res;
+			io_error(fd, rv);
 			goto out;
 		}
 		if (event.res != iobuf_len) {
@@ -1045,3 +2118,434 @@ int read_iobuf_reap(int fd, uint64_t offset, char *iobuf, int iobuf_len,
 	return rv;
 }
 
+
+/*
+ * renewal_multipath: the delta lease renewal of a lockspace on a
+ * dm-multipath device also uses the underlying paths of the device
+ * (the "slaves" of the dm device in sysfs), opened directly.  path[0]
+ * is the multipath device itself, using the fd of the lockspace disk.
+ *
+ * Each path keeps an average latency and a count of consecutive
+ * failures.  A renewal read goes to the path with the lowest score, and
+ * if it has not completed within renewal_hedge_ms, the same read is
+ * submitted on the next best path, and the first to complete is used.
+ * Both reads use their own buffers, so a read that is left outstanding
+ * is detached and its buffer freed when it is reaped, like the slower
+ * disks of a group.  The reads together are limited by the io timeout
+ * from the first submission, as a single read is.
+ *
+ * A renewal write goes to the best path, but while an earlier write from
+ * the task is still outstanding on one of the paths, the new write goes
+ * to that same path so that the old write cannot land after the new one.
+ */
+
+int lease_paths_open(struct sync_disk *disk, struct lease_paths **lp_ret)
+{
+	char sysdir[64];
+	char path[PATH_MAX];
+	char uuid[64];
+	struct lease_paths *lp;
+	struct lease_path *p;
+	struct dirent *de;
+	struct stat st;
+	DIR *dir;
+	FILE *file;
+	size_t len;
+	int fd, rv;
+
+	*lp_ret = NULL;
+
+	if (fstat(disk->fd, &st) < 0 || !S_ISBLK(st.st_mode))
+		return 0;
+
+	snprintf(sysdir, sizeof(sysdir), "/sys/dev/block/%u:%u",
+		 major(st.st_rdev), minor(st.st_rdev));
+
+	rv = snprintf(path, sizeof(path), "%s/dm/uuid", sysdir);
+	if (rv < 0 || rv >= (int)sizeof(path))
+		return 0;
+	file = fopen(path, "r");
+	if (!file)
+		return 0;
+	memset(uuid, 0, sizeof(uuid));
+	if (!fgets(uuid, sizeof(uuid), file))
+		uuid[0] = '\0';
+	fclose(file);
+
+	if (strncmp(uuid, "mpath-", 6))
+		return 0;
+
+	rv = snprintf(path, sizeof(path), "%s/slaves", sysdir);
+	if (rv < 0 || rv >= (int)sizeof(path))
+		return 0;
+	dir = opendir(path);
+	if (!dir)
+		return 0;
+
+	lp = calloc(1, sizeof(struct lease_paths));
+	if (!lp) {
+		closedir(dir);
+		return -ENOMEM;
+	}
+
+	p = &lp->path[lp->count++];
+	p->fd = disk->fd;
+	snprintf(p->name, sizeof(p->name), "dm-%u", minor(st.st_rdev));
+
+	while ((de = readdir(dir)) && lp->count < MAX_LEASE_PATHS) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		len = strlen(de->d_name);
+		if (len >= sizeof(p->name)) {
+			log_warn("lease path name too long %s for %s", de->d_name, disk->path);
+			continue;
+		}
+
+		rv = snprintf(path, sizeof(path), "/dev/%s", de->d_name);
+		if (rv < 0 || rv >= (int)sizeof(path))
+			continue;
+
+		fd = open(path, O_RDWR | O_DIRECT | O_SYNC | O_CLOEXEC, 0);
+		if (fd < 0) {
+			log_warn("lease path open error %d %s for %s", errno, path, disk->path);
+			continue;
+		}
+		io_stats_open(fd, path);
+
+		p = &lp->path[lp->count++];
+		p->fd = fd;
+		memcpy(p->name, de->d_name, len + 1);
+	}
+	closedir(dir);
+
+	if (lp->count < 2) {
+		free(lp);
+		return 0;
+	}
+
+	log_debug("lease paths %d for %s", lp->count - 1, disk->path);
+
+	*lp_ret = lp;
+	return 0;
+}
+
+void lease_paths_close(struct lease_paths *lp)
+{
+	int i;
+
+	if (!lp)
+		return;
+
+	/* path[0] is the fd of the lockspace disk, closed with the disk */
+
+	for (i = 1; i < lp->count; i++) {
+		io_stats_close(lp->path[i].fd);
+		close(lp->path[i].fd);
+	}
+	free(lp);
+}
+
+static uint64_t path_score(struct lease_path *p)
+{
+	return p->ewma_us + (uint64_t)p->fails * 1000000;
+}
+
+/* the best path, other than skip */
+
+static int best_path(struct lease_paths *lp, int skip)
+{
+	int i, best = -1;
+
+	for (i = 0; i < lp->count; i++) {
+		if (i == skip)
+			continue;
+		if (best < 0 || path_score(&lp->path[i]) < path_score(&lp->path[best]))
+			best = i;
+	}
+	return best;
+}
+
+static void path_done(struct lease_path *p, int rv, uint64_t us)
+{
+	p->ios++;
+
+	if (!rv) {
+		p->fails = 0;
+		p->ewma_us = p->ewma_us ? (p->ewma_us * 7 + us) / 8 : us;
+	} else {
+		p->fails++;
+	}
+}
+
+const char *lease_paths_best(struct lease_paths *lp)
+{
+	return lp->path[best_path(lp, -1)].name;
+}
+
+static uint64_t ts_us(struct timespec *a, struct timespec *b)
+{
+	struct timespec diff;
+
+	ts_diff(a, b, &diff);
+	return (diff.tv_sec * 1000000) + (diff.tv_nsec / 1000);
+}
+
+static int ts_before(struct timespec *a, struct timespec *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec;
+	return a->tv_nsec < b->tv_nsec;
+}
+
+static struct aicb *free_callback_slot(struct task *task)
+{
+	int i;
+
+	for (i = 0; i < task->cb_size; i++) {
+		if (!task->callbacks[i].used)
+			return &task->callbacks[i];
+	}
+	return NULL;
+}
+
+static int submit_path_read(struct lease_paths *lp, int pi, uint64_t offset,
+			    int len, struct task *task, struct aicb **aicb_ret,
+			    char **buf_ret)
+{
+	struct aicb *aicb;
+	char *buf;
+	int rv;
+
+	aicb = free_callback_slot(task);
+	if (!aicb)
+		return -ENOENT;
+
+	if (task_iobuf_alloc(task, len, &buf))
+		return -ENOMEM;
+
+	memset(&aicb->iocb, 0, sizeof(struct iocb));
+	aicb->iocb.aio_fildes = lp->path[pi].fd;
+	aicb->iocb.aio_lio_opcode = IO_CMD_PREAD;
+	aicb->iocb.u.c.buf = buf;
+	aicb->iocb.u.c.nbytes = len;
+	aicb->iocb.u.c.offset = offset;
+
+	if (com.debug_io_submit)
+		log_taskd(task, "RD %d at %llu path %s", len,
+			  (unsigned long long)offset, lp->path[pi].name);
+
+	rv = task_aio_submit(task, 1, &aicb);
+	if (rv != 1) {
+		log_taske(task, "aio submit path %s rv %d", lp->path[pi].name, rv);
+		task_iobuf_free(task, buf);
+		return rv < 0 ? rv : -EIO;
+	}
+
+	task->io_count++;
+	aicb->used = 1;
+	aicb->detached = 0;
+	aicb->buf = buf;
+
+	*aicb_ret = aicb;
+	*buf_ret = buf;
+	return 0;
+}
+
+int read_iobuf_paths(struct lease_paths *lp, uint64_t offset, char *iobuf,
+		     int iobuf_len, struct task *task, int ioto, int hedge_ms,
+		     int *rd_ms)
+{
+	struct aicb *aicbs[2] = { NULL, NULL };
+	struct aio_done events[MAX_IOBUF_GROUP];
+	struct timespec begin, now, end, hedge, submitted[2], ts;
+	struct aicb *ev_aicb;
+	struct io_sched is;
+	char *bufs[2] = { NULL, NULL };
+	uint64_t trace_start;
+	int pis[2] = { -1, -1 };
+	int n = 0, outstanding = 0;
+	int result = SANLK_AIO_TIMEOUT;
+	int i, j, rv;
+
+	if (!ioto || !task->use_aio)
+		return read_iobuf(lp->path[0].fd, offset, iobuf, iobuf_len, task, ioto, rd_ms);
+
+	io_sched_begin(&is, task, &lp->path[0].fd, 1, ioto);
+
+	trace_start = trace_begin();
+
+	/* free slots of earlier reads that have since completed */
+
+	memset(&ts, 0, sizeof(ts));
+	rv = task_aio_getevents(task, 0, MAX_IOBUF_GROUP, events, &ts);
+	for (j = 0; j < rv; j++) {
+		ev_aicb = events[j].aicb;
+		ev_aicb->used = 0;
+		aio_collected(ev_aicb);
+		task_iobuf_free(task, ev_aicb->buf);
+		ev_aicb->buf = NULL;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	end = begin;
+	end.tv_sec += ioto;
+	hedge = begin;
+	hedge.tv_sec += hedge_ms / 1000;
+	hedge.tv_nsec += (hedge_ms % 1000) * 1000000;
+	if (hedge.tv_nsec >= 1000000000) {
+		hedge.tv_sec++;
+		hedge.tv_nsec -= 1000000000;
+	}
+
+	pis[0] = best_path(lp, -1);
+	pis[1] = best_path(lp, pis[0]);
+
+ submit:
+	rv = submit_path_read(lp, pis[n], offset, iobuf_len, task, &aicbs[n], &bufs[n]);
+	clock_gettime(CLOCK_MONOTONIC, &submitted[n]);
+	if (rv < 0) {
+		path_done(&lp->path[pis[n]], rv, 0);
+		result = rv;
+	} else {
+		outstanding++;
+	}
+	n++;
+
+	while (1) {
+		if (!outstanding && n == 2)
+			break;
+
+		/* the first read failed to submit or failed */
+		if (!outstanding && n == 1)
+			goto submit;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		if (!ts_before(&now, &end))
+			break;
+
+		/* hedge the read on the next best path */
+		if (n == 1 && !ts_before(&now, &hedge))
+			goto submit;
+
+		ts_diff(&now, (n == 1 && ts_before(&hedge, &end)) ? &hedge : &end, &ts);
+
+		memset(events, 0, sizeof(events));
+
+		rv = task_aio_getevents(task, 1, MAX_IOBUF_GROUP, events, &ts);
+		if (rv == -EINTR)
+			continue;
+		if (rv < 0) {
+			log_taske(task, "aio paths getevents rv %d", rv);
+			result = rv;
+			break;
+		}
+		if (!rv)
+			continue;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		for (j = 0; j < rv; j++) {
+			ev_aicb = events[j].aicb;
+			ev_aicb->used = 0;
+
+			for (i = 0; i < n; i++) {
+				if (aicbs[i] == ev_aicb)
+					break;
+			}
+
+			if (i == n) {
+				/* an earlier i/o that is not part of this read */
+				aio_collected(ev_aicb);
+				task_iobuf_free(task, ev_aicb->buf);
+				ev_aicb->buf = NULL;
+				continue;
+			}
+
+			aicbs[i] = NULL;
+			ev_aicb->buf = NULL;
+			outstanding--;
+
+			if (!result) {
+				/* the other read already completed */
+				task_iobuf_free(task, bufs[i]);
+				continue;
+			}
+
+			if (events[j].res == iobuf_len) {
+				path_done(&lp->path[pis[i]], 0, ts_us(&submitted[i], &now));
+				if (i)
+					lp->path[pis[i]].hedges++;
+				memcpy(iobuf, bufs[i], iobuf_len);
+				result = 0;
+			} else {
+				log_taskw(task, "aio collect RD path %s result %ld:%ld",
+					  lp->path[pis[i]].name, events[j].res, events[j].res2);
+				path_done(&lp->path[pis[i]], -EIO, 0);
+				result = ((int)events[j].res < 0) ? (int)events[j].res : -EMSGSIZE;
+			}
+			task_iobuf_free(task, bufs[i]);
+		}
+
+		if (!result)
+			break;
+	}
+
+	/* reads still outstanding keep their slot and buffer until reaped */
+
+	for (i = 0; i < n; i++) {
+		if (!aicbs[i])
+			continue;
+
+		task_iobuf_aio_held(task, bufs[i]);
+		aicbs[i]->detached = 1;
+
+		if (result) {
+			path_done(&lp->path[pis[i]], SANLK_AIO_TIMEOUT, 0);
+			task->to_count++;
+			log_taskw(task, "aio timeout RD path %s ioto %d to_count %d",
+				  lp->path[pis[i]].name, ioto, task->to_count);
+			result = SANLK_AIO_TIMEOUT;
+		}
+	}
+
+	if (rd_ms) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		*rd_ms = ts_us(&begin, &now) / 1000;
+	}
+
+	io_sched_end(&is);
+	trace_event(SANLK_TRACE_AIO_READ, 0, 0, 0, lp->path[0].fd, offset, trace_start, result);
+	capture_io(task, lp->path[0].fd, IO_CMD_PREAD, offset, iobuf_len, iobuf,
+		   trace_start, result);
+	io_stats_add(task, lp->path[0].fd, IO_CMD_PREAD, trace_start, result);
+	return result;
+}
+
+int write_iobuf_paths(struct lease_paths *lp, uint64_t offset, char *iobuf,
+		      int iobuf_len, struct task *task, int ioto, int *wr_ms)
+{
+	struct timespec begin, end;
+	struct aicb *aicb;
+	int pi, i, j, rv;
+
+	pi = best_path(lp, -1);
+
+	for (j = 0; j < task->cb_size; j++) {
+		aicb = &task->callbacks[j];
+		if (!aicb->used || aicb->iocb.aio_lio_opcode != IO_CMD_PWRITE)
+			continue;
+		for (i = 0; i < lp->count; i++) {
+			if (aicb->iocb.aio_fildes == lp->path[i].fd)
+				pi = i;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	rv = write_iobuf(lp->path[pi].fd, offset, iobuf, iobuf_len, task, ioto, wr_ms);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	path_done(&lp->path[pi], rv, ts_us(&begin, &end));
+	return rv;
+}
@@ -11,6 +11,7 @@
 
 void offset_to_str(unsigned long long offset, int buflen, char *off_str);
 
+void close_disk_fd(int fd);
 void close_disks(struct sync_disk *disks, int num_disks);
 int open_disk(struct sync_disk *disks);
 int open_disks(struct sync_disk *disks, int num_disks);
@@ -18,6 +19,9 @@ int open_disks_fd(struct sync_disk *disks, int num_disks);
 int majority_disks(int num_disks, int num);
 
 int read_sysfs_size(const char *path, const char *name, unsigned int *val);
+
+void set_renewal_ioprio(void);
+void get_io_sched_stats(uint64_t *waits, uint64_t *wait_ms, uint64_t *wait_timeouts);
 int set_max_sectors_kb(struct sync_disk *disk, uint32_t max_sectors_kb);
 int get_max_sectors_kb(struct sync_disk *disk, uint32_t *max_sectors_kb);
 
@@ -32,9 +36,96 @@ int write_iobuf(int fd, uint64_t offset, char *iobuf, int iobuf_len,
 int read_iobuf(int fd, uint64_t offset, char *iobuf, int iobuf_len,
 	       struct task *task, int ioto, int *rd_ms);
 
+/*
+ * One of a group of i/os submitted together by write_iobufs/read_iobufs,
+ * e.g. one i/o per disk of a lease.  Each returns the number of i/os that
+ * completed successfully, and sets rv for each.  When rv is
+ * SANLK_AIO_TIMEOUT, the caller must not free iobuf.
+ */
+
+#define MAX_IOBUF_GROUP SANLK_MAX_DISKS
+
+struct iobuf_io {
+	int fd;
+	int iobuf_len;
+	uint64_t offset;
+	char *iobuf;
+	int rv;
+};
+
+int write_iobufs(struct iobuf_io *ios, int count, int needed,
+		 struct task *task, int ioto);
+
+int read_iobufs(struct iobuf_io *ios, int count, int needed,
+		struct task *task, int ioto);
+
 int read_iobuf_reap(int fd, uint64_t offset, char *iobuf, int iobuf_len,
 		    struct task *task, uint32_t ioto_msec);
 
+void aio_collected(struct aicb *aicb);
+void reap_detached_aio(struct task *task, int ioto);
+
+/*
+ * The number of parallel i/os used to read the host_id area and the
+ * dblock area of a device, see io_tune_calibrate.  The usec for each
+ * split (1, 2, 4) were measured by the calibration.
+ */
+
+#define IO_TUNE_HOST_ID 0
+#define IO_TUNE_DBLOCK  1
+#define IO_TUNE_SPLITS  3
+#define IO_TUNE_MAX_SPLIT 4
+
+struct io_tune {
+	int host_id_len;
+	int host_id_split;
+	uint32_t host_id_us[IO_TUNE_SPLITS];
+	int dblock_len;
+	int dblock_split;
+	uint32_t dblock_us[IO_TUNE_SPLITS];
+};
+
+int read_iobuf_split(int fd, uint64_t offset, char *iobuf, int iobuf_len,
+		     int split, struct task *task, int ioto, int *rd_ms);
+
+int io_tune_calibrate(struct task *task, struct sync_disk *disk, char *iobuf,
+		      int host_id_len, int dblock_len, int ioto);
+
+int io_tune_get(int fd, struct io_tune *tune);
+
+int io_tune_split(int fd, int area);
+
+/*
+ * The paths of a dm-multipath lockspace disk used for renewal i/o,
+ * see renewal_multipath.  path[0] is the multipath device itself.
+ */
+
+#define MAX_LEASE_PATHS 8
+
+struct lease_path {
+	int fd;
+	char name[32];
+	uint32_t ewma_us;	/* average latency of successful i/o */
+	uint32_t fails;		/* consecutive failed or timed out i/o */
+	uint64_t ios;
+	uint64_t hedges;	/* hedged reads completed first on this path */
+};
+
+struct lease_paths {
+	int count;
+	struct lease_path path[MAX_LEASE_PATHS];
+};
+
+int lease_paths_open(struct sync_disk *disk, struct lease_paths **lp_ret);
+void lease_paths_close(struct lease_paths *lp);
+const char *lease_paths_best(struct lease_paths *lp);
+
+int read_iobuf_paths(struct lease_paths *lp, uint64_t offset, char *iobuf,
+		     int iobuf_len, struct task *task, int ioto, int hedge_ms,
+		     int *rd_ms);
+int write_iobuf_paths(struct lease_paths *lp, uint64_t offset, char *iobuf,
+		      int iobuf_len, struct task *task, int ioto, int *wr_ms);
+
 /*
  * sector functions allocate an iobuf themselves, copy into it for read, use it
  * for io, copy out of it for write, and free it
@@ -0,0 +1,195 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "sanlock_internal.h"
+#include "log.h"
+#include "monotime.h"
+#include "fdcache.h"
+#include "diskio.h"
+#include "simdisk.h"
+
+/*
+ * An entry is found by the path and the device and inode that the path
+ * currently refers to, so a path that is changed to refer to a different
+ * disk gets a new fd.  The old entry remains until its users are done.
+ * All i/o on the disks uses explicit offsets, so one fd is safely used
+ * by any number of threads at once.
+ *
+ * An entry that has had an i/o error is invalid: it is not returned to
+ * new users, and it is closed when its last reference is dropped.  A
+ * valid entry with no references is kept open for fd_cache_idle seconds
+ * so that a disk used repeatedly, e.g. by acquire and release on the
+ * same lease, is not opened for each use.
+ */
+
+struct fd_cache_entry {
+	struct list_head list;
+	char path[SANLK_PATH_LEN];
+	dev_t dev;
+	ino_t ino;
+	int fd;
+	int refs;
+	int invalid;
+	uint32_t sector_size;
+	uint64_t last_put;
+};
+
+static LIST_HEAD(fd_cache);
+static pthread_mutex_t fd_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct fd_cache_entry *find_fd(int fd)
+{
+	struct fd_cache_entry *fe;
+
+	list_for_each_entry(fe, &fd_cache, list) {
+		if (fe->fd == fd)
+			return fe;
+	}
+	return NULL;
+}
+
+static void close_entry(struct fd_cache_entry *fe)
+{
+	list_del(&fe->list);
+	close_disk_fd(fe->fd);
+	free(fe);
+}
+
+int fd_cache_get(const char *path, int *fd, uint32_t *sector_size)
+{
+	struct fd_cache_entry *fe;
+	struct stat st;
+	const char *path_file = path;
+	int rv = -ENOENT;
+
+	if (sim_path(path))
+		path_file = path + strlen(SIM_PATH_PREFIX);
+
+	if (stat(path_file, &st) < 0)
+		return -ENOENT;
+
+	pthread_mutex_lock(&fd_cache_mutex);
+	list_for_each_entry(fe, &fd_cache, list) {
+		if (fe->invalid || fe->dev != st.st_dev || fe->ino != st.st_ino)
+			continue;
+		if (strncmp(fe->path, path, SANLK_PATH_LEN))
+			continue;
+		fe->refs++;
+		*fd = fe->fd;
+		*sector_size = fe->sector_size;
+		rv = 0;
+		break;
+	}
+	pthread_mutex_unlock(&fd_cache_mutex);
+
+	return rv;
+}
+
+void fd_cache_add(const char *path, int fd, uint32_t sector_size)
+{
+	struct fd_cache_entry *fe;
+	struct stat st;
+
+	if (fstat(fd, &st) < 0)
+		return;
+
+	fe = calloc(1, sizeof(struct fd_cache_entry));
+	if (!fe)
+		return;
+
+	strncpy(fe->path, path, SANLK_PATH_LEN - 1);
+	fe->dev = st.st_dev;
+	fe->ino = st.st_ino;
+	fe->fd = fd;
+	fe->refs = 1;
+	fe->sector_size = sector_size;
+
+	pthread_mutex_lock(&fd_cache_mutex);
+	list_add(&fe->list, &fd_cache);
+	pthread_mutex_unlock(&fd_cache_mutex);
+}
+
+void fd_cache_set_sector_size(int fd, uint32_t sector_size)
+{
+	struct fd_cache_entry *fe;
+
+	pthread_mutex_lock(&fd_cache_mutex);
+	fe = find_fd(fd);
+	if (fe)
+		fe->sector_size = sector_size;
+	pthread_mutex_unlock(&fd_cache_mutex);
+}
+
+int fd_cache_put(int fd)
+{
+	struct fd_cache_entry *fe;
+
+	pthread_mutex_lock(&fd_cache_mutex);
+	fe = find_fd(fd);
+	if (!fe) {
+		pthread_mutex_unlock(&fd_cache_mutex);
+		return 0;
+	}
+
+	if (--fe->refs <= 0) {
+		fe->refs = 0;
+		fe->last_put = monotime();
+		if (fe->invalid || !com.fd_cache_idle)
+			close_entry(fe);
+	}
+	pthread_mutex_unlock(&fd_cache_mutex);
+	return 1;
+}
+
+void fd_cache_invalidate(int fd, int err)
+{
+	struct fd_cache_entry *fe;
+
+	/* errors that are not about the device, e.g. a short read at the
+	   end of a file, do not require opening it again */
+	if (err != -EIO && err != -ENODEV && err != -ENXIO && err != -ESTALE)
+		return;
+
+	pthread_mutex_lock(&fd_cache_mutex);
+	fe = find_fd(fd);
+	if (fe && !fe->invalid) {
+		log_debug("fd_cache invalidate fd %d error %d %s", fd, err, fe->path);
+		fe->invalid = 1;
+		if (!fe->refs)
+			close_entry(fe);
+	}
+	pthread_mutex_unlock(&fd_cache_mutex);
+}
+
+void fd_cache_prune(void)
+{
+	struct fd_cache_entry *fe, *safe;
+	uint64_t now = monotime();
+
+	pthread_mutex_lock(&fd_cache_mutex);
+	list_for_each_entry_safe(fe, safe, &fd_cache, list) {
+		if (fe->refs)
+			continue;
+		if (fe->invalid || now - fe->last_put >= (uint64_t)com.fd_cache_idle)
+			close_entry(fe);
+	}
+	pthread_mutex_unlock(&fd_cache_mutex);
+}
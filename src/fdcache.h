@@ -0,0 +1,39 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#ifndef __FDCACHE_H__
+#define __FDCACHE_H__
+
+/*
+ * The daemon keeps one O_DIRECT fd for each disk path, shared by the
+ * lockspaces, resources and commands that use the disk, see fd_cache.
+ * The functions are called from open_disk/open_disks_fd/close_disks,
+ * and from the i/o functions in diskio.c when an i/o fails.
+ */
+
+/* 0 and a new reference to the fd for path, or -ENOENT if there is
+   none; sector_size is 0 if it is not yet known */
+int fd_cache_get(const char *path, int *fd, uint32_t *sector_size);
+
+/* add an fd that was just opened for path, with one reference */
+void fd_cache_add(const char *path, int fd, uint32_t sector_size);
+
+void fd_cache_set_sector_size(int fd, uint32_t sector_size);
+
+/* drop a reference; returns 1 if the fd belongs to the cache and the
+   caller must not close it, 0 if it is not in the cache */
+int fd_cache_put(int fd);
+
+/* an i/o error on the fd: new users open the disk again, and the fd is
+   closed when the last reference is dropped */
+void fd_cache_invalidate(int fd, int err);
+
+/* main_loop: close fds that have had no references for fd_cache_idle */
+void fd_cache_prune(void);
+
+#endif
@@ -0,0 +1,430 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "sanlock_internal.h"
+#include "sanlock_admin.h"
+#include "diskio.h"
+#include "ondisk.h"
+#include "log.h"
+#include "task.h"
+#include "direct.h"
+#include "freemap.h"
+
+/*
+ * The scan reads the first sector of each lease area.  A number of
+ * threads each take the next 64 areas (one word of bits) and read them,
+ * so there are that many reads outstanding.  An area that cannot be read
+ * is not counted as free.
+ */
+
+#define FREEMAP_THREADS		8
+#define FREEMAP_MAGIC		0x46524d50
+#define FREEMAP_VERSION		1
+
+struct freemap_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sector_size;
+	uint32_t align_size;
+	uint64_t offset;
+	uint64_t count;
+	uint64_t next;
+	char path[SANLK_PATH_LEN];
+};
+
+struct freemap_scan_args {
+	struct freemap *fm;
+	struct sync_disk *sd;
+	int use_aio;
+	pthread_mutex_t mutex;
+	uint64_t next_word;
+	int errors;
+};
+
+static inline uint64_t freemap_words(uint64_t count)
+{
+	return (count + 63) / 64;
+}
+
+static int area_in_use(char *data)
+{
+	uint32_t magic;
+
+	magic_in(data, &magic);
+
+	return (magic == DELTA_DISK_MAGIC || magic == PAXOS_DISK_MAGIC ||
+		magic == RINDEX_DISK_MAGIC);
+}
+
+static void *freemap_scan_thread(void *arg)
+{
+	struct freemap_scan_args *sa = arg;
+	struct freemap *fm = sa->fm;
+	struct task task;
+	uint64_t word, area, bits;
+	int sector_count = fm->align_size / fm->sector_size;
+	int errors = 0;
+	int i, rv;
+	char *data;
+
+	memset(&task, 0, sizeof(struct task));
+	setup_task_aio(&task, sa->use_aio, DIRECT_AIO_CB_SIZE);
+	sprintf(task.name, "%s", "freemap");
+
+	data = malloc(fm->sector_size);
+	if (!data)
+		goto out;
+
+	while (1) {
+		pthread_mutex_lock(&sa->mutex);
+		word = sa->next_word++;
+		pthread_mutex_unlock(&sa->mutex);
+
+		if (word >= freemap_words(fm->count))
+			break;
+
+		bits = 0;
+
+		for (i = 0; i < 64; i++) {
+			area = word * 64 + i;
+			if (area >= fm->count)
+				break;
+
+			memset(data, 0, fm->sector_size);
+
+			rv = read_sectors(sa->sd, fm->sector_size, area * sector_count, 1,
+					  data, fm->sector_size, &task, DEFAULT_IO_TIMEOUT, "freemap");
+			if (rv < 0) {
+				errors++;
+				continue;
+			}
+
+			if (!area_in_use(data))
+				bits |= 1ULL << i;
+		}
+
+		fm->bits[word] = bits;
+	}
+ out:
+	pthread_mutex_lock(&sa->mutex);
+	sa->errors += errors;
+	pthread_mutex_unlock(&sa->mutex);
+
+	free(data);
+	close_task_aio(&task);
+	return NULL;
+}
+
+static struct freemap *freemap_alloc(const char *path, uint64_t offset, int sector_size,
+				     int align_size, uint64_t count)
+{
+	struct freemap *fm;
+
+	fm = calloc(1, sizeof(struct freemap));
+	if (!fm)
+		return NULL;
+
+	fm->bits = calloc(freemap_words(count) ? freemap_words(count) : 1, sizeof(uint64_t));
+	if (!fm->bits) {
+		free(fm);
+		return NULL;
+	}
+
+	strncpy(fm->path, path, SANLK_PATH_LEN - 1);
+	fm->offset = offset;
+	fm->sector_size = sector_size;
+	fm->align_size = align_size;
+	fm->count = count;
+	return fm;
+}
+
+void freemap_free(struct freemap *fm)
+{
+	if (!fm)
+		return;
+	free(fm->bits);
+	free(fm);
+}
+
+int freemap_scan(struct task *task, struct sync_disk *sd, int sector_size,
+		 int align_size, uint64_t size, struct freemap **fm_out)
+{
+	struct freemap_scan_args sa;
+	struct freemap *fm;
+	pthread_t threads[FREEMAP_THREADS];
+	off_t end;
+	int i, rv, started = 0;
+
+	if (!sector_size || !align_size || align_size % sector_size)
+		return -EINVAL;
+
+	if (!size) {
+		end = lseek(sd->fd, 0, SEEK_END);
+		if (end < 0 || (uint64_t)end <= sd->offset) {
+			log_error("freemap %s size unknown %lld", sd->path, (long long)end);
+			return -EINVAL;
+		}
+		size = end - sd->offset;
+	}
+
+	fm = freemap_alloc(sd->path, sd->offset, sector_size, align_size, size / align_size);
+	if (!fm)
+		return -ENOMEM;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.fm = fm;
+	sa.sd = sd;
+	sa.use_aio = task->use_aio;
+	pthread_mutex_init(&sa.mutex, NULL);
+
+	for (i = 0; i < FREEMAP_THREADS; i++) {
+		if ((uint64_t)i >= freemap_words(fm->count))
+			break;
+		rv = pthread_create(&threads[i], NULL, freemap_scan_thread, &sa);
+		if (rv) {
+			log_error("freemap thread create error %d", rv);
+			break;
+		}
+		started++;
+	}
+
+	if (!started)
+		freemap_scan_thread(&sa);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&sa.mutex);
+
+	if (sa.errors)
+		log_error("freemap %s:%llu %d read errors", sd->path,
+			  (unsigned long long)sd->offset, sa.errors);
+
+	log_debug("freemap %s:%llu areas %llu free %llu", sd->path,
+		  (unsigned long long)sd->offset,
+		  (unsigned long long)fm->count,
+		  (unsigned long long)freemap_count_free(fm));
+
+	*fm_out = fm;
+	return 0;
+}
+
+uint64_t freemap_count_free(struct freemap *fm)
+{
+	uint64_t w, free_count = 0;
+
+	for (w = 0; w < freemap_words(fm->count); w++)
+		free_count += __builtin_popcountll(fm->bits[w]);
+	return free_count;
+}
+
+static int freemap_first(struct freemap *fm, uint64_t *area_out)
+{
+	uint64_t w;
+
+	for (w = fm->next / 64; w < freemap_words(fm->count); w++) {
+		if (!fm->bits[w])
+			continue;
+		*area_out = w * 64 + __builtin_ctzll(fm->bits[w]);
+		return 0;
+	}
+	fm->next = fm->count;
+	return -ENOSPC;
+}
+
+int freemap_take(struct task *task, struct sync_disk *sd, struct freemap *fm,
+		 uint64_t *area_out)
+{
+	int sector_count = fm->align_size / fm->sector_size;
+	uint64_t area;
+	char *data;
+	int rv;
+
+	data = malloc(fm->sector_size);
+	if (!data)
+		return -ENOMEM;
+
+	while (1) {
+		rv = freemap_first(fm, &area);
+		if (rv < 0)
+			break;
+
+		fm->bits[area / 64] &= ~(1ULL << (area % 64));
+		fm->next = area + 1;
+
+		/* the area may have been used since the map was made */
+
+		memset(data, 0, fm->sector_size);
+
+		rv = read_sectors(sd, fm->sector_size, area * sector_count, 1,
+				  data, fm->sector_size, task, DEFAULT_IO_TIMEOUT, "freemap");
+		if (rv < 0)
+			continue;
+
+		if (area_in_use(data))
+			continue;
+
+		*area_out = area;
+		rv = 0;
+		break;
+	}
+
+	free(data);
+	return rv;
+}
+
+int freemap_write(struct freemap *fm, const char *file_path)
+{
+	struct freemap_header hdr;
+	char tmp_path[PATH_MAX];
+	size_t len = freemap_words(fm->count) * sizeof(uint64_t);
+	int fd, rv = 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = FREEMAP_MAGIC;
+	hdr.version = FREEMAP_VERSION;
+	hdr.sector_size = fm->sector_size;
+	hdr.align_size = fm->align_size;
+	hdr.offset = fm->offset;
+	hdr.count = fm->count;
+	hdr.next = fm->next;
+	memcpy(hdr.path, fm->path, SANLK_PATH_LEN);
+
+	/* replace the old map at once, next_free may run concurrently */
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d", file_path, getpid());
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -errno;
+
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    write(fd, fm->bits, len) != (ssize_t)len)
+		rv = -EIO;
+
+	if (close(fd) < 0 && !rv)
+		rv = -errno;
+
+	if (!rv && rename(tmp_path, file_path) < 0)
+		rv = -errno;
+
+	if (rv)
+		unlink(tmp_path);
+	return rv;
+}
+
+int freemap_read(const char *file_path, struct freemap **fm_out)
+{
+	struct freemap_header hdr;
+	struct freemap *fm;
+	size_t len;
+	int fd, rv = 0;
+
+	fd = open(file_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    hdr.magic != FREEMAP_MAGIC || hdr.version != FREEMAP_VERSION) {
+		rv = -EINVAL;
+		goto out;
+	}
+
+	hdr.path[SANLK_PATH_LEN - 1] = '\0';
+
+	fm = freemap_alloc(hdr.path, hdr.offset, hdr.sector_size, hdr.align_size, hdr.count);
+	if (!fm) {
+		rv = -ENOMEM;
+		goto out;
+	}
+	fm->next = hdr.next;
+
+	len = freemap_words(fm->count) * sizeof(uint64_t);
+
+	if (read(fd, fm->bits, len) != (ssize_t)len) {
+		freemap_free(fm);
+		rv = -EINVAL;
+		goto out;
+	}
+
+	*fm_out = fm;
+ out:
+	close(fd);
+	return rv;
+}
+
+/*
+ * The daemon keeps the map of each disk that next_free has been used
+ * on.  The first next_free on a disk scans it, and later ones take the
+ * next free area from the map.  Areas that are freed after the scan are
+ * not seen until a next_free with SANLK_NEXT_FREE_RESCAN.  The mutex is
+ * held during a scan so concurrent callers do not repeat it.
+ */
+
+static LIST_HEAD(freemaps);
+static pthread_mutex_t freemaps_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int freemap_cache_next(struct task *task, struct sync_disk *sd, uint32_t flags,
+		       uint64_t *offset_out)
+{
+	struct freemap *fm = NULL, *iter;
+	uint64_t area;
+	int sector_size, align_size;
+	int rv;
+
+	pthread_mutex_lock(&freemaps_mutex);
+
+	list_for_each_entry(iter, &freemaps, list) {
+		if (iter->offset == sd->offset && !strncmp(iter->path, sd->path, SANLK_PATH_LEN)) {
+			fm = iter;
+			break;
+		}
+	}
+
+	if (fm && (flags & SANLK_NEXT_FREE_RESCAN)) {
+		list_del(&fm->list);
+		freemap_free(fm);
+		fm = NULL;
+	}
+
+	if (!fm) {
+		rv = direct_read_leader_sizes(task, sd, &sector_size, &align_size);
+		if (rv < 0)
+			goto out;
+
+		rv = freemap_scan(task, sd, sector_size, align_size, 0, &fm);
+		if (rv < 0)
+			goto out;
+
+		list_add(&fm->list, &freemaps);
+	}
+
+	rv = freemap_take(task, sd, fm, &area);
+	if (rv < 0)
+		goto out;
+
+	*offset_out = fm->offset + area * fm->align_size;
+	rv = 0;
+ out:
+	pthread_mutex_unlock(&freemaps_mutex);
+	return rv;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#ifndef __FREEMAP_H__
+#define __FREEMAP_H__
+
+/*
+ * A bitmap of the align_size lease areas on a disk, from a given offset,
+ * with a bit set for each area that does not begin with a leader record
+ * or rindex header.
+ */
+
+struct freemap {
+	struct list_head list;		/* daemon cache */
+	char path[SANLK_PATH_LEN];
+	uint64_t offset;
+	int sector_size;
+	int align_size;
+	uint64_t count;			/* number of areas scanned */
+	uint64_t next;			/* no free areas before this one */
+	uint64_t *bits;
+};
+
+/* size 0 scans to the end of the disk */
+int freemap_scan(struct task *task, struct sync_disk *sd, int sector_size,
+		 int align_size, uint64_t size, struct freemap **fm_out);
+
+void freemap_free(struct freemap *fm);
+
+uint64_t freemap_count_free(struct freemap *fm);
+
+/* find the first free area and clear its bit, after reading it to check
+   that it is still free; -ENOSPC if no areas in the map are free */
+int freemap_take(struct task *task, struct sync_disk *sd, struct freemap *fm,
+		 uint64_t *area_out);
+
+int freemap_write(struct freemap *fm, const char *file_path);
+int freemap_read(const char *file_path, struct freemap **fm_out);
+
+/* daemon: next_free using a map of each disk kept in memory */
+int freemap_cache_next(struct task *task, struct sync_disk *sd, uint32_t flags,
+		       uint64_t *offset_out);
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#ifndef __HASH_H__
+#define __HASH_H__
+
+/*
+ * FNV-1a hash of lockspace and resource names, which are NAME_ID_SIZE
+ * fields that are not always null terminated.  Hash tables are arrays
+ * of list_head buckets, with a power of two size.
+ */
+
+#define NAME_HASH_INIT 2166136261U
+
+static inline uint32_t name_hash_add(uint32_t h, const char *name, int len)
+{
+	int i;
+
+	for (i = 0; i < len && name[i]; i++) {
+		h ^= (uint8_t)name[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static inline uint32_t name_hash(const char *name, int len)
+{
+	return name_hash_add(NAME_HASH_INIT, name, len);
+}
+
+/* the same on every host, so it can identify a resource in a host event */
+
+static inline uint32_t resource_name_hash(const char *space_name, const char *res_name)
+{
+	return name_hash_add(name_hash(space_name, NAME_ID_SIZE), res_name, NAME_ID_SIZE);
+}
+
+static inline uint32_t id_hash(uint32_t id)
+{
+	return id * 2654435761U;
+}
+
+#endif
@@ -25,7 +25,9 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/prctl.h>
+#include <sys/signalfd.h>
 #include <grp.h>
+#include <spawn.h>
 
 #include "sanlock.h"
 #include "monotime.h"
@@ -33,13 +35,27 @@
 
 #define MAX_AV_COUNT 8
 
-static void run_path(struct helper_msg *hm)
+/* RUNPATH msgs waiting for one of the HELPER_MAX_RUNNING to exit */
+
+struct pending_msg {
+	struct pending_msg *next;
+	struct helper_msg hm;
+};
+
+static struct pending_msg *pending_head;
+static struct pending_msg *pending_tail;
+static int running_count;
+
+static int run_path(struct helper_msg *hm)
 {
+	posix_spawnattr_t attr;
+	sigset_t mask;
+	pid_t pid;
 	char arg[SANLK_HELPER_ARGS_LEN];
 	char *args = hm->args;
 	char *av[MAX_AV_COUNT + 1]; /* +1 for NULL */
 	int av_count = 0;
-	int i, arg_len, args_len;
+	int i, rv, arg_len, args_len;
 
 	for (i = 0; i < MAX_AV_COUNT + 1; i++)
 		av[i] = NULL;
@@ -104,20 +120,39 @@ static void run_path(struct helper_msg *hm)
 		av[av_count++] = strdup(arg);
 	}
 
-	execvp(av[0], av);
+	/* the helper blocks SIGCHLD for its signalfd, the program should not */
+	sigemptyset(&mask);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+	rv = posix_spawnp(&pid, av[0], NULL, &attr, av, environ);
+
+	posix_spawnattr_destroy(&attr);
+
+	for (i = 0; i < MAX_AV_COUNT + 1; i++)
+		free(av[i]);
+
+	return -rv;
 }
 
-static int read_hm(int fd, struct helper_msg *hm)
+/*
+ * The daemon writes up to HELPER_MSG_BATCH msgs at once, and a write of
+ * that size to a pipe is atomic, so a read returns whole msgs.  Returns
+ * the number of msgs read.
+ */
+
+static int read_hm(int fd, struct helper_msg *hm, int max)
 {
 	int rv;
  retry:
-	rv = read(fd, hm, sizeof(struct helper_msg));
+	rv = read(fd, hm, max * sizeof(struct helper_msg));
 	if (rv == -1 && errno == EINTR)
 		goto retry;
 
-	if (rv != sizeof(struct helper_msg))
+	if (rv <= 0 || rv % sizeof(struct helper_msg))
 		return -1;
-	return 0;
+	return rv / sizeof(struct helper_msg);
 }
 
 static int send_status(int fd)
@@ -136,6 +171,24 @@ static int send_status(int fd)
 	return -1;
 }
 
+/* if the status pipe is full, the daemon just doesn't get this status */
+
+static void send_runpath_status(int fd, int pid, int result)
+{
+	struct helper_status hs;
+	int rv;
+
+	memset(&hs, 0, sizeof(hs));
+
+	hs.type = HELPER_STATUS_RUNPATH;
+	hs.len = sizeof(hs);
+	hs.pid = pid;
+	hs.result = result;
+
+	rv = write(fd, &hs, sizeof(hs));
+	(void)rv;
+}
+
 #define log_debug(fmt, args...) \
 do { \
 	if (log_stderr) \
@@ -145,16 +198,67 @@ do { \
 #define STANDARD_TIMEOUT_MS (HELPER_STATUS_INTERVAL*1000)
 #define RECOVERY_TIMEOUT_MS 1000
 
+static void start_path(int out_fd, struct helper_msg *hm)
+{
+	int rv;
+
+	rv = run_path(hm);
+	if (!rv)
+		running_count++;
+
+	send_runpath_status(out_fd, hm->client_pid, rv);
+}
+
+static void queue_path(int out_fd, struct helper_msg *hm)
+{
+	struct pending_msg *pm;
+
+	if (running_count < HELPER_MAX_RUNNING) {
+		start_path(out_fd, hm);
+		return;
+	}
+
+	pm = malloc(sizeof(struct pending_msg));
+	if (!pm) {
+		send_runpath_status(out_fd, hm->client_pid, -ENOMEM);
+		return;
+	}
+	memcpy(&pm->hm, hm, sizeof(struct helper_msg));
+	pm->next = NULL;
+
+	if (pending_tail)
+		pending_tail->next = pm;
+	else
+		pending_head = pm;
+	pending_tail = pm;
+}
+
+static void start_pending(int out_fd)
+{
+	struct pending_msg *pm;
+
+	while (pending_head && running_count < HELPER_MAX_RUNNING) {
+		pm = pending_head;
+		pending_head = pm->next;
+		if (!pending_head)
+			pending_tail = NULL;
+
+		start_path(out_fd, &pm->hm);
+		free(pm);
+	}
+}
+
 int run_helper(int in_fd, int out_fd, int log_stderr)
 {
 	char name[16];
-	struct pollfd pollfd;
-	struct helper_msg hm;
+	struct pollfd pollfd[2];
+	struct helper_msg hm[HELPER_MSG_BATCH];
+	struct signalfd_siginfo si;
+	sigset_t mask;
 	unsigned int fork_count = 0;
 	unsigned int wait_count = 0;
 	time_t now, last_send, last_good = 0;
-	int timeout = STANDARD_TIMEOUT_MS;
-	int rv, pid, status;
+	int rv, i, count, status, sfd;
 
 	memset(name, 0, sizeof(name));
 	sprintf(name, "%s", "sanlock-helper");
@@ -164,9 +268,20 @@ int run_helper(int in_fd, int out_fd, int log_stderr)
 	if (rv < 0)
 		log_debug("error clearing helper groups errno %i", errno);
 
+	/* child exits are seen through sfd instead of polling waitpid */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (sfd < 0)
+		log_debug("helper signalfd error %d", errno);
+
 	memset(&pollfd, 0, sizeof(pollfd));
-	pollfd.fd = in_fd;
-	pollfd.events = POLLIN;
+	pollfd[0].fd = in_fd;
+	pollfd[0].events = POLLIN;
+	pollfd[1].fd = sfd;
+	pollfd[1].events = POLLIN;
 
 	now = monotime();
 	last_send = now;
@@ -175,7 +290,9 @@ int run_helper(int in_fd, int out_fd, int log_stderr)
 		last_good = now;
 
 	while (1) {
-		rv = poll(&pollfd, 1, timeout);
+		/* without sfd, look for child exits each second */
+		rv = poll(pollfd, 2, (sfd < 0 && running_count) ?
+			  RECOVERY_TIMEOUT_MS : STANDARD_TIMEOUT_MS);
 		if (rv == -1 && errno == EINTR)
 			continue;
 
@@ -192,35 +309,32 @@ int run_helper(int in_fd, int out_fd, int log_stderr)
 				last_good = now;
 		}
 
-		memset(&hm, 0, sizeof(hm));
+		if (pollfd[0].revents & POLLIN) {
+			memset(hm, 0, sizeof(hm));
 
-		if (pollfd.revents & POLLIN) {
-			rv = read_hm(in_fd, &hm);
-			if (rv)
-				continue;
+			count = read_hm(in_fd, hm, HELPER_MSG_BATCH);
 
-			if (hm.type == HELPER_MSG_RUNPATH) {
-				pid = fork();
-				if (!pid) {
-					run_path(&hm);
-					exit(-1);
+			for (i = 0; i < count; i++) {
+				if (hm[i].type == HELPER_MSG_RUNPATH) {
+					queue_path(out_fd, &hm[i]);
+					fork_count++;
+				} else if (hm[i].type == HELPER_MSG_KILLPID) {
+					kill(hm[i].pid, hm[i].sig);
 				}
-
-				fork_count++;
-
-				/*
-				log_debug("helper fork %d count %d %d %s %s",
-					  pid, fork_count, wait_count,
-					  hm.path, hm.args);
-				*/
-			} else if (hm.type == HELPER_MSG_KILLPID) {
-				kill(hm.pid, hm.sig);
 			}
 		}
 
-		if (pollfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+		if (pollfd[0].revents & (POLLERR | POLLHUP | POLLNVAL))
 			exit(0);
 
+		if (pollfd[1].revents & POLLIN) {
+			while (read(sfd, &si, sizeof(si)) == sizeof(si))
+				;
+		}
+
+		if (!running_count)
+			continue;
+
 		/* collect child exits until no more children exist (ECHILD)
 		   or none are ready (WNOHANG) */
 
@@ -228,28 +342,20 @@ int run_helper(int in_fd, int out_fd, int log_stderr)
 			rv = waitpid(-1, &status, WNOHANG);
 			if (rv > 0) {
 				wait_count++;
-
-				/*
-				log_debug("helper wait %d count %d %d",
-					  rv, fork_count, wait_count);
-				*/
+				running_count--;
 				continue;
 			}
-
-			/* no more children to wait for or no children
-			   have exited */
-
-			if (rv < 0 && errno == ECHILD) {
-				if (timeout == RECOVERY_TIMEOUT_MS) {
-					log_debug("helper no children count %d %d",
-						  fork_count, wait_count);
-				}
-				timeout = STANDARD_TIMEOUT_MS;
-			} else {
-				timeout = RECOVERY_TIMEOUT_MS;
-			}
 			break;
 		}
+
+		if (rv < 0 && errno == ECHILD)
+			running_count = 0;
+
+		start_pending(out_fd);
+
+		if (!running_count)
+			log_debug("helper no children count %d %d",
+				  fork_count, wait_count);
 	}
 
 	return 0;
@@ -11,8 +11,13 @@
 
 /*
  * helper process
- * recvs 512 byte helper_msg on in_fd
- * sends 4 byte helper_status on out_fd
+ * recvs 512 byte helper_msg on in_fd, up to HELPER_MSG_BATCH in one write
+ * sends 12 byte helper_status on out_fd
+ *
+ * Up to HELPER_MAX_RUNNING killpath programs are run at once, further
+ * RUNPATH msgs wait in the helper until one exits.  When a killpath is
+ * started, or fails to start, the helper sends HELPER_STATUS_RUNPATH
+ * with the pid of the client it was sent for.
  */
 
 #define SANLK_HELPER_MSG_LEN 512
@@ -20,6 +25,10 @@
 #define HELPER_MSG_RUNPATH 1
 #define HELPER_MSG_KILLPID 2
 
+#define HELPER_MSG_BATCH (PIPE_BUF / SANLK_HELPER_MSG_LEN) /* atomic write */
+
+#define HELPER_MAX_RUNNING 32
+
 struct helper_msg {
 	uint8_t type;
 	uint8_t pad1;
@@ -29,17 +38,21 @@ struct helper_msg {
 	int sig;
 	char path[SANLK_HELPER_PATH_LEN]; /* 128 */
 	char args[SANLK_HELPER_ARGS_LEN]; /* 128 */
-	char pad[240];
+	int client_pid; /* RUNPATH: reported in HELPER_STATUS_RUNPATH */
+	char pad[236];
 };
 
 #define HELPER_STATUS_INTERVAL 30
 
 #define HELPER_STATUS 1
+#define HELPER_STATUS_RUNPATH 2
 
 struct helper_status {
 	uint8_t type;
 	uint8_t status;
 	uint16_t len;
+	int pid; /* RUNPATH: client_pid from helper_msg */
+	int result; /* RUNPATH: 0 started, or -errno */
 };
 
 int run_helper(int in_fd, int out_fd, int log_stderr);
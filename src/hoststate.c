@@ -0,0 +1,335 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sanlock_internal.h"
+#include "log.h"
+#include "monotime.h"
+#include "timeouts.h"
+#include "hash.h"
+#include "hoststate.h"
+
+/*
+ * Each lockspace has a file in the run dir, named by a hash of the
+ * lockspace name and host_id disk path, and the disk offset.  The main
+ * loop copies host_status into it after each check_other_leases, along
+ * with the renewal history.
+ * When the lockspace is added again by a later daemon, the saved state
+ * is used only if it was saved since the machine booted (local monotime
+ * values are comparable) and recently enough that its host states are
+ * still meaningful.
+ *
+ * The restored host states are only displayed: until the first
+ * check_other_leases, get_hosts reports them instead of EAGAIN.  The
+ * host_status used to decide if a host is dead starts fresh, as without
+ * the file, so a host is not judged dead until host_dead_seconds of our
+ * own observation have passed.  The delta lease acquire is not affected.
+ *
+ * The file is kept when the lockspace is removed, since a daemon
+ * restart usually follows removing all lockspaces.  The run dir does
+ * not survive a reboot, and the boot_id check covers one that does.
+ */
+
+#define HOST_STATE_MAGIC   0x48535443
+#define HOST_STATE_VERSION 1
+
+struct host_state_entry {
+	uint64_t first_check;
+	uint64_t last_live;
+	uint64_t owner_id;
+	uint64_t owner_generation;
+	uint64_t timestamp;
+	uint16_t io_timeout;
+	uint16_t pad1;
+	uint32_t pad2;
+	char owner_name[NAME_ID_SIZE];
+};
+
+struct host_state_file {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seq;                   /* odd while being saved */
+	uint32_t max_hosts;
+	uint64_t saved;                 /* local monotime */
+	uint64_t offset;
+	uint32_t sector_size;
+	uint32_t history_size;
+	uint32_t history_next;
+	uint32_t history_prev;
+	char boot_id[40];
+	char space_name[NAME_ID_SIZE];
+	char path[SANLK_PATH_LEN];
+	struct host_state_entry hosts[DEFAULT_MAX_HOSTS];
+	/* followed by history_size struct renewal_history */
+};
+
+static char host_state_dir[PATH_MAX];
+static char boot_id[40];
+
+void setup_host_state(const char *run_dir)
+{
+	FILE *file;
+
+	if (!com.host_state_cache)
+		return;
+
+	file = fopen("/proc/sys/kernel/random/boot_id", "r");
+	if (!file) {
+		log_error("host state cache disabled, no boot_id %d", errno);
+		com.host_state_cache = 0;
+		return;
+	}
+
+	if (!fgets(boot_id, sizeof(boot_id), file) || !boot_id[0]) {
+		log_error("host state cache disabled, no boot_id");
+		com.host_state_cache = 0;
+	}
+	fclose(file);
+
+	boot_id[strcspn(boot_id, "\n")] = '\0';
+
+	snprintf(host_state_dir, sizeof(host_state_dir) - 1, "%s", run_dir);
+}
+
+static size_t host_state_size(void)
+{
+	return sizeof(struct host_state_file) +
+	       com.renewal_history_size * sizeof(struct renewal_history);
+}
+
+static struct renewal_history *host_state_history(struct host_state_file *hf)
+{
+	return (struct renewal_history *)(hf + 1);
+}
+
+static struct host_state_file *host_state_map(struct space *sp)
+{
+	struct host_state_file *hf;
+	char path[PATH_MAX + 48]; /* host_state_dir and the file name */
+	struct stat st;
+	uint32_t hash;
+	size_t size = host_state_size();
+	int fd, rv;
+
+	hash = name_hash(sp->space_name, NAME_ID_SIZE);
+	hash = name_hash_add(hash, sp->host_id_disk.path, SANLK_PATH_LEN);
+
+	rv = snprintf(path, sizeof(path), "%s/host_state.%08x.%llu", host_state_dir,
+		      hash, (unsigned long long)sp->host_id_disk.offset);
+	if (rv < 0 || rv >= PATH_MAX) {
+		log_erros(sp, "host state path too long %s", host_state_dir);
+		return NULL;
+	}
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		log_erros(sp, "host state %s open error %d", path, errno);
+		return NULL;
+	}
+
+	rv = fstat(fd, &st);
+	if (rv < 0) {
+		log_erros(sp, "host state %s stat error %d", path, errno);
+		goto fail;
+	}
+
+	/* a different layout or history size, start over */
+	if (st.st_size != size) {
+		if (ftruncate(fd, 0) < 0 || ftruncate(fd, size) < 0) {
+			log_erros(sp, "host state %s truncate error %d", path, errno);
+			goto fail;
+		}
+	}
+
+	hf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (hf == MAP_FAILED) {
+		log_erros(sp, "host state %s mmap error %d", path, errno);
+		goto fail;
+	}
+
+	close(fd);
+	return hf;
+ fail:
+	close(fd);
+	return NULL;
+}
+
+static int host_state_valid(struct space *sp, struct host_state_file *hf, uint64_t now)
+{
+	uint64_t max_age = calc_id_renewal_fail_seconds(sp->io_timeout);
+
+	if (hf->magic != HOST_STATE_MAGIC || hf->version != HOST_STATE_VERSION)
+		return 0;
+
+	/* the last save did not finish */
+	if (hf->seq & 1)
+		return 0;
+
+	if (strncmp(hf->boot_id, boot_id, sizeof(boot_id)) ||
+	    strncmp(hf->space_name, sp->space_name, NAME_ID_SIZE) ||
+	    strncmp(hf->path, sp->host_id_disk.path, SANLK_PATH_LEN) ||
+	    hf->offset != sp->host_id_disk.offset ||
+	    hf->sector_size != sp->sector_size ||
+	    hf->max_hosts != sp->max_hosts)
+		return 0;
+
+	if (hf->saved > now || now - hf->saved > max_age) {
+		log_space(sp, "host state saved %llu too old",
+			  (unsigned long long)hf->saved);
+		return 0;
+	}
+
+	return 1;
+}
+
+void host_state_load(struct space *sp)
+{
+	struct host_state_file *hf;
+	uint64_t now;
+	int i, count = 0;
+
+	if (!com.host_state_cache)
+		return;
+
+	hf = host_state_map(sp);
+	if (!hf)
+		return;
+
+	now = monotime();
+
+	if (!host_state_valid(sp, hf, now)) {
+		/* not valid again until the first save for this lockspace */
+		memset(hf, 0, sizeof(struct host_state_file));
+		goto out;
+	}
+
+	for (i = 0; i < sp->max_hosts; i++) {
+		/* our own lease has just been acquired with a new generation */
+		if (hf->hosts[i].timestamp && i+1 != sp->host_id)
+			count++;
+	}
+
+	pthread_mutex_lock(&sp->mutex);
+	if (sp->renewal_history && hf->history_size == sp->renewal_history_size &&
+	    hf->history_next < hf->history_size && hf->history_prev < hf->history_size) {
+		memcpy(sp->renewal_history, host_state_history(hf),
+		       sp->renewal_history_size * sizeof(struct renewal_history));
+		sp->renewal_history_next = hf->history_next;
+		sp->renewal_history_prev = hf->history_prev;
+	}
+	pthread_mutex_unlock(&sp->mutex);
+
+	sp->host_status_warm = count ? 1 : 0;
+
+	log_space(sp, "host state restored %d hosts saved %llu",
+		  count, (unsigned long long)hf->saved);
+ out:
+	hf->max_hosts = sp->max_hosts;
+	hf->offset = sp->host_id_disk.offset;
+	hf->sector_size = sp->sector_size;
+	hf->history_size = sp->renewal_history_size;
+	memcpy(hf->boot_id, boot_id, sizeof(boot_id));
+	memcpy(hf->space_name, sp->space_name, NAME_ID_SIZE);
+	memcpy(hf->path, sp->host_id_disk.path, SANLK_PATH_LEN);
+
+	sp->host_state = hf;
+}
+
+/*
+ * The host_status of host i+1 saved by the previous daemon, for display
+ * only.  Returns 0 if there is none.
+ */
+
+int host_state_get(struct space *sp, int i, struct host_status *hs)
+{
+	struct host_state_file *hf = sp->host_state;
+	struct host_state_entry *he;
+
+	if (!hf || !sp->host_status_warm || i+1 == sp->host_id)
+		return 0;
+
+	he = &hf->hosts[i];
+	if (!he->timestamp)
+		return 0;
+
+	memset(hs, 0, sizeof(struct host_status));
+	hs->first_check = he->first_check;
+	hs->last_live = he->last_live;
+	hs->owner_id = he->owner_id;
+	hs->owner_generation = he->owner_generation;
+	hs->timestamp = he->timestamp;
+	hs->io_timeout = he->io_timeout;
+	return 1;
+}
+
+void host_state_save(struct space *sp)
+{
+	struct host_state_file *hf = sp->host_state;
+	struct host_state_entry *he;
+	struct host_status *hs;
+	int i;
+
+	if (!hf)
+		return;
+
+	hf->seq++;
+	__sync_synchronize();
+
+	for (i = 0; i < sp->max_hosts; i++) {
+		hs = &sp->host_status[i];
+		he = &hf->hosts[i];
+
+		he->first_check = hs->first_check;
+		he->last_live = hs->last_live;
+		he->owner_id = hs->owner_id;
+		he->owner_generation = hs->owner_generation;
+		he->timestamp = hs->timestamp;
+		he->io_timeout = hs->io_timeout;
+		memcpy(he->owner_name, sp->host_names[i], NAME_ID_SIZE);
+	}
+
+	pthread_mutex_lock(&sp->mutex);
+	if (sp->renewal_history && hf->history_size == sp->renewal_history_size) {
+		memcpy(host_state_history(hf), sp->renewal_history,
+		       sp->renewal_history_size * sizeof(struct renewal_history));
+		hf->history_next = sp->renewal_history_next;
+		hf->history_prev = sp->renewal_history_prev;
+	}
+	pthread_mutex_unlock(&sp->mutex);
+
+	hf->saved = monotime();
+	hf->magic = HOST_STATE_MAGIC;
+	hf->version = HOST_STATE_VERSION;
+
+	__sync_synchronize();
+	hf->seq++;
+}
+
+void host_state_close(struct space *sp)
+{
+	if (!sp->host_state)
+		return;
+
+	munmap(sp->host_state, host_state_size());
+	sp->host_state = NULL;
+}
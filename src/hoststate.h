@@ -0,0 +1,32 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#ifndef __HOSTSTATE_H__
+#define __HOSTSTATE_H__
+
+/*
+ * The host_status and renewal history of each lockspace, kept in a file
+ * in the run dir so a restarted daemon does not begin with no knowledge
+ * of the other hosts, see host_state_cache.
+ */
+
+void setup_host_state(const char *run_dir);
+
+/* lockspace_thread, after the delta lease is acquired */
+void host_state_load(struct space *sp);
+
+/* get_hosts, until the first check_other_leases after host_state_load */
+int host_state_get(struct space *sp, int i, struct host_status *hs);
+
+/* check_other_leases */
+void host_state_save(struct space *sp);
+
+/* free_sp */
+void host_state_close(struct space *sp);
+
+#endif
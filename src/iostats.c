@@ -0,0 +1,217 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "sanlock_internal.h"
+#include "sanlock_admin.h"
+#include "iostats.h"
+#include "trace.h"
+#include "capture.h"
+
+/*
+ * Stats for a path are created when the path is first opened and are
+ * kept for the life of the daemon.  The fd table points an open fd to
+ * the stats for its path, so recording an i/o only needs atomic adds
+ * on the counters, no locking.
+ */
+
+struct io_hist {
+	uint64_t count;
+	uint64_t errors;
+	uint64_t total_us;
+	uint64_t max_us;
+	uint64_t buckets[IO_STATS_BUCKETS];
+};
+
+struct io_stats_path {
+	char path[SANLK_PATH_LEN];
+	struct io_hist hist[SANLK_IO_OPS];
+};
+
+static struct io_stats_path *stats_paths[IO_STATS_PATHS];
+static struct io_stats_path *fd_stats[IO_STATS_FDS];
+static int stats_paths_count;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void io_stats_open(int fd, const char *path)
+{
+	struct io_stats_path *sp = NULL;
+	int i;
+
+	if (fd < 0 || fd >= IO_STATS_FDS)
+		return;
+
+	pthread_mutex_lock(&stats_mutex);
+	for (i = 0; i < stats_paths_count; i++) {
+		if (!strncmp(stats_paths[i]->path, path, SANLK_PATH_LEN)) {
+			sp = stats_paths[i];
+			break;
+		}
+	}
+
+	if (!sp && stats_paths_count < IO_STATS_PATHS) {
+		sp = calloc(1, sizeof(struct io_stats_path));
+		if (sp) {
+			strncpy(sp->path, path, SANLK_PATH_LEN - 1);
+			stats_paths[stats_paths_count++] = sp;
+		}
+	}
+	pthread_mutex_unlock(&stats_mutex);
+
+	__atomic_store_n(&fd_stats[fd], sp, __ATOMIC_RELEASE);
+
+	capture_open(fd, path);
+}
+
+void io_stats_close(int fd)
+{
+	if (fd < 0 || fd >= IO_STATS_FDS)
+		return;
+
+	__atomic_store_n(&fd_stats[fd], NULL, __ATOMIC_RELEASE);
+
+	capture_close(fd);
+}
+
+static int us_to_bucket(uint64_t us)
+{
+	int b;
+
+	if (!us)
+		return 0;
+
+	b = 64 - __builtin_clzll(us);
+	if (b >= IO_STATS_BUCKETS)
+		b = IO_STATS_BUCKETS - 1;
+	return b;
+}
+
+void io_stats_add(struct task *task, int fd, int cmd, uint64_t begin, int result)
+{
+	struct io_stats_path *sp;
+	struct io_hist *h;
+	uint64_t now, us, max;
+	int op;
+
+	if (fd < 0 || fd >= IO_STATS_FDS)
+		return;
+
+	sp = __atomic_load_n(&fd_stats[fd], __ATOMIC_ACQUIRE);
+	if (!sp)
+		return;
+
+	op = task ? task->io_op : 0;
+	if (op <= 0 || op >= SANLK_IO_OPS)
+		op = (cmd == IO_CMD_PREAD) ? SANLK_IO_OTHER_READ : SANLK_IO_OTHER_WRITE;
+
+	now = trace_begin();
+	us = (now > begin) ? now - begin : 0;
+
+	h = &sp->hist[op];
+
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->total_us, us, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->buckets[us_to_bucket(us)], 1, __ATOMIC_RELAXED);
+	if (result < 0)
+		__atomic_fetch_add(&h->errors, 1, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+	while (us > max) {
+		if (__atomic_compare_exchange_n(&h->max_us, &max, us, 0,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+	}
+}
+
+/* the upper bound of the bucket holding the given fraction (per 1000) of i/os */
+
+static uint64_t hist_percentile(uint64_t *buckets, uint64_t count, uint64_t max_us, int per_mille)
+{
+	uint64_t target, sum = 0, upper;
+	int b;
+
+	target = (count * per_mille + 999) / 1000;
+	if (!target)
+		target = 1;
+
+	for (b = 0; b < IO_STATS_BUCKETS; b++) {
+		sum += buckets[b];
+		if (sum >= target)
+			break;
+	}
+
+	upper = 1ULL << b;
+	return (upper < max_us) ? upper : max_us;
+}
+
+int copy_io_stats(char *buf, int *len, int *count, int maxlen)
+{
+	struct sanlk_io_stats *st;
+	struct io_stats_path *sp;
+	struct io_hist *h;
+	uint64_t buckets[IO_STATS_BUCKETS];
+	uint64_t total;
+	int num_paths, i, op, b;
+	int pos = 0, num = 0, rv = 0;
+
+	pthread_mutex_lock(&stats_mutex);
+	num_paths = stats_paths_count;
+	pthread_mutex_unlock(&stats_mutex);
+
+	for (i = 0; i < num_paths; i++) {
+		sp = stats_paths[i];
+
+		for (op = 1; op < SANLK_IO_OPS; op++) {
+			h = &sp->hist[op];
+
+			if (!__atomic_load_n(&h->count, __ATOMIC_RELAXED))
+				continue;
+
+			if (pos + (int)sizeof(struct sanlk_io_stats) > maxlen) {
+				rv = -ENOSPC;
+				goto out;
+			}
+
+			/* the count is taken from the buckets so they agree */
+
+			total = 0;
+			for (b = 0; b < IO_STATS_BUCKETS; b++) {
+				buckets[b] = __atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+				total += buckets[b];
+			}
+
+			st = (struct sanlk_io_stats *)(buf + pos);
+			memset(st, 0, sizeof(struct sanlk_io_stats));
+			memcpy(st->path, sp->path, SANLK_PATH_LEN);
+			st->op = op;
+			st->count = total;
+			st->errors = __atomic_load_n(&h->errors, __ATOMIC_RELAXED);
+			st->total_us = __atomic_load_n(&h->total_us, __ATOMIC_RELAXED);
+			st->max_us = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+			st->p50_us = hist_percentile(buckets, total, st->max_us, 500);
+			st->p99_us = hist_percentile(buckets, total, st->max_us, 990);
+			st->p999_us = hist_percentile(buckets, total, st->max_us, 999);
+
+			pos += sizeof(struct sanlk_io_stats);
+			num++;
+		}
+	}
+ out:
+	*len = pos;
+	*count = num;
+	return rv;
+}
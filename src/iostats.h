@@ -0,0 +1,42 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#ifndef __IOSTATS_H__
+#define __IOSTATS_H__
+
+/*
+ * Latency histograms of disk i/o for each disk path and type of i/o,
+ * see struct sanlk_io_stats in sanlock_admin.h.
+ */
+
+#define IO_STATS_BUCKETS 32  /* power of 2 usec buckets */
+#define IO_STATS_FDS     4096
+#define IO_STATS_PATHS   1024
+
+/*
+ * The type of i/o is set in the task before calling read/write
+ * functions in diskio.c, which clear it after the i/o.  i/o done
+ * without setting it is counted as OTHER_READ/OTHER_WRITE.
+ */
+
+static inline void set_io_op(struct task *task, int op)
+{
+	if (task)
+		task->io_op = op;
+}
+
+void io_stats_open(int fd, const char *path);
+void io_stats_close(int fd);
+
+/* begin is from trace_begin() */
+
+void io_stats_add(struct task *task, int fd, int cmd, uint64_t begin, int result);
+
+int copy_io_stats(char *buf, int *len, int *count, int maxlen);
+
+#endif
@@ -53,11 +53,17 @@
 
 /* leader_record flags */
 #define LFL_SHORT_HOLD 0x00000001
+/* the owner was named by the previous owner handing the lease over */
+#define LFL_HANDOFF    0x00000002
 /* skip ahead in flag numbers so these align flags match other defines */
 #define LFL_ALIGN_1M   0x00000010
 #define LFL_ALIGN_2M   0x00000020
 #define LFL_ALIGN_4M   0x00000040
 #define LFL_ALIGN_8M   0x00000080
+/* these lvb flags match the SANLK_RES_LVB defines */
+#define LFL_LVB_4K     0x00000400
+#define LFL_LVB_8K     0x00000800
+#define LFL_LVB_16K    0x00001000
 
 struct leader_record {
 	uint32_t magic;
@@ -93,13 +99,42 @@ struct leader_record {
 
 #define REQ_DISK_MAGIC 0x08292011
 #define REQ_DISK_VERSION_MAJOR 0x00010000
-#define REQ_DISK_VERSION_MINOR 0x00000001
+#define REQ_DISK_VERSION_MINOR 0x00000002
+
+/* host_id/host_generation (minor 2) name the requester for SANLK_REQ_HANDOFF */
 
 struct request_record {
 	uint32_t magic;
 	uint32_t version;
 	uint64_t lver;
 	uint32_t force_mode;
+	uint32_t pad1;
+	uint64_t host_id;
+	uint64_t host_generation;
+};
+
+/* the lvb is the sector after the dblock for host_id 2000, i.e. 2002 */
+
+#define LVB_SECTOR 2002
+
+/*
+ * A multi-sector lvb (LFL_LVB_ flags) ends each sector with this footer.
+ * Every sector of one lvb write carries the same lver, so a write that
+ * only partially reached the disk shows up as sectors with differing
+ * lvers or bad checksums.  The checksum covers the sector up to the
+ * checksum field.
+ */
+
+#define LVB_DISK_MAGIC 0x4C564210
+
+struct lvb_footer {
+	uint32_t magic;
+	uint32_t sector;	/* index in the lvb region */
+	uint64_t lver;		/* lease version of the host that wrote it */
+	uint32_t count;		/* number of sectors in the region */
+	uint32_t checksum;
 };
 
+#define LVB_FOOTER_CHECKSUM_OFF 20
+
 #endif
@@ -24,6 +24,13 @@
 #include <sys/time.h>
 #include <sys/un.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "sanlock_internal.h"
 #include "sanlock_admin.h"
@@ -38,9 +45,88 @@
 #include "task.h"
 #include "timeouts.h"
 #include "direct.h"
+#include "hash.h"
+#include "trace.h"
+#include "metrics.h"
+#include "hoststate.h"
+#include "affinity.h"
+
+int get_rand(int a, int b);
+void main_loop_wake(void);
 
 static uint32_t space_id_counter = 1;
 
+static void renew_pool_kick(struct space *sp);
+
+/*
+ * Lookups by name or space_id are frequent (every lockspace command, and
+ * every resource command through find_lockspace_id), so each struct space
+ * is also on a name hash bucket and a space_id hash bucket while it's on
+ * one of spaces/spaces_add/spaces_rem.  sp->on_list records which of those
+ * lists it's on.  All are protected by spaces_mutex.
+ */
+
+#define SPACE_HASH_SIZE 256
+
+static struct list_head space_name_hash[SPACE_HASH_SIZE];
+static struct list_head space_id_hash[SPACE_HASH_SIZE];
+
+static struct list_head *space_name_head(const char *name)
+{
+	return &space_name_hash[name_hash(name, NAME_ID_SIZE) % SPACE_HASH_SIZE];
+}
+
+static struct list_head *space_id_head(uint32_t space_id)
+{
+	return &space_id_hash[id_hash(space_id) % SPACE_HASH_SIZE];
+}
+
+void setup_lockspace_hash(void)
+{
+	int i;
+
+	for (i = 0; i < SPACE_HASH_SIZE; i++) {
+		INIT_LIST_HEAD(&space_name_hash[i]);
+		INIT_LIST_HEAD(&space_id_hash[i]);
+	}
+}
+
+static void space_list_add(struct space *sp, struct list_head *head)
+{
+	list_add(&sp->list, head);
+	list_add(&sp->name_hash_list, space_name_head(sp->space_name));
+	list_add(&sp->id_hash_list, space_id_head(sp->space_id));
+	sp->on_list = head;
+}
+
+void space_list_move(struct space *sp, struct list_head *head)
+{
+	list_move(&sp->list, head);
+	sp->on_list = head;
+}
+
+static void space_list_del(struct space *sp)
+{
+	list_del(&sp->list);
+	list_del(&sp->name_hash_list);
+	list_del(&sp->id_hash_list);
+	sp->on_list = NULL;
+}
+
+static int space_matches(struct space *sp, const char *name,
+			 struct sync_disk *disk, uint64_t host_id)
+{
+	if (name && strncmp(sp->space_name, name, NAME_ID_SIZE))
+		return 0;
+	if (disk && strncmp(sp->host_id_disk.path, disk->path, SANLK_PATH_LEN))
+		return 0;
+	if (disk && sp->host_id_disk.offset != disk->offset)
+		return 0;
+	if (host_id && sp->host_id != host_id)
+		return 0;
+	return 1;
+}
+
 static struct space *_search_space(const char *name,
 				   struct sync_disk *disk,
 				   uint64_t host_id,
@@ -50,8 +136,35 @@ static struct space *_search_space(const char *name,
 				   int *listnum)
 {
 	int i;
-	struct space *sp;
+	struct space *sp, *found = NULL;
 	struct list_head *heads[] = {head1, head2, head3};
+	int found_i = 3;
+
+	/*
+	 * With a name, only the name bucket needs to be checked.  The same
+	 * name can be on more than one list (e.g. being removed and added
+	 * again), so return the match from the earliest list given, as the
+	 * linear search does.
+	 */
+
+	if (name) {
+		list_for_each_entry(sp, space_name_head(name), name_hash_list) {
+			if (!space_matches(sp, name, disk, host_id))
+				continue;
+
+			for (i = 0; i < found_i; i++) {
+				if (heads[i] && sp->on_list == heads[i]) {
+					found = sp;
+					found_i = i;
+					break;
+				}
+			}
+		}
+
+		if (found && listnum)
+			*listnum = found_i+1;
+		return found;
+	}
 
 	for (i = 0; i < 3; i++) {
 		if (!heads[i]) {
@@ -59,13 +172,7 @@ static struct space *_search_space(const char *name,
 		}
 
 		list_for_each_entry(sp, heads[i], list) {
-			if (name && strncmp(sp->space_name, name, NAME_ID_SIZE))
-				continue;
-			if (disk && strncmp(sp->host_id_disk.path, disk->path, SANLK_PATH_LEN))
-				continue;
-			if (disk && sp->host_id_disk.offset != disk->offset)
-				continue;
-			if (host_id && sp->host_id != host_id)
+			if (!space_matches(sp, name, disk, host_id))
 				continue;
 
 			if (listnum)
@@ -85,8 +192,8 @@ static struct space *find_lockspace_id(uint32_t space_id)
 {
 	struct space *sp;
 
-	list_for_each_entry(sp, &spaces, list) {
-		if (sp->space_id == space_id)
+	list_for_each_entry(sp, space_id_head(space_id), id_hash_list) {
+		if (sp->space_id == space_id && sp->on_list == &spaces)
 			return sp;
 	}
 	return NULL;
@@ -215,6 +322,128 @@ int host_status_set_bit(char *space_name, uint64_t host_id)
 	return 0;
 }
 
+/*
+ * Along with the bitmap bit, tell the owner of a requested resource
+ * which resource to examine, using a SANLK_HOST_EVENT_REQUEST host event
+ * with the resource_name_hash() as data.  The owner then examines only
+ * that resource, without waiting out the set_bitmap_seconds between
+ * requests from one host.  An application event (which always replaces
+ * a request event) takes precedence, and the owner falls back to
+ * examining all its resources for the bitmap bit.  A second request
+ * while the first is still being sent makes the data zero, which has
+ * the owner of each also examine all resources, including an owner that
+ * has already examined the resource named by the first.  The lockspace thread
+ * is woken to renew early, so the request is on disk right away, but no
+ * more than once per io_timeout, see take_renewal_wake().
+ */
+
+int host_status_set_request(char *space_name, uint64_t host_id, uint32_t hash)
+{
+	struct space *sp;
+	struct sanlk_host_event *he;
+	uint64_t now;
+	int rv = 0;
+
+	if (!host_id || host_id > DEFAULT_MAX_HOSTS)
+		return -EINVAL;
+
+	pthread_mutex_lock(&spaces_mutex);
+	sp = _search_space(space_name, NULL, 0, &spaces, NULL, NULL, NULL);
+	pthread_mutex_unlock(&spaces_mutex);
+
+	if (!sp)
+		return -ENOSPC;
+
+	if (host_id > sp->max_hosts)
+		return -EINVAL;
+
+	now = monotime();
+	he = &sp->host_event;
+
+	pthread_mutex_lock(&sp->mutex);
+	sp->host_status[host_id-1].set_bit_time = now;
+
+	if ((now - sp->set_event_time < sp->set_bitmap_seconds) && he->event) {
+		if (he->event != SANLK_HOST_EVENT_REQUEST) {
+			rv = -EBUSY;
+			goto out;
+		}
+		if (he->host_id != host_id || he->data != hash)
+			hash = 0;
+	}
+
+	he->host_id = host_id;
+	he->generation = sp->host_status[host_id-1].owner_generation;
+	he->event = SANLK_HOST_EVENT_REQUEST;
+	he->data = hash;
+	sp->set_event_time = now;
+ out:
+	sp->renewal_wake = 1;
+	pthread_mutex_unlock(&sp->mutex);
+
+	renew_pool_kick(sp);
+
+	log_space(sp, "set request host_id %llu data %x rv %d",
+		  (unsigned long long)host_id, hash, rv);
+	return rv;
+}
+
+static void copy_host_status(struct space *sp, uint64_t host_id, struct host_status *hs_out)
+{
+	memcpy(hs_out, &sp->host_status[host_id-1], sizeof(struct host_status));
+
+	/*
+	 * A lease that the last renewal did not read (a free lease
+	 * skipped by a sparse read) may have been acquired since, so
+	 * what we have is reported as unchecked.  Our own lease is
+	 * always read.
+	 */
+	if (hs_out->last_check != sp->host_status[sp->host_id-1].last_check)
+		hs_out->last_check = 0;
+
+	if (!hs_out->io_timeout) {
+		log_erros(sp, "host_info %llu use own io_timeout %d",
+			  (unsigned long long)host_id, sp->io_timeout);
+		hs_out->io_timeout = sp->io_timeout;
+	}
+}
+
+/*
+ * Our delta lease in the lockspace has been renewed recently enough that
+ * no other host can consider us dead, and the lockspace is the same
+ * instance (generation) that a lease was acquired in.  Until renewals
+ * have failed for id_renewal_fail_seconds, other hosts can't take our
+ * paxos leases, so the leaders we last wrote are still what's on disk.
+ * The warn time is used to leave a margin.
+ */
+
+int lockspace_renewal_current(uint32_t space_id, uint64_t host_generation)
+{
+	struct space *sp;
+	uint64_t last_success;
+	int corrupt_result;
+	int gap, rv = 0;
+
+	pthread_mutex_lock(&spaces_mutex);
+	sp = find_lockspace_id(space_id);
+	if (!sp || sp->space_dead || sp->host_generation != host_generation)
+		goto out;
+
+	pthread_mutex_lock(&sp->mutex);
+	last_success = sp->lease_status.renewal_last_success;
+	corrupt_result = sp->lease_status.corrupt_result;
+	pthread_mutex_unlock(&sp->mutex);
+
+	gap = monotime() - last_success;
+
+	if (!corrupt_result && last_success &&
+	    gap < calc_id_renewal_warn_seconds(sp->io_timeout))
+		rv = 1;
+ out:
+	pthread_mutex_unlock(&spaces_mutex);
+	return rv;
+}
+
 int host_info(char *space_name, uint64_t host_id, struct host_status *hs_out)
 {
 	struct space *sp;
@@ -232,14 +461,8 @@ int host_info(char *space_name, uint64_t host_id, struct host_status *hs_out)
 			toobig = 1;
 			break;
 		}
-		memcpy(hs_out, &sp->host_status[host_id-1], sizeof(struct host_status));
+		copy_host_status(sp, host_id, hs_out);
 		found = 1;
-
-		if (!hs_out->io_timeout) {
-			log_erros(sp, "host_info %llu use own io_timeout %d",
-				  (unsigned long long)host_id, sp->io_timeout);
-			hs_out->io_timeout = sp->io_timeout;
-		}
 		break;
 	}
 	pthread_mutex_unlock(&spaces_mutex);
@@ -251,6 +474,120 @@ int host_info(char *space_name, uint64_t host_id, struct host_status *hs_out)
 	return 0;
 }
 
+/*
+ * host_info() for each host_id set in bitmap, copied to hs_out[host_id-1],
+ * with one lookup of the lockspace for a caller checking many hosts.
+ * host_ids beyond max_hosts are left zeroed, i.e. unchecked.
+ */
+
+int host_info_bitmap(char *space_name, char *bitmap, int num_hosts,
+		     struct host_status *hs_out)
+{
+	struct space *sp;
+	uint64_t host_id;
+	int found = 0;
+
+	if (num_hosts > DEFAULT_MAX_HOSTS)
+		num_hosts = DEFAULT_MAX_HOSTS;
+
+	memset(hs_out, 0, num_hosts * sizeof(struct host_status));
+
+	pthread_mutex_lock(&spaces_mutex);
+	list_for_each_entry(sp, &spaces, list) {
+		if (strncmp(sp->space_name, space_name, NAME_ID_SIZE))
+			continue;
+
+		for (host_id = 1; host_id <= (uint64_t)num_hosts; host_id++) {
+			if (host_id > sp->max_hosts)
+				break;
+			if (!test_id_bit(host_id, bitmap))
+				continue;
+			copy_host_status(sp, host_id, &hs_out[host_id-1]);
+		}
+		found = 1;
+		break;
+	}
+	pthread_mutex_unlock(&spaces_mutex);
+
+	if (!found)
+		return -ENOSPC;
+	return 0;
+}
+
+/*
+ * sp->host_status_gen is advanced each time the host_status of the
+ * lockspace is updated by check_other_leases, and when the lockspace is
+ * removed, so a thread waiting for news of another host does not need
+ * to poll.
+ */
+
+static void host_status_wake(struct space *sp)
+{
+	pthread_mutex_lock(&sp->mutex);
+	sp->host_status_gen++;
+	pthread_cond_broadcast(&sp->host_status_cond);
+	pthread_mutex_unlock(&sp->mutex);
+}
+
+/*
+ * Wait until the lockspace thread has checked host_id again since the
+ * check reported by last_check, returning 0 and the new host_info().
+ * Returns -ETIMEDOUT if that has not happened by deadline (monotime),
+ * or the host_info() error if the lockspace is gone.  The sp is not
+ * freed while host_status_waiters is set, see free_lockspaces.
+ */
+
+int host_info_wait(char *space_name, uint64_t host_id, uint64_t last_check,
+		   uint64_t deadline, struct host_status *hs_out)
+{
+	struct space *sp;
+	struct timespec ts;
+	uint64_t gen, now;
+	int rv;
+
+	pthread_mutex_lock(&spaces_mutex);
+	sp = find_lockspace(space_name);
+	if (!sp || sp->on_list != &spaces) {
+		pthread_mutex_unlock(&spaces_mutex);
+		return -ENOSPC;
+	}
+	sp->host_status_waiters++;
+	pthread_mutex_lock(&sp->mutex);
+	gen = sp->host_status_gen;
+	pthread_mutex_unlock(&sp->mutex);
+	pthread_mutex_unlock(&spaces_mutex);
+
+	while (1) {
+		rv = host_info(space_name, host_id, hs_out);
+		if (rv < 0)
+			break;
+		if (hs_out->last_check != last_check)
+			break;
+
+		now = monotime();
+		if (now >= deadline || external_shutdown) {
+			rv = -ETIMEDOUT;
+			break;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ts.tv_sec += deadline - now;
+
+		pthread_mutex_lock(&sp->mutex);
+		while (gen == sp->host_status_gen) {
+			if (pthread_cond_timedwait(&sp->host_status_cond, &sp->mutex, &ts) == ETIMEDOUT)
+				break;
+		}
+		gen = sp->host_status_gen;
+		pthread_mutex_unlock(&sp->mutex);
+	}
+
+	pthread_mutex_lock(&spaces_mutex);
+	sp->host_status_waiters--;
+	pthread_mutex_unlock(&spaces_mutex);
+	return rv;
+}
+
 static void create_bitmap_and_extra(struct space *sp, char *bitmap, struct delta_extra *extra)
 {
 	uint64_t now;
@@ -295,10 +632,125 @@ static void create_bitmap_and_extra(struct space *sp, char *bitmap, struct delta
  * delta leases that were read in the last renewal, into
  * sp->lease_status.renewal_read_buf.  Then check_our_lease() called
  * by the main loop makes a copy of sp->lease_status.renewal_read_buf
- * to pass to this function.
+ * to pass to this function.  When the renewal read only some ranges of
+ * leases (renewal_sweep_interval), the others are not checked; their
+ * host_status keeps the last_check of the last read that included them.
+ */
+
+static int renewal_read_includes(struct renewal_read *rr, int i)
+{
+	int r;
+
+	if (!rr || !rr->num_ranges)
+		return 1;
+
+	for (r = 0; r < rr->num_ranges; r++) {
+		if (i >= rr->start[r] && i < rr->start[r] + rr->count[r])
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Most host_id leases have not been written since the last renewal read,
+ * so compare the bytes a write would change with those seen in the last
+ * read before doing any decoding.  Only the unchanged sector of a lease
+ * that was last found valid is skipped; the full checks below would find
+ * nothing new in it.  The bytes are compared in disk order, so no endian
+ * conversion is needed.
+ */
+
+static const int leader_key_offsets[LEADER_KEY_WORDS] = {
+	offsetof(struct leader_record, owner_id),	/* owner_id, owner_generation */
+	offsetof(struct leader_record, timestamp),	/* timestamp, unused1 */
+	offsetof(struct leader_record, checksum),	/* checksum .. write_id */
+};
+
+static inline int leader_key_changed(struct leader_key *key, const char *sector)
+{
+#if defined(__SSE2__)
+	const __m128i *kw = (const __m128i *)key->w;
+	__m128i eq, a, b;
+	int i;
+
+	eq = _mm_set1_epi8(-1);
+	for (i = 0; i < LEADER_KEY_WORDS; i++) {
+		a = _mm_loadu_si128((const __m128i *)(sector + leader_key_offsets[i]));
+		b = _mm_loadu_si128(kw + i);
+		eq = _mm_and_si128(eq, _mm_cmpeq_epi8(a, b));
+	}
+	return _mm_movemask_epi8(eq) != 0xffff;
+#elif defined(__ARM_NEON)
+	const uint8_t *kw = (const uint8_t *)key->w;
+	uint8x16_t eq, a, b;
+	int i;
+
+	eq = vdupq_n_u8(0xff);
+	for (i = 0; i < LEADER_KEY_WORDS; i++) {
+		a = vld1q_u8((const uint8_t *)(sector + leader_key_offsets[i]));
+		b = vld1q_u8(kw + i * 16);
+		eq = vandq_u8(eq, vceqq_u8(a, b));
+	}
+	return vminvq_u8(eq) != 0xff;
+#else
+	int i;
+
+	for (i = 0; i < LEADER_KEY_WORDS; i++) {
+		if (memcmp(sector + leader_key_offsets[i], &key->w[i * 2], 16))
+			return 1;
+	}
+	return 0;
+#endif
+}
+
+static void leader_key_save(struct leader_key *key, const char *sector)
+{
+	int i;
+
+	for (i = 0; i < LEADER_KEY_WORDS; i++)
+		memcpy(&key->w[i * 2], sector + leader_key_offsets[i], 16);
+}
+
+/*
+ * Each change of a host's state, generation or flags as reported by
+ * get_hosts takes the next sp->host_change_seq, so get_hosts_changed can
+ * return the hosts that changed since a sequence number the caller got
+ * previously.  The state of a host changes with time as well as with the
+ * leases read, so all hosts are checked after each check_other_leases.
+ * A new instance of the lockspace starts with a sequence number based on
+ * the time, so it's larger than any of a previous instance, unless that
+ * made more than 2^HOST_CHANGE_SEQ_SHIFT changes per second.
  */
 
-void check_other_leases(struct space *sp, char *buf)
+#define HOST_CHANGE_SEQ_SHIFT 20
+
+static uint32_t get_host_flag(struct space *sp, struct host_status *hs);
+
+static void host_changes_update(struct space *sp)
+{
+	struct host_status *hs;
+	uint32_t flag;
+	int i;
+
+	for (i = 0; i < sp->max_hosts; i++) {
+		hs = &sp->host_status[i];
+
+		if (!hs->timestamp && !hs->change_seq)
+			continue;
+
+		flag = get_host_flag(sp, hs);
+
+		if (hs->change_seq && flag == hs->change_flag &&
+		    hs->owner_generation == hs->change_generation)
+			continue;
+
+		hs->change_flag = flag;
+		hs->change_generation = hs->owner_generation;
+		hs->change_seq = ++sp->host_change_seq;
+	}
+}
+
+void check_other_leases(struct space *sp, char *buf, struct renewal_read *rr)
 {
 	struct leader_record leader_in;
 	struct leader_record *leader_end;
@@ -313,16 +765,26 @@ void check_other_leases(struct space *sp, char *buf)
 	new = 0;
 
 	for (i = 0; i < sp->max_hosts; i++) {
+		if (!renewal_read_includes(rr, i))
+			continue;
+
 		hs = &sp->host_status[i];
-		hs->last_check = now;
 
 		if (!hs->first_check)
 			hs->first_check = now;
 
 		leader_end = (struct leader_record *)(buf + (i * sp->sector_size));
 
-		leader_record_in(leader_end, &leader_in);
-		leader = &leader_in;
+		/* last_check was zero when this lease had not been read before */
+		if (hs->last_check && !hs->lease_bad &&
+		    !leader_key_changed(&sp->leader_keys[i], (char *)leader_end)) {
+			hs->last_check = now;
+			continue;
+		}
+
+		hs->last_check = now;
+
+		leader = leader_record_ref(leader_end, &leader_in);
 
 		/*
 		 * If this lease has invalid fields, log an error.  Limit the logging
@@ -336,7 +798,7 @@ void check_other_leases(struct space *sp, char *buf)
 					  (unsigned long long)hs->owner_id,
 					  (unsigned long long)hs->owner_generation,
 					  (unsigned long long)hs->timestamp,
-					  hs->owner_name,
+					  sp->host_names[i],
 					  sp->space_name);
 				log_erros(sp, "check_other_lease leader %x owner %llu %llu ts %llu sn %.48s rn %.48s",
 					  leader->magic,
@@ -355,24 +817,25 @@ void check_other_leases(struct space *sp, char *buf)
 					  (unsigned long long)hs->owner_id,
 					  (unsigned long long)hs->owner_generation,
 					  (unsigned long long)hs->timestamp,
-					  hs->owner_name,
+					  sp->host_names[i],
 					  sp->space_name);
 			}
 			hs->lease_bad = 0;
+			leader_key_save(&sp->leader_keys[i], (char *)leader_end);
 		}
 
 		/*
 		 * Save a record of each new host instance to help with debugging.
 		 */
 		if (!hs->lease_bad &&
-		    (strncmp(hs->owner_name, leader->resource_name, NAME_ID_SIZE) ||
+		    (strncmp(sp->host_names[i], leader->resource_name, NAME_ID_SIZE) ||
 		     (hs->owner_generation != leader->owner_generation))) {
 			log_warns(sp, "host %llu %llu %llu %.48s",
 				  (unsigned long long)leader->owner_id,
 				  (unsigned long long)leader->owner_generation,
 				  (unsigned long long)leader->timestamp,
 				  leader->resource_name);
-			strncpy(hs->owner_name, leader->resource_name, NAME_ID_SIZE);
+			strncpy(sp->host_names[i], leader->resource_name, NAME_ID_SIZE);
 		}
 
 		if (hs->owner_id == leader->owner_id &&
@@ -392,7 +855,7 @@ void check_other_leases(struct space *sp, char *buf)
 		if (!hs->lease_bad) {
 			hs->owner_id = leader->owner_id;
 			hs->owner_generation = leader->owner_generation;
-			strncpy(hs->owner_name, leader->resource_name, NAME_ID_SIZE);
+			strncpy(sp->host_names[i], leader->resource_name, NAME_ID_SIZE);
 			hs->io_timeout = leader->io_timeout;
 		}
 
@@ -423,7 +886,25 @@ void check_other_leases(struct space *sp, char *buf)
 		 * convenient place to do callbacks (we don't want
 		 * the main thread to be delayed with that.)
 		 */
-		if (he.event) {
+		/*
+		 * A request event names the resource, see
+		 * host_status_set_request().  The bit stays set for
+		 * set_bitmap_seconds, so only act on new data.
+		 */
+		if (he.event == SANLK_HOST_EVENT_REQUEST && he.data) {
+			if (hs->last_req_data == he.data &&
+			    now - hs->last_req < sp->set_bitmap_seconds)
+				continue;
+
+			log_space(sp, "request event from host_id %d data %llx",
+				  i+1, (unsigned long long)he.data);
+			hs->last_req = now;
+			hs->last_req_data = he.data;
+			set_resource_examine_hash(sp->space_name, (uint32_t)he.data);
+			continue;
+		}
+
+		if (he.event && he.event != SANLK_HOST_EVENT_REQUEST) {
 			/*
 			 * lock order: spaces_mutex (main_loop), then
 			 * resource_mutex (add_host_event).
@@ -436,11 +917,20 @@ void check_other_leases(struct space *sp, char *buf)
 		/* this host has made a resource request for us, we won't take a new
 		   request from this host for another set_bitmap_seconds */
 
-		if (now - hs->last_req < sp->set_bitmap_seconds)
-			continue;
+		/*
+		 * Unless the last request only had us examine the resource
+		 * it named: the request event has been replaced, by a
+		 * request with zero data (for more than one resource) or an
+		 * application event, and the other resources it may be for
+		 * need to be examined.
+		 */
+
+		if (now - hs->last_req < sp->set_bitmap_seconds && !hs->last_req_data)
+			continue;
 
 		log_space(sp, "request from host_id %d", i+1);
 		hs->last_req = now;
+		hs->last_req_data = 0;
 		new = 1;
 	}
 
@@ -450,13 +940,31 @@ void check_other_leases(struct space *sp, char *buf)
 	 */
 	if (new)
 		set_resource_examine(sp->space_name, NULL);
+
+	host_changes_update(sp);
+
+	sp->host_status_warm = 0;
+	host_state_save(sp);
+	host_status_wake(sp);
 }
 
 /*
  * check if our_host_id_thread has renewed within timeout
  */
 
-int check_our_lease(struct space *sp, int *check_all, char *check_buf)
+/*
+ * main_loop checks a lockspace when a deadline returned by check_our_lease
+ * or check_host_states is reached, or when it is told to by this.
+ */
+
+static void lockspace_check_wake(struct space *sp)
+{
+	__atomic_store_n(&sp->check_wake, 1, __ATOMIC_RELEASE);
+	main_loop_wake();
+}
+
+int check_our_lease(struct space *sp, int *check_all, char *check_buf,
+		    struct renewal_read *check_read, uint64_t *deadline)
 {
 	int id_renewal_fail_seconds, id_renewal_warn_seconds;
 	uint64_t last_success;
@@ -476,6 +984,8 @@ int check_our_lease(struct space *sp, int *check_all, char *check_buf)
 		*check_all = 1;
 		if (check_buf)
 			memcpy(check_buf, sp->lease_status.renewal_read_buf, sp->align_size);
+		if (check_read)
+			memcpy(check_read, &sp->lease_status.renewal_read, sizeof(struct renewal_read));
 	}
 	pthread_mutex_unlock(&sp->mutex);
 
@@ -497,6 +1007,9 @@ int check_our_lease(struct space *sp, int *check_all, char *check_buf)
 	if (gap >= id_renewal_warn_seconds) {
 		log_erros(sp, "check_our_lease warning %d last_success %llu",
 			  gap, (unsigned long long)last_success);
+		*deadline = last_success + id_renewal_fail_seconds;
+	} else {
+		*deadline = last_success + id_renewal_warn_seconds;
 	}
 
 	if (com.debug_renew > 1) {
@@ -539,6 +1052,8 @@ static void close_event_fds(struct space *sp)
 
 		close(sp->event_fds[i]);
 		sp->event_fds[i] = -1;
+		free(sp->event_filters[i]);
+		sp->event_filters[i] = NULL;
 	}
 	pthread_mutex_unlock(&sp->mutex);
 }
@@ -581,6 +1096,69 @@ static void save_renewal_history(struct space *sp, int delta_result,
 	}
 }
 
+/* the longest read+write time of the last few successful renewals */
+
+#define ADAPTIVE_HISTORY_COUNT 4
+
+static int renewal_recent_ms(struct space *sp)
+{
+	struct renewal_history *hi;
+	int i, n, ms, max_ms = 0;
+
+	if (!sp->renewal_history_size || !sp->renewal_history)
+		return 0;
+
+	n = sp->renewal_history_prev;
+
+	for (i = 0; i < ADAPTIVE_HISTORY_COUNT && i < sp->renewal_history_size; i++) {
+		hi = &sp->renewal_history[n];
+		if (!hi->timestamp)
+			break;
+
+		/* a renewal that timed out took at least io_timeout */
+		if (hi->next_timeouts)
+			ms = sp->io_timeout * 1000;
+		else
+			ms = hi->read_ms + hi->write_ms;
+		if (ms > max_ms)
+			max_ms = ms;
+
+		n = n ? n - 1 : sp->renewal_history_size - 1;
+	}
+
+	return max_ms;
+}
+
+/* when to start the next renewal, in seconds after the last success */
+
+static int next_renewal_seconds(struct space *sp, int id_renewal_seconds)
+{
+	int seconds, latency_ms;
+
+	if (!com.renewal_adaptive)
+		return id_renewal_seconds;
+
+	pthread_mutex_lock(&sp->mutex);
+	latency_ms = renewal_recent_ms(sp);
+	pthread_mutex_unlock(&sp->mutex);
+
+	seconds = calc_adaptive_renewal_seconds(sp->io_timeout, latency_ms);
+
+	/* spread renewals of hosts sharing the storage */
+	if (sp->io_timeout / 2)
+		seconds -= get_rand(0, sp->io_timeout / 2);
+
+	if (seconds < sp->io_timeout)
+		seconds = sp->io_timeout;
+	if (seconds < 1)
+		seconds = 1;
+
+	if (com.debug_renew && seconds != id_renewal_seconds)
+		log_space(sp, "next renewal %d sec latency %d ms", seconds, latency_ms);
+
+	return seconds;
+}
+
 #define ONE_MB_IN_BYTES 1048576
 #define ONE_MB_IN_KB 1024
 
@@ -655,44 +1233,203 @@ static void set_lockspace_max_sectors_kb(struct space *sp, int sector_size, int
 }
 
 /*
- * This thread must not be stopped unless all pids that may be using any
- * resources in it are dead/gone.  (The USED flag in the lockspace represents
- * pids using resources in the lockspace, when those pids are not using actual
- * sanlock resources.  So the USED flag must also prevent this thread from
- * stopping.)
+ * renewal_coalesce: lockspaces whose host_id leases are on the same device
+ * share a renew_group.  When one member is due to renew it starts a new
+ * round, and the other members that are at least half way through their
+ * renewal interval renew along with it.  Renewing early only extends a
+ * lease, so after the first round the members on a device renew together
+ * and their reads and writes reach the device at the same time instead of
+ * being spread across the renewal interval.  Each member still does its
+ * own renewal with its own task, result and watchdog connection, so a
+ * failure or i/o timeout in one lockspace does not delay the others.
  */
 
-static void *lockspace_thread(void *arg_in)
+struct renew_group {
+	struct list_head list;
+	dev_t dev;
+	int members;
+	uint64_t round;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static LIST_HEAD(renew_groups);
+static pthread_mutex_t renew_groups_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct renew_group *renew_group_join(struct space *sp, uint64_t *round)
 {
-	char bitmap[HOSTID_BITMAP_SIZE];
-	struct delta_extra extra;
-	struct task task;
+	struct renew_group *rg;
+	struct stat st;
+	dev_t dev;
+
+	if (fstat(sp->host_id_disk.fd, &st) < 0) {
+		log_erros(sp, "renewal group fstat error %d", errno);
+		return NULL;
+	}
+
+	dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+
+	pthread_mutex_lock(&renew_groups_mutex);
+	list_for_each_entry(rg, &renew_groups, list) {
+		if (rg->dev == dev)
+			goto found;
+	}
+
+	rg = malloc(sizeof(struct renew_group));
+	if (!rg) {
+		pthread_mutex_unlock(&renew_groups_mutex);
+		return NULL;
+	}
+	memset(rg, 0, sizeof(struct renew_group));
+	rg->dev = dev;
+	pthread_mutex_init(&rg->mutex, NULL);
+	pthread_cond_init(&rg->cond, NULL);
+	list_add_tail(&rg->list, &renew_groups);
+ found:
+	rg->members++;
+	pthread_mutex_lock(&rg->mutex);
+	*round = rg->round;
+	pthread_mutex_unlock(&rg->mutex);
+	pthread_mutex_unlock(&renew_groups_mutex);
+
+	log_space(sp, "renewal group %u:%u members %d",
+		  major(dev), minor(dev), rg->members);
+	return rg;
+}
+
+static void renew_group_leave(struct renew_group *rg)
+{
+	pthread_mutex_lock(&renew_groups_mutex);
+	if (!--rg->members) {
+		list_del(&rg->list);
+		pthread_mutex_destroy(&rg->mutex);
+		pthread_cond_destroy(&rg->cond);
+		free(rg);
+	}
+	pthread_mutex_unlock(&renew_groups_mutex);
+}
+
+/*
+ * Returns 1 when the caller should renew now, either because its own
+ * renewal is due, or because another member started a round and the
+ * caller is far enough into its interval to join it.  Otherwise waits
+ * up to a second for a round to start and returns 0.
+ */
+
+static int renew_group_wait(struct renew_group *rg, uint64_t *round,
+			    uint64_t last_success, int id_renewal_seconds)
+{
+	struct timespec ts;
+	int renew = 0;
+
+	pthread_mutex_lock(&rg->mutex);
+	if (monotime() - last_success >= id_renewal_seconds) {
+		if (rg->round == *round) {
+			rg->round++;
+			pthread_cond_broadcast(&rg->cond);
+		}
+		*round = rg->round;
+		renew = 1;
+		goto out;
+	}
+
+	if (rg->round == *round) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += 1;
+		pthread_cond_timedwait(&rg->cond, &rg->mutex, &ts);
+	}
+
+	if (rg->round != *round) {
+		*round = rg->round;
+		if (monotime() - last_success >= id_renewal_seconds / 2)
+			renew = 1;
+	}
+ out:
+	pthread_mutex_unlock(&rg->mutex);
+	return renew;
+}
+
+/*
+ * The state of the delta lease renewal of a lockspace, used by the
+ * lockspace thread or the renewal thread that renews it.
+ */
+
+struct renew_state {
 	struct space *sp;
+	struct task task;
 	struct leader_record leader;
-	uint64_t delta_begin, last_success = 0;
-	int sector_size = 0;
-	int align_size = 0;
-	int max_hosts = 0;
-	int log_renewal_level = -1;
-	int rv, delta_length, renewal_interval = 0;
-	int id_renewal_seconds, id_renewal_fail_seconds;
-	int acquire_result, delta_result, read_result;
-	int rd_ms, wr_ms;
-	int opened = 0;
-	int stop = 0;
-	int wd_con;
+	struct renew_group *rg;
+	uint64_t renew_round;
+	uint64_t last_success;
+	int id_renewal_seconds;
+	int id_renewal_fail_seconds;
+	int renewal_seconds;
+	int renewal_interval;
+	int log_renewal_level;
+	int delta_result;
+	int read_result;
+	int opened;
+
+	/* renewal threads, protected by renew_pool.mutex */
+	int pool;			/* renewed by renewal threads */
+	struct list_head list;		/* renew_pool.spaces */
+	struct list_head wheel_list;	/* renew_pool.wheel */
+	uint64_t due;
+	uint64_t due_us;		/* for the renewal wake stats */
+	dev_t dev;
+	int queued;			/* on the wheel, otherwise being renewed */
+	int kicked;			/* renew now, see renew_pool_kick */
+	int done;			/* released, sp can be freed */
+};
 
-	if (com.debug_renew)
-		log_renewal_level = LOG_DEBUG;
+/*
+ * Time reads of the host_id area, and of a dblock area the size read by a
+ * ballot with max_hosts, to choose how many parallel i/os each is read
+ * with on this device.  The resource leases of the lockspace are usually
+ * on the same device or one like it.
+ */
 
-	sp = (struct space *)arg_in;
+static void calibrate_lockspace_io(struct space *sp, struct renew_state *rs)
+{
+	struct io_tune tune;
+	char *iobuf;
+	int dblock_len;
+	int rv;
 
-	memset(&task, 0, sizeof(struct task));
-	setup_task_aio(&task, main_task.use_aio, HOSTID_AIO_CB_SIZE);
-	memcpy(task.name, sp->space_name, NAME_ID_SIZE);
+	dblock_len = sp->sector_size;
+	while (dblock_len < (sp->max_hosts + 2) * sp->sector_size)
+		dblock_len *= 2;
+	if (dblock_len > sp->align_size)
+		dblock_len = sp->align_size;
 
-	id_renewal_seconds = calc_id_renewal_seconds(sp->io_timeout);
-	id_renewal_fail_seconds = calc_id_renewal_fail_seconds(sp->io_timeout);
+	if (task_iobuf_alloc(&rs->task, sp->align_size, &iobuf))
+		return;
+
+	rv = io_tune_calibrate(&rs->task, &sp->host_id_disk, iobuf, sp->align_size,
+			       dblock_len, sp->io_timeout);
+	if (rv)
+		log_erros(sp, "io_tune calibrate error %d %s", rv, sp->host_id_disk.path);
+
+	if (rv != SANLK_AIO_TIMEOUT)
+		task_iobuf_free(&rs->task, iobuf);
+
+	if (!io_tune_get(sp->host_id_disk.fd, &tune))
+		log_space(sp, "io_tune host_id_read_split %d dblock_read_split %d",
+			  tune.host_id_split, tune.dblock_split);
+}
+
+static int lockspace_acquire(struct space *sp, struct renew_state *rs)
+{
+	uint64_t delta_begin;
+	int sector_size = 0;
+	int align_size = 0;
+	int max_hosts = 0;
+	int acquire_result;
+	int rv, wd_con;
+
+	rs->delta_result = -1;
+	rs->id_renewal_seconds = calc_id_renewal_seconds(sp->io_timeout);
+	rs->id_renewal_fail_seconds = calc_id_renewal_fail_seconds(sp->io_timeout);
 
 	delta_begin = monotime();
 
@@ -700,23 +1437,29 @@ static void *lockspace_thread(void *arg_in)
 	if (rv < 0) {
 		log_erros(sp, "open_disk %s error %d", sp->host_id_disk.path, rv);
 		acquire_result = -ENODEV;
-		delta_result = -1;
 		goto set_status;
 	}
-	opened = 1;
+	rs->opened = 1;
+
+	if (com.renewal_multipath) {
+		rv = lease_paths_open(&sp->host_id_disk, &sp->lease_paths);
+		if (rv < 0)
+			log_erros(sp, "lease paths error %d %s", rv, sp->host_id_disk.path);
+		else if (sp->lease_paths)
+			log_space(sp, "renewal uses %d paths of %s", sp->lease_paths->count,
+				  sp->host_id_disk.path);
+	}
 
-	rv = delta_read_lockspace_sizes(&task, &sp->host_id_disk, sp->io_timeout, &sector_size, &align_size);
+	rv = delta_read_lockspace_sizes(&rs->task, &sp->host_id_disk, sp->io_timeout, &sector_size, &align_size);
 	if (rv < 0) {
 		log_erros(sp, "failed to read device to find sector size error %d %s", rv, sp->host_id_disk.path);
 		acquire_result = rv;
-		delta_result = -1;
 		goto set_status;
 	}
 
 	if ((sector_size != 512) && (sector_size != 4096)) {
 		log_erros(sp, "failed to get valid sector size %d %s", sector_size, sp->host_id_disk.path);
 		acquire_result = SANLK_LEADER_SECTORSIZE;
-		delta_result = -1;
 		goto set_status;
 	}
 
@@ -724,14 +1467,12 @@ static void *lockspace_thread(void *arg_in)
 	if (!max_hosts) {
 		log_erros(sp, "invalid combination of sector size %d and align_size %d", sector_size, align_size);
 		acquire_result = SANLK_ADDLS_SIZES;
-		delta_result = -1;
 		goto set_status;
 	}
 
 	if (sp->host_id > max_hosts) {
 		log_erros(sp, "host_id %llu too large for max_hosts %d", (unsigned long long)sp->host_id, max_hosts);
 		acquire_result = SANLK_ADDLS_INVALID_HOSTID;
-		delta_result = -1;
 		goto set_status;
 	}
 
@@ -741,19 +1482,33 @@ static void *lockspace_thread(void *arg_in)
 
 	set_lockspace_max_sectors_kb(sp, sector_size, align_size);
 
+	if (com.io_tune)
+		calibrate_lockspace_io(sp, rs);
+	sp->host_id_read_split = io_tune_split(sp->host_id_disk.fd, IO_TUNE_HOST_ID);
+
 	sp->lease_status.renewal_read_buf = malloc(sp->align_size);
 	if (!sp->lease_status.renewal_read_buf) {
 		acquire_result = -ENOMEM;
-		delta_result = -1;
 		goto set_status;
 	}
 
+	sp->host_status = calloc(max_hosts, sizeof(struct host_status));
+	sp->leader_keys = calloc(max_hosts, sizeof(struct leader_key));
+	sp->host_names = calloc(max_hosts, NAME_ID_SIZE);
+	if (!sp->host_status || !sp->leader_keys || !sp->host_names) {
+		acquire_result = -ENOMEM;
+		goto set_status;
+	}
+
+	/* larger than the host_change_seq of a previous instance */
+	sp->host_change_seq = (uint64_t)time(NULL) << HOST_CHANGE_SEQ_SHIFT;
+	sp->host_change_first = sp->host_change_seq;
+
 	/* Connect first so we can fail quickly if wdmd is not running. */
 	wd_con = connect_watchdog(sp);
 	if (wd_con < 0) {
 		log_erros(sp, "connect_watchdog failed %d", wd_con);
 		acquire_result = SANLK_WD_ERROR;
-		delta_result = -1;
 		goto set_status;
 	}
 
@@ -763,21 +1518,20 @@ static void *lockspace_thread(void *arg_in)
 
 	delta_begin = monotime();
 
-	delta_result = delta_lease_acquire(&task, sp, &sp->host_id_disk,
-					   sp->space_name, our_host_name_global,
-					   sp->host_id, &leader);
-	delta_length = monotime() - delta_begin;
+	rs->delta_result = delta_lease_acquire(&rs->task, sp, &sp->host_id_disk,
+					       sp->space_name, our_host_name_global,
+					       sp->host_id, &rs->leader);
 
-	if (delta_result == SANLK_OK)
-		last_success = leader.timestamp;
+	if (rs->delta_result == SANLK_OK)
+		rs->last_success = rs->leader.timestamp;
 
-	acquire_result = delta_result;
+	acquire_result = rs->delta_result;
 
 	/* we need to start the watchdog after we acquire the host_id but
 	   before we allow any pid's to begin running */
 
-	if (delta_result == SANLK_OK) {
-		rv = activate_watchdog(sp, last_success, id_renewal_fail_seconds, wd_con);
+	if (rs->delta_result == SANLK_OK) {
+		rv = activate_watchdog(sp, rs->last_success, rs->id_renewal_fail_seconds, wd_con);
 		if (rv < 0) {
 			log_erros(sp, "activate_watchdog failed %d", rv);
 			acquire_result = SANLK_WD_ERROR;
@@ -787,163 +1541,623 @@ static void *lockspace_thread(void *arg_in)
 			close(wd_con);
 	}
 
+	/* before set_status, which adds to the restored renewal history */
+	if (acquire_result == SANLK_OK)
+		host_state_load(sp);
+
  set_status:
 	pthread_mutex_lock(&sp->mutex);
 	sp->lease_status.acquire_last_result = acquire_result;
 	sp->lease_status.acquire_last_attempt = delta_begin;
-	if (delta_result == SANLK_OK)
-		sp->lease_status.acquire_last_success = last_success;
+	if (rs->delta_result == SANLK_OK)
+		sp->lease_status.acquire_last_success = rs->last_success;
 	sp->lease_status.renewal_last_result = acquire_result;
 	sp->lease_status.renewal_last_attempt = delta_begin;
-	if (delta_result == SANLK_OK)
-		sp->lease_status.renewal_last_success = last_success;
+	if (rs->delta_result == SANLK_OK)
+		sp->lease_status.renewal_last_success = rs->last_success;
 	/* First renewal entry shows the acquire time with 0 latencies. */
-	save_renewal_history(sp, delta_result, last_success, 0, 0);
+	save_renewal_history(sp, rs->delta_result, rs->last_success, 0, 0);
 	pthread_mutex_unlock(&sp->mutex);
 
-	if (acquire_result < 0)
-		goto out;
+	if (acquire_result == SANLK_OK) {
+		sp->host_generation = rs->leader.owner_generation;
+		rs->renewal_seconds = next_renewal_seconds(sp, rs->id_renewal_seconds);
+	}
+
+	return acquire_result;
+}
+
+/*
+ * do a renewal, measuring length of time spent in renewal,
+ * and the length of time between successful renewals
+ */
+
+static void lockspace_renew(struct space *sp, struct renew_state *rs)
+{
+	char bitmap[HOSTID_BITMAP_SIZE];
+	struct delta_extra extra;
+	uint64_t delta_begin;
+	uint64_t trace_start;
+	int delta_length;
+	int rd_ms, wr_ms;
+
+	memset(bitmap, 0, sizeof(bitmap));
+	memset(&extra, 0, sizeof(extra));
+	create_bitmap_and_extra(sp, bitmap, &extra);
+
+	delta_begin = monotime();
+	trace_start = trace_begin();
+
+	rs->delta_result = delta_lease_renew(&rs->task, sp, &sp->host_id_disk,
+					     sp->space_name, bitmap, &extra,
+					     rs->delta_result, &rs->read_result,
+					     rs->log_renewal_level,
+					     &rs->leader, &rs->leader,
+					     &rd_ms, &wr_ms);
+	delta_length = monotime() - delta_begin;
+
+	trace_event(SANLK_TRACE_DELTA_RENEW, sp->space_id, 0, 0, 0,
+		    sp->host_id_disk.offset + ((sp->host_id - 1) * sp->sector_size),
+		    trace_start, rs->delta_result);
+
+	if (rs->delta_result == SANLK_OK) {
+		rs->renewal_interval = rs->leader.timestamp - rs->last_success;
+		rs->last_success = rs->leader.timestamp;
+		metrics_add(sp->space_id, METRIC_RENEWAL_READ_MS, rd_ms);
+		metrics_add(sp->space_id, METRIC_RENEWAL_WRITE_MS, wr_ms);
+	} else {
+		metrics_add(sp->space_id, METRIC_RENEWAL_ERRORS, 1);
+	}
+	metrics_add(sp->space_id, METRIC_RENEWALS, 1);
+
+
+	/*
+	 * publish the results
+	 */
+
+	pthread_mutex_lock(&sp->mutex);
+	sp->lease_status.renewal_last_result = rs->delta_result;
+	sp->lease_status.renewal_last_attempt = delta_begin;
+
+	if (rs->delta_result == SANLK_OK)
+		sp->lease_status.renewal_last_success = rs->last_success;
+
+	if (rs->delta_result != SANLK_OK && !sp->lease_status.corrupt_result)
+		sp->lease_status.corrupt_result = corrupt_result(rs->delta_result);
+
+	if (rs->read_result == SANLK_OK && rs->task.iobuf) {
+		/* NB. be careful with how this iobuf escapes */
+		memcpy(sp->lease_status.renewal_read_buf, rs->task.iobuf, sp->align_size);
+		memcpy(&sp->lease_status.renewal_read, &sp->renewal_read_plan,
+		       sizeof(struct renewal_read));
+		sp->lease_status.renewal_read_count++;
+	}
+
+	/*
+	 * pet the watchdog
+	 * (don't update on thread_stop because it's probably unlinked)
+	 */
+
+	if (rs->delta_result == SANLK_OK && !sp->thread_stop)
+		update_watchdog(sp, rs->last_success, rs->id_renewal_fail_seconds);
+
+	save_renewal_history(sp, rs->delta_result, rs->last_success, rd_ms, wr_ms);
+	pthread_mutex_unlock(&sp->mutex);
+
+	/* main_loop scans other leases in the read, or handles the error */
+	lockspace_check_wake(sp);
+
+	if (rs->delta_result == SANLK_OK)
+		rs->renewal_seconds = next_renewal_seconds(sp, rs->id_renewal_seconds);
+
+
+	/*
+	 * log the results
+	 */
+
+	if (rs->delta_result != SANLK_OK) {
+		log_erros(sp, "renewal error %d delta_length %d last_success %llu",
+			  rs->delta_result, delta_length, (unsigned long long)rs->last_success);
+	} else if (delta_length > rs->id_renewal_seconds) {
+		log_erros(sp, "renewed %llu delta_length %d too long",
+			  (unsigned long long)rs->last_success, delta_length);
+	} else {
+		if (com.debug_renew) {
+			log_space(sp, "renewed %llu delta_length %d interval %d",
+				  (unsigned long long)rs->last_success, delta_length,
+				  rs->renewal_interval);
+		}
+	}
+}
+
+static void lockspace_release(struct space *sp, struct renew_state *rs)
+{
+	if (rs->delta_result == SANLK_OK)
+		delta_lease_release(&rs->task, sp, &sp->host_id_disk,
+				    sp->space_name, &rs->leader, &rs->leader);
+
+	if (rs->opened)
+		close_disks(&sp->host_id_disk, 1);
+
+	/*
+	 * TODO: are there cases where struct resources for this lockspace
+	 * still exist on resource_held/resource_add/resource_rem?  Is that ok?
+	 * Should we purge all of them here?  When a lockspace is removed and
+	 * pids are killed, their resources go through release_token_async,
+	 * which will see token->space_dead, and those resources are freed
+	 * directly.  resources that may have already been on resources_rem and
+	 * the resource_thread may be in the middle of releasing one of them.
+	 * For any further async releases, resource_thread will see that the
+	 * lockspace is going away and will just free the resource.
+	 */
+
+	purge_resource_orphans(sp->space_name);
+	purge_resource_lazy(sp->space_name);
+	purge_resource_free(sp->space_name);
+
+	close_event_fds(sp);
+
+	close_task_aio(&rs->task);
+}
+
+/*
+ * renewal_threads: the delta leases of all lockspaces are renewed by a
+ * small number of renewal threads instead of a thread for each lockspace.
+ * The lockspace thread acquires the delta lease and then gives the
+ * lockspace to the renewal threads and exits.  Lockspaces waiting for
+ * their next renewal are kept on a timer wheel with a slot for each
+ * second, and an idle renewal thread takes each lockspace from the wheel
+ * in the second it is due.
+ *
+ * A renewal reads and writes the disk with the lockspace's own task and
+ * aio context, and can take up to io_timeout for each i/o.  So that a
+ * slow disk does not delay the renewals of other lockspaces, the last
+ * idle thread only takes a lockspace that has waited past its second
+ * because the other threads are busy, and starts another thread when it
+ * does.  Threads beyond renewal_threads exit when they have been idle
+ * for RENEW_THREAD_IDLE seconds.
+ *
+ * With renewal_coalesce, a lockspace that is due takes with it the other
+ * lockspaces on the same device that have passed half of their renewal
+ * interval, and the same thread renews them one after the other.
+ *
+ * When the lockspace is stopped, the renewal thread releases the delta
+ * lease and sets done, after which the main thread frees the sp.
+ */
+
+#define RENEW_WHEEL_SIZE	64	/* power of 2 */
+#define RENEW_THREAD_IDLE	10
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;		/* lockspace due, CLOCK_MONOTONIC */
+	pthread_cond_t done_cond;	/* lockspace released */
+	struct list_head spaces;
+	struct list_head wheel[RENEW_WHEEL_SIZE];
+	uint64_t tick;			/* wheel slots before this are empty */
+	int threads;
+	int idle;
+	int setup;
+} renew_pool = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void *renew_thread(void *arg);
+
+/* renew_pool.mutex is held */
+
+static void renew_pool_setup(void)
+{
+	pthread_condattr_t attr;
+	int i;
 
-	sp->host_generation = leader.owner_generation;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&renew_pool.cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	INIT_LIST_HEAD(&renew_pool.spaces);
+	for (i = 0; i < RENEW_WHEEL_SIZE; i++)
+		INIT_LIST_HEAD(&renew_pool.wheel[i]);
+
+	renew_pool.tick = monotime();
+	renew_pool.setup = 1;
+}
+
+/* renew_pool.mutex is held; a new thread begins idle */
+
+static void renew_pool_spawn(void)
+{
+	pthread_attr_t attr;
+	pthread_t th;
+	int rv;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rv = pthread_create(&th, &attr, renew_thread, NULL);
+	pthread_attr_destroy(&attr);
+
+	if (rv) {
+		log_error("renewal thread create error %d threads %d", rv, renew_pool.threads);
+		return;
+	}
+
+	renew_pool.threads++;
+	renew_pool.idle++;
+}
+
+/* renew_pool.mutex is held */
+
+static void renew_pool_queue(struct renew_state *rs, uint64_t due)
+{
+	uint64_t now = monotime();
+
+	if (rs->kicked || due < now)
+		due = now;
+	rs->kicked = 0;
+	rs->due = due;
+	rs->due_us = (due == now) ? trace_begin() : due * 1000000;
+	rs->queued = 1;
+	list_add_tail(&rs->wheel_list, &renew_pool.wheel[due & (RENEW_WHEEL_SIZE - 1)]);
+
+	if (due == now)
+		pthread_cond_signal(&renew_pool.cond);
+}
+
+/* renew_pool.mutex is held; take a lockspace due at or before limit */
+
+static struct renew_state *renew_pool_take(uint64_t limit)
+{
+	struct renew_state *rs;
+	struct list_head *head;
 
 	while (1) {
-		pthread_mutex_lock(&sp->mutex);
-		stop = sp->thread_stop;
-		pthread_mutex_unlock(&sp->mutex);
-		if (stop)
+		head = &renew_pool.wheel[renew_pool.tick & (RENEW_WHEEL_SIZE - 1)];
+
+		list_for_each_entry(rs, head, wheel_list) {
+			if (rs->due > limit)
+				continue;
+			list_del(&rs->wheel_list);
+			rs->queued = 0;
+			return rs;
+		}
+
+		if (renew_pool.tick >= limit)
 			break;
+		renew_pool.tick++;
+	}
+	return NULL;
+}
 
-		/*
-		 * wait between each renewal
-		 */
+/*
+ * renew_pool.mutex is held.  Move the queued lockspaces on the same device
+ * as rs that are half way to their renewal onto the batch.
+ */
 
-		if (monotime() - last_success < id_renewal_seconds) {
-			sleep(1);
+static void renew_pool_coalesce(struct renew_state *rs, struct list_head *batch)
+{
+	struct renew_state *rs2;
+	uint64_t now = monotime();
+
+	list_for_each_entry(rs2, &renew_pool.spaces, list) {
+		if (rs2 == rs || !rs2->queued || rs2->dev != rs->dev)
 			continue;
-		} else {
-			/* don't spin too quickly if renew is failing
-			   immediately and repeatedly */
-			usleep(500000);
-		}
+		if (now - rs2->last_success < (uint64_t)(rs2->renewal_seconds / 2))
+			continue;
+		list_del(&rs2->wheel_list);
+		rs2->queued = 0;
+		list_add_tail(&rs2->wheel_list, batch);
+	}
+}
 
+/*
+ * Renews the lockspace, or releases it if it has been stopped.  Returns
+ * the time the lockspace is next due, or 0 if it has been released.
+ */
 
-		/*
-		 * do a renewal, measuring length of time spent in renewal,
-		 * and the length of time between successful renewals
-		 */
+/*
+ * A renewal_wake renews early at most once per io_timeout, so a client
+ * making requests in a loop does not drive the renewal rate.  A wake
+ * within io_timeout of the last one stays pending, and *wake_time is set
+ * to when it can be taken.  Called with sp->mutex held.
+ */
 
-		memset(bitmap, 0, sizeof(bitmap));
-		memset(&extra, 0, sizeof(extra));
-		create_bitmap_and_extra(sp, bitmap, &extra);
+static int take_renewal_wake(struct space *sp, uint64_t now, uint64_t *wake_time)
+{
+	uint64_t next = sp->renewal_wake_time + sp->io_timeout;
 
-		delta_begin = monotime();
+	*wake_time = 0;
 
-		delta_result = delta_lease_renew(&task, sp, &sp->host_id_disk,
-						 sp->space_name, bitmap, &extra,
-						 delta_result, &read_result,
-						 log_renewal_level,
-						 &leader, &leader,
-						 &rd_ms, &wr_ms);
-		delta_length = monotime() - delta_begin;
+	if (!sp->renewal_wake)
+		return 0;
 
-		if (delta_result == SANLK_OK) {
-			renewal_interval = leader.timestamp - last_success;
-			last_success = leader.timestamp;
+	if (sp->renewal_wake_time && now < next) {
+		*wake_time = next;
+		return 0;
+	}
+
+	sp->renewal_wake = 0;
+	sp->renewal_wake_time = now;
+	return 1;
+}
+
+static uint64_t renew_pool_work(struct renew_state *rs, int coalesced)
+{
+	struct space *sp = rs->sp;
+	uint64_t wake_time, due;
+	int stop, wake;
+
+	pthread_mutex_lock(&sp->mutex);
+	stop = sp->thread_stop;
+	wake = take_renewal_wake(sp, monotime(), &wake_time);
+	pthread_mutex_unlock(&sp->mutex);
+
+	if (stop) {
+		/* watchdog unlink was done in main_loop when thread_stop was set */
+		close_watchdog(sp);
+		lockspace_release(sp, rs);
+		return 0;
+	}
+
+	if (wake) {
+		log_space(sp, "renewal wake");
+	} else if (!coalesced && monotime() - rs->last_success < (uint64_t)rs->renewal_seconds) {
+		due = rs->last_success + rs->renewal_seconds;
+		return (wake_time && wake_time < due) ? wake_time : due;
+	}
+
+	lockspace_renew(sp, rs);
+
+	/* don't spin if renew is failing immediately and repeatedly */
+	if (rs->delta_result != SANLK_OK)
+		return monotime() + 1;
+
+	return rs->last_success + rs->renewal_seconds;
+}
+
+static void *renew_thread(void *arg GNUC_UNUSED)
+{
+	struct renew_state *rs;
+	struct timespec ts;
+	struct list_head batch;
+	uint64_t now, due, last_work;
+	int coalesced;
+
+	set_renewal_ioprio();
+	thread_class_setup(THREAD_CLASS_RENEWAL);
+
+	pthread_mutex_lock(&renew_pool.mutex);
+	last_work = monotime();
+
+	while (1) {
+		now = monotime();
+
+		/* the last idle thread waits for a lockspace to be late */
+		rs = renew_pool_take(renew_pool.idle > 1 ? now : now - 1);
+		if (!rs) {
+			if (renew_pool.threads > com.renewal_threads && renew_pool.idle > 1 &&
+			    now - last_work >= RENEW_THREAD_IDLE)
+				break;
+
+			/* wait until the next second, when more may be due */
+			ts.tv_sec = now + 1;
+			ts.tv_nsec = 0;
+			pthread_cond_timedwait(&renew_pool.cond, &renew_pool.mutex, &ts);
+			continue;
 		}
 
+		thread_class_wake(THREAD_CLASS_RENEWAL, rs->due_us, trace_begin());
 
-		/*
-		 * publish the results
-		 */
+		/* keep one thread waiting for lockspaces that are late */
+		if (!--renew_pool.idle)
+			renew_pool_spawn();
 
-		pthread_mutex_lock(&sp->mutex);
-		sp->lease_status.renewal_last_result = delta_result;
-		sp->lease_status.renewal_last_attempt = delta_begin;
+		INIT_LIST_HEAD(&batch);
+		list_add(&rs->wheel_list, &batch);
+		if (com.renewal_coalesce)
+			renew_pool_coalesce(rs, &batch);
+		coalesced = 0;
 
-		if (delta_result == SANLK_OK)
-			sp->lease_status.renewal_last_success = last_success;
+		while (!list_empty(&batch)) {
+			rs = list_first_entry(&batch, struct renew_state, wheel_list);
+			list_del(&rs->wheel_list);
+			pthread_mutex_unlock(&renew_pool.mutex);
 
-		if (delta_result != SANLK_OK && !sp->lease_status.corrupt_result)
-			sp->lease_status.corrupt_result = corrupt_result(delta_result);
+			due = renew_pool_work(rs, coalesced++);
 
-		if (read_result == SANLK_OK && task.iobuf) {
-			/* NB. be careful with how this iobuf escapes */
-			memcpy(sp->lease_status.renewal_read_buf, task.iobuf, sp->align_size);
-			sp->lease_status.renewal_read_count++;
+			pthread_mutex_lock(&renew_pool.mutex);
+			if (due) {
+				renew_pool_queue(rs, due);
+			} else {
+				list_del(&rs->list);
+				rs->done = 1;
+				pthread_cond_broadcast(&renew_pool.done_cond);
+			}
 		}
 
-		/*
-		 * pet the watchdog
-		 * (don't update on thread_stop because it's probably unlinked)
-		 */
+		renew_pool.idle++;
+		last_work = monotime();
+	}
+
+	renew_pool.threads--;
+	renew_pool.idle--;
+	pthread_mutex_unlock(&renew_pool.mutex);
+	return NULL;
+}
+
+static void renew_pool_add(struct space *sp, struct renew_state *rs)
+{
+	struct stat st;
+
+	if (!fstat(sp->host_id_disk.fd, &st))
+		rs->dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+
+	pthread_mutex_lock(&renew_pool.mutex);
+	if (!renew_pool.setup)
+		renew_pool_setup();
+	while (renew_pool.threads < com.renewal_threads || renew_pool.idle < 2) {
+		int threads = renew_pool.threads;
+
+		renew_pool_spawn();
+		if (renew_pool.threads == threads)
+			break;
+	}
+	list_add_tail(&rs->list, &renew_pool.spaces);
+	renew_pool_queue(rs, rs->last_success + rs->renewal_seconds);
+	pthread_mutex_unlock(&renew_pool.mutex);
+}
+
+/*
+ * Renew the lockspace now, to see a request (renewal_wake) or thread_stop
+ * without waiting for the next renewal.
+ */
+
+static void renew_pool_kick(struct space *sp)
+{
+	struct renew_state *rs = sp->renew;
+
+	if (!rs || !rs->pool)
+		return;
+
+	pthread_mutex_lock(&renew_pool.mutex);
+	rs->kicked = 1;
+	if (rs->queued) {
+		list_del(&rs->wheel_list);
+		renew_pool_queue(rs, 0);
+	}
+	pthread_mutex_unlock(&renew_pool.mutex);
+}
+
+/*
+ * Wait for the lockspace thread or the renewal thread to release the
+ * delta lease after thread_stop is set.  Returns 0 when sp can be freed.
+ */
+
+static int wait_lockspace_thread(struct space *sp, int wait)
+{
+	struct renew_state *rs = sp->renew;
+	int done;
+
+	if (!rs->pool) {
+		if (wait)
+			return pthread_join(sp->thread, NULL);
+		return pthread_tryjoin_np(sp->thread, NULL);
+	}
+
+	renew_pool_kick(sp);
+
+	pthread_mutex_lock(&renew_pool.mutex);
+	while (wait && !rs->done)
+		pthread_cond_wait(&renew_pool.done_cond, &renew_pool.mutex);
+	done = rs->done;
+	pthread_mutex_unlock(&renew_pool.mutex);
+
+	return done ? 0 : EBUSY;
+}
+
+/*
+ * This thread must not be stopped unless all pids that may be using any
+ * resources in it are dead/gone.  (The USED flag in the lockspace represents
+ * pids using resources in the lockspace, when those pids are not using actual
+ * sanlock resources.  So the USED flag must also prevent this thread from
+ * stopping.)
+ */
+
+static void *lockspace_thread(void *arg_in)
+{
+	struct space *sp = (struct space *)arg_in;
+	struct renew_state *rs = sp->renew;
+	uint64_t begin, wake_time;
+	int stop, wake;
+
+	if (com.debug_renew)
+		rs->log_renewal_level = LOG_DEBUG;
+	else
+		rs->log_renewal_level = -1;
+
+	setup_task_aio(&rs->task, main_task.use_aio, HOSTID_AIO_CB_SIZE);
+	memcpy(rs->task.name, sp->space_name, NAME_ID_SIZE);
+	rs->task.io_renewal = 1;
+	set_renewal_ioprio();
+	thread_class_setup(THREAD_CLASS_RENEWAL);
+
+	if (lockspace_acquire(sp, rs) < 0)
+		goto out;
 
-		if (delta_result == SANLK_OK && !sp->thread_stop)
-			update_watchdog(sp, last_success, id_renewal_fail_seconds);
+	if (rs->pool) {
+		/* the renewal threads renew and release the lease from now */
+		pthread_detach(pthread_self());
+		renew_pool_add(sp, rs);
+		return NULL;
+	}
 
-		save_renewal_history(sp, delta_result, last_success, rd_ms, wr_ms);
-		pthread_mutex_unlock(&sp->mutex);
+	if (com.renewal_coalesce)
+		rs->rg = renew_group_join(sp, &rs->renew_round);
 
+	while (1) {
+		pthread_mutex_lock(&sp->mutex);
+		stop = sp->thread_stop;
+		wake = take_renewal_wake(sp, monotime(), &wake_time);
+		pthread_mutex_unlock(&sp->mutex);
+		if (stop)
+			break;
 
 		/*
-		 * log the results
+		 * wait between each renewal, or renew now to send a
+		 * request (host_status_set_request)
 		 */
 
-		if (delta_result != SANLK_OK) {
-			log_erros(sp, "renewal error %d delta_length %d last_success %llu",
-				  delta_result, delta_length, (unsigned long long)last_success);
-		} else if (delta_length > id_renewal_seconds) {
-			log_erros(sp, "renewed %llu delta_length %d too long",
-				  (unsigned long long)last_success, delta_length);
+		if (wake) {
+			log_space(sp, "renewal wake");
+		} else if (rs->rg) {
+			if (!renew_group_wait(rs->rg, &rs->renew_round, rs->last_success,
+					      rs->renewal_seconds))
+				continue;
+			usleep(500000);
+		} else if (monotime() - rs->last_success < rs->renewal_seconds) {
+			begin = trace_begin();
+			sleep(1);
+			thread_class_wake(THREAD_CLASS_RENEWAL, begin + 1000000, trace_begin());
+			continue;
 		} else {
-			if (com.debug_renew) {
-				log_space(sp, "renewed %llu delta_length %d interval %d",
-					  (unsigned long long)last_success, delta_length, renewal_interval);
-			}
+			/* don't spin too quickly if renew is failing
+			   immediately and repeatedly */
+			usleep(500000);
 		}
+
+		lockspace_renew(sp, rs);
 	}
 
+	if (rs->rg)
+		renew_group_leave(rs->rg);
+
 	/* watchdog unlink was done in main_loop when thread_stop was set, to
 	   get it done as quickly as possible in case the wd is about to fire. */
 
 	close_watchdog(sp);
  out:
-	if (delta_result == SANLK_OK)
-		delta_lease_release(&task, sp, &sp->host_id_disk,
-				    sp->space_name, &leader, &leader);
-
-	if (opened)
-		close(sp->host_id_disk.fd);
-
-	/*
-	 * TODO: are there cases where struct resources for this lockspace
-	 * still exist on resource_held/resource_add/resource_rem?  Is that ok?
-	 * Should we purge all of them here?  When a lockspace is removed and
-	 * pids are killed, their resources go through release_token_async,
-	 * which will see token->space_dead, and those resources are freed
-	 * directly.  resources that may have already been on resources_rem and
-	 * the resource_thread may be in the middle of releasing one of them.
-	 * For any further async releases, resource_thread will see that the
-	 * lockspace is going away and will just free the resource.
-	 */
-
-	purge_resource_orphans(sp->space_name);
-	purge_resource_free(sp->space_name);
-
-	close_event_fds(sp);
-
-	close_task_aio(&task);
+	lockspace_release(sp, rs);
 	return NULL;
 }
 
 static void free_sp(struct space *sp)
 {
+	host_state_close(sp);
+	lease_paths_close(sp->lease_paths); /* not in lockspace_release, status reads it */
+	free(sp->renew);
+	free(sp->host_status);
+	free(sp->leader_keys);
+	free(sp->host_names);
 	if (sp->lease_status.renewal_read_buf)
 		free(sp->lease_status.renewal_read_buf);
+	pthread_cond_destroy(&sp->host_status_cond);
 	free(sp);
 }
 
 int add_lockspace_start(struct sanlk_lockspace *ls, uint32_t io_timeout, struct space **sp_out)
 {
+	pthread_condattr_t cond_attr;
 	struct space *sp, *sp2;
 	int listnum = 0;
 	int rv;
@@ -969,14 +2183,32 @@ int add_lockspace_start(struct sanlk_lockspace *ls, uint32_t io_timeout, struct
 	sp->io_timeout = io_timeout;
 	sp->set_bitmap_seconds = calc_set_bitmap_seconds(io_timeout);
 	pthread_mutex_init(&sp->mutex, NULL);
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sp->host_status_cond, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
+	INIT_LIST_HEAD(&sp->client_tokens);
 
 	if (com.renewal_read_extend_sec_set)
 		sp->renewal_read_extend_sec = com.renewal_read_extend_sec;
 	else
 		sp->renewal_read_extend_sec = io_timeout;
 
-	for (i = 0; i < MAX_EVENT_FDS; i++)
+	sp->renewal_sweep_interval = com.renewal_sweep_interval;
+
+	sp->renew = malloc(sizeof(struct renew_state));
+	if (!sp->renew) {
+		free(sp);
+		return -ENOMEM;
+	}
+	memset(sp->renew, 0, sizeof(struct renew_state));
+	sp->renew->sp = sp;
+	sp->renew->pool = com.renewal_threads > 0;
+
+	for (i = 0; i < MAX_EVENT_FDS; i++) {
 		sp->event_fds[i] = -1;
+		sp->event_filters[i] = NULL;
+	}
 
 	if (com.renewal_history_size) {
 		sp->renewal_history = malloc(sizeof(struct renewal_history) * com.renewal_history_size);
@@ -1057,7 +2289,8 @@ int add_lockspace_start(struct sanlk_lockspace *ls, uint32_t io_timeout, struct
 	}
 
 	sp->space_id = space_id_counter++;
-	list_add(&sp->list, &spaces_add);
+	metrics_add_space(sp->space_id);
+	space_list_add(sp, &spaces_add);
 	pthread_mutex_unlock(&spaces_mutex);
 
 	/* save a record of what this space_id is for later debugging */
@@ -1078,7 +2311,7 @@ int add_lockspace_start(struct sanlk_lockspace *ls, uint32_t io_timeout, struct
 
  fail_del:
 	pthread_mutex_lock(&spaces_mutex);
-	list_del(&sp->list);
+	space_list_del(sp);
 	pthread_mutex_unlock(&spaces_mutex);
  fail_free:
 	free_sp(sp);
@@ -1128,12 +2361,13 @@ int add_lockspace_wait(struct space *sp)
 		sp->thread_stop = 1;
 		deactivate_watchdog(sp);
 		pthread_mutex_unlock(&sp->mutex);
-		pthread_join(sp->thread, NULL);
+		wait_lockspace_thread(sp, 1);
 		rv = -1;
 		log_space(sp, "add_lockspace undo complete");
 		goto fail_del;
 	} else {
-		list_move(&sp->list, &spaces);
+		space_list_move(sp, &spaces);
+		lockspace_check_wake(sp);
 		log_space(sp, "add_lockspace done");
 		pthread_mutex_unlock(&spaces_mutex);
 		return 0;
@@ -1141,12 +2375,80 @@ int add_lockspace_wait(struct space *sp)
 
  fail_del:
 	pthread_mutex_lock(&spaces_mutex);
-	list_del(&sp->list);
+	space_list_del(sp);
 	pthread_mutex_unlock(&spaces_mutex);
 	free_sp(sp);
 	return rv;
 }
 
+/*
+ * The lockspaces from lockspace = lines in sanlock.conf are added when the
+ * daemon starts.  As with add_lockspaces, all are started before waiting
+ * for any, so their delta lease acquires run at once.  Until one is added,
+ * inq_lockspace returns -EINPROGRESS for it, and clients may add the same
+ * lockspace themselves, which returns -EEXIST or -EINPROGRESS as usual.
+ */
+
+static void *config_lockspaces_thread(void *arg GNUC_UNUSED)
+{
+	struct config_lockspace *cls;
+	struct space **sps;
+	uint32_t io_timeout;
+	int count = com.config_lockspaces_count;
+	int i, rv, added = 0;
+
+	sps = calloc(count, sizeof(struct space *));
+	if (!sps) {
+		log_error("config lockspaces no mem");
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++) {
+		cls = &com.config_lockspaces[i];
+		io_timeout = cls->io_timeout ? cls->io_timeout : DEFAULT_IO_TIMEOUT;
+
+		rv = add_lockspace_start(&cls->ls, io_timeout, &sps[i]);
+		if (rv < 0) {
+			log_error("config lockspace %.48s start error %d", cls->ls.name, rv);
+			sps[i] = NULL;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!sps[i])
+			continue;
+
+		rv = add_lockspace_wait(sps[i]);
+		if (rv < 0)
+			log_error("config lockspace %.48s add error %d",
+				  com.config_lockspaces[i].ls.name, rv);
+		else
+			added++;
+	}
+
+	log_warn("config lockspaces added %d of %d", added, count);
+	free(sps);
+	return NULL;
+}
+
+void add_config_lockspaces(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	int rv;
+
+	if (!com.config_lockspaces_count)
+		return;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rv = pthread_create(&thread, &attr, config_lockspaces_thread, NULL);
+	pthread_attr_destroy(&attr);
+
+	if (rv)
+		log_error("config lockspaces thread error %d", rv);
+}
+
 int inq_lockspace(struct sanlk_lockspace *ls)
 {
 	int rv;
@@ -1233,6 +2535,7 @@ int rem_lockspace_start(struct sanlk_lockspace *ls, unsigned int *space_id)
 	 */
 
 	sp->external_remove = 1;
+	lockspace_check_wake(sp);
 	id = sp->space_id;
 	pthread_mutex_unlock(&spaces_mutex);
 	*space_id = id;
@@ -1374,7 +2677,7 @@ int get_lockspaces(char *buf, int *len, int *count, int maxlen)
  * After 80 seconds, we'd return FAIL.  After 140 seconds we'd return DEAD.
  */
 
-/* Also see host_live() */
+/* Also see host_status_live() */
 
 static uint32_t get_host_flag(struct space *sp, struct host_status *hs)
 {
@@ -1422,10 +2725,104 @@ out:
 	return flags;
 }
 
+/*
+ * The state of another host changes when its timestamp is read
+ * (check_other_leases), or when enough time has passed since then with
+ * no renewal, so look for changes each time through the main loop.  For
+ * fds registered with SANLK_EVF_HOST_STATE, this is how they learn that
+ * a host is dead without polling get_hosts.  Called with spaces_mutex
+ * held, like get_hosts.  Returns the monotime at which the state of a
+ * host will next change if its lease is not renewed, or 0 if none will.
+ */
+
+uint64_t check_host_states(struct space *sp)
+{
+	struct sanlk_host_event he;
+	struct host_status *hs;
+	uint64_t last, next, deadline = 0;
+	uint32_t flag;
+	int want = 0;
+	int i;
+
+	pthread_mutex_lock(&sp->mutex);
+	for (i = 0; i < MAX_EVENT_FDS; i++) {
+		if (sp->event_fds[i] != -1 && sp->event_filters[i] &&
+		    (sp->event_filters[i]->flags & SANLK_EVF_HOST_STATE)) {
+			want = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sp->mutex);
+
+	if (!want)
+		return 0;
+
+	for (i = 0; i < sp->max_hosts; i++) {
+		hs = &sp->host_status[i];
+
+		if (i+1 == sp->host_id)
+			continue;
+
+		if (!hs->timestamp && !hs->last_flag)
+			continue;
+
+		flag = get_host_flag(sp, hs);
+
+		/* see get_host_flag */
+		last = hs->last_live ? hs->last_live : hs->first_check;
+		if (flag == SANLK_HOST_LIVE || flag == SANLK_HOST_UNKNOWN)
+			next = last + calc_id_renewal_fail_seconds(hs->io_timeout) + 1;
+		else if (flag == SANLK_HOST_FAIL)
+			next = last + calc_host_dead_seconds(hs->io_timeout) + 1;
+		else
+			next = 0;
+		if (next && (!deadline || next < deadline))
+			deadline = next;
+
+		if (flag == hs->last_flag)
+			continue;
+
+		log_space(sp, "host_id %d state %x from %x", i+1, flag, hs->last_flag);
+		hs->last_flag = flag;
+
+		memset(&he, 0, sizeof(he));
+		he.host_id = sp->host_id;
+		he.event = SANLK_HOST_EVENT_STATE;
+		he.data = flag;
+
+		add_host_event(sp->space_id, &he, i+1, hs->owner_generation);
+	}
+
+	return deadline;
+}
+
+/*
+ * The host_status that get_hosts reports for host i+1: the state saved by
+ * the previous daemon until our first check_other_leases, see hoststate.c.
+ */
+
+static struct host_status *shown_host_status(struct space *sp, int i,
+					     struct host_status *saved)
+{
+	if (host_state_get(sp, i, saved))
+		return saved;
+	return &sp->host_status[i];
+}
+
+static void copy_host(struct space *sp, struct host_status *hs, int i,
+		      struct sanlk_host *host)
+{
+	host->host_id = i + 1;
+	host->generation = hs->owner_generation;
+	host->timestamp = hs->timestamp;
+	host->io_timeout = hs->io_timeout;
+	host->flags = get_host_flag(sp, hs);
+}
+
 int get_hosts(struct sanlk_lockspace *ls, char *buf, int *len, int *count, int maxlen)
 {
 	struct space *sp;
-	struct host_status *hs;
+	struct host_status *hs, saved;
 	struct sanlk_host *host;
 	int host_count = 0;
 	int i, rv;
@@ -1446,15 +2843,16 @@ int get_hosts(struct sanlk_lockspace *ls, char *buf, int *len, int *count, int m
 	 * Between add_lockspace completing and the first
 	 * time we call check_other_leases, we don't have
 	 * any data on other hosts, so return this error
-	 * to indicate this to the caller.
+	 * to indicate this to the caller, unless we have
+	 * the state saved by a previous daemon.
 	 */
-	if (!sp->host_status[0].last_check) {
+	if (!sp->host_status[0].last_check && !sp->host_status_warm) {
 		rv = -EAGAIN;
 		goto out;
 	}
 
 	for (i = 0; i < sp->max_hosts; i++) {
-		hs = &sp->host_status[i];
+		hs = shown_host_status(sp, i, &saved);
 
 		if (ls->host_id && (ls->host_id != (i + 1)))
 			continue;
@@ -1469,11 +2867,78 @@ int get_hosts(struct sanlk_lockspace *ls, char *buf, int *len, int *count, int m
 			continue;
 		}
 
-		host->host_id = i + 1;
-		host->generation = hs->owner_generation;
-		host->timestamp = hs->timestamp;
-		host->io_timeout = hs->io_timeout;
-		host->flags = get_host_flag(sp, hs);
+		copy_host(sp, hs, i, host);
+
+		*len += sizeof(struct sanlk_host);
+
+		host++;
+	}
+ out:
+	pthread_mutex_unlock(&spaces_mutex);
+
+	*count = host_count;
+
+	return rv;
+}
+
+/*
+ * Like get_hosts for all hosts, but only the hosts with a change_seq after
+ * since, see host_changes_update.  A host that became FREE is included.
+ * When since is not from this instance of the lockspace (e.g. 0), all
+ * hosts that get_hosts would return are included.  seq is set to the
+ * sequence number to pass as since next time.
+ */
+
+int get_hosts_changed(struct sanlk_lockspace *ls, uint64_t since, uint64_t *seq,
+		      char *buf, int *len, int *count, int maxlen)
+{
+	struct space *sp;
+	struct host_status *hs, saved;
+	struct sanlk_host *host;
+	int host_count = 0;
+	int all, i, rv;
+
+	rv = 0;
+	*len = 0;
+	*count = 0;
+	*seq = 0;
+	host = (struct sanlk_host *)buf;
+
+	pthread_mutex_lock(&spaces_mutex);
+	sp = _search_space(ls->name, NULL, 0, &spaces, NULL, NULL, NULL);
+	if (!sp) {
+		rv = -ENOENT;
+		goto out;
+	}
+
+	/* see get_hosts */
+	if (!sp->host_status[0].last_check && !sp->host_status_warm) {
+		rv = -EAGAIN;
+		goto out;
+	}
+
+	*seq = sp->host_change_seq;
+
+	all = (since < sp->host_change_first) || (since > sp->host_change_seq);
+
+	for (i = 0; i < sp->max_hosts; i++) {
+		hs = shown_host_status(sp, i, &saved);
+
+		if (all) {
+			if (!hs->timestamp)
+				continue;
+		} else if (hs->change_seq <= since) {
+			continue;
+		}
+
+		host_count++;
+
+		if (*len + sizeof(struct sanlk_host) > maxlen) {
+			rv = -ENOSPC;
+			continue;
+		}
+
+		copy_host(sp, hs, i, host);
 
 		*len += sizeof(struct sanlk_host);
 
@@ -1482,11 +2947,56 @@ int get_hosts(struct sanlk_lockspace *ls, char *buf, int *len, int *count, int m
  out:
 	pthread_mutex_unlock(&spaces_mutex);
 
+	/* the hosts that did not fit are returned again next time */
+	if (rv == -ENOSPC)
+		*seq = since;
+
 	*count = host_count;
 
 	return rv;
 }
 
+/* copy what the metrics exporter reports about each lockspace */
+
+int lockspace_metrics(struct space_metrics *sms, int max)
+{
+	struct space *sp;
+	struct space_metrics *sm;
+	struct host_status *hs, saved;
+	uint32_t state;
+	int count = 0;
+	int i;
+
+	pthread_mutex_lock(&spaces_mutex);
+	list_for_each_entry(sp, &spaces, list) {
+		if (count == max)
+			break;
+
+		sm = &sms[count++];
+		memset(sm, 0, sizeof(struct space_metrics));
+		memcpy(sm->name, sp->space_name, NAME_ID_SIZE);
+		sm->space_id = sp->space_id;
+		sm->killing_pids = sp->killing_pids;
+		sm->renew_fail = sp->renew_fail;
+
+		/* no host data until the first check_other_leases */
+		if (!sp->host_status[0].last_check && !sp->host_status_warm)
+			continue;
+
+		for (i = 0; i < sp->max_hosts; i++) {
+			hs = shown_host_status(sp, i, &saved);
+			if (!hs->timestamp)
+				continue;
+			state = get_host_flag(sp, hs);
+			if (state <= SANLK_HOST_DEAD)
+				sm->hosts[state]++;
+		}
+	}
+	pthread_mutex_unlock(&spaces_mutex);
+
+	return count;
+}
+
 int lockspace_set_config(struct sanlk_lockspace *ls, GNUC_UNUSED uint32_t flags, uint32_t cmd)
 {
 	struct space *sp;
@@ -1587,6 +3097,20 @@ int lockspace_clear_rindex_op(char *space_name)
 	return rv;
 }
 
+void lockspace_rindex_progress(char *space_name, uint32_t slots, uint32_t done, uint32_t found)
+{
+	struct space *sp;
+
+	pthread_mutex_lock(&spaces_mutex);
+	sp = _search_space(space_name, NULL, 0, &spaces, NULL, NULL, NULL);
+	if (sp) {
+		sp->rindex_rebuild_slots = slots;
+		sp->rindex_rebuild_done = done;
+		sp->rindex_rebuild_found = found;
+	}
+	pthread_mutex_unlock(&spaces_mutex);
+}
+
 static int _clean_event_fds(struct space *sp)
 {
 	uint32_t end;
@@ -1617,6 +3141,8 @@ static int _clean_event_fds(struct space *sp)
 
 		close(old_fd);
 		sp->event_fds[i] = -1;
+		free(sp->event_filters[i]);
+		sp->event_filters[i] = NULL;
 		count++;
 	}
 	pthread_mutex_unlock(&sp->mutex);
@@ -1648,9 +3174,11 @@ int lockspace_end_event(struct sanlk_lockspace *ls)
 	return 0;
 }
 
-int lockspace_reg_event(struct sanlk_lockspace *ls, int fd, GNUC_UNUSED uint32_t flags)
+int lockspace_reg_event(struct sanlk_lockspace *ls, int fd, GNUC_UNUSED uint32_t flags,
+			struct sanlk_event_filter *ef)
 {
 	struct space *sp;
+	struct sanlk_event_filter *ef_copy = NULL;
 	int retried = 0;
 	int cleaned = 0;
 	int new_fd = -1;
@@ -1667,6 +3195,13 @@ int lockspace_reg_event(struct sanlk_lockspace *ls, int fd, GNUC_UNUSED uint32_t
 		return -ENOENT;
 	}
 	pthread_mutex_unlock(&spaces_mutex);
+
+	if (ef) {
+		ef_copy = malloc(sizeof(struct sanlk_event_filter));
+		if (!ef_copy)
+			return -ENOMEM;
+		memcpy(ef_copy, ef, sizeof(struct sanlk_event_filter));
+	}
 retry:
 	pthread_mutex_lock(&sp->mutex);
 	for (i = 0; i < MAX_EVENT_FDS; i++) {
@@ -1676,22 +3211,33 @@ retry:
 		   so we dup it here instead of adding a special case in
 		   _client free to keep it open. */
 		new_fd = dup(fd);
+		if (new_fd < 0)
+			break;
 		sp->event_fds[i] = new_fd;
+		sp->event_filters[i] = ef_copy;
 		break;
 	}
 	pthread_mutex_unlock(&sp->mutex);
-	log_space(sp, "lockspace_reg_event new_fd %d from client fd %d", new_fd, fd);
+
+	/* check_host_states may have a new fd to send states to */
+	if (new_fd >= 0 && ef && (ef->flags & SANLK_EVF_HOST_STATE))
+		lockspace_check_wake(sp);
+	log_space(sp, "lockspace_reg_event new_fd %d from client fd %d filter %d",
+		  new_fd, fd, ef ? 1 : 0);
 
 	if (new_fd < 0) {
 		if (retried)
-			return -ENOCSI;
+			goto fail;
 		cleaned = _clean_event_fds(sp);
 		if (!cleaned)
-			return -ENOCSI;
+			goto fail;
 		retried = 1;
 		goto retry;
 	}
 	return 0;
+ fail:
+	free(ef_copy);
+	return -ENOCSI;
 }
 
 int lockspace_set_event(struct sanlk_lockspace *ls, struct sanlk_host_event *he, uint32_t flags)
@@ -1744,10 +3290,15 @@ int lockspace_set_event(struct sanlk_lockspace *ls, struct sanlk_host_event *he,
 	if (flags & SANLK_SETEV_REPLACE_EVENT)
 		goto set;
 
-	/* log a warning if one non-zero event clobbers another non-zero event */
+	/*
+	 * log a warning if one non-zero event clobbers another non-zero event.
+	 * A request event is replaced quietly; the owner of the resource then
+	 * examines all its resources, see check_other_leases.
+	 */
 
 	if ((now - sp->set_event_time < sp->set_bitmap_seconds) &&
 	    sp->host_event.event && he->event &&
+	    (sp->host_event.event != SANLK_HOST_EVENT_REQUEST) &&
 	    (sp->host_event.event != he->event)) {
 		log_warns(sp, "event %llu %llu %llu %llu replaced by %llu %llu %llu %llu t %llu",
 			  (unsigned long long)sp->host_event.host_id,
@@ -1776,26 +3327,55 @@ out:
 	return rv;
 }
 
-int send_event_callbacks(uint32_t space_id,
-			 uint64_t from_host_id,
-			 uint64_t from_generation,
-			 struct sanlk_host_event *he)
+static int event_filter_match(struct sanlk_event_filter *ef, struct event_cb *cb)
+{
+	uint64_t id;
+
+	if (cb->he.event == SANLK_HOST_EVENT_STATE) {
+		if (!ef || !(ef->flags & SANLK_EVF_HOST_STATE))
+			return 0;
+	} else if (!ef) {
+		return 1;
+	} else if (ef->event_mask && !(cb->he.event & ef->event_mask)) {
+		return 0;
+	}
+
+	if (ef->generation && cb->he.generation && (cb->he.generation != ef->generation))
+		return 0;
+
+	if (ef->flags & SANLK_EVF_HOST_IDS) {
+		id = cb->from_host_id;
+		if (!id || id > DEFAULT_MAX_HOSTS || !test_id_bit(id, ef->host_ids))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Each fd is sent all of the events that pass its filter with a single
+ * send, so a client can read them all at once (sanlock_get_events).  A
+ * partial send would leave a partial record in the stream, so an fd
+ * that cannot take the whole batch is closed like one with an error.
+ */
+
+int send_event_callbacks(uint32_t space_id, struct event_cb *cbs, int count)
 {
 	struct space *sp;
-	struct event_cb cb;
-	int fd, i;
+	struct event_cb *buf;
+	int fd, i, j, n;
 	int rv = 0;
 
-	memset(&cb, 0, sizeof(cb));
-	cb.h.magic = SM_MAGIC;
-	cb.h.version = SM_CB_PROTO;
-	cb.h.cmd = SM_CB_GET_EVENT;
-	cb.h.length = sizeof(cb);
-
-	memcpy(&cb.he, he, sizeof(struct sanlk_host_event));
+	for (j = 0; j < count; j++) {
+		cbs[j].h.magic = SM_MAGIC;
+		cbs[j].h.version = SM_CB_PROTO;
+		cbs[j].h.cmd = SM_CB_GET_EVENT;
+		cbs[j].h.length = sizeof(struct event_cb);
+	}
 
-	cb.from_host_id = from_host_id;
-	cb.from_generation = from_generation;
+	buf = malloc(count * sizeof(struct event_cb));
+	if (!buf)
+		return -ENOMEM;
 
 	pthread_mutex_lock(&spaces_mutex);
 	sp = find_lockspace_id(space_id);
@@ -1814,16 +3394,27 @@ int send_event_callbacks(uint32_t space_id,
 
 		fd = sp->event_fds[i];
 
-		rv = send(fd, &cb, sizeof(cb), MSG_NOSIGNAL | MSG_DONTWAIT);
-		if (rv < 0) {
+		for (j = 0, n = 0; j < count; j++) {
+			if (event_filter_match(sp->event_filters[i], &cbs[j]))
+				memcpy(&buf[n++], &cbs[j], sizeof(struct event_cb));
+		}
+		if (!n)
+			continue;
+
+		rv = send(fd, buf, n * sizeof(struct event_cb), MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (rv < 0 || rv != n * sizeof(struct event_cb)) {
 			log_erros(sp, "send_event_callbacks error %d %d close fd %d", rv, errno, fd);
 			close(fd);
 			sp->event_fds[i] = -1;
+			free(sp->event_filters[i]);
+			sp->event_filters[i] = NULL;
+			continue;
 		}
-		log_space(sp, "sent event to fd %d", fd);
+		log_space(sp, "sent %d events to fd %d", n, fd);
 	}
 	pthread_mutex_unlock(&sp->mutex);
 ret:
+	free(buf);
 	return rv;
 }
 
@@ -1836,9 +3427,9 @@ ret:
  * "logical" point commented above in host_id_thread.
  */
 
-static int stop_lockspace_thread(struct space *sp, int wait)
+static void stop_lockspace_thread(struct space *sp)
 {
-	int stop, rv;
+	int stop;
 
 	pthread_mutex_lock(&sp->mutex);
 	stop = sp->thread_stop;
@@ -1848,15 +3439,7 @@ static int stop_lockspace_thread(struct space *sp, int wait)
 	if (!stop) {
 		/* should never happen */
 		log_erros(sp, "stop_lockspace_thread zero thread_stop");
-		return -EINVAL;
 	}
-
-	if (wait)
-		rv = pthread_join(sp->thread, NULL);
-	else
-		rv = pthread_tryjoin_np(sp->thread, NULL);
-
-	return rv;
 }
 
 /*
@@ -1934,17 +3517,51 @@ static int stop_lockspace_thread(struct space *sp, int wait)
 void free_lockspaces(int wait)
 {
 	struct space *sp, *safe;
-	int rv;
+	uint64_t last_log = monotime();
+	int count, total = 0;
 
 	pthread_mutex_lock(&spaces_mutex);
-	list_for_each_entry_safe(sp, safe, &spaces_rem, list) {
-		rv = stop_lockspace_thread(sp, wait);
-		if (!rv) {
+
+	/*
+	 * All the threads are stopped before waiting for any of them, so the
+	 * delta lease releases are written concurrently.  The first pass
+	 * of the loop below kicks all the renewal threads in the same way.
+	 */
+	list_for_each_entry(sp, &spaces_rem, list) {
+		host_status_wake(sp);
+		stop_lockspace_thread(sp);
+		total++;
+	}
+
+	while (1) {
+		count = 0;
+		list_for_each_entry_safe(sp, safe, &spaces_rem, list) {
+			if (sp->host_status_waiters || wait_lockspace_thread(sp, 0)) {
+				count++;
+				continue;
+			}
 			log_space(sp, "free lockspace");
-			list_del(&sp->list);
+			space_list_del(sp);
 			free_sp(sp);
 		}
+
+		if (!count || !wait)
+			break;
+
+		if (monotime() - last_log >= 1) {
+			log_warn("free_lockspaces waiting for %d of %d lockspaces to release",
+				 count, total);
+			last_log = monotime();
+		}
+
+		/* the sps on spaces_rem are only freed by this thread */
+		pthread_mutex_unlock(&spaces_mutex);
+		usleep(100000);
+		pthread_mutex_lock(&spaces_mutex);
 	}
 	pthread_mutex_unlock(&spaces_mutex);
+
+	if (wait && total)
+		log_debug("free_lockspaces released %d lockspaces", total);
 }
 
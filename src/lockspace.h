@@ -7,13 +7,19 @@
  */
 
 #ifndef __LOCKSPACE_H__
-#define __LOCKSPACE__H__
+#define __LOCKSPACE_H__
 
 /* See resource.h for lock ordering between spaces_mutex and resource_mutex. */
 
 /* no locks */
 struct space *find_lockspace(const char *name);
 
+/* no locks */
+void setup_lockspace_hash(void);
+
+/* caller must hold spaces_mutex */
+void space_list_move(struct space *sp, struct list_head *head);
+
 /* no locks */
 int _lockspace_info(const char *space_name, struct space_info *spi);
 
@@ -23,11 +29,19 @@ int lockspace_info(const char *space_name, struct space_info *spi);
 /* locks spaces_mutex */
 int lockspace_disk(char *space_name, struct sync_disk *disk, int *sector_size);
 
+/* locks spaces_mutex, locks sp */
+int lockspace_renewal_current(uint32_t space_id, uint64_t host_generation);
+
 /* locks spaces_mutex */
 int host_info(char *space_name, uint64_t host_id, struct host_status *hs_out);
+int host_info_wait(char *space_name, uint64_t host_id, uint64_t last_check,
+		   uint64_t deadline, struct host_status *hs_out);
+int host_info_bitmap(char *space_name, char *bitmap, int num_hosts,
+		     struct host_status *hs_out);
 
 /* locks spaces_mutex, locks sp */
 int host_status_set_bit(char *space_name, uint64_t host_id);
+int host_status_set_request(char *space_name, uint64_t host_id, uint32_t hash);
 
 /* no locks */
 int test_id_bit(int host_id, char *bitmap);
@@ -35,11 +49,15 @@ int test_id_bit(int host_id, char *bitmap);
 /* no locks */
 void set_id_bit(int host_id, char *bitmap, char *c);
 
-/* locks sp */
-int check_our_lease(struct space *sp, int *check_all, char *check_buf);
+/* locks sp; deadline is the monotime when the result next changes */
+int check_our_lease(struct space *sp, int *check_all, char *check_buf,
+		    struct renewal_read *check_read, uint64_t *deadline);
 
 /* locks resource_mutex (add_host_event), locks resource_mutex (set_resource_examine) */
-void check_other_leases(struct space *sp, char *buf);
+void check_other_leases(struct space *sp, char *buf, struct renewal_read *rr);
+
+/* the most lockspaces in one add_lockspaces/rem_lockspaces */
+#define LOCKSPACE_MAX_BATCH 4096
 
 /* locks spaces_mutex */
 int add_lockspace_start(struct sanlk_lockspace *ls, uint32_t io_timeout, struct space **sp_out);
@@ -47,6 +65,9 @@ int add_lockspace_start(struct sanlk_lockspace *ls, uint32_t io_timeout, struct
 /* locks sp, locks spaces_mutex */
 int add_lockspace_wait(struct space *sp);
 
+/* starts a thread that adds com.config_lockspaces */
+void add_config_lockspaces(void);
+
 /* locks spaces_mutex */
 int inq_lockspace(struct sanlk_lockspace *ls);
 
@@ -64,23 +85,37 @@ int get_lockspaces(char *buf, int *len, int *count, int maxlen);
 
 /* locks spaces_mutex */
 int get_hosts(struct sanlk_lockspace *ls, char *buf, int *len, int *count, int maxlen);
+int get_hosts_changed(struct sanlk_lockspace *ls, uint64_t since, uint64_t *seq,
+		      char *buf, int *len, int *count, int maxlen);
+uint64_t check_host_states(struct space *sp);
+
+struct space_metrics;
+
+/* locks spaces_mutex */
+int lockspace_metrics(struct space_metrics *sms, int max);
 
 /* locks spaces_mutex, locks sp */
 int lockspace_set_event(struct sanlk_lockspace *ls, struct sanlk_host_event *he, uint32_t flags);
 
+struct sanlk_event_filter;
+
 /* locks spaces_mutex, locks sp */
-int lockspace_reg_event(struct sanlk_lockspace *ls, int fd, uint32_t flags);
+int lockspace_reg_event(struct sanlk_lockspace *ls, int fd, uint32_t flags,
+			struct sanlk_event_filter *ef);
 
 /* locks spaces_mutex, locks sp */
 int lockspace_end_event(struct sanlk_lockspace *ls);
 
+struct event_cb;
+
 /* locks spaces_mutex, locks sp */
-int send_event_callbacks(uint32_t space_id, uint64_t from_host_id, uint64_t from_generation, struct sanlk_host_event *he);
+int send_event_callbacks(uint32_t space_id, struct event_cb *cbs, int count);
 
 /* locks spaces_mutex, locks sp */
 int lockspace_set_config(struct sanlk_lockspace *ls, uint32_t flags, uint32_t cmd);
 
 int lockspace_begin_rindex_op(char *space_name, int rindex_op, struct space_info *spi);
 int lockspace_clear_rindex_op(char *space_name);
+void lockspace_rindex_progress(char *space_name, uint32_t slots, uint32_t done, uint32_t found);
 
 #endif
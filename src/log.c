@@ -19,111 +19,218 @@
 #include <time.h>
 #include <syslog.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <stdarg.h>
 
 #include "sanlock_internal.h"
 #include "log.h"
+#include "monotime.h"
+#include "affinity.h"
 
 #define LOG_STR_LEN 512
-static char log_str[LOG_STR_LEN];
 
-static pthread_t thread_handle;
-
-static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+/*
+ * Each thread that logs gets its own ring of log records, so threads
+ * never wait on each other to log.  A thread only writes the raw record
+ * into its ring: the time, tid, level, a global sequence number, and the
+ * message.  The time is formatted later, by log_thread_fn when it writes
+ * to logfile/syslog, or by copy_log_dump, which merges the records from
+ * all rings in sequence order.
+ *
+ * The rings are only written by the owning thread.  Readers copy a
+ * record and then check that its seq did not change while copying
+ * (seq is zero while the record is being written).  The ring of a
+ * thread that exits is reused by the next new thread, and its records
+ * remain in the log dump until they are overwritten.
+ *
+ * The ring size is log_ring_entries, which applies to rings created
+ * after it is set.  A ring of another size is not reused.
+ *
+ * log_thread_fn writes all the records that are pending when it wakes
+ * into log_write_buf and then to the logfile with one write, rather than
+ * a write for each record.  The logfile is opened with O_APPEND, and
+ * with logfile_sync_seconds it is synced at that interval while records
+ * are being written.
+ */
 
-static char log_dump[LOG_DUMP_SIZE];
-static unsigned int log_point;
-static unsigned int log_wrap;
+#define LOG_WRITE_BUF (64 * 1024)
 
-struct entry {
+struct log_rec {
+	uint64_t seq;
+	uint64_t mono;
+	struct timeval tv;
+	pid_t tid;
 	int level;
 	char str[LOG_STR_LEN];
 };
 
-#define LOG_DEFAULT_ENTRIES 4096
-static struct entry *log_ents;
-static unsigned int log_num_ents = LOG_DEFAULT_ENTRIES;
-static unsigned int log_head_ent; /* add at head */
-static unsigned int log_tail_ent; /* remove from tail */
+struct log_ring {
+	struct list_head list;
+	int unused;
+	unsigned int head;      /* next record to write */
+	unsigned int file_tail; /* next record for log_thread_fn */
+	unsigned int entries;   /* power of 2 */
+	struct log_rec recs[];
+};
+
+static pthread_t thread_handle;
+
+static pthread_mutex_t log_rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct list_head log_rings = LIST_HEAD_INIT(log_rings);
+static pthread_once_t log_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_key;
+static __thread struct log_ring *log_ring_self;
+static __thread pid_t log_tid;
+
+static uint64_t log_seq;
+static sem_t log_sem;
+static int log_sem_ready;
 static unsigned int log_dropped;
-static unsigned int log_pending_ents;
 static unsigned int log_thread_done;
 
 static char logfile_path[PATH_MAX];
-static FILE *logfile_fp;
+static int logfile_fd = -1;
+static uint64_t logfile_synced;
+static int logfile_dirty;
+
+/* used only by log_thread_fn */
+static char log_write_buf[LOG_WRITE_BUF];
+static int log_write_len;
+
+/* copied out by get_log_stats */
+static uint64_t stat_dropped;
+static uint64_t stat_writes;
+static uint64_t stat_write_entries;
+static unsigned int stat_backlog_max;
 
 extern int log_logfile_priority;
 extern int log_logfile_use_utc;
 extern int log_syslog_priority;
 extern int log_stderr_priority;
+extern int log_ring_entries;
+extern int log_logfile_sync_seconds;
 
-static void _log_save_dump(int level GNUC_UNUSED, int len)
+static void log_ring_release(void *arg)
 {
-	int i;
+	struct log_ring *ring = arg;
 
-	if (len < LOG_DUMP_SIZE - log_point) {
-		memcpy(log_dump+log_point, log_str, len);
-		log_point += len;
+	pthread_mutex_lock(&log_rings_mutex);
+	ring->unused = 1;
+	pthread_mutex_unlock(&log_rings_mutex);
+}
 
-		if (log_point == LOG_DUMP_SIZE) {
-			log_point = 0;
-			log_wrap = 1;
-		}
-		return;
-	}
+static void log_key_create(void)
+{
+	pthread_key_create(&log_key, log_ring_release);
+}
+
+static struct log_ring *get_log_ring(void)
+{
+	struct log_ring *ring;
 
-	for (i = 0; i < len; i++) {
-		log_dump[log_point++] = log_str[i];
+	if (log_ring_self)
+		return log_ring_self;
 
-		if (log_point == LOG_DUMP_SIZE) {
-			log_point = 0;
-			log_wrap = 1;
+	pthread_once(&log_key_once, log_key_create);
+
+	pthread_mutex_lock(&log_rings_mutex);
+	list_for_each_entry(ring, &log_rings, list) {
+		if (ring->unused && ring->entries == (unsigned int)log_ring_entries) {
+			ring->unused = 0;
+			goto out;
 		}
 	}
+
+	ring = calloc(1, sizeof(struct log_ring) +
+		      log_ring_entries * sizeof(struct log_rec));
+	if (!ring) {
+		pthread_mutex_unlock(&log_rings_mutex);
+		return NULL;
+	}
+	ring->entries = log_ring_entries;
+	list_add_tail(&ring->list, &log_rings);
+ out:
+	pthread_mutex_unlock(&log_rings_mutex);
+
+	log_tid = syscall(SYS_gettid);
+	log_ring_self = ring;
+	pthread_setspecific(log_key, ring);
+	return ring;
 }
 
-static void _log_save_ent(int level, int len)
+/* returns 0 if the record was overwritten while being copied */
+
+static int copy_log_rec(struct log_rec *rec, struct log_rec *copy)
 {
-	struct entry *e;
+	uint64_t seq;
 
-	if (!log_ents)
-		return;
+	seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+	if (!seq)
+		return 0;
 
-	if (log_pending_ents == log_num_ents) {
-		log_dropped++;
-		return;
-	}
+	memcpy(copy, rec, sizeof(struct log_rec));
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	if (__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) != seq)
+		return 0;
+
+	copy->seq = seq;
+	copy->str[LOG_STR_LEN-1] = '\0';
+	return 1;
+}
+
+/* the same line format that was previously formatted by log_level */
+
+static int format_log_rec(struct log_rec *rec, char *buf, int len)
+{
+	struct tm time_info;
+	int ret, pos = 0;
+
+	if (log_logfile_use_utc)
+		gmtime_r(&rec->tv.tv_sec, &time_info);
+	else
+		localtime_r(&rec->tv.tv_sec, &time_info);
+
+	ret = strftime(buf, len, "%Y-%m-%d %H:%M:%S ", &time_info);
+	pos += ret;
 
-	e = &log_ents[log_head_ent++];
-	log_head_ent = log_head_ent % log_num_ents;
-	log_pending_ents++;
+	ret = snprintf(buf + pos, len - pos, "%llu [%u]: %s\n",
+		       (unsigned long long)rec->mono, rec->tid, rec->str);
+	if (ret >= len - pos) {
+		/* keep the newline */
+		pos = len - 1;
+		buf[pos - 1] = '\n';
+		buf[pos] = '\0';
+	} else {
+		pos += ret;
+	}
 
-	e->level = level;
-	memcpy(e->str, log_str, len);
+	return pos;
 }
 
 /*
  * This log function:
- * 1. formats the log message in the log_str buffer
- * 2. copies log_str into the log_dump circular buffer
- * 3. copies log_str into the log_ents circular array to be written to
- *    logfile and/or syslog (so callers don't block writing messages to files)
+ * 1. writes the message into a record in this thread's log ring,
+ *    which is included in the log dump that can be sent over unix socket
+ * 2. wakes log_thread_fn to write the record to logfile and/or syslog
+ *    (so callers don't block writing messages to files)
  */
 
 void log_level(uint32_t space_id, uint32_t res_id, char *name_in, int level, const char *fmt, ...)
 {
 	va_list ap;
+	struct log_ring *ring;
+	struct log_rec *rec;
 	char name[NAME_ID_SIZE + 1];
+	char line[LOG_STR_LEN + 64];
 	int ret, pos = 0;
-	int len = LOG_STR_LEN - 2; /* leave room for \n\0 */
-	struct timeval cur_time;
-	struct tm time_info;
-	pid_t tid;
+	int len = LOG_STR_LEN - 1; /* leave room for \0 */
 
 	memset(name, 0, sizeof(name));
 
@@ -136,64 +243,94 @@ void log_level(uint32_t space_id, uint32_t res_id, char *name_in, int level, con
 	else if (name_in)
 		snprintf(name, NAME_ID_SIZE, "%.8s ", name_in);
 
-	pthread_mutex_lock(&log_mutex);
-
-	gettimeofday(&cur_time, NULL);
+	ring = get_log_ring();
+	if (!ring) {
+		__atomic_add_fetch(&log_dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
 
-    if (log_logfile_use_utc)
-	    gmtime_r(&cur_time.tv_sec, &time_info);
-    else
-	    localtime_r(&cur_time.tv_sec, &time_info);
+	rec = &ring->recs[ring->head & (ring->entries - 1)];
 
-	ret = strftime(log_str + pos, len - pos,
-		       "%Y-%m-%d %H:%M:%S ", &time_info);
-	pos += ret;
+	/* readers ignore the record while seq is zero */
+	__atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
 
-	tid = syscall(SYS_gettid);
+	gettimeofday(&rec->tv, NULL);
+	rec->mono = monotime();
+	rec->tid = log_tid;
+	rec->level = level;
 
-	ret = snprintf(log_str + pos, len - pos, "%llu [%u]: %s",
-		       (unsigned long long) monotime(), tid, name);
+	ret = snprintf(rec->str, len, "%s", name);
 	pos += ret;
 
 	va_start(ap, fmt);
-	ret = vsnprintf(log_str + pos, len - pos, fmt, ap);
+	ret = vsnprintf(rec->str + pos, len - pos, fmt, ap);
 	va_end(ap);
 
 	if (ret >= len - pos)
 		pos = len - 1;
 	else
 		pos += ret;
+	rec->str[pos] = '\0';
 
-	log_str[pos++] = '\n';
-	log_str[pos++] = '\0';
+	__atomic_store_n(&rec->seq, __atomic_add_fetch(&log_seq, 1, __ATOMIC_RELAXED),
+			 __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
 
-	/*
-	 * save all messages in circular buffer "log_dump" that can be
-	 * sent over unix socket
-	 */
+	if ((level <= log_logfile_priority || level <= log_syslog_priority) && log_sem_ready)
+		sem_post(&log_sem);
 
-	_log_save_dump(level, pos - 1);
+	if (level <= log_stderr_priority) {
+		format_log_rec(rec, line, sizeof(line));
+		fprintf(stderr, "%s", line);
+	}
+}
+
+static void flush_logfile(void)
+{
+	char *buf = log_write_buf;
+	int len = log_write_len;
+	int rv;
+
+	log_write_len = 0;
+
+	while (len > 0) {
+		rv = write(logfile_fd, buf, len);
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv <= 0)
+			break;
+		buf += rv;
+		len -= rv;
+	}
+	stat_writes++;
+	logfile_dirty = 1;
+}
 
-	/*
-	 * save some messages in circular array "log_ents" that a thread
-	 * writes to logfile/syslog
-	 */
+static void sync_logfile(int force)
+{
+	uint64_t now;
 
-	if (level <= log_logfile_priority || level <= log_syslog_priority)
-		_log_save_ent(level, pos);
+	if (!logfile_dirty || !log_logfile_sync_seconds)
+		return;
 
-	if (level <= log_stderr_priority)
-		fprintf(stderr, "%s", log_str);
+	now = monotime();
+	if (!force && now - logfile_synced < (uint64_t)log_logfile_sync_seconds)
+		return;
 
-	pthread_cond_signal(&log_cond);
-	pthread_mutex_unlock(&log_mutex);
+	fdatasync(logfile_fd);
+	logfile_synced = now;
+	logfile_dirty = 0;
 }
 
-static void write_entry(int level, char *str)
+static void write_entry(int level, char *str, int len)
 {
-	if ((level <= log_logfile_priority) && logfile_fp) {
-		fprintf(logfile_fp, "%s", str);
-		fflush(logfile_fp);
+	if ((level <= log_logfile_priority) && (logfile_fd >= 0)) {
+		if (log_write_len + len > LOG_WRITE_BUF)
+			flush_logfile();
+		memcpy(log_write_buf + log_write_len, str, len);
+		log_write_len += len;
+		stat_write_entries++;
 	}
 	if (level <= log_syslog_priority)
 		syslog(level, "%s", str);
@@ -202,89 +339,240 @@ static void write_entry(int level, char *str)
 static void write_dropped(int level, int num)
 {
 	char str[LOG_STR_LEN];
-	sprintf(str, "dropped %d entries", num);
-	write_entry(level, str);
+	int len;
+
+	len = snprintf(str, sizeof(str), "dropped %d entries\n", num);
+	write_entry(level, str, len);
+	stat_dropped += num;
 }
 
+struct dump_ent {
+	uint64_t seq;
+	struct log_rec *rec;
+	int len;
+};
+
+static int dump_ent_cmp(const void *a, const void *b)
+{
+	const struct dump_ent *ea = a, *eb = b;
+
+	if (ea->seq < eb->seq)
+		return -1;
+	if (ea->seq > eb->seq)
+		return 1;
+	return 0;
+}
+
+/*
+ * Merge the records from all rings into buf in sequence order, keeping
+ * the most recent that fit in LOG_DUMP_SIZE.
+ */
+
 void copy_log_dump(char *buf, int *len)
 {
-	int tail_len;
-
-	pthread_mutex_lock(&log_mutex);
-
-	if (!log_wrap && !log_point) {
-		*len = 0;
-	} else if (log_wrap) {
-		tail_len = LOG_DUMP_SIZE - log_point;
-		memcpy(buf, log_dump+log_point, tail_len);
-		if (log_point)
-			memcpy(buf+tail_len, log_dump, log_point);
-		*len = LOG_DUMP_SIZE;
-	} else {
-		memcpy(buf, log_dump, log_point-1);
-		*len = log_point-1;
+	struct log_ring *ring;
+	struct log_rec copy;
+	struct dump_ent *ents;
+	char line[LOG_STR_LEN + 64];
+	int count = 0, max = 0;
+	int i, first, total, pos = 0;
+
+	*len = 0;
+
+	pthread_mutex_lock(&log_rings_mutex);
+	list_for_each_entry(ring, &log_rings, list)
+		max += ring->entries;
+
+	ents = malloc(max * sizeof(struct dump_ent));
+	if (!ents) {
+		pthread_mutex_unlock(&log_rings_mutex);
+		return;
+	}
+
+	list_for_each_entry(ring, &log_rings, list) {
+		for (i = 0; i < (int)ring->entries; i++) {
+			if (!copy_log_rec(&ring->recs[i], &copy))
+				continue;
+			ents[count].seq = copy.seq;
+			ents[count].rec = &ring->recs[i];
+			ents[count].len = format_log_rec(&copy, line, sizeof(line));
+			count++;
+		}
 	}
-	pthread_mutex_unlock(&log_mutex);
+	pthread_mutex_unlock(&log_rings_mutex);
+
+	qsort(ents, count, sizeof(struct dump_ent), dump_ent_cmp);
+
+	/* find the oldest record to include */
+
+	total = 0;
+	for (first = count; first > 0; first--) {
+		if (total + ents[first - 1].len > LOG_DUMP_SIZE)
+			break;
+		total += ents[first - 1].len;
+	}
+
+	/* records overwritten since they were counted above are skipped */
+
+	for (i = first; i < count; i++) {
+		if (!copy_log_rec(ents[i].rec, &copy) || copy.seq != ents[i].seq)
+			continue;
+		total = format_log_rec(&copy, line, sizeof(line));
+		if (pos + total > LOG_DUMP_SIZE)
+			break;
+		memcpy(buf + pos, line, total);
+		pos += total;
+	}
+
+	free(ents);
+
+	/* the client adds the final newline */
+	*len = pos ? pos - 1 : 0;
 }
 
-static void *log_thread_fn(void *arg GNUC_UNUSED)
+/*
+ * Write the records at or above the logfile/syslog priorities, from all
+ * rings in sequence order.  Records overwritten before they are written
+ * are counted as dropped.
+ */
+
+static int write_ring_entries(void)
 {
-	char str[LOG_STR_LEN];
-	struct entry *e;
-	int level, prev_dropped = 0;
+	struct log_ring *ring, *next_ring;
+	struct log_rec copy, next_copy;
+	char str[LOG_STR_LEN + 64];
+	unsigned int head, dropped, backlog;
+	int len, count = 0;
+
+	/* how far behind the writer is, for get_log_stats */
+	pthread_mutex_lock(&log_rings_mutex);
+	list_for_each_entry(ring, &log_rings, list) {
+		backlog = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - ring->file_tail;
+		if (backlog > stat_backlog_max)
+			stat_backlog_max = backlog;
+	}
+	pthread_mutex_unlock(&log_rings_mutex);
 
 	while (1) {
-		pthread_mutex_lock(&log_mutex);
-		while (log_head_ent == log_tail_ent) {
-			if (log_thread_done) {
-				pthread_mutex_unlock(&log_mutex);
-				goto out;
+		next_ring = NULL;
+
+		pthread_mutex_lock(&log_rings_mutex);
+		list_for_each_entry(ring, &log_rings, list) {
+			head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+			while (ring->file_tail != head) {
+				if (head - ring->file_tail > ring->entries) {
+					dropped = head - ring->file_tail - ring->entries;
+					__atomic_add_fetch(&log_dropped, dropped, __ATOMIC_RELAXED);
+					ring->file_tail = head - ring->entries;
+				}
+
+				if (!copy_log_rec(&ring->recs[ring->file_tail & (ring->entries - 1)], &copy)) {
+					/* overwritten after head was read */
+					__atomic_add_fetch(&log_dropped, 1, __ATOMIC_RELAXED);
+					ring->file_tail++;
+					continue;
+				}
+
+				if (copy.level > log_logfile_priority && copy.level > log_syslog_priority) {
+					ring->file_tail++;
+					continue;
+				}
+
+				if (!next_ring || copy.seq < next_copy.seq) {
+					next_ring = ring;
+					memcpy(&next_copy, &copy, sizeof(copy));
+				}
+				break;
 			}
-			pthread_cond_wait(&log_cond, &log_mutex);
 		}
+		if (next_ring)
+			next_ring->file_tail++;
+		pthread_mutex_unlock(&log_rings_mutex);
 
-		e = &log_ents[log_tail_ent++];
-		log_tail_ent = log_tail_ent % log_num_ents;
-		log_pending_ents--;
+		if (!next_ring)
+			break;
 
-		memcpy(str, e->str, LOG_STR_LEN);
-		level = e->level;
+		dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+		if (dropped)
+			write_dropped(next_copy.level, dropped);
+
+		len = format_log_rec(&next_copy, str, sizeof(str));
+		write_entry(next_copy.level, str, len);
+		count++;
+	}
 
-		prev_dropped = log_dropped;
-		log_dropped = 0;
-		pthread_mutex_unlock(&log_mutex);
+	if (log_write_len)
+		flush_logfile();
+	sync_logfile(0);
 
-		if (prev_dropped) {
-			write_dropped(level, prev_dropped);
-			prev_dropped = 0;
+	return count;
+}
+
+static void *log_thread_fn(void *arg GNUC_UNUSED)
+{
+	struct timespec ts;
+	int rv;
+
+	while (1) {
+		if (logfile_dirty && log_logfile_sync_seconds) {
+			/* wake to sync what was written before going idle */
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += log_logfile_sync_seconds;
+			while ((rv = sem_timedwait(&log_sem, &ts)) < 0 && errno == EINTR)
+				;
+			if (rv < 0)
+				sync_logfile(1);
+		} else {
+			while (sem_wait(&log_sem) < 0 && errno == EINTR)
+				;
 		}
 
-		write_entry(level, str);
+		/* one pass writes the records for all the posts */
+		while (!sem_trywait(&log_sem))
+			;
+
+		write_ring_entries();
+
+		if (__atomic_load_n(&log_thread_done, __ATOMIC_ACQUIRE))
+			break;
 	}
- out:
+
+	sync_logfile(1);
 	pthread_exit(NULL);
 }
 
+void get_log_stats(struct log_stats *st)
+{
+	/* read without locking, the values are only informational */
+	st->ring_entries = log_ring_entries;
+	st->dropped = stat_dropped + __atomic_load_n(&log_dropped, __ATOMIC_RELAXED);
+	st->writes = stat_writes;
+	st->write_entries = stat_write_entries;
+	st->backlog_max = stat_backlog_max;
+}
+
 int setup_logging(void)
 {
-	int fd, rv;
+	int rv;
 
 	snprintf(logfile_path, PATH_MAX, "%s/%s", SANLK_LOG_DIR,
 		 SANLK_LOGFILE_NAME);
 
-	logfile_fp = fopen(logfile_path, "a+");
-	if (logfile_fp) {
-		fd = fileno(logfile_fp);
-		fcntl(fd, F_SETFD, fcntl(fd, F_GETFD, 0) | FD_CLOEXEC);
-	}
+	logfile_fd = open(logfile_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+	logfile_synced = monotime();
 
-	log_ents = malloc(log_num_ents * sizeof(struct entry));
-	if (!log_ents) {
-		fclose(logfile_fp);
-		logfile_fp = NULL;
-		return -1;
+	/* the ring of this thread was created before log_ring_entries was
+	   set from the config, so use a new one of the configured size */
+	if (log_ring_self && log_ring_self->entries != (unsigned int)log_ring_entries) {
+		pthread_mutex_lock(&log_rings_mutex);
+		log_ring_self->unused = 1;
+		pthread_mutex_unlock(&log_rings_mutex);
+		log_ring_self = NULL;
 	}
-	memset(log_ents, 0, log_num_ents * sizeof(struct entry));
+
+	sem_init(&log_sem, 0, 0);
+	log_sem_ready = 1;
 
 	openlog(DAEMON_NAME, LOG_CONS | LOG_PID, LOG_DAEMON);
 
@@ -292,24 +580,29 @@ int setup_logging(void)
 	if (rv)
 		return -1;
 
+	/* write anything logged before the thread started */
+	sem_post(&log_sem);
+
 	return 0;
 }
 
+/* the log thread starts before thread classes are set up */
+
+void set_log_thread_class(void)
+{
+	thread_class_apply(THREAD_CLASS_LOG, thread_handle);
+}
+
 void close_logging(void)
 {
-	pthread_mutex_lock(&log_mutex);
-	log_thread_done = 1;
-	pthread_cond_signal(&log_cond);
-	pthread_mutex_unlock(&log_mutex);
+	__atomic_store_n(&log_thread_done, 1, __ATOMIC_RELEASE);
+	sem_post(&log_sem);
 	pthread_join(thread_handle, NULL);
 
-	pthread_mutex_lock(&log_mutex);
 	closelog();
-	if (logfile_fp) {
-		fclose(logfile_fp);
-		logfile_fp = NULL;
+	if (logfile_fd >= 0) {
+		close(logfile_fd);
+		logfile_fd = -1;
 	}
-
-	pthread_mutex_unlock(&log_mutex);
 }
 
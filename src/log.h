@@ -28,6 +28,17 @@ void log_level(uint32_t space_id, uint32_t res_id, char *name_in, int level, con
 	__attribute__((format(printf, 5, 6)));
 
 int setup_logging(void);
+
+struct log_stats {
+	uint64_t dropped;		/* records not written to logfile/syslog */
+	uint64_t writes;		/* logfile writes */
+	uint64_t write_entries;		/* records written to logfile */
+	unsigned int backlog_max;	/* most records waiting in a ring */
+	int ring_entries;
+};
+
+void get_log_stats(struct log_stats *st);
+void set_log_thread_class(void);
 void close_logging(void);
 void copy_log_dump(char *buf, int *len);
 
@@ -19,8 +19,8 @@
 #include <time.h>
 #include <syslog.h>
 #include <pthread.h>
-#include <poll.h>
 #include <sched.h>
+#include <semaphore.h>
 #include <pwd.h>
 #include <grp.h>
 #include <ctype.h>
@@ -36,6 +36,7 @@
 #include <sys/utsname.h>
 #include <sys/resource.h>
 #include <uuid/uuid.h>
+#include <sys/epoll.h>
 #include <sys/eventfd.h>
 
 #define EXTERN
@@ -57,17 +58,83 @@
 #include "timeouts.h"
 #include "paxos_lease.h"
 #include "env.h"
+#include "rindex.h"
+#include "metrics.h"
+#include "capture.h"
+#include "snapshot.h"
+#include "hoststate.h"
+#include "crc32c.h"
+#include "fdcache.h"
+#include "slab.h"
+#include "affinity.h"
+#include "trace.h"
 
 #define SIGRUNPATH 100 /* anything that's not SIGTERM/SIGKILL */
 
+/*
+ * Bounded multi-producer/multi-consumer queue of pointers.  Each cell has
+ * a sequence number that tells a producer or consumer at a given position
+ * whether the cell is ready for it, so push and pop only contend on a
+ * cmpxchg of the position.
+ */
+
+struct work_cell {
+	unsigned int seq;
+	void *data;
+};
+
+struct work_queue {
+	struct work_cell *cells;
+	unsigned int mask;
+	unsigned int push_pos __attribute__((aligned(64)));
+	unsigned int pop_pos __attribute__((aligned(64)));
+};
+
+/*
+ * Every cmd_args from a plain connection is passed to the pool with its
+ * connection suspended, so there can't be more than CLIENT_NALLOC of
+ * those at once.  Pipelined connections can each have pipeline_queue_max
+ * cmds in the pool, which together is not bounded by the queue size, so
+ * pipelined cmds are only queued while a queue has more than
+ * CLIENT_NALLOC free cells (half of the query queue), and fail with
+ * -EBUSY otherwise.  The remaining cells are kept for plain connections,
+ * so their lease cmds are never refused.  cmd_args beyond the pool are
+ * malloc'ed.
+ */
+#define WORK_QUEUE_SIZE 2048 /* 2 * CLIENT_NALLOC, power of 2 */
+#define WORK_QUERY_SIZE 256  /* power of 2 */
+
+/*
+ * Work is queued by class, and workers take it from the class queues in
+ * the order of work_schedule, lease cmds four times for each query, so a
+ * client flooding the daemon with reads does not hold up acquires and
+ * releases from others.  When the scheduled queue is empty, a worker
+ * takes from the others in class order.  The cmds that main_loop runs
+ * itself in call_cmd_daemon don't wait for workers at all.
+ */
+#define WORK_LEASE   0	/* acquire, release, lockspace add and remove */
+#define WORK_NORMAL  1
+#define WORK_QUERY   2	/* reads of lockspaces and resources */
+#define WORK_CLASSES 3
+
+static const int work_schedule[] = {
+	WORK_LEASE, WORK_NORMAL, WORK_LEASE, WORK_QUERY,
+	WORK_LEASE, WORK_NORMAL, WORK_LEASE,
+};
+#define WORK_SCHEDULE_LEN (sizeof(work_schedule) / sizeof(work_schedule[0]))
+
 struct thread_pool {
 	int num_workers;
 	int max_workers;
-	int free_workers;
+	int free_workers;	/* waiting workers less unclaimed wakeups */
 	int quit;
-	struct list_head work_data;
+	unsigned int work_seq;
+	uint64_t work_busy;
+	struct work_queue work_data[WORK_CLASSES];
+	struct work_queue free_args;
+	struct cmd_args *args;
+	sem_t work_sem;
 	pthread_mutex_t mutex;
-	pthread_cond_t cond;
 	pthread_cond_t quit_wait;
 };
 
@@ -76,11 +143,17 @@ int log_logfile_priority = LOG_WARNING;
 int log_logfile_use_utc = 0;
 int log_syslog_priority = LOG_ERR;
 int log_stderr_priority = -1; /* -D sets this to LOG_DEBUG */
+int log_ring_entries = DEFAULT_LOG_RING_ENTRIES;
+int log_logfile_sync_seconds = 0;
 
 #define CLIENT_NALLOC 1024
+#define MAIN_EPOLL_EVENTS 64
 static int client_maxi;
 static int client_size = 0;
-static struct pollfd *pollfd;
+static int epoll_fd = -1;
+static int *client_free_list;
+static int client_free_count;
+static pthread_mutex_t client_free_mutex = PTHREAD_MUTEX_INITIALIZER;
 static char command[COMMAND_MAX];
 static int cmd_argc;
 static char **cmd_argv;
@@ -90,14 +163,41 @@ static pthread_mutex_t rand_mutex = PTHREAD_MUTEX_INITIALIZER;
 static const char *run_dir = NULL;
 static int privileged = 1;
 
+/*
+ * Each client fd is registered with epoll using EPOLLONESHOT, so once
+ * main_loop gets an event for a connection, epoll ignores it until it's
+ * rearmed.  main_loop rearms a connection after calling its workfn,
+ * unless the workfn suspended it to pass it to a worker thread, in which
+ * case client_resume() rearms it from the worker thread.  The event data
+ * includes a generation number for the ci, so that an event for a
+ * connection that was closed, and its ci reused, during the same
+ * epoll_wait batch is ignored.
+ */
+
+static void client_watch(int ci, int fd, int op)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.u64 = ((uint64_t)client[ci].epoll_gen << 32) | (uint32_t)ci;
+
+	if (epoll_ctl(epoll_fd, op, fd, &ev) < 0 && errno != ENOENT && errno != EBADF)
+		log_error("client_watch ci %d fd %d op %d error %d", ci, fd, op, errno);
+}
+
+static void client_unwatch(int fd)
+{
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
 static void close_helper(void)
 {
+	client_unwatch(helper_status_fd);
 	close(helper_kill_fd);
 	close(helper_status_fd);
 	helper_kill_fd = -1;
 	helper_status_fd = -1;
-	pollfd[helper_ci].fd = -1;
-	pollfd[helper_ci].events = 0;
 	helper_ci = -1;
 
 	/* don't set helper_pid = -1 until we've tried waitpid */
@@ -113,56 +213,44 @@ static void close_helper(void)
  *
  * By setting the pipe size to 1MB in setup_helper, we could quickly send 2048
  * msgs before getting EAGAIN.
+ *
+ * The msgs for the pids in one kill_pids pass are collected in
+ * helper_batch and written together, HELPER_MSG_BATCH at a time, which
+ * is the most that is written to a pipe atomically.  A batch that does
+ * not fit in the pipe is not written at all.
  */
 
-static void send_helper_kill(struct space *sp, struct client *cl, int sig)
-{
-	struct helper_msg hm;
-	int rv;
+static struct helper_msg helper_batch[HELPER_MSG_BATCH];
+static int helper_batch_ci[HELPER_MSG_BATCH];
+static int helper_batch_count;
 
-	/*
-	 * We come through here once a second while the pid still has
-	 * leases.  We only send a single RUNPATH message, so after
-	 * the first RUNPATH goes through we set CL_RUNPATH_SENT to
-	 * avoid futher RUNPATH's.
-	 */
+static void flush_helper_kill(struct space *sp)
+{
+	struct helper_msg *hm;
+	struct client *cl;
+	int count = helper_batch_count;
+	int i, rv;
 
-	if ((cl->flags & CL_RUNPATH_SENT) && (sig == SIGRUNPATH))
+	if (!count)
 		return;
 
+	helper_batch_count = 0;
+
 	if (helper_kill_fd == -1) {
-		log_error("send_helper_kill pid %d no fd", cl->pid);
+		log_error("send_helper_kill count %d no fd", count);
 		return;
 	}
 
-	memset(&hm, 0, sizeof(hm));
-
-	if (sig == SIGRUNPATH) {
-		hm.type = HELPER_MSG_RUNPATH;
-		memcpy(hm.path, cl->killpath, SANLK_HELPER_PATH_LEN);
-		memcpy(hm.args, cl->killargs, SANLK_HELPER_ARGS_LEN);
-
-		/* only include pid if it's requested as a killpath arg */
-		if (cl->flags & CL_KILLPATH_PID)
-			hm.pid = cl->pid;
-	} else {
-		hm.type = HELPER_MSG_KILLPID;
-		hm.sig = sig;
-		hm.pid = cl->pid;
-	}
-
-	log_erros(sp, "kill %d sig %d count %d", cl->pid, sig, cl->kill_count);
-
  retry:
-	rv = write(helper_kill_fd, &hm, sizeof(hm));
+	rv = write(helper_kill_fd, helper_batch, count * sizeof(struct helper_msg));
 	if (rv == -1 && errno == EINTR)
 		goto retry;
 
 	/* pipe is full, we'll try again in a second */
 	if (rv == -1 && errno == EAGAIN) {
 		helper_full_count++;
-		log_space(sp, "send_helper_kill pid %d sig %d full_count %u",
-			  cl->pid, sig, helper_full_count);
+		log_space(sp, "send_helper_kill count %d full_count %u",
+			  count, helper_full_count);
 		return;
 	}
 
@@ -173,16 +261,66 @@ static void send_helper_kill(struct space *sp, struct client *cl, int sig)
 		return;
 	}
 
-	if (rv != sizeof(hm)) {
+	if (rv != (int)(count * sizeof(struct helper_msg))) {
 		/* this shouldn't happen */
-		log_erros(sp, "send_helper_kill pid %d error %d %d",
-			  cl->pid, rv, errno);
+		log_erros(sp, "send_helper_kill count %d error %d %d",
+			  count, rv, errno);
 		close_helper();
 		return;
 	}
 
-	if (sig == SIGRUNPATH)
-		cl->flags |= CL_RUNPATH_SENT;
+	for (i = 0; i < count; i++) {
+		hm = &helper_batch[i];
+		cl = &client[helper_batch_ci[i]];
+
+		if (hm->type == HELPER_MSG_RUNPATH)
+			cl->flags |= CL_RUNPATH_SENT;
+	}
+}
+
+static void send_helper_kill(struct space *sp, struct client *cl, int sig)
+{
+	struct helper_msg *hm;
+
+	/*
+	 * We come through here once a second while the pid still has
+	 * leases.  We only send a single RUNPATH message, so after
+	 * the first RUNPATH goes through we set CL_RUNPATH_SENT to
+	 * avoid futher RUNPATH's.
+	 */
+
+	if ((cl->flags & CL_RUNPATH_SENT) && (sig == SIGRUNPATH))
+		return;
+
+	if (helper_kill_fd == -1) {
+		log_error("send_helper_kill pid %d no fd", cl->pid);
+		return;
+	}
+
+	hm = &helper_batch[helper_batch_count];
+	memset(hm, 0, sizeof(struct helper_msg));
+
+	if (sig == SIGRUNPATH) {
+		hm->type = HELPER_MSG_RUNPATH;
+		memcpy(hm->path, cl->killpath, SANLK_HELPER_PATH_LEN);
+		memcpy(hm->args, cl->killargs, SANLK_HELPER_ARGS_LEN);
+		hm->client_pid = cl->pid;
+
+		/* only include pid if it's requested as a killpath arg */
+		if (cl->flags & CL_KILLPATH_PID)
+			hm->pid = cl->pid;
+	} else {
+		hm->type = HELPER_MSG_KILLPID;
+		hm->sig = sig;
+		hm->pid = cl->pid;
+	}
+
+	log_erros(sp, "kill %d sig %d count %d", cl->pid, sig, cl->kill_count);
+
+	helper_batch_ci[helper_batch_count++] = cl - client;
+
+	if (helper_batch_count == HELPER_MSG_BATCH)
+		flush_helper_kill(sp);
 }
 
 /* FIXME: add a mutex for client array so we don't try to expand it
@@ -193,27 +331,32 @@ static int client_alloc(void)
 {
 	int i;
 
-	/* pollfd is one element longer as we use an additional element for the
-	 * eventfd notification mechanism */
 	client = malloc(CLIENT_NALLOC * sizeof(struct client));
-	pollfd = malloc((CLIENT_NALLOC+1) * sizeof(struct pollfd));
+	client_free_list = malloc(CLIENT_NALLOC * sizeof(int));
 
-	if (!client || !pollfd) {
-		log_error("can't alloc for client or pollfd array");
+	if (!client || !client_free_list) {
+		log_error("can't alloc for client array");
 		return -ENOMEM;
 	}
 
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		log_error("can't create epoll fd %d", errno);
+		return -errno;
+	}
+
 	for (i = 0; i < CLIENT_NALLOC; i++) {
 		memset(&client[i], 0, sizeof(struct client));
-		memset(&pollfd[i], 0, sizeof(struct pollfd));
 
 		pthread_mutex_init(&client[i].mutex, NULL);
+		pthread_mutex_init(&client[i].send_mutex, NULL);
 		client[i].fd = -1;
 		client[i].pid = -1;
 
-		pollfd[i].fd = -1;
-		pollfd[i].events = 0;
+		/* the free list is a stack, lowest ci on top to keep client_maxi low */
+		client_free_list[i] = CLIENT_NALLOC - 1 - i;
 	}
+	client_free_count = CLIENT_NALLOC;
 	client_size = CLIENT_NALLOC;
 	return 0;
 }
@@ -247,8 +390,16 @@ static void _client_free(int ci)
 		goto out;
 	}
 
-	if (cl->fd != -1)
+	if (cl->inflight) {
+		log_debug("client_free ci %d inflight %d", ci, cl->inflight);
+		cl->need_free = 1;
+		goto out;
+	}
+
+	if (cl->fd != -1) {
+		client_unwatch(cl->fd);
 		close(cl->fd);
+	}
 
 	cl->used = 0;
 	cl->fd = -1;
@@ -257,6 +408,7 @@ static void _client_free(int ci)
 	cl->pid_dead = 0;
 	cl->suspend = 0;
 	cl->need_free = 0;
+	cl->pipeline = 0;
 	cl->kill_count = 0;
 	cl->kill_last = 0;
 	cl->restricted = 0;
@@ -271,10 +423,14 @@ static void _client_free(int ci)
 		free(cl->tokens);
 	cl->tokens = NULL;
 	cl->tokens_slots = 0;
-
-	/* make poll() ignore this connection */
-	pollfd[ci].fd = -1;
-	pollfd[ci].events = 0;
+	cl->tokens_count = 0;
+	free(cl->tokens_hash);
+	cl->tokens_hash = NULL;
+	cl->tokens_hash_size = 0;
+
+	pthread_mutex_lock(&client_free_mutex);
+	client_free_list[client_free_count++] = ci;
+	pthread_mutex_unlock(&client_free_mutex);
  out:
 	return;
 }
@@ -320,11 +476,9 @@ static int client_suspend(int ci)
 		goto out;
 	}
 
+	/* the connection is already disarmed in epoll (oneshot) while main_loop
+	   is processing it, and main_loop won't rearm it while it's suspended */
 	cl->suspend = 1;
-
-	/* make poll() ignore this connection */
-	pollfd[ci].fd = -1;
-	pollfd[ci].events = 0;
  out:
 	pthread_mutex_unlock(&cl->mutex);
 
@@ -350,6 +504,10 @@ void client_resume(int ci)
 		goto out;
 	}
 
+	/* a pipelined connection is not suspended, see client_send_reply */
+	if (cl->pipeline)
+		goto out;
+
 	if (!cl->suspend) {
 		/* should never happen */
 		log_error("client_resume ci %d not suspended", ci);
@@ -362,12 +520,8 @@ void client_resume(int ci)
 		log_debug("client_resume ci %d need_free", ci);
 		_client_free(ci);
 	} else {
-		/* make poll() watch this connection */
-		pollfd[ci].fd = cl->fd;
-		pollfd[ci].events = POLLIN;
-
-		/* interrupt any poll() that might already be running */
-		eventfd_write(efd, 1);
+		/* make epoll watch this connection again */
+		client_watch(ci, cl->fd, EPOLL_CTL_MOD);
 	}
  out:
 	pthread_mutex_unlock(&cl->mutex);
@@ -378,28 +532,42 @@ static int client_add(int fd, void (*workfn)(int ci), void (*deadfn)(int ci))
 	struct client *cl;
 	int i;
 
-	for (i = 0; i < client_size; i++) {
-		cl = &client[i];
-		pthread_mutex_lock(&cl->mutex);
-		if (!cl->used) {
-			cl->used = 1;
-			cl->fd = fd;
-			cl->workfn = workfn;
-			cl->deadfn = deadfn ? deadfn : client_free;
-
-			/* make poll() watch this connection */
-			pollfd[i].fd = fd;
-			pollfd[i].events = POLLIN;
-
-			if (i > client_maxi)
-				client_maxi = i;
-			pthread_mutex_unlock(&cl->mutex);
-			return i;
-		}
-		pthread_mutex_unlock(&cl->mutex);
+	pthread_mutex_lock(&client_free_mutex);
+	if (!client_free_count) {
+		pthread_mutex_unlock(&client_free_mutex);
+		return -1;
 	}
+	i = client_free_list[--client_free_count];
+	pthread_mutex_unlock(&client_free_mutex);
 
-	return -1;
+	cl = &client[i];
+	pthread_mutex_lock(&cl->mutex);
+	cl->used = 1;
+	cl->fd = fd;
+	cl->epoll_gen++;
+	cl->workfn = workfn;
+	cl->deadfn = deadfn ? deadfn : client_free;
+
+	/* make epoll watch this connection */
+	client_watch(i, fd, EPOLL_CTL_ADD);
+
+	if (i > client_maxi)
+		client_maxi = i;
+	pthread_mutex_unlock(&cl->mutex);
+	return i;
+}
+
+/* rearm a connection after main_loop has processed an event for it */
+
+static void client_rearm(int ci, uint32_t gen)
+{
+	struct client *cl = &client[ci];
+
+	pthread_mutex_lock(&cl->mutex);
+	if (cl->used && cl->epoll_gen == gen && !cl->suspend && !cl->pid_dead &&
+	    !cl->need_free)
+		client_watch(ci, cl->fd, EPOLL_CTL_MOD);
+	pthread_mutex_unlock(&cl->mutex);
 }
 
 /* clear the unreceived portion of an aborted command */
@@ -411,7 +579,8 @@ void client_recv_all(int ci, struct sm_header *h_recv, int pos)
 	int rem = h_recv->length - sizeof(struct sm_header) - pos;
 	int rv, error = 0, total = 0, retries = 0;
 
-	if (!rem)
+	/* main_loop has already read all of a pipelined request */
+	if (!rem || client[ci].pipeline)
 		return;
 
 	while (1) {
@@ -439,6 +608,40 @@ void client_recv_all(int ci, struct sm_header *h_recv, int pos)
 		  ci, client[ci].fd, client[ci].pid, pos, rv, error, retries, rem, total);
 }
 
+/*
+ * Send the whole reply to a pipelined cmd, and free the connection if it
+ * was closed while the cmd was running.
+ */
+
+void client_send_reply(int ci, char *buf, int len);
+void client_send_reply(int ci, char *buf, int len)
+{
+	struct client *cl = &client[ci];
+
+	pthread_mutex_lock(&cl->send_mutex);
+	send(cl->fd, buf, len, MSG_NOSIGNAL);
+	pthread_mutex_unlock(&cl->send_mutex);
+
+	pthread_mutex_lock(&cl->mutex);
+	cl->inflight--;
+	if (!cl->inflight && cl->need_free)
+		_client_free(ci);
+	pthread_mutex_unlock(&cl->mutex);
+}
+
+static void pipeline_fail(int ci, struct sm_header *h_recv, char *body, int result)
+{
+	struct sm_header h;
+
+	memcpy(&h, h_recv, sizeof(struct sm_header));
+	h.version = SM_PROTO;
+	h.length = sizeof(h);
+	h.data = result;
+	h.data2 = 0;
+	client_send_reply(ci, (char *)&h, sizeof(h));
+	free(body);
+}
+
 void send_result(int fd, struct sm_header *h_recv, int result);
 void send_result(int fd, struct sm_header *h_recv, int result)
 {
@@ -489,9 +692,7 @@ void client_pid_dead(int ci)
 	   cl->mutex to set cl->cmd_active to 0, it will see cl->pid_dead is 1
 	   and know they need to release cl->tokens and call client_free */
 
-	/* make poll() ignore this connection */
-	pollfd[ci].fd = -1;
-	pollfd[ci].events = 0;
+	/* main_loop won't rearm this connection in epoll */
 
 	pthread_mutex_unlock(&cl->mutex);
 
@@ -507,6 +708,11 @@ void client_pid_dead(int ci)
 		return;
 	}
 
+	/* no cmd is using cl->tokens while cmd_active is 0 and pid_dead is
+	   set, and spaces_mutex must not be taken while holding cl->mutex */
+
+	unlink_client_tokens(cl->tokens, cl->tokens_slots);
+
 	/* use async release here because this is the main thread that we don't
 	   want to block doing disk lease i/o */
 
@@ -514,7 +720,7 @@ void client_pid_dead(int ci)
 	for (i = 0; i < cl->tokens_slots; i++) {
 		if (cl->tokens[i]) {
 			release_token_async(cl->tokens[i]);
-			free(cl->tokens[i]);
+			slab_free(cl->tokens[i]);
 		}
 	}
 
@@ -522,52 +728,48 @@ void client_pid_dead(int ci)
 	pthread_mutex_unlock(&cl->mutex);
 }
 
-/* At some point we may want to keep a record of each pid using a lockspace
-   in the sp struct to avoid walking through each client's cl->tokens to see if
-   it's using the lockspace.  It should be the uncommon situation where a
-   lockspace renewal fails and we need to walk through all client tokens like
-   this.  i.e. we'd probably not want to optimize for this case at the expense
-   of the more common case where a pid exits, but we do want it to be robust.
+/* The three routines that correlate which clients are using which
+   lockspaces (client_using_space, kill_pids, all_pids_dead) are called
+   with spaces_mutex held, and they need to take cl->mutex.  This means
+   that cmd_acquire_thread has to lock both spaces_mutex and cl->mutex
+   when adding new tokens to the client.  (It needs to check that the
+   lockspace for the new tokens hasn't failed while the tokens were being
+   acquired.)
 
-   The locking is also made a bit ugly by these three routines that need to
-   correlate which clients are using which lockspaces.  (client_using_space,
-   kill_pids, all_pids_dead)  spaces_mutex is held when they are called, and
-   they need to take cl->mutex.  This means that cmd_acquire_thread has to
-   lock both spaces_mutex and cl->mutex when adding new tokens to the client.
-   (It needs to check that the lockspace for the new tokens hasn't failed
-   while the tokens were being acquired.)
+   The clients using a lockspace are found through the tokens on
+   sp->client_tokens (see link_client_tokens), so only the clients with
+   tokens in the failed lockspace are looked at.  A client with several
+   tokens in the lockspace is found for each of them.
 
    In kill_pids and all_pids_dead could we check cl->pid <= 0 without
    taking cl->mutex, since client_pid_dead in the main thread is the
    only place that changes that?  */
 
-static int client_using_space(struct client *cl, struct space *sp)
+/* called with cl->mutex held; token is on sp->client_tokens, but may
+   have just been removed from cl->tokens by cmd_release */
+
+static int client_using_space(struct client *cl, struct space *sp,
+			      struct token *token)
 {
-	struct token *token;
-	int i, rv = 0;
+	int i = token->client_slot;
 
-	for (i = 0; i < cl->tokens_slots; i++) {
-		token = cl->tokens[i];
-		if (!token)
-			continue;
-		if (strncmp(token->r.lockspace_name, sp->space_name, NAME_ID_SIZE))
-			continue;
+	if (i < 0 || i >= cl->tokens_slots || cl->tokens[i] != token)
+		return 0;
 
-		if (!cl->kill_count)
-			log_token(token, "client_using_space pid %d", cl->pid);
-		if (sp->space_dead)
-			token->space_dead = sp->space_dead;
-		rv = 1;
-	}
-	return rv;
+	if (!cl->kill_count)
+		log_token(token, "client_using_space pid %d", cl->pid);
+	if (sp->space_dead)
+		token->space_dead = sp->space_dead;
+	return 1;
 }
 
 static void kill_pids(struct space *sp)
 {
 	struct client *cl;
+	struct token *token;
 	uint64_t now, last_success;
 	int id_renewal_fail_seconds;
-	int ci, sig;
+	int sig;
 	int do_kill, in_grace;
 
 	/*
@@ -592,10 +794,10 @@ static void kill_pids(struct space *sp)
 
 	now = monotime();
 
-	for (ci = 0; ci <= client_maxi; ci++) {
+	list_for_each_entry(token, &sp->client_tokens, client_list) {
 		do_kill = 0;
 
-		cl = &client[ci];
+		cl = &client[token->client_ci];
 		pthread_mutex_lock(&cl->mutex);
 
 		if (!cl->used)
@@ -604,16 +806,14 @@ static void kill_pids(struct space *sp)
 		if (cl->pid <= 0)
 			goto unlock;
 
-		/* NB this cl may not be using sp, but trying to
-		   avoid the expensive client_using_space check */
-
 		if (cl->kill_count >= kill_count_max)
 			goto unlock;
 
+		/* also skips a cl already killed for another token in sp */
 		if (cl->kill_count && (now - cl->kill_last < 1))
 			goto unlock;
 
-		if (!client_using_space(cl, sp))
+		if (!client_using_space(cl, sp, token))
 			goto unlock;
 
 		cl->kill_last = now;
@@ -631,7 +831,8 @@ static void kill_pids(struct space *sp)
 
 		if (sp->external_remove || (external_shutdown > 1)) {
 			sig = SIGKILL;
-		} else if ((kill_grace_seconds > 0) && in_grace && cl->killpath[0]) {
+		} else if ((kill_grace_seconds > 0) && in_grace && cl->killpath[0] &&
+			   !(cl->flags & CL_RUNPATH_FAILED)) {
 			sig = SIGRUNPATH;
 		} else if (in_grace) {
 			sig = SIGTERM;
@@ -659,23 +860,25 @@ static void kill_pids(struct space *sp)
 
 		send_helper_kill(sp, cl, sig);
 	}
+
+	flush_helper_kill(sp);
 }
 
 static int all_pids_dead(struct space *sp)
 {
 	struct client *cl;
+	struct token *token;
 	int stuck = 0, check = 0;
-	int ci;
 
-	for (ci = 0; ci <= client_maxi; ci++) {
-		cl = &client[ci];
+	list_for_each_entry(token, &sp->client_tokens, client_list) {
+		cl = &client[token->client_ci];
 		pthread_mutex_lock(&cl->mutex);
 
 		if (!cl->used)
 			goto unlock;
 		if (cl->pid <= 0)
 			goto unlock;
-		if (!client_using_space(cl, sp))
+		if (!client_using_space(cl, sp, token))
 			goto unlock;
 
 		if (cl->kill_count >= kill_count_max)
@@ -724,76 +927,143 @@ static int all_pids_dead(struct space *sp)
 	return 1;
 }
 
-static unsigned int time_diff(struct timeval *begin, struct timeval *end)
+#define STANDARD_CHECK_INTERVAL 1000 /* milliseconds */
+#define RECOVERY_CHECK_INTERVAL  200 /* milliseconds */
+#define IDLE_CHECK_INTERVAL    10000 /* milliseconds */
+
+/*
+ * main_loop sleeps until the earliest time that something needs to be
+ * checked, instead of waking every STANDARD_CHECK_INTERVAL to check all
+ * lockspaces.  Each lockspace is checked at its own check_time, which is
+ * the earliest of the deadlines returned by check_our_lease (renewal
+ * warning or failure) and check_host_states (another host becoming
+ * failed or dead), or RECOVERY_CHECK_INTERVAL while its pids are being
+ * killed.  Lockspace threads make main_loop check a lockspace sooner,
+ * e.g. after each renewal so that check_other_leases sees the new reads,
+ * by setting sp->check_wake and writing to wake_fd (main_loop_wake).
+ */
+
+static int wake_fd = -1;
+static int main_woken;
+
+void main_loop_wake(void);
+void main_loop_wake(void)
 {
-	struct timeval result;
-	timersub(end, begin, &result);
-	return (result.tv_sec * 1000) + (result.tv_usec / 1000);
+	uint64_t val = 1;
+	int rv;
+
+	/* also called from sigterm_handler */
+	rv = write(wake_fd, &val, sizeof(val));
+	(void)rv;
 }
 
-#define STANDARD_CHECK_INTERVAL 1000 /* milliseconds */
-#define RECOVERY_CHECK_INTERVAL  200 /* milliseconds */
+static void process_wake(int ci GNUC_UNUSED)
+{
+	uint64_t val;
+	int rv;
+
+	rv = read(wake_fd, &val, sizeof(val));
+	(void)rv;
+	main_woken = 1;
+}
+
+static int setup_wake(void)
+{
+	int ci;
+
+	wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (wake_fd < 0) {
+		log_error("wake eventfd error %d", errno);
+		return -1;
+	}
+
+	ci = client_add(wake_fd, process_wake, NULL);
+	if (ci < 0) {
+		close(wake_fd);
+		wake_fd = -1;
+		return -1;
+	}
+	strcpy(client[ci].owner_name, "wake");
+	return 0;
+}
+
+static void set_deadline(uint64_t *next, uint64_t ms)
+{
+	if (ms < *next)
+		*next = ms;
+}
+
+/* move sp to spaces_rem so main_loop will no longer see it */
+
+static void stop_space(struct space *sp)
+{
+	log_space(sp, "set thread_stop");
+	pthread_mutex_lock(&sp->mutex);
+	sp->thread_stop = 1;
+	deactivate_watchdog(sp);
+	pthread_mutex_unlock(&sp->mutex);
+	space_list_move(sp, &spaces_rem);
+}
 
 static int main_loop(void)
 {
 	void (*workfn) (int ci);
 	void (*deadfn) (int ci);
 	struct space *sp, *safe;
-	struct timeval now, last_check;
-	int poll_timeout, check_interval;
-	unsigned int ms;
-	int i, rv, empty, check_all;
+	uint64_t now, next, next_check, deadline, wait_begin;
+	int poll_timeout;
+	struct epoll_event events[MAIN_EPOLL_EVENTS];
+	uint32_t gen;
+	int i, ci, rv, empty, check_all, check_sp, busy;
+	struct renewal_read check_read;
 	char *check_buf = NULL;
 	int check_buf_len = 0;
-	uint64_t ebuf;
 
-	gettimeofday(&last_check, NULL);
+	next_check = monotime_ms() + STANDARD_CHECK_INTERVAL;
 	poll_timeout = STANDARD_CHECK_INTERVAL;
-	check_interval = STANDARD_CHECK_INTERVAL;
 
 	while (1) {
-		/* as well as the clients, check the eventfd */
-		pollfd[client_maxi+1].fd = efd;
-		pollfd[client_maxi+1].events = POLLIN;
-
-		rv = poll(pollfd, client_maxi + 2, poll_timeout);
-		if (rv == -1 && errno == EINTR)
-			continue;
+		wait_begin = trace_begin();
+		rv = epoll_wait(epoll_fd, events, MAIN_EPOLL_EVENTS, poll_timeout);
+		if (!rv)
+			thread_class_wake(THREAD_CLASS_MAIN, wait_begin + (poll_timeout * 1000),
+					  trace_begin());
 		if (rv < 0) {
-			/* not sure */
+			/* EINTR from a signal that may set external_shutdown */
+			rv = 0;
 		}
-		for (i = 0; i <= client_maxi + 1; i++) {
-			if (pollfd[i].fd == efd && pollfd[i].revents & POLLIN) {
-				/* a client_resume completed */
-				eventfd_read(efd, &ebuf);
-				continue;
-			}
-			if (client[i].fd < 0)
+		for (i = 0; i < rv; i++) {
+			ci = (int)(events[i].data.u64 & 0xFFFFFFFF);
+			gen = (uint32_t)(events[i].data.u64 >> 32);
+
+			/* connection was closed and ci reused in this batch */
+			if (client[ci].epoll_gen != gen)
 				continue;
-			if (pollfd[i].revents & POLLIN) {
-				workfn = client[i].workfn;
+
+			if (events[i].events & EPOLLIN) {
+				workfn = client[ci].workfn;
 				if (workfn)
-					workfn(i);
+					workfn(ci);
 			}
-			if (pollfd[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
-				deadfn = client[i].deadfn;
+			if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+				deadfn = client[ci].deadfn;
 				if (deadfn)
-					deadfn(i);
+					deadfn(ci);
 			}
-		}
 
+			client_rearm(ci, gen);
+		}
 
-		gettimeofday(&now, NULL);
-		ms = time_diff(&last_check, &now);
-		if (ms < check_interval) {
-			poll_timeout = check_interval - ms;
+		now = monotime_ms();
+		if (now < next_check && !main_woken && !external_shutdown) {
+			poll_timeout = next_check - now;
 			continue;
 		}
-		last_check = now;
-		check_interval = STANDARD_CHECK_INTERVAL;
+		main_woken = 0;
+		next = now + IDLE_CHECK_INTERVAL;
 
 		/*
-		 * check the condition of each lockspace,
+		 * check the condition of each lockspace that is due,
 		 * if pids are being killed, have pids all exited?
 		 * is its host_id being renewed?, if not kill pids
 		 */
@@ -801,17 +1071,15 @@ static int main_loop(void)
 		pthread_mutex_lock(&spaces_mutex);
 		list_for_each_entry_safe(sp, safe, &spaces, list) {
 
+			check_sp = __atomic_exchange_n(&sp->check_wake, 0, __ATOMIC_ACQUIRE);
+
+			if (!check_sp && now < sp->check_time && !external_shutdown) {
+				set_deadline(&next, sp->check_time);
+				continue;
+			}
+
 			if (sp->killing_pids && all_pids_dead(sp)) {
-				/*
-				 * move sp to spaces_rem so main_loop
-				 * will no longer see it.
-				 */
-				log_space(sp, "set thread_stop");
-				pthread_mutex_lock(&sp->mutex);
-				sp->thread_stop = 1;
-				deactivate_watchdog(sp);
-				pthread_mutex_unlock(&sp->mutex);
-				list_move(&sp->list, &spaces_rem);
+				stop_space(sp);
 				continue;
 			}
 
@@ -821,7 +1089,8 @@ static int main_loop(void)
 				 * levels of severity until they all exit
 				 */
 				kill_pids(sp);
-				check_interval = RECOVERY_CHECK_INTERVAL;
+				sp->check_time = now + RECOVERY_CHECK_INTERVAL;
+				set_deadline(&next, sp->check_time);
 				continue;
 			}
 
@@ -839,8 +1108,10 @@ static int main_loop(void)
 				memset(check_buf, 0, check_buf_len);
 
 			check_all = 0;
+			deadline = 0;
+			memset(&check_read, 0, sizeof(check_read));
 
-			rv = check_our_lease(sp, &check_all, check_buf);
+			rv = check_our_lease(sp, &check_all, check_buf, &check_read, &deadline);
 			if (rv)
 				sp->renew_fail = 1;
 
@@ -850,13 +1121,29 @@ static int main_loop(void)
 				sp->space_dead = 1;
 				sp->killing_pids = 1;
 				kill_pids(sp);
-				check_interval = RECOVERY_CHECK_INTERVAL;
 
-			} else if (check_all) {
-				check_other_leases(sp, check_buf);
+				/* with no pids to wait for, the thread can be
+				   stopped now, e.g. for each lockspace in a
+				   shutdown, instead of at the next check */
+				if (all_pids_dead(sp)) {
+					stop_space(sp);
+					continue;
+				}
+				sp->check_time = now + RECOVERY_CHECK_INTERVAL;
+
+			} else {
+				if (check_all)
+					check_other_leases(sp, check_buf, &check_read);
+				sp->check_time = deadline * 1000;
+
+				deadline = check_host_states(sp);
+				if (deadline)
+					set_deadline(&sp->check_time, deadline * 1000);
 			}
+			set_deadline(&next, sp->check_time);
 		}
 		empty = list_empty(&spaces);
+		busy = !list_empty(&spaces_rem);
 		pthread_mutex_unlock(&spaces_mutex);
 
 		if (external_shutdown && empty)
@@ -868,12 +1155,19 @@ static int main_loop(void)
 		}
 
 		free_lockspaces(0);
-		rem_resources();
-
-		gettimeofday(&now, NULL);
-		ms = time_diff(&last_check, &now);
-		if (ms < check_interval)
-			poll_timeout = check_interval - ms;
+		if (rem_resources())
+			busy = 1;
+		fd_cache_prune();
+
+		/* lockspaces being freed and resources being released are
+		   retried at the standard interval */
+		if (busy)
+			set_deadline(&next, now + STANDARD_CHECK_INTERVAL);
+
+		next_check = next;
+		now = monotime_ms();
+		if (now < next_check)
+			poll_timeout = next_check - now;
 		else
 			poll_timeout = 1;
 	}
@@ -885,6 +1179,162 @@ static int main_loop(void)
 	return 0;
 }
 
+static int work_queue_depth(struct work_queue *wq)
+{
+	unsigned int push_pos, pop_pos;
+	int n;
+
+	pop_pos = __atomic_load_n(&wq->pop_pos, __ATOMIC_RELAXED);
+	push_pos = __atomic_load_n(&wq->push_pos, __ATOMIC_RELAXED);
+	n = (int)(push_pos - pop_pos);
+	return (n > 0) ? n : 0;
+}
+
+void thread_pool_metrics(int *workers, int *free_workers, int *queued, uint64_t *busy);
+void thread_pool_metrics(int *workers, int *free_workers, int *queued, uint64_t *busy)
+{
+	int c;
+
+	pthread_mutex_lock(&pool.mutex);
+	*workers = pool.num_workers;
+	pthread_mutex_unlock(&pool.mutex);
+
+	*free_workers = __atomic_load_n(&pool.free_workers, __ATOMIC_RELAXED);
+	if (*free_workers < 0)
+		*free_workers = 0;
+	*busy = __atomic_load_n(&pool.work_busy, __ATOMIC_RELAXED);
+
+	*queued = 0;
+	for (c = 0; c < WORK_CLASSES; c++)
+		*queued += work_queue_depth(&pool.work_data[c]);
+}
+
+static int work_queue_init(struct work_queue *wq, unsigned int size)
+{
+	unsigned int i;
+
+	memset(wq, 0, sizeof(struct work_queue));
+
+	wq->cells = malloc(size * sizeof(struct work_cell));
+	if (!wq->cells)
+		return -ENOMEM;
+
+	for (i = 0; i < size; i++) {
+		wq->cells[i].seq = i;
+		wq->cells[i].data = NULL;
+	}
+	wq->mask = size - 1;
+	return 0;
+}
+
+static int work_queue_push(struct work_queue *wq, void *data)
+{
+	struct work_cell *cell;
+	unsigned int pos, seq;
+	int dif;
+
+	pos = __atomic_load_n(&wq->push_pos, __ATOMIC_RELAXED);
+
+	while (1) {
+		cell = &wq->cells[pos & wq->mask];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		dif = (int)(seq - pos);
+
+		if (!dif) {
+			if (__atomic_compare_exchange_n(&wq->push_pos, &pos, pos + 1, 1,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			/* full */
+			return -EAGAIN;
+		} else {
+			pos = __atomic_load_n(&wq->push_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	cell->data = data;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static void *work_queue_pop(struct work_queue *wq)
+{
+	struct work_cell *cell;
+	unsigned int pos, seq;
+	void *data;
+	int dif;
+
+	pos = __atomic_load_n(&wq->pop_pos, __ATOMIC_RELAXED);
+
+	while (1) {
+		cell = &wq->cells[pos & wq->mask];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		dif = (int)(seq - (pos + 1));
+
+		if (!dif) {
+			if (__atomic_compare_exchange_n(&wq->pop_pos, &pos, pos + 1, 1,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			/* empty */
+			return NULL;
+		} else {
+			pos = __atomic_load_n(&wq->pop_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	data = cell->data;
+	__atomic_store_n(&cell->seq, pos + wq->mask + 1, __ATOMIC_RELEASE);
+	return data;
+}
+
+/*
+ * cmd_args are recycled through the free_args queue instead of being
+ * malloc'ed by the main thread and freed by the workers for each cmd.
+ */
+
+static struct cmd_args *get_cmd_args(void)
+{
+	struct cmd_args *ca;
+
+	ca = work_queue_pop(&pool.free_args);
+	if (!ca)
+		ca = malloc(sizeof(struct cmd_args));
+	return ca;
+}
+
+static void put_cmd_args(struct cmd_args *ca)
+{
+	if (ca >= pool.args && ca < pool.args + WORK_QUEUE_SIZE) {
+		if (!work_queue_push(&pool.free_args, ca))
+			return;
+	}
+	free(ca);
+}
+
+static struct cmd_args *thread_pool_get_work(void)
+{
+	struct cmd_args *ca;
+	unsigned int seq;
+	int first, c;
+
+	seq = __atomic_fetch_add(&pool.work_seq, 1, __ATOMIC_RELAXED);
+	first = work_schedule[seq % WORK_SCHEDULE_LEN];
+
+	ca = work_queue_pop(&pool.work_data[first]);
+	if (ca)
+		return ca;
+
+	for (c = 0; c < WORK_CLASSES; c++) {
+		if (c == first)
+			continue;
+		ca = work_queue_pop(&pool.work_data[c]);
+		if (ca)
+			return ca;
+	}
+	return NULL;
+}
+
 static void *thread_pool_worker(void *data)
 {
 	struct task task;
@@ -894,30 +1344,27 @@ static void *thread_pool_worker(void *data)
 	setup_task_aio(&task, main_task.use_aio, WORKER_AIO_CB_SIZE);
 	snprintf(task.name, NAME_ID_SIZE, "worker%ld", (long)data);
 
-	pthread_mutex_lock(&pool.mutex);
+	thread_class_setup(THREAD_CLASS_WORKER);
 
 	while (1) {
-		while (!pool.quit && list_empty(&pool.work_data)) {
-			pool.free_workers++;
-			pthread_cond_wait(&pool.cond, &pool.mutex);
-			pool.free_workers--;
-		}
-
-		while (!list_empty(&pool.work_data)) {
-			ca = list_first_entry(&pool.work_data, struct cmd_args, list);
-			list_del(&ca->list);
-			pthread_mutex_unlock(&pool.mutex);
+		/* thread_pool_add_work takes this back when it wakes a worker */
+		__atomic_add_fetch(&pool.free_workers, 1, __ATOMIC_SEQ_CST);
+		while (sem_wait(&pool.work_sem) < 0 && errno == EINTR)
+			;
 
+		while ((ca = thread_pool_get_work())) {
+			thread_class_wake(THREAD_CLASS_WORKER, ca->queued, trace_begin());
 			call_cmd_thread(&task, ca);
-			free(ca);
-
-			pthread_mutex_lock(&pool.mutex);
+			put_cmd_args(ca);
 		}
 
-		if (pool.quit)
+		reap_detached_aio(&task, DEFAULT_IO_TIMEOUT);
+
+		if (__atomic_load_n(&pool.quit, __ATOMIC_SEQ_CST))
 			break;
 	}
 
+	pthread_mutex_lock(&pool.mutex);
 	pool.num_workers--;
 	if (!pool.num_workers)
 		pthread_cond_signal(&pool.quit_wait);
@@ -927,41 +1374,128 @@ static void *thread_pool_worker(void *data)
 	return NULL;
 }
 
+/*
+ * A cmd on one lockspace can block a worker for a long time on slow disk
+ * i/o, so allow more workers than max_worker_threads when there are many
+ * lockspaces, so cmds on unrelated lockspaces are not stuck behind it.
+ */
+
+static int thread_pool_max_workers(void)
+{
+	struct space *sp;
+	int count = 0;
+	int max;
+
+	pthread_mutex_lock(&spaces_mutex);
+	list_for_each_entry(sp, &spaces, list)
+		count++;
+	pthread_mutex_unlock(&spaces_mutex);
+
+	max = count * WORKER_THREADS_PER_LOCKSPACE;
+	if (max > MAX_WORKER_THREADS)
+		max = MAX_WORKER_THREADS;
+	if (max < pool.max_workers)
+		max = pool.max_workers;
+	return max;
+}
+
+static int work_pipeline_max(int class)
+{
+	if (class == WORK_QUERY)
+		return WORK_QUERY_SIZE / 2;
+	return WORK_QUEUE_SIZE - CLIENT_NALLOC;
+}
+
+static int work_class(int cmd)
+{
+	switch (cmd) {
+	case SM_CMD_ACQUIRE:
+	case SM_CMD_RELEASE:
+	case SM_CMD_INQUIRE:
+	case SM_CMD_CONVERT:
+	case SM_CMD_ADD_LOCKSPACE:
+	case SM_CMD_INQ_LOCKSPACE:
+	case SM_CMD_REM_LOCKSPACE:
+	case SM_CMD_ADD_LOCKSPACES:
+	case SM_CMD_REM_LOCKSPACES:
+		return WORK_LEASE;
+	case SM_CMD_EXAMINE_RESOURCE:
+	case SM_CMD_EXAMINE_LOCKSPACE:
+	case SM_CMD_ALIGN:
+	case SM_CMD_NEXT_FREE:
+	case SM_CMD_READ_LOCKSPACE:
+	case SM_CMD_READ_RESOURCE:
+	case SM_CMD_READ_RESOURCE_OWNERS:
+	case SM_CMD_GET_LVB:
+	case SM_CMD_LOOKUP_RINDEX:
+		return WORK_QUERY;
+	default:
+		return WORK_NORMAL;
+	}
+}
+
+/* only called by the main thread */
+
 static int thread_pool_add_work(struct cmd_args *ca)
 {
 	pthread_t th;
+	int class;
 	int rv;
 
-	pthread_mutex_lock(&pool.mutex);
-	if (pool.quit) {
-		pthread_mutex_unlock(&pool.mutex);
+	if (__atomic_load_n(&pool.quit, __ATOMIC_SEQ_CST))
 		return -1;
+
+	ca->queued = trace_begin();
+
+	class = work_class(ca->header.cmd);
+
+	if (ca->pipeline &&
+	    work_queue_depth(&pool.work_data[class]) >= work_pipeline_max(class)) {
+		__atomic_add_fetch(&pool.work_busy, 1, __ATOMIC_RELAXED);
+		return -EBUSY;
 	}
 
-	list_add_tail(&ca->list, &pool.work_data);
+	rv = work_queue_push(&pool.work_data[class], ca);
+	if (rv < 0) {
+		__atomic_add_fetch(&pool.work_busy, 1, __ATOMIC_RELAXED);
+		return -EBUSY;
+	}
 
-	if (!pool.free_workers && pool.num_workers < pool.max_workers) {
+	/*
+	 * Claim a waiting worker for this cmd.  The claim is made here rather
+	 * than when the worker runs, so a burst of cmds does not count on
+	 * workers already woken for earlier ones.  Below zero, no worker is
+	 * left for this cmd.
+	 */
+	if (__atomic_sub_fetch(&pool.free_workers, 1, __ATOMIC_SEQ_CST) < 0 &&
+	    ((pool.num_workers < pool.max_workers) ||
+	     (pool.num_workers < thread_pool_max_workers()))) {
+		pthread_mutex_lock(&pool.mutex);
 		rv = pthread_create(&th, NULL, thread_pool_worker,
 				    (void *)(long)pool.num_workers);
-		if (rv < 0) {
-			list_del(&ca->list);
-			pthread_mutex_unlock(&pool.mutex);
-			return rv;
-		}
-		pool.num_workers++;
+		if (!rv)
+			pool.num_workers++;
+		pthread_mutex_unlock(&pool.mutex);
+
+		/* existing workers will get to it */
+		if (rv)
+			log_error("thread_pool_add_work create error %d workers %d",
+				  rv, pool.num_workers);
 	}
 
-	pthread_cond_signal(&pool.cond);
-	pthread_mutex_unlock(&pool.mutex);
+	sem_post(&pool.work_sem);
 	return 0;
 }
 
 static void thread_pool_free(void)
 {
+	int i;
+
 	pthread_mutex_lock(&pool.mutex);
-	pool.quit = 1;
+	__atomic_store_n(&pool.quit, 1, __ATOMIC_SEQ_CST);
 	if (pool.num_workers > 0) {
-		pthread_cond_broadcast(&pool.cond);
+		for (i = 0; i < pool.num_workers; i++)
+			sem_post(&pool.work_sem);
 		pthread_cond_wait(&pool.quit_wait, &pool.mutex);
 	}
 	pthread_mutex_unlock(&pool.mutex);
@@ -970,21 +1504,37 @@ static void thread_pool_free(void)
 static int thread_pool_create(int min_workers, int max_workers)
 {
 	pthread_t th;
-	int i, rv;
+	int i, rv = 0;
 
 	memset(&pool, 0, sizeof(pool));
-	INIT_LIST_HEAD(&pool.work_data);
 	pthread_mutex_init(&pool.mutex, NULL);
-	pthread_cond_init(&pool.cond, NULL);
 	pthread_cond_init(&pool.quit_wait, NULL);
+	sem_init(&pool.work_sem, 0, 0);
 	pool.max_workers = max_workers;
 
+	pool.args = malloc(WORK_QUEUE_SIZE * sizeof(struct cmd_args));
+	if (!pool.args)
+		return -ENOMEM;
+
+	if (work_queue_init(&pool.work_data[WORK_LEASE], WORK_QUEUE_SIZE) < 0 ||
+	    work_queue_init(&pool.work_data[WORK_NORMAL], WORK_QUEUE_SIZE) < 0 ||
+	    work_queue_init(&pool.work_data[WORK_QUERY], WORK_QUERY_SIZE) < 0 ||
+	    work_queue_init(&pool.free_args, WORK_QUEUE_SIZE) < 0)
+		return -ENOMEM;
+
+	for (i = 0; i < WORK_QUEUE_SIZE; i++)
+		work_queue_push(&pool.free_args, &pool.args[i]);
+
 	for (i = 0; i < min_workers; i++) {
 		rv = pthread_create(&th, NULL, thread_pool_worker,
 				    (void *)(long)i);
-		if (rv < 0)
+		if (rv) {
+			rv = -rv;
 			break;
+		}
+		pthread_mutex_lock(&pool.mutex);
 		pool.num_workers++;
+		pthread_mutex_unlock(&pool.mutex);
 	}
 
 	if (rv < 0)
@@ -1000,18 +1550,31 @@ static int thread_pool_create(int min_workers, int max_workers)
  * client or the tokens held by a specific client.
  */
 
-static void process_cmd_thread_unregistered(int ci_in, struct sm_header *h_recv)
+static void init_cmd_args(struct cmd_args *ca, int ci_in, char *body, int body_len)
+{
+	ca->pipeline = client[ci_in].pipeline;
+	ca->body = body;
+	ca->body_len = body_len;
+	ca->body_pos = 0;
+	ca->reply = NULL;
+	ca->reply_len = 0;
+	ca->reply_size = 0;
+}
+
+static void process_cmd_thread_unregistered(int ci_in, struct sm_header *h_recv,
+					    char *body, int body_len)
 {
 	struct cmd_args *ca;
 	int rv;
 
-	ca = malloc(sizeof(struct cmd_args));
+	ca = get_cmd_args();
 	if (!ca) {
 		rv = -ENOMEM;
 		goto fail;
 	}
 	ca->ci_in = ci_in;
 	memcpy(&ca->header, h_recv, sizeof(struct sm_header));
+	init_cmd_args(ca, ci_in, body, body_len);
 
 	snprintf(client[ci_in].owner_name, SANLK_NAME_LEN, "cmd%d", h_recv->cmd);
 
@@ -1021,8 +1584,12 @@ static void process_cmd_thread_unregistered(int ci_in, struct sm_header *h_recv)
 	return;
 
  fail_free:
-	free(ca);
+	put_cmd_args(ca);
  fail:
+	if (client[ci_in].pipeline) {
+		pipeline_fail(ci_in, h_recv, body, rv);
+		return;
+	}
 	send_result(client[ci_in].fd, h_recv, rv);
 	close(client[ci_in].fd);
 }
@@ -1037,14 +1604,15 @@ static void process_cmd_thread_unregistered(int ci_in, struct sm_header *h_recv)
  * processing and handle the cleanup of the client if so.
  */
 
-static void process_cmd_thread_registered(int ci_in, struct sm_header *h_recv)
+static void process_cmd_thread_registered(int ci_in, struct sm_header *h_recv,
+					  char *body, int body_len)
 {
 	struct cmd_args *ca;
 	struct client *cl;
 	int result = 0;
 	int rv, i, ci_target;
 
-	ca = malloc(sizeof(struct cmd_args));
+	ca = get_cmd_args();
 	if (!ca) {
 		result = -ENOMEM;
 		goto fail;
@@ -1147,6 +1715,7 @@ static void process_cmd_thread_registered(int ci_in, struct sm_header *h_recv)
 	ca->cl_pid = cl->pid;
 	ca->cl_fd = cl->fd;
 	memcpy(&ca->header, h_recv, sizeof(struct sm_header));
+	init_cmd_args(ca, ci_in, body, body_len);
 
 	rv = thread_pool_add_work(ca);
 	if (rv < 0) {
@@ -1155,7 +1724,8 @@ static void process_cmd_thread_registered(int ci_in, struct sm_header *h_recv)
 		   because client_pid_dead is called from the main thread which
 		   is running this function */
 
-		log_error("create cmd thread failed");
+		log_error("cmd %d %d,%d,%d add work error %d",
+			  h_recv->cmd, ci_target, cl->fd, cl->pid, rv);
 		pthread_mutex_lock(&cl->mutex);
 		cl->cmd_active = 0;
 		pthread_mutex_unlock(&cl->mutex);
@@ -1165,12 +1735,116 @@ static void process_cmd_thread_registered(int ci_in, struct sm_header *h_recv)
 	return;
 
  fail:
+	if (ca)
+		put_cmd_args(ca);
+
+	if (client[ci_in].pipeline) {
+		pipeline_fail(ci_in, h_recv, body, result);
+		return;
+	}
+
 	client_recv_all(ci_in, h_recv, 0);
 	send_result(client[ci_in].fd, h_recv, result);
 	client_resume(ci_in);
+}
 
-	if (ca)
-		free(ca);
+/*
+ * On a pipelined connection, main_loop reads each request whole and goes
+ * back to watching the connection while the cmd runs in the thread pool,
+ * so the requests that follow are started without waiting for it.  The
+ * cmds that main_loop runs itself, or that are tied to the connection,
+ * are not used on a pipelined connection.
+ */
+
+static void process_pipeline(int ci, struct sm_header *h)
+{
+	void (*deadfn)(int ci);
+	char *body = NULL;
+	int body_len = 0;
+	int inflight;
+	int rv;
+
+	if (h->length < sizeof(struct sm_header) ||
+	    h->length - sizeof(struct sm_header) > MAX_CLIENT_MSG) {
+		log_error("ci %d pipeline cmd %d length %u", ci, h->cmd, h->length);
+		goto dead;
+	}
+
+	body_len = h->length - sizeof(struct sm_header);
+
+	if (body_len) {
+		body = malloc(body_len);
+		if (!body) {
+			log_error("ci %d pipeline cmd %d length %u no mem", ci, h->cmd, h->length);
+			goto dead;
+		}
+
+		rv = recv(client[ci].fd, body, body_len, MSG_WAITALL);
+		if (rv != body_len) {
+			log_error("ci %d pipeline cmd %d recv %d errno %d", ci, h->cmd, rv, errno);
+			free(body);
+			goto dead;
+		}
+	}
+
+	pthread_mutex_lock(&client[ci].mutex);
+	inflight = ++client[ci].inflight;
+	pthread_mutex_unlock(&client[ci].mutex);
+
+	if (com.pipeline_queue_max && inflight > com.pipeline_queue_max) {
+		log_debug("ci %d pipeline cmd %d busy inflight %d", ci, h->cmd, inflight);
+		__atomic_add_fetch(&pool.work_busy, 1, __ATOMIC_RELAXED);
+		pipeline_fail(ci, h, body, -EBUSY);
+		return;
+	}
+
+	switch (h->cmd) {
+	case SM_CMD_ADD_LOCKSPACE:
+	case SM_CMD_INQ_LOCKSPACE:
+	case SM_CMD_REM_LOCKSPACE:
+	case SM_CMD_REQUEST:
+	case SM_CMD_EXAMINE_RESOURCE:
+	case SM_CMD_EXAMINE_LOCKSPACE:
+	case SM_CMD_ALIGN:
+	case SM_CMD_NEXT_FREE:
+	case SM_CMD_WRITE_LOCKSPACE:
+	case SM_CMD_WRITE_RESOURCE:
+	case SM_CMD_READ_LOCKSPACE:
+	case SM_CMD_READ_RESOURCE:
+	case SM_CMD_READ_RESOURCE_OWNERS:
+	case SM_CMD_SET_LVB:
+	case SM_CMD_GET_LVB:
+	case SM_CMD_SET_EVENT:
+	case SM_CMD_FORMAT_RINDEX:
+	case SM_CMD_REBUILD_RINDEX:
+	case SM_CMD_UPDATE_RINDEX:
+	case SM_CMD_LOOKUP_RINDEX:
+	case SM_CMD_CREATE_RESOURCE:
+	case SM_CMD_DELETE_RESOURCE:
+	case SM_CMD_CREATE_RESOURCES:
+	case SM_CMD_DELETE_RESOURCES:
+	case SM_CMD_ADD_LOCKSPACES:
+	case SM_CMD_REM_LOCKSPACES:
+		process_cmd_thread_unregistered(ci, h, body, body_len);
+		break;
+	case SM_CMD_ACQUIRE:
+	case SM_CMD_RELEASE:
+	case SM_CMD_INQUIRE:
+	case SM_CMD_CONVERT:
+		/* for other registered pids, this connection is not registered */
+		process_cmd_thread_registered(ci, h, body, body_len);
+		break;
+	default:
+		log_error("ci %d pipeline cmd %d not allowed", ci, h->cmd);
+		pipeline_fail(ci, h, body, -EINVAL);
+	};
+
+	return;
+
+ dead:
+	deadfn = client[ci].deadfn;
+	if (deadfn)
+		deadfn(ci);
 }
 
 static void process_connection(int ci)
@@ -1213,6 +1887,11 @@ static void process_connection(int ci)
 
 	client[ci].cmd_last = h.cmd;
 
+	if (client[ci].pipeline) {
+		process_pipeline(ci, &h);
+		return;
+	}
+
 	switch (h.cmd) {
 	case SM_CMD_REGISTER:
 	case SM_CMD_RESTRICT:
@@ -1222,8 +1901,12 @@ static void process_connection(int ci)
 	case SM_CMD_HOST_STATUS:
 	case SM_CMD_RENEWAL:
 	case SM_CMD_LOG_DUMP:
+	case SM_CMD_TRACE:
+	case SM_CMD_GET_STATS:
+	case SM_CMD_PIPELINE:
 	case SM_CMD_GET_LOCKSPACES:
 	case SM_CMD_GET_HOSTS:
+	case SM_CMD_GET_HOSTS_CHANGED:
 	case SM_CMD_REG_EVENT:
 	case SM_CMD_END_EVENT:
 	case SM_CMD_SET_CONFIG:
@@ -1236,6 +1919,7 @@ static void process_connection(int ci)
 	case SM_CMD_EXAMINE_RESOURCE:
 	case SM_CMD_EXAMINE_LOCKSPACE:
 	case SM_CMD_ALIGN:
+	case SM_CMD_NEXT_FREE:
 	case SM_CMD_WRITE_LOCKSPACE:
 	case SM_CMD_WRITE_RESOURCE:
 	case SM_CMD_READ_LOCKSPACE:
@@ -1251,10 +1935,14 @@ static void process_connection(int ci)
 	case SM_CMD_LOOKUP_RINDEX:
 	case SM_CMD_CREATE_RESOURCE:
 	case SM_CMD_DELETE_RESOURCE:
+	case SM_CMD_CREATE_RESOURCES:
+	case SM_CMD_DELETE_RESOURCES:
+	case SM_CMD_ADD_LOCKSPACES:
+	case SM_CMD_REM_LOCKSPACES:
 		rv = client_suspend(ci);
 		if (rv < 0)
 			return;
-		process_cmd_thread_unregistered(ci, &h);
+		process_cmd_thread_unregistered(ci, &h, NULL, 0);
 		break;
 	case SM_CMD_ACQUIRE:
 	case SM_CMD_RELEASE:
@@ -1266,7 +1954,7 @@ static void process_connection(int ci)
 		rv = client_suspend(ci);
 		if (rv < 0)
 			return;
-		process_cmd_thread_registered(ci, &h);
+		process_cmd_thread_registered(ci, &h, NULL, 0);
 		break;
 	default:
 		log_error("ci %d cmd %d unknown", ci, h.cmd);
@@ -1346,6 +2034,7 @@ static void sigterm_handler(int sig GNUC_UNUSED,
 			    void *ctx GNUC_UNUSED)
 {
 	external_shutdown = 1;
+	main_loop_wake();
 }
 
 static void setup_priority(void)
@@ -1575,27 +2264,61 @@ static int setup_helper(void)
 	}
 }
 
+/*
+ * The helper could not start the killpath for a client, so kill_pids
+ * uses SIGTERM for it instead of waiting for kill_grace_seconds.
+ */
+
+static void helper_runpath_failed(int pid, int result)
+{
+	struct client *cl;
+	int ci;
+
+	for (ci = 0; ci <= client_maxi; ci++) {
+		cl = &client[ci];
+		pthread_mutex_lock(&cl->mutex);
+		if (cl->used && cl->pid == pid) {
+			log_error("killpath %s for pid %d failed %d",
+				  cl->killpath, pid, result);
+			cl->flags |= CL_RUNPATH_FAILED;
+			cl->kill_last = 0;
+		}
+		pthread_mutex_unlock(&cl->mutex);
+	}
+}
+
 static void process_helper(int ci)
 {
-	struct helper_status hs;
-	int rv;
+	struct helper_status hs[HELPER_MSG_BATCH];
+	int rv, i, count;
 
-	memset(&hs, 0, sizeof(hs));
+	memset(hs, 0, sizeof(hs));
 
-	rv = read(client[ci].fd, &hs, sizeof(hs));
+	rv = read(client[ci].fd, hs, sizeof(hs));
 	if (!rv || rv == -EAGAIN)
 		return;
 	if (rv < 0) {
 		log_error("process_helper rv %d errno %d", rv, errno);
 		goto fail;
 	}
-	if (rv != sizeof(hs)) {
+	if (rv % sizeof(struct helper_status)) {
 		log_error("process_helper recv size %d", rv);
 		goto fail;
 	}
 
-	if (hs.type == HELPER_STATUS && !hs.status)
-		helper_last_status = monotime();
+	count = rv / sizeof(struct helper_status);
+
+	for (i = 0; i < count; i++) {
+		if (hs[i].type == HELPER_STATUS && !hs[i].status)
+			helper_last_status = monotime();
+
+		if (hs[i].type == HELPER_STATUS_RUNPATH) {
+			if (hs[i].result < 0)
+				helper_runpath_failed(hs[i].pid, hs[i].result);
+			else
+				log_debug("killpath started for pid %d", hs[i].pid);
+		}
+	}
 
 	return;
 
@@ -1673,6 +2396,10 @@ static int do_daemon(void)
 		return rv;
 	strcpy(client[helper_ci].owner_name, "helper");
 
+	rv = setup_wake();
+	if (rv < 0)
+		return rv;
+
 	setup_signals();
 	setup_logging();
 
@@ -1698,9 +2425,17 @@ static int do_daemon(void)
 	setup_uid_gid();
 
 	log_warn("sanlock daemon started %s host %s", VERSION, our_host_name_global);
+	log_debug("crc32c %s", crc32c_name());
 
 	setup_priority();
 
+	/* after setup_priority, which sets the default for thread classes */
+	setup_thread_classes();
+	set_log_thread_class();
+
+	/* before any disk is opened, so every disk is in the capture */
+	setup_capture();
+
 	rv = thread_pool_create(DEFAULT_MIN_WORKER_THREADS, com.max_worker_threads);
 	if (rv < 0)
 		goto out;
@@ -1709,23 +2444,32 @@ static int do_daemon(void)
 	if (rv < 0)
 		goto out_threads;
 
+	setup_metrics(run_dir);
+
 	setup_token_manager();
 	if (rv < 0)
 		goto out_threads;
 
-	/* initialize global eventfd for client_resume notification */
-	if ((efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1) {
-		log_error("couldn't create eventfd");
-		goto out_threads;
-	}
+	/* after setup_token_manager, the snapshot walks the resource lists */
+	setup_snapshot(run_dir);
+
+	setup_host_state(run_dir);
+
+	add_config_lockspaces();
 
 	main_loop();
 
+	close_snapshot();
+
+	close_metrics();
+
 	close_token_manager();
 
  out_threads:
 	thread_pool_free();
  out:
+	close_capture();
+
 	/* order reversed from setup so lockfile is last */
 	close_logging();
 	close(fd);
@@ -1788,9 +2532,36 @@ static int parse_arg_rentry(char *str)
 		com.rentry.offset = offnum;
 	}
 
-	if (name)
-		strncpy(com.rentry.name, name, SANLK_NAME_LEN);
+	if (name)
+		strncpy(com.rentry.name, name, SANLK_NAME_LEN);
+
+	return 0;
+}
+
+/*
+ * -e can be repeated for create and delete, which are then done as one
+ * batch.  com.rentry is the last one, and rentries has all of them.
+ */
+
+static int add_arg_rentry(char *str)
+{
+	struct sanlk_rentry *rentries;
+
+	if (com.rentry_count >= RINDEX_MAX_BATCH)
+		return -EINVAL;
+
+	if (com.rentry_count)
+		memset(&com.rentry, 0, sizeof(com.rentry));
+
+	parse_arg_rentry(str);
+
+	rentries = realloc(com.rentries, (com.rentry_count + 1) * sizeof(struct sanlk_rentry));
+	if (!rentries)
+		return -ENOMEM;
 
+	memcpy(&rentries[com.rentry_count], &com.rentry, sizeof(struct sanlk_rentry));
+	com.rentries = rentries;
+	com.rentry_count++;
 	return 0;
 }
 
@@ -1851,6 +2622,26 @@ static int parse_arg_rindex(char *str)
 	return 0;
 }
 
+/*
+ * Find the next ':' separating fields of a lockspace or resource arg,
+ * skipping colons escaped with a backslash in a path, e.g. "sim\:<file>".
+ */
+
+static char *find_arg_colon(char *str)
+{
+	for (; *str; str++) {
+		if (*str == '\\') {
+			if (!*(str + 1))
+				break;
+			str++;
+			continue;
+		}
+		if (*str == ':')
+			return str;
+	}
+	return NULL;
+}
+
 /* <lockspace_name>:<host_id>:<path>:<offset> */
 
 static int parse_arg_lockspace(char *arg)
@@ -1867,9 +2658,9 @@ static int parse_arg_lockspace(char *arg)
 	 * If the arg string uses an offset with the 'M' suffix, then
 	 * convert it to a string without 'M'.
 	 */
-	if ((colon1 = strchr(arg, ':'))) {
-		if ((colon2 = strchr(colon1+1, ':'))) {
-			if ((colon3 = strchr(colon2+1, ':'))) {
+	if ((colon1 = find_arg_colon(arg))) {
+		if ((colon2 = find_arg_colon(colon1+1))) {
+			if ((colon3 = find_arg_colon(colon2+1))) {
 
 				if ((m = strchr(colon3+1, 'M'))) {
 					p = colon3+1;
@@ -1911,6 +2702,34 @@ static int parse_arg_lockspace(char *arg)
 	return 0;
 }
 
+/*
+ * -s can be repeated for add_lockspace and rem_lockspace, which are then
+ * done as one batch.  com.lockspace is the last one, and lockspaces has
+ * all of them.
+ */
+
+static int add_arg_lockspace(char *str)
+{
+	struct sanlk_lockspace *lockspaces;
+
+	if (com.lockspace_count >= LOCKSPACE_MAX_BATCH)
+		return -EINVAL;
+
+	if (com.lockspace_count)
+		memset(&com.lockspace, 0, sizeof(com.lockspace));
+
+	parse_arg_lockspace(str);
+
+	lockspaces = realloc(com.lockspaces, (com.lockspace_count + 1) * sizeof(struct sanlk_lockspace));
+	if (!lockspaces)
+		return -ENOMEM;
+
+	memcpy(&lockspaces[com.lockspace_count], &com.lockspace, sizeof(struct sanlk_lockspace));
+	com.lockspaces = lockspaces;
+	com.lockspace_count++;
+	return 0;
+}
+
 /* <lockspace_name>:<resource_name>:<path>:<offset>[:<lver>] */
 
 static int parse_arg_resource(char *arg)
@@ -1924,8 +2743,8 @@ static int parse_arg_resource(char *arg)
 	int len2 = 0;
 	int rv, i;
 
-	if (com.res_count >= SANLK_MAX_RESOURCES) {
-		log_tool("resource args over max %d", SANLK_MAX_RESOURCES);
+	if (com.res_count >= SANLK_MAX_ACQUIRE_RESOURCES) {
+		log_tool("resource args over max %d", SANLK_MAX_ACQUIRE_RESOURCES);
 		return -1;
 	}
 
@@ -1935,10 +2754,10 @@ static int parse_arg_resource(char *arg)
 	 * If the arg string uses an offset with the 'M' suffix, then
 	 * convert it to a string without 'M'.
 	 */
-	if ((colon1 = strchr(arg, ':'))) {
-		if ((colon2 = strchr(colon1+1, ':'))) {
-			if ((colon3 = strchr(colon2+1, ':'))) {
-				colon4 = strchr(colon3+1, ':'); /* optional */
+	if ((colon1 = find_arg_colon(arg))) {
+		if ((colon2 = find_arg_colon(colon1+1))) {
+			if ((colon3 = find_arg_colon(colon2+1))) {
+				colon4 = find_arg_colon(colon3+1); /* optional */
 
 				if ((m = strchr(colon3+1, 'M'))) {
 					p = colon3+1;
@@ -2043,6 +2862,9 @@ static void print_usage(void)
 	printf("sanlock client set_event -s LOCKSPACE -i <host_id> [-g gen] -e <event> -d <data>\n");
 	printf("sanlock client set_config -s LOCKSPACE [-u 0|1] [-O 0|1]\n");
 	printf("sanlock client log_dump\n");
+	printf("sanlock client trace\n");
+	printf("sanlock client stats\n");
+	printf("sanlock client state\n");
 	printf("sanlock client shutdown [-f 0|1] [-w 0|1]\n");
 	printf("sanlock client init -s LOCKSPACE | -r RESOURCE [-z 0|1] [-Z 512|4096 -A 1M|2M|4M|8M]\n");
 	printf("sanlock client read -s LOCKSPACE | -r RESOURCE [-D]\n");
@@ -2056,9 +2878,10 @@ static void print_usage(void)
 	printf("sanlock client inquire -p <pid>\n");
 	printf("sanlock client request -r RESOURCE -f <force_mode>\n");
 	printf("sanlock client examine -r RESOURCE | -s LOCKSPACE\n");
-	printf("sanlock client format -x RINDEX [-Z 512|4096 -A 1M|2M|4M|8M]\n");
-	printf("sanlock client create -x RINDEX -e <resource_name>\n");
-	printf("sanlock client delete -x RINDEX -e <resource_name>[:<offset>]\n");
+	printf("sanlock client next_free <path>[:<offset>] [-z 0|1]\n");
+	printf("sanlock client format -x RINDEX [-Z 512|4096 -A 1M|2M|4M|8M] [-X 1|2]\n");
+	printf("sanlock client create -x RINDEX -e <resource_name> [-e <resource_name> ...]\n");
+	printf("sanlock client delete -x RINDEX -e <resource_name>[:<offset>] [-e ...]\n");
 	printf("sanlock client lookup -x RINDEX [-e <resource_name>:<offset>]\n");
 	printf("sanlock client update -x RINDEX -e <resource_name>[:<offset>] [-z 0|1]\n");
 	printf("sanlock client rebuild -x RINDEX\n");
@@ -2066,11 +2889,14 @@ static void print_usage(void)
 	printf("sanlock direct <action> [-a 0|1] [-o 0|1] [-Z 512|4096 -A 1M|2M|4M|8M]\n");
 	printf("sanlock direct init -s LOCKSPACE | -r RESOURCE [-Z 512|4096 -A 1M|2M|4M|8M]\n");
 	printf("sanlock direct read_leader -s LOCKSPACE | -r RESOURCE\n");
-	printf("sanlock direct dump <path>[:<offset>[:<size>]]\n");
-	printf("sanlock direct format -x RINDEX [-Z 512|4096 -A 1M|2M|4M|8M]\n");
+	printf("sanlock direct dump <path>[:<offset>[:<size>]] [-t <num>] [-T <timestamp>] [-j 0|1]\n");
+	printf("sanlock direct next_free <path>[:<offset>] [-F <map_file>]\n");
+	printf("sanlock direct freemap <path>[:<offset>[:<size>]] [-F <map_file>]\n");
+	printf("sanlock direct format -x RINDEX [-Z 512|4096 -A 1M|2M|4M|8M] [-X 1|2]\n");
 	printf("sanlock direct lookup -x RINDEX [-e <resource_name>:<offset>]\n");
 	printf("sanlock direct update -x RINDEX -e <resource_name>[:<offset>] [-z 0|1]\n");
 	printf("sanlock direct rebuild -x RINDEX\n");
+	printf("sanlock direct convert -x RINDEX [-X 1|2]\n");
 	printf("\n");
 	printf("LOCKSPACE = <lockspace_name>:<host_id>:<path>:<offset>\n");
 	printf("  <lockspace_name>	name of lockspace\n");
@@ -2167,6 +2993,12 @@ static int read_command_line(int argc, char *argv[])
 			com.action = ACT_GETS;
 		else if (!strcmp(act, "log_dump"))
 			com.action = ACT_LOG_DUMP;
+		else if (!strcmp(act, "trace"))
+			com.action = ACT_TRACE;
+		else if (!strcmp(act, "stats"))
+			com.action = ACT_STATS;
+		else if (!strcmp(act, "state"))
+			com.action = ACT_STATE;
 		else if (!strcmp(act, "shutdown"))
 			com.action = ACT_SHUTDOWN;
 		else if (!strcmp(act, "add_lockspace"))
@@ -2191,6 +3023,8 @@ static int read_command_line(int argc, char *argv[])
 			com.action = ACT_EXAMINE;
 		else if (!strcmp(act, "align"))
 			com.action = ACT_CLIENT_ALIGN;
+		else if (!strcmp(act, "next_free"))
+			com.action = ACT_NEXT_FREE;
 		else if (!strcmp(act, "init"))
 			com.action = ACT_CLIENT_INIT;
 		else if (!strcmp(act, "write"))
@@ -2234,6 +3068,8 @@ static int read_command_line(int argc, char *argv[])
 			com.action = ACT_DUMP;
 		else if (!strcmp(act, "next_free"))
 			com.action = ACT_NEXT_FREE;
+		else if (!strcmp(act, "freemap"))
+			com.action = ACT_FREEMAP;
 		else if (!strcmp(act, "read_leader"))
 			com.action = ACT_READ_LEADER;
 		else if (!strcmp(act, "write_leader"))
@@ -2254,6 +3090,8 @@ static int read_command_line(int argc, char *argv[])
 		} else if (!strcmp(act, "rebuild")) {
 			com.action = ACT_REBUILD;
 			com.rindex_op = RX_OP_REBUILD;
+		} else if (!strcmp(act, "convert")) {
+			com.action = ACT_CONVERT_RINDEX;
 		} else if (!strcmp(act, "lookup")) {
 			com.action = ACT_LOOKUP;
 			com.rindex_op = RX_OP_LOOKUP;
@@ -2269,7 +3107,8 @@ static int read_command_line(int argc, char *argv[])
 
 
 	/* actions that have an option without dash-letter prefix */
-	if (com.action == ACT_DUMP || com.action == ACT_NEXT_FREE) {
+	if (com.action == ACT_DUMP || com.action == ACT_NEXT_FREE ||
+	    com.action == ACT_FREEMAP) {
 		if (argc < 4)
 			exit(EXIT_FAILURE);
 		optionarg = argv[i++];
@@ -2324,14 +3163,25 @@ static int read_command_line(int argc, char *argv[])
 		case 'a':
 			com.all = atoi(optionarg);
 			com.aio_arg = atoi(optionarg);
-			if (com.aio_arg && com.aio_arg != 1)
-				com.aio_arg = 1;
+			if (com.aio_arg && com.aio_arg != USE_AIO_LINUX &&
+			    com.aio_arg != USE_AIO_URING)
+				com.aio_arg = USE_AIO_LINUX;
 			break;
 		case 't':
+			if (com.action == ACT_DUMP) {
+				com.dump_threads = atoi(optionarg);
+				break;
+			}
 			com.max_worker_threads = atoi(optionarg);
 			if (com.max_worker_threads < DEFAULT_MIN_WORKER_THREADS)
 				com.max_worker_threads = DEFAULT_MIN_WORKER_THREADS;
 			break;
+		case 'T':
+			com.dump_changed_since = strtoull(optionarg, NULL, 0);
+			break;
+		case 'j':
+			com.dump_json = atoi(optionarg);
+			break;
 		case 'w':
 			com.use_watchdog = atoi(optionarg);
 			com.wait = atoi(optionarg);
@@ -2371,7 +3221,10 @@ static int read_command_line(int argc, char *argv[])
 			break;
 		case 'e':
 			if (com.rindex_op) {
-				parse_arg_rentry(optionarg);
+				if (add_arg_rentry(optionarg) < 0) {
+					log_tool("too many -e args");
+					exit(EXIT_FAILURE);
+				}
 			} else {
 				strncpy(com.our_host_name, optionarg, NAME_ID_SIZE);
 				com.he_event = strtoull(optionarg, NULL, 0);
@@ -2393,7 +3246,10 @@ static int read_command_line(int argc, char *argv[])
 			com.force_mode = strtoul(optionarg, NULL, 0);
 			break;
 		case 's':
-			parse_arg_lockspace(optionarg); /* com.lockspace */
+			if (add_arg_lockspace(optionarg) < 0) { /* com.lockspace */
+				log_tool("too many -s args");
+				exit(EXIT_FAILURE);
+			}
 			break;
 		case 'r':
 			parse_arg_resource(optionarg); /* com.res_args[] */
@@ -2443,6 +3299,10 @@ static int read_command_line(int argc, char *argv[])
 			com.sector_size = atoi(optionarg);
 			break;
 
+		case 'X':
+			com.rindex_version = atoi(optionarg);
+			break;
+
 		default:
 			log_tool("unknown option: %c", optchar);
 			exit(EXIT_FAILURE);
@@ -2510,7 +3370,7 @@ static int read_command_line(int argc, char *argv[])
 	return 0;
 }
 
-#define MAX_CONF_LINE 128
+#define MAX_CONF_LINE (SANLK_PATH_LEN + 128)
 
 static void get_val_int(char *line, int *val_out)
 {
@@ -2538,21 +3398,68 @@ static void get_val_str(char *line, char *val_out)
 	strcpy(val_out, val);
 }
 
+/* lockspace = <name>:<host_id>:<path>:<offset>[:<io_timeout>] */
+
+static void add_config_lockspace(char *str)
+{
+	struct config_lockspace *cls, *grow;
+	char *timeout = NULL;
+	int i, colons = 0;
+
+	for (i = 0; str[i]; i++) {
+		if (str[i] == '\\' && str[i+1]) {
+			i++;
+			continue;
+		}
+		if (str[i] == ':' && ++colons == 4)
+			timeout = &str[i];
+	}
+
+	if (timeout) {
+		*timeout = '\0';
+		timeout++;
+	}
+
+	grow = realloc(com.config_lockspaces,
+		       (com.config_lockspaces_count + 1) * sizeof(struct config_lockspace));
+	if (!grow) {
+		log_error("config lockspace no mem");
+		return;
+	}
+	com.config_lockspaces = grow;
+
+	cls = &com.config_lockspaces[com.config_lockspaces_count];
+	memset(cls, 0, sizeof(struct config_lockspace));
+	sanlock_str_to_lockspace(str, &cls->ls);
+	if (timeout)
+		cls->io_timeout = atoi(timeout);
+
+	if (!cls->ls.name[0] || !cls->ls.host_id || !cls->ls.host_id_disk.path[0]) {
+		log_error("ignore invalid config lockspace %.48s", cls->ls.name);
+		return;
+	}
+
+	com.config_lockspaces_count++;
+}
+
 static void read_config_file(void)
 {
 	FILE *file;
 	struct stat buf;
 	char line[MAX_CONF_LINE];
 	char str[MAX_CONF_LINE];
+	const char *conf_path;
 	int i, val;
 
-	if (stat(SANLK_CONF_PATH, &buf) < 0) {
+	conf_path = env_get(SANLOCK_CONF, SANLK_CONF_PATH);
+
+	if (stat(conf_path, &buf) < 0) {
 		if (errno != ENOENT)
-			log_error("%s stat failed: %d", SANLK_CONF_PATH, errno);
+			log_error("%s stat failed: %d", conf_path, errno);
 		return;
 	}
 
-	file = fopen(SANLK_CONF_PATH, "r");
+	file = fopen(conf_path, "r");
 	if (!file)
 		return;
 
@@ -2588,6 +3495,8 @@ static void read_config_file(void)
 
 		} else if (!strcmp(str, "use_aio")) {
 			get_val_int(line, &val);
+			if (val && val != USE_AIO_LINUX && val != USE_AIO_URING)
+				val = USE_AIO_LINUX;
 			com.aio_arg = val;
 
 		} else if (!strcmp(str, "logfile_priority")) {
@@ -2598,6 +3507,23 @@ static void read_config_file(void)
 			get_val_int(line, &val);
 			log_logfile_use_utc = val;
 
+		} else if (!strcmp(str, "log_ring_entries")) {
+			get_val_int(line, &val);
+			if (val < MIN_LOG_RING_ENTRIES)
+				val = MIN_LOG_RING_ENTRIES;
+			if (val > MAX_LOG_RING_ENTRIES)
+				val = MAX_LOG_RING_ENTRIES;
+			/* round up to a power of 2 */
+			log_ring_entries = MIN_LOG_RING_ENTRIES;
+			while (log_ring_entries < val)
+				log_ring_entries *= 2;
+
+		} else if (!strcmp(str, "logfile_sync_seconds")) {
+			get_val_int(line, &val);
+			if (val < 0)
+				val = 0;
+			log_logfile_sync_seconds = val;
+
 		} else if (!strcmp(str, "syslog_priority")) {
 			get_val_int(line, &val);
 			log_syslog_priority = val;
@@ -2610,6 +3536,14 @@ static void read_config_file(void)
 			get_val_int(line, &val);
 			com.use_watchdog = val;
 
+		} else if (!strcmp(str, "watchdog_shm")) {
+			get_val_int(line, &val);
+			com.watchdog_shm = val;
+
+		} else if (!strcmp(str, "watchdog_batch_ms")) {
+			get_val_int(line, &val);
+			com.watchdog_batch_ms = val;
+
 		} else if (!strcmp(str, "high_priority")) {
 			get_val_int(line, &val);
 			com.high_priority = val;
@@ -2645,6 +3579,148 @@ static void read_config_file(void)
 			com.renewal_read_extend_sec_set = 1;
 			com.renewal_read_extend_sec = val;
 
+		} else if (!strcmp(str, "renewal_sweep_interval")) {
+			get_val_int(line, &val);
+			com.renewal_sweep_interval = val;
+
+		} else if (!strcmp(str, "renewal_coalesce")) {
+			get_val_int(line, &val);
+			com.renewal_coalesce = val;
+
+		} else if (!strcmp(str, "renewal_threads")) {
+			get_val_int(line, &val);
+			if (val < 0)
+				val = 0;
+			if (val == 1)
+				val = 2;
+			if (val > MAX_RENEWAL_THREADS)
+				val = MAX_RENEWAL_THREADS;
+			com.renewal_threads = val;
+
+		} else if (!strcmp(str, "renewal_adaptive")) {
+			get_val_int(line, &val);
+			com.renewal_adaptive = val;
+
+		} else if (!strcmp(str, "lvb_cache")) {
+			get_val_int(line, &val);
+			com.lvb_cache = val;
+
+		} else if (!strcmp(str, "host_state_cache")) {
+			get_val_int(line, &val);
+			com.host_state_cache = val;
+
+		} else if (!strcmp(str, "fd_cache")) {
+			get_val_int(line, &val);
+			com.fd_cache = val;
+
+		} else if (!strcmp(str, "fd_cache_idle")) {
+			get_val_int(line, &val);
+			if (val < 0)
+				val = 0;
+			com.fd_cache_idle = val;
+
+		} else if (!strcmp(str, "lazy_release_seconds")) {
+			get_val_int(line, &val);
+			if (val < 0)
+				val = 0;
+			com.lazy_release_seconds = val;
+
+		} else if (!strcmp(str, "lockspace")) {
+			memset(str, 0, sizeof(str));
+			get_val_str(line, str);
+			add_config_lockspace(str);
+
+		} else if (!strcmp(str, "convert_queue_seconds")) {
+			get_val_int(line, &val);
+			if (val < 0)
+				val = 0;
+			com.convert_queue_seconds = val;
+
+		} else if (!strcmp(str, "read_coalesce")) {
+			get_val_int(line, &val);
+			com.read_coalesce = val;
+
+		} else if (!strcmp(str, "read_cache_ms")) {
+			get_val_int(line, &val);
+			if (val < 0)
+				val = 0;
+			if (val > MAX_READ_CACHE_MS)
+				val = MAX_READ_CACHE_MS;
+			com.read_cache_ms = val;
+
+		} else if (!strcmp(str, "release_verify")) {
+			get_val_int(line, &val);
+			com.release_verify = val;
+
+		} else if (!strcmp(str, "paxos_fast_ballot")) {
+			get_val_int(line, &val);
+			com.paxos_fast_ballot = val;
+
+		} else if (!strcmp(str, "pipeline_queue_max")) {
+			get_val_int(line, &val);
+			if (val < 0)
+				val = 0;
+			com.pipeline_queue_max = val;
+
+		} else if (!strcmp(str, "io_worker_max")) {
+			get_val_int(line, &val);
+			if (val < 0)
+				val = 0;
+			com.io_worker_max = val;
+
+		} else if (!strcmp(str, "renewal_ioprio")) {
+			get_val_int(line, &val);
+			com.renewal_ioprio = val;
+
+		} else if (!strcmp(str, "renewal_multipath")) {
+			get_val_int(line, &val);
+			com.renewal_multipath = val;
+
+		} else if (!strcmp(str, "renewal_hedge_ms")) {
+			get_val_int(line, &val);
+			if (val < 0)
+				val = 0;
+			com.renewal_hedge_ms = val;
+
+		} else if (!strcmp(str, "io_tune")) {
+			get_val_int(line, &val);
+			com.io_tune = val;
+
+		} else if (!strcmp(str, "io_capture_file")) {
+			memset(str, 0, sizeof(str));
+			get_val_str(line, str);
+			com.io_capture_file = strdup(str);
+
+		} else if (!strcmp(str, "max_acquire_resources")) {
+			get_val_int(line, &val);
+			if (val < SANLK_MAX_RESOURCES)
+				val = SANLK_MAX_RESOURCES;
+			if (val > SANLK_MAX_ACQUIRE_RESOURCES)
+				val = SANLK_MAX_ACQUIRE_RESOURCES;
+			com.max_acquire_resources = val;
+
+		} else if (!strcmp(str, "host_id_read_split")) {
+			get_val_int(line, &val);
+			if (val < 0 || val > IO_TUNE_MAX_SPLIT || (val & (val - 1)))
+				log_error("ignore invalid host_id_read_split %d", val);
+			else
+				com.host_id_read_split = val;
+
+		} else if (!strcmp(str, "dblock_read_split")) {
+			get_val_int(line, &val);
+			if (val < 0 || val > IO_TUNE_MAX_SPLIT || (val & (val - 1)))
+				log_error("ignore invalid dblock_read_split %d", val);
+			else
+				com.dblock_read_split = val;
+
+		} else if (!strcmp(str, "resource_threads")) {
+			get_val_int(line, &val);
+			if (val < 1)
+				val = 1;
+			if (val > MAX_RESOURCE_THREADS)
+				val = MAX_RESOURCE_THREADS;
+			com.resource_threads = val;
+
 		} else if (!strcmp(str, "renewal_history_size")) {
 			get_val_int(line, &val);
 			com.renewal_history_size = val;
@@ -2653,6 +3729,17 @@ static void read_config_file(void)
 			get_val_int(line, &val);
 			com.paxos_debug_all = val;
 
+		} else if (!strcmp(str, "metrics")) {
+			get_val_int(line, &val);
+			com.metrics = val;
+
+		} else if (!strcmp(str, "metrics_port")) {
+			get_val_int(line, &val);
+			if (val < 0 || val > 65535)
+				log_error("ignore invalid metrics_port %d", val);
+			else
+				com.metrics_port = val;
+
 		} else if (!strcmp(str, "debug_io")) {
 			memset(str, 0, sizeof(str));
 			get_val_str(line, str);
@@ -2684,6 +3771,16 @@ static void read_config_file(void)
 			} else {
 				log_error("ignore unknown max_sectors_kb %s", str);
 			}
+
+		} else if (strstr(str, "_cpus") || strstr(str, "_sched")) {
+			/* <class>_cpus and <class>_sched, see affinity.c */
+			char key[MAX_CONF_LINE];
+
+			memcpy(key, str, sizeof(key));
+			memset(str, 0, sizeof(str));
+			get_val_str(line, str);
+			if (thread_class_config(key, str) < 0)
+				log_error("ignore invalid %s %s", key, str);
 		}
 	}
 
@@ -2791,6 +3888,138 @@ static int do_client_gets(void)
 	return 0;
 }
 
+static const char *io_op_str(uint32_t op)
+{
+	switch (op) {
+	case SANLK_IO_DELTA_READ:
+		return "delta_read";
+	case SANLK_IO_DELTA_WRITE:
+		return "delta_write";
+	case SANLK_IO_LEADER_READ:
+		return "leader_read";
+	case SANLK_IO_LEADER_WRITE:
+		return "leader_write";
+	case SANLK_IO_DBLOCK_READ:
+		return "dblock_read";
+	case SANLK_IO_DBLOCK_WRITE:
+		return "dblock_write";
+	case SANLK_IO_MBLOCK_WRITE:
+		return "mblock_write";
+	case SANLK_IO_LVB_READ:
+		return "lvb_read";
+	case SANLK_IO_LVB_WRITE:
+		return "lvb_write";
+	case SANLK_IO_OTHER_READ:
+		return "other_read";
+	case SANLK_IO_OTHER_WRITE:
+		return "other_write";
+	default:
+		return "unknown";
+	};
+}
+
+static int do_client_stats(void)
+{
+	struct sanlk_io_stats *stats = NULL, *st;
+	int count = 0;
+	int i, rv;
+
+	rv = sanlock_get_stats(&stats, &count, 0);
+	if (rv < 0 && rv != -ENOSPC) {
+		log_tool("stats error %d", rv);
+		return rv;
+	}
+
+	if (!stats)
+		return 0;
+
+	printf("# path op count errors avg_us max_us p50_us p99_us p999_us\n");
+
+	for (i = 0; i < count; i++) {
+		st = &stats[i];
+		printf("%s %s %llu %llu %llu %llu %llu %llu %llu\n",
+		       st->path, io_op_str(st->op),
+		       (unsigned long long)st->count,
+		       (unsigned long long)st->errors,
+		       (unsigned long long)(st->count ? st->total_us / st->count : 0),
+		       (unsigned long long)st->max_us,
+		       (unsigned long long)st->p50_us,
+		       (unsigned long long)st->p99_us,
+		       (unsigned long long)st->p999_us);
+	}
+
+	free(stats);
+	return 0;
+}
+
+static int do_client_state(void)
+{
+	struct sanlk_state_map *st = NULL;
+	struct sanlk_state_header *hdr;
+	struct sanlk_state_lockspace *sl;
+	struct sanlk_state_resource *sr;
+	struct sanlk_host *hs;
+	char *buf = NULL;
+	uint32_t i, j;
+	int len, rv;
+
+	rv = sanlock_state_open(&st, 0);
+	if (rv < 0) {
+		log_tool("state open error %d", rv);
+		return rv;
+	}
+
+	rv = sanlock_state_read(st, &buf, &len);
+	if (rv < 0) {
+		log_tool("state read error %d", rv);
+		goto out;
+	}
+
+	hdr = (struct sanlk_state_header *)buf;
+
+	log_tool("daemon %u seq %llu update_time %llu%s",
+		 hdr->daemon_pid,
+		 (unsigned long long)hdr->seq,
+		 (unsigned long long)hdr->update_time,
+		 (hdr->flags & SANLK_STATE_TRUNCATED) ? " truncated" : "");
+
+	for (i = 0; i < hdr->ls_count; i++) {
+		sl = (struct sanlk_state_lockspace *)(buf + hdr->ls_offset) + i;
+
+		log_tool("s %.48s:%llu:%s:%llu %s",
+			 sl->ls.name,
+			 (unsigned long long)sl->ls.host_id,
+			 sl->ls.host_id_disk.path,
+			 (unsigned long long)sl->ls.host_id_disk.offset,
+			 !sl->ls.flags ? "" : lsf_to_str(sl->ls.flags));
+
+		for (j = 0; j < sl->host_count; j++) {
+			hs = (struct sanlk_host *)(buf + hdr->host_offset) + sl->host_first + j;
+
+			log_tool("h %llu gen %llu timestamp %llu %s",
+				 (unsigned long long)hs->host_id,
+				 (unsigned long long)hs->generation,
+				 (unsigned long long)hs->timestamp,
+				 host_state_str(hs->flags));
+		}
+	}
+
+	for (i = 0; i < hdr->res_count; i++) {
+		sr = (struct sanlk_state_resource *)(buf + hdr->res_offset) + i;
+
+		log_tool("r %.48s:%.48s:%llu%s pid %u",
+			 sr->lockspace_name, sr->name,
+			 (unsigned long long)sr->lver,
+			 (sr->flags & SANLK_RES_SHARED) ? ":SH" : "",
+			 sr->pid);
+	}
+
+	free(buf);
+ out:
+	sanlock_state_close(st);
+	return rv;
+}
+
 static int do_client_read(void)
 {
 	struct sanlk_host *hss = NULL, *hs;
@@ -2908,12 +4137,92 @@ static void do_client_version(void)
 		  (proto & 0x0000FFFF));
 }
 
+/* <path>[:<offset>] */
+
+static int parse_arg_disk(char *arg, struct sanlk_disk *disk)
+{
+	char *colon;
+
+	memset(disk, 0, sizeof(struct sanlk_disk));
+
+	colon = strstr(arg, ":");
+	if (colon) {
+		*colon = '\0';
+		disk->offset = strtoull(colon + 1, NULL, 0);
+	}
+
+	if (!arg[0] || strlen(arg) >= SANLK_PATH_LEN) {
+		log_tool("disk path invalid");
+		return -EINVAL;
+	}
+
+	strncpy(disk->path, arg, SANLK_PATH_LEN - 1);
+	return 0;
+}
+
+static int add_lockspaces(void)
+{
+	int *results;
+	int i, rv;
+
+	results = calloc(com.lockspace_count, sizeof(int));
+	if (!results)
+		return -ENOMEM;
+
+	log_tool("add_lockspaces %d", com.lockspace_count);
+	rv = sanlock_add_lockspaces(com.lockspaces, com.lockspace_count, 0,
+				    com.io_timeout_arg != DEFAULT_IO_TIMEOUT ? com.io_timeout_arg : 0,
+				    results);
+	log_tool("add_lockspaces done %d", rv);
+
+	if (rv < 0)
+		goto out;
+
+	for (i = 0; i < com.lockspace_count; i++) {
+		log_tool("%.48s %d", com.lockspaces[i].name, results[i]);
+		if (results[i] < 0 && !rv)
+			rv = results[i];
+	}
+ out:
+	free(results);
+	return rv;
+}
+
+static int rem_lockspaces(void)
+{
+	int *results;
+	int i, rv;
+
+	results = calloc(com.lockspace_count, sizeof(int));
+	if (!results)
+		return -ENOMEM;
+
+	log_tool("rem_lockspaces %d", com.lockspace_count);
+	rv = sanlock_rem_lockspaces(com.lockspaces, com.lockspace_count, 0, results);
+	log_tool("rem_lockspaces done %d", rv);
+
+	if (rv < 0)
+		goto out;
+
+	for (i = 0; i < com.lockspace_count; i++) {
+		log_tool("%.48s %d", com.lockspaces[i].name, results[i]);
+		if (results[i] < 0 && !rv)
+			rv = results[i];
+	}
+ out:
+	free(results);
+	return rv;
+}
+
 static int do_client(void)
 {
 	struct sanlk_host_event he;
 	struct sanlk_resource **res_args = NULL;
 	struct sanlk_resource *res;
+	struct sanlk_disk disk;
 	char *res_state = NULL;
+	char *inq_state = NULL;
+	uint64_t offset = 0;
 	uint32_t flags = 0;
 	uint32_t config_cmd = 0;
 	int i, fd;
@@ -2955,6 +4264,18 @@ static int do_client(void)
 		rv = sanlock_log_dump(LOG_DUMP_SIZE);
 		break;
 
+	case ACT_TRACE:
+		rv = sanlock_trace(LOG_DUMP_SIZE);
+		break;
+
+	case ACT_STATS:
+		rv = do_client_stats();
+		break;
+
+	case ACT_STATE:
+		rv = do_client_state();
+		break;
+
 	case ACT_SHUTDOWN:
 		log_tool("shutdown force %d wait %d", com.force_mode, com.wait);
 		rv = sanlock_shutdown(com.force_mode, com.wait);
@@ -2989,6 +4310,10 @@ static int do_client(void)
 		break;
 
 	case ACT_ADD_LOCKSPACE:
+		if (com.lockspace_count > 1) {
+			rv = add_lockspaces();
+			break;
+		}
 		if (com.io_timeout_arg != DEFAULT_IO_TIMEOUT) {
 			log_tool("add_lockspace_timeout %d", com.io_timeout_arg);
 			rv = sanlock_add_lockspace_timeout(&com.lockspace, 0,
@@ -3008,6 +4333,10 @@ static int do_client(void)
 		break;
 
 	case ACT_REM_LOCKSPACE:
+		if (com.lockspace_count > 1) {
+			rv = rem_lockspaces();
+			break;
+		}
 		log_tool("rem_lockspace");
 		rv = sanlock_rem_lockspace(&com.lockspace, 0);
 		log_tool("rem_lockspace done %d", rv);
@@ -3084,6 +4413,21 @@ static int do_client(void)
 		if (rv < 0)
 			break;
 		log_tool("\"%s\"", res_state);
+
+		free(res_state);
+		res_state = NULL;
+
+		rv = sanlock_inquire(-1, com.pid, SANLK_INQUIRE_BINARY, &com.res_count, &inq_state);
+		log_tool("\ninquire binary done %d res_count %d", rv, com.res_count);
+		if (rv < 0 || !inq_state)
+			break;
+
+		rv = sanlock_inquire_to_state(inq_state, &res_state);
+		log_tool("inquire_to_state done %d", rv);
+		free(inq_state);
+		if (rv < 0)
+			break;
+		log_tool("\"%s\"", res_state);
 		break;
 
 	case ACT_REQUEST:
@@ -3101,6 +4445,17 @@ static int do_client(void)
 		log_tool("examine done %d", rv);
 		break;
 
+	case ACT_NEXT_FREE:
+		log_tool("next_free");
+		rv = parse_arg_disk(com.dump_path, &disk);
+		if (rv < 0)
+			break;
+		rv = sanlock_next_free(&disk, com.clear_arg ? SANLK_NEXT_FREE_RESCAN : 0, &offset);
+		if (!rv)
+			printf("%llu\n", (unsigned long long)offset);
+		log_tool("next_free done %d", rv);
+		break;
+
 	case ACT_CLIENT_ALIGN:
 		log_tool("align");
 		rv = sanlock_align(&com.lockspace.host_id_disk);
@@ -3174,6 +4529,8 @@ static int do_client(void)
 			com.rindex.flags |= sanlk_rif_sector_size_to_flag(com.sector_size);
 		if (com.align_size)
 			com.rindex.flags |= sanlk_rif_align_size_to_flag(com.align_size);
+		if (com.rindex_version == 2)
+			com.rindex.flags |= SANLK_RIF_HASHED;
 
 		rv = sanlock_format_rindex(&com.rindex, 0);
 		log_tool("format done %d", rv);
@@ -3185,6 +4542,14 @@ static int do_client(void)
 		break;
 
 	case ACT_CREATE:
+		if (com.rentry_count > 1) {
+			rv = sanlock_create_resources(&com.rindex, 0, com.rentries, com.rentry_count, 0, 0);
+			log_tool("create_resources done %d", rv);
+			for (i = 0; !rv && i < com.rentry_count; i++)
+				log_tool("name %.48s offset %llu", com.rentries[i].name,
+					 (unsigned long long)com.rentries[i].offset);
+			break;
+		}
 		rv = sanlock_create_resource(&com.rindex, 0, &com.rentry, 0, 0);
 		log_tool("create_resource done %d", rv);
 		if (!rv)
@@ -3192,6 +4557,11 @@ static int do_client(void)
 		break;
 
 	case ACT_DELETE:
+		if (com.rentry_count > 1) {
+			rv = sanlock_delete_resources(&com.rindex, 0, com.rentries, com.rentry_count);
+			log_tool("delete_resources done %d", rv);
+			break;
+		}
 		rv = sanlock_delete_resource(&com.rindex, 0, &com.rentry);
 		log_tool("delete_resource done %d", rv);
 		break;
@@ -3501,7 +4871,11 @@ static int do_direct(void)
 		break;
 
 	case ACT_NEXT_FREE:
-		rv = direct_next_free(&main_task, com.dump_path);
+		rv = direct_next_free(&main_task, com.dump_path, com.file_path);
+		break;
+
+	case ACT_FREEMAP:
+		rv = direct_freemap(&main_task, com.dump_path, com.file_path);
 		break;
 
 	case ACT_READ_LEADER:
@@ -3517,6 +4891,8 @@ static int do_direct(void)
 			com.rindex.flags |= sanlk_rif_sector_size_to_flag(com.sector_size);
 		if (com.align_size)
 			com.rindex.flags |= sanlk_rif_align_size_to_flag(com.align_size);
+		if (com.rindex_version == 2)
+			com.rindex.flags |= SANLK_RIF_HASHED;
 
 		syslog(LOG_WARNING, "format rindex %.48s:%s:%llu 0x%x",
 		       com.rindex.lockspace_name,
@@ -3533,6 +4909,17 @@ static int do_direct(void)
 		log_tool("rebuild done %d", rv);
 		break;
 
+	case ACT_CONVERT_RINDEX:
+		syslog(LOG_WARNING, "convert rindex %.48s:%s:%llu %d",
+		       com.rindex.lockspace_name,
+		       com.rindex.disk.path,
+		       (unsigned long long)com.rindex.disk.offset,
+		       (com.rindex_version == 1) ? 1 : 2);
+
+		rv = direct_rindex_convert(&main_task, &com.rindex, (com.rindex_version == 1) ? 0 : 1);
+		log_tool("convert done %d", rv);
+		break;
+
 	case ACT_LOOKUP:
 		rv = direct_rindex_lookup(&main_task, &com.rindex, &com.rentry, 0);
 		log_tool("lookup done %d", rv);
@@ -3657,9 +5044,12 @@ int main(int argc, char *argv[])
 	INIT_LIST_HEAD(&spaces);
 	INIT_LIST_HEAD(&spaces_rem);
 	INIT_LIST_HEAD(&spaces_add);
+	setup_lockspace_hash();
 
 	memset(&com, 0, sizeof(com));
 	com.use_watchdog = DEFAULT_USE_WATCHDOG;
+	com.watchdog_batch_ms = DEFAULT_WATCHDOG_BATCH_MS;
+	com.watchdog_shm = DEFAULT_WATCHDOG_SHM;
 	com.high_priority = DEFAULT_HIGH_PRIORITY;
 	com.mlock_level = DEFAULT_MLOCK_LEVEL;
 	com.names_log_priority = LOG_WARNING;
@@ -3668,11 +5058,28 @@ int main(int argc, char *argv[])
 	com.aio_arg = DEFAULT_USE_AIO;
 	com.pid = -1;
 	com.sh_retries = DEFAULT_SH_RETRIES;
+	com.resource_threads = DEFAULT_RESOURCE_THREADS;
+	com.renewal_threads = DEFAULT_RENEWAL_THREADS;
 	com.quiet_fail = DEFAULT_QUIET_FAIL;
 	com.renewal_read_extend_sec_set = 0;
 	com.renewal_read_extend_sec = 0;
 	com.renewal_history_size = DEFAULT_RENEWAL_HISTORY_SIZE;
 	com.paxos_debug_all = 0;
+	com.metrics = DEFAULT_METRICS;
+	com.fd_cache = DEFAULT_FD_CACHE;
+	com.fd_cache_idle = DEFAULT_FD_CACHE_IDLE;
+	com.lazy_release_seconds = DEFAULT_LAZY_RELEASE_SECONDS;
+	com.convert_queue_seconds = DEFAULT_CONVERT_QUEUE_SECONDS;
+	com.read_coalesce = DEFAULT_READ_COALESCE;
+	com.read_cache_ms = DEFAULT_READ_CACHE_MS;
+	com.pipeline_queue_max = DEFAULT_PIPELINE_QUEUE_MAX;
+	com.release_verify = DEFAULT_RELEASE_VERIFY;
+	com.paxos_fast_ballot = DEFAULT_PAXOS_FAST_BALLOT;
+	com.io_worker_max = DEFAULT_IO_WORKER_MAX;
+	com.max_acquire_resources = DEFAULT_MAX_ACQUIRE_RESOURCES;
+	com.renewal_ioprio = DEFAULT_RENEWAL_IOPRIO;
+	com.renewal_hedge_ms = DEFAULT_RENEWAL_HEDGE_MS;
+	com.io_tune = DEFAULT_IO_TUNE;
 	com.max_sectors_kb_ignore = DEFAULT_MAX_SECTORS_KB_IGNORE;
 	com.max_sectors_kb_align = DEFAULT_MAX_SECTORS_KB_ALIGN;
 	com.max_sectors_kb_num = DEFAULT_MAX_SECTORS_KB_NUM;
@@ -0,0 +1,506 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+/*
+ * OpenMetrics exporter.  A thread of its own accepts connections on the
+ * metrics unix socket in the run dir, and optionally on a tcp port, and
+ * answers each http request with the current metrics, so scraping never
+ * involves main_loop or the worker threads.
+ */
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+
+#include "sanlock_internal.h"
+#include "sanlock_admin.h"
+#include "log.h"
+#include "lockspace.h"
+#include "metrics.h"
+
+void thread_pool_metrics(int *workers, int *free_workers, int *queued, uint64_t *busy);
+
+struct space_counters {
+	uint32_t space_id;
+	uint64_t val[METRIC_COUNTERS];
+};
+
+static struct space_counters counters[METRICS_SPACES];
+
+static int metrics_unix_fd = -1;
+static int metrics_tcp_fd = -1;
+static int metrics_quit_fd = -1;
+static int metrics_thread_started;
+static pthread_t metrics_thread;
+static struct sockaddr_un metrics_addr;
+
+static const struct {
+	const char *name;
+	const char *help;
+} counter_info[METRIC_COUNTERS] = {
+	[METRIC_ACQUIRES]         = { "sanlock_acquires", "Resource leases acquired." },
+	[METRIC_ACQUIRE_ERRORS]   = { "sanlock_acquire_errors", "Resource lease acquires that failed." },
+	[METRIC_RELEASES]         = { "sanlock_releases", "Resource leases released." },
+	[METRIC_CONVERTS]         = { "sanlock_converts", "Resource leases converted between sh and ex." },
+	[METRIC_BALLOTS]          = { "sanlock_ballots", "Paxos ballots run." },
+	[METRIC_BALLOT_RETRIES]   = { "sanlock_ballot_retries", "Paxos ballots retried after losing to another host." },
+	[METRIC_MBAL_ABORTS]      = { "sanlock_ballot_mbal_aborts", "Paxos ballots aborted by a larger mbal." },
+	[METRIC_RENEWALS]         = { "sanlock_renewals", "Delta lease renewals attempted." },
+	[METRIC_RENEWAL_ERRORS]   = { "sanlock_renewal_errors", "Delta lease renewals that failed." },
+	[METRIC_RENEWAL_READ_MS]  = { "sanlock_renewal_read_ms", "Milliseconds spent in successful renewal reads." },
+	[METRIC_RENEWAL_WRITE_MS] = { "sanlock_renewal_write_ms", "Milliseconds spent in successful renewal writes." },
+	[METRIC_HANDOFFS]         = { "sanlock_handoffs", "Resource leases taken over from a handoff without a ballot." },
+	[METRIC_FAST_BALLOTS]     = { "sanlock_fast_ballots", "Paxos ballots run with phase 2 only by the last owner." },
+};
+
+static const char *host_state_names[SANLK_HOST_DEAD+1] = {
+	[SANLK_HOST_UNKNOWN] = "unknown",
+	[SANLK_HOST_FREE]    = "free",
+	[SANLK_HOST_LIVE]    = "live",
+	[SANLK_HOST_FAIL]    = "fail",
+	[SANLK_HOST_DEAD]    = "dead",
+};
+
+/* called with spaces_mutex held when a lockspace is added */
+
+void metrics_add_space(uint32_t space_id)
+{
+	struct space_counters *sc = &counters[space_id & (METRICS_SPACES - 1)];
+	int i;
+
+	__atomic_store_n(&sc->space_id, 0, __ATOMIC_RELEASE);
+	for (i = 0; i < METRIC_COUNTERS; i++)
+		__atomic_store_n(&sc->val[i], 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&sc->space_id, space_id, __ATOMIC_RELEASE);
+}
+
+void metrics_add(uint32_t space_id, int counter, uint64_t val)
+{
+	struct space_counters *sc = &counters[space_id & (METRICS_SPACES - 1)];
+
+	if (__atomic_load_n(&sc->space_id, __ATOMIC_ACQUIRE) != space_id)
+		return;
+
+	__atomic_fetch_add(&sc->val[counter], val, __ATOMIC_RELAXED);
+}
+
+static int get_counter(uint32_t space_id, int counter, uint64_t *val)
+{
+	struct space_counters *sc = &counters[space_id & (METRICS_SPACES - 1)];
+
+	if (__atomic_load_n(&sc->space_id, __ATOMIC_ACQUIRE) != space_id)
+		return -1;
+
+	*val = __atomic_load_n(&sc->val[counter], __ATOMIC_RELAXED);
+	return 0;
+}
+
+struct mbuf {
+	char *buf;
+	int len;
+	int size;
+};
+
+static void mb_printf(struct mbuf *mb, const char *fmt, ...)
+{
+	va_list ap;
+	char *buf;
+	int rv;
+
+	if (!mb->buf)
+		return;
+ retry:
+	va_start(ap, fmt);
+	rv = vsnprintf(mb->buf + mb->len, mb->size - mb->len, fmt, ap);
+	va_end(ap);
+
+	if (rv < 0)
+		return;
+
+	if (rv >= mb->size - mb->len) {
+		buf = realloc(mb->buf, mb->size * 2);
+		if (!buf) {
+			free(mb->buf);
+			mb->buf = NULL;
+			return;
+		}
+		mb->buf = buf;
+		mb->size *= 2;
+		goto retry;
+	}
+
+	mb->len += rv;
+}
+
+/* label values escape backslash, double quote and line feed */
+
+static void label_value(const char *in, char *out, int outlen)
+{
+	int i, j = 0;
+
+	for (i = 0; in[i] && j < outlen - 2; i++) {
+		if (in[i] == '\\' || in[i] == '"') {
+			out[j++] = '\\';
+			out[j++] = in[i];
+		} else if (in[i] == '\n') {
+			out[j++] = '\\';
+			out[j++] = 'n';
+		} else {
+			out[j++] = in[i];
+		}
+	}
+	out[j] = '\0';
+}
+
+static void format_metrics(struct mbuf *mb)
+{
+	struct space_metrics *sms;
+	char (*labels)[2 * NAME_ID_SIZE + 1];
+	uint64_t val;
+	uint64_t busy;
+	int workers, free_workers, queued;
+	int count, i, c, st;
+
+	sms = calloc(METRICS_SPACES, sizeof(struct space_metrics));
+	labels = calloc(METRICS_SPACES, sizeof(*labels));
+	if (!sms || !labels)
+		goto out;
+
+	count = lockspace_metrics(sms, METRICS_SPACES);
+
+	for (i = 0; i < count; i++)
+		label_value(sms[i].name, labels[i], sizeof(labels[i]));
+
+	for (c = 0; c < METRIC_COUNTERS; c++) {
+		mb_printf(mb, "# TYPE %s counter\n", counter_info[c].name);
+		mb_printf(mb, "# HELP %s %s\n", counter_info[c].name, counter_info[c].help);
+
+		for (i = 0; i < count; i++) {
+			if (get_counter(sms[i].space_id, c, &val) < 0)
+				continue;
+			mb_printf(mb, "%s_total{lockspace=\"%s\"} %llu\n",
+				  counter_info[c].name, labels[i], (unsigned long long)val);
+		}
+	}
+
+	mb_printf(mb, "# TYPE sanlock_killing_pids gauge\n");
+	mb_printf(mb, "# HELP sanlock_killing_pids Pids using the lockspace are being killed (1) or are stuck (2).\n");
+	for (i = 0; i < count; i++)
+		mb_printf(mb, "sanlock_killing_pids{lockspace=\"%s\"} %d\n",
+			  labels[i], sms[i].killing_pids);
+
+	mb_printf(mb, "# TYPE sanlock_renewal_failing gauge\n");
+	mb_printf(mb, "# HELP sanlock_renewal_failing The delta lease renewal has failed for too long.\n");
+	for (i = 0; i < count; i++)
+		mb_printf(mb, "sanlock_renewal_failing{lockspace=\"%s\"} %d\n",
+			  labels[i], sms[i].renew_fail ? 1 : 0);
+
+	mb_printf(mb, "# TYPE sanlock_hosts gauge\n");
+	mb_printf(mb, "# HELP sanlock_hosts Hosts seen in the lockspace in each state.\n");
+	for (i = 0; i < count; i++) {
+		for (st = SANLK_HOST_UNKNOWN; st <= SANLK_HOST_DEAD; st++) {
+			if (st == SANLK_HOST_FREE)
+				continue;
+			mb_printf(mb, "sanlock_hosts{lockspace=\"%s\",state=\"%s\"} %d\n",
+				  labels[i], host_state_names[st], sms[i].hosts[st]);
+		}
+	}
+
+	thread_pool_metrics(&workers, &free_workers, &queued, &busy);
+
+	mb_printf(mb, "# TYPE sanlock_thread_pool_workers gauge\n");
+	mb_printf(mb, "# HELP sanlock_thread_pool_workers Worker threads.\n");
+	mb_printf(mb, "sanlock_thread_pool_workers %d\n", workers);
+	mb_printf(mb, "# TYPE sanlock_thread_pool_free_workers gauge\n");
+	mb_printf(mb, "# HELP sanlock_thread_pool_free_workers Worker threads waiting for work.\n");
+	mb_printf(mb, "sanlock_thread_pool_free_workers %d\n", free_workers);
+	mb_printf(mb, "# TYPE sanlock_thread_pool_queue_depth gauge\n");
+	mb_printf(mb, "# HELP sanlock_thread_pool_queue_depth Commands waiting for a worker thread.\n");
+	mb_printf(mb, "sanlock_thread_pool_queue_depth %d\n", queued);
+	mb_printf(mb, "# TYPE sanlock_thread_pool_busy counter\n");
+	mb_printf(mb, "# HELP sanlock_thread_pool_busy Commands failed with EBUSY because their queue was full.\n");
+	mb_printf(mb, "sanlock_thread_pool_busy_total %llu\n", (unsigned long long)busy);
+ out:
+	mb_printf(mb, "# EOF\n");
+	free(sms);
+	free(labels);
+}
+
+static int send_all(int fd, const char *buf, int len)
+{
+	int rv, pos = 0;
+
+	while (pos < len) {
+		rv = send(fd, buf + pos, len - pos, MSG_NOSIGNAL);
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv <= 0)
+			return -1;
+		pos += rv;
+	}
+	return 0;
+}
+
+/*
+ * Read the request header, the request itself isn't looked at,
+ * every request gets the metrics.
+ */
+
+static void serve_request(int fd)
+{
+	struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+	struct mbuf mb;
+	char req[4096];
+	char hdr[256];
+	int rv, pos = 0, hdr_len;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	while (pos < (int)sizeof(req) - 1) {
+		rv = recv(fd, req + pos, sizeof(req) - 1 - pos, 0);
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv <= 0)
+			break;
+		pos += rv;
+		req[pos] = '\0';
+		if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+			break;
+	}
+
+	if (!pos)
+		return;
+
+	mb.len = 0;
+	mb.size = 16384;
+	mb.buf = malloc(mb.size);
+
+	format_metrics(&mb);
+
+	if (!mb.buf) {
+		hdr_len = snprintf(hdr, sizeof(hdr),
+				   "HTTP/1.0 500 Internal Server Error\r\n"
+				   "Content-Length: 0\r\n\r\n");
+		send_all(fd, hdr, hdr_len);
+		return;
+	}
+
+	hdr_len = snprintf(hdr, sizeof(hdr),
+			   "HTTP/1.0 200 OK\r\n"
+			   "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+			   "Content-Length: %d\r\n\r\n", mb.len);
+
+	if (!send_all(fd, hdr, hdr_len))
+		send_all(fd, mb.buf, mb.len);
+
+	free(mb.buf);
+}
+
+static void *metrics_thread_main(void *arg GNUC_UNUSED)
+{
+	struct pollfd pfd[3];
+	int listen_fds[3];
+	int i, n, fd, rv;
+
+	n = 0;
+	pfd[n].fd = metrics_quit_fd;
+	pfd[n].events = POLLIN;
+	listen_fds[n++] = -1;
+
+	if (metrics_unix_fd != -1) {
+		pfd[n].fd = metrics_unix_fd;
+		pfd[n].events = POLLIN;
+		listen_fds[n++] = metrics_unix_fd;
+	}
+
+	if (metrics_tcp_fd != -1) {
+		pfd[n].fd = metrics_tcp_fd;
+		pfd[n].events = POLLIN;
+		listen_fds[n++] = metrics_tcp_fd;
+	}
+
+	while (1) {
+		rv = poll(pfd, n, -1);
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv < 0)
+			break;
+
+		if (pfd[0].revents)
+			break;
+
+		for (i = 1; i < n; i++) {
+			if (!(pfd[i].revents & POLLIN))
+				continue;
+
+			fd = accept4(listen_fds[i], NULL, NULL, SOCK_CLOEXEC);
+			if (fd < 0)
+				continue;
+
+			serve_request(fd);
+			close(fd);
+		}
+	}
+
+	return NULL;
+}
+
+static int setup_metrics_unix(const char *run_dir)
+{
+	int fd, rv;
+
+	memset(&metrics_addr, 0, sizeof(metrics_addr));
+	metrics_addr.sun_family = AF_LOCAL;
+	snprintf(metrics_addr.sun_path, sizeof(metrics_addr.sun_path) - 1, "%s/%s",
+		 run_dir, METRICS_SOCKET_NAME);
+
+	fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	unlink(metrics_addr.sun_path);
+	rv = bind(fd, (struct sockaddr *) &metrics_addr, sizeof(struct sockaddr_un));
+	if (rv < 0)
+		goto fail;
+
+	rv = chmod(metrics_addr.sun_path, DEFAULT_SOCKET_MODE);
+	if (rv < 0)
+		goto fail;
+
+	rv = chown(metrics_addr.sun_path, com.uid, com.gid);
+	if (rv < 0)
+		goto fail;
+
+	rv = listen(fd, 5);
+	if (rv < 0)
+		goto fail;
+
+	metrics_unix_fd = fd;
+	return 0;
+ fail:
+	rv = -errno;
+	log_error("metrics socket %s error %d", metrics_addr.sun_path, rv);
+	close(fd);
+	return rv;
+}
+
+static int setup_metrics_tcp(int port)
+{
+	struct sockaddr_in sin;
+	int fd, rv, on = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_ANY);
+	sin.sin_port = htons(port);
+
+	rv = bind(fd, (struct sockaddr *) &sin, sizeof(sin));
+	if (rv < 0)
+		goto fail;
+
+	rv = listen(fd, 5);
+	if (rv < 0)
+		goto fail;
+
+	metrics_tcp_fd = fd;
+	return 0;
+ fail:
+	rv = -errno;
+	log_error("metrics port %d error %d", port, rv);
+	close(fd);
+	return rv;
+}
+
+/* metrics are not essential, so errors are logged and not returned */
+
+int setup_metrics(const char *run_dir)
+{
+	int rv;
+
+	if (!com.metrics && !com.metrics_port)
+		return 0;
+
+	if (com.metrics)
+		setup_metrics_unix(run_dir);
+
+	if (com.metrics_port)
+		setup_metrics_tcp(com.metrics_port);
+
+	if (metrics_unix_fd == -1 && metrics_tcp_fd == -1)
+		return 0;
+
+	metrics_quit_fd = eventfd(0, EFD_CLOEXEC);
+	if (metrics_quit_fd < 0) {
+		log_error("metrics eventfd error %d", errno);
+		goto fail;
+	}
+
+	rv = pthread_create(&metrics_thread, NULL, metrics_thread_main, NULL);
+	if (rv) {
+		log_error("metrics thread error %d", rv);
+		goto fail;
+	}
+
+	metrics_thread_started = 1;
+	return 0;
+ fail:
+	close_metrics();
+	return 0;
+}
+
+void close_metrics(void)
+{
+	uint64_t one = 1;
+	int rv;
+
+	if (metrics_thread_started) {
+		rv = write(metrics_quit_fd, &one, sizeof(one));
+		if (rv == sizeof(one))
+			pthread_join(metrics_thread, NULL);
+		metrics_thread_started = 0;
+	}
+
+	if (metrics_quit_fd != -1) {
+		close(metrics_quit_fd);
+		metrics_quit_fd = -1;
+	}
+
+	if (metrics_unix_fd != -1) {
+		close(metrics_unix_fd);
+		unlink(metrics_addr.sun_path);
+		metrics_unix_fd = -1;
+	}
+
+	if (metrics_tcp_fd != -1) {
+		close(metrics_tcp_fd);
+		metrics_tcp_fd = -1;
+	}
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+/*
+ * Lockspace counters and state exported in OpenMetrics text format from
+ * the metrics socket.  Counters are kept by space_id, so they can be
+ * updated from the resource code which only has the token.
+ */
+
+#define METRICS_SOCKET_NAME "sanlock_metrics.sock"
+
+#define METRIC_ACQUIRES		0
+#define METRIC_ACQUIRE_ERRORS	1
+#define METRIC_RELEASES		2
+#define METRIC_CONVERTS		3
+#define METRIC_BALLOTS		4
+#define METRIC_BALLOT_RETRIES	5
+#define METRIC_MBAL_ABORTS	6
+#define METRIC_RENEWALS		7
+#define METRIC_RENEWAL_ERRORS	8
+#define METRIC_RENEWAL_READ_MS	9
+#define METRIC_RENEWAL_WRITE_MS	10
+#define METRIC_HANDOFFS		11
+#define METRIC_FAST_BALLOTS	12
+#define METRIC_COUNTERS		13
+
+#define METRICS_SPACES 256 /* power of 2 */
+
+/* lockspace state copied out by lockspace_metrics() */
+
+struct space_metrics {
+	char name[NAME_ID_SIZE+1];
+	uint32_t space_id;
+	int killing_pids;
+	int renew_fail;
+	int hosts[SANLK_HOST_DEAD+1]; /* count of hosts in each SANLK_HOST_ state */
+};
+
+void metrics_add_space(uint32_t space_id);
+void metrics_add(uint32_t space_id, int counter, uint64_t val);
+
+int setup_metrics(const char *run_dir);
+void close_metrics(void);
+
+#endif
@@ -20,6 +20,15 @@ uint64_t monotime(void)
 	return ts.tv_sec;
 }
 
+uint64_t monotime_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 void ts_diff(struct timespec *begin, struct timespec *end, struct timespec *diff)
 {
 	if ((end->tv_nsec - begin->tv_nsec) < 0) {
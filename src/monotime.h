@@ -10,6 +10,7 @@
 #define	__MONOTIME_H__
 
 uint64_t monotime(void);
+uint64_t monotime_ms(void);
 void ts_diff(struct timespec *begin, struct timespec *end, struct timespec *diff);
 
 #endif
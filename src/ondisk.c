@@ -11,6 +11,7 @@
 #include <byteswap.h>
 #include <inttypes.h>
 #include <unistd.h>
+#include <string.h>
 #include <time.h>
 
 #include "sanlock_internal.h"
@@ -76,12 +77,34 @@ void leader_record_out(struct leader_record *lr, struct leader_record *end)
 	end->write_timestamp  = cpu_to_le64(lr->write_timestamp);
 }
 
+void lvb_footer_in(struct lvb_footer *end, struct lvb_footer *lf)
+{
+	lf->magic    = le32_to_cpu(end->magic);
+	lf->sector   = le32_to_cpu(end->sector);
+	lf->lver     = le64_to_cpu(end->lver);
+	lf->count    = le32_to_cpu(end->count);
+	lf->checksum = le32_to_cpu(end->checksum);
+}
+
+void lvb_footer_out(struct lvb_footer *lf, struct lvb_footer *end)
+{
+	end->magic    = cpu_to_le32(lf->magic);
+	end->sector   = cpu_to_le32(lf->sector);
+	end->lver     = cpu_to_le64(lf->lver);
+	end->count    = cpu_to_le32(lf->count);
+	/* N.B. the checksum must be computed after the byte swapping */
+	end->checksum = cpu_to_le32(lf->checksum);
+}
+
 void request_record_in(struct request_record *end, struct request_record *rr)
 {
 	rr->magic      = le32_to_cpu(end->magic);
 	rr->version    = le32_to_cpu(end->version);
 	rr->lver       = le64_to_cpu(end->lver);
 	rr->force_mode = le32_to_cpu(end->force_mode);
+	rr->pad1       = le32_to_cpu(end->pad1);
+	rr->host_id    = le64_to_cpu(end->host_id);
+	rr->host_generation = le64_to_cpu(end->host_generation);
 }
 
 void request_record_out(struct request_record *rr, struct request_record *end)
@@ -90,6 +113,9 @@ void request_record_out(struct request_record *rr, struct request_record *end)
 	end->version    = cpu_to_le32(rr->version);
 	end->lver       = cpu_to_le64(rr->lver);
 	end->force_mode = cpu_to_le32(rr->force_mode);
+	end->pad1       = cpu_to_le32(rr->pad1);
+	end->host_id    = cpu_to_le64(rr->host_id);
+	end->host_generation = cpu_to_le64(rr->host_generation);
 }
 
 void paxos_dblock_in(struct paxos_dblock *end, struct paxos_dblock *pd)
@@ -136,7 +162,7 @@ void rindex_header_in(struct rindex_header *end, struct rindex_header *rh)
 	rh->flags		= le32_to_cpu(end->flags);
 	rh->sector_size		= le32_to_cpu(end->sector_size);
 	rh->max_resources	= le32_to_cpu(end->max_resources);
-	rh->unused		= le32_to_cpu(end->unused);
+	rh->buckets		= le32_to_cpu(end->buckets);
 	rh->rx_offset		= le64_to_cpu(end->rx_offset);
 	memcpy(rh->lockspace_name, end->lockspace_name, NAME_ID_SIZE);
 }
@@ -148,7 +174,7 @@ void rindex_header_out(struct rindex_header *rh, struct rindex_header *end)
 	end->flags		= cpu_to_le32(rh->flags);
 	end->sector_size	= cpu_to_le32(rh->sector_size);
 	end->max_resources	= cpu_to_le32(rh->max_resources);
-	end->unused		= cpu_to_le32(rh->unused);
+	end->buckets		= cpu_to_le32(rh->buckets);
 	end->rx_offset		= cpu_to_le64(rh->rx_offset);
 	memcpy(end->lockspace_name, rh->lockspace_name, NAME_ID_SIZE);
 }
@@ -169,3 +195,17 @@ void rindex_entry_out(struct rindex_entry *re, struct rindex_entry *end)
 	memcpy(end->name, re->name, NAME_ID_SIZE);
 }
 
+void rindex_bucket_in(struct rindex_bucket *end, struct rindex_bucket *rb)
+{
+	rb->count		= le32_to_cpu(end->count);
+	rb->flags		= le32_to_cpu(end->flags);
+	memset(rb->unused, 0, sizeof(rb->unused));
+}
+
+void rindex_bucket_out(struct rindex_bucket *rb, struct rindex_bucket *end)
+{
+	end->count		= cpu_to_le32(rb->count);
+	end->flags		= cpu_to_le32(rb->flags);
+	memset(end->unused, 0, sizeof(end->unused));
+}
+
@@ -40,6 +40,8 @@ void leader_record_in(struct leader_record *end, struct leader_record *lr);
 void leader_record_out(struct leader_record *lr, struct leader_record *end);
 void request_record_in(struct request_record *end, struct request_record *rr);
 void request_record_out(struct request_record *rr, struct request_record *end);
+void lvb_footer_in(struct lvb_footer *end, struct lvb_footer *lf);
+void lvb_footer_out(struct lvb_footer *lf, struct lvb_footer *end);
 void paxos_dblock_in(struct paxos_dblock *end, struct paxos_dblock *pd);
 void paxos_dblock_out(struct paxos_dblock *pd, struct paxos_dblock *end);
 void mode_block_in(struct mode_block *end, struct mode_block *mb);
@@ -48,5 +50,58 @@ void rindex_header_in(struct rindex_header *end, struct rindex_header *rh);
 void rindex_header_out(struct rindex_header *rh, struct rindex_header *end);
 void rindex_entry_in(struct rindex_entry *end, struct rindex_entry *re);
 void rindex_entry_out(struct rindex_entry *re, struct rindex_entry *end);
+void rindex_bucket_in(struct rindex_bucket *end, struct rindex_bucket *rb);
+void rindex_bucket_out(struct rindex_bucket *rb, struct rindex_bucket *end);
+
+/*
+ * For loops that only read the fields of each record in an iobuf, the
+ * _ref functions return a pointer to the record in host format.  On
+ * little endian hosts that is the record in the iobuf itself, so no
+ * copy is made, otherwise the record is converted into the struct that
+ * is passed.  The iobuf must be aligned for the record (records are at
+ * sector or entry offsets in an aligned iobuf), and the record must not
+ * be modified through the pointer.
+ */
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+static inline struct leader_record *leader_record_ref(struct leader_record *end,
+						      struct leader_record *lr GNUC_UNUSED)
+{
+	return end;
+}
+
+static inline struct paxos_dblock *paxos_dblock_ref(struct paxos_dblock *end,
+						    struct paxos_dblock *pd GNUC_UNUSED)
+{
+	return end;
+}
+
+static inline struct rindex_entry *rindex_entry_ref(struct rindex_entry *end,
+						    struct rindex_entry *re GNUC_UNUSED)
+{
+	return end;
+}
+#else
+static inline struct leader_record *leader_record_ref(struct leader_record *end,
+						      struct leader_record *lr)
+{
+	leader_record_in(end, lr);
+	return lr;
+}
+
+static inline struct paxos_dblock *paxos_dblock_ref(struct paxos_dblock *end,
+						    struct paxos_dblock *pd)
+{
+	paxos_dblock_in(end, pd);
+	return pd;
+}
+
+static inline struct rindex_entry *rindex_entry_ref(struct rindex_entry *end,
+						    struct rindex_entry *re)
+{
+	rindex_entry_in(end, re);
+	return re;
+}
+#endif
 
 #endif
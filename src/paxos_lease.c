@@ -22,6 +22,7 @@
 #include <sys/time.h>
 
 #include "sanlock_internal.h"
+#include "sanlock_admin.h"
 #include "diskio.h"
 #include "ondisk.h"
 #include "direct.h"
@@ -31,8 +32,14 @@
 #include "paxos_lease.h"
 #include "resource.h"
 #include "timeouts.h"
+#include "task.h"
+#include "iostats.h"
+#include "metrics.h"
+#include "sanlock_sock.h"
+#include "trace.h"
+#include "crc32c.h"
+#include "readflight.h"
 
-uint32_t crc32c(uint32_t crc, uint8_t *data, size_t length);
 int get_rand(int a, int b);
 
 /*
@@ -153,38 +160,19 @@ int paxos_erase_dblock(struct task *task,
  * the case, but could change in the future.
  */
 
-static int write_dblock_mblock_sh(struct task *task,
-			          struct token *token,
-			          struct sync_disk *disk,
-			          uint64_t host_id,
-			          struct paxos_dblock *pd)
+static void dblock_mblock_sh_to_sector(struct token *token,
+				       struct paxos_dblock *pd,
+				       char *iobuf)
 {
 	struct paxos_dblock pd_end;
 	struct mode_block mb;
 	struct mode_block mb_end;
-	char *iobuf, **p_iobuf;
-	uint64_t offset;
 	uint32_t checksum;
-	int iobuf_len, rv, sector_size;
 
 	memset(&mb, 0, sizeof(mb));
 	mb.flags = MBLOCK_SHARED;
 	mb.generation = token->host_generation;
 
-	sector_size = token->sector_size;
-
-	iobuf_len = sector_size;
-	if (!iobuf_len)
-		return -EINVAL;
-
-	p_iobuf = &iobuf;
-
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
-	if (rv)
-		return -ENOMEM;
-
-	offset = disk->offset + ((2 + host_id - 1) * sector_size);
-
 	paxos_dblock_out(pd, &pd_end);
 
 	/*
@@ -198,7 +186,37 @@ static int write_dblock_mblock_sh(struct task *task,
 
 	memcpy(iobuf, (char *)&pd_end, sizeof(struct paxos_dblock));
 	memcpy(iobuf + MBLOCK_OFFSET, (char *)&mb_end, sizeof(struct mode_block));
+}
+
+static int write_dblock_mblock_sh(struct task *task,
+			          struct token *token,
+			          struct sync_disk *disk,
+			          uint64_t host_id,
+			          struct paxos_dblock *pd)
+{
+	char *iobuf, **p_iobuf;
+	uint64_t offset;
+	int iobuf_len, rv, sector_size;
+
+	sector_size = token->sector_size;
 
+	iobuf_len = sector_size;
+	if (!iobuf_len)
+		return -EINVAL;
+
+	p_iobuf = &iobuf;
+
+	rv = task_iobuf_alloc(task, iobuf_len, p_iobuf);
+	if (rv)
+		return -ENOMEM;
+
+	memset(iobuf, 0, iobuf_len);
+
+	offset = disk->offset + ((2 + host_id - 1) * sector_size);
+
+	dblock_mblock_sh_to_sector(token, pd, iobuf);
+
+	set_io_op(task, SANLK_IO_MBLOCK_WRITE);
 	rv = write_iobuf(disk->fd, offset, iobuf, iobuf_len, task, token->io_timeout, NULL);
 
 	if (rv < 0) {
@@ -209,7 +227,7 @@ static int write_dblock_mblock_sh(struct task *task,
 	}
 
 	if (rv != SANLK_AIO_TIMEOUT)
-		free(iobuf);
+		task_iobuf_free(task, iobuf);
 	return rv;
 }
 
@@ -240,11 +258,218 @@ static int write_dblock(struct task *task,
 	pd->checksum = checksum;
 	pd_end.checksum = cpu_to_le32(checksum);
 
+	set_io_op(task, SANLK_IO_DBLOCK_WRITE);
 	rv = write_sector(disk, token->sector_size, 2 + host_id - 1, (char *)&pd_end, sizeof(struct paxos_dblock),
 			  task, token->io_timeout, "dblock");
 	return rv;
 }
 
+/*
+ * Write our dblock to all disks at once, returning when a majority of
+ * the writes have completed instead of waiting for the slowest disk.
+ * written[d] is set for each disk the dblock was written to.  With one
+ * disk, the dblock is written directly without the group of ios.
+ */
+
+static int write_dblocks(struct task *task,
+			 struct token *token,
+			 struct paxos_dblock *pd,
+			 int *written,
+			 int *error)
+{
+	struct iobuf_io ios[SANLK_MAX_DISKS];
+	struct paxos_dblock pd_end;
+	struct sync_disk *disk;
+	char *iobuf, **p_iobuf;
+	uint32_t checksum;
+	int num_disks = token->r.num_disks;
+	int sector_size = token->sector_size;
+	int num_writes;
+	int d, rv;
+
+	if (!sector_size)
+		return 0;
+
+	if (num_disks == 1) {
+		rv = write_dblock(task, token, &token->disks[0], token->host_id, pd);
+		written[0] = !rv;
+		if (rv)
+			*error = rv;
+		return !rv;
+	}
+
+	for (d = 0; d < num_disks; d++) {
+		written[d] = 0;
+
+		p_iobuf = &iobuf;
+
+		rv = task_iobuf_alloc(task, sector_size, p_iobuf);
+		if (rv) {
+			num_disks = d;
+			*error = -ENOMEM;
+			break;
+		}
+
+		memset(iobuf, 0, sector_size);
+
+		if (!d && (token->flags & T_WRITE_DBLOCK_MBLOCK_SH)) {
+			/* special case to preserve our SH mode block within the dblock */
+			dblock_mblock_sh_to_sector(token, pd, iobuf);
+		} else if (!d) {
+			paxos_dblock_out(pd, &pd_end);
+
+			/*
+			 * N.B. must compute checksum after the data has been byte swapped.
+			 */
+			checksum = dblock_checksum(&pd_end);
+			pd->checksum = checksum;
+			pd_end.checksum = cpu_to_le32(checksum);
+
+			memcpy(iobuf, (char *)&pd_end, sizeof(struct paxos_dblock));
+		} else {
+			/* the same sector is written to each disk */
+			memcpy(iobuf, ios[0].iobuf, sector_size);
+		}
+
+		disk = &token->disks[d];
+
+		ios[d].fd = disk->fd;
+		ios[d].offset = disk->offset + ((2 + token->host_id - 1) * sector_size);
+		ios[d].iobuf = iobuf;
+		ios[d].iobuf_len = sector_size;
+		ios[d].rv = 0;
+	}
+
+	set_io_op(task, SANLK_IO_DBLOCK_WRITE);
+	num_writes = write_iobufs(ios, num_disks, (token->r.num_disks / 2) + 1,
+				  task, token->io_timeout);
+
+	for (d = 0; d < num_disks; d++) {
+		if (!ios[d].rv)
+			written[d] = 1;
+		else if (ios[d].rv != SANLK_AIO_TIMEOUT)
+			*error = ios[d].rv;
+		else if (!majority_disks(token->r.num_disks, num_writes))
+			*error = SANLK_AIO_TIMEOUT;
+
+		if (ios[d].rv != SANLK_AIO_TIMEOUT)
+			task_iobuf_free(task, ios[d].iobuf);
+	}
+
+	return num_writes;
+}
+
+/*
+ * Read the lease area from each disk our dblock was just written to,
+ * all at once, returning when a majority of the reads have completed.
+ * read_done[d] is set for each disk whose iobuf holds a completed read.
+ * iobuf[d] is cleared for a read that remains outstanding, its buffer
+ * is freed when the i/o is eventually reaped.  A disk whose
+ * iobuf was cleared this way (usually just because the majority completed
+ * first) is given a new iobuf when it's read again in a later phase,
+ * otherwise it would be left out of the rest of the ballot.  With one
+ * disk, the lease area is read directly into iobuf[0].
+ */
+
+static int read_dblocks(struct task *task,
+			struct token *token,
+			char **iobuf,
+			int iobuf_len,
+			int *written,
+			int *read_done,
+			int *error)
+{
+	struct iobuf_io ios[SANLK_MAX_DISKS];
+	int disk_num[SANLK_MAX_DISKS];
+	struct sync_disk *disk;
+	int num_disks = token->r.num_disks;
+	int num_reads, count = 0;
+	int split = 1;
+	int d, i, rv;
+
+	if (num_disks == 1) {
+		read_done[0] = 0;
+
+		if (!written[0])
+			return 0;
+
+		if (!iobuf[0] && task_iobuf_alloc(task, iobuf_len, &iobuf[0]))
+			return 0;
+
+		memset(iobuf[0], 0, iobuf_len);
+
+		disk = &token->disks[0];
+		split = io_tune_split(disk->fd, IO_TUNE_DBLOCK);
+
+		set_io_op(task, SANLK_IO_DBLOCK_READ);
+		rv = read_iobuf_split(disk->fd, disk->offset, iobuf[0], iobuf_len, split,
+				      task, token->io_timeout, NULL);
+
+		if (rv == SANLK_AIO_TIMEOUT && split == 1)
+			iobuf[0] = NULL;
+
+		if (rv) {
+			*error = rv;
+			return 0;
+		}
+		read_done[0] = 1;
+		return 1;
+	}
+
+	for (d = 0; d < num_disks; d++) {
+		read_done[d] = 0;
+
+		if (!written[d])
+			continue;
+
+		if (!iobuf[d] && task_iobuf_alloc(task, iobuf_len, &iobuf[d]))
+			continue;
+
+		memset(iobuf[d], 0, iobuf_len);
+
+		disk = &token->disks[d];
+
+		ios[count].fd = disk->fd;
+		ios[count].offset = disk->offset;
+		ios[count].iobuf = iobuf[d];
+		ios[count].iobuf_len = iobuf_len;
+		ios[count].rv = 0;
+		disk_num[count] = d;
+		count++;
+	}
+
+	if (!count)
+		return 0;
+
+	if (count == 1)
+		split = io_tune_split(ios[0].fd, IO_TUNE_DBLOCK);
+
+	set_io_op(task, SANLK_IO_DBLOCK_READ);
+	if (split > 1) {
+		ios[0].rv = read_iobuf_split(ios[0].fd, ios[0].offset, ios[0].iobuf,
+					     ios[0].iobuf_len, split, task,
+					     token->io_timeout, NULL);
+		num_reads = ios[0].rv ? 0 : 1;
+	} else {
+		num_reads = read_iobufs(ios, count, (num_disks / 2) + 1, task, token->io_timeout);
+	}
+
+	for (i = 0; i < count; i++) {
+		d = disk_num[i];
+
+		/* a split read does not leave iobuf to the aio */
+		if (ios[i].rv == SANLK_AIO_TIMEOUT && split == 1)
+			iobuf[d] = NULL;
+
+		if (!ios[i].rv)
+			read_done[d] = 1;
+		else
+			*error = ios[i].rv;
+	}
+
+	return num_reads;
+}
+
 static int write_leader(struct task *task,
 		        struct token *token,
 			struct sync_disk *disk,
@@ -263,6 +488,7 @@ static int write_leader(struct task *task,
 	lr->checksum = checksum;
 	lr_end.checksum = cpu_to_le32(checksum);
 
+	set_io_op(task, SANLK_IO_LEADER_WRITE);
 	rv = write_sector(disk, token->sector_size, 0, (char *)&lr_end, sizeof(struct leader_record),
 			  task, token->io_timeout, "leader");
 	return rv;
@@ -292,6 +518,7 @@ int paxos_lease_leader_clobber(struct task *task,
 	leader->checksum = checksum;
 	lr_end.checksum = cpu_to_le32(checksum);
 
+	set_io_op(task, SANLK_IO_LEADER_WRITE);
 	rv = write_sector(&token->disks[0], token->sector_size, 0, (char *)&lr_end, sizeof(struct leader_record),
 			  task, token->io_timeout, caller);
 	return rv;
@@ -308,6 +535,7 @@ static int read_dblock(struct task *task,
 
 	/* 1 leader block + 1 request block; host_id N is block offset N-1 */
 
+	set_io_op(task, SANLK_IO_DBLOCK_READ);
 	rv = read_sectors(disk, token->sector_size, 2 + host_id - 1, 1, (char *)&pd_end, sizeof(struct paxos_dblock),
 			  task, token->io_timeout, "dblock");
 
@@ -316,51 +544,113 @@ static int read_dblock(struct task *task,
 	return rv;
 }
 
-#if 0
-static int read_dblocks(struct task *task,
-			struct sync_disk *disk,
-			struct paxos_dblock *pds,
-			int pds_count)
+int paxos_blocks_alloc(struct paxos_blocks *pb, int num_hosts)
 {
-	struct paxos_dblock pd_end;
-	char *data;
-	int data_len, rv, i;
+	memset(pb, 0, sizeof(struct paxos_blocks));
 
-	data_len = pds_count * sector_size;
+	if (num_hosts <= 0)
+		return -EINVAL;
 
-	data = malloc(data_len);
-	if (!data) {
-		log_error("read_dblocks malloc %d %s", data_len, disk->path);
-		rv = -ENOMEM;
-		goto out;
+	pb->dblocks = malloc(num_hosts * sizeof(struct paxos_dblock));
+	pb->dblock_checksums = malloc(num_hosts * sizeof(uint32_t));
+	pb->mblocks = malloc(num_hosts * sizeof(struct mode_block));
+
+	if (!pb->dblocks || !pb->dblock_checksums || !pb->mblocks) {
+		paxos_blocks_free(pb);
+		return -ENOMEM;
 	}
 
-	/* 2 = 1 leader block + 1 request block */
+	pb->num_hosts = num_hosts;
+	return 0;
+}
 
-	rv = read_sectors(disk, token->sector_size, 2, pds_count, data, data_len,
-			  task, "dblocks");
-	if (rv < 0)
-		goto out_free;
+void paxos_blocks_free(struct paxos_blocks *pb)
+{
+	if (pb->dblocks)
+		free(pb->dblocks);
+	if (pb->dblock_checksums)
+		free(pb->dblock_checksums);
+	if (pb->mblocks)
+		free(pb->mblocks);
+	memset(pb, 0, sizeof(struct paxos_blocks));
+}
+
+/*
+ * iobuf holds the lease area as it is on disk, starting with the leader
+ * sector, followed by the request sector and then one sector per host
+ * containing the host's dblock and mode block.  The checksums are computed
+ * while the data is still in ondisk format.
+ */
+
+void paxos_blocks_parse(struct paxos_blocks *pb, char *iobuf, int sector_size)
+{
+	struct leader_record leader_end;
+	struct request_record rr_end;
+	struct paxos_dblock *bk_end;
+	struct mode_block *mb_end;
+	char *sector;
+	int q;
+
+	memcpy(&leader_end, iobuf, sizeof(struct leader_record));
+	pb->leader_checksum = leader_checksum(&leader_end);
+	leader_record_in(&leader_end, &pb->leader);
 
-	/* copy the first N bytes from each sector, where N is size of
-	   paxos_dblock */
+	memcpy(&rr_end, iobuf + sector_size, sizeof(struct request_record));
+	request_record_in(&rr_end, &pb->rr);
 
-	for (i = 0; i < pds_count; i++) {
-		memcpy(&pd_end, data + (i * sector_size),
-		       sizeof(struct paxos_dblock));
+	for (q = 0; q < pb->num_hosts; q++) {
+		sector = iobuf + ((2 + q) * sector_size);
 
-		paxos_dblock_in(&pd_end, &pd);
+		bk_end = (struct paxos_dblock *)sector;
+		pb->dblock_checksums[q] = dblock_checksum(bk_end);
+		paxos_dblock_in(bk_end, &pb->dblocks[q]);
 
-		memcpy(&pds[i], &pd, sizeof(struct paxos_dblock));
+		mb_end = (struct mode_block *)(sector + MBLOCK_OFFSET);
+		mode_block_in(mb_end, &pb->mblocks[q]);
 	}
+}
 
-	rv = 0;
- out_free:
-	free(data);
+/*
+ * Read the leader, request, and the dblocks and mode blocks of all
+ * pb->num_hosts hosts from one disk in a single i/o, instead of reading
+ * the sectors individually.
+ */
+
+int paxos_read_blocks(struct task *task,
+		      struct token *token,
+		      struct sync_disk *disk,
+		      struct paxos_blocks *pb)
+{
+	char *iobuf, **p_iobuf;
+	int iobuf_len, rv;
+
+	if (!token->sector_size || !pb->num_hosts) {
+		log_errot(token, "paxos_read_blocks with sector_size %d num_hosts %d",
+			  token->sector_size, pb->num_hosts);
+		return -EINVAL;
+	}
+
+	iobuf_len = (2 + pb->num_hosts) * token->sector_size;
+
+	p_iobuf = &iobuf;
+
+	rv = task_iobuf_alloc(task, iobuf_len, p_iobuf);
+	if (rv)
+		return -ENOMEM;
+
+	memset(iobuf, 0, iobuf_len);
+
+	set_io_op(task, SANLK_IO_LEADER_READ);
+	rv = read_iobuf(disk->fd, disk->offset, iobuf, iobuf_len, task, token->io_timeout, NULL);
+	if (rv < 0)
+		goto out;
+
+	paxos_blocks_parse(pb, iobuf, token->sector_size);
  out:
+	if (rv != SANLK_AIO_TIMEOUT)
+		task_iobuf_free(task, iobuf);
 	return rv;
 }
-#endif
 
 static int read_leader(struct task *task,
 		       struct token *token,
@@ -378,6 +668,7 @@ static int read_leader(struct task *task,
 
 	/* 0 = leader record is first sector */
 
+	set_io_op(task, SANLK_IO_LEADER_READ);
 	rv = read_sectors(disk, token->sector_size, 0, 1, (char *)&lr_end, sizeof(struct leader_record),
 			  task, token->io_timeout, "leader");
 
@@ -450,27 +741,92 @@ static int verify_dblock(struct token *token, struct paxos_dblock *pd, uint32_t
  *                                           host1 fail
  */
 
+/*
+ * The number of other hosts that have written a dblock for the same
+ * lver, i.e. are running a ballot with us.
+ */
+
+static int count_competitors(struct token *token, struct paxos_blocks *pb,
+			     int num_hosts, uint64_t lver)
+{
+	struct paxos_dblock *bk;
+	int q, count = 0;
+
+	for (q = 0; q < num_hosts; q++) {
+		if (q == (int)token->host_id - 1)
+			continue;
+		bk = &pb->dblocks[q];
+		if (bk->mbal && bk->lver == lver)
+			count++;
+	}
+	return count;
+}
+
+/*
+ * With one disk, the lease area read in phase 1 begins with the leader, so
+ * the leader does not need to be read separately before each ballot to see
+ * if another host has changed it.  The leader from the phase 1 read is
+ * compared with the one the ballot is based on, and if it differs, the
+ * ballot returns BALLOT_LEADER_CHANGED with the new leader, before writing
+ * anything in phase 2.
+ */
+
+#define BALLOT_LEADER_CHANGED 2 /* not an error, and not SANLK_OK */
+
+static int check_ballot_leader(struct token *token, struct paxos_blocks *pb,
+			       struct leader_record *leader, uint64_t next_lver)
+{
+	int rv;
+
+	rv = paxos_verify_leader(token, &token->disks[0], &pb->leader,
+				 pb->leader_checksum, "paxos_acquire");
+	if (rv < 0)
+		return rv;
+
+	if (!memcmp(&pb->leader, leader, sizeof(struct leader_record)))
+		return 0;
+
+	log_token(token, "ballot %llu phase1 leader changed %llu owner %llu %llu %llu",
+		  (unsigned long long)next_lver,
+		  (unsigned long long)pb->leader.lver,
+		  (unsigned long long)pb->leader.owner_id,
+		  (unsigned long long)pb->leader.owner_generation,
+		  (unsigned long long)pb->leader.timestamp);
+
+	memcpy(leader, &pb->leader, sizeof(struct leader_record));
+	return BALLOT_LEADER_CHANGED;
+}
+
+/*
+ * fast: skip phase 1 and run phase 2 with our_mbal and our own inp, see
+ * fast_ballot_ok().
+ *
+ * leader: when not NULL (one disk), checked in the phase 1 read, see
+ * check_ballot_leader().
+ */
+
 static int run_ballot(struct task *task, struct token *token, uint32_t flags,
 		      int num_hosts, uint64_t next_lver, uint64_t our_mbal,
-		      struct paxos_dblock *dblock_out)
+		      struct paxos_dblock *dblock_out, struct leader_record *leader,
+		      int *competitors, int fast)
 {
 	char bk_debug[BK_DEBUG_SIZE];
 	char bk_str[BK_STR_SIZE];
 	int bk_debug_count;
 	struct paxos_dblock dblock;
-	struct paxos_dblock bk_in;
 	struct paxos_dblock bk_max;
-	struct paxos_dblock *bk_end;
 	struct paxos_dblock *bk;
-	struct sync_disk *disk;
+	struct paxos_blocks pb;
 	char *iobuf[SANLK_MAX_DISKS];
 	char **p_iobuf[SANLK_MAX_DISKS];
-	uint32_t checksum;
+	int written[SANLK_MAX_DISKS];
+	int read_done[SANLK_MAX_DISKS];
 	int num_disks = token->r.num_disks;
 	int num_writes, num_reads;
 	int sector_size = token->sector_size;
 	int sector_count;
 	int iobuf_len;
+	uint64_t phase_begin;
 	int phase2 = 0;
 	int d, q, rv = 0;
 	int q_max = -1;
@@ -483,15 +839,47 @@ static int run_ballot(struct task *task, struct token *token, uint32_t flags,
 	if (!iobuf_len)
 		return -EINVAL;
 
+	memset(iobuf, 0, sizeof(iobuf));
+
+	/* the dblocks and mode blocks read from each disk are parsed into pb */
+
+	rv = paxos_blocks_alloc(&pb, num_hosts);
+	if (rv < 0)
+		return rv;
+
 	for (d = 0; d < num_disks; d++) {
 		p_iobuf[d] = &iobuf[d];
 
-		rv = posix_memalign((void *)p_iobuf[d], getpagesize(), iobuf_len);
-		if (rv)
-			return rv;
+		rv = task_iobuf_alloc(task, iobuf_len, p_iobuf[d]);
+		if (rv) {
+			for (d = 0; d < num_disks; d++) {
+				if (iobuf[d])
+					task_iobuf_free(task, iobuf[d]);
+			}
+			paxos_blocks_free(&pb);
+			return -ENOMEM;
+		}
 	}
 
 
+	if (fast) {
+		memset(&dblock, 0, sizeof(struct paxos_dblock));
+		dblock.mbal = our_mbal;
+		dblock.bal = our_mbal;
+		dblock.lver = next_lver;
+		dblock.inp = token->host_id;
+		dblock.inp2 = token->host_generation;
+		dblock.inp3 = monotime();
+		dblock.checksum = 0; /* set after paxos_dblock_out */
+
+		phase_begin = trace_begin();
+		num_reads = 0;
+		phase2 = 1;
+
+		log_token(token, "ballot %llu fast", (unsigned long long)next_lver);
+		goto phase2_write;
+	}
+
 	/*
 	 * phase 1
 	 *
@@ -514,15 +902,11 @@ static int run_ballot(struct task *task, struct token *token, uint32_t flags,
 
 	memset(&bk_max, 0, sizeof(struct paxos_dblock));
 
-	num_writes = 0;
+	phase_begin = trace_begin();
+	num_reads = 0;
 
-	for (d = 0; d < num_disks; d++) {
-		/* acquire io: write 1 */
-		rv = write_dblock(task, token, &token->disks[d], token->host_id, &dblock);
-		if (rv < 0)
-			continue;
-		num_writes++;
-	}
+	/* acquire io: write 1 */
+	num_writes = write_dblocks(task, token, &dblock, written, &rv);
 
 	if (!majority_disks(num_disks, num_writes)) {
 		log_errot(token, "ballot %llu dblock write error %d",
@@ -534,32 +918,27 @@ static int run_ballot(struct task *task, struct token *token, uint32_t flags,
 	memset(bk_debug, 0, sizeof(bk_debug));
 	bk_debug_count = 0;
 
-	num_reads = 0;
+	/* acquire io: read 2 */
+	num_reads = read_dblocks(task, token, iobuf, iobuf_len, written, read_done, &rv);
 
 	for (d = 0; d < num_disks; d++) {
-		disk = &token->disks[d];
-
-		if (!iobuf[d])
+		if (!read_done[d])
 			continue;
-		memset(iobuf[d], 0, iobuf_len);
 
-		/* acquire io: read 2 */
-		rv = read_iobuf(disk->fd, disk->offset, iobuf[d], iobuf_len, task, token->io_timeout, NULL);
-		if (rv == SANLK_AIO_TIMEOUT)
-			iobuf[d] = NULL;
-		if (rv < 0)
-			continue;
-		num_reads++;
-
-		for (q = 0; q < num_hosts; q++) {
-			bk_end = (struct paxos_dblock *)(iobuf[d] + ((2 + q)*sector_size));
+		paxos_blocks_parse(&pb, iobuf[d], sector_size);
 
-			checksum = dblock_checksum(bk_end);
+		if (leader) {
+			rv = check_ballot_leader(token, &pb, leader, next_lver);
+			if (rv) {
+				error = rv;
+				goto out;
+			}
+		}
 
-			paxos_dblock_in(bk_end, &bk_in);
-			bk = &bk_in;
+		for (q = 0; q < num_hosts; q++) {
+			bk = &pb.dblocks[q];
 
-			if (bk_in.mbal && ((flags & PAXOS_ACQUIRE_DEBUG_ALL) || (bk_in.lver >= dblock.lver))) {
+			if (bk->mbal && ((flags & PAXOS_ACQUIRE_DEBUG_ALL) || (bk->lver >= dblock.lver))) {
 				if (bk_debug_count >= BK_DEBUG_COUNT) {
 					log_token(token, "ballot %llu phase1 read %s",
 						  (unsigned long long)next_lver, bk_debug);
@@ -569,23 +948,23 @@ static int run_ballot(struct task *task, struct token *token, uint32_t flags,
 
 				memset(bk_str, 0, sizeof(bk_str));
 				snprintf(bk_str, BK_STR_SIZE, "%d:%llu:%llu:%llu:%llu:%llu:%llu:%x,", q,
-					 (unsigned long long)bk_in.mbal,
-					 (unsigned long long)bk_in.bal,
-					 (unsigned long long)bk_in.inp,
-					 (unsigned long long)bk_in.inp2,
-					 (unsigned long long)bk_in.inp3,
-					 (unsigned long long)bk_in.lver,
-					 bk_in.flags);
+					 (unsigned long long)bk->mbal,
+					 (unsigned long long)bk->bal,
+					 (unsigned long long)bk->inp,
+					 (unsigned long long)bk->inp2,
+					 (unsigned long long)bk->inp3,
+					 (unsigned long long)bk->lver,
+					 bk->flags);
 				bk_str[BK_STR_SIZE-1] = '\0';
 				strncat(bk_debug, bk_str, BK_STR_SIZE-1);
 				bk_debug_count++;
 			}
 
-			rv = verify_dblock(token, bk, checksum);
+			rv = verify_dblock(token, bk, pb.dblock_checksums[q]);
 			if (rv < 0)
 				continue;
 
-			check_mode_block(token, next_lver, q, (char *)bk_end);
+			check_mode_block(token, next_lver, q, &pb.mblocks[q]);
 
 			if (bk->lver < dblock.lver)
 				continue;
@@ -636,6 +1015,7 @@ static int run_ballot(struct task *task, struct token *token, uint32_t flags,
 				log_token(token, "ballot %llu phase1 read %s",
 					  (unsigned long long)next_lver, bk_debug);
 
+				*competitors = count_competitors(token, &pb, num_hosts, dblock.lver);
 				error = SANLK_DBLOCK_MBAL;
 				goto out;
 			}
@@ -717,25 +1097,24 @@ static int run_ballot(struct task *task, struct token *token, uint32_t flags,
 	 * Same description as phase 1, same sequence of writes/reads.
 	 */
 
+	trace_event(SANLK_TRACE_BALLOT_PHASE1, token->space_id, token->res_id,
+		    next_lver, num_reads, 0, phase_begin, 0);
+	OP_TIME_ADD(task, phase1_us, phase_begin);
+	phase_begin = trace_begin();
+	num_reads = 0;
 	phase2 = 1;
 
+ phase2_write:
 	log_token(token, "ballot %llu phase2 write bal %llu inp %llu %llu %llu q_max %d",
 		  (unsigned long long)dblock.lver,
 		  (unsigned long long)dblock.bal,
 		  (unsigned long long)dblock.inp,
 		  (unsigned long long)dblock.inp2,
 		  (unsigned long long)dblock.inp3,
-		  q_max);
-
-	num_writes = 0;
-
-	for (d = 0; d < num_disks; d++) {
-		/* acquire io: write 2 */
-		rv = write_dblock(task, token, &token->disks[d], token->host_id, &dblock);
-		if (rv < 0)
-			continue;
-		num_writes++;
-	}
+		  q_max);
+
+	/* acquire io: write 2 */
+	num_writes = write_dblocks(task, token, &dblock, written, &rv);
 
 	if (!majority_disks(num_disks, num_writes)) {
 		log_errot(token, "ballot %llu our dblock write2 error %d",
@@ -747,30 +1126,17 @@ static int run_ballot(struct task *task, struct token *token, uint32_t flags,
 	memset(bk_debug, 0, sizeof(bk_debug));
 	bk_debug_count = 0;
 
-	num_reads = 0;
+	/* acquire io: read 3 */
+	num_reads = read_dblocks(task, token, iobuf, iobuf_len, written, read_done, &rv);
 
 	for (d = 0; d < num_disks; d++) {
-		disk = &token->disks[d];
-
-		if (!iobuf[d])
+		if (!read_done[d])
 			continue;
-		memset(iobuf[d], 0, iobuf_len);
 
-		/* acquire io: read 3 */
-		rv = read_iobuf(disk->fd, disk->offset, iobuf[d], iobuf_len, task, token->io_timeout, NULL);
-		if (rv == SANLK_AIO_TIMEOUT)
-			iobuf[d] = NULL;
-		if (rv < 0)
-			continue;
-		num_reads++;
+		paxos_blocks_parse(&pb, iobuf[d], sector_size);
 
 		for (q = 0; q < num_hosts; q++) {
-			bk_end = (struct paxos_dblock *)(iobuf[d] + ((2 + q)*sector_size));
-
-			checksum = dblock_checksum(bk_end);
-
-			paxos_dblock_in(bk_end, &bk_in);
-			bk = &bk_in;
+			bk = &pb.dblocks[q];
 
 			if (bk->mbal && ((flags & PAXOS_ACQUIRE_DEBUG_ALL) || (bk->lver >= dblock.lver))) {
 				if (bk_debug_count >= BK_DEBUG_COUNT) {
@@ -794,13 +1160,37 @@ static int run_ballot(struct task *task, struct token *token, uint32_t flags,
 				bk_debug_count++;
 			}
 
-			rv = verify_dblock(token, bk, checksum);
+			rv = verify_dblock(token, bk, pb.dblock_checksums[q]);
 			if (rv < 0)
 				continue;
 
+			/* phase 1 is not run to see these */
+			if (fast)
+				check_mode_block(token, next_lver, q, &pb.mblocks[q]);
+
 			if (bk->lver < dblock.lver)
 				continue;
 
+			/*
+			 * Another host running a ballot for next_lver uses a
+			 * larger mbal than ours, which is caught below, so this
+			 * is not expected.  Without phase 1 we cannot choose its
+			 * inp, so leave it to a full ballot.
+			 */
+			if (fast && (q != (int)token->host_id - 1) &&
+			    (bk->lver == dblock.lver) && (bk->mbal <= dblock.mbal)) {
+				log_warnt(token, "ballot %llu abort fast bk[%d] %llu:%llu:%llu:%llu:%llu:%llu",
+					  (unsigned long long)next_lver, q,
+					  (unsigned long long)bk->mbal,
+					  (unsigned long long)bk->bal,
+					  (unsigned long long)bk->inp,
+					  (unsigned long long)bk->inp2,
+					  (unsigned long long)bk->inp3,
+					  (unsigned long long)bk->lver);
+				error = SANLK_DBLOCK_LVER;
+				goto out;
+			}
+
 			if (bk->lver > dblock.lver) {
 				/*
 				 * This happens when we choose another host's bk, that host
@@ -855,6 +1245,7 @@ static int run_ballot(struct task *task, struct token *token, uint32_t flags,
 				log_token(token, "ballot %llu phase2 read %s",
 					  (unsigned long long)next_lver, bk_debug);
 
+				*competitors = count_competitors(token, &pb, num_hosts, dblock.lver);
 				error = SANLK_DBLOCK_MBAL;
 				goto out;
 			}
@@ -876,11 +1267,21 @@ static int run_ballot(struct task *task, struct token *token, uint32_t flags,
 	memcpy(dblock_out, &dblock, sizeof(struct paxos_dblock));
 	error = SANLK_OK;
  out:
+	trace_event(phase2 ? SANLK_TRACE_BALLOT_PHASE2 : SANLK_TRACE_BALLOT_PHASE1,
+		    token->space_id, token->res_id, next_lver, num_reads, 0,
+		    phase_begin, error);
+	if (phase2)
+		OP_TIME_ADD(task, phase2_us, phase_begin);
+	else
+		OP_TIME_ADD(task, phase1_us, phase_begin);
+
+	paxos_blocks_free(&pb);
+
 	for (d = 0; d < num_disks; d++) {
 		/* don't free iobufs that have timed out */
 		if (!iobuf[d])
 			continue;
-		free(iobuf[d]);
+		task_iobuf_free(task, iobuf[d]);
 	}
 
 	if (phase2 && (error < 0) &&
@@ -1163,13 +1564,18 @@ int paxos_read_buf(struct task *task,
 
 	p_iobuf = &iobuf;
 
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
+	rv = task_iobuf_alloc(task, iobuf_len, p_iobuf);
 	if (rv)
 		return rv;
 
 	memset(iobuf, 0, iobuf_len);
 
-	rv = read_iobuf(disk->fd, disk->offset, iobuf, iobuf_len, task, token->io_timeout, NULL);
+	set_io_op(task, SANLK_IO_LEADER_READ);
+	if (task && task->read_shared)
+		rv = read_flight(disk->path, disk->fd, disk->offset, iobuf, iobuf_len,
+				 task, token->io_timeout);
+	else
+		rv = read_iobuf(disk->fd, disk->offset, iobuf, iobuf_len, task, token->io_timeout, NULL);
 
 	*buf_out = iobuf;
 
@@ -1206,16 +1612,24 @@ static int _leader_read_num(struct task *task,
 			    struct leader_record *leader_ret,
 			    const char *caller)
 {
+	struct iobuf_io ios[SANLK_MAX_DISKS];
 	struct leader_record leader;
+	struct leader_record leader_end;
 	struct leader_record *leaders;
+	char *iobuf, **p_iobuf;
 	uint32_t checksum;
 	int *leader_reps;
 	int leaders_len, leader_reps_len;
-	int num_reads;
+	int num_reads, num_iobufs;
 	int num_disks = token->r.num_disks;
 	int rv = 0, d, i, found;
 	int error;
 
+	if (!token->sector_size) {
+		log_errot(token, "paxos leader_read_num with zero sector_size");
+		return -EINVAL;
+	}
+
 	leaders_len = num_disks * sizeof(struct leader_record);
 	leader_reps_len = num_disks * sizeof(int);
 
@@ -1238,13 +1652,41 @@ static int _leader_read_num(struct task *task,
 	memset(leaders, 0, leaders_len);
 	memset(leader_reps, 0, leader_reps_len);
 
-	num_reads = 0;
+	/* read the leader from all disks at once */
 
 	for (d = 0; d < num_disks; d++) {
-		rv = read_leader(task, token, &token->disks[d], &leaders[d], &checksum);
+		p_iobuf = &iobuf;
+
+		rv = task_iobuf_alloc(task, token->sector_size, p_iobuf);
+		if (rv) {
+			rv = -ENOMEM;
+			break;
+		}
+		memset(iobuf, 0, token->sector_size);
+
+		ios[d].fd = token->disks[d].fd;
+		ios[d].offset = token->disks[d].offset;
+		ios[d].iobuf = iobuf;
+		ios[d].iobuf_len = token->sector_size;
+		ios[d].rv = 0;
+	}
+	num_iobufs = d;
+
+	set_io_op(task, SANLK_IO_LEADER_READ);
+	read_iobufs(ios, num_iobufs, num_iobufs, task, token->io_timeout);
+
+	num_reads = 0;
+
+	for (d = 0; d < num_iobufs; d++) {
+		rv = ios[d].rv;
 		if (rv < 0)
 			continue;
 
+		/* N.B. checksum is computed while the data is in ondisk format. */
+		memcpy(&leader_end, ios[d].iobuf, sizeof(struct leader_record));
+		checksum = leader_checksum(&leader_end);
+		leader_record_in(&leader_end, &leaders[d]);
+
 		rv = verify_leader(token, &token->disks[d], &leaders[d], checksum, caller);
 		if (rv < 0)
 			continue;
@@ -1293,6 +1735,10 @@ static int _leader_read_num(struct task *task,
 
 	error = SANLK_OK;
  out:
+	for (d = 0; d < num_iobufs; d++) {
+		if (ios[d].rv != SANLK_AIO_TIMEOUT)
+			task_iobuf_free(task, ios[d].iobuf);
+	}
 	memcpy(leader_ret, &leader, sizeof(struct leader_record));
 	free(leaders);
 	free(leader_reps);
@@ -1340,14 +1786,14 @@ static int _lease_read_one(struct task *task,
 	int bk_debug_count;
 	struct leader_record leader_end;
 	struct paxos_dblock our_dblock_end;
-	struct paxos_dblock bk;
+	struct paxos_dblock bk_in, *bk;
 	char *iobuf, **p_iobuf;
 	uint32_t host_id = token->host_id;
 	uint32_t sector_size = token->sector_size;
 	uint32_t checksum;
 	struct paxos_dblock *bk_end;
 	uint64_t tmp_mbal = 0;
-	int q, tmp_q = -1, rv, iobuf_len;
+	int q, tmp_q = -1, rv, iobuf_len, split;
 
 	iobuf_len = token->align_size;
 	if (iobuf_len < 0)
@@ -1355,13 +1801,16 @@ static int _lease_read_one(struct task *task,
 
 	p_iobuf = &iobuf;
 
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
+	rv = task_iobuf_alloc(task, iobuf_len, p_iobuf);
 	if (rv)
 		return rv;
 
 	memset(iobuf, 0, iobuf_len);
 
-	rv = read_iobuf(disk->fd, disk->offset, iobuf, iobuf_len, task, token->io_timeout, NULL);
+	split = io_tune_split(disk->fd, IO_TUNE_DBLOCK);
+
+	set_io_op(task, SANLK_IO_DBLOCK_READ);
+	rv = read_iobuf_split(disk->fd, disk->offset, iobuf, iobuf_len, split, task, token->io_timeout, NULL);
 	if (rv < 0)
 		goto out;
 
@@ -1386,10 +1835,10 @@ static int _lease_read_one(struct task *task,
 
 		checksum = dblock_checksum(bk_end);
 
-		paxos_dblock_in(bk_end, &bk);
+		bk = paxos_dblock_ref(bk_end, &bk_in);
 
-		if (log_bk_vals && bk.mbal &&
-		    ((flags & PAXOS_ACQUIRE_DEBUG_ALL) || (bk.lver >= leader_ret->lver))) {
+		if (log_bk_vals && bk->mbal &&
+		    ((flags & PAXOS_ACQUIRE_DEBUG_ALL) || (bk->lver >= leader_ret->lver))) {
 			if (bk_debug_count >= BK_DEBUG_COUNT) {
 				log_token(token, "leader %llu dblocks %s",
 					  (unsigned long long)leader_ret->lver, bk_debug);
@@ -1399,24 +1848,24 @@ static int _lease_read_one(struct task *task,
 
 			memset(bk_str, 0, sizeof(bk_str));
 			snprintf(bk_str, BK_STR_SIZE, "%d:%llu:%llu:%llu:%llu:%llu:%llu:%x,", q,
-				 (unsigned long long)bk.mbal,
-				 (unsigned long long)bk.bal,
-				 (unsigned long long)bk.inp,
-				 (unsigned long long)bk.inp2,
-				 (unsigned long long)bk.inp3,
-				 (unsigned long long)bk.lver,
-				 bk.flags);
+				 (unsigned long long)bk->mbal,
+				 (unsigned long long)bk->bal,
+				 (unsigned long long)bk->inp,
+				 (unsigned long long)bk->inp2,
+				 (unsigned long long)bk->inp3,
+				 (unsigned long long)bk->lver,
+				 bk->flags);
 			bk_str[BK_STR_SIZE-1] = '\0';
 			strncat(bk_debug, bk_str, BK_STR_SIZE-1);
 			bk_debug_count++;
 		}
 
-		rv = verify_dblock(token, &bk, checksum);
+		rv = verify_dblock(token, bk, checksum);
 		if (rv < 0)
 			goto out;
 
-		if (!tmp_mbal || bk.mbal > tmp_mbal) {
-			tmp_mbal = bk.mbal;
+		if (!tmp_mbal || bk->mbal > tmp_mbal) {
+			tmp_mbal = bk->mbal;
 			tmp_q = q;
 		}
 	}
@@ -1432,8 +1881,8 @@ static int _lease_read_one(struct task *task,
 			  bk_debug);
 
  out:
-	if (rv != SANLK_AIO_TIMEOUT)
-		free(iobuf);
+	if (rv != SANLK_AIO_TIMEOUT || split > 1)
+		task_iobuf_free(task, iobuf);
 	return rv;
 }
 
@@ -1548,11 +1997,15 @@ static int _lease_read_num(struct task *task,
 
 static int paxos_lease_read(struct task *task, struct token *token, uint32_t flags,
 			    struct leader_record *leader_ret,
-			    uint64_t *max_mbal, const char *caller, int log_bk_vals)
+			    struct paxos_dblock *our_dblock_ret,
+			    uint64_t *max_mbal, int *max_q,
+			    const char *caller, int log_bk_vals)
 {
 	struct paxos_dblock our_dblock;
 	int rv, q = -1;
 
+	memset(&our_dblock, 0, sizeof(our_dblock));
+
 	if (token->r.num_disks > 1)
 		rv = _lease_read_num(task, token, flags,
 				     leader_ret, &our_dblock, max_mbal, &q, caller);
@@ -1577,6 +2030,8 @@ static int paxos_lease_read(struct task *task, struct token *token, uint32_t fla
 			  (unsigned long long)our_dblock.inp3,
 			  (unsigned long long)our_dblock.lver);
 
+	memcpy(our_dblock_ret, &our_dblock, sizeof(struct paxos_dblock));
+	*max_q = q;
 	return rv;
 }
 
@@ -1585,6 +2040,7 @@ static int write_new_leader(struct task *task,
 			    struct leader_record *nl,
 			    const char *caller)
 {
+	uint64_t begin = trace_begin();
 	int num_disks = token->r.num_disks;
 	int num_writes = 0;
 	int timeout = 0;
@@ -1600,6 +2056,8 @@ static int write_new_leader(struct task *task,
 		num_writes++;
 	}
 
+	OP_TIME_ADD(task, commit_us, begin);
+
 	if (!majority_disks(num_disks, num_writes)) {
 		log_errot(token, "%s write_new_leader error %d timeout %d owner %llu %llu %llu",
 			  caller, rv, timeout,
@@ -1616,6 +2074,105 @@ static int write_new_leader(struct task *task,
 	return SANLK_OK;
 }
 
+/*
+ * Backoff after a ballot is aborted by another host's ballot, or before
+ * retrying a shared lease that another host holds ex briefly.  Instead of
+ * a fixed random delay of up to 1 second, the window starts at the time
+ * that recent ballots on the resource have taken, multiplied by the
+ * number of hosts seen competing, and doubles with each retry, up to
+ * PAXOS_BACKOFF_MAX_US.  The delay is chosen at random from the upper
+ * half of the window, so competing hosts spread out without any of them
+ * retrying immediately.
+ */
+
+#define PAXOS_BACKOFF_MIN_US	1000
+#define PAXOS_BACKOFF_MAX_US	2000000
+#define PAXOS_BACKOFF_SHIFT_MAX	10
+
+/*
+ * We are the owner committed in the current lver, by a ballot whose dblock
+ * is still ours and has the largest mbal.  Any other host that runs a
+ * ballot for the next lver reads the leader after that ballot, so it uses
+ * an mbal larger than ours.  Our phase 1 with our mbal then still holds
+ * for the next lver, the same as a multi-paxos leader reusing its ballot,
+ * and we can run phase 2 with it directly.  Phase 2 still reads all the
+ * dblocks, and aborts on a larger mbal, after which a full ballot is run.
+ */
+
+static int fast_ballot_ok(struct token *token, struct leader_record *leader,
+			  struct paxos_dblock *our_dblock, uint64_t max_mbal, int max_q)
+{
+	if (leader->owner_id != token->host_id ||
+	    leader->owner_generation != token->host_generation)
+		return 0;
+
+	if (leader->flags & LFL_HANDOFF)
+		return 0;
+
+	if (max_q != (int)token->host_id - 1 || our_dblock->mbal != max_mbal)
+		return 0;
+
+	if (our_dblock->lver != leader->lver ||
+	    our_dblock->bal != our_dblock->mbal ||
+	    our_dblock->inp != token->host_id ||
+	    our_dblock->inp2 != token->host_generation)
+		return 0;
+
+	return 1;
+}
+
+int paxos_backoff_us(struct token *token, int retries, int competitors)
+{
+	struct resource *r = token->resource;
+	uint64_t window;
+	int us;
+
+	window = r ? r->ballot_us : 0;
+	if (window < PAXOS_BACKOFF_MIN_US)
+		window = PAXOS_BACKOFF_MIN_US;
+
+	window *= (competitors > 0) ? competitors + 1 : 2;
+
+	if (retries > PAXOS_BACKOFF_SHIFT_MAX)
+		retries = PAXOS_BACKOFF_SHIFT_MAX;
+	window <<= retries;
+
+	if (window > PAXOS_BACKOFF_MAX_US)
+		window = PAXOS_BACKOFF_MAX_US;
+
+	us = get_rand(window / 2, window);
+	if (us < 0)
+		us = window / 2 + token->host_id % (window / 2);
+
+	if (r) {
+		__atomic_add_fetch(&r->backoff_count, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&r->backoff_us, us, __ATOMIC_RELAXED);
+	}
+	return us;
+}
+
+/* the ballot time kept in the resource is a moving average */
+
+static void ballot_stats(struct token *token, uint64_t us, int error)
+{
+	struct resource *r = token->resource;
+
+	if (!r)
+		return;
+
+	__atomic_add_fetch(&r->ballots, 1, __ATOMIC_RELAXED);
+	if (error == SANLK_DBLOCK_MBAL || error == SANLK_DBLOCK_LVER)
+		__atomic_add_fetch(&r->ballot_aborts, 1, __ATOMIC_RELAXED);
+
+	if (us > UINT32_MAX)
+		us = UINT32_MAX;
+
+	if (!r->ballot_us)
+		r->ballot_us = us;
+	else
+		r->ballot_us = (uint32_t)(((uint64_t)r->ballot_us * 7 + us) / 8);
+}
+
 /*
  * If we hang or crash after completing a ballot successfully, but before
  * commiting the leader_record, then the next host that runs a ballot (with the
@@ -1642,6 +2199,14 @@ static int write_new_leader(struct task *task,
  * 	write_new_leader()	1 write  512 bytes (1 leader sector)
  *
  * 				6 i/os = 3 1MB reads, 3 512 byte writes
+ *
+ * When the lease was last acquired by us (fast_ballot_ok) and
+ * paxos_fast_ballot is set, run_ballot() skips phase 1:
+ * 4 i/os = 2 1MB reads, 2 512 byte writes
+ *
+ * With one disk, a retried ballot checks the leader in its phase 1 read
+ * instead of reading it first, and the dblock writes and reads are done
+ * directly rather than in groups of ios across disks.
  */
 
 int paxos_lease_acquire(struct task *task,
@@ -1658,9 +2223,10 @@ int paxos_lease_acquire(struct task *task,
 	struct leader_record tmp_leader;
 	struct leader_record new_leader;
 	struct paxos_dblock dblock;
+	struct paxos_dblock our_dblock;
 	struct paxos_dblock owner_dblock;
-	struct host_status hs;
-	uint64_t wait_start, now;
+	struct host_status hs, hs_new;
+	uint64_t wait_start, deadline, now;
 	uint64_t last_timestamp;
 	uint64_t next_lver;
 	uint64_t max_mbal;
@@ -1668,6 +2234,14 @@ int paxos_lease_acquire(struct task *task,
 	uint64_t our_mbal;
 	int copy_cur_leader;
 	int disk_open = 0;
+	uint64_t ballot_begin;
+	uint64_t owner_wait_begin = 0;
+	uint64_t read_begin;
+	int ballot_retries = 0;
+	int competitors;
+	int check_leader;
+	int max_q;
+	int fast;
 	int error, rv, us;
 	int align_size;
 	int ls_sector_size;
@@ -1685,14 +2259,25 @@ int paxos_lease_acquire(struct task *task,
 	}
 
  restart:
+	if (owner_wait_begin) {
+		OP_TIME_ADD(task, owner_wait_us, owner_wait_begin);
+		owner_wait_begin = 0;
+	}
+
 	memset(&tmp_leader, 0, sizeof(tmp_leader));
 	copy_cur_leader = 0;
 
 	/* acquire io: read 1 */
-	error = paxos_lease_read(task, token, flags, &cur_leader, &max_mbal, "paxos_acquire", 1);
+	read_begin = trace_begin();
+	error = paxos_lease_read(task, token, flags, &cur_leader, &our_dblock,
+				 &max_mbal, &max_q, "paxos_acquire", 1);
+	OP_TIME_ADD(task, leader_read_us, read_begin);
 	if (error < 0)
 		goto out;
 
+	fast = com.paxos_fast_ballot && !(flags & PAXOS_ACQUIRE_FORCE) &&
+	       fast_ballot_ok(token, &cur_leader, &our_dblock, max_mbal, max_q);
+
 	align_size = leader_align_size_from_flag(cur_leader.flags);
 	if (!align_size)
 		align_size = sector_size_to_align_size_old(cur_leader.sector_size);
@@ -1733,6 +2318,51 @@ int paxos_lease_acquire(struct task *task,
 		goto run;
 	}
 
+	/*
+	 * The previous owner handed the lease to us (paxos_lease_handoff),
+	 * committing us as owner of the current lver.  Other hosts see us as
+	 * the live owner, so taking it only requires rewriting the leader as
+	 * our own.
+	 */
+
+	if ((cur_leader.flags & LFL_HANDOFF) &&
+	    !(flags & PAXOS_ACQUIRE_SHARED) &&
+	    cur_leader.owner_id == token->host_id &&
+	    cur_leader.owner_generation == token->host_generation) {
+		memcpy(&new_leader, &cur_leader, sizeof(struct leader_record));
+		new_leader.timestamp = monotime();
+		new_leader.write_id = token->host_id;
+		new_leader.write_generation = token->host_generation;
+		new_leader.write_timestamp = new_leader.timestamp;
+		new_leader.flags &= ~(LFL_HANDOFF | LFL_SHORT_HOLD);
+		new_leader.checksum = 0; /* set after leader_record_out */
+
+		error = write_new_leader(task, token, &new_leader, "paxos_acquire");
+		if (error < 0) {
+			memcpy(leader_ret, &cur_leader, sizeof(struct leader_record));
+			goto out;
+		}
+
+		/* our dblock is rewritten from this copy on release; with
+		   one disk it was read with cur_leader */
+		if (token->r.num_disks == 1)
+			memcpy(&dblock, &our_dblock, sizeof(struct paxos_dblock));
+		else if (read_dblock(task, token, &token->disks[0], token->host_id, &dblock) < 0)
+			memset(&dblock, 0, sizeof(dblock));
+
+		log_token(token, "paxos_acquire %llu handoff owner %llu %llu %llu",
+			  (unsigned long long)new_leader.lver,
+			  (unsigned long long)new_leader.owner_id,
+			  (unsigned long long)new_leader.owner_generation,
+			  (unsigned long long)new_leader.timestamp);
+
+		metrics_add(token->space_id, METRIC_HANDOFFS, 1);
+		memcpy(leader_ret, &new_leader, sizeof(struct leader_record));
+		memcpy(dblock_ret, &dblock, sizeof(struct paxos_dblock));
+		error = SANLK_OK;
+		goto out;
+	}
+
 	if (cur_leader.owner_id == token->host_id &&
 	    cur_leader.owner_generation == token->host_generation) {
 		log_token(token, "paxos_acquire owner %llu %llu %llu is already local %llu %llu",
@@ -1789,6 +2419,8 @@ int paxos_lease_acquire(struct task *task,
 		disk_open = 1;
 	}
 
+	owner_wait_begin = trace_begin();
+
 	rv = host_info(cur_leader.space_name, cur_leader.owner_id, &hs);
 	if (!rv && hs.last_check && hs.last_live &&
 	    hs.owner_id == cur_leader.owner_id &&
@@ -1948,8 +2580,29 @@ int paxos_lease_acquire(struct task *task,
 		}
 
  skip_live_check:
-		/* TODO: test with sleep(2) here */
-		sleep(1);
+		/*
+		 * Our lockspace thread reads the owner's delta lease at each
+		 * renewal, so wake up when it has done that again rather than
+		 * only polling.  The wait is still limited to a second so the
+		 * leader is reread as often as before, and the owner is
+		 * declared dead only after reading it ourself.
+		 */
+		if (hs.last_check) {
+			deadline = wait_start + calc_host_dead_seconds(hs.io_timeout) + 1;
+			now = monotime();
+			if (deadline > now + 1)
+				deadline = now + 1;
+
+			rv = host_info_wait(cur_leader.space_name, cur_leader.owner_id,
+					    hs.last_check, deadline, &hs_new);
+			if (!rv && hs_new.owner_id == cur_leader.owner_id &&
+			    hs_new.owner_generation == cur_leader.owner_generation)
+				memcpy(&hs, &hs_new, sizeof(struct host_status));
+			else if (rv != -ETIMEDOUT)
+				hs.last_check = 0;
+		} else {
+			sleep(1);
+		}
 
 		if (external_shutdown) {
 			error = -1;
@@ -1976,10 +2629,16 @@ int paxos_lease_acquire(struct task *task,
 				  (unsigned long long)tmp_leader.owner_id,
 				  (unsigned long long)tmp_leader.owner_generation,
 				  (unsigned long long)tmp_leader.timestamp);
+			OP_COUNT_ADD(task, retries);
 			goto restart;
 		}
 	}
  run:
+	if (owner_wait_begin) {
+		OP_TIME_ADD(task, owner_wait_us, owner_wait_begin);
+		owner_wait_begin = 0;
+	}
+
 	/*
 	 * Use the disk paxos algorithm to attempt to commit a new leader.
 	 *
@@ -1991,8 +2650,9 @@ int paxos_lease_acquire(struct task *task,
 	 * We need to monitor the leader record to see if another host commits
 	 * a new leader_record with next_lver.
 	 *
-	 * TODO: may not need to increase mbal if dblock.inp and inp2 match
-	 * current host_id and generation?
+	 * If we are the owner of the current lver and our dblock has the
+	 * largest mbal, the first ballot reuses our mbal and skips phase 1
+	 * when paxos_fast_ballot is set, see fast_ballot_ok().
 	 */
 
 	/* This next_lver assignment is based on the original cur_leader, not a
@@ -2002,7 +2662,9 @@ int paxos_lease_acquire(struct task *task,
 
 	next_lver = cur_leader.lver + 1;
 
-	if (!max_mbal) {
+	if (fast) {
+		our_mbal = max_mbal;
+	} else if (!max_mbal) {
 		our_mbal = token->host_id;
 	} else {
 		num_mbal = max_mbal - (max_mbal % cur_leader.max_hosts);
@@ -2011,17 +2673,26 @@ int paxos_lease_acquire(struct task *task,
 
  retry_ballot:
 
+	/* a fast ballot has no phase 1 read in which to check the leader */
+	check_leader = (token->r.num_disks == 1) && !fast;
+
 	if (copy_cur_leader) {
 		/* reusing the initial read removes an iop in the common case */
 		copy_cur_leader = 0;
 		memcpy(&tmp_leader, &cur_leader, sizeof(struct leader_record));
+	} else if (check_leader) {
+		/* run_ballot reads the leader with the dblocks */
+		memcpy(&tmp_leader, &cur_leader, sizeof(struct leader_record));
 	} else {
 		/* acquire io: read 1 (for retry) */
+		read_begin = trace_begin();
 		error = paxos_lease_leader_read(task, token, &tmp_leader, "paxos_acquire");
+		OP_TIME_ADD(task, leader_read_us, read_begin);
 		if (error < 0)
 			goto out;
 	}
 
+ leader_check:
 	if (tmp_leader.lver == next_lver) {
 		/*
 		 * another host has commited a leader_record for next_lver,
@@ -2076,6 +2747,7 @@ int paxos_lease_acquire(struct task *task,
 			  (unsigned long long)tmp_leader.owner_id,
 			  (unsigned long long)tmp_leader.owner_generation,
 			  (unsigned long long)tmp_leader.timestamp);
+		OP_COUNT_ADD(task, retries);
 		goto restart;
 	}
 
@@ -2089,18 +2761,38 @@ int paxos_lease_acquire(struct task *task,
 			  (unsigned long long)tmp_leader.owner_id,
 			  (unsigned long long)tmp_leader.owner_generation,
 			  (unsigned long long)tmp_leader.timestamp);
+		OP_COUNT_ADD(task, retries);
 		goto restart;
 	}
 
-	error = run_ballot(task, token, flags, cur_leader.num_hosts, next_lver, our_mbal, &dblock);
+	competitors = 0;
+	ballot_begin = trace_begin();
+
+	error = run_ballot(task, token, flags, cur_leader.num_hosts, next_lver, our_mbal,
+			   &dblock, check_leader ? &tmp_leader : NULL, &competitors, fast);
+
+	ballot_stats(token, trace_begin() - ballot_begin, error);
+
+	metrics_add(token->space_id, METRIC_BALLOTS, 1);
+	OP_COUNT_ADD(task, ballots);
+	if (fast)
+		metrics_add(token->space_id, METRIC_FAST_BALLOTS, 1);
+	if (error == SANLK_DBLOCK_MBAL)
+		metrics_add(token->space_id, METRIC_MBAL_ABORTS, 1);
+
+	/* only the first ballot can be fast, retries use a larger mbal */
+	fast = 0;
+
+	if (error == BALLOT_LEADER_CHANGED)
+		goto leader_check;
 
 	if ((error == SANLK_DBLOCK_MBAL) || (error == SANLK_DBLOCK_LVER)) {
-		us = get_rand(0, 1000000);
-		if (us < 0)
-			us = token->host_id * 100;
+		metrics_add(token->space_id, METRIC_BALLOT_RETRIES, 1);
+		OP_COUNT_ADD(task, retries);
+		us = paxos_backoff_us(token, ballot_retries++, competitors);
 
-		log_token(token, "paxos_acquire %llu retry delay %d us",
-			  (unsigned long long)next_lver, us);
+		log_token(token, "paxos_acquire %llu retry delay %d us competitors %d",
+			  (unsigned long long)next_lver, us, competitors);
 
 		usleep(us);
 		our_mbal += cur_leader.max_hosts;
@@ -2184,6 +2876,9 @@ int paxos_lease_acquire(struct task *task,
 	error = SANLK_OK;
 
  out:
+	if (owner_wait_begin)
+		OP_TIME_ADD(task, owner_wait_us, owner_wait_begin);
+
 	if (disk_open)
 		close_disks(&host_id_disk, 1);
 
@@ -2235,9 +2930,11 @@ int paxos_lease_release(struct task *task,
 {
 	struct leader_record leader;
 	struct leader_record *last;
+	uint64_t read_begin = trace_begin();
 	int error;
 
 	error = paxos_lease_leader_read(task, token, &leader, "paxos_release");
+	OP_TIME_ADD(task, leader_read_us, read_begin);
 	if (error < 0) {
 		log_errot(token, "paxos_release leader_read error %d", error);
 		goto out;
@@ -2407,22 +3104,133 @@ int paxos_lease_release(struct task *task,
 	return error;
 }
 
-int paxos_lease_init(struct task *task,
-		     struct token *token,
-		     int num_hosts, int write_clear)
+/*
+ * Release without reading the leader first, when the caller knows that
+ * leader_last, which we wrote, is still on disk (see release_leader_cached).
+ * The caller writes our released dblock after this, not before, so no
+ * other host can have taken the lease and written a newer leader that
+ * this would overwrite.  If another host finished the same ballot and
+ * rewrote leader_last as its writer, this frees the same lver, which is
+ * also what that host's leader becomes once our dblock is released.
+ */
+
+int paxos_lease_release_cached(struct task *task,
+			       struct token *token,
+			       struct sanlk_resource *resrename,
+			       struct leader_record *leader_last,
+			       struct leader_record *leader_ret)
+{
+	struct leader_record leader;
+	int error;
+
+	if (leader_last->write_id != token->host_id ||
+	    leader_last->owner_id != token->host_id ||
+	    leader_last->owner_generation != token->host_generation ||
+	    leader_last->timestamp == LEASE_FREE)
+		return -EINVAL;
+
+	memcpy(&leader, leader_last, sizeof(struct leader_record));
+
+	if (resrename)
+		memcpy(leader.resource_name, resrename->name, NAME_ID_SIZE);
+
+	leader.timestamp = LEASE_FREE;
+	leader.write_id = token->host_id;
+	leader.write_generation = token->host_generation;
+	leader.write_timestamp = monotime();
+	leader.flags &= ~LFL_SHORT_HOLD;
+	leader.checksum = 0; /* set after leader_record_out */
+
+	error = write_new_leader(task, token, &leader, "paxos_release_cached");
+	if (error < 0)
+		return error;
+
+	memcpy(leader_ret, &leader, sizeof(struct leader_record));
+	return SANLK_OK;
+}
+
+/*
+ * Instead of freeing the leader on release, commit next_lver with the
+ * requesting host as owner (SANLK_REQ_HANDOFF).  As the owner, we are the
+ * only host that may write the leader, so no ballot is needed to pick the
+ * next owner.  The new owner is also written as the writer so that other
+ * hosts treat the leader as written by the owner and do not look for a
+ * released dblock of the new owner (which may be left from an earlier
+ * release).  LFL_HANDOFF tells the new owner that it can take the lease
+ * by rewriting the leader without a ballot.  Returns 0 on success or an
+ * error, after which the caller falls back to a normal release.
+ */
+
+int paxos_lease_handoff(struct task *task,
+			struct token *token,
+			struct leader_record *leader_last,
+			uint64_t owner_id, uint64_t owner_generation,
+			uint64_t next_lver,
+			struct leader_record *leader_ret)
+{
+	struct leader_record leader;
+	int error;
+
+	error = paxos_lease_leader_read(task, token, &leader, "paxos_handoff");
+	if (error < 0) {
+		log_errot(token, "paxos_handoff leader_read error %d", error);
+		return error;
+	}
+
+	if (leader.write_id != token->host_id ||
+	    leader.lver + 1 != next_lver ||
+	    memcmp(&leader, leader_last, sizeof(struct leader_record))) {
+		log_warnt(token, "paxos_handoff skip disk lver %llu owner %llu %llu writer %llu next_lver %llu",
+			  (unsigned long long)leader.lver,
+			  (unsigned long long)leader.owner_id,
+			  (unsigned long long)leader.owner_generation,
+			  (unsigned long long)leader.write_id,
+			  (unsigned long long)next_lver);
+		return SANLK_RELEASE_OWNER;
+	}
+
+	leader.lver = next_lver;
+	leader.owner_id = owner_id;
+	leader.owner_generation = owner_generation;
+	leader.timestamp = monotime();
+	leader.write_id = owner_id;
+	leader.write_generation = owner_generation;
+	leader.write_timestamp = leader.timestamp;
+	leader.flags &= ~LFL_SHORT_HOLD;
+	leader.flags |= LFL_HANDOFF;
+	leader.checksum = 0; /* set after leader_record_out */
+
+	error = write_new_leader(task, token, &leader, "paxos_handoff");
+	if (error < 0)
+		return error;
+
+	log_token(token, "paxos_handoff lver %llu to owner %llu %llu",
+		  (unsigned long long)next_lver,
+		  (unsigned long long)owner_id,
+		  (unsigned long long)owner_generation);
+
+	memcpy(leader_ret, &leader, sizeof(struct leader_record));
+	return SANLK_OK;
+}
+
+/*
+ * Fill in the on-disk image of a new lease (or a cleared lease with
+ * write_clear) in buf, which is one zeroed align_size area.  Sets the
+ * token sector_size and align_size.
+ */
+
+int paxos_lease_init_buf(struct token *token, int num_hosts, int write_clear, char *buf)
 {
-	char *iobuf, **p_iobuf;
 	struct leader_record leader;
 	struct leader_record leader_end;
 	struct request_record rr;
 	struct request_record rr_end;
 	uint32_t checksum;
-	int iobuf_len;
 	int sector_size = 0;
 	int align_size = 0;
 	int max_hosts = 0;
-	int aio_timeout = 0;
-	int rv, d;
+	int lvb_size;
+	int rv;
 
 	rv = sizes_from_flags(token->r.flags, &sector_size, &align_size, &max_hosts, "RES");
 	if (rv)
@@ -2438,19 +3246,18 @@ int paxos_lease_init(struct task *task,
 	if (!num_hosts || (num_hosts > max_hosts))
 		num_hosts = max_hosts;
 
+	/* the lvb region must fit in the lease area after LVB_SECTOR */
+	lvb_size = sanlk_res_lvb_flag_to_size(token->r.flags);
+	if (lvb_size && (lvb_size % sector_size ||
+			 (LVB_SECTOR * sector_size) + lvb_size > align_size)) {
+		log_error("paxos_lease_init lvb size %d does not fit sector_size %d align_size %d",
+			  lvb_size, sector_size, align_size);
+		return -EINVAL;
+	}
+
 	token->sector_size = sector_size;
 	token->align_size = align_size;
 
-	iobuf_len = align_size;
-
-	p_iobuf = &iobuf;
-
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
-	if (rv)
-		return rv;
-
-	memset(iobuf, 0, iobuf_len);
-
 	memset(&leader, 0, sizeof(leader));
 
 	if (write_clear) {
@@ -2463,6 +3270,7 @@ int paxos_lease_init(struct task *task,
 	leader.timestamp = LEASE_FREE;
 	leader.version = PAXOS_DISK_VERSION_MAJOR | PAXOS_DISK_VERSION_MINOR;
 	leader.flags = leader_align_flag_from_size(align_size);
+	leader.flags |= leader_lvb_flag_from_size(lvb_size);
 	leader.sector_size = sector_size;
 	leader.num_hosts = num_hosts;
 	leader.max_hosts = max_hosts;
@@ -2485,8 +3293,49 @@ int paxos_lease_init(struct task *task,
 
 	request_record_out(&rr, &rr_end);
 
-	memcpy(iobuf, &leader_end, sizeof(struct leader_record));
-	memcpy(iobuf + sector_size, &rr_end, sizeof(struct request_record));
+	memcpy(buf, &leader_end, sizeof(struct leader_record));
+	memcpy(buf + sector_size, &rr_end, sizeof(struct request_record));
+
+	return 0;
+}
+
+int paxos_lease_init(struct task *task,
+		     struct token *token,
+		     int num_hosts, int write_clear)
+{
+	char *iobuf, **p_iobuf;
+	int iobuf_len;
+	int sector_size = 0;
+	int align_size = 0;
+	int max_hosts = 0;
+	int aio_timeout = 0;
+	int rv, d;
+
+	rv = sizes_from_flags(token->r.flags, &sector_size, &align_size, &max_hosts, "RES");
+	if (rv)
+		return rv;
+
+	if (!sector_size) {
+		/* sector/align flags were not set, use historical defaults */
+		sector_size = token->disks[0].sector_size;
+		align_size = sector_size_to_align_size_old(sector_size);
+	}
+
+	iobuf_len = align_size;
+
+	p_iobuf = &iobuf;
+
+	rv = task_iobuf_alloc(task, iobuf_len, p_iobuf);
+	if (rv)
+		return rv;
+
+	memset(iobuf, 0, iobuf_len);
+
+	rv = paxos_lease_init_buf(token, num_hosts, write_clear, iobuf);
+	if (rv < 0) {
+		task_iobuf_free(task, iobuf);
+		return rv;
+	}
 
 	for (d = 0; d < token->r.num_disks; d++) {
 		rv = write_iobuf(token->disks[d].fd, token->disks[d].offset,
@@ -2496,12 +3345,13 @@ int paxos_lease_init(struct task *task,
 			aio_timeout = 1;
 
 		if (rv < 0)
-			return rv;
+			goto out;
 	}
-
+	rv = 0;
+ out:
 	if (!aio_timeout)
-		free(iobuf);
+		task_iobuf_free(task, iobuf);
 
-	return 0;
+	return rv;
 }
 
@@ -15,6 +15,20 @@
 #define PAXOS_ACQUIRE_OWNER_NOWAIT	0x00000008
 #define PAXOS_ACQUIRE_DEBUG_ALL		0x00000010
 
+/*
+ * The leader, request, and the dblock and mode block of each host,
+ * parsed from a single read of the lease area.
+ */
+struct paxos_blocks {
+	int num_hosts;
+	uint32_t leader_checksum;
+	struct leader_record leader;
+	struct request_record rr;
+	struct paxos_dblock *dblocks;
+	uint32_t *dblock_checksums;
+	struct mode_block *mblocks;
+};
+
 uint32_t leader_checksum(struct leader_record *lr);
 
 uint32_t dblock_checksum(struct paxos_dblock *pd);
@@ -24,6 +38,9 @@ int paxos_lease_leader_read(struct task *task,
 			    struct leader_record *leader_ret,
 			    const char *caller);
 
+/* usec to wait before retrying a ballot or shared acquire */
+int paxos_backoff_us(struct token *token, int retries, int competitors);
+
 int paxos_lease_acquire(struct task *task,
 			struct token *token,
 			uint32_t flags,
@@ -38,10 +55,25 @@ int paxos_lease_release(struct task *task,
 			struct leader_record *leader_last,
 			struct leader_record *leader_ret);
 
+int paxos_lease_release_cached(struct task *task,
+			       struct token *token,
+			       struct sanlk_resource *resrename,
+			       struct leader_record *leader_last,
+			       struct leader_record *leader_ret);
+
+int paxos_lease_handoff(struct task *task,
+			struct token *token,
+			struct leader_record *leader_last,
+			uint64_t owner_id, uint64_t owner_generation,
+			uint64_t next_lver,
+			struct leader_record *leader_ret);
+
 int paxos_lease_init(struct task *task,
 		     struct token *token,
 		     int num_hosts, int write_clear);
 
+int paxos_lease_init_buf(struct token *token, int num_hosts, int write_clear, char *buf);
+
 int paxos_lease_request_read(struct task *task, struct token *token,
                              struct request_record *rr);
 
@@ -56,6 +88,17 @@ int paxos_read_buf(struct task *task,
                    struct token *token,
                    char **buf_out);
 
+int paxos_blocks_alloc(struct paxos_blocks *pb, int num_hosts);
+
+void paxos_blocks_free(struct paxos_blocks *pb);
+
+void paxos_blocks_parse(struct paxos_blocks *pb, char *iobuf, int sector_size);
+
+int paxos_read_blocks(struct task *task,
+		      struct token *token,
+		      struct sync_disk *disk,
+		      struct paxos_blocks *pb);
+
 int paxos_verify_leader(struct token *token,
                          struct sync_disk *disk,
                          struct leader_record *lr,
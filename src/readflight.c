@@ -0,0 +1,212 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <syslog.h>
+
+#include "sanlock_internal.h"
+#include "diskio.h"
+#include "log.h"
+#include "hash.h"
+#include "trace.h"
+#include "iostats.h"
+#include "readflight.h"
+
+/*
+ * The first read of a path, offset and length adds a flight and does the
+ * i/o without holding flight_mutex.  Reads of the same that arrive before
+ * it's done wait on flight_cond and copy its result.  The flight is freed
+ * when the last of them is done, unless read_cache_ms is set, in which
+ * case it's kept with the data until it's older than read_cache_ms, so
+ * that reads which follow closely also use it.
+ *
+ * Commands that read the disk for their own purposes (acquire, release,
+ * lockspace renewals) don't set read_shared and always read the disk.
+ */
+
+#define FLIGHT_HASH_SIZE 64	/* power of 2 */
+#define FLIGHT_CACHE_MAX 256	/* completed flights kept for read_cache_ms */
+
+struct flight {
+	struct list_head list;
+	char path[SANLK_PATH_LEN];
+	uint64_t offset;
+	int len;
+	int waiters;		/* reads waiting for or copying the result */
+	int done;
+	int result;
+	uint64_t done_us;	/* trace_begin() */
+	char *data;		/* len bytes when result is 0 */
+};
+
+static struct list_head flight_hash[FLIGHT_HASH_SIZE];
+static int flight_hash_setup;
+static int flight_cached_count;
+static struct read_flight_stats flight_stats;
+static pthread_mutex_t flight_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flight_cond = PTHREAD_COND_INITIALIZER;
+
+static struct list_head *flight_head(const char *path, uint64_t offset, int len)
+{
+	uint32_t h;
+	int i;
+
+	if (!flight_hash_setup) {
+		for (i = 0; i < FLIGHT_HASH_SIZE; i++)
+			INIT_LIST_HEAD(&flight_hash[i]);
+		flight_hash_setup = 1;
+	}
+
+	h = name_hash(path, SANLK_PATH_LEN);
+	h ^= id_hash((uint32_t)(offset >> 9) ^ (uint32_t)len);
+
+	return &flight_hash[h & (FLIGHT_HASH_SIZE - 1)];
+}
+
+static void flight_free(struct flight *f)
+{
+	list_del(&f->list);
+	if (f->done)
+		flight_cached_count--;
+	free(f->data);
+	free(f);
+}
+
+static int flight_expired(struct flight *f, uint64_t now)
+{
+	if (f->result || !com.read_cache_ms)
+		return 1;
+	return now - f->done_us > (uint64_t)com.read_cache_ms * 1000;
+}
+
+/* called with flight_mutex; frees the flights that can't be used again */
+
+static struct flight *flight_find(struct list_head *head, const char *path,
+				  uint64_t offset, int len, uint64_t now)
+{
+	struct flight *f, *safe, *found = NULL;
+
+	list_for_each_entry_safe(f, safe, head, list) {
+		if (f->done && !f->waiters && flight_expired(f, now)) {
+			flight_free(f);
+			continue;
+		}
+		if (f->offset != offset || f->len != len)
+			continue;
+		if (strncmp(f->path, path, SANLK_PATH_LEN))
+			continue;
+		if (f->done && flight_expired(f, now))
+			continue;
+		found = f;
+	}
+	return found;
+}
+
+/* called with flight_mutex */
+
+static int flight_copy(struct flight *f, char *iobuf)
+{
+	int rv = f->result;
+
+	if (!rv)
+		memcpy(iobuf, f->data, f->len);
+	else if (rv == SANLK_AIO_TIMEOUT)
+		rv = -ETIMEDOUT;
+
+	return rv;
+}
+
+int read_flight(const char *path, int fd, uint64_t offset, char *iobuf, int iobuf_len,
+		struct task *task, int ioto)
+{
+	struct list_head *head;
+	struct flight *f;
+	uint64_t now;
+	int rv;
+
+	if (!com.read_coalesce)
+		return read_iobuf(fd, offset, iobuf, iobuf_len, task, ioto, NULL);
+
+	now = trace_begin();
+
+	pthread_mutex_lock(&flight_mutex);
+	head = flight_head(path, offset, iobuf_len);
+	f = flight_find(head, path, offset, iobuf_len, now);
+
+	if (f && f->done) {
+		rv = flight_copy(f, iobuf);
+		flight_stats.cached++;
+		pthread_mutex_unlock(&flight_mutex);
+		set_io_op(task, 0);
+		return rv;
+	}
+
+	if (f) {
+		f->waiters++;
+		flight_stats.shared++;
+		while (!f->done)
+			pthread_cond_wait(&flight_cond, &flight_mutex);
+		rv = flight_copy(f, iobuf);
+		f->waiters--;
+		if (!f->waiters && flight_expired(f, trace_begin()))
+			flight_free(f);
+		pthread_mutex_unlock(&flight_mutex);
+		set_io_op(task, 0);
+		return rv;
+	}
+
+	f = calloc(1, sizeof(struct flight));
+	if (!f) {
+		pthread_mutex_unlock(&flight_mutex);
+		return read_iobuf(fd, offset, iobuf, iobuf_len, task, ioto, NULL);
+	}
+	strncpy(f->path, path, SANLK_PATH_LEN - 1);
+	f->offset = offset;
+	f->len = iobuf_len;
+	list_add(&f->list, head);
+	flight_stats.reads++;
+	pthread_mutex_unlock(&flight_mutex);
+
+	rv = read_iobuf(fd, offset, iobuf, iobuf_len, task, ioto, NULL);
+
+	pthread_mutex_lock(&flight_mutex);
+	f->result = rv;
+	if (!rv) {
+		f->data = malloc(iobuf_len);
+		if (f->data)
+			memcpy(f->data, iobuf, iobuf_len);
+		else
+			f->result = -ENOMEM;
+	}
+	f->done = 1;
+	f->done_us = trace_begin();
+	flight_cached_count++;
+	pthread_cond_broadcast(&flight_cond);
+
+	if (!f->waiters &&
+	    (flight_expired(f, f->done_us) || flight_cached_count > FLIGHT_CACHE_MAX))
+		flight_free(f);
+	pthread_mutex_unlock(&flight_mutex);
+
+	return rv;
+}
+
+void read_flight_get_stats(struct read_flight_stats *st)
+{
+	pthread_mutex_lock(&flight_mutex);
+	memcpy(st, &flight_stats, sizeof(struct read_flight_stats));
+	pthread_mutex_unlock(&flight_mutex);
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#ifndef __READFLIGHT_H__
+#define __READFLIGHT_H__
+
+/*
+ * Reads done for read-only queries from programs (read_lockspace,
+ * read_resource, read_resource_owners) set task->read_shared, and the
+ * reads are done by read_flight instead of read_iobuf.  Concurrent reads
+ * of the same path, offset and length share one i/o, and with
+ * read_cache_ms the result is also returned to reads that follow within
+ * that time.
+ */
+
+struct read_flight_stats {
+	uint64_t reads;		/* i/os done */
+	uint64_t shared;	/* reads that waited for another's i/o */
+	uint64_t cached;	/* reads returned from a recent i/o */
+};
+
+/* like read_iobuf; a shared read that times out returns -ETIMEDOUT, and
+   SANLK_AIO_TIMEOUT (iobuf still in use) only for the task doing the i/o */
+
+int read_flight(const char *path, int fd, uint64_t offset, char *iobuf, int iobuf_len,
+		struct task *task, int ioto);
+
+void read_flight_get_stats(struct read_flight_stats *st);
+
+#endif
@@ -24,6 +24,7 @@
 #include <sys/time.h>
 
 #include "sanlock_internal.h"
+#include "sanlock_admin.h"
 #include "diskio.h"
 #include "ondisk.h"
 #include "log.h"
@@ -31,24 +32,44 @@
 #include "lockspace.h"
 #include "resource.h"
 #include "task.h"
+#include "iostats.h"
+#include "metrics.h"
+#include "snapshot.h"
+#include "hash.h"
 #include "timeouts.h"
 #include "helper.h"
+#include "sanlock_sock.h"
+#include "trace.h"
+#include "sizeflags.h"
+#include "crc32c.h"
+#include "slab.h"
+#include "affinity.h"
 
 /* from cmd.c */
 void send_state_resource(int fd, struct resource *r, const char *list_name, int pid, uint32_t token_id);
 
-/* from main.c */
-int get_rand(int a, int b);
+/*
+ * A pool of resource threads (com.resource_threads), each with its own
+ * work flags so that one thread finding nothing to do doesn't clear the
+ * work of another.
+ */
+
+struct resource_worker {
+	pthread_t thread;
+	int index;
+	int work;
+	int work_examine;
+};
 
-static pthread_t resource_pt;
+static struct resource_worker resource_workers[MAX_RESOURCE_THREADS];
+static int resource_worker_count;
 static int resource_thread_stop;
-static int resource_thread_work;
-static int resource_thread_work_examine;
 static struct list_head resources_free;
 static struct list_head resources_held;
 static struct list_head resources_add;
 static struct list_head resources_rem;
 static struct list_head resources_orphan;
+static struct list_head resources_lazy;
 static pthread_mutex_t resource_mutex;
 static pthread_cond_t resource_cond;
 static struct list_head host_events;
@@ -57,6 +78,108 @@ static uint32_t resource_id_counter = 2; /* id 1 used for internal rindex lease
 
 #define FREE_RES_COUNT 128
 
+/* caller holds resource_mutex */
+
+static void resource_thread_wake(int examine)
+{
+	int i;
+
+	for (i = 0; i < resource_worker_count; i++) {
+		resource_workers[i].work = 1;
+		if (examine)
+			resource_workers[i].work_examine = 1;
+	}
+	pthread_cond_broadcast(&resource_cond);
+}
+
+/*
+ * Resources on the add, held, rem, orphan and lazy lists are also in
+ * resource_hash, by lockspace and resource name, so find_resource
+ * doesn't walk the lists.  on_list is the list the resource is on.
+ * A name is on at most one of those lists at a time.  Resources on the
+ * free list are not in the hash.  All under resource_mutex.
+ */
+
+#define RESOURCE_HASH_SIZE 4096 /* power of 2 */
+
+static struct list_head resource_hash[RESOURCE_HASH_SIZE];
+
+static struct list_head *resource_hash_head(const char *space_name, const char *res_name)
+{
+	uint32_t h = resource_name_hash(space_name, res_name);
+
+	return &resource_hash[h & (RESOURCE_HASH_SIZE - 1)];
+}
+
+/*
+ * Resources on the orphan list are also in orphan_hash by lockspace name,
+ * so counting, releasing or purging the orphans of one lockspace looks at
+ * that lockspace's orphans instead of every orphan.  Adopting an orphan
+ * finds it by name in resource_hash.
+ */
+
+#define ORPHAN_HASH_SIZE 256 /* power of 2 */
+
+static struct list_head orphan_hash[ORPHAN_HASH_SIZE];
+
+static struct list_head *orphan_hash_head(const char *space_name)
+{
+	return &orphan_hash[name_hash(space_name, NAME_ID_SIZE) & (ORPHAN_HASH_SIZE - 1)];
+}
+
+static void res_orphan_update(struct resource *r, struct list_head *head)
+{
+	if (r->on_list == &resources_orphan && head != &resources_orphan)
+		list_del(&r->orphan_list);
+	else if (r->on_list != &resources_orphan && head == &resources_orphan)
+		list_add_tail(&r->orphan_list, orphan_hash_head(r->r.lockspace_name));
+}
+
+static void res_list_add(struct resource *r, struct list_head *head)
+{
+	list_add(&r->list, head);
+	list_add(&r->hash_list, resource_hash_head(r->r.lockspace_name, r->r.name));
+	res_orphan_update(r, head);
+	r->on_list = head;
+}
+
+static void res_list_move(struct resource *r, struct list_head *head)
+{
+	list_move(&r->list, head);
+	if (!r->on_list)
+		list_add(&r->hash_list, resource_hash_head(r->r.lockspace_name, r->r.name));
+	res_orphan_update(r, head);
+	r->on_list = head;
+}
+
+static void res_list_del(struct resource *r)
+{
+	list_del(&r->list);
+	if (r->on_list) {
+		res_orphan_update(r, NULL);
+		list_del(&r->hash_list);
+		r->on_list = NULL;
+	}
+}
+
+static struct resource *find_resource_name(const char *space_name,
+					   const char *res_name,
+					   struct list_head *head)
+{
+	struct resource *r;
+
+	list_for_each_entry(r, resource_hash_head(space_name, res_name), hash_list) {
+		if (r->on_list != head)
+			continue;
+		if (strncmp(r->r.lockspace_name, space_name, NAME_ID_SIZE))
+			continue;
+		if (strncmp(r->r.name, res_name, NAME_ID_SIZE))
+			continue;
+		return r;
+	}
+	return NULL;
+}
+
 /*
  * There's not much advantage to saving resource structs and reusing them again
  * when they are requested again.  One advantage can be that the res_id remains
@@ -71,8 +194,21 @@ static void free_resource(struct resource *r)
 	struct resource *rtmp = NULL;
 	struct resource *rmin = NULL;
 
-	if (r->lvb)
+	/* with lvb_cache, an lvb that matches the disk is kept for the next
+	   acquire of the same resource, see acquire_token */
+
+	if (r->lvb_cache) {
+		free(r->lvb_cache);
+		r->lvb_cache = NULL;
+	}
+
+	if (r->lvb && com.lvb_cache && r->lvb_lver && !(r->flags & R_LVB_WRITE_RELEASE)) {
+		r->lvb_cache = r->lvb;
+		r->lvb = NULL;
+	} else if (r->lvb) {
 		free(r->lvb);
+		r->lvb = NULL;
+	}
 
 	if (resources_free_count < FREE_RES_COUNT) {
 		resources_free_count++;
@@ -85,7 +221,8 @@ static void free_resource(struct resource *r)
 	list_for_each_entry_reverse(rtmp, &resources_free, list) {
 		if (!rtmp->reused) {
 			list_del(&rtmp->list);
-			free(rtmp);
+			free(rtmp->lvb_cache);
+			slab_free(rtmp);
 			goto out;
 		}
 
@@ -95,7 +232,8 @@ static void free_resource(struct resource *r)
 
 	if (rmin) {
 		list_del(&rmin->list);
-		free(rmin);
+		free(rmin->lvb_cache);
+		slab_free(rmin);
 	}
  out:
 	list_add(&r->list, &resources_free);
@@ -151,7 +289,46 @@ void send_state_resources(int fd)
 
 	list_for_each_entry(r, &resources_orphan, list)
 		send_state_resource(fd, r, "orphan", r->pid, 0);
+
+	list_for_each_entry(r, &resources_lazy, list)
+		send_state_resource(fd, r, "lazy", r->pid, 0);
+	pthread_mutex_unlock(&resource_mutex);
+}
+
+/* copy the held resources for the state snapshot, one record per token */
+
+int resource_state(char *buf, int maxlen, int *count)
+{
+	struct sanlk_state_resource *sr;
+	struct resource *r;
+	struct token *token;
+	int len = 0, num = 0, rv = 0;
+
+	pthread_mutex_lock(&resource_mutex);
+	list_for_each_entry(r, &resources_held, list) {
+		list_for_each_entry(token, &r->tokens, list) {
+			if (len + (int)sizeof(struct sanlk_state_resource) > maxlen) {
+				rv = -ENOSPC;
+				goto out;
+			}
+
+			sr = (struct sanlk_state_resource *)(buf + len);
+			memset(sr, 0, sizeof(struct sanlk_state_resource));
+			memcpy(sr->lockspace_name, r->r.lockspace_name, NAME_ID_SIZE);
+			memcpy(sr->name, r->r.name, NAME_ID_SIZE);
+			sr->lver = r->leader.lver;
+			sr->pid = token->pid;
+			if (r->flags & R_SHARED)
+				sr->flags |= SANLK_RES_SHARED;
+
+			len += sizeof(struct sanlk_state_resource);
+			num++;
+		}
+	}
+ out:
 	pthread_mutex_unlock(&resource_mutex);
+	*count = num;
+	return rv;
 }
 
 int read_resource_owners(struct task *task, struct token *token,
@@ -160,13 +337,12 @@ int read_resource_owners(struct task *task, struct token *token,
 {
 	struct leader_record leader;
 	struct leader_record leader_end;
-	struct mode_block mb;
+	struct paxos_blocks pb;
+	struct mode_block *mb;
 	struct sync_disk *disk;
 	struct sanlk_host *host;
-	struct mode_block *mb_end;
 	uint64_t host_id;
 	uint32_t checksum;
-	char *lease_buf_dblock;
 	char *lease_buf = NULL;
 	char *hosts_buf = NULL;
 	int align_size;
@@ -175,6 +351,8 @@ int read_resource_owners(struct task *task, struct token *token,
 
 	disk = &token->disks[0];
 
+	memset(&pb, 0, sizeof(pb));
+
 	/*
 	 * We don't know the sector_size of the resource until the leader
 	 * record has been read, start with the smaller size.
@@ -185,14 +363,13 @@ int read_resource_owners(struct task *task, struct token *token,
 		token->align_size = sector_size_to_align_size_old(512);
 	}
 
-	/* we could in-line paxos_read_buf here like we do in read_mode_block */
  retry:
 	rv = paxos_read_buf(task, token, &lease_buf);
 	if (rv < 0) {
 		log_errot(token, "read_resource_owners read_buf rv %d", rv);
 
 		if (lease_buf && (rv != SANLK_AIO_TIMEOUT))
-			free(lease_buf);
+			task_iobuf_free(task, lease_buf);
 		return rv;
 	}
 
@@ -212,7 +389,7 @@ int read_resource_owners(struct task *task, struct token *token,
 		log_debug("read_resource_owners rereading with correct sizses");
 		token->sector_size = leader.sector_size;
 		token->align_size  = align_size;
-		free(lease_buf);
+		task_iobuf_free(task, lease_buf);
 		lease_buf = NULL;
 		goto retry;
 	}
@@ -226,18 +403,23 @@ int read_resource_owners(struct task *task, struct token *token,
 
 	res->lver = leader.lver;
 
+	if (leader.num_hosts) {
+		rv = paxos_blocks_alloc(&pb, leader.num_hosts);
+		if (rv < 0)
+			goto out;
+
+		paxos_blocks_parse(&pb, lease_buf, token->sector_size);
+	}
+
 	if (leader.timestamp && leader.owner_id)
 		host_count++;
 
-	for (i = 0; i < leader.num_hosts; i++) {
-		lease_buf_dblock = lease_buf + ((2 + i) * token->sector_size);
-		mb_end = (struct mode_block *)(lease_buf_dblock + MBLOCK_OFFSET);
-
-		mode_block_in(mb_end, &mb);
+	for (i = 0; i < pb.num_hosts; i++) {
+		mb = &pb.mblocks[i];
 
 		host_id = i + 1;
 
-		if (!(mb.flags & MBLOCK_SHARED))
+		if (!(mb->flags & MBLOCK_SHARED))
 			continue;
 
 		res->flags |= SANLK_RES_SHARED;
@@ -281,51 +463,44 @@ int read_resource_owners(struct task *task, struct token *token,
 		host++;
 	}
 
-	for (i = 0; i < leader.num_hosts; i++) {
-		lease_buf_dblock = lease_buf + ((2 + i) * token->sector_size);
-		mb_end = (struct mode_block *)(lease_buf_dblock + MBLOCK_OFFSET);
-
-		mode_block_in(mb_end, &mb);
+	for (i = 0; i < pb.num_hosts; i++) {
+		mb = &pb.mblocks[i];
 
 		host_id = i + 1;
 
-		if (!(mb.flags & MBLOCK_SHARED))
+		if (!(mb->flags & MBLOCK_SHARED))
 			continue;
 
 		if (leader.timestamp && leader.owner_id && (host_id == leader.owner_id))
 			continue;
 
 		host->host_id = host_id;
-		host->generation = mb.generation;
+		host->generation = mb->generation;
 		host++;
 	}
 	rv = 0;
  out:
 	*send_len = host_count * sizeof(struct sanlk_host);
 	*send_buf = hosts_buf;
-	free(lease_buf);
+	paxos_blocks_free(&pb);
+	task_iobuf_free(task, lease_buf);
 	return rv;
 }
 
 /* return 1 (is alive) to force a failure if we don't have enough
-   knowledge to know it's really not alive.  Later we could have this sit and
+   knowledge to know it's really not alive, hs_in is from host_info.  Later we could have this sit and
    wait (like paxos_lease_acquire) until we have waited long enough or have
    enough knowledge to say it's safely dead (unless of course we find it is
    alive while waiting) */
 
-static int host_live(char *lockspace_name, uint32_t space_id, uint64_t host_id, uint64_t gen)
+static int host_status_live(uint32_t space_id, uint64_t host_id, uint64_t gen,
+			    struct host_status *hs_in)
 {
 	struct host_status hs;
 	uint64_t now;
 	int other_io_timeout, other_host_dead_seconds;
-	int rv;
 
-	rv = host_info(lockspace_name, host_id, &hs);
-	if (rv) {
-		log_sid(space_id, "host_live %llu %llu yes host_info %d",
-			(unsigned long long)host_id, (unsigned long long)gen, rv);
-		return 1;
-	}
+	memcpy(&hs, hs_in, sizeof(hs));
 
 	if (!hs.last_check) {
 		log_sid(space_id, "host_live %llu %llu yes unchecked",
@@ -374,21 +549,14 @@ static int host_live(char *lockspace_name, uint32_t space_id, uint64_t host_id,
 	return 1;
 }
 
-void check_mode_block(struct token *token, uint64_t next_lver, int q, char *dblock_buf)
+void check_mode_block(struct token *token, uint64_t next_lver, int q, struct mode_block *mb)
 {
-	struct mode_block *mb_end;
-	struct mode_block mb;
-
-	mb_end = (struct mode_block *)(dblock_buf + MBLOCK_OFFSET);
-
-	mode_block_in(mb_end, &mb);
-
-	if (mb.flags & MBLOCK_SHARED) {
+	if (mb->flags & MBLOCK_SHARED) {
 		set_id_bit(q + 1, token->shared_bitmap, NULL);
 		token->shared_count++;
 		log_token(token, "ballot %llu mode[%d] shared %d gen %llu",
 			  (unsigned long long)next_lver, q, token->shared_count,
-			  (unsigned long long)mb.generation);
+			  (unsigned long long)mb->generation);
 	}
 }
 
@@ -414,7 +582,7 @@ static int write_host_block(struct task *task, struct token *token,
 
 	p_iobuf = &iobuf;
 
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
+	rv = task_iobuf_alloc(task, iobuf_len, p_iobuf);
 	if (rv)
 		return -ENOMEM;
 
@@ -463,6 +631,7 @@ static int write_host_block(struct task *task, struct token *token,
 
 		offset = disk->offset + ((2 + host_id - 1) * token->sector_size);
 
+		set_io_op(task, SANLK_IO_MBLOCK_WRITE);
 		rv = write_iobuf(disk->fd, offset, iobuf, iobuf_len, task, token->io_timeout, NULL);
 		if (rv < 0)
 			break;
@@ -490,87 +659,84 @@ static int write_host_block(struct task *task, struct token *token,
 	}
 
 	if (rv != SANLK_AIO_TIMEOUT)
-		free(iobuf);
+		task_iobuf_free(task, iobuf);
 	return rv;
 }
 
 static int write_mblock_zero_dblock_release(struct task *task, struct token *token)
 {
 	struct paxos_dblock dblock;
+	uint64_t begin = trace_begin();
+	int rv;
 
 	memcpy(&dblock, &token->resource->dblock, sizeof(dblock));
 
 	dblock.flags = DBLOCK_FL_RELEASED;
 
-	return write_host_block(task, token, token->host_id, 0, 0, &dblock);
+	rv = write_host_block(task, token, token->host_id, 0, 0, &dblock);
+	OP_TIME_ADD(task, commit_us, begin);
+	return rv;
 }
 
 static int write_mblock_shared_dblock_release(struct task *task, struct token *token)
 {
 	struct paxos_dblock dblock;
+	uint64_t begin = trace_begin();
+	int rv;
 
 	memcpy(&dblock, &token->resource->dblock, sizeof(dblock));
 
 	dblock.flags = DBLOCK_FL_RELEASED;
 
-	return write_host_block(task, token, token->host_id, token->host_generation,
-				MBLOCK_SHARED, &dblock);
+	rv = write_host_block(task, token, token->host_id, token->host_generation,
+			      MBLOCK_SHARED, &dblock);
+	OP_TIME_ADD(task, commit_us, begin);
+	return rv;
 }
 
-static int read_mode_block(struct task *task, struct token *token,
-			   uint64_t host_id, struct mode_block *mb_out)
+/*
+ * The mode blocks of all hosts are read together in one i/o, rather
+ * than reading the sector of each host that had the shared bit set.
+ */
+
+static int clear_dead_shared(struct task *task, struct token *token,
+			     int num_hosts, int *live_count)
 {
-	struct sync_disk *disk;
-	struct mode_block *mb_end;
+	struct paxos_blocks pb;
 	struct mode_block mb;
-	char *iobuf, **p_iobuf;
-	uint64_t offset;
-	int num_disks = token->r.num_disks;
-	int iobuf_len, rv, d;
-
-	disk = &token->disks[0];
-
-	iobuf_len = token->sector_size;
-	if (!iobuf_len)
-		return -EINVAL;
+	struct host_status *hss;
+	uint64_t host_id;
+	int i, rv = 0, live = 0;
+	int info_rv;
 
-	p_iobuf = &iobuf;
+	if (num_hosts > DEFAULT_MAX_HOSTS)
+		num_hosts = DEFAULT_MAX_HOSTS;
 
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
-	if (rv)
+	hss = malloc(num_hosts * sizeof(struct host_status));
+	if (!hss)
 		return -ENOMEM;
 
-	for (d = 0; d < num_disks; d++) {
-		disk = &token->disks[d];
-
-		offset = disk->offset + ((2 + host_id - 1) * token->sector_size);
-
-		rv = read_iobuf(disk->fd, offset, iobuf, iobuf_len, task, token->io_timeout, NULL);
-		if (rv < 0)
-			break;
-
-		mb_end = (struct mode_block *)(iobuf + MBLOCK_OFFSET);
-
-		mode_block_in(mb_end, &mb);
-
-		memcpy(mb_out, &mb, sizeof(struct mode_block));
-
-		/* FIXME: combine results for multi-disk case */
-		break;
+	rv = paxos_blocks_alloc(&pb, num_hosts);
+	if (rv < 0) {
+		free(hss);
+		return rv;
 	}
 
-	if (rv != SANLK_AIO_TIMEOUT)
-		free(iobuf);
+	/*
+	 * The host_status of all the shared holders is copied at once,
+	 * rather than looking up the lockspace for each holder.  If the
+	 * lockspace isn't found, the holders are all taken to be alive.
+	 */
+	info_rv = host_info_bitmap(token->r.lockspace_name, token->shared_bitmap,
+				   num_hosts, hss);
 
-	return rv;
-}
+	/* FIXME: combine results for multi-disk case */
 
-static int clear_dead_shared(struct task *task, struct token *token,
-			     int num_hosts, int *live_count)
-{
-	struct mode_block mb;
-	uint64_t host_id;
-	int i, rv = 0, live = 0;
+	rv = paxos_read_blocks(task, token, &token->disks[0], &pb);
+	if (rv < 0) {
+		log_errot(token, "clear_dead_shared read_blocks %d", rv);
+		goto out;
+	}
 
 	for (i = 0; i < num_hosts; i++) {
 		host_id = i + 1;
@@ -581,14 +747,7 @@ static int clear_dead_shared(struct task *task, struct token *token,
 		if (!test_id_bit(host_id, token->shared_bitmap))
 			continue;
 
-		memset(&mb, 0, sizeof(mb));
-
-		rv = read_mode_block(task, token, host_id, &mb);
-		if (rv < 0) {
-			log_errot(token, "clear_dead_shared read_mode_block %llu %d",
-				  (unsigned long long)host_id, rv);
-			return rv;
-		}
+		memcpy(&mb, &pb.mblocks[i], sizeof(mb));
 
 		log_token(token, "clear_dead_shared host_id %llu mode_block: flags %x gen %llu",
 			  (unsigned long long)host_id, mb.flags, (unsigned long long)mb.generation);
@@ -608,7 +767,11 @@ static int clear_dead_shared(struct task *task, struct token *token,
 			continue;
 		}
 
-		if (host_live(token->r.lockspace_name, token->space_id, host_id, mb.generation)) {
+		if (info_rv)
+			log_token(token, "clear_dead_shared host_id %llu yes host_info %d",
+				  (unsigned long long)host_id, info_rv);
+
+		if (info_rv || host_status_live(token->space_id, host_id, mb.generation, &hss[i])) {
 			log_token(token, "clear_dead_shared host_id %llu gen %llu alive",
 				  (unsigned long long)host_id, (unsigned long long)mb.generation);
 			live++;
@@ -619,7 +782,7 @@ static int clear_dead_shared(struct task *task, struct token *token,
 		if (rv < 0) {
 			log_errot(token, "clear_dead_shared host_id %llu write_host_block %d",
 				  (unsigned long long)host_id, rv);
-			return rv;
+			goto out;
 		}
 
 		/*
@@ -631,12 +794,133 @@ static int clear_dead_shared(struct task *task, struct token *token,
 	}
 
 	*live_count = live;
+ out:
+	paxos_blocks_free(&pb);
+	free(hss);
 	return rv;
 }
 
-/* the lvb is the sector after the dblock for host_id 2000, i.e. 2002 */
+/*
+ * The lvb region starts at LVB_SECTOR.  Without an LFL_LVB_ flag on the
+ * leader it is one sector of plain lvb data.  With one, the region is
+ * r->lvb_size bytes of sectors that each end with an lvb_footer, and
+ * r->lvb holds the region as it is on disk; the lvb data seen by
+ * set_lvb/get_lvb is the sectors without their footers.  The whole
+ * region is read or written with one i/o.
+ */
+
+static int lvb_multi(struct resource *r)
+{
+	return leader_lvb_size_from_flag(r->leader.flags) ? 1 : 0;
+}
+
+static int lvb_data_len(struct resource *r)
+{
+	int sector_size = r->leader.sector_size;
+
+	if (!lvb_multi(r))
+		return r->lvb_size;
+
+	return (r->lvb_size / sector_size) * (sector_size - sizeof(struct lvb_footer));
+}
+
+/* copy between lvb data and the region in r->lvb */
+
+static void lvb_data_copy(struct resource *r, char *data, int len, int to_lvb)
+{
+	int sector_size = r->leader.sector_size;
+	int chunk = sector_size - sizeof(struct lvb_footer);
+	int pos = 0, n;
+	char *sector;
+
+	if (!lvb_multi(r)) {
+		if (to_lvb)
+			memcpy(r->lvb, data, len);
+		else
+			memcpy(data, r->lvb, len);
+		return;
+	}
+
+	for (sector = r->lvb; pos < len; sector += sector_size) {
+		n = (len - pos < chunk) ? len - pos : chunk;
+		if (to_lvb)
+			memcpy(sector, data + pos, n);
+		else
+			memcpy(data + pos, sector, n);
+		pos += n;
+	}
+}
+
+static uint32_t lvb_sector_checksum(char *sector, int sector_size)
+{
+	return crc32c((uint32_t)~1, (uint8_t *)sector,
+		      sector_size - sizeof(struct lvb_footer) + LVB_FOOTER_CHECKSUM_OFF);
+}
+
+static void lvb_footers_out(char *iobuf, int sector_size, int lvb_size, uint64_t lver)
+{
+	struct lvb_footer lf;
+	struct lvb_footer *end;
+	char *sector;
+	int i, count = lvb_size / sector_size;
 
-#define LVB_SECTOR 2002
+	for (i = 0; i < count; i++) {
+		sector = iobuf + (i * sector_size);
+		end = (struct lvb_footer *)(sector + sector_size - sizeof(struct lvb_footer));
+
+		memset(&lf, 0, sizeof(lf));
+		lf.magic = LVB_DISK_MAGIC;
+		lf.sector = i;
+		lf.lver = lver;
+		lf.count = count;
+		lvb_footer_out(&lf, end);
+
+		/* N.B. compute checksum after the data has been byte swapped */
+		end->checksum = cpu_to_le32(lvb_sector_checksum(sector, sector_size));
+	}
+}
+
+static int lvb_footers_check(struct token *token, char *iobuf, int sector_size, int lvb_size)
+{
+	struct lvb_footer lf;
+	struct lvb_footer *end;
+	char *sector;
+	uint64_t lver = 0;
+	int i, count = lvb_size / sector_size;
+	int zero = 0;
+
+	for (i = 0; i < count; i++) {
+		sector = iobuf + (i * sector_size);
+		end = (struct lvb_footer *)(sector + sector_size - sizeof(struct lvb_footer));
+
+		lvb_footer_in(end, &lf);
+
+		/* a region that was never written is all zero */
+		if (!lf.magic) {
+			zero++;
+			continue;
+		}
+
+		if (lf.magic != LVB_DISK_MAGIC || lf.sector != (uint32_t)i || lf.count != (uint32_t)count ||
+		    lf.checksum != lvb_sector_checksum(sector, sector_size))
+			goto bad;
+
+		if (!lver)
+			lver = lf.lver;
+		else if (lf.lver != lver)
+			goto bad;
+	}
+
+	if (!zero || zero == count)
+		return 0;
+
+	log_errot(token, "lvb %d of %d sectors unwritten partial", zero, count);
+	return SANLK_LVB_PARTIAL;
+ bad:
+	log_errot(token, "lvb sector %d of %d magic %x sector %u lver %llu checksum %x partial",
+		  i, count, lf.magic, lf.sector, (unsigned long long)lf.lver, lf.checksum);
+	return SANLK_LVB_PARTIAL;
+}
 
 static int read_lvb_block(struct task *task, struct token *token)
 {
@@ -648,67 +932,165 @@ static int read_lvb_block(struct task *task, struct token *token)
 
 	r = token->resource;
 	disk = &token->disks[0];
-	iobuf_len = token->sector_size;
+	iobuf_len = r->lvb_size;
 	iobuf = r->lvb;
 	offset = disk->offset + (LVB_SECTOR * token->sector_size);
 
 	if (!r->lvb)
 		return 0;
 
+	set_io_op(task, SANLK_IO_LVB_READ);
 	rv = read_iobuf(disk->fd, offset, iobuf, iobuf_len, task, token->io_timeout, NULL);
+	if (rv < 0)
+		return rv;
+
+	if (lvb_multi(r))
+		rv = lvb_footers_check(token, iobuf, token->sector_size, iobuf_len);
 
 	return rv;
 }
 
-static int write_lvb_block(struct task *task, struct resource *r, struct token *token)
+static int write_lvb_iobuf(struct task *task, struct sync_disk *disk, int sector_size,
+			   int lvb_size, uint32_t io_timeout, char *iobuf)
 {
-	struct sync_disk *disk;
-	char *iobuf;
-	uint64_t offset;
-	int iobuf_len, rv;
+	uint64_t offset = disk->offset + (LVB_SECTOR * sector_size);
 
-	disk = &token->disks[0];
-	iobuf_len = token->sector_size;
-	iobuf = r->lvb;
-	offset = disk->offset + (LVB_SECTOR * token->sector_size);
+	set_io_op(task, SANLK_IO_LVB_WRITE);
+	return write_iobuf(disk->fd, offset, iobuf, lvb_size, task, io_timeout, NULL);
+}
 
+static int write_lvb_block(struct task *task, struct resource *r, struct token *token)
+{
 	if (!r->lvb)
 		return 0;
 
-	rv = write_iobuf(disk->fd, offset, iobuf, iobuf_len, task, token->io_timeout, NULL);
+	if (lvb_multi(r))
+		lvb_footers_out(r->lvb, token->sector_size, r->lvb_size, r->leader.lver);
 
-	return rv;
+	return write_lvb_iobuf(task, &token->disks[0], token->sector_size, r->lvb_size,
+			       token->io_timeout, r->lvb);
+}
+
+/*
+ * SANLK_SETLVB_WRITE: the new lvb is written from a private copy without
+ * holding resource_mutex.  If the lvb is unchanged when the write is done,
+ * the pending write on release is no longer needed.
+ */
+
+struct lvb_write {
+	char lockspace_name[SANLK_NAME_LEN];
+	char name[SANLK_NAME_LEN];
+	uint32_t res_id;
+	uint32_t io_timeout;
+	int sector_size;
+	int lvb_size;
+	struct sync_disk disk;
+	char *iobuf;
+};
+
+static int write_lvb_through(struct task *task, struct lvb_write *lw)
+{
+	struct resource *r;
+	int rv;
+
+	rv = open_disk(&lw->disk);
+	if (rv < 0) {
+		log_error("set_lvb %.48s:%.48s open_disk %s error %d",
+			  lw->lockspace_name, lw->name, lw->disk.path, rv);
+		return -ENODEV;
+	}
+
+	rv = write_lvb_iobuf(task, &lw->disk, lw->sector_size, lw->lvb_size,
+			     lw->io_timeout, lw->iobuf);
+
+	close_disks(&lw->disk, 1);
+
+	if (rv < 0) {
+		log_error("set_lvb %.48s:%.48s write error %d",
+			  lw->lockspace_name, lw->name, rv);
+		return rv;
+	}
+
+	/* the footers in lw->iobuf were filled in, r->lvb may not have them */
+	pthread_mutex_lock(&resource_mutex);
+	r = find_resource_name(lw->lockspace_name, lw->name, &resources_held);
+	if (r && r->res_id == lw->res_id && r->lvb) {
+		if (lvb_multi(r))
+			lvb_footers_out(r->lvb, r->leader.sector_size, r->lvb_size, r->leader.lver);
+		if (!memcmp(r->lvb, lw->iobuf, lw->lvb_size))
+			r->flags &= ~R_LVB_WRITE_RELEASE;
+	}
+	pthread_mutex_unlock(&resource_mutex);
+
+	return 0;
 }
 
-int res_set_lvb(struct sanlk_resource *res, char *lvb, int lvblen)
+int res_set_lvb(struct task *task, struct sanlk_resource *res, char *lvb, int lvblen,
+		uint32_t flags)
 {
 	struct resource *r;
+	struct lvb_write lw;
 	int rv = -ENOENT;
 
+	lw.iobuf = NULL;
+
 	pthread_mutex_lock(&resource_mutex);
-	list_for_each_entry(r, &resources_held, list) {
-		if (strncmp(r->r.lockspace_name, res->lockspace_name, NAME_ID_SIZE))
-			continue;
-		if (strncmp(r->r.name, res->name, NAME_ID_SIZE))
-			continue;
+	r = find_resource_name(res->lockspace_name, res->name, &resources_held);
+	if (!r)
+		goto out;
 
-		if (!r->lvb) {
-			rv = -EINVAL;
-			break;
-		}
+	if (!r->lvb) {
+		rv = -EINVAL;
+		goto out;
+	}
 
-		if (lvblen > r->leader.sector_size) {
-			rv = -E2BIG;
-			break;
-		}
+	if (lvblen > lvb_data_len(r)) {
+		rv = -E2BIG;
+		goto out;
+	}
 
-		memcpy(r->lvb, lvb, lvblen);
-		r->flags |= R_LVB_WRITE_RELEASE;
-		rv = 0;
-		break;
+	if ((flags & SANLK_SETLVB_WRITE) && (r->flags & R_SHARED)) {
+		rv = -EINVAL;
+		goto out;
 	}
+
+	lvb_data_copy(r, lvb, lvblen, 1);
+	r->flags |= R_LVB_WRITE_RELEASE;
+	r->flags &= ~R_LVB_PARTIAL;
+	rv = 0;
+
+	if (!(flags & SANLK_SETLVB_WRITE))
+		goto out;
+
+	if (posix_memalign((void *)&lw.iobuf, getpagesize(), r->lvb_size)) {
+		lw.iobuf = NULL;
+		rv = -ENOMEM;
+		goto out;
+	}
+
+	memcpy(lw.iobuf, r->lvb, r->lvb_size);
+	if (lvb_multi(r))
+		lvb_footers_out(lw.iobuf, r->leader.sector_size, r->lvb_size, r->leader.lver);
+	memcpy(lw.lockspace_name, r->r.lockspace_name, SANLK_NAME_LEN);
+	memcpy(lw.name, r->r.name, SANLK_NAME_LEN);
+	lw.res_id = r->res_id;
+	lw.io_timeout = r->io_timeout;
+	lw.sector_size = r->leader.sector_size;
+	lw.lvb_size = r->lvb_size;
+	memset(&lw.disk, 0, sizeof(lw.disk));
+	memcpy(lw.disk.path, r->r.disks[0].path, SANLK_PATH_LEN);
+	lw.disk.offset = r->r.disks[0].offset;
+	lw.disk.fd = -1;
+ out:
 	pthread_mutex_unlock(&resource_mutex);
 
+	if (lw.iobuf) {
+		rv = write_lvb_through(task, &lw);
+		/* a timed out write still owns the buffer */
+		if (rv != SANLK_AIO_TIMEOUT)
+			free(lw.iobuf);
+	}
+
 	return rv;
 }
 
@@ -720,32 +1102,39 @@ int res_get_lvb(struct sanlk_resource *res, char **lvb_out, int *lvblen)
 	int len = *lvblen;
 
 	pthread_mutex_lock(&resource_mutex);
-	list_for_each_entry(r, &resources_held, list) {
-		if (strncmp(r->r.lockspace_name, res->lockspace_name, NAME_ID_SIZE))
-			continue;
-		if (strncmp(r->r.name, res->name, NAME_ID_SIZE))
-			continue;
+	r = find_resource_name(res->lockspace_name, res->name, &resources_held);
+	if (!r)
+		goto out;
 
-		if (!r->lvb) {
-			rv = -EINVAL;
-			break;
-		}
+	if (!r->lvb) {
+		rv = -EINVAL;
+		goto out;
+	}
 
-		if (!len)
-			len = r->leader.sector_size;
+	if (r->flags & R_LVB_PARTIAL) {
+		rv = SANLK_LVB_PARTIAL;
+		goto out;
+	}
 
-		lvb = malloc(len);
-		if (!lvb) {
-			rv = -ENOMEM;
-			break;
-		}
+	if (!len)
+		len = lvb_data_len(r);
 
-		memcpy(lvb, r->lvb, len);
-		*lvb_out = lvb;
-		*lvblen = len;
-		rv = 0;
-		break;
+	if (len > lvb_data_len(r)) {
+		rv = -E2BIG;
+		goto out;
 	}
+
+	lvb = malloc(len);
+	if (!lvb) {
+		rv = -ENOMEM;
+		goto out;
+	}
+
+	lvb_data_copy(r, lvb, len, 0);
+	*lvb_out = lvb;
+	*lvblen = len;
+	rv = 0;
+ out:
 	pthread_mutex_unlock(&resource_mutex);
 
 	return rv;
@@ -808,6 +1197,93 @@ static int release_disk(struct task *task, struct token *token,
 	return rv; /* SANLK_OK */
 }
 
+/*
+ * The leader read in paxos_lease_release only confirms that r->leader is
+ * still on disk.  It is when we wrote r->leader as its owner, nothing was
+ * handed off, and our lockspace has been renewed throughout, so that no
+ * other host can have taken the lease from us.  Then, if release_verify
+ * is set to 0, the free leader is written directly, before our released
+ * dblock, and an ex release is two writes instead of a read and two
+ * writes.  The dblock is in our host
+ * sector, which is not next to the leader (the request record and other
+ * hosts' dblocks are between them), so the two can't be one write.
+ */
+
+static int release_leader_cached(struct token *token, struct resource *r,
+				 uint64_t lver)
+{
+	if (com.release_verify)
+		return 0;
+	if (!lver || r->leader.lver != lver || r->handoff_host_id)
+		return 0;
+	/* an earlier attempt may have released our dblock */
+	if (r->flags & R_RELEASE_RETRY)
+		return 0;
+	if (r->leader.write_id != token->host_id ||
+	    r->leader.owner_id != token->host_id ||
+	    r->leader.owner_generation != token->host_generation ||
+	    r->leader.timestamp == LEASE_FREE)
+		return 0;
+	return lockspace_renewal_current(token->space_id, token->host_generation);
+}
+
+static int release_disk_cached(struct task *task, struct token *token,
+			       struct sanlk_resource *resrename,
+			       struct resource *r)
+{
+	struct leader_record leader_tmp;
+	int rv, wrv;
+
+	log_token(token, "release cached leader lver %llu",
+		  (unsigned long long)r->leader.lver);
+
+	rv = paxos_lease_release_cached(task, token, resrename, &r->leader, &leader_tmp);
+	if (rv == SANLK_OK)
+		memcpy(&r->leader, &leader_tmp, sizeof(struct leader_record));
+
+	/* Failure here is not a big deal and can be ignored. */
+	wrv = write_mblock_zero_dblock_release(task, token);
+	if (wrv < 0)
+		log_errot(token, "release cached write_host_block %d", wrv);
+
+	return rv;
+}
+
+/*
+ * Release the leader of an ex lease, handing it to the host named by a
+ * SANLK_REQ_HANDOFF request if one was examined while we held it.  If the
+ * handoff cannot be written, the lease is released normally and the other
+ * host acquires it with a ballot.
+ */
+
+static int release_disk_handoff(struct task *task, struct token *token,
+				struct sanlk_resource *resrename,
+				struct resource *r)
+{
+	struct leader_record leader_tmp;
+	int rv;
+
+	if (!r->handoff_host_id || resrename)
+		return release_disk(task, token, resrename, &r->leader);
+
+	rv = paxos_lease_handoff(task, token, &r->leader,
+				 r->handoff_host_id, r->handoff_generation,
+				 r->handoff_lver, &leader_tmp);
+	if (rv == SANLK_OK) {
+		memcpy(&r->leader, &leader_tmp, sizeof(struct leader_record));
+		return SANLK_OK;
+	}
+
+	log_errot(token, "release handoff to %llu %llu error %d",
+		  (unsigned long long)r->handoff_host_id,
+		  (unsigned long long)r->handoff_generation, rv);
+
+	if (rv == SANLK_AIO_TIMEOUT)
+		return rv;
+
+	return release_disk(task, token, resrename, &r->leader);
+}
+
 /*
  * This function will:
  * 1. list_del token from the struct resource (caller frees struct token)
@@ -922,6 +1398,8 @@ static int _release_token(struct task *task, struct token *token,
 {
 	struct leader_record leader;
 	struct resource *r = token->resource;
+	uint64_t trace_start = trace_begin();
+	uint64_t open_begin;
 	uint64_t lver;
 	uint32_t r_flags = 0;
 	int retry_async = 0;
@@ -938,7 +1416,7 @@ static int _release_token(struct task *task, struct token *token,
 	pthread_mutex_lock(&resource_mutex);
 	list_del(&token->list);
 	if (list_empty(&r->tokens)) {
-		list_move(&r->list, &resources_rem);
+		res_list_move(r, &resources_rem);
 		last_token = 1;
 	}
 	lver = r->leader.lver;
@@ -969,7 +1447,9 @@ static int _release_token(struct task *task, struct token *token,
 		goto out;
 
 	if (!opened) {
+		open_begin = trace_begin();
 		rv = open_disks_fd(token->disks, token->r.num_disks);
+		OP_TIME_ADD(task, open_us, open_begin);
 		if (rv < 0) {
 			log_errot(token, "release_token open error %d", rv);
 			ret = rv;
@@ -1072,12 +1552,16 @@ static int _release_token(struct task *task, struct token *token,
 			/* do we want to give more effort to writing lvb? */
 		}
 
-		/* Failure here is not a big deal and can be ignored. */
-		rv = write_mblock_zero_dblock_release(task, token);
-		if (rv < 0)
-			log_errot(token, "release_token write_host_block %d", rv);
+		if (release_leader_cached(token, r, lver)) {
+			rv = release_disk_cached(task, token, resrename, r);
+		} else {
+			/* Failure here is not a big deal and can be ignored. */
+			rv = write_mblock_zero_dblock_release(task, token);
+			if (rv < 0)
+				log_errot(token, "release_token write_host_block %d", rv);
 
-		rv = release_disk(task, token, resrename, &r->leader);
+			rv = release_disk_handoff(task, token, resrename, r);
+		}
 		if (rv < 0) {
 			log_errot(token, "release_token release leader %d", rv);
 			ret = rv;
@@ -1089,13 +1573,20 @@ static int _release_token(struct task *task, struct token *token,
 
 	close_disks(token->disks, token->r.num_disks);
  out:
+	trace_event(SANLK_TRACE_RELEASE, token->space_id, token->res_id, lver, 0, 0,
+		    trace_start, retry_async ? SANLK_AIO_TIMEOUT : ret);
+	if (!retry_async) {
+		metrics_add(token->space_id, METRIC_RELEASES, 1);
+		snapshot_changed();
+	}
+
 	if (!retry_async) {
 		if (ret != SANLK_OK)
 			log_token(token, "release_token error %d r_flags %x", ret, r_flags);
 		else
 			log_token(token, "release_token done r_flags %x", r_flags);
 		pthread_mutex_lock(&resource_mutex);
-		list_del(&r->list);
+		res_list_del(r);
 		free_resource(r);
 		pthread_mutex_unlock(&resource_mutex);
 		return ret;
@@ -1111,7 +1602,7 @@ static int _release_token(struct task *task, struct token *token,
 
 	log_errot(token, "release_token timeout r_flags %x", r_flags);
 	pthread_mutex_lock(&resource_mutex);
-	r->flags |= R_THREAD_RELEASE;
+	r->flags |= (R_THREAD_RELEASE | R_RELEASE_RETRY);
 	pthread_mutex_unlock(&resource_mutex);
 	return SANLK_AIO_TIMEOUT;
 }
@@ -1132,6 +1623,50 @@ int release_token(struct task *task, struct token *token,
 	return _release_token(task, token, resrename, 0, 0);
 }
 
+/*
+ * SANLK_REL_LAZY: the last token of an ex lease is removed, but the lease
+ * remains ours on disk, and the resource is kept on resources_lazy.  An
+ * acquire from this host takes it back from there (see acquire_lazy), and
+ * it is released on disk by the resource_thread after lazy_release_seconds,
+ * or when another host requests it (set_resource_examine).
+ */
+
+int release_token_lazy(struct task *task, struct token *token)
+{
+	struct resource *r = token->resource;
+	int lazy = 0;
+
+	pthread_mutex_lock(&resource_mutex);
+	if (com.lazy_release_seconds && r->leader.lver && !token->space_dead &&
+	    r->on_list == &resources_held && list_is_singular(&r->tokens) &&
+	    !(r->flags & (R_SHARED | R_UNDO_SHARED | R_ERASE_ALL | R_CONVERT_EX))) {
+		list_del(&token->list);
+		res_list_move(r, &resources_lazy);
+		r->lazy_time = monotime();
+		lazy = 1;
+	}
+	pthread_mutex_unlock(&resource_mutex);
+
+	if (!lazy)
+		return release_token(task, token, NULL);
+
+	log_token(token, "release_token lazy lver %llu",
+		  (unsigned long long)r->leader.lver);
+	metrics_add(token->space_id, METRIC_RELEASES, 1);
+	snapshot_changed();
+	return SANLK_OK;
+}
+
+/* caller holds resource_mutex */
+
+static void lazy_release_async(struct resource *r, const char *reason)
+{
+	log_debug("release lazy %.48s:%.48s %s", r->r.lockspace_name, r->r.name, reason);
+	r->flags |= R_THREAD_RELEASE;
+	res_list_move(r, &resources_rem);
+	resource_thread_wake(0);
+}
+
 /* We're releasing a token from the main thread, in which we don't want to block,
    so we can't do a real release involving disk io.  So, pass the release off to
    the resource_thread. */
@@ -1147,15 +1682,14 @@ void release_token_async(struct token *token)
 			/* don't bother trying to release if the lockspace
 			   is dead (release will probably fail), or the
 			   lease was never acquired */
-			list_del(&r->list);
+			res_list_del(r);
 			free_resource(r);
 		} else if (token->acquire_flags & SANLK_RES_PERSISTENT) {
-			list_move(&r->list, &resources_orphan);
+			res_list_move(r, &resources_orphan);
 		} else {
 			r->flags |= R_THREAD_RELEASE;
-			resource_thread_work = 1;
-			list_move(&r->list, &resources_rem);
-			pthread_cond_signal(&resource_cond);
+			res_list_move(r, &resources_rem);
+			resource_thread_wake(0);
 		}
 	}
 	pthread_mutex_unlock(&resource_mutex);
@@ -1164,16 +1698,7 @@ void release_token_async(struct token *token)
 static struct resource *find_resource(struct token *token,
 				      struct list_head *head)
 {
-	struct resource *r;
-
-	list_for_each_entry(r, head, list) {
-		if (strncmp(r->r.lockspace_name, token->r.lockspace_name, NAME_ID_SIZE))
-			continue;
-		if (strncmp(r->r.name, token->r.name, NAME_ID_SIZE))
-			continue;
-		return r;
-	}
-	return NULL;
+	return find_resource_name(token->r.lockspace_name, token->r.name, head);
 }
 
 /*
@@ -1198,7 +1723,7 @@ int lockspace_is_used(struct sanlk_lockspace *ls)
 		if (!strncmp(r->r.lockspace_name, ls->name, NAME_ID_SIZE))
 			goto yes;
 	}
-	list_for_each_entry(r, &resources_orphan, list) {
+	list_for_each_entry(r, orphan_hash_head(ls->name), orphan_list) {
 		if (!strncmp(r->r.lockspace_name, ls->name, NAME_ID_SIZE))
 			goto yes;
 	}
@@ -1215,7 +1740,7 @@ int resource_orphan_count(char *space_name)
 	int count = 0;
 
 	pthread_mutex_lock(&resource_mutex);
-	list_for_each_entry(r, &resources_orphan, list) {
+	list_for_each_entry(r, orphan_hash_head(space_name), orphan_list) {
 		if (!strncmp(r->r.lockspace_name, space_name, NAME_ID_SIZE))
 			count++;
 	}
@@ -1250,6 +1775,9 @@ static struct resource *get_resource(struct token *token, int *new_id)
 	int token_matches = 0;
 	uint32_t res_id = 0;
 	uint32_t reused = 0;
+	char *lvb_cache = NULL;
+	uint64_t lvb_lver = 0;
+	int lvb_size = 0;
 	int disks_len, r_len;
 
 	disks_len = token->r.num_disks * sizeof(struct sync_disk);
@@ -1260,12 +1788,16 @@ static struct resource *get_resource(struct token *token, int *new_id)
 	if (r && token_matches) {
 		res_id = r->res_id;
 		reused = r->reused;
+		lvb_cache = r->lvb_cache;
+		lvb_lver = r->lvb_lver;
+		lvb_size = r->lvb_size;
 		*new_id = 0;
 	} else if (r) {
+		free(r->lvb_cache);
 		res_id = resource_id_counter++;
 		*new_id = 1;
 	} else {
-		r = malloc(r_len);
+		r = slab_alloc(SLAB_RESOURCE, token->r.num_disks);
 		if (!r)
 			return NULL;
 		res_id = resource_id_counter++;
@@ -1277,6 +1809,9 @@ static struct resource *get_resource(struct token *token, int *new_id)
 	/* preserved from one use to the next */
 	r->res_id = res_id;
 	r->reused = reused;
+	r->lvb_cache = lvb_cache;
+	r->lvb_lver = lvb_lver;
+	r->lvb_size = lvb_size;
 
 	memcpy(&r->r, &token->r, sizeof(struct sanlk_resource));
 	r->io_timeout = token->io_timeout;
@@ -1288,18 +1823,99 @@ static struct resource *get_resource(struct token *token, int *new_id)
 
 	r->host_id = token->host_id;
 	r->host_generation = token->host_generation;
+	r->space_id = token->space_id;
+
+	if (token->acquire_flags & SANLK_RES_SHARED) {
+		r->flags |= R_SHARED;
+	} else {
+		r->pid = token->pid;
+		if (token->flags & T_RESTRICT_SIGKILL)
+			r->flags |= R_RESTRICT_SIGKILL;
+		if (token->flags & T_RESTRICT_SIGTERM)
+			r->flags |= R_RESTRICT_SIGTERM;
+	}
+
+	return r;
+}
+
+/*
+ * SANLK_CONVERT_QUEUE: after sh2ex has found live shared holders, read the
+ * mode blocks every CONVERT_QUEUE_POLL_MS until none of the other hosts in
+ * token->shared_bitmap hold the lease shared, instead of repeating the
+ * ballot and release of the whole conversion.  Returns 0 when sh2ex should
+ * be tried again, -EAGAIN at the deadline.  Holders that are found dead
+ * are cleared by the next sh2ex.
+ */
+
+#define CONVERT_QUEUE_POLL_MS 250
+
+static int wait_shared_holders(struct task *task, struct token *token,
+			       int num_hosts, uint64_t deadline)
+{
+	struct paxos_blocks pb;
+	struct mode_block *mb;
+	struct host_status *hss;
+	uint64_t host_id;
+	int i, rv, live, info_rv;
+
+	if (num_hosts > DEFAULT_MAX_HOSTS)
+		num_hosts = DEFAULT_MAX_HOSTS;
+
+	hss = malloc(num_hosts * sizeof(struct host_status));
+	if (!hss)
+		return -ENOMEM;
+
+	rv = paxos_blocks_alloc(&pb, num_hosts);
+	if (rv < 0) {
+		free(hss);
+		return rv;
+	}
+
+	while (1) {
+		if (token->space_dead || monotime() >= deadline) {
+			rv = -EAGAIN;
+			break;
+		}
+
+		usleep(CONVERT_QUEUE_POLL_MS * 1000);
+
+		info_rv = host_info_bitmap(token->r.lockspace_name, token->shared_bitmap,
+					   num_hosts, hss);
+
+		rv = paxos_read_blocks(task, token, &token->disks[0], &pb);
+		if (rv < 0) {
+			log_errot(token, "convert_sh2ex queue read_blocks %d", rv);
+			break;
+		}
+
+		live = 0;
+
+		for (i = 0; i < num_hosts; i++) {
+			host_id = i + 1;
+
+			if (host_id == token->host_id)
+				continue;
+			if (!test_id_bit(host_id, token->shared_bitmap))
+				continue;
+
+			mb = &pb.mblocks[i];
+
+			if (!(mb->flags & MBLOCK_SHARED) || !mb->generation)
+				continue;
+
+			if (info_rv || host_status_live(token->space_id, host_id, mb->generation, &hss[i]))
+				live++;
+		}
 
-	if (token->acquire_flags & SANLK_RES_SHARED) {
-		r->flags |= R_SHARED;
-	} else {
-		r->pid = token->pid;
-		if (token->flags & T_RESTRICT_SIGKILL)
-			r->flags |= R_RESTRICT_SIGKILL;
-		if (token->flags & T_RESTRICT_SIGTERM)
-			r->flags |= R_RESTRICT_SIGTERM;
+		if (!live) {
+			log_token(token, "convert_sh2ex queue shared holders gone");
+			break;
+		}
 	}
 
-	return r;
+	paxos_blocks_free(&pb);
+	free(hss);
+	return rv;
 }
 
 static int convert_sh2ex_token(struct task *task, struct resource *r, struct token *token,
@@ -1522,11 +2138,20 @@ int convert_token(struct task *task, struct sanlk_resource *res, struct token *c
 {
 	struct resource *r;
 	struct token *tk;
-	struct token *token = NULL;
-	int sh_count = 0;
+	struct token *token;
+	uint64_t deadline = 0;
+	uint64_t open_begin;
+	int sh_count;
+	int convert_ex = 0;
 	int rv;
 
+	if (cmd_flags & SANLK_CONVERT_QUEUE)
+		deadline = monotime() + com.convert_queue_seconds;
+
 	/* we could probably grab cl_token->r, but it's good to verify */
+ retry:
+	token = NULL;
+	sh_count = 0;
 
 	pthread_mutex_lock(&resource_mutex);
 
@@ -1548,6 +2173,29 @@ int convert_token(struct task *task, struct sanlk_resource *res, struct token *c
 		if (tk->acquire_flags & SANLK_RES_SHARED)
 			sh_count++;
 	}
+
+	/*
+	 * The on-disk shared count checked by sh2ex does not include other
+	 * local pids holding the lease shared, and another local pid must
+	 * not join the shared lease while it is being converted.
+	 */
+	if (token && !(res->flags & SANLK_RES_SHARED) && (r->flags & R_SHARED)) {
+		if (sh_count > 1 || (r->flags & R_CONVERT_EX)) {
+			pthread_mutex_unlock(&resource_mutex);
+
+			/* queued: wait for the other local pids to release */
+			if (deadline && !token->space_dead && monotime() < deadline) {
+				usleep(CONVERT_QUEUE_POLL_MS * 1000);
+				goto retry;
+			}
+
+			log_token(token, "convert_token sh2ex with %d local sh", sh_count);
+			rv = -EAGAIN;
+			goto out;
+		}
+		r->flags |= R_CONVERT_EX;
+		convert_ex = 1;
+	}
 	pthread_mutex_unlock(&resource_mutex);
 
 	if (!token) {
@@ -1581,7 +2229,9 @@ int convert_token(struct task *task, struct sanlk_resource *res, struct token *c
 		goto out;
 	}
 
+	open_begin = trace_begin();
 	rv = open_disks_fd(token->disks, token->r.num_disks);
+	OP_TIME_ADD(task, open_us, open_begin);
 	if (rv < 0) {
 		log_errot(token, "convert_token open error %d", rv);
 		goto out;
@@ -1589,6 +2239,13 @@ int convert_token(struct task *task, struct sanlk_resource *res, struct token *c
 
 	if (!(res->flags & SANLK_RES_SHARED)) {
 		rv = convert_sh2ex_token(task, r, token, cmd_flags);
+
+		while (rv == -EAGAIN && deadline) {
+			rv = wait_shared_holders(task, token, r->leader.num_hosts, deadline);
+			if (rv < 0)
+				break;
+			rv = convert_sh2ex_token(task, r, token, cmd_flags);
+		}
 	} else if (res->flags & SANLK_RES_SHARED) {
 		rv = convert_ex2sh_token(task, r, token);
 	} else {
@@ -1597,17 +2254,112 @@ int convert_token(struct task *task, struct sanlk_resource *res, struct token *c
 	}
 
 	close_disks(token->disks, token->r.num_disks);
+
+	if (rv >= 0)
+		metrics_add(token->space_id, METRIC_CONVERTS, 1);
  out:
+	if (convert_ex) {
+		pthread_mutex_lock(&resource_mutex);
+		r->flags &= ~R_CONVERT_EX;
+		pthread_mutex_unlock(&resource_mutex);
+	}
 	return rv;
 }
 
-int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
-		  char *killpath, char *killargs)
+/* fill in a tmp token with the values from r that the disk functions use */
+
+static void copy_resource_token(struct token *tt, struct resource *r)
+{
+	memset(tt, 0, sizeof(struct token) + (r->r.num_disks * sizeof(struct sync_disk)));
+	tt->disks = (struct sync_disk *)&tt->r.disks[0];
+
+	memcpy(&tt->r, &r->r, sizeof(struct sanlk_resource));
+	copy_disks(&tt->r.disks, &r->r.disks, r->r.num_disks);
+	tt->host_id = r->host_id;
+	tt->host_generation = r->host_generation;
+	tt->space_id = r->space_id;
+	tt->res_id = r->res_id;
+	tt->io_timeout = r->io_timeout;
+	tt->sector_size = r->sector_size;
+	tt->align_size = r->align_size;
+}
+
+static void resource_thread_release(struct task *task, struct resource *r, struct token *token);
+
+/*
+ * Called with resource_mutex held, and returns with it unlocked.
+ * r is on resources_lazy, so the leader on disk is still ours with
+ * the lver in r->leader, and no other host has been given the lease.
+ * If the acquire is for an ex lease like the one we have, and needs
+ * nothing from the disk, the token takes over r.  Otherwise the lease
+ * is released on disk here, and the caller does a normal acquire.
+ * Returns 1 if the token now holds r.
+ */
+
+static int acquire_lazy(struct task *task, struct token *token, struct resource *r,
+			uint32_t cmd_flags, uint64_t acquire_lver, uint32_t new_num_hosts,
+			char *killpath, char *killargs)
+{
+	struct token *tt;
+
+	if (!(token->acquire_flags & SANLK_RES_SHARED) &&
+	    (!acquire_lver || acquire_lver == r->leader.lver) &&
+	    (!new_num_hosts || new_num_hosts == r->leader.num_hosts) &&
+	    (!(cmd_flags & SANLK_ACQUIRE_LVB) || r->lvb) &&
+	    r->host_generation == token->host_generation) {
+		token->res_id = r->res_id;
+		token->r.lver = r->leader.lver;
+		token->sector_size = r->sector_size;
+		token->align_size = r->align_size;
+		token->resource = r;
+		r->pid = token->pid;
+		r->lazy_time = 0;
+		memcpy(r->killpath, killpath, SANLK_HELPER_PATH_LEN);
+		memcpy(r->killargs, killargs, SANLK_HELPER_ARGS_LEN);
+		copy_disks(&token->r.disks, &r->r.disks, token->r.num_disks);
+		list_add(&token->list, &r->tokens);
+		res_list_move(r, &resources_held);
+		pthread_mutex_unlock(&resource_mutex);
+
+		log_token(token, "acquire_token lazy lver %llu",
+			  (unsigned long long)r->leader.lver);
+		return 1;
+	}
+
+	log_token(token, "acquire_token lazy release first");
+
+	r->flags &= ~R_THREAD_RELEASE;
+	res_list_move(r, &resources_rem);
+	pthread_mutex_unlock(&resource_mutex);
+
+	tt = slab_alloc(SLAB_TOKEN, SANLK_MAX_DISKS);
+	if (!tt) {
+		pthread_mutex_lock(&resource_mutex);
+		lazy_release_async(r, "nomem");
+		pthread_mutex_unlock(&resource_mutex);
+		return 0;
+	}
+
+	pthread_mutex_lock(&resource_mutex);
+	copy_resource_token(tt, r);
+	tt->resource = r;
+	pthread_mutex_unlock(&resource_mutex);
+
+	/* frees r, or leaves it on resources_rem to retry, so
+	   the caller's acquire then fails with EAGAIN */
+	resource_thread_release(task, r, tt);
+	slab_free(tt);
+	return 0;
+}
+
+static int _acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
+			  char *killpath, char *killargs)
 {
 	struct leader_record leader;
 	struct paxos_dblock dblock;
 	struct resource *r;
 	uint64_t acquire_lver = 0;
+	uint64_t open_begin;
 	uint32_t new_num_hosts = 0;
 	int sh_retries = 0;
 	int live_count = 0;
@@ -1631,6 +2383,7 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 	if (cmd_flags & SANLK_ACQUIRE_OWNER_NOWAIT)
 		owner_nowait = 1;
 
+ find:
 	pthread_mutex_lock(&resource_mutex);
 
 	/*
@@ -1656,6 +2409,15 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 	}
 
 	r = find_resource(token, &resources_held);
+	if (r && (token->acquire_flags & SANLK_RES_SHARED) && (r->flags & R_SHARED) &&
+	    (r->flags & R_CONVERT_EX)) {
+		/* another local pid is converting its shared lease to ex */
+		token->res_id = r->res_id;
+		log_token(token, "acquire_token shared being converted");
+		pthread_mutex_unlock(&resource_mutex);
+		return -EAGAIN;
+	}
+
 	if (r && (token->acquire_flags & SANLK_RES_SHARED) && (r->flags & R_SHARED)) {
 		/* multiple shared holders allowed */
 		token->res_id = r->res_id;
@@ -1675,6 +2437,14 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 		return -EEXIST;
 	}
 
+	r = find_resource(token, &resources_lazy);
+	if (r) {
+		if (acquire_lazy(task, token, r, cmd_flags, acquire_lver, new_num_hosts,
+				 killpath, killargs))
+			return SANLK_OK;
+		goto find;
+	}
+
 	/* caller did not ask for orphan, but an orphan exists */
 
 	r = find_resource(token, &resources_orphan);
@@ -1713,7 +2483,7 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 		log_token(token, "acquire_token adopt shared orphan");
 		token->resource = r;
 		list_add(&token->list, &r->tokens);
-		list_move(&r->list, &resources_held);
+		res_list_move(r, &resources_held);
 		pthread_mutex_unlock(&resource_mutex);
 
 		/* do this to initialize some token fields */
@@ -1738,7 +2508,7 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 		r->pid = token->pid;
 		token->resource = r;
 		list_add(&token->list, &r->tokens);
-		list_move(&r->list, &resources_held);
+		res_list_move(r, &resources_held);
 		pthread_mutex_unlock(&resource_mutex);
 
 		/* do this to initialize some token fields */
@@ -1773,7 +2543,7 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 	memcpy(r->killpath, killpath, SANLK_HELPER_PATH_LEN);
 	memcpy(r->killargs, killargs, SANLK_HELPER_ARGS_LEN);
 	list_add(&token->list, &r->tokens);
-	list_add(&r->list, &resources_add);
+	res_list_add(r, &resources_add);
 	token->res_id = r->res_id;
 	token->resource = r;
 	pthread_mutex_unlock(&resource_mutex);
@@ -1787,7 +2557,9 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 			  (unsigned long long)token->r.disks[0].offset);
 	}
 
+	open_begin = trace_begin();
 	rv = open_disks(token->disks, token->r.num_disks);
+	OP_TIME_ADD(task, open_us, open_begin);
 	if (rv < 0) {
 		log_errot(token, "acquire_token open error %d", rv);
 		release_token_nodisk(task, token);
@@ -1821,8 +2593,8 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 		 * probably succeed.
 		 */
 		if ((token->acquire_flags & SANLK_RES_SHARED) && (leader.flags & LFL_SHORT_HOLD)) {
-			if (sh_retries++ < com.sh_retries) {
-				int us = get_rand(0, 1000000);
+			if (sh_retries < com.sh_retries) {
+				int us = paxos_backoff_us(token, sh_retries++, 0);
 				log_token(token, "acquire_token sh_retry %d %d", rv, us);
 				usleep(us);
 				goto retry;
@@ -1942,33 +2714,93 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
  out:
 	if (cmd_flags & SANLK_ACQUIRE_LVB) {
 		char *iobuf, **p_iobuf;
+		int lvb_size;
 		p_iobuf = &iobuf;
 
 		/* TODO: we should probably notify the caller somehow about
 		   lvb read/write independent of the lease results. */
 
-		rv = posix_memalign((void *)p_iobuf, getpagesize(), token->sector_size);
+		lvb_size = leader_lvb_size_from_flag(r->leader.flags);
+		if (!lvb_size)
+			lvb_size = token->sector_size;
+
+		if (r->lvb_cache && r->lvb_size != lvb_size) {
+			free(r->lvb_cache);
+			r->lvb_cache = NULL;
+		}
+		r->lvb_size = lvb_size;
+
+		/* no other host or process has held the lease since our cached
+		   copy of the lvb was known to match the disk, any lvb write
+		   by them would have come with an ex acquire and a new lver */
+
+		if (r->lvb_cache && r->lvb_lver && (r->leader.lver == r->lvb_lver + 1)) {
+			log_token(token, "acquire_token lvb cached lver %llu",
+				  (unsigned long long)r->lvb_lver);
+			r->lvb = r->lvb_cache;
+			r->lvb_cache = NULL;
+			r->lvb_lver = r->leader.lver;
+			goto lvb_done;
+		}
+
+		r->lvb_lver = 0;
+
+		/* reuse the stale copy's buffer for the read */
+		if (r->lvb_cache) {
+			iobuf = r->lvb_cache;
+			r->lvb_cache = NULL;
+			rv = 0;
+		} else {
+			rv = posix_memalign((void *)p_iobuf, getpagesize(), lvb_size);
+		}
 		if (rv) {
 			log_errot(token, "acquire_token lvb size %d memalign error %d",
-				  token->sector_size, rv);
+				  lvb_size, rv);
 		} else {
 			r->lvb = iobuf;
 
 			rv = read_lvb_block(task, token);
-			if (rv < 0)
+			if (rv == SANLK_LVB_PARTIAL)
+				r->flags |= R_LVB_PARTIAL;
+			else if (rv < 0)
 				log_errot(token, "acquire_token read_lvb error %d", rv);
+			else
+				r->lvb_lver = r->leader.lver;
 		}
 	}
+ lvb_done:
+	if (r->lvb_cache) {
+		/* not using the lvb this time, and it can't be tracked */
+		free(r->lvb_cache);
+		r->lvb_cache = NULL;
+		r->lvb_lver = 0;
+	}
 
 	close_disks(token->disks, token->r.num_disks);
 
 	pthread_mutex_lock(&resource_mutex);
-	list_move(&r->list, &resources_held);
+	res_list_move(r, &resources_held);
 	pthread_mutex_unlock(&resource_mutex);
 
 	return SANLK_OK;
 }
 
+int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
+		  char *killpath, char *killargs)
+{
+	uint64_t trace_start = trace_begin();
+	int rv;
+
+	rv = _acquire_token(task, token, cmd_flags, killpath, killargs);
+
+	trace_event(SANLK_TRACE_ACQUIRE, token->space_id, token->res_id,
+		    token->r.lver, 0, 0, trace_start, rv);
+	metrics_add(token->space_id, (rv < 0) ? METRIC_ACQUIRE_ERRORS : METRIC_ACQUIRES, 1);
+	if (!rv)
+		snapshot_changed();
+	return rv;
+}
+
 int request_token(struct task *task, struct token *token, uint32_t force_mode,
 		  uint64_t *owner_id, int next_lver)
 {
@@ -2058,6 +2890,15 @@ int request_token(struct task *task, struct token *token, uint32_t force_mode,
 	req.lver = token->acquire_lver;
 	req.force_mode = force_mode;
 
+	/* the requesting host is the one the lease is handed to */
+	if (force_mode == SANLK_REQ_HANDOFF) {
+		req.host_id = token->host_id;
+		req.host_generation = token->host_generation;
+	} else {
+		req.host_id = 0;
+		req.host_generation = 0;
+	}
+
 	rv = paxos_lease_request_write(task, token, &req);
  out:
 	close_disks(token->disks, token->r.num_disks);
@@ -2164,24 +3005,123 @@ static void do_request(struct token *tt, int pid, uint32_t force_mode)
 			  pid, errno);
 }
 
-int set_resource_examine(char *space_name, char *res_name)
+/*
+ * Nothing is done to the pid for a handoff request.  The requesting host
+ * is saved in the resource, and the on-disk release of the lease (whether
+ * the pid releases it or exits) commits the requested lver with that host
+ * as the owner.
+ */
+
+static void do_handoff(struct token *tt, int pid, struct request_record *req)
 {
 	struct resource *r;
+	uint64_t lver = 0;
+	int rv = -ENOENT;
+
+	pthread_mutex_lock(&resource_mutex);
+	r = find_resource(tt, &resources_held);
+	if (r && r->pid == pid) {
+		lver = r->leader.lver;
+		if (r->flags & R_SHARED) {
+			rv = -EINVAL;
+		} else if (!req->host_id || req->host_id == r->host_id ||
+			   req->lver != lver + 1) {
+			rv = -EINVAL;
+		} else {
+			r->handoff_host_id = req->host_id;
+			r->handoff_generation = req->host_generation;
+			r->handoff_lver = req->lver;
+			rv = 0;
+		}
+	}
+	pthread_mutex_unlock(&resource_mutex);
+
+	if (rv < 0) {
+		log_error("do_handoff pid %d %.48s:%.48s host %llu %llu lver %llu our lver %llu error %d",
+			  pid, tt->r.lockspace_name, tt->r.name,
+			  (unsigned long long)req->host_id,
+			  (unsigned long long)req->host_generation,
+			  (unsigned long long)req->lver,
+			  (unsigned long long)lver, rv);
+		return;
+	}
+
+	log_token(tt, "do_handoff %d to host %llu %llu lver %llu",
+		  pid, (unsigned long long)req->host_id,
+		  (unsigned long long)req->host_generation,
+		  (unsigned long long)req->lver);
+}
+
+/*
+ * A request from another host for a lease we are keeping after a lazy
+ * release is not examined, the lease is just released.
+ */
+
+int set_resource_examine(char *space_name, char *res_name)
+{
+	struct resource *r, *safe;
 	int count = 0;
 
 	pthread_mutex_lock(&resource_mutex);
+	if (res_name) {
+		r = find_resource_name(space_name, res_name, &resources_held);
+		if (r) {
+			r->flags |= R_THREAD_EXAMINE;
+			count++;
+		}
+		r = find_resource_name(space_name, res_name, &resources_lazy);
+		if (r)
+			lazy_release_async(r, "request");
+		goto out;
+	}
+
 	list_for_each_entry(r, &resources_held, list) {
 		if (strncmp(r->r.lockspace_name, space_name, NAME_ID_SIZE))
 			continue;
-		if (res_name && strncmp(r->r.name, res_name, NAME_ID_SIZE))
+		r->flags |= R_THREAD_EXAMINE;
+		count++;
+	}
+
+	list_for_each_entry_safe(r, safe, &resources_lazy, list) {
+		if (strncmp(r->r.lockspace_name, space_name, NAME_ID_SIZE))
+			continue;
+		lazy_release_async(r, "request");
+	}
+ out:
+	if (count)
+		resource_thread_wake(1);
+	pthread_mutex_unlock(&resource_mutex);
+
+	return count;
+}
+
+/*
+ * Examine the held resource whose resource_name_hash() was sent in a
+ * SANLK_HOST_EVENT_REQUEST host event.
+ */
+
+int set_resource_examine_hash(char *space_name, uint32_t hash)
+{
+	struct resource *r, *safe;
+	int count = 0;
+
+	pthread_mutex_lock(&resource_mutex);
+	list_for_each_entry_safe(r, safe, &resource_hash[hash & (RESOURCE_HASH_SIZE - 1)], hash_list) {
+		if (r->on_list != &resources_held && r->on_list != &resources_lazy)
+			continue;
+		if (strncmp(r->r.lockspace_name, space_name, NAME_ID_SIZE))
+			continue;
+		if (resource_name_hash(r->r.lockspace_name, r->r.name) != hash)
 			continue;
+		if (r->on_list == &resources_lazy) {
+			lazy_release_async(r, "request");
+			continue;
+		}
 		r->flags |= R_THREAD_EXAMINE;
-		resource_thread_work = 1;
-		resource_thread_work_examine = 1;
 		count++;
 	}
 	if (count)
-		pthread_cond_signal(&resource_cond);
+		resource_thread_wake(1);
 	pthread_mutex_unlock(&resource_mutex);
 
 	return count;
@@ -2194,22 +3134,39 @@ int set_resource_examine(char *space_name, char *res_name)
  * - examines request blocks of resources
  */
 
-static struct resource *find_resource_thread(struct list_head *head, uint32_t flag)
+/*
+ * Each thread is assigned the leases on some of the disks, so a slow
+ * disk holds up only its own thread.  A thread with no work on its own
+ * disks takes any other work, so that many releases on one disk are
+ * also done in parallel.
+ */
+
+static int resource_worker_index(struct resource *r)
 {
-	struct resource *r;
+	if (resource_worker_count < 2)
+		return 0;
+	return name_hash(r->r.disks[0].path, SANLK_PATH_LEN) % resource_worker_count;
+}
+
+static struct resource *find_resource_thread(struct list_head *head, uint32_t flag, int index)
+{
+	struct resource *r, *other = NULL;
 	uint64_t now = monotime();
 
 	list_for_each_entry(r, head, list) {
 		if (!(r->flags & flag))
 			continue;
 
-		if (flag & R_THREAD_EXAMINE)
-			return r;
+		if (!(flag & R_THREAD_EXAMINE) && (now < r->thread_release_retry))
+			continue;
 
-		if (now >= r->thread_release_retry)
+		if (resource_worker_index(r) == index)
 			return r;
+
+		if (!other)
+			other = r;
 	}
-	return NULL;
+	return other;
 }
 
 /*
@@ -2234,6 +3191,7 @@ static void resource_thread_release(struct task *task, struct resource *r, struc
 {
 	struct leader_record leader;
 	struct space_info spi;
+	uint64_t trace_start = trace_begin();
 	uint32_t r_flags;
 	int retry_async = 0;
 	int rv;
@@ -2323,12 +3281,16 @@ static void resource_thread_release(struct task *task, struct resource *r, struc
 			/* do we want to give more effort to writing lvb? */
 		}
 
-		/* Failure here is not a big deal and can be ignored. */
-		rv = write_mblock_zero_dblock_release(task, token);
-		if (rv < 0)
-			log_errot(token, "release async write_host_block %d", rv);
+		if (release_leader_cached(token, r, r->leader.lver)) {
+			rv = release_disk_cached(task, token, NULL, r);
+		} else {
+			/* Failure here is not a big deal and can be ignored. */
+			rv = write_mblock_zero_dblock_release(task, token);
+			if (rv < 0)
+				log_errot(token, "release async write_host_block %d", rv);
 
-		rv = release_disk(task, token, NULL, &r->leader);
+			rv = release_disk_handoff(task, token, NULL, r);
+		}
 		if (rv < 0)
 			log_errot(token, "release async release leader %d", rv);
 
@@ -2339,10 +3301,17 @@ static void resource_thread_release(struct task *task, struct resource *r, struc
  out_close:
 	close_disks(token->disks, token->r.num_disks);
  out:
+	trace_event(SANLK_TRACE_RELEASE, token->space_id, token->res_id, r->leader.lver, 0, 0,
+		    trace_start, retry_async ? SANLK_AIO_TIMEOUT : rv);
+	if (!retry_async) {
+		metrics_add(token->space_id, METRIC_RELEASES, 1);
+		snapshot_changed();
+	}
+
 	if (!retry_async) {
 		log_token(token, "release async done r_flags %x", r_flags);
 		pthread_mutex_lock(&resource_mutex);
-		list_del(&r->list);
+		res_list_del(r);
 		free_resource(r);
 		pthread_mutex_unlock(&resource_mutex);
 		return;
@@ -2351,7 +3320,7 @@ static void resource_thread_release(struct task *task, struct resource *r, struc
 	/* Keep the resource on the list to keep trying. */
 	log_token(token, "release async timeout r_flags %x", r_flags);
 	pthread_mutex_lock(&resource_mutex);
-	r->flags |= R_THREAD_RELEASE;
+	r->flags |= (R_THREAD_RELEASE | R_RELEASE_RETRY);
 	pthread_mutex_unlock(&resource_mutex);
 }
 
@@ -2382,7 +3351,9 @@ static void resource_thread_examine(struct task *task, struct token *tt, int pid
 		return;
 	}
 
-	if (req.force_mode) {
+	if (req.force_mode == SANLK_REQ_HANDOFF) {
+		do_handoff(tt, pid, &req);
+	} else if (req.force_mode) {
 		do_request(tt, pid, req.force_mode);
 	} else {
 		log_error("req force_mode %u unknown", req.force_mode);
@@ -2416,8 +3387,8 @@ void add_host_event(uint32_t space_id, struct sanlk_host_event *he,
 
 	pthread_mutex_lock(&resource_mutex);
 	list_add_tail(&rhe->list, &host_events);
-	resource_thread_work = 1;
-	pthread_cond_signal(&resource_cond);
+	resource_workers[0].work = 1;
+	pthread_cond_broadcast(&resource_cond);
 	pthread_mutex_unlock(&resource_mutex);
 }
 
@@ -2428,18 +3399,53 @@ static struct recv_he *find_host_event(void)
 	return list_first_entry(&host_events, struct recv_he, list);
 }
 
-static void *resource_thread(void *arg GNUC_UNUSED)
+#define HOST_EVENT_BATCH 64
+
+/*
+ * Take the queued events for the same lockspace as the first one, so
+ * they are sent to each event fd together.  Caller holds resource_mutex.
+ */
+
+static int get_host_events(struct event_cb *cbs, uint32_t *space_id)
+{
+	struct recv_he *rhe, *safe;
+	int count = 0;
+
+	list_for_each_entry_safe(rhe, safe, &host_events, list) {
+		if (!count)
+			*space_id = rhe->space_id;
+		else if (rhe->space_id != *space_id)
+			continue;
+
+		memset(&cbs[count], 0, sizeof(struct event_cb));
+		memcpy(&cbs[count].he, &rhe->he, sizeof(struct sanlk_host_event));
+		cbs[count].from_host_id = rhe->from_host_id;
+		cbs[count].from_generation = rhe->from_generation;
+		list_del(&rhe->list);
+		free(rhe);
+
+		if (++count == HOST_EVENT_BATCH)
+			break;
+	}
+	return count;
+}
+
+static void *resource_thread(void *arg)
 {
+	struct resource_worker *rw = arg;
 	struct task task;
 	struct resource *r;
 	struct token *tt = NULL;
-	struct recv_he *rhe;
+	struct event_cb cbs[HOST_EVENT_BATCH];
+	uint32_t space_id;
 	uint64_t lver;
-	int pid, tt_len;
+	int pid, tt_len, count;
 
 	memset(&task, 0, sizeof(struct task));
 	setup_task_aio(&task, main_task.use_aio, RESOURCE_AIO_CB_SIZE);
-	sprintf(task.name, "%s", "resource");
+	sprintf(task.name, "%s%d", "resource", rw->index);
+
+	thread_class_setup(THREAD_CLASS_RESOURCE);
 
 	/* a fake/tmp token struct we copy necessary res info into,
 	   because other functions take a token struct arg */
@@ -2452,8 +3458,10 @@ static void *resource_thread(void *arg GNUC_UNUSED)
 	}
 
 	while (1) {
+		reap_detached_aio(&task, DEFAULT_IO_TIMEOUT);
+
 		pthread_mutex_lock(&resource_mutex);
-		while (!resource_thread_work) {
+		while (!rw->work) {
 			if (resource_thread_stop) {
 				pthread_mutex_unlock(&resource_mutex);
 				goto out;
@@ -2461,12 +3469,11 @@ static void *resource_thread(void *arg GNUC_UNUSED)
 			pthread_cond_wait(&resource_cond, &resource_mutex);
 		}
 
-		rhe = find_host_event();
-		if (rhe) {
-			list_del(&rhe->list);
+		/* only the first thread sends host events to keep their order */
+		count = (rw->index || !find_host_event()) ? 0 : get_host_events(cbs, &space_id);
+		if (count) {
 			pthread_mutex_unlock(&resource_mutex);
-			send_event_callbacks(rhe->space_id, rhe->from_host_id, rhe->from_generation, &rhe->he);
-			free(rhe);
+			send_event_callbacks(space_id, cbs, count);
 			continue;
 		}
 
@@ -2475,19 +3482,9 @@ static void *resource_thread(void *arg GNUC_UNUSED)
 		 * r into a temp token.  The whole duplication of stuff
 		 * between token and r would be nice to clean up. */
 
-		memset(tt, 0, tt_len);
-		tt->disks = (struct sync_disk *)&tt->r.disks[0];
-
-		r = find_resource_thread(&resources_rem, R_THREAD_RELEASE);
+		r = find_resource_thread(&resources_rem, R_THREAD_RELEASE, rw->index);
 		if (r) {
-			memcpy(&tt->r, &r->r, sizeof(struct sanlk_resource));
-			copy_disks(&tt->r.disks, &r->r.disks, r->r.num_disks);
-			tt->host_id = r->host_id;
-			tt->host_generation = r->host_generation;
-			tt->res_id = r->res_id;
-			tt->io_timeout = r->io_timeout;
-			tt->sector_size = r->sector_size;
-			tt->align_size = r->align_size;
+			copy_resource_token(tt, r);
 			tt->resource = r;
 
 			/*
@@ -2510,22 +3507,15 @@ static void *resource_thread(void *arg GNUC_UNUSED)
 		 * We don't want to search all of resource_held each time
 		 * we are woken unless we know there is something to examine.
 		 */
-		if (!resource_thread_work_examine)
+		if (!rw->work_examine)
 			goto find_done;
 
-		r = find_resource_thread(&resources_held, R_THREAD_EXAMINE);
+		r = find_resource_thread(&resources_held, R_THREAD_EXAMINE, rw->index);
 		if (r) {
 			/* make copies of things we need because we can't use r
 			   once we unlock the mutex since it could be released */
 
-			memcpy(&tt->r, &r->r, sizeof(struct sanlk_resource));
-			copy_disks(&tt->r.disks, &r->r.disks, r->r.num_disks);
-			tt->host_id = r->host_id;
-			tt->host_generation = r->host_generation;
-			tt->res_id = r->res_id;
-			tt->io_timeout = r->io_timeout;
-			tt->sector_size = r->sector_size;
-			tt->align_size = r->align_size;
+			copy_resource_token(tt, r);
 			pid = r->pid;
 			lver = r->leader.lver;
 
@@ -2537,8 +3527,8 @@ static void *resource_thread(void *arg GNUC_UNUSED)
 		}
 
  find_done:
-		resource_thread_work = 0;
-		resource_thread_work_examine = 0;
+		rw->work = 0;
+		rw->work_examine = 0;
 		pthread_mutex_unlock(&resource_mutex);
 	}
  out:
@@ -2548,33 +3538,52 @@ static void *resource_thread(void *arg GNUC_UNUSED)
 	return NULL;
 }
 
+static void release_orphan_resource(struct resource *r)
+{
+	log_debug("release orphan %.48s:%.48s", r->r.lockspace_name, r->r.name);
+	r->flags |= R_THREAD_RELEASE;
+	res_list_move(r, &resources_rem);
+}
+
 int release_orphan(struct sanlk_resource *res)
 {
 	struct resource *r, *safe;
 	int count = 0;
 
 	pthread_mutex_lock(&resource_mutex);
-	list_for_each_entry_safe(r, safe, &resources_orphan, list) {
-		if (strncmp(r->r.lockspace_name, res->lockspace_name, NAME_ID_SIZE))
-			continue;
-
-		if (!res->name[0] || !strncmp(r->r.name, res->name, NAME_ID_SIZE)) {
-			log_debug("release orphan %.48s:%.48s", r->r.lockspace_name, r->r.name);
-			r->flags |= R_THREAD_RELEASE;
-			list_move(&r->list, &resources_rem);
+	if (res->name[0]) {
+		r = find_resource_name(res->lockspace_name, res->name, &resources_orphan);
+		if (r) {
+			release_orphan_resource(r);
 			count++;
 		}
+		goto out;
 	}
 
-	if (count) {
-		resource_thread_work = 1;
-		pthread_cond_signal(&resource_cond);
+	list_for_each_entry_safe(r, safe, orphan_hash_head(res->lockspace_name), orphan_list) {
+		if (strncmp(r->r.lockspace_name, res->lockspace_name, NAME_ID_SIZE))
+			continue;
+		release_orphan_resource(r);
+		count++;
 	}
+ out:
+	if (count)
+		resource_thread_wake(0);
 	pthread_mutex_unlock(&resource_mutex);
 
 	return count;
 }
 
+static void purge_resource(struct resource *r, const char *list_name)
+{
+	if (list_name)
+		log_debug("purge %s %.48s:%.48s", list_name, r->r.lockspace_name, r->r.name);
+	res_list_del(r);
+	free(r->lvb);
+	free(r->lvb_cache);
+	slab_free(r);
+}
+
 static void purge_resource_list(struct list_head *head, char *space_name, const char *list_name)
 {
 	struct resource *r, *safe;
@@ -2583,17 +3592,27 @@ static void purge_resource_list(struct list_head *head, char *space_name, const
 	list_for_each_entry_safe(r, safe, head, list) {
 		if (strncmp(r->r.lockspace_name, space_name, NAME_ID_SIZE))
 			continue;
-		if (list_name)
-			log_debug("purge %s %.48s:%.48s", list_name, r->r.lockspace_name, r->r.name);
-		list_del(&r->list);
-		free(r);
+		purge_resource(r, list_name);
 	}
 	pthread_mutex_unlock(&resource_mutex);
 }
 
 void purge_resource_orphans(char *space_name)
 {
-	purge_resource_list(&resources_orphan, space_name, "orphan_list");
+	struct resource *r, *safe;
+
+	pthread_mutex_lock(&resource_mutex);
+	list_for_each_entry_safe(r, safe, orphan_hash_head(space_name), orphan_list) {
+		if (strncmp(r->r.lockspace_name, space_name, NAME_ID_SIZE))
+			continue;
+		purge_resource(r, "orphan_list");
+	}
+	pthread_mutex_unlock(&resource_mutex);
+}
+
+void purge_resource_lazy(char *space_name)
+{
+	purge_resource_list(&resources_lazy, space_name, "lazy_list");
 }
 
 void purge_resource_free(char *space_name)
@@ -2602,25 +3621,38 @@ void purge_resource_free(char *space_name)
 }
 
 /*
- * This is called by the main_loop once a second during normal operation.
- * The resources_rem list should normally be empty, so this does nothing.
- * This is needed to wake up the resource_thread to retry release operations
- * that had timed out previously and need to be retried.
+ * This is called each time the main_loop wakes up.  The resources_rem and
+ * resources_lazy lists should normally be empty, so this does nothing.
+ * It is needed to wake up the resource_thread to retry release operations
+ * that had timed out previously, and to release idle lazy leases.  While
+ * it returns 1, the main_loop wakes up again within STANDARD_CHECK_INTERVAL.
  */
 
-void rem_resources(void)
+int rem_resources(void)
 {
+	struct resource *r, *safe;
+	uint64_t now;
+	int busy;
+
 	pthread_mutex_lock(&resource_mutex);
-	if (!list_empty(&resources_rem) && !resource_thread_work) {
-		resource_thread_work = 1;
-		pthread_cond_signal(&resource_cond);
+	if (!list_empty(&resources_lazy)) {
+		now = monotime();
+		list_for_each_entry_safe(r, safe, &resources_lazy, list) {
+			if (now - r->lazy_time >= (uint64_t)com.lazy_release_seconds)
+				lazy_release_async(r, "idle");
+		}
 	}
+	if (!list_empty(&resources_rem))
+		resource_thread_wake(0);
+	busy = !list_empty(&resources_rem) || !list_empty(&resources_lazy);
 	pthread_mutex_unlock(&resource_mutex);
+
+	return busy;
 }
 
 int setup_token_manager(void)
 {
-	int rv;
+	int i, rv;
 
 	pthread_mutex_init(&resource_mutex, NULL);
 	pthread_cond_init(&resource_cond, NULL);
@@ -2629,20 +3661,43 @@ int setup_token_manager(void)
 	INIT_LIST_HEAD(&resources_held);
 	INIT_LIST_HEAD(&resources_free);
 	INIT_LIST_HEAD(&resources_orphan);
+	INIT_LIST_HEAD(&resources_lazy);
 	INIT_LIST_HEAD(&host_events);
 
-	rv = pthread_create(&resource_pt, NULL, resource_thread, NULL);
-	if (rv)
+	for (i = 0; i < RESOURCE_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&resource_hash[i]);
+
+	for (i = 0; i < ORPHAN_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&orphan_hash[i]);
+
+	for (i = 0; i < com.resource_threads && i < MAX_RESOURCE_THREADS; i++) {
+		resource_workers[i].index = i;
+		rv = pthread_create(&resource_workers[i].thread, NULL, resource_thread,
+				    &resource_workers[i]);
+		if (rv) {
+			log_error("resource thread %d create error %d", i, rv);
+			break;
+		}
+		pthread_mutex_lock(&resource_mutex);
+		resource_worker_count++;
+		pthread_mutex_unlock(&resource_mutex);
+	}
+
+	if (!resource_worker_count)
 		return -1;
 	return 0;
 }
 
 void close_token_manager(void)
 {
+	int i;
+
 	pthread_mutex_lock(&resource_mutex);
 	resource_thread_stop = 1;
-	pthread_cond_signal(&resource_cond);
+	pthread_cond_broadcast(&resource_cond);
 	pthread_mutex_unlock(&resource_mutex);
-	pthread_join(resource_pt, NULL);
+
+	for (i = 0; i < resource_worker_count; i++)
+		pthread_join(resource_workers[i].thread, NULL);
 }
 
@@ -24,7 +24,7 @@ int lockspace_is_used(struct sanlk_lockspace *ls);
 int resource_orphan_count(char *space_name);
 
 /* no locks */
-void check_mode_block(struct token *token, uint64_t next_lver, int q, char *dblock);
+void check_mode_block(struct token *token, uint64_t next_lver, int q, struct mode_block *mb);
 
 /* locks resource_mutex */
 int convert_token(struct task *task, struct sanlk_resource *res, struct token *cl_token, uint32_t cmd_flags);
@@ -38,6 +38,9 @@ int acquire_token(struct task *task, struct token *token, uint32_t cmd_flags,
 int release_token(struct task *task, struct token *token,
 		  struct sanlk_resource *resrename);
 
+/* locks resource_mutex */
+int release_token_lazy(struct task *task, struct token *token);
+
 /* locks resource_mutex */
 void release_token_async(struct token *token);
 
@@ -47,26 +50,32 @@ int request_token(struct task *task, struct token *token, uint32_t force_mode,
 
 /* locks resource_mutex */
 int set_resource_examine(char *space_name, char *res_name);
+int set_resource_examine_hash(char *space_name, uint32_t hash);
 
 /* locks resource_mutex */
-int res_set_lvb(struct sanlk_resource *res, char *lvb, int lvblen);
+int res_set_lvb(struct task *task, struct sanlk_resource *res, char *lvb, int lvblen,
+		uint32_t flags);
 
 /* locks resource_mutex */
 int res_get_lvb(struct sanlk_resource *res, char **lvb_out, int *lvblen);
 
+/* locks resource_mutex */
+int resource_state(char *buf, int maxlen, int *count);
+
 /* no locks */
 int read_resource_owners(struct task *task, struct token *token,
                          struct sanlk_resource *res,
                          char **send_buf, int *send_len, int *count);
 
 /* locks resource_mutex */
-void rem_resources(void);
+int rem_resources(void);
 
 /* locks resource_mutex */
 int release_orphan(struct sanlk_resource *res);
 
 /* locks resource_mutex */
 void purge_resource_orphans(char *space_name);
+void purge_resource_lazy(char *space_name);
 void purge_resource_free(char *space_name);
 
 /* locks resource_mutex */
@@ -37,6 +37,7 @@
 #include "rindex.h"
 #include "paxos_dblock.h"
 #include "leader.h"
+#include "hash.h"
 
 struct rindex_info {
 	struct sanlk_rindex *ri;    /* point to sanlk_rindex */
@@ -137,43 +138,336 @@ static uint32_t size_to_max_resources(int sector_size, int align_size)
 	return 16000;
 }
 
-static int search_entries(struct rindex_info *rx, char *rindex_iobuf,
-		          uint64_t *ent_offset, uint64_t *res_offset,
-			  int find_free, char *find_name)
+/*
+ * In-memory copy of an rindex, used by lookup/create/delete in place of
+ * reading the entire rindex area and searching it for each request.
+ *
+ * The buf is a copy of the rindex area as it is on disk (so update_rindex
+ * can take the sector it writes from it), and the entries in it are also
+ * indexed by name in a hash table, with a bitmap of free entries.
+ *
+ * Every change to the rindex made by create or delete, on any host, is
+ * done while holding the rindex lease, and each acquire of the lease
+ * increments its lver.  So a copy taken while the lease is free at a
+ * given lver (and leader checksum) is current as long as the leader on
+ * disk is unchanged, which is checked by reading the leader sector rather
+ * than the rindex.  A copy is not kept if the rindex was read while the
+ * lease was held, since the holder may still be changing the rindex.
+ *
+ * Changes made without the rindex lease (update, or the direct commands)
+ * drop the copy on the host making the change, but are not noticed by
+ * other hosts until the next create or delete.
+ *
+ * A cache struct is taken off the list while it is in use, so only the
+ * list is protected by rindex_cache_mutex, and no i/o is done with it held.
+ */
+
+#define RINDEX_CACHE_MAX 8
+
+struct rindex_cache {
+	struct list_head list;
+	char lockspace_name[NAME_ID_SIZE];
+	char path[SANLK_PATH_LEN];
+	uint64_t offset;
+	struct rindex_header header;
+	uint32_t max_resources;
+	int current;               /* lver and checksum are set */
+	uint64_t lver;
+	uint32_t leader_checksum;
+	char *buf;                 /* rindex area, as on disk */
+	uint32_t hash_mask;
+	int32_t *hash_head;        /* first entry number in bucket, or -1 */
+	int32_t *hash_next;        /* next entry number in bucket, or -1 */
+	uint64_t *free_map;        /* bit set for each unused entry */
+	uint32_t free_map_len;
+};
+
+static pthread_mutex_t rindex_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(rindex_caches);
+static int rindex_cache_count;
+
+static struct rindex_entry *rindex_cache_entry(struct rindex_cache *rc, uint32_t num)
 {
-	struct rindex_entry re;
-	struct rindex_entry *re_end;
-	uint64_t entry_offset_in_rindex;
+	return (struct rindex_entry *)(rc->buf + rc->header.sector_size +
+				       (num * sizeof(struct rindex_entry)));
+}
+
+static uint32_t rindex_cache_bucket(struct rindex_cache *rc, const char *name)
+{
+	return name_hash(name, SANLK_NAME_LEN) & rc->hash_mask;
+}
+
+static void rindex_cache_free(struct rindex_cache *rc)
+{
+	if (!rc)
+		return;
+
+	free(rc->buf);
+	free(rc->hash_head);
+	free(rc->hash_next);
+	free(rc->free_map);
+	free(rc);
+}
+
+static int rindex_cache_match(struct rindex_cache *rc, struct rindex_info *rx)
+{
+	return !strncmp(rc->lockspace_name, rx->ri->lockspace_name, NAME_ID_SIZE) &&
+	       !strncmp(rc->path, rx->disk->path, SANLK_PATH_LEN) &&
+	       rc->offset == rx->disk->offset;
+}
+
+static struct rindex_cache *rindex_cache_take(struct rindex_info *rx)
+{
+	struct rindex_cache *rc;
+
+	pthread_mutex_lock(&rindex_cache_mutex);
+	list_for_each_entry(rc, &rindex_caches, list) {
+		if (!rindex_cache_match(rc, rx))
+			continue;
+		list_del(&rc->list);
+		rindex_cache_count--;
+		pthread_mutex_unlock(&rindex_cache_mutex);
+		return rc;
+	}
+	pthread_mutex_unlock(&rindex_cache_mutex);
+	return NULL;
+}
+
+/* Return a cache struct to the list to be used again, or free it. */
+
+static void rindex_cache_put(struct rindex_cache *rc)
+{
+	struct rindex_cache *rc2, *safe;
+	struct rindex_cache *old = NULL;
+
+	if (!rc)
+		return;
+
+	if (!rc->current) {
+		rindex_cache_free(rc);
+		return;
+	}
+
+	pthread_mutex_lock(&rindex_cache_mutex);
+	list_for_each_entry_safe(rc2, safe, &rindex_caches, list) {
+		if (!strncmp(rc2->lockspace_name, rc->lockspace_name, NAME_ID_SIZE) &&
+		    !strncmp(rc2->path, rc->path, SANLK_PATH_LEN) &&
+		    rc2->offset == rc->offset) {
+			/* from a concurrent nolock lookup */
+			list_del(&rc2->list);
+			rindex_cache_count--;
+			old = rc2;
+			break;
+		}
+	}
+
+	list_add(&rc->list, &rindex_caches);
+	rindex_cache_count++;
+
+	/* the least recently used are at the end */
+	if (!old && rindex_cache_count > RINDEX_CACHE_MAX) {
+		old = list_last_entry(&rindex_caches, struct rindex_cache, list);
+		list_del(&old->list);
+		rindex_cache_count--;
+	}
+	pthread_mutex_unlock(&rindex_cache_mutex);
+
+	rindex_cache_free(old);
+}
+
+/* Used by ops that change the rindex without the rindex lease. */
+
+static void rindex_cache_drop(struct rindex_info *rx)
+{
+	rindex_cache_free(rindex_cache_take(rx));
+}
+
+static void rindex_cache_set_leader(struct rindex_cache *rc, struct leader_record *leader)
+{
+	rc->lver = leader->lver;
+	rc->leader_checksum = leader->checksum;
+	rc->current = 1;
+}
+
+static int rindex_cache_is_current(struct rindex_cache *rc, struct leader_record *leader)
+{
+	return rc->current &&
+	       leader->timestamp == LEASE_FREE &&
+	       leader->lver == rc->lver &&
+	       leader->checksum == rc->leader_checksum;
+}
+
+static void rindex_cache_hash_add(struct rindex_cache *rc, uint32_t num, const char *name)
+{
+	uint32_t b = rindex_cache_bucket(rc, name);
+
+	rc->hash_next[num] = rc->hash_head[b];
+	rc->hash_head[b] = num;
+}
+
+static void rindex_cache_hash_del(struct rindex_cache *rc, uint32_t num, const char *name)
+{
+	int32_t *p = &rc->hash_head[rindex_cache_bucket(rc, name)];
+
+	while (*p != -1) {
+		if (*p == num) {
+			*p = rc->hash_next[num];
+			rc->hash_next[num] = -1;
+			return;
+		}
+		p = &rc->hash_next[*p];
+	}
+}
+
+/*
+ * Create the cache struct from a copy of the rindex that was just read
+ * (rindex_iobuf is align_size).  It's not current (can't be reused)
+ * until rindex_cache_set_leader.
+ */
+
+static struct rindex_cache *rindex_cache_load(struct rindex_info *rx, char *rindex_iobuf)
+{
+	struct rindex_cache *rc;
+	struct rindex_entry re_in, *re;
 	uint32_t max_resources = rx->header.max_resources;
 	int sector_size = rx->header.sector_size;
 	int align_size = rindex_header_align_size_from_flag(rx->header.flags);
-	int i;
+	uint32_t hash_size;
+	uint32_t i;
 
 	if (!max_resources)
 		max_resources = size_to_max_resources(sector_size, align_size);
 
+	rc = malloc(sizeof(struct rindex_cache));
+	if (!rc)
+		return NULL;
+	memset(rc, 0, sizeof(struct rindex_cache));
+
+	memcpy(rc->lockspace_name, rx->ri->lockspace_name, NAME_ID_SIZE);
+	memcpy(rc->path, rx->disk->path, SANLK_PATH_LEN);
+	rc->offset = rx->disk->offset;
+	memcpy(&rc->header, &rx->header, sizeof(struct rindex_header));
+	rc->max_resources = max_resources;
+
+	hash_size = 64;
+	while (hash_size < max_resources)
+		hash_size <<= 1;
+	rc->hash_mask = hash_size - 1;
+
+	rc->free_map_len = (max_resources + 63) / 64;
+
+	rc->buf = malloc(align_size);
+	rc->hash_head = malloc(hash_size * sizeof(int32_t));
+	rc->hash_next = malloc(max_resources * sizeof(int32_t));
+	rc->free_map = malloc(rc->free_map_len * sizeof(uint64_t));
+
+	if (!rc->buf || !rc->hash_head || !rc->hash_next || !rc->free_map) {
+		rindex_cache_free(rc);
+		return NULL;
+	}
+
+	memcpy(rc->buf, rindex_iobuf, align_size);
+	memset(rc->hash_head, 0xff, hash_size * sizeof(int32_t));
+	memset(rc->hash_next, 0xff, max_resources * sizeof(int32_t));
+	memset(rc->free_map, 0, rc->free_map_len * sizeof(uint64_t));
+
 	for (i = 0; i < max_resources; i++) {
-		/* skip first sector which holds header */
-		entry_offset_in_rindex = sector_size + (i * sizeof(struct rindex_entry));
+		re = rindex_entry_ref(rindex_cache_entry(rc, i), &re_in);
 
-		re_end = (struct rindex_entry *)(rindex_iobuf + entry_offset_in_rindex);
+		if (!re->res_offset && !re->name[0])
+			rc->free_map[i / 64] |= (1ULL << (i % 64));
 
-		rindex_entry_in(re_end, &re);
+		/* insert in reverse so the first of duplicate names is found first */
+		if (re->name[0])
+			rc->hash_next[i] = -2;
+	}
 
-		if (find_free && (!re.res_offset && !re.name[0])) {
-			*ent_offset = entry_offset_in_rindex;
-			*res_offset = rx->disk->offset + (2 * align_size) + (i * align_size);
-			return 0;
-		}
+	for (i = max_resources; i > 0; i--) {
+		if (rc->hash_next[i - 1] != -2)
+			continue;
+		re = rindex_entry_ref(rindex_cache_entry(rc, i - 1), &re_in);
+		rindex_cache_hash_add(rc, i - 1, re->name);
+	}
 
-		if (find_name && re.name[0] && !strncmp(re.name, find_name, SANLK_NAME_LEN)) {
-			*ent_offset = entry_offset_in_rindex;
-			*res_offset = rx->disk->offset + (2 * align_size) + (i * align_size);
-			return 0;
+	return rc;
+}
+
+/*
+ * Replaces a linear search of the rindex.  Finds the first free entry, or
+ * the entry for a given name.
+ */
+
+static int search_entries(struct rindex_info *rx, struct rindex_cache *rc,
+		          uint64_t *ent_offset, uint64_t *res_offset,
+			  int find_free, char *find_name)
+{
+	struct rindex_entry re_in, *re;
+	int sector_size = rx->header.sector_size;
+	int align_size = rindex_header_align_size_from_flag(rx->header.flags);
+	int32_t num = -1;
+	uint32_t i;
+
+	if (find_free) {
+		for (i = 0; i < rc->free_map_len; i++) {
+			if (!rc->free_map[i])
+				continue;
+			num = (i * 64) + __builtin_ctzll(rc->free_map[i]);
+			break;
+		}
+	} else if (find_name && find_name[0]) {
+		num = rc->hash_head[rindex_cache_bucket(rc, find_name)];
+
+		while (num != -1) {
+			re = rindex_entry_ref(rindex_cache_entry(rc, num), &re_in);
+			if (!strncmp(re->name, find_name, SANLK_NAME_LEN))
+				break;
+			num = rc->hash_next[num];
 		}
 	}
 
-	return -ENOENT;
+	if (num < 0 || num >= rc->max_resources)
+		return -ENOENT;
+
+	*ent_offset = sector_size + (num * sizeof(struct rindex_entry));
+	*res_offset = rx->disk->offset + (2 * align_size) + (num * align_size);
+	return 0;
+}
+
+/* Apply the change that update_rindex wrote to disk. */
+
+static void rindex_cache_update(struct rindex_cache *rc, uint64_t ent_offset,
+				char *name, uint64_t res_offset)
+{
+	struct rindex_entry re_old;
+	struct rindex_entry re_new;
+	uint32_t num;
+
+	if (ent_offset < rc->header.sector_size)
+		return;
+
+	num = (ent_offset - rc->header.sector_size) / sizeof(struct rindex_entry);
+	if (num >= rc->max_resources)
+		return;
+
+	rindex_entry_in(rindex_cache_entry(rc, num), &re_old);
+
+	if (re_old.name[0])
+		rindex_cache_hash_del(rc, num, re_old.name);
+
+	memset(&re_new, 0, sizeof(struct rindex_entry));
+	if (name) {
+		memcpy(re_new.name, name, NAME_ID_SIZE);
+		re_new.res_offset = res_offset;
+	}
+	rindex_entry_out(&re_new, rindex_cache_entry(rc, num));
+
+	if (re_new.name[0])
+		rindex_cache_hash_add(rc, num, re_new.name);
+
+	if (!re_new.res_offset && !re_new.name[0])
+		rc->free_map[num / 64] |= (1ULL << (num % 64));
+	else
+		rc->free_map[num / 64] &= ~(1ULL << (num % 64));
 }
 
 static int update_rindex(struct task *task,
@@ -215,7 +509,7 @@ static int update_rindex(struct task *task,
 
 	p_iobuf = &sector_iobuf;
 
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
+	rv = task_iobuf_alloc(task, iobuf_len, p_iobuf);
 	if (rv)
 		return rv;
 
@@ -239,7 +533,7 @@ static int update_rindex(struct task *task,
 	rv = write_iobuf(rx->disk->fd, rx->disk->offset + sector_offset, sector_iobuf, iobuf_len, task, spi->io_timeout, NULL);
 
 	if (rv != SANLK_AIO_TIMEOUT)
-		free(sector_iobuf);
+		task_iobuf_free(task, sector_iobuf);
 
 	return rv;
 }
@@ -259,7 +553,7 @@ static int read_rindex(struct task *task,
 
 	p_iobuf = &iobuf;
 
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
+	rv = task_iobuf_alloc(task, iobuf_len, p_iobuf);
 	if (rv) {
 		return rv;
 	}
@@ -268,7 +562,8 @@ static int read_rindex(struct task *task,
 
 	rv = read_iobuf(rx->disk->fd, rx->disk->offset, iobuf, iobuf_len, task, spi->io_timeout, NULL);
 	if (rv < 0) {
-		free(iobuf);
+		if (rv != SANLK_AIO_TIMEOUT)
+			task_iobuf_free(task, iobuf);
 		return rv;
 	}
 
@@ -276,6 +571,26 @@ static int read_rindex(struct task *task,
 	return rv;
 }
 
+/* buckets and the lease bitmap fit in the rindex area */
+
+static int rindex_header_hashed_valid(struct rindex_header *rh)
+{
+	int align_size = rindex_header_align_size_from_flag(rh->flags);
+	uint32_t sectors, bitmap;
+
+	if (!(rh->flags & RHF_HASHED) || !align_size)
+		return 0;
+	if ((rh->sector_size != 512) && (rh->sector_size != 4096))
+		return 0;
+	if (!rh->buckets || !rh->max_resources)
+		return 0;
+
+	sectors = align_size / rh->sector_size;
+	bitmap = (rh->max_resources + (rh->sector_size * 8) - 1) / (rh->sector_size * 8);
+
+	return (uint64_t)1 + rh->buckets + bitmap <= sectors;
+}
+
 static int read_rindex_header(struct task *task,
 			      struct space_info *spi,
 			      struct rindex_info *rx)
@@ -305,7 +620,7 @@ static int read_rindex_header(struct task *task,
 
 	p_iobuf = &iobuf;
 
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
+	rv = task_iobuf_alloc(task, iobuf_len, p_iobuf);
 	if (rv)
 		return -ENOMEM;
 
@@ -327,7 +642,8 @@ static int read_rindex_header(struct task *task,
 		goto out;
 	}
 
-	if ((rx->header.version & 0xFFFF0000) != RINDEX_DISK_VERSION_MAJOR) {
+	if (((rx->header.version & 0xFFFF0000) != RINDEX_DISK_VERSION_MAJOR) &&
+	    ((rx->header.version & 0xFFFF0000) != RINDEX_DISK_VERSION_MAJOR_V2)) {
 		log_debug("rindex header bad version %x vs %x on %s:%llu",
 			  rx->header.version,
 			  RINDEX_DISK_VERSION_MAJOR,
@@ -337,6 +653,18 @@ static int read_rindex_header(struct task *task,
 		goto out;
 	}
 
+	if (((rx->header.version & 0xFFFF0000) == RINDEX_DISK_VERSION_MAJOR_V2) &&
+	    !rindex_header_hashed_valid(&rx->header)) {
+		log_debug("rindex header bad hashed flags %x buckets %u max_resources %u on %s:%llu",
+			  rx->header.flags,
+			  rx->header.buckets,
+			  rx->header.max_resources,
+			  rx->disk->path,
+			  (unsigned long long)rx->disk->offset);
+		rv = SANLK_RINDEX_VERSION;
+		goto out;
+	}
+
 	if (strcmp(rx->header.lockspace_name, rx->ri->lockspace_name)) {
 		log_debug("rindex header bad lockspace_name %.48s vs %.48s on %s:%llu",
 			  rx->header.lockspace_name,
@@ -357,278 +685,1132 @@ static int read_rindex_header(struct task *task,
 	}
 out:
 	if (rv != SANLK_AIO_TIMEOUT)
-		free(iobuf);
+		task_iobuf_free(task, iobuf);
 
 	return rv;
 }
 
-/*
- * format rindex: write new rindex header, and initialize internal paxos lease
- * for protecting the rindex.
- */
-
-int rindex_format(struct task *task, struct sanlk_rindex *ri)
+static int read_rindex_leader(struct task *task,
+			      struct space_info *spi,
+			      struct rindex_info *rx,
+			      struct leader_record *leader)
 {
-	struct rindex_info rx;
-	struct rindex_header rh;
-	struct rindex_header rh_end;
 	struct token *token;
-	char *iobuf;
-	char **p_iobuf;
-	uint32_t max_resources;
-	uint32_t max_resources_limit;
-	int sector_size = 0;
-	int align_size = 0;
-	int max_hosts = 0;
-	int iobuf_len;
+	int sector_size = rx->header.sector_size;
+	int align_size = rindex_header_align_size_from_flag(rx->header.flags);
 	int rv;
 
-	memset(&rx, 0, sizeof(rx));
-	rx.ri = ri;
-	rx.disk = (struct sync_disk *)&ri->disk;
-
-	rv = open_disk(rx.disk);
-	if (rv < 0) {
-		log_error("rindex_format open failed %d %s", rv, rx.disk->path);
-		return rv;
-	}
-
-	rv = sizes_from_flags(ri->flags, &sector_size, &align_size, &max_hosts, "RIF");
-	if (rv)
-		return rv;
+	token = setup_rindex_token(rx, sector_size, align_size, spi);
+	if (!token)
+		return -ENOMEM;
 
-	if (!sector_size) {
-		/* sector/align flags were not set, use historical defaults */
-		sector_size = rx.disk->sector_size;
-		align_size = sector_size_to_align_size_old(sector_size);
-		max_hosts = DEFAULT_MAX_HOSTS;
-	}
+	rv = paxos_lease_leader_read(task, token, leader, "rindex_cache");
 
-	/*
-	 * When unspecified, default to 4096 to limit the amount of searching.
-	 */
-	max_resources = rx.ri->max_resources;
-	if (!max_resources)
-		max_resources = 4096;
-	max_resources_limit = size_to_max_resources(sector_size, align_size);
-	if (max_resources > max_resources_limit)
-		max_resources = max_resources_limit;
+	free(token);
+	return rv;
+}
 
-	log_debug("rindex_format %.48s:%s:%llu %d %d max_res %u",
-		  rx.ri->lockspace_name, rx.disk->path,
-		  (unsigned long long)rx.disk->offset,
-		  sector_size, align_size, max_resources);
+/*
+ * Returns the cached rindex if the rindex lease shows it's still current,
+ * and sets rx->header from it.  Otherwise NULL, and the caller needs to
+ * read the rindex header.
+ */
 
-	iobuf_len = align_size;
+static struct rindex_cache *get_current_cache(struct task *task,
+					      struct space_info *spi,
+					      struct rindex_info *rx)
+{
+	struct leader_record leader;
+	struct rindex_cache *rc;
+	int rv;
 
-	p_iobuf = &iobuf;
+	rc = rindex_cache_take(rx);
+	if (!rc)
+		return NULL;
 
-	rv = posix_memalign((void *)p_iobuf, getpagesize(), iobuf_len);
-	if (rv)
-		goto out_close;
+	if (!spi->io_timeout)
+		spi->io_timeout = DEFAULT_IO_TIMEOUT;
 
-	memset(iobuf, 0, iobuf_len);
+	memcpy(&rx->header, &rc->header, sizeof(struct rindex_header));
 
-	memset(&rh, 0, sizeof(struct rindex_header));
-	rh.magic = RINDEX_DISK_MAGIC;
-	rh.version = RINDEX_DISK_VERSION_MAJOR | RINDEX_DISK_VERSION_MINOR;
-	rh.flags = rindex_header_align_flag_from_size(align_size);
-	rh.sector_size = sector_size;
-	rh.max_resources = max_resources;
-	rh.rx_offset = rx.disk->offset;
-	strncpy(rh.lockspace_name, rx.ri->lockspace_name, NAME_ID_SIZE);
+	memset(&leader, 0, sizeof(leader));
 
-	memset(&rh_end, 0, sizeof(struct rindex_header));
-	rindex_header_out(&rh, &rh_end);
+	rv = read_rindex_leader(task, spi, rx, &leader);
+	if (rv == SANLK_OK && rindex_cache_is_current(rc, &leader))
+		return rc;
 
-	memcpy(iobuf, &rh_end, sizeof(struct rindex_header));
+	rindex_cache_free(rc);
+	memset(&rx->header, 0, sizeof(struct rindex_header));
+	return NULL;
+}
 
-	rv = write_iobuf(rx.disk->fd, rx.disk->offset, iobuf, iobuf_len, task, DEFAULT_IO_TIMEOUT, NULL);
-	if (rv < 0) {
-		log_error("rindex_format write failed %d %s", rv, rx.disk->path);
-		goto out_iobuf;
-	}
+/*
+ * After create/delete release the rindex lease, the cached rindex that
+ * was updated is current if the lease is free and still at the lver
+ * that we acquired.
+ */
 
-	token = setup_rindex_token(&rx, sector_size, align_size, NULL);
-	if (!token) {
-		rv = -ENOMEM;
-		goto out_iobuf;
-	}
+static void check_released_cache(struct task *task,
+				 struct space_info *spi,
+				 struct rindex_info *rx,
+				 struct rindex_cache *rc)
+{
+	struct leader_record leader;
+	int rv;
 
-	rv = paxos_lease_init(task, token, 0, 0);
-	if (rv < 0) {
-		log_error("rindex_format lease init failed %d", rv);
-		goto out_token;
-	}
-	
-	rv = 0;
+	memset(&leader, 0, sizeof(leader));
 
- out_token:
-	free(token);
- out_iobuf:
-	if (rv != SANLK_AIO_TIMEOUT)
-		free(iobuf);
- out_close:
-	close_disks(rx.disk, 1);
-	return rv;
+	rv = read_rindex_leader(task, spi, rx, &leader);
+	if (rv == SANLK_OK && leader.timestamp == LEASE_FREE && leader.lver == rc->lver)
+		rindex_cache_set_leader(rc, &leader);
 }
 
-int rindex_create(struct task *task, struct sanlk_rindex *ri,
-		  struct sanlk_rentry *re, struct sanlk_rentry *re_ret,
-		  uint32_t max_hosts, uint32_t num_hosts)
+/*
+ * Read the rindex (without holding the rindex lease.)  The leader is read
+ * before the rindex so that a copy is only saved when no update was in
+ * progress or could have been made since.  For a hashed rindex only the
+ * header is read, and rc_ret is NULL.
+ */
+
+static int get_rindex(struct task *task,
+		      struct space_info *spi,
+		      struct rindex_info *rx,
+		      struct rindex_cache **rc_ret)
 {
-	struct rindex_info rx;
-	struct space_info spi;
 	struct leader_record leader;
-	struct paxos_dblock dblock;
-	struct token *rx_token;
-	struct token *res_token;
+	struct rindex_cache *rc;
 	char *rindex_iobuf = NULL;
-	uint64_t ent_offset, res_offset;
-	int sector_size, align_size;
+	int leader_rv;
 	int rv;
 
-	memset(&rx, 0, sizeof(rx));
-	rx.ri = ri;
-	rx.disk = (struct sync_disk *)&ri->disk;
+	rc = get_current_cache(task, spi, rx);
+	if (rc) {
+		*rc_ret = rc;
+		return 0;
+	}
 
-	rv = open_disk(rx.disk);
-	if (rv < 0) {
-		log_error("rindex_create open failed %d %s", rv, rx.disk->path);
+	rv = read_rindex_header(task, spi, rx);
+	if (rv < 0)
 		return rv;
+
+	/* the caller reads the sectors it needs */
+	if (rx->header.flags & RHF_HASHED) {
+		*rc_ret = NULL;
+		return 0;
 	}
 
-	/*
-	 * Allows only one rindex op for a given lockspace at a time.
-	 * If there's already one in progress, this returns EBUSY.
-	 * Also collects lockspace info at the same time.
-	 */
-	memset(&spi, 0, sizeof(spi));
+	memset(&leader, 0, sizeof(leader));
 
-	rv = lockspace_begin_rindex_op(ri->lockspace_name, RX_OP_CREATE, &spi);
-	if (rv < 0) {
-		log_error("rindex_create lockspace not available %d %.48s", rv, ri->lockspace_name);
-		goto out_close;
+	leader_rv = read_rindex_leader(task, spi, rx, &leader);
+
+	rv = read_rindex(task, spi, rx, &rindex_iobuf);
+	if (rv < 0)
+		return rv;
+
+	rc = rindex_cache_load(rx, rindex_iobuf);
+
+	task_iobuf_free(task, rindex_iobuf);
+
+	if (!rc)
+		return -ENOMEM;
+
+	if (leader_rv == SANLK_OK && leader.timestamp == LEASE_FREE)
+		rindex_cache_set_leader(rc, &leader);
+
+	*rc_ret = rc;
+	return 0;
+}
+
+/*
+ * Hashed rindex, see rindex_disk.h.  The sectors used by an op are read
+ * when first needed and kept in hx->sectors, or are all in hx->full when
+ * the entire rindex has been read.  Sectors that are changed are marked
+ * dirty and written by hx_write.  The in-memory rindex_cache is not used
+ * for a hashed rindex, since a lookup only reads the sectors it needs.
+ */
+
+#define HX_LOAD_PCT 125 /* bucket slots per 100 max_resources */
+
+struct hx_info {
+	struct task *task;
+	struct space_info *spi;
+	struct rindex_info *rx;
+	int sector_size;
+	int align_size;
+	uint32_t num_sectors;
+	uint32_t per_bucket;	/* entries in a bucket sector */
+	uint32_t buckets;
+	uint32_t bitmap_first;	/* first sector of the lease bitmap */
+	uint32_t max_resources;
+	uint64_t res_start;	/* offset of resource lease 0 */
+	char *full;		/* entire rindex area */
+	char *full_read;	/* full that was read by hx_read_full */
+	char **sectors;		/* sectors read by hx_sector */
+	char *dirty;
+};
+
+static int rindex_hashed(struct rindex_info *rx)
+{
+	return (rx->header.flags & RHF_HASHED) ? 1 : 0;
+}
+
+static uint32_t hx_bitmap_sectors(int sector_size, uint32_t max_resources)
+{
+	uint32_t bits = sector_size * 8;
+
+	return (max_resources + bits - 1) / bits;
+}
+
+/*
+ * The number of buckets for a new hashed rindex.  max_resources is reduced
+ * if the buckets that fit in the area can't hold that many entries.
+ */
+
+static uint32_t hx_format_buckets(int sector_size, int align_size, uint32_t *max_resources)
+{
+	uint32_t per_bucket = (sector_size / sizeof(struct rindex_entry)) - 1;
+	uint32_t avail, buckets;
+
+	avail = (align_size / sector_size) - 1 - hx_bitmap_sectors(sector_size, *max_resources);
+
+	buckets = ((uint64_t)*max_resources * HX_LOAD_PCT / 100 + per_bucket - 1) / per_bucket;
+	if (buckets > avail)
+		buckets = avail;
+	if (!buckets)
+		buckets = 1;
+
+	if (*max_resources > buckets * per_bucket)
+		*max_resources = buckets * per_bucket;
+
+	return buckets;
+}
+
+/* the header values were checked by read_rindex_header */
+
+static int hx_setup(struct hx_info *hx, struct task *task, struct space_info *spi,
+		    struct rindex_info *rx, char *full)
+{
+	memset(hx, 0, sizeof(struct hx_info));
+	hx->task = task;
+	hx->spi = spi;
+	hx->rx = rx;
+	hx->sector_size = rx->header.sector_size;
+	hx->align_size = rindex_header_align_size_from_flag(rx->header.flags);
+	hx->num_sectors = hx->align_size / hx->sector_size;
+	hx->per_bucket = (hx->sector_size / sizeof(struct rindex_entry)) - 1;
+	hx->buckets = rx->header.buckets;
+	hx->bitmap_first = 1 + hx->buckets;
+	hx->max_resources = rx->header.max_resources;
+	hx->res_start = rx->disk->offset + (2 * hx->align_size);
+	hx->full = full;
+
+	hx->dirty = calloc(hx->num_sectors, 1);
+	hx->sectors = calloc(hx->num_sectors, sizeof(char *));
+	if (!hx->dirty || !hx->sectors) {
+		free(hx->dirty);
+		free(hx->sectors);
+		return -ENOMEM;
 	}
+	return 0;
+}
 
-	rv = read_rindex_header(task, &spi, &rx);
-	if (rv < 0) {
-		log_error("rindex_create failed to read rindex header %d on %s:%llu",
-			  rv, rx.disk->path, (unsigned long long)rx.disk->offset);
-		goto out_clear;
+static void hx_free(struct hx_info *hx)
+{
+	uint32_t i;
+
+	if (hx->sectors) {
+		for (i = 0; i < hx->num_sectors; i++) {
+			if (hx->sectors[i])
+				task_iobuf_free(hx->task, hx->sectors[i]);
+		}
 	}
+	if (hx->full_read)
+		task_iobuf_free(hx->task, hx->full_read);
+	free(hx->sectors);
+	free(hx->dirty);
+}
 
-	sector_size = rx.header.sector_size;
-	align_size = rindex_header_align_size_from_flag(rx.header.flags);
+static int hx_sector(struct hx_info *hx, uint32_t num, char **buf)
+{
+	struct sync_disk *disk = hx->rx->disk;
+	int rv;
 
-	log_debug("rindex_create %.48s:%s:%llu %d %d max_res %u",
-		  rx.ri->lockspace_name, rx.disk->path,
-		  (unsigned long long)rx.disk->offset,
-		  sector_size, align_size, rx.header.max_resources);
+	if (hx->full) {
+		*buf = hx->full + ((uint64_t)num * hx->sector_size);
+		return 0;
+	}
 
-	/* used to acquire the internal paxos lease protecting the rindex */
-	rx_token = setup_rindex_token(&rx, sector_size, align_size, &spi);
-	if (!rx_token) {
-		rv = -ENOMEM;
-		goto out_clear;
+	if (!hx->sectors[num]) {
+		rv = task_iobuf_alloc(hx->task, hx->sector_size, &hx->sectors[num]);
+		if (rv)
+			return rv;
+
+		rv = read_iobuf(disk->fd, disk->offset + ((uint64_t)num * hx->sector_size),
+				hx->sectors[num], hx->sector_size, hx->task, hx->spi->io_timeout, NULL);
+		if (rv < 0) {
+			if (rv != SANLK_AIO_TIMEOUT)
+				task_iobuf_free(hx->task, hx->sectors[num]);
+			hx->sectors[num] = NULL;
+			return rv;
+		}
 	}
 
-	/* used to initialize the new paxos lease for the resource */
-	res_token = setup_resource_token(&rx, re->name, sector_size, align_size, &spi);
-	if (!res_token) {
-		free(rx_token);
-		rv = -ENOMEM;
-		goto out_clear;
+	*buf = hx->sectors[num];
+	return 0;
+}
+
+/* Used before anything is changed, when most of the rindex will be used. */
+
+static int hx_read_full(struct hx_info *hx)
+{
+	int rv;
+
+	if (hx->full)
+		return 0;
+
+	rv = read_rindex(hx->task, hx->spi, hx->rx, &hx->full_read);
+	if (rv < 0)
+		return rv;
+
+	hx->full = hx->full_read;
+	return 0;
+}
+
+static struct rindex_entry *hx_entry_end(char *buf, uint32_t slot)
+{
+	return (struct rindex_entry *)(buf + (slot * sizeof(struct rindex_entry)));
+}
+
+/* entry slot in the bucket sector to the offset of the entry in rindex */
+
+static uint64_t hx_ent_offset(struct hx_info *hx, uint32_t sector, uint32_t slot)
+{
+	return ((uint64_t)sector * hx->sector_size) + (slot * sizeof(struct rindex_entry));
+}
+
+static int hx_find(struct hx_info *hx, const char *name, uint32_t *sector_ret,
+		   uint32_t *slot_ret, struct rindex_entry *re)
+{
+	struct rindex_bucket rb;
+	uint32_t b, i, slot;
+	char *buf;
+	int rv;
+
+	b = name_hash(name, SANLK_NAME_LEN) % hx->buckets;
+
+	for (i = 0; i < hx->buckets; i++) {
+		rv = hx_sector(hx, 1 + b, &buf);
+		if (rv < 0)
+			return rv;
+
+		rindex_bucket_in((struct rindex_bucket *)buf, &rb);
+
+		for (slot = 1; rb.count && slot <= hx->per_bucket; slot++) {
+			rindex_entry_in(hx_entry_end(buf, slot), re);
+			if (re->name[0] && !strncmp(re->name, name, SANLK_NAME_LEN)) {
+				*sector_ret = 1 + b;
+				*slot_ret = slot;
+				return 0;
+			}
+		}
+
+		if (!(rb.flags & RXB_OVERFLOW))
+			break;
+
+		b = (b + 1) % hx->buckets;
 	}
 
-	log_debug("rindex_create acquire offset %llu sector_size %d align_size %d",
-		  (unsigned long long)rx_token->disks[0].offset,
-		  rx_token->sector_size, rx_token->align_size);
+	return -ENOENT;
+}
 
-	rv = paxos_lease_acquire(task, rx_token,
-			         PAXOS_ACQUIRE_OWNER_NOWAIT | PAXOS_ACQUIRE_QUIET_FAIL,
-			         &leader, &dblock, 0, 0);
-	if (rv < 0) {
-		/* TODO: sleep and retry if this fails because it's held by another host? */
-		log_error("rindex_create failed to acquire rindex lease %d", rv);
-		goto out_token;
+/* Entries are not placed by offset, so this can read every bucket. */
+
+static int hx_find_offset(struct hx_info *hx, uint64_t res_offset, uint32_t *sector_ret,
+			  uint32_t *slot_ret, struct rindex_entry *re)
+{
+	uint32_t sector, slot;
+	char *buf;
+	int rv;
+
+	for (sector = 1; sector <= hx->buckets; sector++) {
+		rv = hx_sector(hx, sector, &buf);
+		if (rv < 0)
+			return rv;
+
+		for (slot = 1; slot <= hx->per_bucket; slot++) {
+			rindex_entry_in(hx_entry_end(buf, slot), re);
+			if (re->name[0] && re->res_offset == res_offset) {
+				*sector_ret = sector;
+				*slot_ret = slot;
+				return 0;
+			}
+		}
 	}
 
-	rv = read_rindex(task, &spi, &rx, &rindex_iobuf);
-	if (rv < 0) {
-		log_error("rindex_create failed to read rindex %d", rv);
-		goto out_lease;
+	return -ENOENT;
+}
+
+static int hx_insert(struct hx_info *hx, const char *name, uint64_t res_offset,
+		     uint32_t *sector_ret, uint32_t *slot_ret)
+{
+	struct rindex_bucket rb;
+	struct rindex_entry re;
+	uint32_t b, i, slot;
+	char *buf;
+	int rv;
+
+	b = name_hash(name, SANLK_NAME_LEN) % hx->buckets;
+
+	for (i = 0; i < hx->buckets; i++) {
+		rv = hx_sector(hx, 1 + b, &buf);
+		if (rv < 0)
+			return rv;
+
+		rindex_bucket_in((struct rindex_bucket *)buf, &rb);
+
+		for (slot = 1; rb.count < hx->per_bucket && slot <= hx->per_bucket; slot++) {
+			rindex_entry_in(hx_entry_end(buf, slot), &re);
+			if (re.name[0] || re.res_offset)
+				continue;
+
+			memset(&re, 0, sizeof(re));
+			memcpy(re.name, name, NAME_ID_SIZE);
+			re.res_offset = res_offset;
+			rindex_entry_out(&re, hx_entry_end(buf, slot));
+
+			rb.count++;
+			rindex_bucket_out(&rb, (struct rindex_bucket *)buf);
+			hx->dirty[1 + b] = 1;
+
+			*sector_ret = 1 + b;
+			*slot_ret = slot;
+			return 0;
+		}
+
+		if (!(rb.flags & RXB_OVERFLOW)) {
+			rb.flags |= RXB_OVERFLOW;
+			rindex_bucket_out(&rb, (struct rindex_bucket *)buf);
+			hx->dirty[1 + b] = 1;
+		}
+
+		b = (b + 1) % hx->buckets;
 	}
 
-	rv = search_entries(&rx, rindex_iobuf, &ent_offset, &res_offset, 1, NULL);
+	return -ENOSPC;
+}
+
+/* The overflow flag is left set, it's cleared by rebuild. */
+
+static int hx_remove(struct hx_info *hx, uint32_t sector, uint32_t slot)
+{
+	struct rindex_bucket rb;
+	char *buf;
+	int rv;
+
+	rv = hx_sector(hx, sector, &buf);
+	if (rv < 0)
+		return rv;
+
+	memset(hx_entry_end(buf, slot), 0, sizeof(struct rindex_entry));
+
+	rindex_bucket_in((struct rindex_bucket *)buf, &rb);
+	if (rb.count)
+		rb.count--;
+	rindex_bucket_out(&rb, (struct rindex_bucket *)buf);
+
+	hx->dirty[sector] = 1;
+	return 0;
+}
+
+/* resource lease offset to lease number, -1 if it's not a lease in the rindex */
+
+static int64_t hx_lease_num(struct hx_info *hx, uint64_t res_offset)
+{
+	uint64_t num;
+
+	if (res_offset < hx->res_start || (res_offset - hx->res_start) % hx->align_size)
+		return -1;
+
+	num = (res_offset - hx->res_start) / hx->align_size;
+	if (num >= hx->max_resources)
+		return -1;
+
+	return num;
+}
+
+static uint64_t hx_lease_offset(struct hx_info *hx, uint32_t num)
+{
+	return hx->res_start + ((uint64_t)num * hx->align_size);
+}
+
+static int hx_lease_byte(struct hx_info *hx, uint32_t num, uint8_t **byte, uint32_t *sector)
+{
+	uint32_t bits = hx->sector_size * 8;
+	char *buf;
+	int rv;
+
+	*sector = hx->bitmap_first + (num / bits);
+
+	rv = hx_sector(hx, *sector, &buf);
+	if (rv < 0)
+		return rv;
+
+	*byte = (uint8_t *)buf + ((num % bits) / 8);
+	return 0;
+}
+
+static int hx_lease_used(struct hx_info *hx, uint32_t num, int *used)
+{
+	uint32_t sector;
+	uint8_t *byte;
+	int rv;
+
+	rv = hx_lease_byte(hx, num, &byte, &sector);
+	if (rv < 0)
+		return rv;
+
+	*used = (*byte & (1 << (num % 8))) ? 1 : 0;
+	return 0;
+}
+
+static int hx_lease_set(struct hx_info *hx, uint32_t num, int used)
+{
+	uint32_t sector;
+	uint8_t *byte;
+	int rv;
+
+	rv = hx_lease_byte(hx, num, &byte, &sector);
+	if (rv < 0)
+		return rv;
+
+	if (used)
+		*byte |= (1 << (num % 8));
+	else
+		*byte &= ~(1 << (num % 8));
+
+	hx->dirty[sector] = 1;
+	return 0;
+}
+
+/* Find the first unused resource lease, and mark it used if set. */
+
+static int hx_lease_free(struct hx_info *hx, uint32_t *num_ret, int set)
+{
+	uint32_t bits = hx->sector_size * 8;
+	uint32_t sectors = hx_bitmap_sectors(hx->sector_size, hx->max_resources);
+	uint32_t s, i, num;
+	uint8_t *byte;
+	char *buf;
+	int rv;
+
+	for (s = 0; s < sectors; s++) {
+		rv = hx_sector(hx, hx->bitmap_first + s, &buf);
+		if (rv < 0)
+			return rv;
+
+		for (i = 0; i < (uint32_t)hx->sector_size; i++) {
+			byte = (uint8_t *)buf + i;
+			if (*byte == 0xff)
+				continue;
+
+			num = (s * bits) + (i * 8) + __builtin_ctz(~(uint32_t)*byte);
+			if (num >= hx->max_resources)
+				return -ENOENT;
+
+			if (set) {
+				rv = hx_lease_set(hx, num, 1);
+				if (rv < 0)
+					return rv;
+			}
+			*num_ret = num;
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/* Write each run of dirty sectors from first to end. */
+
+static int hx_write(struct hx_info *hx, uint32_t first_sector, uint32_t end_sector)
+{
+	struct sync_disk *disk = hx->rx->disk;
+	char *iobuf;
+	char *buf;
+	uint32_t first, last, num;
+	int len;
+	int rv;
+
+	for (first = first_sector; first < end_sector; first = last) {
+		last = first + 1;
+
+		if (!hx->dirty[first])
+			continue;
+
+		while (last < end_sector && hx->dirty[last])
+			last++;
+
+		len = (last - first) * hx->sector_size;
+
+		rv = task_iobuf_alloc(hx->task, len, &iobuf);
+		if (rv)
+			return rv;
+
+		for (num = first; num < last; num++) {
+			hx_sector(hx, num, &buf);
+			memcpy(iobuf + ((num - first) * hx->sector_size), buf, hx->sector_size);
+		}
+
+		rv = write_iobuf(disk->fd, disk->offset + ((uint64_t)first * hx->sector_size),
+				 iobuf, len, hx->task, hx->spi->io_timeout, NULL);
+
+		if (rv != SANLK_AIO_TIMEOUT)
+			task_iobuf_free(hx->task, iobuf);
+
+		if (rv < 0)
+			return rv;
+
+		memset(hx->dirty + first, 0, last - first);
+	}
+
+	return 0;
+}
+
+static int hx_write_buckets(struct hx_info *hx)
+{
+	return hx_write(hx, 1, hx->bitmap_first);
+}
+
+static int hx_write_bitmap(struct hx_info *hx)
+{
+	return hx_write(hx, hx->bitmap_first, hx->num_sectors);
+}
+
+/*
+ * The resource lease for a name is found by reading the bucket sectors,
+ * and a free lease by reading the bitmap.  Only the name recorded for a
+ * given offset needs the entire rindex.
+ */
+
+static int lookup_hashed(struct task *task, struct space_info *spi, struct rindex_info *rx,
+			 struct sanlk_rentry *re, struct sanlk_rentry *re_ret)
+{
+	struct hx_info hx;
+	struct rindex_entry ent;
+	uint32_t sector, slot, num;
+	int64_t lease_num;
+	int used = 0;
+	int rv;
+
+	rv = hx_setup(&hx, task, spi, rx, NULL);
+	if (rv < 0)
+		return rv;
+
+	if (!re->name[0] && !re->offset) {
+		/* find the first free resource lease offset */
+
+		rv = hx_lease_free(&hx, &num, 0);
+		if (rv < 0)
+			goto out;
+
+		memset(re_ret->name, 0, SANLK_NAME_LEN);
+		re_ret->offset = hx_lease_offset(&hx, num);
+		goto out;
+	}
+
+	if (re->name[0]) {
+		rv = hx_find(&hx, re->name, &sector, &slot, &ent);
+
+		if (!rv && (!re->offset || ent.res_offset == re->offset)) {
+			memcpy(re_ret->name, re->name, SANLK_NAME_LEN);
+			re_ret->offset = ent.res_offset;
+			goto out;
+		}
+
+		if (!re->offset || (rv < 0 && rv != -ENOENT))
+			goto out;
+	}
+
+	/* find the name the index has recorded for the given offset */
+
+	memset(&ent, 0, sizeof(ent));
+
+	lease_num = hx_lease_num(&hx, re->offset);
+	if (lease_num >= 0) {
+		rv = hx_lease_used(&hx, lease_num, &used);
+		if (rv < 0)
+			goto out;
+	}
+
+	if (used) {
+		rv = hx_read_full(&hx);
+		if (rv < 0)
+			goto out;
+
+		rv = hx_find_offset(&hx, re->offset, &sector, &slot, &ent);
+		if (rv < 0 && rv != -ENOENT)
+			goto out;
+		if (rv < 0)
+			memset(&ent, 0, sizeof(ent));
+	}
+
+	if (re->name[0] && strncmp(re->name, ent.name, SANLK_NAME_LEN))
+		rv = SANLK_RINDEX_DIFF;
+	else
+		rv = 0;
+
+	memcpy(re_ret->name, ent.name, SANLK_NAME_LEN);
+	re_ret->offset = re->offset;
+ out:
+	hx_free(&hx);
+	return rv;
+}
+
+/* rindex_iobuf is the entire rindex */
+
+static int update_hashed(struct task *task, struct space_info *spi, struct rindex_info *rx,
+			 char *rindex_iobuf, struct sanlk_rentry *re, int op_add)
+{
+	struct hx_info hx;
+	struct rindex_entry ent;
+	uint32_t sector, slot;
+	int64_t lease_num;
+	int rv;
+
+	rv = hx_setup(&hx, task, spi, rx, rindex_iobuf);
+	if (rv < 0)
+		return rv;
+
+	lease_num = hx_lease_num(&hx, re->offset);
+	if (lease_num < 0) {
+		rv = SANLK_RINDEX_OFFSET;
+		goto out;
+	}
+
+	/* an entry added for an offset replaces the one there, like unhashed */
+	while (!hx_find_offset(&hx, re->offset, &sector, &slot, &ent))
+		hx_remove(&hx, sector, slot);
+
+	if (op_add) {
+		rv = hx_insert(&hx, re->name, re->offset, &sector, &slot);
+		if (rv < 0)
+			goto out;
+	}
+
+	rv = hx_lease_set(&hx, lease_num, op_add);
+	if (rv < 0)
+		goto out;
+
+	rv = hx_write(&hx, 1, hx.num_sectors);
+ out:
+	hx_free(&hx);
+	return rv;
+}
+
+/*
+ * format rindex: write new rindex header, and initialize internal paxos lease
+ * for protecting the rindex.
+ */
+
+int rindex_format(struct task *task, struct sanlk_rindex *ri)
+{
+	struct rindex_info rx;
+	struct rindex_header rh;
+	struct rindex_header rh_end;
+	struct token *token;
+	char *iobuf;
+	char **p_iobuf;
+	uint32_t max_resources;
+	uint32_t max_resources_limit;
+	int sector_size = 0;
+	int align_size = 0;
+	int max_hosts = 0;
+	int iobuf_len;
+	int rv;
+
+	memset(&rx, 0, sizeof(rx));
+	rx.ri = ri;
+	rx.disk = (struct sync_disk *)&ri->disk;
+
+	rv = open_disk(rx.disk);
 	if (rv < 0) {
-		log_error("rindex_create failed to find free offset %d", rv);
-		goto out_iobuf;
+		log_error("rindex_format open failed %d %s", rv, rx.disk->path);
+		return rv;
 	}
 
-	/* set the location of the new paxos lease */
+	rv = sizes_from_flags(ri->flags, &sector_size, &align_size, &max_hosts, "RIF");
+	if (rv)
+		return rv;
 
-	log_debug("rindex_create found offset %llu for %.48s:%.48s",
-		  (unsigned long long)res_offset,
-		  rx.ri->lockspace_name, re->name);
+	if (!sector_size) {
+		/* sector/align flags were not set, use historical defaults */
+		sector_size = rx.disk->sector_size;
+		align_size = sector_size_to_align_size_old(sector_size);
+		max_hosts = DEFAULT_MAX_HOSTS;
+	}
+
+	/*
+	 * When unspecified, default to 4096 to limit the amount of searching.
+	 */
+	max_resources = rx.ri->max_resources;
+	if (!max_resources)
+		max_resources = 4096;
+	max_resources_limit = size_to_max_resources(sector_size, align_size);
+	if (max_resources > max_resources_limit)
+		max_resources = max_resources_limit;
+
+	log_debug("rindex_format %.48s:%s:%llu %d %d max_res %u",
+		  rx.ri->lockspace_name, rx.disk->path,
+		  (unsigned long long)rx.disk->offset,
+		  sector_size, align_size, max_resources);
 
-	res_token->disks[0].offset = res_offset;
+	iobuf_len = align_size;
+
+	p_iobuf = &iobuf;
+
+	rv = task_iobuf_alloc(task, iobuf_len, p_iobuf);
+	if (rv)
+		goto out_close;
+
+	memset(iobuf, 0, iobuf_len);
+
+	memset(&rh, 0, sizeof(struct rindex_header));
+	rh.magic = RINDEX_DISK_MAGIC;
+	rh.version = RINDEX_DISK_VERSION_MAJOR | RINDEX_DISK_VERSION_MINOR;
+	rh.flags = rindex_header_align_flag_from_size(align_size);
+	rh.sector_size = sector_size;
+	rh.max_resources = max_resources;
+	rh.rx_offset = rx.disk->offset;
 
-	/* write the new paxos lease */
+	if (ri->flags & SANLK_RIF_HASHED) {
+		rh.version = RINDEX_DISK_VERSION_MAJOR_V2 | RINDEX_DISK_VERSION_MINOR_V2;
+		rh.flags |= RHF_HASHED;
+		rh.buckets = hx_format_buckets(sector_size, align_size, &rh.max_resources);
 
-	rv = paxos_lease_init(task, res_token, num_hosts, 0);
+		log_debug("rindex_format hashed buckets %u max_res %u", rh.buckets, rh.max_resources);
+	}
+	strncpy(rh.lockspace_name, rx.ri->lockspace_name, NAME_ID_SIZE);
+
+	memset(&rh_end, 0, sizeof(struct rindex_header));
+	rindex_header_out(&rh, &rh_end);
+
+	memcpy(iobuf, &rh_end, sizeof(struct rindex_header));
+
+	rv = write_iobuf(rx.disk->fd, rx.disk->offset, iobuf, iobuf_len, task, DEFAULT_IO_TIMEOUT, NULL);
 	if (rv < 0) {
-		log_error("rindex_create failed to init new lease %d", rv);
+		log_error("rindex_format write failed %d %s", rv, rx.disk->path);
 		goto out_iobuf;
 	}
 
-	rv = update_rindex(task, &spi, &rx, rindex_iobuf, re, ent_offset, res_offset, 0);
-	if (rv < 0) {
-		log_error("rindex_create failed to update rindex %d", rv);
+	token = setup_rindex_token(&rx, sector_size, align_size, NULL);
+	if (!token) {
+		rv = -ENOMEM;
 		goto out_iobuf;
 	}
 
-	log_debug("rindex_create updated rindex entry %llu for %.48s %llu",
-		  (unsigned long long)ent_offset,
-		  re->name,
-		  (unsigned long long)res_offset);
+	rv = paxos_lease_init(task, token, 0, 0);
+	if (rv < 0) {
+		log_error("rindex_format lease init failed %d", rv);
+		goto out_token;
+	}
 
-	re_ret->offset = res_offset;
+	rindex_cache_drop(&rx);
+	
 	rv = 0;
 
- out_iobuf:
-	free(rindex_iobuf);
- out_lease:
-	paxos_lease_release(task, rx_token, NULL, &leader, &leader);
  out_token:
-	free(rx_token);
-	free(res_token);
- out_clear:
-	lockspace_clear_rindex_op(ri->lockspace_name);
+	free(token);
+ out_iobuf:
+	if (rv != SANLK_AIO_TIMEOUT)
+		task_iobuf_free(task, iobuf);
  out_close:
 	close_disks(rx.disk, 1);
 	return rv;
 }
 
 /*
- * clear the rindex entry for a given resource lease name and offset
- * first the rentry is cleared, then the resource lease is cleared
+ * create/delete for a batch of resources acquire the rindex lease once,
+ * make all the rindex changes in the cached copy, and write the changed
+ * rindex sectors and the resource leases with as few writes as possible.
  */
 
-int rindex_delete(struct task *task, struct sanlk_rindex *ri,
-		  struct sanlk_rentry *re, struct sanlk_rentry *re_ret)
+#define RINDEX_WRITE_MAX (8 * 1024 * 1024) /* max bytes in one lease write */
+
+struct rindex_slot {
+	uint64_t ent_offset;
+	uint64_t res_offset;
+	int num; /* index in the rentry array */
+};
+
+static int cmp_slot_offset(const void *a, const void *b)
+{
+	const struct rindex_slot *s1 = a;
+	const struct rindex_slot *s2 = b;
+
+	if (s1->res_offset < s2->res_offset)
+		return -1;
+	if (s1->res_offset > s2->res_offset)
+		return 1;
+	return 0;
+}
+
+/* Write each run of consecutive dirty rindex sectors from the cached copy. */
+
+static int write_rindex_sectors(struct task *task,
+				struct space_info *spi,
+				struct rindex_info *rx,
+				struct rindex_cache *rc,
+				char *dirty, int num_sectors)
+{
+	char *iobuf;
+	char **p_iobuf;
+	int sector_size = rx->header.sector_size;
+	int first, last, len;
+	int rv;
+
+	p_iobuf = &iobuf;
+
+	for (first = 0; first < num_sectors; first = last) {
+		last = first + 1;
+
+		if (!dirty[first])
+			continue;
+
+		while (last < num_sectors && dirty[last])
+			last++;
+
+		len = (last - first) * sector_size;
+
+		rv = task_iobuf_alloc(task, len, p_iobuf);
+		if (rv)
+			return rv;
+
+		memcpy(iobuf, rc->buf + (first * sector_size), len);
+
+		rv = write_iobuf(rx->disk->fd, rx->disk->offset + (first * sector_size),
+				 iobuf, len, task, spi->io_timeout, NULL);
+
+		if (rv != SANLK_AIO_TIMEOUT)
+			task_iobuf_free(task, iobuf);
+
+		if (rv < 0)
+			return rv;
+	}
+
+	return 0;
+}
+
+/*
+ * Write new (or cleared) resource leases at the slot offsets, which are
+ * sorted, with one write for each run of adjacent leases.
+ */
+
+static int write_resource_leases(struct task *task,
+				 struct rindex_info *rx,
+				 struct token *res_token,
+				 struct sanlk_rentry *re,
+				 struct rindex_slot *slots, int count,
+				 int num_hosts, int write_clear)
+{
+	char *iobuf;
+	char **p_iobuf;
+	int align_size = rindex_header_align_size_from_flag(rx->header.flags);
+	int max_run = RINDEX_WRITE_MAX / align_size;
+	int i, j, k, len;
+	int rv;
+
+	if (max_run < 1)
+		max_run = 1;
+
+	p_iobuf = &iobuf;
+
+	for (i = 0; i < count; i = j) {
+		for (j = i + 1; j < count && (j - i) < max_run; j++) {
+			if (slots[j].res_offset != slots[j - 1].res_offset + align_size)
+				break;
+		}
+
+		len = (j - i) * align_size;
+
+		rv = task_iobuf_alloc(task, len, p_iobuf);
+		if (rv)
+			return rv;
+
+		memset(iobuf, 0, len);
+
+		for (k = i; k < j; k++) {
+			memcpy(res_token->r.name, re[slots[k].num].name, SANLK_NAME_LEN);
+
+			rv = paxos_lease_init_buf(res_token, num_hosts, write_clear,
+						  iobuf + ((k - i) * align_size));
+			if (rv < 0) {
+				task_iobuf_free(task, iobuf);
+				return rv;
+			}
+		}
+
+		rv = write_iobuf(rx->disk->fd, slots[i].res_offset, iobuf, len,
+				 task, res_token->io_timeout, NULL);
+
+		if (rv != SANLK_AIO_TIMEOUT)
+			task_iobuf_free(task, iobuf);
+
+		if (rv < 0)
+			return rv;
+	}
+
+	return 0;
+}
+
+/*
+ * rindex_batch for a hashed rindex, with the rindex lease held.  create
+ * writes the new leases, then the bitmap, so a lease is not given out
+ * twice if the host fails before the buckets are written.  delete writes
+ * the buckets and the bitmap before clearing the leases.
+ */
+
+#define HX_BATCH_FULL 64 /* a larger batch reads the entire rindex */
+
+static int batch_hashed(struct task *task, struct space_info *spi, struct rindex_info *rx,
+			struct token *res_token, struct sanlk_rentry *re,
+			struct rindex_slot *slots, int count, uint32_t num_hosts, int op)
 {
+	struct hx_info hx;
+	struct rindex_entry ent;
+	uint32_t sector, slot, num;
+	int64_t lease_num;
+	int i, rv;
+
+	rv = hx_setup(&hx, task, spi, rx, NULL);
+	if (rv < 0)
+		return rv;
+
+	if (count > HX_BATCH_FULL) {
+		rv = hx_read_full(&hx);
+		if (rv < 0)
+			goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (op == RX_OP_CREATE) {
+			rv = hx_lease_free(&hx, &num, 1);
+			if (rv < 0) {
+				log_error("rindex_create failed to find free offset %d", rv);
+				goto out;
+			}
+
+			rv = hx_insert(&hx, re[i].name, hx_lease_offset(&hx, num), &sector, &slot);
+			if (rv < 0) {
+				log_error("rindex_create failed to find free entry %d", rv);
+				goto out;
+			}
+
+			slots[i].res_offset = hx_lease_offset(&hx, num);
+
+			log_debug("rindex_create found offset %llu for %.48s:%.48s",
+				  (unsigned long long)slots[i].res_offset,
+				  rx->ri->lockspace_name, re[i].name);
+		} else {
+			rv = hx_find(&hx, re[i].name, &sector, &slot, &ent);
+			if (rv < 0) {
+				log_error("rindex_delete failed to find entry '%s': %d", re[i].name, rv);
+				goto out;
+			}
+
+			lease_num = hx_lease_num(&hx, ent.res_offset);
+			if (lease_num < 0) {
+				log_error("rindex_delete entry '%s' bad offset %llu", re[i].name,
+					  (unsigned long long)ent.res_offset);
+				rv = SANLK_RINDEX_OFFSET;
+				goto out;
+			}
+
+			rv = hx_remove(&hx, sector, slot);
+			if (rv < 0)
+				goto out;
+
+			rv = hx_lease_set(&hx, lease_num, 0);
+			if (rv < 0)
+				goto out;
+
+			slots[i].res_offset = ent.res_offset;
+		}
+
+		slots[i].ent_offset = hx_ent_offset(&hx, sector, slot);
+		slots[i].num = i;
+	}
+
+	qsort(slots, count, sizeof(struct rindex_slot), cmp_slot_offset);
+
+	if (op == RX_OP_CREATE) {
+		rv = write_resource_leases(task, rx, res_token, re, slots, count, num_hosts, 0);
+		if (rv < 0) {
+			log_error("rindex_create failed to init new lease %d", rv);
+			goto out;
+		}
+
+		rv = hx_write_bitmap(&hx);
+		if (!rv)
+			rv = hx_write_buckets(&hx);
+		if (rv < 0) {
+			log_error("rindex_create failed to update rindex %d", rv);
+			goto out;
+		}
+	} else {
+		rv = hx_write_buckets(&hx);
+		if (!rv)
+			rv = hx_write_bitmap(&hx);
+		if (rv < 0) {
+			log_error("rindex_delete failed to update rindex %d", rv);
+			goto out;
+		}
+
+		rv = write_resource_leases(task, rx, res_token, re, slots, count, 0, 1);
+		if (rv < 0) {
+			log_error("rindex_delete failed to init new lease %d", rv);
+			goto out;
+		}
+	}
+ out:
+	hx_free(&hx);
+	return rv;
+}
+
+/*
+ * create: search the rindex for free resource lease areas, initialize
+ * new resource leases there, then update the rindex for the new leases.
+ * The new leases are written before the index is updated, so the index
+ * will not reference an uninitialized area if the host fails.
+ *
+ * delete: clear the rindex entries for the given resource lease names,
+ * then clear the resource leases.
+ *
+ * Either all the entries are found before anything is written, or the
+ * batch fails.
+ */
+
+static int rindex_batch(struct task *task, struct sanlk_rindex *ri,
+			struct sanlk_rentry *re, struct sanlk_rentry *re_ret,
+			int count, uint32_t num_hosts, int op)
+{
+	const char *fn = (op == RX_OP_CREATE) ? "rindex_create" : "rindex_delete";
 	struct rindex_info rx;
 	struct space_info spi;
 	struct leader_record leader;
 	struct paxos_dblock dblock;
 	struct token *rx_token;
 	struct token *res_token;
+	struct rindex_cache *rc;
+	struct rindex_slot *slots = NULL;
 	char *rindex_iobuf = NULL;
-	uint64_t res_offset = re->offset;
-	uint64_t ent_offset;
+	char *dirty = NULL;
+	uint64_t ent_offset, res_offset;
 	int sector_size, align_size;
-	int rv;
+	int num_sectors;
+	int i, rv;
+
+	if (count < 1 || count > RINDEX_MAX_BATCH)
+		return -EINVAL;
 
 	memset(&rx, 0, sizeof(rx));
 	rx.ri = ri;
@@ -636,7 +1818,7 @@ int rindex_delete(struct task *task, struct sanlk_rindex *ri,
 
 	rv = open_disk(rx.disk);
 	if (rv < 0) {
-		log_error("rindex_create open failed %d %s", rv, rx.disk->path);
+		log_error("%s open failed %d %s", fn, rv, rx.disk->path);
 		return rv;
 	}
 
@@ -647,98 +1829,206 @@ int rindex_delete(struct task *task, struct sanlk_rindex *ri,
 	 */
 	memset(&spi, 0, sizeof(spi));
 
-	rv = lockspace_begin_rindex_op(ri->lockspace_name, RX_OP_DELETE, &spi);
+	rv = lockspace_begin_rindex_op(ri->lockspace_name, op, &spi);
 	if (rv < 0) {
-		log_error("rindex_delete lockspace not available %d %.48s", rv, ri->lockspace_name);
+		log_error("%s lockspace not available %d %.48s", fn, rv, ri->lockspace_name);
 		goto out_close;
 	}
 
-	rv = read_rindex_header(task, &spi, &rx);
-	if (rv < 0) {
-		log_error("rindex_delete failed to read rindex header %d on %s:%llu",
-			  rv, rx.disk->path, (unsigned long long)rx.disk->offset);
-		goto out_clear;
+	rc = get_current_cache(task, &spi, &rx);
+	if (!rc) {
+		rv = read_rindex_header(task, &spi, &rx);
+		if (rv < 0) {
+			log_error("%s failed to read rindex header %d on %s:%llu",
+				  fn, rv, rx.disk->path, (unsigned long long)rx.disk->offset);
+			goto out_clear;
+		}
 	}
 
 	sector_size = rx.header.sector_size;
 	align_size = rindex_header_align_size_from_flag(rx.header.flags);
 
+	log_debug("%s %.48s:%s:%llu %d %d max_res %u count %d", fn,
+		  rx.ri->lockspace_name, rx.disk->path,
+		  (unsigned long long)rx.disk->offset,
+		  sector_size, align_size, rx.header.max_resources, count);
+
 	/* resource lease locations must use the same alignment as the rindex */
-	if (re->offset && (re->offset % align_size)) {
-		rv = SANLK_RINDEX_OFFSET;
-		goto out_clear;
+	if (op == RX_OP_DELETE) {
+		for (i = 0; i < count; i++) {
+			if (re[i].offset && (re[i].offset % align_size)) {
+				rv = SANLK_RINDEX_OFFSET;
+				goto out_cache;
+			}
+		}
+	}
+
+	num_sectors = align_size / sector_size;
+
+	slots = malloc(count * sizeof(struct rindex_slot));
+	dirty = malloc(num_sectors);
+	if (!slots || !dirty) {
+		rv = -ENOMEM;
+		goto out_cache;
 	}
+	memset(dirty, 0, num_sectors);
 
 	/* used to acquire the internal paxos lease protecting the rindex */
 	rx_token = setup_rindex_token(&rx, sector_size, align_size, &spi);
 	if (!rx_token) {
 		rv = -ENOMEM;
-		goto out_clear;
+		goto out_cache;
 	}
 
-	/* used to write the cleared paxos lease for the resource */
-	res_token = setup_resource_token(&rx, re->name, sector_size, align_size, &spi);
+	/* used to write the new or cleared paxos leases for the resources */
+	res_token = setup_resource_token(&rx, re[0].name, sector_size, align_size, &spi);
 	if (!res_token) {
 		free(rx_token);
 		rv = -ENOMEM;
-		goto out_clear;
+		goto out_cache;
 	}
 
+	log_debug("%s acquire offset %llu sector_size %d align_size %d", fn,
+		  (unsigned long long)rx_token->disks[0].offset,
+		  rx_token->sector_size, rx_token->align_size);
+
 	rv = paxos_lease_acquire(task, rx_token,
 			         PAXOS_ACQUIRE_OWNER_NOWAIT | PAXOS_ACQUIRE_QUIET_FAIL,
 			         &leader, &dblock, 0, 0);
 	if (rv < 0) {
 		/* TODO: sleep and retry if this fails because it's held by another host? */
-		log_error("rindex_create failed to acquire rindex lease %d", rv);
+		log_error("%s failed to acquire rindex lease %d", fn, rv);
 		goto out_token;
 	}
 
-	rv = read_rindex(task, &spi, &rx, &rindex_iobuf);
-	if (rv < 0) {
-		log_error("rindex_delete failed to read rindex %d", rv);
-		goto out_lease;
+	if (rindex_hashed(&rx)) {
+		rv = batch_hashed(task, &spi, &rx, res_token, re, slots, count, num_hosts, op);
+		if (rv < 0)
+			goto out_lease;
+		goto out_entries;
+	}
+
+	/*
+	 * The cached rindex is current if nobody has acquired the rindex
+	 * lease between our reading the leader and acquiring it.
+	 */
+	if (rc && (leader.lver != rc->lver + 1)) {
+		rindex_cache_free(rc);
+		rc = NULL;
+	}
+
+	if (!rc) {
+		rv = read_rindex(task, &spi, &rx, &rindex_iobuf);
+		if (rv < 0) {
+			log_error("%s failed to read rindex %d", fn, rv);
+			goto out_lease;
+		}
+
+		rc = rindex_cache_load(&rx, rindex_iobuf);
+		task_iobuf_free(task, rindex_iobuf);
+		if (!rc) {
+			rv = -ENOMEM;
+			goto out_lease;
+		}
 	}
 
-	/* find the entry */
+	/* not current again until the lease is released at this lver */
+	rc->current = 0;
+	rc->lver = leader.lver;
 
-	rv = search_entries(&rx, rindex_iobuf, &ent_offset, &res_offset, 0, re->name);
-	if (rv < 0) {
-		log_error("rindex_delete failed to find entry '%s': %d", re->name, rv);
-		goto out_iobuf;
-	}
+	/*
+	 * Find the slot for each entry, and make the change to the cached
+	 * rindex, so that a free slot is not found twice.
+	 */
 
-	rv = update_rindex(task, &spi, &rx, rindex_iobuf, re, ent_offset, res_offset, 1);
-	if (rv < 0) {
-		log_error("rindex_delete failed to update rindex %d", rv);
-		goto out_iobuf;
+	for (i = 0; i < count; i++) {
+		if (op == RX_OP_CREATE)
+			rv = search_entries(&rx, rc, &ent_offset, &res_offset, 1, NULL);
+		else
+			rv = search_entries(&rx, rc, &ent_offset, &res_offset, 0, re[i].name);
+		if (rv < 0) {
+			if (op == RX_OP_CREATE)
+				log_error("rindex_create failed to find free offset %d", rv);
+			else
+				log_error("rindex_delete failed to find entry '%s': %d", re[i].name, rv);
+			/* nothing is written, but the cached rindex was changed */
+			rindex_cache_free(rc);
+			rc = NULL;
+			goto out_lease;
+		}
+
+		if (op == RX_OP_CREATE)
+			log_debug("rindex_create found offset %llu for %.48s:%.48s",
+				  (unsigned long long)res_offset,
+				  rx.ri->lockspace_name, re[i].name);
+
+		slots[i].ent_offset = ent_offset;
+		slots[i].res_offset = res_offset;
+		slots[i].num = i;
+
+		rindex_cache_update(rc, ent_offset, (op == RX_OP_CREATE) ? re[i].name : NULL, res_offset);
+
+		dirty[ent_offset / sector_size] = 1;
 	}
 
-	/* clear the paxos lease */
+	qsort(slots, count, sizeof(struct rindex_slot), cmp_slot_offset);
+
+	if (op == RX_OP_CREATE) {
+		rv = write_resource_leases(task, &rx, res_token, re, slots, count, num_hosts, 0);
+		if (rv < 0) {
+			log_error("rindex_create failed to init new lease %d", rv);
+			rindex_cache_free(rc);
+			rc = NULL;
+			goto out_lease;
+		}
 
-	res_token->disks[0].offset = res_offset;
+		rv = write_rindex_sectors(task, &spi, &rx, rc, dirty, num_sectors);
+		if (rv < 0) {
+			log_error("rindex_create failed to update rindex %d", rv);
+			rindex_cache_free(rc);
+			rc = NULL;
+			goto out_lease;
+		}
+	} else {
+		rv = write_rindex_sectors(task, &spi, &rx, rc, dirty, num_sectors);
+		if (rv < 0) {
+			log_error("rindex_delete failed to update rindex %d", rv);
+			rindex_cache_free(rc);
+			rc = NULL;
+			goto out_lease;
+		}
 
-	rv = paxos_lease_init(task, res_token, 0, 1);
-	if (rv < 0) {
-		log_error("rindex_delete failed to init new lease %d", rv);
-		goto out_iobuf;
+		rv = write_resource_leases(task, &rx, res_token, re, slots, count, 0, 1);
+		if (rv < 0) {
+			log_error("rindex_delete failed to init new lease %d", rv);
+			goto out_lease;
+		}
 	}
 
-	log_debug("rindex_delete updated rindex entry %llu for %.48s %llu",
-		  (unsigned long long)ent_offset,
-		  re->name,
-		  (unsigned long long)res_offset);
+ out_entries:
+	for (i = 0; i < count; i++) {
+		log_debug("%s updated rindex entry %llu for %.48s %llu", fn,
+			  (unsigned long long)slots[i].ent_offset,
+			  re[slots[i].num].name,
+			  (unsigned long long)slots[i].res_offset);
 
-	re_ret->offset = 0;
+		memcpy(re_ret[slots[i].num].name, re[slots[i].num].name, SANLK_NAME_LEN);
+		re_ret[slots[i].num].offset = (op == RX_OP_CREATE) ? slots[i].res_offset : 0;
+	}
 
 	rv = 0;
 
- out_iobuf:
-	free(rindex_iobuf);
  out_lease:
 	paxos_lease_release(task, rx_token, NULL, &leader, &leader);
+	if (rc)
+		check_released_cache(task, &spi, &rx, rc);
  out_token:
 	free(rx_token);
 	free(res_token);
+ out_cache:
+	rindex_cache_put(rc);
+	free(slots);
+	free(dirty);
  out_clear:
 	lockspace_clear_rindex_op(ri->lockspace_name);
  out_close:
@@ -746,6 +2036,32 @@ int rindex_delete(struct task *task, struct sanlk_rindex *ri,
 	return rv;
 }
 
+int rindex_create(struct task *task, struct sanlk_rindex *ri,
+		  struct sanlk_rentry *re, struct sanlk_rentry *re_ret,
+		  uint32_t max_hosts, uint32_t num_hosts)
+{
+	return rindex_batch(task, ri, re, re_ret, 1, num_hosts, RX_OP_CREATE);
+}
+
+int rindex_create_batch(struct task *task, struct sanlk_rindex *ri,
+			struct sanlk_rentry *re, struct sanlk_rentry *re_ret, int count,
+			uint32_t max_hosts, uint32_t num_hosts)
+{
+	return rindex_batch(task, ri, re, re_ret, count, num_hosts, RX_OP_CREATE);
+}
+
+int rindex_delete(struct task *task, struct sanlk_rindex *ri,
+		  struct sanlk_rentry *re, struct sanlk_rentry *re_ret)
+{
+	return rindex_batch(task, ri, re, re_ret, 1, 0, RX_OP_DELETE);
+}
+
+int rindex_delete_batch(struct task *task, struct sanlk_rindex *ri,
+			struct sanlk_rentry *re, struct sanlk_rentry *re_ret, int count)
+{
+	return rindex_batch(task, ri, re, re_ret, count, 0, RX_OP_DELETE);
+}
+
 int rindex_lookup(struct task *task, struct sanlk_rindex *ri,
 		  struct sanlk_rentry *re, struct sanlk_rentry *re_ret, uint32_t cmd_flags)
 {
@@ -753,7 +2069,7 @@ int rindex_lookup(struct task *task, struct sanlk_rindex *ri,
 	struct space_info spi;
 	struct rindex_entry re_in;
 	struct rindex_entry *re_end;
-	char *rindex_iobuf = NULL;
+	struct rindex_cache *rc = NULL;
 	uint64_t ent_offset, res_offset;
 	int entry_num;
 	int sector_size, align_size;
@@ -778,7 +2094,7 @@ int rindex_lookup(struct task *task, struct sanlk_rindex *ri,
 		}
 	}
 
-	rv = read_rindex_header(task, &spi, &rx);
+	rv = get_rindex(task, &spi, &rx, &rc);
 	if (rv < 0) {
 		goto out_clear;
 	}
@@ -786,22 +2102,22 @@ int rindex_lookup(struct task *task, struct sanlk_rindex *ri,
 	sector_size = rx.header.sector_size;
 	align_size = rindex_header_align_size_from_flag(rx.header.flags);
 
-	rv = read_rindex(task, &spi, &rx, &rindex_iobuf);
-	if (rv < 0) {
-		goto out_clear;
-	}
-
 	if (re->offset && (re->offset % align_size)) {
 		rv = SANLK_RINDEX_OFFSET;
-		goto out_clear;
+		goto out_cache;
+	}
+
+	if (!rc) {
+		rv = lookup_hashed(task, &spi, &rx, re, re_ret);
+		goto out_cache;
 	}
 
 	if (!re->name[0] && !re->offset) {
 		/* find the first free resource lease offset */
 
-		rv = search_entries(&rx, rindex_iobuf, &ent_offset, &res_offset, 1, NULL);
+		rv = search_entries(&rx, rc, &ent_offset, &res_offset, 1, NULL);
 		if (rv < 0) {
-			goto out_iobuf;
+			goto out_cache;
 		}
 
 		memset(re_ret->name, 0, SANLK_NAME_LEN);
@@ -816,7 +2132,7 @@ int rindex_lookup(struct task *task, struct sanlk_rindex *ri,
 		entry_num = (res_offset - rx.disk->offset - (2 * align_size)) / align_size;
 		ent_offset = sector_size + (entry_num * sizeof(struct rindex_entry));
 
-		re_end = (struct rindex_entry *)(rindex_iobuf + ent_offset);
+		re_end = (struct rindex_entry *)(rc->buf + ent_offset);
 
 		rindex_entry_in(re_end, &re_in);
 
@@ -828,9 +2144,9 @@ int rindex_lookup(struct task *task, struct sanlk_rindex *ri,
 		/* search the rindex entries for a given resource lease name and
 		   if found return the offset of the resource lease */
 
-		rv = search_entries(&rx, rindex_iobuf, &ent_offset, &res_offset, 0, re->name);
+		rv = search_entries(&rx, rc, &ent_offset, &res_offset, 0, re->name);
 		if (rv < 0) {
-			goto out_iobuf;
+			goto out_cache;
 		}
 
 		memcpy(re_ret->name, re->name, SANLK_NAME_LEN);
@@ -846,7 +2162,7 @@ int rindex_lookup(struct task *task, struct sanlk_rindex *ri,
 		entry_num = (res_offset - rx.disk->offset - (2 * align_size)) / align_size;
 		ent_offset = sector_size + (entry_num * sizeof(struct rindex_entry));
 
-		re_end = (struct rindex_entry *)(rindex_iobuf + ent_offset);
+		re_end = (struct rindex_entry *)(rc->buf + ent_offset);
 
 		rindex_entry_in(re_end, &re_in);
 
@@ -860,8 +2176,8 @@ int rindex_lookup(struct task *task, struct sanlk_rindex *ri,
 	}
 
 
- out_iobuf:
-	free(rindex_iobuf);
+ out_cache:
+	rindex_cache_put(rc);
  out_clear:
 	if (!nolock)
 		lockspace_clear_rindex_op(ri->lockspace_name);
@@ -933,7 +2249,10 @@ int rindex_update(struct task *task, struct sanlk_rindex *ri,
 		goto out_iobuf;
 	}
 
-	rv = update_rindex(task, &spi, &rx, rindex_iobuf, re, ent_offset, res_offset, op_remove);
+	if (rindex_hashed(&rx))
+		rv = update_hashed(task, &spi, &rx, rindex_iobuf, re, op_add);
+	else
+		rv = update_rindex(task, &spi, &rx, rindex_iobuf, re, ent_offset, res_offset, op_remove);
 	if (rv < 0) {
 		log_error("rindex_update failed to update rindex %d", rv);
 		goto out_iobuf;
@@ -950,7 +2269,8 @@ int rindex_update(struct task *task, struct sanlk_rindex *ri,
 	}
 
  out_iobuf:
-	free(rindex_iobuf);
+	task_iobuf_free(task, rindex_iobuf);
+	rindex_cache_drop(&rx);
  out_clear:
 	if (!nolock)
 		lockspace_clear_rindex_op(ri->lockspace_name);
@@ -959,24 +2279,264 @@ int rindex_update(struct task *task, struct sanlk_rindex *ri,
 	return rv;
 }
 
-int rindex_rebuild(struct task *task, struct sanlk_rindex *ri, uint32_t cmd_flags)
+/*
+ * rindex_rebuild reads the leader sector of each resource lease slot to
+ * see if a lease exists there.  The slots are divided among scan threads
+ * which each take the next REBUILD_GROUP slots and read their leader
+ * sectors with one group of i/os.  Each thread checks the leaders it
+ * reads and sets the rindex entries for its slots, so threads never
+ * touch the same part of the rindex buffer.
+ */
+
+#define REBUILD_THREADS		4
+#define REBUILD_GROUP		MAX_IOBUF_GROUP
+#define REBUILD_WRITE_GAP	8	/* unchanged sectors included in one write */
+
+struct rebuild_scan_args {
+	struct rindex_info *rx;
+	char *rindex_iobuf;
+	char *space_name;
+	int sector_size;
+	int align_size;
+	int io_timeout;
+	int use_aio;
+	int nolock;
+	pthread_mutex_t mutex;
+	uint32_t next;		/* next slot to read */
+	uint32_t end;		/* first slot beyond the end of the device */
+	uint32_t done;
+	uint32_t found;
+	int errors;
+};
+
+static void *rebuild_scan_thread(void *arg)
 {
-	struct rindex_info rx;
+	struct rebuild_scan_args *sa = arg;
+	struct rindex_info *rx = sa->rx;
+	struct iobuf_io ios[REBUILD_GROUP];
+	struct leader_record leader_end;
+	struct leader_record leader;
 	struct rindex_entry re_new;
 	struct rindex_entry re_end;
+	struct task task;
+	char off_str[16];
+	uint64_t res_base = rx->disk->offset + (2 * sa->align_size);
+	uint64_t ent_offset;
+	uint32_t first, slot, slots, done, found;
+	int count, errors = 0;
+	int i, rv;
+
+	memset(&task, 0, sizeof(struct task));
+	setup_task_aio(&task, sa->use_aio, REBUILD_GROUP);
+	sprintf(task.name, "%s", "rebuild");
+
+	memset(ios, 0, sizeof(ios));
+
+	for (i = 0; i < REBUILD_GROUP; i++) {
+		if (task_iobuf_alloc(&task, sa->sector_size, &ios[i].iobuf)) {
+			errors++;
+			goto out;
+		}
+	}
+
+	while (1) {
+		pthread_mutex_lock(&sa->mutex);
+		first = sa->next;
+		if (first >= sa->end) {
+			pthread_mutex_unlock(&sa->mutex);
+			break;
+		}
+		count = (sa->end - first < REBUILD_GROUP) ? sa->end - first : REBUILD_GROUP;
+		sa->next += count;
+		pthread_mutex_unlock(&sa->mutex);
+
+		for (i = 0; i < count; i++) {
+			ios[i].fd = rx->disk->fd;
+			ios[i].offset = res_base + ((uint64_t)(first + i) * sa->align_size);
+			ios[i].iobuf_len = sa->sector_size;
+			ios[i].rv = 0;
+			memset(ios[i].iobuf, 0, sa->sector_size);
+		}
+
+		read_iobufs(ios, count, count, &task, sa->io_timeout);
+
+		found = 0;
+
+		for (i = 0; i < count; i++) {
+			slot = first + i;
+			rv = ios[i].rv;
+
+			offset_to_str(ios[i].offset, sizeof(off_str), off_str);
+
+			/* end of device */
+			if (rv == -EMSGSIZE) {
+				pthread_mutex_lock(&sa->mutex);
+				if (slot < sa->end) {
+					log_debug("rindex_rebuild reached end of device at %u %s", slot, off_str);
+					sa->end = slot;
+				}
+				pthread_mutex_unlock(&sa->mutex);
+				continue;
+			}
+
+			if (rv == SANLK_AIO_TIMEOUT) {
+				/* the task frees the old iobuf when the i/o completes */
+				ios[i].iobuf = NULL;
+				if (task_iobuf_alloc(&task, sa->sector_size, &ios[i].iobuf)) {
+					errors++;
+					goto out;
+				}
+			}
+
+			if (rv < 0) {
+				log_debug("rindex_rebuild read error %d at %u %s", rv, slot, off_str);
+				errors++;
+				continue;
+			}
+
+			memcpy(&leader_end, ios[i].iobuf, sizeof(struct leader_record));
+			leader_record_in(&leader_end, &leader);
+
+			if (leader.magic != PAXOS_DISK_MAGIC)
+				continue;
+
+			log_debug("rindex_rebuild found %.48s at %u %s",
+				  leader.resource_name, slot, off_str);
+
+			memset(&re_new, 0, sizeof(re_new));
+			re_new.res_offset = ios[i].offset;
+			memcpy(re_new.name, leader.resource_name, SANLK_NAME_LEN);
+			rindex_entry_out(&re_new, &re_end);
+
+			/* Within rindex, entries begin after the header sector */
+			ent_offset = sa->sector_size + ((uint64_t)slot * sizeof(struct rindex_entry));
+
+			memcpy(sa->rindex_iobuf + ent_offset, &re_end, sizeof(re_end));
+			found++;
+		}
+
+		pthread_mutex_lock(&sa->mutex);
+		sa->done += count;
+		sa->found += found;
+		slots = sa->end;
+		done = (sa->done < slots) ? sa->done : slots;
+		found = sa->found;
+		pthread_mutex_unlock(&sa->mutex);
+
+		if (!sa->nolock)
+			lockspace_rindex_progress(sa->space_name, slots, done, found);
+	}
+ out:
+	if (errors) {
+		pthread_mutex_lock(&sa->mutex);
+		sa->errors += errors;
+		pthread_mutex_unlock(&sa->mutex);
+	}
+
+	for (i = 0; i < REBUILD_GROUP; i++) {
+		if (ios[i].iobuf)
+			task_iobuf_free(&task, ios[i].iobuf);
+	}
+	close_task_aio(&task);
+	return NULL;
+}
+
+/*
+ * For a hashed rindex, the scan threads set the entries in scan_buf at the
+ * unhashed locations, and they are then added to the zeroed buckets.
+ */
+
+static int rebuild_hashed(struct task *task, struct space_info *spi, struct rindex_info *rx,
+			  char *rindex_iobuf, char *scan_buf)
+{
+	struct hx_info hx;
+	struct rindex_entry re;
+	uint32_t sector, slot, i;
+	int rv;
+
+	rv = hx_setup(&hx, task, spi, rx, rindex_iobuf);
+	if (rv < 0)
+		return rv;
+
+	for (i = 0; i < hx.max_resources; i++) {
+		rindex_entry_in((struct rindex_entry *)(scan_buf + hx.sector_size +
+				(i * sizeof(struct rindex_entry))), &re);
+		if (!re.name[0])
+			continue;
+
+		rv = hx_insert(&hx, re.name, re.res_offset, &sector, &slot);
+		if (rv < 0) {
+			log_error("rindex_rebuild no bucket for %.48s %d", re.name, rv);
+			break;
+		}
+
+		rv = hx_lease_set(&hx, i, 1);
+		if (rv < 0)
+			break;
+	}
+
+	hx_free(&hx);
+	return rv;
+}
+
+/*
+ * Write the sectors of the rebuilt rindex that differ from what was read,
+ * with runs of changed sectors separated by no more than REBUILD_WRITE_GAP
+ * unchanged sectors written together.
+ */
+
+static int rebuild_write_runs(struct task *task, struct rindex_info *rx, int io_timeout,
+			      char *rindex_iobuf, char *prev_iobuf,
+			      int sector_size, int align_size, int *writes)
+{
+	int sectors = align_size / sector_size;
+	int s, start, last;
+	int rv;
+
+	*writes = 0;
+
+	/* the header sector is not changed */
+	for (s = 1; s < sectors; s++) {
+		if (!memcmp(rindex_iobuf + (s * sector_size), prev_iobuf + (s * sector_size), sector_size))
+			continue;
+
+		start = s;
+		last = s;
+
+		for (s = start + 1; s < sectors && (s - last) <= REBUILD_WRITE_GAP; s++) {
+			if (memcmp(rindex_iobuf + (s * sector_size), prev_iobuf + (s * sector_size), sector_size))
+				last = s;
+		}
+
+		rv = write_iobuf(rx->disk->fd, rx->disk->offset + ((uint64_t)start * sector_size),
+				 rindex_iobuf + (start * sector_size),
+				 (last - start + 1) * sector_size, task, io_timeout, NULL);
+		if (rv < 0)
+			return rv;
+
+		(*writes)++;
+		s = last;
+	}
+
+	return 0;
+}
+
+int rindex_rebuild(struct task *task, struct sanlk_rindex *ri, uint32_t cmd_flags)
+{
+	struct rindex_info rx;
+	struct rebuild_scan_args sa;
 	struct space_info spi;
 	struct leader_record leader;
 	struct paxos_dblock dblock;
 	struct token *rx_token;
-	struct token *res_token;
-	struct sanlk_resource res;
-	char off_str[16];
+	pthread_t threads[REBUILD_THREADS];
 	char *rindex_iobuf = NULL;
-	uint64_t res_offset;
-	uint64_t ent_offset;
+	char *prev_iobuf;
+	char *scan_buf = NULL;
 	uint32_t max_resources;
 	int sector_size, align_size;
 	int nolock = cmd_flags & SANLK_RX_NO_LOCKSPACE;
+	int started = 0, writes = 0;
 	int i, rv;
 
 	memset(&rx, 0, sizeof(rx));
@@ -1030,15 +2590,6 @@ int rindex_rebuild(struct task *task, struct sanlk_rindex *ri, uint32_t cmd_flag
 		goto out_clear;
 	}
 
-	memset(&res, 0, sizeof(res));
-
-	res_token = setup_resource_token(&rx, res.name, sector_size, align_size, &spi);
-	if (!res_token) {
-		free(rx_token);
-		rv = -ENOMEM;
-		goto out_clear;
-	}
-
 	if (!nolock) {
 		rv = paxos_lease_acquire(task, rx_token,
 					 PAXOS_ACQUIRE_OWNER_NOWAIT | PAXOS_ACQUIRE_QUIET_FAIL,
@@ -1056,6 +2607,14 @@ int rindex_rebuild(struct task *task, struct sanlk_rindex *ri, uint32_t cmd_flag
 		goto out_lease;
 	}
 
+	prev_iobuf = malloc(align_size);
+	if (!prev_iobuf) {
+		task_iobuf_free(task, rindex_iobuf);
+		rv = -ENOMEM;
+		goto out_lease;
+	}
+	memcpy(prev_iobuf, rindex_iobuf, align_size);
+
 	/*
 	 * Zero all the entries after the header sector.  Entries will be
 	 * recreated in the zeroed space if corresponding resource leases are
@@ -1063,74 +2622,92 @@ int rindex_rebuild(struct task *task, struct sanlk_rindex *ri, uint32_t cmd_flag
 	 */
 	memset(rindex_iobuf + sector_size, 0, align_size - sector_size);
 
-	/*
-	 * We read each potential resource lease offset to check if a
-	 * lease exists there.  It's ok if there is none, and we don't
-	 * want to log errors if none is found.
-	 */
-	res_token->flags |= T_CHECK_EXISTS;
+	if (rindex_hashed(&rx)) {
+		scan_buf = calloc(1, align_size);
+		if (!scan_buf) {
+			free(prev_iobuf);
+			task_iobuf_free(task, rindex_iobuf);
+			rv = -ENOMEM;
+			goto out_lease;
+		}
+	}
 
 	/*
 	 * Read each potential resource lease area and add an rindex entry
 	 * for each one that's found.  Resource leases begin after
-	 * the rindex area and the rindex lease area.
+	 * the rindex area and the rindex lease area.  It's ok if there
+	 * is none, and we don't want to log errors if none is found.
 	 */
-	res_offset = rx.disk->offset + (2 * align_size);
-
-	for (i = 0; i < max_resources; i++) {
-		memset(&re_new, 0, sizeof(re_new));
-		memset(&re_end, 0, sizeof(re_end));
-		memset(&res, 0, sizeof(res));
-		memset(res_token->r.name, 0, SANLK_NAME_LEN);
-		res_token->disks[0].offset = res_offset;
-
-		rv = paxos_read_resource(task, res_token, &res);
+	memset(&sa, 0, sizeof(sa));
+	sa.rx = &rx;
+	sa.rindex_iobuf = scan_buf ? scan_buf : rindex_iobuf;
+	sa.space_name = ri->lockspace_name;
+	sa.sector_size = sector_size;
+	sa.align_size = align_size;
+	sa.io_timeout = spi.io_timeout;
+	sa.use_aio = task->use_aio;
+	sa.nolock = nolock;
+	sa.end = max_resources;
+	pthread_mutex_init(&sa.mutex, NULL);
 
-		offset_to_str(res_offset, sizeof(off_str), off_str);
+	if (!nolock)
+		lockspace_rindex_progress(ri->lockspace_name, max_resources, 0, 0);
 
-		/* end of device */
-		if (rv == -EMSGSIZE) {
-			log_debug("rindex_rebuild reached end of device at %d %s", i, off_str);
+	for (i = 0; i < REBUILD_THREADS; i++) {
+		if ((uint32_t)i * REBUILD_GROUP >= max_resources)
+			break;
+		rv = pthread_create(&threads[i], NULL, rebuild_scan_thread, &sa);
+		if (rv) {
+			log_error("rindex_rebuild thread create error %d", rv);
 			break;
 		}
+		started++;
+	}
 
-		if (rv == SANLK_OK) {
-			log_debug("rindex_rebuild found %.48s at %d %s",
-			  	  res.name, i, off_str);
+	if (!started)
+		rebuild_scan_thread(&sa);
 
-			re_new.res_offset = res_offset;
-			memcpy(re_new.name, res.name, SANLK_NAME_LEN);
-			rindex_entry_out(&re_new, &re_end);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
 
-			/* Within rindex, entries begin after the header sector */
-			ent_offset = sector_size + (i * sizeof(struct rindex_entry));
+	pthread_mutex_destroy(&sa.mutex);
 
-			memcpy(rindex_iobuf + ent_offset, &re_end, sizeof(re_end));
-		} else if ((i + 1) == max_resources) {
-			log_debug("rindex_rebuild found no resource at last %d %s %d",
-			  	  i, off_str, rv);
-		}
+	log_debug("rindex_rebuild found %u in %u slots errors %d",
+		  sa.found, sa.end, sa.errors);
 
-		res_offset += align_size;
+	if (scan_buf) {
+		rv = rebuild_hashed(task, &spi, &rx, rindex_iobuf, scan_buf);
+		free(scan_buf);
+		if (rv < 0) {
+			free(prev_iobuf);
+			task_iobuf_free(task, rindex_iobuf);
+			goto out_lease;
+		}
 	}
 
-	rv = write_iobuf(rx.disk->fd, rx.disk->offset, rindex_iobuf, align_size, task, spi.io_timeout, NULL);
+	rv = rebuild_write_runs(task, &rx, spi.io_timeout, rindex_iobuf, prev_iobuf,
+				sector_size, align_size, &writes);
+	free(prev_iobuf);
 	if (rv < 0) {
 		if (rv != SANLK_AIO_TIMEOUT)
-			free(rindex_iobuf);
+			task_iobuf_free(task, rindex_iobuf);
 		log_error("rindex_rebuild write failed %d %s", rv, rx.disk->path);
+		if (writes)
+			rindex_cache_drop(&rx);
 		goto out_lease;
 	}
 
+	log_debug("rindex_rebuild wrote %d runs", writes);
+
 	rv = 0;
 
-	free(rindex_iobuf);
+	task_iobuf_free(task, rindex_iobuf);
+	rindex_cache_drop(&rx);
  out_lease:
 	if (!nolock)
 		paxos_lease_release(task, rx_token, NULL, &leader, &leader);
  out_token:
 	free(rx_token);
-	free(res_token);
  out_clear:
 	if (!nolock)
 		lockspace_clear_rindex_op(ri->lockspace_name);
@@ -1139,3 +2716,200 @@ int rindex_rebuild(struct task *task, struct sanlk_rindex *ri, uint32_t cmd_flag
 	return rv;
 }
 
+
+/*
+ * convert: rewrite an rindex as hashed, or back to unhashed, keeping the
+ * same entries and resource leases.  This is done offline, without the
+ * rindex lease, and fails if the lease is held.  The lver of the lease is
+ * incremented so that no host uses a copy of the rindex cached before.
+ */
+
+int rindex_convert(struct task *task, struct sanlk_rindex *ri, int hashed)
+{
+	struct rindex_info rx;
+	struct rindex_info rx_new;
+	struct rindex_header rh_end;
+	struct rindex_entry re_end;
+	struct rindex_entry re;
+	struct space_info spi;
+	struct leader_record leader;
+	struct hx_info hx;
+	struct token *token = NULL;
+	char *rindex_iobuf = NULL;
+	char *new_iobuf = NULL;
+	uint32_t max_resources;
+	uint32_t sector, slot, i;
+	int64_t lease_num;
+	int sector_size, align_size;
+	int count = 0;
+	int rv;
+
+	memset(&rx, 0, sizeof(rx));
+	rx.ri = ri;
+	rx.disk = (struct sync_disk *)&ri->disk;
+
+	rv = open_disk(rx.disk);
+	if (rv < 0) {
+		log_error("rindex_convert open failed %d %s", rv, rx.disk->path);
+		return rv;
+	}
+
+	memset(&spi, 0, sizeof(spi));
+
+	rv = read_rindex_header(task, &spi, &rx);
+	if (rv < 0) {
+		log_error("rindex_convert failed to read rindex header %d on %s:%llu",
+			  rv, rx.disk->path, (unsigned long long)rx.disk->offset);
+		goto out_close;
+	}
+
+	if (rindex_hashed(&rx) == hashed) {
+		log_debug("rindex_convert %s is already %s", rx.disk->path,
+			  hashed ? "hashed" : "unhashed");
+		rv = 0;
+		goto out_close;
+	}
+
+	sector_size = rx.header.sector_size;
+	align_size = rindex_header_align_size_from_flag(rx.header.flags);
+
+	max_resources = rx.header.max_resources;
+	if (!max_resources)
+		max_resources = size_to_max_resources(sector_size, align_size);
+
+	token = setup_rindex_token(&rx, sector_size, align_size, &spi);
+	if (!token) {
+		rv = -ENOMEM;
+		goto out_close;
+	}
+
+	rv = paxos_lease_leader_read(task, token, &leader, "rindex_convert");
+	if (rv != SANLK_OK) {
+		log_error("rindex_convert failed to read rindex lease %d", rv);
+		goto out_token;
+	}
+
+	if (leader.timestamp != LEASE_FREE) {
+		log_error("rindex_convert rindex lease is held by host %llu",
+			  (unsigned long long)leader.owner_id);
+		rv = -EBUSY;
+		goto out_token;
+	}
+
+	rv = read_rindex(task, &spi, &rx, &rindex_iobuf);
+	if (rv < 0) {
+		log_error("rindex_convert failed to read rindex %d", rv);
+		goto out_token;
+	}
+
+	rv = task_iobuf_alloc(task, align_size, &new_iobuf);
+	if (rv)
+		goto out_iobuf;
+
+	memset(new_iobuf, 0, align_size);
+
+	memcpy(&rx_new, &rx, sizeof(struct rindex_info));
+
+	if (hashed) {
+		rx_new.header.version = RINDEX_DISK_VERSION_MAJOR_V2 | RINDEX_DISK_VERSION_MINOR_V2;
+		rx_new.header.flags |= RHF_HASHED;
+		rx_new.header.max_resources = max_resources;
+		rx_new.header.buckets = hx_format_buckets(sector_size, align_size,
+							  &rx_new.header.max_resources);
+
+		rv = hx_setup(&hx, task, &spi, &rx_new, new_iobuf);
+		if (rv < 0)
+			goto out_new;
+
+		for (i = 0; i < max_resources; i++) {
+			rindex_entry_in((struct rindex_entry *)(rindex_iobuf + sector_size +
+					(i * sizeof(struct rindex_entry))), &re);
+			if (!re.name[0])
+				continue;
+
+			lease_num = hx_lease_num(&hx, re.res_offset);
+			if (lease_num < 0) {
+				log_error("rindex_convert entry %.48s bad offset %llu",
+					  re.name, (unsigned long long)re.res_offset);
+				rv = SANLK_RINDEX_OFFSET;
+				break;
+			}
+
+			rv = hx_insert(&hx, re.name, re.res_offset, &sector, &slot);
+			if (rv < 0) {
+				log_error("rindex_convert no bucket for %.48s %d", re.name, rv);
+				break;
+			}
+
+			rv = hx_lease_set(&hx, lease_num, 1);
+			if (rv < 0)
+				break;
+			count++;
+		}
+		hx_free(&hx);
+	} else {
+		rx_new.header.version = RINDEX_DISK_VERSION_MAJOR | RINDEX_DISK_VERSION_MINOR;
+		rx_new.header.flags &= ~RHF_HASHED;
+		rx_new.header.buckets = 0;
+
+		rv = hx_setup(&hx, task, &spi, &rx, rindex_iobuf);
+		if (rv < 0)
+			goto out_new;
+
+		for (sector = 1; sector <= hx.buckets; sector++) {
+			for (slot = 1; slot <= hx.per_bucket; slot++) {
+				rindex_entry_in(hx_entry_end(rindex_iobuf + ((uint64_t)sector * sector_size), slot), &re);
+				if (!re.name[0])
+					continue;
+
+				lease_num = hx_lease_num(&hx, re.res_offset);
+				if (lease_num < 0) {
+					log_error("rindex_convert entry %.48s bad offset %llu",
+						  re.name, (unsigned long long)re.res_offset);
+					rv = SANLK_RINDEX_OFFSET;
+					goto out_unhashed;
+				}
+
+				rindex_entry_out(&re, &re_end);
+				memcpy(new_iobuf + sector_size + (lease_num * sizeof(struct rindex_entry)),
+				       &re_end, sizeof(struct rindex_entry));
+				count++;
+			}
+		}
+ out_unhashed:
+		hx_free(&hx);
+	}
+
+	if (rv < 0)
+		goto out_new;
+
+	rindex_header_out(&rx_new.header, &rh_end);
+	memcpy(new_iobuf, &rh_end, sizeof(struct rindex_header));
+
+	log_debug("rindex_convert %s:%llu to %s with %d entries", rx.disk->path,
+		  (unsigned long long)rx.disk->offset, hashed ? "hashed" : "unhashed", count);
+
+	rv = write_iobuf(rx.disk->fd, rx.disk->offset, new_iobuf, align_size, task, spi.io_timeout, NULL);
+	if (rv < 0) {
+		log_error("rindex_convert write failed %d %s", rv, rx.disk->path);
+		goto out_new;
+	}
+
+	leader.lver++;
+
+	rv = paxos_lease_leader_clobber(task, token, &leader, "rindex_convert");
+	if (rv < 0)
+		log_error("rindex_convert failed to write rindex lease %d", rv);
+
+	rindex_cache_drop(&rx);
+ out_new:
+	if (rv != SANLK_AIO_TIMEOUT)
+		task_iobuf_free(task, new_iobuf);
+ out_iobuf:
+	task_iobuf_free(task, rindex_iobuf);
+ out_token:
+	free(token);
+ out_close:
+	close_disks(rx.disk, 1);
+	return rv;
+}
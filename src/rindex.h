@@ -11,6 +11,7 @@
 
 int rindex_format(struct task *task, struct sanlk_rindex *ri);
 int rindex_rebuild(struct task *task, struct sanlk_rindex *ri, uint32_t cmd_flags);
+int rindex_convert(struct task *task, struct sanlk_rindex *ri, int hashed);
 
 int rindex_lookup(struct task *task, struct sanlk_rindex *ri,
                   struct sanlk_rentry *re, struct sanlk_rentry *re_ret, uint32_t cmd_flags);
@@ -22,4 +23,13 @@ int rindex_create(struct task *task, struct sanlk_rindex *ri,
 		  uint32_t num_hosts, uint32_t max_hosts);
 int rindex_delete(struct task *task, struct sanlk_rindex *ri,
                   struct sanlk_rentry *re, struct sanlk_rentry *re_ret);
+
+/* max entries in one create/delete batch, the most entries an rindex can have */
+#define RINDEX_MAX_BATCH 128000
+
+int rindex_create_batch(struct task *task, struct sanlk_rindex *ri,
+                        struct sanlk_rentry *re, struct sanlk_rentry *re_ret, int count,
+                        uint32_t max_hosts, uint32_t num_hosts);
+int rindex_delete_batch(struct task *task, struct sanlk_rindex *ri,
+                        struct sanlk_rentry *re, struct sanlk_rentry *re_ret, int count);
 #endif
@@ -68,6 +68,30 @@
  * resource lease N offset = resource_leases_start + (N * area_size)
  *
  * rindex_entry[N].res_offset = resource lease N offset
+ *
+ * Hashed rindex (version 2, RHF_HASHED)
+ *
+ * The entries are placed by resource name rather than by lease offset,
+ * so a name is found by reading one or two sectors instead of the entire
+ * rindex.  The resource leases are located as above.
+ *
+ * sector 0 holds the rindex_header, with rindex_header.buckets set.
+ * sectors 1 to buckets are the buckets.  The first entry-size slot of
+ * each bucket sector holds a rindex_bucket (the occupancy summary of the
+ * sector), and the remaining slots hold rindex_entry's, 7 per 512 byte
+ * sector or 63 per 4096 byte sector.
+ *
+ * The bucket of a name is name_hash(name) % buckets.  When a bucket is
+ * full, the entry goes in the next bucket that is not full (wrapping
+ * around), and the full bucket is marked with RXB_OVERFLOW, so a search
+ * for a name continues past a bucket only if it has overflowed.
+ *
+ * The sectors following the buckets hold a bitmap of resource leases in
+ * use, with bit N (bit N % 8 of byte N / 8) set for resource lease N.
+ *
+ * buckets are chosen by format so that the bucket slots exceed
+ * max_resources by a quarter, limited by the sectors available in the
+ * align-size area.
  */
 
 #define RINDEX_DISK_MAGIC 0x01042018
@@ -76,11 +100,16 @@
 
 /* MINOR 2: addition of align flags */
 
+/* MAJOR 2: hashed entries, major 1 versions do not read it */
+#define RINDEX_DISK_VERSION_MAJOR_V2 0x00020000
+#define RINDEX_DISK_VERSION_MINOR_V2 0x00000000
+
 /* rindex_header flags */
 #define RHF_ALIGN_1M   0x00000001
 #define RHF_ALIGN_2M   0x00000002
 #define RHF_ALIGN_4M   0x00000004
 #define RHF_ALIGN_8M   0x00000008
+#define RHF_HASHED     0x00000100
 
 struct rindex_header {
 	uint32_t magic;
@@ -88,7 +117,7 @@ struct rindex_header {
 	uint32_t flags; /* RHF_ */
 	uint32_t sector_size;
 	uint32_t max_resources;
-	uint32_t unused;
+	uint32_t buckets; /* hashed only, unused (0) otherwise */
 	uint64_t rx_offset; /* location of rindex_header from start of disk */
 	char lockspace_name[NAME_ID_SIZE];
 };
@@ -105,4 +134,15 @@ struct rindex_entry {
 	char name[NAME_ID_SIZE];
 };
 
+/* rindex_bucket flags */
+#define RXB_OVERFLOW   0x00000001
+
+/* In the first entry-size slot of each bucket sector of a hashed rindex */
+
+struct rindex_bucket {
+	uint32_t count; /* entries used in this sector */
+	uint32_t flags; /* RXB_ */
+	uint64_t unused[7];
+};
+
 #endif
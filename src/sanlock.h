@@ -15,6 +15,13 @@
 
 #define SANLK_MAX_RESOURCES	8
 
+/* a daemon that supports it accepts up to this many resources in one
+   sanlock_acquire() call, see max_acquire_resources in sanlock.conf.
+   An async acquire is still limited to SANLK_MAX_RESOURCES because
+   that is the size of the lver array in sanlk_async_result. */
+
+#define SANLK_MAX_ACQUIRE_RESOURCES	512
+
 /* max resource name length */
 
 #define SANLK_NAME_LEN		48   
@@ -95,6 +102,18 @@ struct sanlk_disk {
 #define SANLK_RES_SECTOR512	0x00000100
 #define SANLK_RES_SECTOR4K	0x00000200
 
+/*
+ * Size of the lvb region, set with sanlock_write_resource().
+ * Without one of these the lvb is the single sector following
+ * the lease, as before.  With one, the region holds this many
+ * bytes of sectors, each ending with a footer that lets a
+ * partially written lvb be detected, so the lvb data that can
+ * be set is somewhat smaller than the region.
+ */
+#define SANLK_RES_LVB4K		0x00000400
+#define SANLK_RES_LVB8K		0x00000800
+#define SANLK_RES_LVB16K	0x00001000
+
 struct sanlk_resource {
 	char lockspace_name[SANLK_NAME_LEN]; /* terminating \0 not required */
 	char name[SANLK_NAME_LEN]; /* terminating \0 not required */
@@ -115,6 +134,7 @@ struct sanlk_resource {
 #define SANLK_RIF_ALIGN8M	0x00000080
 #define SANLK_RIF_SECTOR512	0x00000100
 #define SANLK_RIF_SECTOR4K	0x00000200
+#define SANLK_RIF_HASHED	0x00000400	/* format: hashed entries (v2) */
 
 struct sanlk_rindex {
 	uint32_t flags;		/* SANLK_RIF_ */
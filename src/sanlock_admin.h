@@ -69,6 +69,25 @@ int sanlock_inq_lockspace(struct sanlk_lockspace *ls, uint32_t flags);
 
 int sanlock_rem_lockspace(struct sanlk_lockspace *ls, uint32_t flags);
 
+/*
+ * add_lockspaces/rem_lockspaces do add_lockspace/rem_lockspace for
+ * ls_count lockspaces at once, and the daemon adds or removes them
+ * concurrently.  The result for ls[i] is copied to results[i], with
+ * the same values as add_lockspace/rem_lockspace above.  The flags
+ * apply to each lockspace; with ASYNC the results are those of starting
+ * the add/rem.
+ *
+ * returns:
+ * 0: the results are set for each lockspace
+ * -EINVAL: ls_count is less than 1 or more than 4096
+ */
+
+int sanlock_add_lockspaces(struct sanlk_lockspace *ls, int ls_count,
+			   uint32_t flags, uint32_t io_timeout, int *results);
+
+int sanlock_rem_lockspaces(struct sanlk_lockspace *ls, int ls_count,
+			   uint32_t flags, int *results);
+
 /*
  * get_lockspace returns:
  * 0: all lockspaces copied out, lss_count set to number
@@ -125,6 +144,21 @@ int sanlock_get_hosts(const char *ls_name, uint64_t host_id,
 		      struct sanlk_host **hss, int *hss_count,
 		      uint32_t flags);
 
+/*
+ * Returns sanlk_host info, as sanlock_get_hosts with host_id 0, only
+ * for the hosts whose state (flags) or generation changed after the
+ * sequence number since, including hosts that became FREE.  seq is set
+ * to the sequence number to pass as since in the next call.  With a
+ * since of 0, or one from before the lockspace was last added, all hosts
+ * are returned.  Changes are seen each time the daemon reads the delta
+ * leases of the lockspace.  The timestamp of a host is not a change.
+ * If hss is NULL, only hss_count and seq are set.
+ */
+
+int sanlock_get_hosts_changed(const char *ls_name, uint64_t since, uint64_t *seq,
+			      struct sanlk_host **hss, int *hss_count,
+			      uint32_t flags);
+
 /*
  * set_config cmd values
  *
@@ -157,6 +191,20 @@ int sanlock_set_config(const char *ls_name, uint32_t flags, uint32_t cmd, void *
 
 int sanlock_align(struct sanlk_disk *disk);
 
+/*
+ * Returns the offset of a lease area on the disk, at or after
+ * disk->offset, that does not hold a lockspace, resource or rindex.
+ * The first call for a disk has the daemon scan all the areas on it
+ * (the sizes come from the leader record at disk->offset), and later
+ * calls take the next free area from the map it keeps, so each call
+ * returns a different area.  Areas freed after the scan are found again
+ * with SANLK_NEXT_FREE_RESCAN.  -ENOSPC when no area is free.
+ */
+
+#define SANLK_NEXT_FREE_RESCAN	0x00000001
+
+int sanlock_next_free(struct sanlk_disk *disk, uint32_t flags, uint64_t *offset);
+
 /*
  * Ask sanlock daemon to initialize disk space.
  * Use max_hosts = 0 for default value.
@@ -391,6 +439,9 @@ int sanlock_test_resource_owners(struct sanlk_resource *res, uint32_t flags,
  * Set the ALIGN flag in sanlk_rindex corresponding to the desired
  * sector size; the align size used for the rindex must match the
  * align size used for resources.
+ * Set SANLK_RIF_HASHED to place entries by a hash of the resource
+ * name, so that lookup/create/delete use one or two sectors of the
+ * index instead of the entire index (not readable by older versions.)
  *
  * lookup
  * ------
@@ -434,6 +485,16 @@ int sanlock_test_resource_owners(struct sanlk_resource *res, uint32_t flags,
  * after the index update but before clearing the resource, a
  * subsequent create will overwrite the uncleared resource.
  *
+ * create_resources, delete_resources
+ * ----------------------------------
+ * The same as create_resource and delete_resource for an array of
+ * re_count rentries, holding the rindex paxos lease once for all of
+ * them.  The free lease areas are all found (or all the named entries
+ * are found) before anything is written, otherwise nothing is done.
+ * The resource leases and the rindex sectors are written with one i/o
+ * for each contiguous range.  On success, the offset of each rentry
+ * is set as with the single versions.
+ *
  * rebuild
  * -------
  * Rebuilds the rindex based on resource leases that are found.
@@ -469,8 +530,116 @@ int sanlock_create_resource(struct sanlk_rindex *rx, uint32_t flags,
 int sanlock_delete_resource(struct sanlk_rindex *rx, uint32_t flags,
 			    struct sanlk_rentry *re);
 
+int sanlock_create_resources(struct sanlk_rindex *rx, uint32_t flags,
+			     struct sanlk_rentry *re, int re_count,
+			     int max_hosts, int num_hosts);
+
+int sanlock_delete_resources(struct sanlk_rindex *rx, uint32_t flags,
+			     struct sanlk_rentry *re, int re_count);
+
 int sanlock_version(uint32_t flags, uint32_t *version, uint32_t *proto);
 
+/*
+ * get_stats returns i/o latency stats kept by the daemon for each
+ * disk path and type of i/o (SANLK_IO_), stats_count set to number.
+ * The caller frees stats.  -ENOSPC means internal buffer ran out of
+ * space and only stats_count entries were copied.
+ *
+ * Latencies are recorded in power of 2 microsecond buckets, so the
+ * percentiles are the upper bound of the bucket they fall in.
+ */
+
+#define SANLK_IO_DELTA_READ	1
+#define SANLK_IO_DELTA_WRITE	2
+#define SANLK_IO_LEADER_READ	3
+#define SANLK_IO_LEADER_WRITE	4
+#define SANLK_IO_DBLOCK_READ	5
+#define SANLK_IO_DBLOCK_WRITE	6
+#define SANLK_IO_MBLOCK_WRITE	7
+#define SANLK_IO_LVB_READ	8
+#define SANLK_IO_LVB_WRITE	9
+#define SANLK_IO_OTHER_READ	10
+#define SANLK_IO_OTHER_WRITE	11
+#define SANLK_IO_OPS		12
+
+struct sanlk_io_stats {
+	char path[SANLK_PATH_LEN];
+	uint32_t op;		/* SANLK_IO_ */
+	uint32_t pad;
+	uint64_t count;
+	uint64_t errors;
+	uint64_t total_us;
+	uint64_t max_us;
+	uint64_t p50_us;
+	uint64_t p99_us;
+	uint64_t p999_us;
+};
+
+int sanlock_get_stats(struct sanlk_io_stats **stats, int *stats_count,
+		      uint32_t flags);
+
+/*
+ * The daemon publishes a read-only snapshot of its lockspaces, their
+ * hosts (as returned by get_hosts) and the held resources in a shared
+ * memory file in the run dir.  Reading the snapshot doesn't involve the
+ * daemon: state_open maps the file, and state_read copies a consistent
+ * version of it into a new buffer that the caller frees.  The snapshot
+ * is updated when resources are acquired or released, and at least once
+ * a second, update_time is the daemon's monotonic time of the update.
+ *
+ * The buffer begins with sanlk_state_header, followed by arrays of
+ * sanlk_state_lockspace, sanlk_host and sanlk_state_resource at the
+ * given offsets from the start of the buffer.  For each lockspace,
+ * its hosts are host_count entries beginning at host_first in the
+ * sanlk_host array.
+ *
+ * state_read returns -EAGAIN if the daemon is not running or the snapshot
+ * changed during each try of copying it.
+ */
+
+#define SANLK_STATE_MAGIC	0x534c4b53
+#define SANLK_STATE_VERSION	1
+
+/* sanlk_state_header.flags */
+#define SANLK_STATE_TRUNCATED	0x00000001 /* records did not all fit */
+
+struct sanlk_state_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t seq;		/* odd while the daemon is updating */
+	uint64_t update_time;
+	uint32_t daemon_pid;
+	uint32_t flags;
+	uint32_t len;		/* header and records */
+	uint32_t ls_count;
+	uint32_t ls_offset;
+	uint32_t host_count;
+	uint32_t host_offset;
+	uint32_t res_count;
+	uint32_t res_offset;
+	uint32_t pad;
+};
+
+struct sanlk_state_lockspace {
+	struct sanlk_lockspace ls;	/* flags SANLK_LSF_ */
+	uint32_t host_first;
+	uint32_t host_count;
+};
+
+struct sanlk_state_resource {
+	char lockspace_name[SANLK_NAME_LEN];
+	char name[SANLK_NAME_LEN];
+	uint64_t lver;
+	uint32_t pid;
+	uint32_t flags;			/* SANLK_RES_SHARED */
+};
+
+struct sanlk_state_map;
+
+int sanlock_state_open(struct sanlk_state_map **st, uint32_t flags);
+int sanlock_state_read(struct sanlk_state_map *st, char **buf, int *len);
+void sanlock_state_close(struct sanlk_state_map *st);
+
 /*
  * Lockspace host events
  *
@@ -539,6 +708,27 @@ int sanlock_version(uint32_t flags, uint32_t *version, uint32_t *proto);
  * set_event in this case.
  */
 
+/*
+ * A request (sanlock_request) also sends a host event with this event
+ * value to the owner of the resource, so the owner can examine the
+ * resource right away.  The daemon consumes it, it is not passed to
+ * sanlock_get_event, and it does not cause set_event to return -EBUSY.
+ */
+
+#define SANLK_HOST_EVENT_REQUEST   0xFFFFFFFF52455155ULL
+
+/*
+ * An fd registered with the SANLK_EVF_HOST_STATE filter flag is also sent
+ * an event with this event value when the state of another host changes
+ * (as reported by sanlock_get_hosts.)  data is the new SANLK_HOST_ state,
+ * from_host_id and from_generation are the host.  The daemon checks the
+ * states once a second, so a host is reported DEAD within a second of
+ * host_dead_seconds passing since its last renewal.  Read the current
+ * states with sanlock_get_hosts after registering.
+ */
+
+#define SANLK_HOST_EVENT_STATE     0xFFFFFFFF53544154ULL
+
 #define SANLK_SETEV_CUR_GENERATION 0x00000001
 #define SANLK_SETEV_CLEAR_HOSTID   0x00000002
 #define SANLK_SETEV_CLEAR_EVENT    0x00000004
@@ -546,6 +736,55 @@ int sanlock_version(uint32_t flags, uint32_t *version, uint32_t *proto);
 #define SANLK_SETEV_ALL_HOSTS      0x00000010
 
 int sanlock_reg_event(const char *ls_name, struct sanlk_host_event *he, uint32_t flags);
+
+/*
+ * sanlock_reg_event_filter
+ *
+ * Like sanlock_reg_event, but the daemon only sends the events that pass
+ * the filter to the fd:
+ *
+ * event_mask: events with any of these bits set in event (0 for all).
+ * generation: events set for this generation of the local host_id, or
+ * for any generation (he.generation 0) (0 for all).
+ * host_ids: with SANLK_EVF_HOST_IDS, events from the host_ids whose bits
+ * are set (host_id N is bit (N-1)%8 of byte (N-1)/8).
+ * SANLK_EVF_HOST_STATE: also send SANLK_HOST_EVENT_STATE events, which
+ * are not sent to other fds, and are not subject to event_mask.
+ *
+ * Up to 256 fds can be registered for a lockspace.
+ */
+
+#define SANLK_REG_EVENT_FILTER     0x00000001
+
+#define SANLK_EVF_HOST_IDS         0x00000001
+#define SANLK_EVF_HOST_STATE       0x00000002
+
+struct sanlk_event_filter {
+	uint64_t event_mask;
+	uint64_t generation;
+	uint32_t flags;         /* SANLK_EVF_ */
+	uint32_t pad;
+	char host_ids[256];     /* bitmap of host_ids 1-2000 */
+};
+
+int sanlock_reg_event_filter(const char *ls_name, struct sanlk_event_filter *ef, uint32_t flags);
+
+/*
+ * sanlock_get_events
+ *
+ * Get up to max pending events from the fd in one read.  Returns 0 with
+ * the number of events in count, or -EAGAIN when there are none.
+ * The daemon sends all the events it has for the fd at once, so a
+ * client can drain many events per call.
+ */
+
+struct sanlk_event_rec {
+	struct sanlk_host_event he;
+	uint64_t from_host_id;
+	uint64_t from_generation;
+};
+
+int sanlock_get_events(int fd, uint32_t flags, struct sanlk_event_rec *recs, int max, int *count);
 int sanlock_end_event(int fd, const char *ls_name, uint32_t flags);
 int sanlock_set_event(const char *ls_name, struct sanlk_host_event *he, uint32_t flags);
 int sanlock_get_event(int fd, uint32_t flags, struct sanlk_host_event *he,
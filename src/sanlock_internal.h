@@ -48,6 +48,7 @@
 #define SANLOCK_RUN_DIR "SANLOCK_RUN_DIR"
 #define DEFAULT_RUN_DIR "/var/run/sanlock"
 #define SANLOCK_PRIVILEGED "SANLOCK_PRIVILEGED"
+#define SANLOCK_CONF "SANLOCK_CONF"
 
 #define SANLK_LOG_DIR "/var/log"
 #define SANLK_LOGFILE_NAME "sanlock.log"
@@ -103,8 +104,12 @@ struct token {
 
 	/* internal */
 	struct list_head list; /* resource->tokens */
+	struct list_head client_list; /* sp->client_tokens, see link_client_tokens */
 	struct resource *resource;
 	int pid;
+	int client_ci; /* client[] holding the token in cl->tokens */
+	int client_slot; /* index of the token in cl->tokens */
+	struct list_head client_hash; /* cl->tokens_hash bucket */
 	uint32_t flags;  /* be careful to avoid using this from different threads */
 	uint32_t token_id;
 	uint32_t res_id;
@@ -132,13 +137,20 @@ struct token {
 #define R_LVB_WRITE_RELEASE	0x00000020
 #define R_UNDO_SHARED		0x00000040
 #define R_ERASE_ALL		0x00000080
+#define R_LVB_PARTIAL		0x00000100 /* multi-sector lvb was read torn */
+#define R_CONVERT_EX		0x00000200 /* a local sh token is converting to ex */
+#define R_RELEASE_RETRY		0x00000400 /* an earlier release attempt timed out */
 
 struct resource {
 	struct list_head list;
+	struct list_head hash_list;  /* resource_hash, while on_list is set */
+	struct list_head *on_list;   /* resources_add/held/rem/orphan */
+	struct list_head orphan_list; /* orphan_hash, while on resources_orphan */
 	struct list_head tokens;     /* only one token when ex, multiple sh */
 	uint64_t host_id;
 	uint64_t host_generation;
 	uint32_t io_timeout;
+	uint32_t space_id;
 	int pid;                     /* copied from token when ex */
 	int sector_size;
 	int align_size;
@@ -146,7 +158,19 @@ struct resource {
 	uint32_t reused;
 	uint32_t flags;
 	uint64_t thread_release_retry;
+	uint64_t lazy_time;          /* monotime of SANLK_REL_LAZY release */
 	char *lvb;
+	char *lvb_cache;             /* lvb kept from the last use, see lvb_cache */
+	uint64_t lvb_lver;           /* leader lver at which lvb matched the disk */
+	int lvb_size;                /* bytes of the on-disk lvb region in lvb */
+	uint64_t handoff_host_id;    /* SANLK_REQ_HANDOFF target, set by examine */
+	uint64_t handoff_generation;
+	uint64_t handoff_lver;
+	uint64_t ballots;            /* contention stats, see paxos_backoff_us */
+	uint64_t ballot_aborts;
+	uint64_t backoff_count;
+	uint64_t backoff_us;
+	uint32_t ballot_us;          /* moving average of ballot time */
 	char killpath[SANLK_HELPER_PATH_LEN]; /* copied from client */
 	char killargs[SANLK_HELPER_ARGS_LEN]; /* copied from client */
 	struct leader_record leader; /* copy of last leader_record we wrote */
@@ -154,6 +178,21 @@ struct resource {
 	struct sanlk_resource r;
 };
 
+/*
+ * With renewal_sweep_interval, a renewal between full reads of the
+ * host_id area reads only ranges holding the delta leases that were in
+ * use, num_ranges 0 means the full area was read.  start and count are
+ * in host_id leases (sectors) from the start of the area.
+ */
+
+#define RENEWAL_READ_RANGES 4
+
+struct renewal_read {
+	int num_ranges;
+	int start[RENEWAL_READ_RANGES];
+	int count[RENEWAL_READ_RANGES];
+};
+
 struct lease_status {
 	int corrupt_result;
 	int acquire_last_result;
@@ -166,6 +205,7 @@ struct lease_status {
 	uint32_t renewal_read_count;
 	uint32_t renewal_read_check;
 	char *renewal_read_buf;
+	struct renewal_read renewal_read; /* parts of renewal_read_buf read */
 };
 
 struct host_status {
@@ -173,13 +213,30 @@ struct host_status {
 	uint64_t last_check; /* local monotime */
 	uint64_t last_live; /* local monotime */
 	uint64_t last_req; /* local monotime */
+	uint64_t last_req_data; /* SANLK_HOST_EVENT_REQUEST data at last_req */
 	uint64_t owner_id;
 	uint64_t owner_generation;
 	uint64_t timestamp; /* remote monotime */
 	uint64_t set_bit_time;
 	uint16_t io_timeout;
 	uint16_t lease_bad;
-	char owner_name[NAME_ID_SIZE];
+	uint32_t last_flag; /* SANLK_HOST_ state at last check_host_states */
+	uint32_t change_flag; /* SANLK_HOST_ state at last change_seq */
+	uint64_t change_generation; /* owner_generation at last change_seq */
+	uint64_t change_seq; /* sp->host_change_seq when the host last changed */
+};
+
+/*
+ * The on-disk bytes of a host's delta lease that change when it is
+ * written: owner_id and owner_generation, and timestamp through
+ * write_id (which include the checksum).  check_other_leases compares
+ * these with the sector before decoding it, see leader_key_changed().
+ */
+
+#define LEADER_KEY_WORDS 3
+
+struct leader_key {
+	uint64_t w[LEADER_KEY_WORDS * 2];
 };
 
 struct renewal_history {
@@ -191,13 +248,16 @@ struct renewal_history {
 };
 
 /* The max number of connections that can get events for a lockspace. */
-#define MAX_EVENT_FDS 32
+#define MAX_EVENT_FDS 256
 
 #define SP_EXTERNAL_USED   0x00000001
 #define SP_USED_BY_ORPHANS 0x00000002
 
 struct space {
 	struct list_head list;
+	struct list_head name_hash_list; /* space_name_hash */
+	struct list_head id_hash_list;   /* space_id_hash */
+	struct list_head *on_list;       /* spaces, spaces_add or spaces_rem */
 	char space_name[NAME_ID_SIZE];
 	uint32_t space_id; /* used to refer to this space instance in log messages */
 	uint64_t host_id;
@@ -208,7 +268,13 @@ struct space {
 	uint32_t flags; /* SP_ */
 	uint32_t used_retries;
 	uint32_t renewal_read_extend_sec; /* defaults to io_timeout */
+	uint32_t renewal_sweep_interval; /* read all host_id leases every nth renewal */
+	uint32_t renewal_sweep_count;    /* renewals since the last full read */
+	struct renewal_read renewal_read_plan; /* the last renewal read, lockspace thread */
 	uint32_t rindex_op;
+	uint32_t rindex_rebuild_slots;	/* progress of the last rindex_rebuild */
+	uint32_t rindex_rebuild_done;
+	uint32_t rindex_rebuild_found;
 	int sector_size;
 	int align_size;
 	int max_hosts;
@@ -217,18 +283,43 @@ struct space {
 	int killing_pids;
 	int external_remove;
 	int thread_stop;
+	int renewal_wake; /* renew without waiting, see host_status_set_request */
+	uint64_t renewal_wake_time; /* monotime of the last renewal_wake renewal */
 	int wd_fd;
+	uint64_t wd_client_id;		/* batched test_live, 0 if not */
+	struct wdmd_shm_slot *wd_shm;	/* test_live by shm, NULL if not */
 	int event_fds[MAX_EVENT_FDS];
+	struct sanlk_event_filter *event_filters[MAX_EVENT_FDS]; /* NULL for all events */
 	struct sanlk_host_event host_event;
 	uint64_t set_event_time;
 	pthread_t thread;
 	pthread_mutex_t mutex; /* protects lease_status, thread_stop  */
 	struct lease_status lease_status;
-	struct host_status host_status[DEFAULT_MAX_HOSTS];
+	/*
+	 * max_hosts entries each, allocated by lockspace_acquire once the
+	 * lease size is known.  The owner name of each host is kept apart
+	 * since check_other_leases only looks at it for a new host instance.
+	 */
+	struct host_status *host_status;
+	struct leader_key *leader_keys; /* check_other_leases */
+	char (*host_names)[NAME_ID_SIZE];
 	struct renewal_history *renewal_history;
 	int renewal_history_size;
 	int renewal_history_next;
 	int renewal_history_prev;
+	struct host_state_file *host_state; /* mapped host_state file, see hoststate.c */
+	int host_status_warm; /* get_hosts shows host_state until the first check */
+	uint64_t host_change_seq; /* see host_changes_update */
+	uint64_t host_change_first; /* host_change_seq when the lockspace was added */
+	pthread_cond_t host_status_cond; /* with mutex, see host_info_wait */
+	uint64_t host_status_gen;        /* mutex */
+	int host_status_waiters;         /* spaces_mutex */
+	struct renew_state *renew; /* delta lease renewal, see lockspace_thread */
+	struct lease_paths *lease_paths; /* renewal_multipath, NULL if not */
+	int host_id_read_split; /* parallel reads of the host_id area, see io_tune */
+	struct list_head client_tokens; /* tokens held by clients, spaces_mutex */
+	uint64_t check_time; /* main_loop: next check, ms, see main_loop_deadline */
+	int check_wake; /* main_loop: check at next wakeup, see lockspace_check_wake */
 };
 
 /* Update lockspace_info() to copy any fields from struct space
@@ -251,30 +342,77 @@ struct space_info {
 #define RX_OP_UPDATE 5
 #define RX_OP_REBUILD 6
 
+/*
+ * The worker and resource tasks run paxos on multi-disk leases, which
+ * submits one i/o per disk at once, and may leave the i/o to the slowest
+ * disks outstanding once a majority completes.
+ */
+
 #define HOSTID_AIO_CB_SIZE 4
-#define WORKER_AIO_CB_SIZE 2
+#define WORKER_AIO_CB_SIZE (2 * SANLK_MAX_DISKS)
 #define DIRECT_AIO_CB_SIZE 1
-#define RESOURCE_AIO_CB_SIZE 2
+#define RESOURCE_AIO_CB_SIZE (2 * SANLK_MAX_DISKS)
 #define LIB_AIO_CB_SIZE 1
 
+/* use_aio values */
+#define USE_AIO_LINUX 1
+#define USE_AIO_URING 2
+
 struct aicb {
 	int used;
+	int detached; /* left outstanding after the rest of its group completed */
+	int detached_write; /* a detached write on the detached_writes list */
+	dev_t detached_dev;
+	struct list_head detached_list;
 	char *buf;
 	struct iocb iocb;
 };
 
+/* a completed i/o reported by task_aio_getevents() */
+struct aio_done {
+	struct aicb *aicb;
+	long res;
+	long res2;
+};
+
+struct uring;
+struct sim_queue;
+
+/*
+ * Each task keeps the page aligned buffers used for its disk i/o in a
+ * small pool so they are reused rather than allocated and freed for
+ * each i/o.  A buffer of a timed out i/o stays used (aio_held) until
+ * the i/o is reaped.
+ */
+
+#define TASK_IOBUF_POOL_SIZE 16
+
+struct task_iobuf {
+	char *buf;
+	int len;
+	int used;
+	int aio_held;
+};
+
 struct task {
 	char name[NAME_ID_SIZE+1];   /* for log messages */
 
 	unsigned int io_count;       /* stats */
 	unsigned int to_count;       /* stats */
+	int io_op;                   /* SANLK_IO_ for iostats */
 
 	int use_aio;
+	int io_renewal;              /* aio has priority on its devices */
+	int read_shared;             /* reads may be shared, see readflight.c */
+	struct sanlk_op_times *op_times; /* see OP_TIME_ADD */
 	int cb_size;
 	char *iobuf;
 	io_context_t aio_ctx;
+	struct uring *uring;         /* use_aio USE_AIO_URING */
+	struct sim_queue *sim;       /* i/o to sim disks, see simdisk.c */
 	struct aicb *read_iobuf_timeout_aicb;
 	struct aicb *callbacks;
+	struct task_iobuf iobuf_pool[TASK_IOBUF_POOL_SIZE];
 };
 
 EXTERN struct task main_task;
@@ -283,6 +421,7 @@ EXTERN struct task main_task;
 
 #define CL_KILLPATH_PID 0x00000001 /* include pid as killpath arg */
 #define CL_RUNPATH_SENT 0x00000002 /* a RUNPATH msg has been sent to helper */
+#define CL_RUNPATH_FAILED 0x00000004 /* helper could not start killpath */
 
 struct client {
 	int used;
@@ -293,20 +432,32 @@ struct client {
 	int pid_dead;
 	int suspend;
 	int need_free;
+	int pipeline;
+	int inflight; /* pipelined cmds not yet replied */
 	int kill_count;
 	int tokens_slots;
+	int tokens_count; /* non-NULL entries in tokens */
+	int tokens_hash_size; /* 0 until tokens_slots reaches CL_TOKENS_HASH_MIN */
 	uint32_t flags;
 	uint32_t restricted;
+	uint32_t epoll_gen; /* incremented each time ci is used */
 	uint64_t kill_last;
 	char owner_name[SANLK_NAME_LEN+1];
 	char killpath[SANLK_HELPER_PATH_LEN];
 	char killargs[SANLK_HELPER_ARGS_LEN];
 	pthread_mutex_t mutex;
+	pthread_mutex_t send_mutex; /* pipelined replies */
 	void *workfn;
 	void *deadfn;
 	struct token **tokens;
+	struct list_head *tokens_hash; /* tokens by resource name */
 };
 
+/* cl->tokens are looked up by name through tokens_hash once a client
+   has this many slots */
+
+#define CL_TOKENS_HASH_MIN 32
+
 /*
  * client array is only touched by main_loop, there is no lock for it.
  * individual cl structs are accessed by worker threads using cl->mutex
@@ -319,21 +470,56 @@ EXTERN struct client *client;
 #define DEFAULT_IO_TIMEOUT 10
 #define DEFAULT_GRACE_SEC 40
 #define DEFAULT_USE_WATCHDOG 1
+#define DEFAULT_WATCHDOG_BATCH_MS 200
+#define DEFAULT_WATCHDOG_SHM 1
 #define DEFAULT_HIGH_PRIORITY 1
 #define DEFAULT_MLOCK_LEVEL 1 /* 1=CURRENT, 2=CURRENT|FUTURE */
 #define DEFAULT_SOCKET_UID 0
 #define DEFAULT_SOCKET_GID 0
 #define DEFAULT_SOCKET_MODE (S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP)
 #define DEFAULT_MIN_WORKER_THREADS 2
+#define WORKER_THREADS_PER_LOCKSPACE 2
+#define MAX_WORKER_THREADS 128
 #define DEFAULT_MAX_WORKER_THREADS 8
 #define DEFAULT_SH_RETRIES 8
+#define DEFAULT_RESOURCE_THREADS 4
+#define DEFAULT_DUMP_THREADS 8
+#define MAX_RESOURCE_THREADS 16
 #define DEFAULT_QUIET_FAIL 1
 #define DEFAULT_RENEWAL_HISTORY_SIZE 180 /* about 1 hour with 20 sec renewal interval */
+#define DEFAULT_METRICS 1
+#define DEFAULT_FD_CACHE 1
+#define DEFAULT_LAZY_RELEASE_SECONDS 0
+#define DEFAULT_CONVERT_QUEUE_SECONDS 30
+#define DEFAULT_READ_COALESCE 1
+#define DEFAULT_READ_CACHE_MS 0
+#define MAX_READ_CACHE_MS 10000
+#define DEFAULT_PIPELINE_QUEUE_MAX 64
+#define DEFAULT_RELEASE_VERIFY 1
+#define DEFAULT_PAXOS_FAST_BALLOT 0
+#define DEFAULT_FD_CACHE_IDLE 10
+#define DEFAULT_IO_WORKER_MAX 32
+#define DEFAULT_MAX_ACQUIRE_RESOURCES SANLK_MAX_ACQUIRE_RESOURCES
+#define DEFAULT_RENEWAL_IOPRIO 1
+#define DEFAULT_RENEWAL_HEDGE_MS 100
+#define DEFAULT_IO_TUNE 1
+#define DEFAULT_RENEWAL_THREADS 4
+#define MAX_RENEWAL_THREADS 64
+#define DEFAULT_LOG_RING_ENTRIES 1024
+#define MIN_LOG_RING_ENTRIES 256
+#define MAX_LOG_RING_ENTRIES 16384
 
 #define DEFAULT_MAX_SECTORS_KB_IGNORE 0     /* don't change it */
 #define DEFAULT_MAX_SECTORS_KB_ALIGN  0     /* set it to align size */
 #define DEFAULT_MAX_SECTORS_KB_NUM    1024  /* set it to num KB for all lockspaces */
 
+/* from lockspace = lines in sanlock.conf, added when the daemon starts */
+
+struct config_lockspace {
+	struct sanlk_lockspace ls;
+	uint32_t io_timeout; /* 0 for DEFAULT_IO_TIMEOUT */
+};
+
 struct command_line {
 	int type;				/* COM_ */
 	int action;				/* ACT_ */
@@ -342,12 +528,16 @@ struct command_line {
 	int debug_io_submit;
 	int debug_io_complete;
 	int paxos_debug_all;
+	int metrics;
+	int metrics_port;
 	int max_sectors_kb_ignore;
 	int max_sectors_kb_align;
 	int max_sectors_kb_num;
 	int quiet_fail;
 	int wait;
 	int use_watchdog;
+	int watchdog_batch_ms;
+	int watchdog_shm;
 	int high_priority;		/* -h */
 	int get_hosts;			/* -h */
 	int names_log_priority;
@@ -383,14 +573,49 @@ struct command_line {
 	int renewal_history_size;
 	int renewal_read_extend_sec_set; /* 1 if renewal_read_extend_sec is configured */
 	uint32_t renewal_read_extend_sec;
+	uint32_t renewal_sweep_interval;
+	int renewal_coalesce;
+	int renewal_adaptive;
+	int renewal_threads;
+	int lvb_cache;
+	int resource_threads;
+	int host_state_cache;
+	int fd_cache;
+	int fd_cache_idle;
+	int lazy_release_seconds;
+	int convert_queue_seconds;
+	int read_coalesce;
+	int read_cache_ms;
+	int pipeline_queue_max;
+	int release_verify;
+	int paxos_fast_ballot;
+	int config_lockspaces_count;
+	struct config_lockspace *config_lockspaces;
+	int io_worker_max;
+	int renewal_ioprio;
+	int renewal_multipath;
+	int renewal_hedge_ms;
+	int io_tune;
+	int host_id_read_split;
+	int dblock_read_split;
+	char *io_capture_file;
+	int max_acquire_resources;
 	char our_host_name[SANLK_NAME_LEN+1];
 	char *file_path;
 	char *dump_path;
+	int dump_threads;			/* -t */
+	int dump_json;				/* -j */
+	uint64_t dump_changed_since;		/* -T */
 	int rindex_op;
 	struct sanlk_rentry rentry;		/* -e */
+	struct sanlk_rentry *rentries;		/* -e repeated */
+	int rentry_count;
 	struct sanlk_rindex rindex;		/* -x RINDEX */
+	int rindex_version;			/* -X 1|2 */
 	struct sanlk_lockspace lockspace;	/* -s LOCKSPACE */
-	struct sanlk_resource *res_args[SANLK_MAX_RESOURCES]; /* -r RESOURCE */
+	struct sanlk_lockspace *lockspaces;	/* -s repeated */
+	int lockspace_count;
+	struct sanlk_resource *res_args[SANLK_MAX_ACQUIRE_RESOURCES]; /* -r RESOURCE */
 };
 
 EXTERN struct command_line com;
@@ -421,6 +646,7 @@ enum {
 	ACT_DIRECT_INIT,
 	ACT_DUMP,
 	ACT_NEXT_FREE,
+	ACT_FREEMAP,
 	ACT_READ_LEADER,
 	ACT_CLIENT_INIT,
 	ACT_CLIENT_READ,
@@ -438,6 +664,10 @@ enum {
 	ACT_LOOKUP,
 	ACT_UPDATE,
 	ACT_REBUILD,
+	ACT_CONVERT_RINDEX,
+	ACT_TRACE,
+	ACT_STATS,
+	ACT_STATE,
 };
 
 EXTERN int external_shutdown;
@@ -451,7 +681,6 @@ EXTERN int helper_kill_fd;
 EXTERN int helper_status_fd;
 EXTERN uint64_t helper_last_status;
 EXTERN uint32_t helper_full_count;
-EXTERN int efd;
 
 EXTERN struct list_head spaces;
 EXTERN struct list_head spaces_rem;
@@ -48,12 +48,35 @@
  * If the lock cannot be granted immediately
  * because the owner's lease needs to time out, do
  * not wait, but return -SANLK_ACQUIRE_OWNED_RETRY.
+ *
+ * SANLK_ACQUIRE_PARALLEL
+ * When acquiring multiple resources, acquire them
+ * concurrently rather than one after the other.
+ * If any of them fails, the others are released
+ * and the first error is returned, as usual.
+ *
+ * SANLK_ACQUIRE_TIMES
+ * Return a breakdown of where the time of the
+ * acquire was spent, see sanlock_acquire_times().
  */
 
 #define SANLK_ACQUIRE_LVB		0x00000001
 #define SANLK_ACQUIRE_ORPHAN		0x00000002
 #define SANLK_ACQUIRE_ORPHAN_ONLY	0x00000004
 #define SANLK_ACQUIRE_OWNER_NOWAIT	0x00000008
+#define SANLK_ACQUIRE_PARALLEL		0x00000010
+#define SANLK_ACQUIRE_TIMES		0x00000020
+
+/*
+ * set_lvb flags
+ *
+ * SANLK_SETLVB_WRITE
+ * Write the lvb to disk before returning, rather than
+ * only when the resource is released.  The resource must
+ * be held exclusively.
+ */
+
+#define SANLK_SETLVB_WRITE		0x00000001
 
 /*
  * release flags
@@ -79,20 +102,83 @@
  * If the resource name is set, then an
  * orphan with the matching resource name is
  * released.
+ *
+ * SANLK_REL_LAZY
+ * Release the client's exclusive lease, but have
+ * the daemon keep the lease on disk for a while.
+ * An acquire of the resource from this host in
+ * that time takes the lease without any disk i/o.
+ * The lease is released on disk after the
+ * lazy_release_seconds config setting (0 by
+ * default, which disables this), when
+ * another host makes a request for it (see
+ * sanlock_request), or when it can't be reused
+ * by an acquire.  Shared leases are released
+ * normally.
+ *
+ * SANLK_REL_TIMES
+ * Return a breakdown of where the time of the
+ * release was spent, see sanlock_release_times().
  */
 
 #define SANLK_REL_ALL		0x00000001
 #define SANLK_REL_RENAME	0x00000002
 #define SANLK_REL_ORPHAN	0x00000004
+#define SANLK_REL_LAZY		0x00000008
+#define SANLK_REL_TIMES		0x00000010
 
 /*
  * convert flags
  *
  * SANLK_CONVERT_OWNER_NOWAIT
  * Same as SANLK_ACQUIRE_OWNER_NOWAIT.
+ *
+ * SANLK_CONVERT_QUEUE
+ * When converting sh to ex finds that other
+ * local processes or other hosts hold the lease
+ * shared, the daemon keeps the conversion pending
+ * instead of returning -EAGAIN.  It watches the
+ * mode blocks of the lease, and converts as soon
+ * as the other shared holders are gone.  -EAGAIN
+ * is returned if they are not gone within the
+ * convert_queue_seconds config setting.
+ *
+ * SANLK_CONVERT_TIMES
+ * Return a breakdown of where the time of the
+ * convert was spent, see sanlock_convert_times().
  */
 
 #define SANLK_CONVERT_OWNER_NOWAIT	0x00000008 /* NB: value must match SANLK_ACQUIRE_OWNER_NOWAIT */
+#define SANLK_CONVERT_QUEUE		0x00000010
+#define SANLK_CONVERT_TIMES		0x00000020 /* NB: value must match SANLK_ACQUIRE_TIMES */
+
+/*
+ * inquire flags
+ *
+ * SANLK_INQUIRE_BINARY
+ * Return res_state in the binary inquire format
+ * instead of the text state string.  It is a
+ * struct sanlk_inquire_header followed by a
+ * struct sanlk_resource with its num_disks
+ * struct sanlk_disk for each of res_count
+ * resources.  The flags of each resource are
+ * SANLK_RES_SHARED, or SANLK_RES_LVER with the
+ * lver set.  The records can be used in place, see
+ * sanlock_inquire_to_args(), or converted to and
+ * from the text format.
+ */
+
+#define SANLK_INQUIRE_BINARY	0x00000001
+
+#define SANLK_INQUIRE_MAGIC	0x534c4951
+#define SANLK_INQUIRE_VERSION	1
+
+struct sanlk_inquire_header {
+	uint32_t magic;		/* SANLK_INQUIRE_MAGIC */
+	uint32_t version;	/* SANLK_INQUIRE_VERSION */
+	uint32_t res_count;
+	uint32_t length;	/* bytes, including this header */
+};
 
 /*
  * request flags
@@ -119,10 +205,18 @@
  * SANLK_REQ_GRACEFUL
  * Run killpath against the pid if it is defined, otherwise
  * send SIGTERM to the pid (or SIGKILL if SIGTERM is restricted).
+ *
+ * SANLK_REQ_HANDOFF
+ * Hand the resource to the requesting host when the owner next
+ * releases it.  Nothing is sent to the pid.  The release commits
+ * the requested lver with the requesting host as owner, and the
+ * requesting host then acquires it without running a ballot.
+ * The requested lver must be the owner's lver + 1.
  */
 
 #define SANLK_REQ_FORCE			0x00000001
 #define SANLK_REQ_GRACEFUL		0x00000002
+#define SANLK_REQ_HANDOFF		0x00000004
 
 /* old name deprecated */
 #define SANLK_REQ_KILL_PID		SANLK_REQ_FORCE
@@ -140,12 +234,141 @@ int sanlock_acquire(int sock, int pid, uint32_t flags, int res_count,
 int sanlock_release(int sock, int pid, uint32_t flags, int res_count,
 		    struct sanlk_resource *res_args[]);
 
+/*
+ * Where the time of an acquire, release or convert was spent
+ *
+ * The _times variants set the TIMES flag, and the daemon returns the
+ * time spent in each part of the command after the reply header.  Times
+ * are in microseconds, and are summed over all the resources of the
+ * command (which may overlap for SANLK_ACQUIRE_PARALLEL).  A daemon that
+ * does not return the times leaves them zero.
+ *
+ * queue_us: waiting for a worker thread to run the command
+ * open_us: opening the disks of the resources
+ * leader_read_us: reading the leader and dblocks before ballots,
+ *   and the leader before a release writes it
+ * phase1_us, phase2_us: the two phases of the ballots
+ * commit_us: writing the leader after a ballot, and the dblock
+ *   and leader writes of a release
+ * owner_wait_us: waiting to see if a live owner's host_id lease
+ *   is renewed, or for it to expire
+ * total_us: the whole command, from when it was queued
+ * ballots: the ballots run
+ * retries: ballots retried after an abort, and acquires restarted
+ *   after the leader changed
+ *
+ * The times are only returned for blocking requests, not the async
+ * and pipelined ones.
+ */
+
+struct sanlk_op_times {
+	uint64_t queue_us;
+	uint64_t open_us;
+	uint64_t leader_read_us;
+	uint64_t phase1_us;
+	uint64_t phase2_us;
+	uint64_t commit_us;
+	uint64_t owner_wait_us;
+	uint64_t total_us;
+	uint32_t ballots;
+	uint32_t retries;
+	uint64_t unused[4];
+};
+
+int sanlock_acquire_times(int sock, int pid, uint32_t flags, int res_count,
+			  struct sanlk_resource *res_args[],
+			  struct sanlk_options *opt_in,
+			  struct sanlk_op_times *times);
+
+int sanlock_release_times(int sock, int pid, uint32_t flags, int res_count,
+			  struct sanlk_resource *res_args[],
+			  struct sanlk_op_times *times);
+
+/*
+ * Asynchronous acquire and release
+ *
+ * sanlock_acquire_async() and sanlock_release_async() send the request
+ * on sock and return without waiting for the result, setting req_id to
+ * a nonzero id for the request.  sock is a connection returned by
+ * sanlock_register(), and pid is -1 for the registered process itself,
+ * or the pid of another registered process.  When sock is readable,
+ * sanlock_async_result() reads the completion of one request, so sock
+ * can be watched with poll/epoll.  Requests on one sock complete in the
+ * order they were sent, and blocking calls must not be used on sock
+ * while async requests are outstanding.
+ *
+ * On a successful acquire, lver holds the lease version of each of the
+ * res_count resources, in the order they were passed, so an async acquire
+ * is limited to SANLK_MAX_RESOURCES.
+ */
+
+#define SANLK_ASYNC_ACQUIRE	1
+#define SANLK_ASYNC_RELEASE	2
+
+struct sanlk_async_result {
+	uint32_t req_id;
+	uint32_t cmd;		/* SANLK_ASYNC_ */
+	int32_t result;
+	uint32_t res_count;
+	uint64_t lver[SANLK_MAX_RESOURCES];
+};
+
+int sanlock_acquire_async(int sock, int pid, uint32_t flags, int res_count,
+			  struct sanlk_resource *res_args[],
+			  struct sanlk_options *opt_in, uint32_t *req_id);
+
+int sanlock_release_async(int sock, int pid, uint32_t flags, int res_count,
+			  struct sanlk_resource *res_args[], uint32_t *req_id);
+
+int sanlock_async_result(int sock, struct sanlk_async_result *ar);
+
+/*
+ * Pipelined requests
+ *
+ * sanlock_pipeline_open() returns a new connection on which many requests
+ * can be outstanding at once.  The daemon runs them concurrently and
+ * replies to each as it completes, possibly out of order.  Each send
+ * function sets req_id, and sanlock_pipeline_recv() reads the next reply,
+ * setting data to a buffer the caller frees (NULL if data_len is 0):
+ *
+ * inq_lockspace: no data
+ * read_resource_owners: struct sanlk_resource followed by data2 sanlk_host
+ * get_lvb: the lvb (lvblen 0 reads the sector size)
+ * acquire/release: sanlock_acquire_async() and sanlock_release_async()
+ * can be used on the connection to acquire for other registered pids,
+ * the acquire data is the lver (uint64_t) of each resource.
+ */
+
+struct sanlk_pipeline_reply {
+	uint32_t req_id;
+	int32_t result;
+	uint32_t data2;
+	uint32_t data_len;
+};
+
+int sanlock_pipeline_open(void);
+
+int sanlock_pipeline_inq_lockspace(int fd, struct sanlk_lockspace *ls,
+				   uint32_t flags, uint32_t *req_id);
+
+int sanlock_pipeline_read_resource_owners(int fd, struct sanlk_resource *res,
+					  uint32_t flags, uint32_t *req_id);
+
+int sanlock_pipeline_get_lvb(int fd, struct sanlk_resource *res, int lvblen,
+			     uint32_t flags, uint32_t *req_id);
+
+int sanlock_pipeline_recv(int fd, struct sanlk_pipeline_reply *rep, char **data);
+
 int sanlock_inquire(int sock, int pid, uint32_t flags, int *res_count,
 		    char **res_state);
 
 int sanlock_convert(int sock, int pid, uint32_t flags,
 		    struct sanlk_resource *res);
 
+int sanlock_convert_times(int sock, int pid, uint32_t flags,
+			  struct sanlk_resource *res,
+			  struct sanlk_op_times *times);
+
 int sanlock_request(uint32_t flags, uint32_t force_mode,
 		    struct sanlk_resource *res);
 
@@ -197,6 +420,31 @@ int sanlock_state_to_args(char *res_state,
 			  int *res_count,
 			  struct sanlk_resource ***res_args);
 
+/*
+ * convert from binary inquire state (SANLK_INQUIRE_BINARY)
+ * to array of struct sanlk_resource *.  The resources are
+ * not copied: each res_args entry points into inq_state,
+ * and the caller frees only res_args.
+ */
+
+int sanlock_inquire_to_args(char *inq_state,
+			    int *res_count,
+			    struct sanlk_resource ***res_args);
+
+/*
+ * convert from binary inquire state (SANLK_INQUIRE_BINARY)
+ * to the state string used by sanlock_state_to_args().
+ */
+
+int sanlock_inquire_to_state(char *inq_state, char **res_state);
+
+/*
+ * convert from state string to binary inquire state
+ * (SANLK_INQUIRE_BINARY).
+ */
+
+int sanlock_state_to_inquire(char *res_state, char **inq_state);
+
 /*
  * convert to struct sanlk_lockspace from string with format:
  * <lockspace_name>:<host_id>:<path>:<offset>
@@ -75,4 +75,7 @@
 #define SANLK_RINDEX_OFFSET	-277
 #define SANLK_RINDEX_DIFF	-278
 
+/* multi-sector lvb read */
+#define SANLK_LVB_PARTIAL	-279
+
 #endif
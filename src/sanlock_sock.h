@@ -10,7 +10,11 @@
 #ifndef __SANLOCK_SOCK_H__
 #define __SANLOCK_SOCK_H__
 
+#include <sys/un.h>
+
 #define SANLK_SOCKET_NAME "sanlock.sock"
+#define SANLK_STATE_NAME "sanlock_state"
+#define SANLK_STATE_SIZE (8 * 1024 * 1024) /* size of the state snapshot file */
 
 #define SM_MAGIC 0x04282010
 #define SM_PROTO 0x00000001
@@ -60,10 +64,27 @@ enum {
 	SM_CMD_CREATE_RESOURCE   = 38,
 	SM_CMD_DELETE_RESOURCE   = 39,
 	SM_CMD_REBUILD_RINDEX    = 40,
+	SM_CMD_CREATE_RESOURCES  = 41,
+	SM_CMD_DELETE_RESOURCES  = 42,
+	SM_CMD_TRACE             = 43,
+	SM_CMD_GET_STATS         = 44,
+	SM_CMD_PIPELINE          = 45,
+	SM_CMD_NEXT_FREE         = 46,
+	SM_CMD_ADD_LOCKSPACES    = 47,
+	SM_CMD_REM_LOCKSPACES    = 48,
+	SM_CMD_GET_HOSTS_CHANGED = 49,
 };
 
 #define SM_CB_GET_EVENT 1
 
+/*
+ * seq is copied from a request into its reply.  After SM_CMD_PIPELINE, a
+ * connection can have many requests outstanding: each request is sent
+ * whole (length includes all of its data), requests that run in the
+ * thread pool are processed concurrently, and replies, identified by
+ * seq, are sent as each request completes.
+ */
+
 struct sm_header {
 	uint32_t magic;
 	uint32_t version;
@@ -94,6 +115,36 @@ struct sanlk_state {
 	char str[0]; /* string of internal state */
 };
 
+/*
+ * Binary trace records returned by SM_CMD_TRACE.  time_us is from
+ * CLOCK_MONOTONIC, latency_us is the length of the traced operation
+ * ending at time_us.  For AIO ops, disk is the fd; for BALLOT ops, disk
+ * is the number of disks that completed the phase.
+ */
+
+#define SANLK_TRACE_AIO_READ		1
+#define SANLK_TRACE_AIO_WRITE		2
+#define SANLK_TRACE_BALLOT_PHASE1	3
+#define SANLK_TRACE_BALLOT_PHASE2	4
+#define SANLK_TRACE_DELTA_RENEW		5
+#define SANLK_TRACE_ACQUIRE		6
+#define SANLK_TRACE_RELEASE		7
+
+struct sanlk_trace {
+	uint64_t seq;
+	uint64_t time_us;
+	uint64_t lver;
+	uint64_t offset;
+	uint32_t op; /* SANLK_TRACE_ */
+	uint32_t space_id;
+	uint32_t res_id;
+	uint32_t disk;
+	uint32_t latency_us;
+	int32_t result;
+	uint32_t tid;
+	uint32_t pad;
+};
+
 int sanlock_socket_address(const char *dir, struct sockaddr_un *addr);
 
 struct event_cb {
@@ -0,0 +1,671 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+/*
+ * Simulated storage for testing and benchmarking.
+ *
+ * A disk path "sim:<file>" (written "sim\:<file>" in a lease string)
+ * is kept in <file>, e.g. a file in /dev/shm, and its i/o is delayed or
+ * failed as described by the optional parameter file <file>.sim:
+ *
+ * latency_dist = fixed | uniform | normal
+ * latency_us = <usec added to each i/o>
+ * jitter_us = <usec range of the uniform or normal part>
+ * slow_pct = <percent of i/o that are slow>
+ * slow_us = <usec added to a slow i/o>
+ * stall_pct = <percent of i/o that stall>
+ * stall_ms = <msec added to a stalled i/o, e.g. more than io_timeout>
+ * stall_op = all | read | write (the i/o that may stall)
+ * error_pct = <percent of i/o that fail with EIO>
+ * short_pct = <percent of i/o that complete half of the length>
+ * seed = <random seed, for repeatable runs>
+ *
+ * The parameter file is checked for changes every SIM_CONF_CHECK_MS, so
+ * a test can make a disk slow or failing while it is in use.  Each disk
+ * has its own parameters, so separate files simulate disks of different
+ * speeds.
+ *
+ * Aio to a sim disk is submitted (task_aio_submit) to a delay thread,
+ * which does the i/o when its latency has passed, and completes it to
+ * the task, where task_aio_getevents returns it like a libaio event.
+ * So a sim i/o that takes longer than the io timeout is handled by the
+ * usual aio timeout code, and is later reaped.  Sync i/o to a sim disk
+ * sleeps for the latency.
+ */
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "sanlock_internal.h"
+#include "log.h"
+#include "list.h"
+#include "monotime.h"
+#include "simdisk.h"
+
+#define SIM_DISKS 512
+#define SIM_MAX_FD 4096
+#define SIM_CONF_CHECK_MS 100
+
+enum {
+	SIM_DIST_FIXED = 0,
+	SIM_DIST_UNIFORM,
+	SIM_DIST_NORMAL,
+};
+
+enum {
+	SIM_STALL_ALL = 0,
+	SIM_STALL_READ,
+	SIM_STALL_WRITE,
+};
+
+struct sim_params {
+	int latency_dist;
+	uint32_t latency_us;
+	uint32_t jitter_us;
+	uint32_t slow_pct;
+	uint32_t slow_us;
+	uint32_t stall_pct;
+	uint32_t stall_ms;
+	int stall_op;
+	uint32_t error_pct;
+	uint32_t short_pct;
+	uint32_t seed;
+};
+
+struct sim_disk {
+	int used;
+	int fd;
+	char file[PATH_MAX];
+	char conf[PATH_MAX];
+	struct timespec conf_mtime;
+	uint64_t conf_checked;
+	unsigned int rand_state;
+	struct sim_params p;
+	uint64_t ios;
+	uint64_t errors;
+	uint64_t stalls;
+	uint64_t shorts;
+};
+
+/* the effect chosen for one i/o when it is submitted */
+struct sim_effect {
+	uint64_t delay_us;
+	int error;
+	int half;
+};
+
+struct sim_io {
+	struct list_head list;
+	struct task *task;
+	struct aicb *aicb;
+	struct sim_effect e;
+	uint64_t due_us;
+	long res;
+};
+
+/* task->sim */
+struct sim_queue {
+	struct list_head done;
+	int outstanding;
+	pthread_cond_t cond;
+};
+
+int sim_disk_count;
+
+static struct sim_disk sim_disks[SIM_DISKS];
+static short sim_fd_disk[SIM_MAX_FD]; /* sim_disks index + 1 */
+static LIST_HEAD(sim_pending);
+static struct sim_io *sim_executing;
+static pthread_mutex_t sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_cond;
+static pthread_cond_t sim_exec_cond;
+static pthread_condattr_t sim_condattr;
+static pthread_once_t sim_once = PTHREAD_ONCE_INIT;
+static int sim_thread_started;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static void us_to_ts(uint64_t us, struct timespec *ts)
+{
+	ts->tv_sec = us / 1000000;
+	ts->tv_nsec = (us % 1000000) * 1000;
+}
+
+static void sim_init(void)
+{
+	pthread_condattr_init(&sim_condattr);
+	pthread_condattr_setclock(&sim_condattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sim_cond, &sim_condattr);
+	pthread_cond_init(&sim_exec_cond, &sim_condattr);
+}
+
+int sim_path(const char *path)
+{
+	return !strncmp(path, SIM_PATH_PREFIX, strlen(SIM_PATH_PREFIX));
+}
+
+static struct sim_disk *find_sim_disk(int fd)
+{
+	if (fd < 0 || fd >= SIM_MAX_FD || !sim_fd_disk[fd])
+		return NULL;
+	return &sim_disks[sim_fd_disk[fd] - 1];
+}
+
+int sim_fd(int fd)
+{
+	return find_sim_disk(fd) ? 1 : 0;
+}
+
+static void read_params(struct sim_disk *sd)
+{
+	struct sim_params p;
+	struct stat st;
+	char line[256];
+	char key[64];
+	char val[64];
+	FILE *file;
+
+	sd->conf_checked = monotime_ms();
+
+	if (stat(sd->conf, &st) < 0) {
+		memset(&sd->p, 0, sizeof(sd->p));
+		memset(&sd->conf_mtime, 0, sizeof(sd->conf_mtime));
+		return;
+	}
+
+	if (st.st_mtim.tv_sec == sd->conf_mtime.tv_sec &&
+	    st.st_mtim.tv_nsec == sd->conf_mtime.tv_nsec)
+		return;
+
+	file = fopen(sd->conf, "r");
+	if (!file)
+		return;
+
+	memset(&p, 0, sizeof(p));
+
+	while (fgets(line, sizeof(line), file)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		memset(key, 0, sizeof(key));
+		memset(val, 0, sizeof(val));
+
+		if (sscanf(line, "%63s = %63s", key, val) != 2)
+			continue;
+
+		if (!strcmp(key, "latency_dist")) {
+			if (!strcmp(val, "uniform"))
+				p.latency_dist = SIM_DIST_UNIFORM;
+			else if (!strcmp(val, "normal"))
+				p.latency_dist = SIM_DIST_NORMAL;
+			else
+				p.latency_dist = SIM_DIST_FIXED;
+		} else if (!strcmp(key, "latency_us"))
+			p.latency_us = strtoul(val, NULL, 0);
+		else if (!strcmp(key, "jitter_us"))
+			p.jitter_us = strtoul(val, NULL, 0);
+		else if (!strcmp(key, "slow_pct"))
+			p.slow_pct = strtoul(val, NULL, 0);
+		else if (!strcmp(key, "slow_us"))
+			p.slow_us = strtoul(val, NULL, 0);
+		else if (!strcmp(key, "stall_pct"))
+			p.stall_pct = strtoul(val, NULL, 0);
+		else if (!strcmp(key, "stall_ms"))
+			p.stall_ms = strtoul(val, NULL, 0);
+		else if (!strcmp(key, "stall_op")) {
+			if (!strcmp(val, "read"))
+				p.stall_op = SIM_STALL_READ;
+			else if (!strcmp(val, "write"))
+				p.stall_op = SIM_STALL_WRITE;
+			else
+				p.stall_op = SIM_STALL_ALL;
+		}
+		else if (!strcmp(key, "error_pct"))
+			p.error_pct = strtoul(val, NULL, 0);
+		else if (!strcmp(key, "short_pct"))
+			p.short_pct = strtoul(val, NULL, 0);
+		else if (!strcmp(key, "seed"))
+			p.seed = strtoul(val, NULL, 0);
+	}
+	fclose(file);
+
+	if (p.seed != sd->p.seed || !sd->conf_mtime.tv_sec)
+		sd->rand_state = p.seed;
+
+	memcpy(&sd->p, &p, sizeof(p));
+	sd->conf_mtime = st.st_mtim;
+
+	log_debug("sim %s latency %u jitter %u dist %d slow %u%% %u stall %u%% %u error %u%% short %u%%",
+		  sd->file, p.latency_us, p.jitter_us, p.latency_dist, p.slow_pct, p.slow_us,
+		  p.stall_pct, p.stall_ms, p.error_pct, p.short_pct);
+}
+
+static int pct(struct sim_disk *sd, uint32_t percent)
+{
+	if (!percent)
+		return 0;
+	return (rand_r(&sd->rand_state) % 100) < percent;
+}
+
+/* called with sim_mutex held */
+
+static void choose_effect(struct sim_disk *sd, int cmd, struct sim_effect *e)
+{
+	struct sim_params *p;
+	uint64_t us;
+	int i;
+
+	if (monotime_ms() - sd->conf_checked >= SIM_CONF_CHECK_MS)
+		read_params(sd);
+
+	p = &sd->p;
+	memset(e, 0, sizeof(struct sim_effect));
+
+	us = p->latency_us;
+
+	if (p->jitter_us) {
+		if (p->latency_dist == SIM_DIST_UNIFORM) {
+			us += rand_r(&sd->rand_state) % (p->jitter_us + 1);
+		} else if (p->latency_dist == SIM_DIST_NORMAL) {
+			/* sum of four uniforms, centered on latency_us */
+			for (i = 0; i < 4; i++)
+				us += rand_r(&sd->rand_state) % (p->jitter_us / 2 + 1);
+			us = (us > p->jitter_us) ? us - p->jitter_us : 0;
+		}
+	}
+
+	if (pct(sd, p->slow_pct))
+		us += p->slow_us;
+
+	if ((p->stall_op == SIM_STALL_ALL ||
+	     (p->stall_op == SIM_STALL_READ && cmd == IO_CMD_PREAD) ||
+	     (p->stall_op == SIM_STALL_WRITE && cmd == IO_CMD_PWRITE)) &&
+	    pct(sd, p->stall_pct)) {
+		us += (uint64_t)p->stall_ms * 1000;
+		sd->stalls++;
+	}
+
+	if (pct(sd, p->error_pct)) {
+		e->error = -EIO;
+		sd->errors++;
+	} else if (pct(sd, p->short_pct)) {
+		e->half = 1;
+		sd->shorts++;
+	}
+
+	sd->ios++;
+	e->delay_us = us;
+}
+
+static long do_sim_io(int fd, int cmd, char *buf, size_t len, off_t offset,
+		      struct sim_effect *e)
+{
+	ssize_t rv;
+
+	if (e->error)
+		return e->error;
+
+	if (e->half)
+		len /= 2;
+
+	if (cmd == IO_CMD_PWRITE)
+		rv = pwrite(fd, buf, len, offset);
+	else
+		rv = pread(fd, buf, len, offset);
+
+	/* a read past the end of the file returns zeros, as a device would */
+	if (cmd == IO_CMD_PREAD && rv >= 0 && rv < (ssize_t)len) {
+		memset(buf + rv, 0, len - rv);
+		rv = len;
+	}
+
+	return (rv < 0) ? -errno : rv;
+}
+
+int sim_open(const char *path)
+{
+	struct sim_disk *sd = NULL;
+	const char *file = path + strlen(SIM_PATH_PREFIX);
+	int fd, i;
+
+	pthread_once(&sim_once, sim_init);
+
+	fd = open(file, O_RDWR, 0);
+	if (fd < 0)
+		return -1;
+
+	if (fd >= SIM_MAX_FD)
+		goto fail;
+
+	pthread_mutex_lock(&sim_mutex);
+	for (i = 0; i < SIM_DISKS; i++) {
+		if (sim_disks[i].used)
+			continue;
+		sd = &sim_disks[i];
+		memset(sd, 0, sizeof(struct sim_disk));
+		sd->used = 1;
+		sd->fd = fd;
+		snprintf(sd->file, sizeof(sd->file), "%s", file);
+		snprintf(sd->conf, sizeof(sd->conf), "%s.sim", file);
+		read_params(sd);
+		sim_fd_disk[fd] = i + 1;
+		sim_disk_count++;
+		break;
+	}
+	pthread_mutex_unlock(&sim_mutex);
+
+	if (!sd)
+		goto fail;
+
+	log_debug("sim open %d %s", fd, file);
+	return fd;
+
+ fail:
+	close(fd);
+	errno = EMFILE;
+	return -1;
+}
+
+/* called before the fd is closed */
+
+void sim_close(int fd)
+{
+	struct sim_disk *sd;
+
+	pthread_mutex_lock(&sim_mutex);
+	sd = find_sim_disk(fd);
+	if (sd) {
+		log_debug("sim close %d %s ios %llu errors %llu stalls %llu shorts %llu",
+			  fd, sd->file, (unsigned long long)sd->ios,
+			  (unsigned long long)sd->errors, (unsigned long long)sd->stalls,
+			  (unsigned long long)sd->shorts);
+		sim_fd_disk[fd] = 0;
+		sd->used = 0;
+		sim_disk_count--;
+	}
+	pthread_mutex_unlock(&sim_mutex);
+}
+
+static ssize_t sim_sync_io(int fd, int cmd, char *buf, size_t len, off_t offset)
+{
+	struct sim_disk *sd;
+	struct sim_effect e;
+	long rv;
+
+	pthread_mutex_lock(&sim_mutex);
+	sd = find_sim_disk(fd);
+	if (sd)
+		choose_effect(sd, cmd, &e);
+	else
+		memset(&e, 0, sizeof(e));
+	pthread_mutex_unlock(&sim_mutex);
+
+	if (e.delay_us)
+		usleep(e.delay_us);
+
+	rv = do_sim_io(fd, cmd, buf, len, offset, &e);
+	if (rv < 0) {
+		errno = -rv;
+		return -1;
+	}
+	return rv;
+}
+
+ssize_t sim_pread(int fd, void *buf, size_t len, off_t offset)
+{
+	return sim_sync_io(fd, IO_CMD_PREAD, buf, len, offset);
+}
+
+ssize_t sim_pwrite(int fd, const void *buf, size_t len, off_t offset)
+{
+	return sim_sync_io(fd, IO_CMD_PWRITE, (char *)buf, len, offset);
+}
+
+/*
+ * The delay thread does each pending i/o when it is due, in order of
+ * when they are due, and moves it to the done list of its task.
+ */
+
+static void *sim_thread(void *arg)
+{
+	struct sim_io *io;
+	struct iocb *iocb;
+	struct timespec ts;
+	uint64_t now;
+
+	pthread_mutex_lock(&sim_mutex);
+	while (1) {
+		if (list_empty(&sim_pending)) {
+			pthread_cond_wait(&sim_cond, &sim_mutex);
+			continue;
+		}
+
+		io = list_first_entry(&sim_pending, struct sim_io, list);
+		now = now_us();
+
+		if (io->due_us > now) {
+			us_to_ts(io->due_us, &ts);
+			pthread_cond_timedwait(&sim_cond, &sim_mutex, &ts);
+			continue;
+		}
+
+		list_del(&io->list);
+		sim_executing = io;
+		pthread_mutex_unlock(&sim_mutex);
+
+		iocb = &io->aicb->iocb;
+		io->res = do_sim_io(iocb->aio_fildes, iocb->aio_lio_opcode,
+				    iocb->u.c.buf, iocb->u.c.nbytes, iocb->u.c.offset,
+				    &io->e);
+
+		pthread_mutex_lock(&sim_mutex);
+		sim_executing = NULL;
+		list_add_tail(&io->list, &io->task->sim->done);
+		pthread_cond_broadcast(&io->task->sim->cond);
+		pthread_cond_broadcast(&sim_exec_cond);
+	}
+	pthread_mutex_unlock(&sim_mutex);
+	return arg;
+}
+
+static int start_sim_thread(void)
+{
+	pthread_attr_t attr;
+	pthread_t th;
+	int rv;
+
+	if (sim_thread_started)
+		return 0;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rv = pthread_create(&th, &attr, sim_thread, NULL);
+	pthread_attr_destroy(&attr);
+	if (rv)
+		return -rv;
+
+	sim_thread_started = 1;
+	return 0;
+}
+
+static int setup_sim_queue(struct task *task)
+{
+	struct sim_queue *sq;
+
+	if (task->sim)
+		return 0;
+
+	sq = calloc(1, sizeof(struct sim_queue));
+	if (!sq)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&sq->done);
+	pthread_cond_init(&sq->cond, &sim_condattr);
+	task->sim = sq;
+	return 0;
+}
+
+static void add_pending(struct sim_io *io)
+{
+	struct sim_io *pos;
+
+	list_for_each_entry(pos, &sim_pending, list) {
+		if (pos->due_us > io->due_us) {
+			list_add_tail(&io->list, &pos->list);
+			return;
+		}
+	}
+	list_add_tail(&io->list, &sim_pending);
+}
+
+/* same return values as io_submit */
+
+int sim_submit(struct task *task, int nr, struct aicb **aicbs)
+{
+	struct sim_disk *sd;
+	struct sim_io *io;
+	uint64_t now;
+	int i, rv;
+
+	pthread_mutex_lock(&sim_mutex);
+
+	rv = start_sim_thread();
+	if (!rv)
+		rv = setup_sim_queue(task);
+	if (rv < 0)
+		goto out;
+
+	now = now_us();
+
+	for (i = 0; i < nr; i++) {
+		sd = find_sim_disk(aicbs[i]->iocb.aio_fildes);
+		if (!sd)
+			break;
+
+		io = calloc(1, sizeof(struct sim_io));
+		if (!io)
+			break;
+
+		io->task = task;
+		io->aicb = aicbs[i];
+		choose_effect(sd, aicbs[i]->iocb.aio_lio_opcode, &io->e);
+		io->due_us = now + io->e.delay_us;
+
+		add_pending(io);
+		task->sim->outstanding++;
+	}
+	pthread_cond_broadcast(&sim_cond);
+
+	rv = i ? i : -EAGAIN;
+ out:
+	pthread_mutex_unlock(&sim_mutex);
+	return rv;
+}
+
+/* return completed sim i/o of the task without waiting */
+
+int sim_collect(struct task *task, int nr, struct aio_done *done)
+{
+	struct sim_io *io, *safe;
+	int count = 0;
+
+	if (!task->sim)
+		return 0;
+
+	pthread_mutex_lock(&sim_mutex);
+	list_for_each_entry_safe(io, safe, &task->sim->done, list) {
+		if (count == nr)
+			break;
+		list_del(&io->list);
+		done[count].aicb = io->aicb;
+		done[count].res = io->res;
+		done[count].res2 = 0;
+		count++;
+		task->sim->outstanding--;
+		free(io);
+	}
+	pthread_mutex_unlock(&sim_mutex);
+
+	return count;
+}
+
+/* wait until a sim i/o of the task is done, or until (CLOCK_MONOTONIC) */
+
+void sim_wait(struct task *task, struct timespec *until)
+{
+	if (!task->sim)
+		return;
+
+	pthread_mutex_lock(&sim_mutex);
+	if (list_empty(&task->sim->done))
+		pthread_cond_timedwait(&task->sim->cond, &sim_mutex, until);
+	pthread_mutex_unlock(&sim_mutex);
+}
+
+int sim_outstanding(struct task *task)
+{
+	int count;
+
+	if (!task->sim)
+		return 0;
+
+	pthread_mutex_lock(&sim_mutex);
+	count = task->sim->outstanding;
+	pthread_mutex_unlock(&sim_mutex);
+
+	return count;
+}
+
+/* forget sim i/o that the task did not wait for */
+
+void sim_task_destroy(struct task *task)
+{
+	struct sim_io *io, *safe;
+
+	if (!task->sim)
+		return;
+
+	pthread_mutex_lock(&sim_mutex);
+	while (sim_executing && sim_executing->task == task)
+		pthread_cond_wait(&sim_exec_cond, &sim_mutex);
+
+	list_for_each_entry_safe(io, safe, &sim_pending, list) {
+		if (io->task != task)
+			continue;
+		list_del(&io->list);
+		free(io);
+	}
+	list_for_each_entry_safe(io, safe, &task->sim->done, list) {
+		list_del(&io->list);
+		free(io);
+	}
+	pthread_mutex_unlock(&sim_mutex);
+
+	pthread_cond_destroy(&task->sim->cond);
+	free(task->sim);
+	task->sim = NULL;
+}
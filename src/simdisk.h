@@ -0,0 +1,36 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#ifndef __SIMDISK_H__
+#define __SIMDISK_H__
+
+#define SIM_PATH_PREFIX "sim:"
+
+extern int sim_disk_count;
+
+int sim_path(const char *path);
+int sim_open(const char *path);
+void sim_close(int fd);
+int sim_fd(int fd);
+
+ssize_t sim_pread(int fd, void *buf, size_t len, off_t offset);
+ssize_t sim_pwrite(int fd, const void *buf, size_t len, off_t offset);
+
+int sim_submit(struct task *task, int nr, struct aicb **aicbs);
+int sim_collect(struct task *task, int nr, struct aio_done *done);
+void sim_wait(struct task *task, struct timespec *until);
+int sim_outstanding(struct task *task);
+void sim_task_destroy(struct task *task);
+
+/* an aicb of the task is for a sim disk */
+static inline int sim_aicb(struct aicb *aicb)
+{
+	return sim_disk_count && sim_fd(aicb->iocb.aio_fildes);
+}
+
+#endif
@@ -263,6 +263,41 @@ uint32_t sanlk_res_align_size_to_flag(int align_size)
 	return 0;
 }
 
+int sanlk_res_lvb_flag_to_size(uint32_t flags)
+{
+	if (flags & SANLK_RES_LVB4K)
+		return 4096;
+	if (flags & SANLK_RES_LVB8K)
+		return 8192;
+	if (flags & SANLK_RES_LVB16K)
+		return 16384;
+	return 0;
+}
+
+/* zero lvb_size is the original single sector lvb without a flag */
+
+uint32_t leader_lvb_flag_from_size(int lvb_size)
+{
+	if (lvb_size == 4096)
+		return LFL_LVB_4K;
+	if (lvb_size == 8192)
+		return LFL_LVB_8K;
+	if (lvb_size == 16384)
+		return LFL_LVB_16K;
+	return 0;
+}
+
+int leader_lvb_size_from_flag(uint32_t flags)
+{
+	if (flags & LFL_LVB_4K)
+		return 4096;
+	if (flags & LFL_LVB_8K)
+		return 8192;
+	if (flags & LFL_LVB_16K)
+		return 16384;
+	return 0;
+}
+
 /*
  * struct sanlk_rindex
  */
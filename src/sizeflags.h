@@ -35,6 +35,10 @@ int sanlk_res_sector_flag_to_size(uint32_t flags);
 uint32_t sanlk_res_sector_size_to_flag(int sector_size);
 int sanlk_res_align_flag_to_size(uint32_t flags);
 uint32_t sanlk_res_align_size_to_flag(int align_size);
+int sanlk_res_lvb_flag_to_size(uint32_t flags);
+
+uint32_t leader_lvb_flag_from_size(int lvb_size);
+int leader_lvb_size_from_flag(uint32_t flags);
 void sanlk_res_sector_flags_clear(uint32_t *flags);
 void sanlk_res_align_flags_clear(uint32_t *flags);
 
@@ -0,0 +1,248 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <syslog.h>
+
+#include "sanlock_internal.h"
+#include "log.h"
+#include "slab.h"
+
+/*
+ * Tokens and resources are carved out of chunks that are never freed, so
+ * once the daemon has seen its peak number of leases, acquire and release
+ * do not malloc or free, and the mlock'ed heap is not fragmented by them.
+ *
+ * Each thread keeps a short free list for each size class, and takes or
+ * returns a batch of objects from the global free list under slab_mutex
+ * when its list is empty or too long.  A token is often freed by a
+ * different thread than the one that allocated it, which is fine, the
+ * objects end up back on the global list.  The lists of a thread that
+ * exits are returned to the global list by the key destructor.
+ */
+
+#define SLAB_MAGIC      0x534c4142 /* "SLAB" */
+#define SLAB_FREE_MAGIC 0x46524545 /* "FREE" */
+
+#define SLAB_CHUNK_OBJS  32
+#define SLAB_CACHE_BATCH 16
+#define SLAB_CACHE_MAX   32
+
+struct slab_obj {
+	struct slab_obj *next;
+	uint32_t magic;
+	uint16_t type;
+	uint16_t class;		/* num_disks - 1 */
+} __attribute__((aligned(16)));
+
+struct slab_list {
+	struct slab_obj *head;
+	int count;
+};
+
+static struct slab_list slab_free_list[SLAB_TYPES][SANLK_MAX_DISKS];
+static struct slab_stats slab_stats[SLAB_TYPES];
+static pthread_mutex_t slab_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slab_key;
+
+static __thread struct slab_list slab_cache[SLAB_TYPES][SANLK_MAX_DISKS];
+static __thread int slab_cache_registered;
+
+static int slab_obj_size(int type, int class)
+{
+	int len;
+
+	if (type == SLAB_TOKEN)
+		len = sizeof(struct token);
+	else
+		len = sizeof(struct resource);
+
+	len += (class + 1) * sizeof(struct sync_disk);
+
+	return sizeof(struct slab_obj) + ((len + 15) & ~15);
+}
+
+/* move up to count objects from the head of one list to another */
+
+static void slab_list_move(struct slab_list *from, struct slab_list *to, int count)
+{
+	struct slab_obj *o;
+
+	while (count-- && from->head) {
+		o = from->head;
+		from->head = o->next;
+		from->count--;
+
+		o->next = to->head;
+		to->head = o;
+		to->count++;
+	}
+}
+
+static void slab_thread_exit(void *arg GNUC_UNUSED)
+{
+	int type, class;
+
+	pthread_mutex_lock(&slab_mutex);
+	for (type = 0; type < SLAB_TYPES; type++) {
+		for (class = 0; class < SANLK_MAX_DISKS; class++) {
+			slab_list_move(&slab_cache[type][class],
+				       &slab_free_list[type][class], INT32_MAX);
+		}
+	}
+	pthread_mutex_unlock(&slab_mutex);
+}
+
+static void slab_key_create(void)
+{
+	pthread_key_create(&slab_key, slab_thread_exit);
+}
+
+static void slab_thread_register(void)
+{
+	pthread_once(&slab_once, slab_key_create);
+	pthread_setspecific(slab_key, (void *)1);
+	slab_cache_registered = 1;
+}
+
+/* called with slab_mutex */
+
+static int slab_add_chunk(int type, int class)
+{
+	struct slab_list *fl = &slab_free_list[type][class];
+	struct slab_obj *o;
+	char *chunk;
+	int size = slab_obj_size(type, class);
+	int i;
+
+	chunk = malloc(size * SLAB_CHUNK_OBJS);
+	if (!chunk)
+		return -ENOMEM;
+
+	for (i = 0; i < SLAB_CHUNK_OBJS; i++) {
+		o = (struct slab_obj *)(chunk + (i * size));
+		o->magic = SLAB_FREE_MAGIC;
+		o->type = type;
+		o->class = class;
+		o->next = fl->head;
+		fl->head = o;
+		fl->count++;
+	}
+
+	slab_stats[type].chunks++;
+	slab_stats[type].objs += SLAB_CHUNK_OBJS;
+	return 0;
+}
+
+static int slab_refill(int type, int class, struct slab_list *c)
+{
+	struct slab_list *fl = &slab_free_list[type][class];
+	int rv = 0;
+
+	if (!slab_cache_registered)
+		slab_thread_register();
+
+	pthread_mutex_lock(&slab_mutex);
+	if (!fl->head)
+		rv = slab_add_chunk(type, class);
+	if (!rv)
+		slab_list_move(fl, c, SLAB_CACHE_BATCH);
+	pthread_mutex_unlock(&slab_mutex);
+
+	return rv;
+}
+
+void *slab_alloc(int type, int num_disks)
+{
+	struct slab_list *c;
+	struct slab_obj *o;
+	int class = num_disks - 1;
+
+	if (type < 0 || type >= SLAB_TYPES || class < 0 || class >= SANLK_MAX_DISKS)
+		return NULL;
+
+	c = &slab_cache[type][class];
+
+	if (c->head)
+		__atomic_add_fetch(&slab_stats[type].cache_hits, 1, __ATOMIC_RELAXED);
+	else if (slab_refill(type, class, c) < 0)
+		return NULL;
+
+	o = c->head;
+	c->head = o->next;
+	c->count--;
+
+	o->next = NULL;
+	o->magic = SLAB_MAGIC;
+
+	__atomic_add_fetch(&slab_stats[type].allocs, 1, __ATOMIC_RELAXED);
+
+	return o + 1;
+}
+
+void slab_free(void *obj)
+{
+	struct slab_list *c;
+	struct slab_obj *o;
+
+	if (!obj)
+		return;
+
+	o = (struct slab_obj *)obj - 1;
+
+	/* leaking the object is better than corrupting a free list */
+	if (o->magic != SLAB_MAGIC) {
+		log_error("slab_free bad object %p magic %x", obj, o->magic);
+		return;
+	}
+
+	o->magic = SLAB_FREE_MAGIC;
+
+	c = &slab_cache[o->type][o->class];
+	o->next = c->head;
+	c->head = o;
+	c->count++;
+
+	__atomic_add_fetch(&slab_stats[o->type].frees, 1, __ATOMIC_RELAXED);
+
+	if (c->count <= SLAB_CACHE_MAX)
+		return;
+
+	if (!slab_cache_registered)
+		slab_thread_register();
+
+	pthread_mutex_lock(&slab_mutex);
+	slab_list_move(c, &slab_free_list[o->type][o->class], SLAB_CACHE_BATCH);
+	pthread_mutex_unlock(&slab_mutex);
+}
+
+void slab_get_stats(int type, struct slab_stats *st)
+{
+	memset(st, 0, sizeof(struct slab_stats));
+
+	if (type < 0 || type >= SLAB_TYPES)
+		return;
+
+	pthread_mutex_lock(&slab_mutex);
+	st->chunks = slab_stats[type].chunks;
+	st->objs = slab_stats[type].objs;
+	pthread_mutex_unlock(&slab_mutex);
+
+	st->allocs = __atomic_load_n(&slab_stats[type].allocs, __ATOMIC_RELAXED);
+	st->frees = __atomic_load_n(&slab_stats[type].frees, __ATOMIC_RELAXED);
+	st->cache_hits = __atomic_load_n(&slab_stats[type].cache_hits, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+/*
+ * struct token and struct resource are followed by num_disks sync_disk's,
+ * so each type has a size class for each num_disks 1..SANLK_MAX_DISKS.
+ */
+
+#define SLAB_TOKEN    0
+#define SLAB_RESOURCE 1
+#define SLAB_TYPES    2
+
+struct slab_stats {
+	uint64_t allocs;
+	uint64_t frees;
+	uint64_t cache_hits;	/* allocs from the thread cache */
+	uint64_t chunks;	/* chunks malloc'ed */
+	uint64_t objs;		/* objects in all chunks */
+};
+
+/* the object is not zeroed */
+
+void *slab_alloc(int type, int num_disks);
+void slab_free(void *obj);
+void slab_get_stats(int type, struct slab_stats *st);
+
+#endif
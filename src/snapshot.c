@@ -0,0 +1,258 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sanlock_internal.h"
+#include "sanlock_admin.h"
+#include "sanlock_sock.h"
+#include "log.h"
+#include "lockspace.h"
+#include "resource.h"
+#include "snapshot.h"
+
+/*
+ * The snapshot is built in a private buffer with the same functions
+ * that answer get_lockspaces, get_hosts and status, then copied into
+ * the shared file under a seqlock: seq is odd while the copy is being
+ * written, and a reader retries if seq was odd or changed while it was
+ * copying.  Readers only map the file, so nothing they do can block the
+ * daemon.
+ */
+
+#define SNAPSHOT_MAX_LOCKSPACES 1024
+
+static char snapshot_path[PATH_MAX];
+static char *snapshot_map;
+static char *snapshot_buf;
+static struct sanlk_lockspace *snapshot_lss;
+static pthread_t snapshot_thread;
+static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t snapshot_cond = PTHREAD_COND_INITIALIZER;
+static int snapshot_wake;
+static int snapshot_stop;
+
+void snapshot_changed(void)
+{
+	if (!snapshot_map)
+		return;
+
+	pthread_mutex_lock(&snapshot_mutex);
+	snapshot_wake = 1;
+	pthread_cond_signal(&snapshot_cond);
+	pthread_mutex_unlock(&snapshot_mutex);
+}
+
+static int build_snapshot(char *buf, int maxlen)
+{
+	struct sanlk_state_header *hdr = (struct sanlk_state_header *)buf;
+	struct sanlk_state_lockspace *sl;
+	int ls_len, ls_count = 0, count;
+	int pos, i, rv;
+
+	memset(hdr, 0, sizeof(struct sanlk_state_header));
+	hdr->magic = SANLK_STATE_MAGIC;
+	hdr->version = SANLK_STATE_VERSION;
+	hdr->update_time = monotime();
+	hdr->daemon_pid = getpid();
+
+	rv = get_lockspaces((char *)snapshot_lss, &ls_len, &ls_count,
+			    SNAPSHOT_MAX_LOCKSPACES * sizeof(struct sanlk_lockspace));
+	if (rv == -ENOSPC) {
+		hdr->flags |= SANLK_STATE_TRUNCATED;
+		ls_count = ls_len / sizeof(struct sanlk_lockspace);
+	}
+
+	pos = sizeof(struct sanlk_state_header);
+	hdr->ls_offset = pos;
+	hdr->ls_count = ls_count;
+	pos += ls_count * sizeof(struct sanlk_state_lockspace);
+
+	hdr->host_offset = pos;
+
+	for (i = 0; i < ls_count; i++) {
+		sl = (struct sanlk_state_lockspace *)(buf + hdr->ls_offset) + i;
+		memset(sl, 0, sizeof(struct sanlk_state_lockspace));
+		memcpy(&sl->ls, &snapshot_lss[i], sizeof(struct sanlk_lockspace));
+		sl->host_first = hdr->host_count;
+
+		/* host_id 0 asks get_hosts for every host with a timestamp */
+		snapshot_lss[i].host_id = 0;
+
+		rv = get_hosts(&snapshot_lss[i], buf + pos, &ls_len, &count, maxlen - pos);
+		if (rv == -ENOSPC)
+			hdr->flags |= SANLK_STATE_TRUNCATED;
+		else if (rv < 0)
+			continue;
+
+		sl->host_count = ls_len / sizeof(struct sanlk_host);
+		hdr->host_count += sl->host_count;
+		pos += ls_len;
+	}
+
+	hdr->res_offset = pos;
+
+	rv = resource_state(buf + pos, maxlen - pos, &count);
+	if (rv == -ENOSPC)
+		hdr->flags |= SANLK_STATE_TRUNCATED;
+
+	hdr->res_count = count;
+	pos += count * sizeof(struct sanlk_state_resource);
+
+	hdr->len = pos;
+	return pos;
+}
+
+static void publish_snapshot(char *buf, int len)
+{
+	struct sanlk_state_header *map_hdr = (struct sanlk_state_header *)snapshot_map;
+	struct sanlk_state_header *hdr = (struct sanlk_state_header *)buf;
+	uint64_t seq;
+
+	seq = __atomic_load_n(&map_hdr->seq, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&map_hdr->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	/* the copied header carries the same odd seq that was just set */
+	hdr->seq = seq + 1;
+	memcpy(snapshot_map, buf, len);
+
+	__atomic_store_n(&map_hdr->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void *snapshot_thread_main(void *arg GNUC_UNUSED)
+{
+	struct timespec ts;
+	int len;
+
+	while (1) {
+		len = build_snapshot(snapshot_buf, SANLK_STATE_SIZE);
+		publish_snapshot(snapshot_buf, len);
+
+		pthread_mutex_lock(&snapshot_mutex);
+		if (!snapshot_wake && !snapshot_stop) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += 1;
+			pthread_cond_timedwait(&snapshot_cond, &snapshot_mutex, &ts);
+		}
+		snapshot_wake = 0;
+		if (snapshot_stop) {
+			pthread_mutex_unlock(&snapshot_mutex);
+			break;
+		}
+		pthread_mutex_unlock(&snapshot_mutex);
+	}
+
+	return NULL;
+}
+
+int setup_snapshot(const char *run_dir)
+{
+	int fd, rv;
+
+	snprintf(snapshot_path, sizeof(snapshot_path) - 1, "%s/%s",
+		 run_dir, SANLK_STATE_NAME);
+
+	snapshot_buf = malloc(SANLK_STATE_SIZE);
+	snapshot_lss = malloc(SNAPSHOT_MAX_LOCKSPACES * sizeof(struct sanlk_lockspace));
+	if (!snapshot_buf || !snapshot_lss) {
+		rv = -ENOMEM;
+		goto out_free;
+	}
+
+	unlink(snapshot_path);
+
+	fd = open(snapshot_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+		  S_IRUSR | S_IWUSR | S_IRGRP);
+	if (fd < 0) {
+		rv = -errno;
+		log_error("state snapshot %s open error %d", snapshot_path, rv);
+		goto out_free;
+	}
+
+	rv = fchown(fd, com.uid, com.gid);
+	if (rv < 0) {
+		rv = -errno;
+		log_error("state snapshot %s chown error %d", snapshot_path, rv);
+		goto out_close;
+	}
+
+	rv = ftruncate(fd, SANLK_STATE_SIZE);
+	if (rv < 0) {
+		rv = -errno;
+		log_error("state snapshot %s truncate error %d", snapshot_path, rv);
+		goto out_close;
+	}
+
+	snapshot_map = mmap(NULL, SANLK_STATE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (snapshot_map == MAP_FAILED) {
+		snapshot_map = NULL;
+		rv = -errno;
+		log_error("state snapshot %s mmap error %d", snapshot_path, rv);
+		goto out_close;
+	}
+
+	/* the mapping stays valid after the fd is closed */
+	close(fd);
+
+	rv = pthread_create(&snapshot_thread, NULL, snapshot_thread_main, NULL);
+	if (rv) {
+		log_error("state snapshot thread error %d", rv);
+		munmap(snapshot_map, SANLK_STATE_SIZE);
+		snapshot_map = NULL;
+		rv = -rv;
+		goto out_unlink;
+	}
+
+	return 0;
+
+ out_close:
+	close(fd);
+ out_unlink:
+	unlink(snapshot_path);
+ out_free:
+	free(snapshot_buf);
+	free(snapshot_lss);
+	snapshot_buf = NULL;
+	snapshot_lss = NULL;
+	return rv;
+}
+
+void close_snapshot(void)
+{
+	if (!snapshot_map)
+		return;
+
+	pthread_mutex_lock(&snapshot_mutex);
+	snapshot_stop = 1;
+	pthread_cond_signal(&snapshot_cond);
+	pthread_mutex_unlock(&snapshot_mutex);
+
+	pthread_join(snapshot_thread, NULL);
+
+	unlink(snapshot_path);
+	munmap(snapshot_map, SANLK_STATE_SIZE);
+	snapshot_map = NULL;
+	free(snapshot_buf);
+	free(snapshot_lss);
+}
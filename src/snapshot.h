@@ -0,0 +1,23 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+/*
+ * The state snapshot read by sanlock_state_read(), see
+ * struct sanlk_state_header in sanlock_admin.h.
+ */
+
+int setup_snapshot(const char *run_dir);
+void close_snapshot(void);
+
+/* ask for the snapshot to be updated now rather than at the next interval */
+void snapshot_changed(void);
+
+#endif
@@ -25,6 +25,9 @@
 #include "sanlock_internal.h"
 #include "log.h"
 #include "task.h"
+#include "diskio.h"
+#include "uring.h"
+#include "simdisk.h"
 
 void setup_task_aio(struct task *task, int use_aio, int cb_size)
 {
@@ -44,9 +47,20 @@ void setup_task_aio(struct task *task, int use_aio, int cb_size)
 	if (!cb_size)
 		return;
 
+	if (use_aio == USE_AIO_URING) {
+		rv = uring_setup(task, cb_size);
+		if (!rv)
+			goto alloc;
+
+		/* fall back to libaio on kernels without a usable io_uring */
+		log_taskw(task, "io_uring unavailable %d, using libaio", rv);
+		task->use_aio = USE_AIO_LINUX;
+	}
+
 	rv = io_setup(cb_size, &task->aio_ctx);
 	if (rv < 0)
 		goto fail;
+ alloc:
 
 	task->cb_size = cb_size;
 	task->callbacks = malloc(cb_size * sizeof(struct aicb));
@@ -58,15 +72,386 @@ void setup_task_aio(struct task *task, int use_aio, int cb_size)
 	return;
 
  fail_setup:
-	io_destroy(task->aio_ctx);
+	if (task->uring)
+		uring_destroy(task);
+	else
+		io_destroy(task->aio_ctx);
  fail:
 	task->use_aio = 0;
 }
 
+/*
+ * The aio engine of the task, libaio or io_uring, is used through these
+ * functions, which have the same return values as io_submit, io_getevents
+ * and io_cancel.  The aicb iocb describes the i/o for either engine.
+ */
+
+static int engine_submit(struct task *task, int nr, struct aicb **aicbs)
+{
+	struct iocb *iocbs[nr];
+	int i;
+
+	if (task->uring)
+		return uring_submit(task, nr, aicbs);
+
+	for (i = 0; i < nr; i++)
+		iocbs[i] = &aicbs[i]->iocb;
+
+	return io_submit(task->aio_ctx, nr, iocbs);
+}
+
+static int engine_getevents(struct task *task, int min_nr, int nr,
+			    struct aio_done *done, struct timespec *ts)
+{
+	struct io_event events[nr];
+	int i, rv;
+
+	if (task->uring)
+		return uring_getevents(task, min_nr, nr, done, ts);
+
+	memset(events, 0, sizeof(events));
+
+	rv = io_getevents(task->aio_ctx, min_nr, nr, events, ts);
+
+	for (i = 0; i < rv; i++) {
+		done[i].aicb = container_of(events[i].obj, struct aicb, iocb);
+		done[i].res = events[i].res;
+		done[i].res2 = events[i].res2;
+	}
+	return rv;
+}
+
+/*
+ * I/O to sim disks (see simdisk.c) goes to the sim delay thread instead
+ * of the engine.  A group with both kinds is submitted in runs of each
+ * kind, and while sim i/o is outstanding, events are collected from both.
+ */
+
+static int submit_runs(struct task *task, int nr, struct aicb **aicbs)
+{
+	int i, run, sim, rv, done = 0;
+
+	while (done < nr) {
+		sim = sim_aicb(aicbs[done]);
+
+		for (i = done + 1; i < nr; i++) {
+			if (sim_aicb(aicbs[i]) != sim)
+				break;
+		}
+		run = i - done;
+
+		if (sim)
+			rv = sim_submit(task, run, aicbs + done);
+		else
+			rv = engine_submit(task, run, aicbs + done);
+
+		if (rv < 0)
+			return done ? done : rv;
+
+		done += rv;
+		if (rv < run)
+			break;
+	}
+	return done;
+}
+
+static int engine_outstanding(struct task *task)
+{
+	int i;
+
+	for (i = 0; i < task->cb_size; i++) {
+		if (task->callbacks[i].used && !sim_aicb(&task->callbacks[i]))
+			return 1;
+	}
+	return 0;
+}
+
+static int getevents_sim(struct task *task, int min_nr, int nr,
+			 struct aio_done *done, struct timespec *ts)
+{
+	struct timespec now, end, zero, until;
+	int count, eng, rv;
+
+	memset(&zero, 0, sizeof(zero));
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (ts) {
+		end.tv_sec += ts->tv_sec;
+		end.tv_nsec += ts->tv_nsec;
+		if (end.tv_nsec >= 1000000000) {
+			end.tv_sec++;
+			end.tv_nsec -= 1000000000;
+		}
+	} else {
+		end.tv_sec += 3600;
+	}
+
+	while (1) {
+		count = sim_collect(task, nr, done);
+
+		eng = engine_outstanding(task);
+		if (eng && count < nr) {
+			rv = engine_getevents(task, 0, nr - count, done + count, &zero);
+			if (rv > 0)
+				count += rv;
+		}
+
+		/* events are returned as soon as there are any, callers
+		   use min_nr 0 or 1 */
+		if (count || !min_nr)
+			return count;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > end.tv_sec ||
+		    (now.tv_sec == end.tv_sec && now.tv_nsec >= end.tv_nsec))
+			return 0;
+
+		/* poll the engine every ms while it has i/o outstanding */
+		until = end;
+		if (eng) {
+			until = now;
+			until.tv_nsec += 1000000;
+			if (until.tv_nsec >= 1000000000) {
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000;
+			}
+		}
+		sim_wait(task, &until);
+	}
+}
+
+/*
+ * The aio engine of the task, libaio or io_uring, is used through these
+ * functions, which have the same return values as io_submit, io_getevents
+ * and io_cancel.  The aicb iocb describes the i/o for either engine.
+ */
+
+int task_aio_submit(struct task *task, int nr, struct aicb **aicbs)
+{
+	if (sim_disk_count)
+		return submit_runs(task, nr, aicbs);
+
+	return engine_submit(task, nr, aicbs);
+}
+
+int task_aio_getevents(struct task *task, int min_nr, int nr,
+		       struct aio_done *done, struct timespec *ts)
+{
+	if (task->sim && sim_outstanding(task))
+		return getevents_sim(task, min_nr, nr, done, ts);
+
+	return engine_getevents(task, min_nr, nr, done, ts);
+}
+
+int task_aio_cancel(struct task *task, struct aicb *aicb)
+{
+	struct io_event event;
+
+	/* an io_uring cancel completes asynchronously, so leave the i/o to be
+	   reaped, as when io_cancel fails; a sim i/o is always reaped */
+	if (task->uring || sim_aicb(aicb))
+		return -EINPROGRESS;
+
+	return io_cancel(task->aio_ctx, &aicb->iocb, &event);
+}
+
+static pthread_mutex_t iobuf_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct iobuf_pool_stats iobuf_stats;
+
+/*
+ * Get a page aligned buffer of at least len bytes from the task's pool.
+ * A free pooled buffer is reused if it's not much larger than needed,
+ * otherwise a new buffer is allocated into an empty pool slot (replacing
+ * a free buffer that's too small if there is no empty slot.)  When every
+ * slot is in use, e.g. by timed out i/o, the buffer is allocated outside
+ * the pool.  The caller must not assume the buffer is zeroed.
+ */
+
+int task_iobuf_alloc(struct task *task, int len, char **iobuf)
+{
+	struct task_iobuf *tb, *fit = NULL, *empty = NULL, *small = NULL;
+	int pagesize = getpagesize();
+	int alen = ((len + pagesize - 1) / pagesize) * pagesize;
+	char *buf;
+	int i, rv;
+
+	if (!task)
+		goto unpooled;
+
+	for (i = 0; i < TASK_IOBUF_POOL_SIZE; i++) {
+		tb = &task->iobuf_pool[i];
+
+		if (tb->used)
+			continue;
+
+		if (!tb->buf) {
+			if (!empty)
+				empty = tb;
+			continue;
+		}
+
+		if (tb->len >= alen && tb->len < 2 * alen) {
+			if (!fit || tb->len < fit->len)
+				fit = tb;
+			continue;
+		}
+
+		if (tb->len < alen && !small)
+			small = tb;
+	}
+
+	if (fit) {
+		fit->used = 1;
+		*iobuf = fit->buf;
+
+		pthread_mutex_lock(&iobuf_stats_mutex);
+		iobuf_stats.gets++;
+		pthread_mutex_unlock(&iobuf_stats_mutex);
+		return 0;
+	}
+
+	if (!empty && small) {
+		pthread_mutex_lock(&iobuf_stats_mutex);
+		iobuf_stats.bufs--;
+		iobuf_stats.bytes -= small->len;
+		pthread_mutex_unlock(&iobuf_stats_mutex);
+
+		free(small->buf);
+		small->buf = NULL;
+		small->len = 0;
+		empty = small;
+	}
+
+	if (!empty)
+		goto unpooled;
+
+	rv = posix_memalign((void *)&buf, pagesize, alen);
+	if (rv)
+		return -ENOMEM;
+
+	empty->buf = buf;
+	empty->len = alen;
+	empty->used = 1;
+	empty->aio_held = 0;
+	*iobuf = buf;
+
+	pthread_mutex_lock(&iobuf_stats_mutex);
+	iobuf_stats.gets++;
+	iobuf_stats.allocs++;
+	iobuf_stats.bufs++;
+	iobuf_stats.bytes += alen;
+	pthread_mutex_unlock(&iobuf_stats_mutex);
+	return 0;
+
+ unpooled:
+	rv = posix_memalign((void *)&buf, pagesize, len);
+	if (rv)
+		return -ENOMEM;
+	*iobuf = buf;
+
+	pthread_mutex_lock(&iobuf_stats_mutex);
+	iobuf_stats.gets++;
+	iobuf_stats.unpooled++;
+	pthread_mutex_unlock(&iobuf_stats_mutex);
+	return 0;
+}
+
+static struct task_iobuf *find_task_iobuf(struct task *task, char *iobuf)
+{
+	int i;
+
+	if (!task)
+		return NULL;
+
+	for (i = 0; i < TASK_IOBUF_POOL_SIZE; i++) {
+		if (task->iobuf_pool[i].buf == iobuf)
+			return &task->iobuf_pool[i];
+	}
+	return NULL;
+}
+
+/* return a buffer to the pool, or free it if it's not from the pool */
+
+void task_iobuf_free(struct task *task, char *iobuf)
+{
+	struct task_iobuf *tb;
+
+	if (!iobuf)
+		return;
+
+	tb = find_task_iobuf(task, iobuf);
+	if (!tb) {
+		free(iobuf);
+		return;
+	}
+
+	if (tb->aio_held) {
+		pthread_mutex_lock(&iobuf_stats_mutex);
+		iobuf_stats.aio_held--;
+		pthread_mutex_unlock(&iobuf_stats_mutex);
+	}
+
+	tb->used = 0;
+	tb->aio_held = 0;
+}
+
+/* the buffer belongs to a timed out i/o until the i/o is reaped */
+
+void task_iobuf_aio_held(struct task *task, char *iobuf)
+{
+	struct task_iobuf *tb;
+
+	tb = find_task_iobuf(task, iobuf);
+	if (!tb || tb->aio_held)
+		return;
+
+	tb->aio_held = 1;
+
+	pthread_mutex_lock(&iobuf_stats_mutex);
+	iobuf_stats.aio_held++;
+	pthread_mutex_unlock(&iobuf_stats_mutex);
+}
+
+void task_iobuf_stats(struct iobuf_pool_stats *st)
+{
+	pthread_mutex_lock(&iobuf_stats_mutex);
+	memcpy(st, &iobuf_stats, sizeof(struct iobuf_pool_stats));
+	pthread_mutex_unlock(&iobuf_stats_mutex);
+}
+
+static void free_task_iobufs(struct task *task)
+{
+	struct task_iobuf *tb;
+	int i;
+
+	for (i = 0; i < TASK_IOBUF_POOL_SIZE; i++) {
+		tb = &task->iobuf_pool[i];
+
+		if (!tb->buf)
+			continue;
+
+		/* still owned by an i/o that was never reaped */
+		if (tb->used) {
+			log_taskd(task, "close_task_aio iobuf %p len %d in use%s",
+				  tb->buf, tb->len, tb->aio_held ? " by aio" : "");
+			continue;
+		}
+
+		pthread_mutex_lock(&iobuf_stats_mutex);
+		iobuf_stats.bufs--;
+		iobuf_stats.bytes -= tb->len;
+		pthread_mutex_unlock(&iobuf_stats_mutex);
+
+		free(tb->buf);
+		tb->buf = NULL;
+		tb->len = 0;
+	}
+}
+
 void close_task_aio(struct task *task)
 {
 	struct timespec ts;
-	struct io_event event;
+	struct aio_done event;
 	uint64_t last_warn;
 	uint64_t begin;
 	uint64_t now;
@@ -113,14 +498,14 @@ void close_task_aio(struct task *task)
 
 		memset(&event, 0, sizeof(event));
 
-		rv = io_getevents(task->aio_ctx, 1, 1, &event, &ts);
+		rv = task_aio_getevents(task, 1, 1, &event, &ts);
 		if (rv == -EINTR)
 			continue;
 		if (rv < 0)
 			break;
 		if (rv == 1) {
-			struct iocb *ev_iocb = event.obj;
-			struct aicb *ev_aicb = container_of(ev_iocb, struct aicb, iocb);
+			struct aicb *ev_aicb = event.aicb;
+			struct iocb *ev_iocb = &ev_aicb->iocb;
 
 			if (ev_aicb->buf == task->iobuf)
 				task->iobuf = NULL;
@@ -129,7 +514,8 @@ void close_task_aio(struct task *task)
 				  ev_aicb, ev_iocb, ev_aicb->buf, event.res, event.res2);
 
 			ev_aicb->used = 0;
-			free(ev_aicb->buf);
+			aio_collected(ev_aicb);
+			task_iobuf_free(task, ev_aicb->buf);
 			ev_aicb->buf = NULL;
 		}
 	}
@@ -137,15 +523,25 @@ void close_task_aio(struct task *task)
 	if (used)
 		log_taskd(task, "close_task_aio destroy %d incomplete ops", used);
 
-	io_destroy(task->aio_ctx);
+	sim_task_destroy(task);
+
+	if (task->uring)
+		uring_destroy(task);
+	else
+		io_destroy(task->aio_ctx);
 
 	if (used)
 		log_taske(task, "close_task_aio destroyed %d incomplete ops", used);
 
+	for (i = 0; i < task->cb_size; i++)
+		aio_collected(&task->callbacks[i]);
+
 	if (task->iobuf)
 		free(task->iobuf);
 
  skip_aio:
+	free_task_iobufs(task);
+
 	if (task->callbacks)
 		free(task->callbacks);
 	task->callbacks = NULL;
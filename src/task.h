@@ -11,5 +11,23 @@
 
 void setup_task_aio(struct task *task, int use_aio, int cb_size);
 void close_task_aio(struct task *task);
+int task_aio_submit(struct task *task, int nr, struct aicb **aicbs);
+int task_aio_getevents(struct task *task, int min_nr, int nr,
+		       struct aio_done *done, struct timespec *ts);
+int task_aio_cancel(struct task *task, struct aicb *aicb);
+
+struct iobuf_pool_stats {
+	uint64_t gets;
+	uint64_t allocs;
+	uint64_t unpooled;
+	uint64_t bytes;
+	int bufs;
+	int aio_held;
+};
+
+int task_iobuf_alloc(struct task *task, int len, char **iobuf);
+void task_iobuf_free(struct task *task, char *iobuf);
+void task_iobuf_aio_held(struct task *task, char *iobuf);
+void task_iobuf_stats(struct iobuf_pool_stats *st);
 
 #endif
@@ -38,6 +38,26 @@ int calc_id_renewal_seconds(int io_timeout)
 	return 2 * io_timeout;
 }
 
+/*
+ * renewal_adaptive: start a renewal earlier when recent renewals have been
+ * slow, leading the measured latency by twice its length so a rising trend
+ * is caught before it reaches the fail time.  The renewal never starts
+ * later than id_renewal_seconds, and never comes sooner than io_timeout
+ * after the last one.  Only the local renewal phase moves; the on-disk
+ * timeouts seen by other hosts are unchanged.
+ */
+
+int calc_adaptive_renewal_seconds(int io_timeout, int latency_ms)
+{
+	int renewal_seconds = calc_id_renewal_seconds(io_timeout);
+	int lead_seconds = (2 * latency_ms) / 1000;
+
+	if (renewal_seconds - lead_seconds < io_timeout)
+		return io_timeout ? io_timeout : 1;
+
+	return renewal_seconds - lead_seconds;
+}
+
 int calc_id_renewal_fail_seconds(int io_timeout)
 {
 	return 8 * io_timeout;
@@ -450,6 +450,7 @@
 
 int calc_host_dead_seconds(int io_timeout);
 int calc_id_renewal_seconds(int io_timeout);
+int calc_adaptive_renewal_seconds(int io_timeout, int latency_ms);
 int calc_id_renewal_fail_seconds(int io_timeout);
 int calc_id_renewal_warn_seconds(int io_timeout);
 int calc_set_bitmap_seconds(int io_timeout);
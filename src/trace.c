@@ -0,0 +1,101 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#include "sanlock_internal.h"
+#include "sanlock_sock.h"
+#include "trace.h"
+
+/*
+ * A single ring shared by all threads.  A writer claims the next slot
+ * with an atomic increment, and sets the slot's seq to zero while it
+ * fills it in.  A reader copies a slot and rechecks seq to detect that
+ * it was written again meanwhile.
+ */
+
+static struct sanlk_trace trace_ring[TRACE_ENTRIES];
+static uint64_t trace_pos;
+static __thread uint32_t trace_tid;
+
+void trace_event(uint32_t op, uint32_t space_id, uint32_t res_id, uint64_t lver,
+		 uint32_t disk, uint64_t offset, uint64_t begin, int result)
+{
+	struct sanlk_trace *tr;
+	uint64_t pos, now;
+
+	now = trace_begin();
+
+	if (!trace_tid)
+		trace_tid = syscall(SYS_gettid);
+
+	pos = __atomic_fetch_add(&trace_pos, 1, __ATOMIC_RELAXED);
+	tr = &trace_ring[pos & (TRACE_ENTRIES - 1)];
+
+	__atomic_store_n(&tr->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	tr->time_us = now;
+	tr->lver = lver;
+	tr->offset = offset;
+	tr->op = op;
+	tr->space_id = space_id;
+	tr->res_id = res_id;
+	tr->disk = disk;
+	tr->latency_us = (now > begin) ? (uint32_t)(now - begin) : 0;
+	tr->result = result;
+	tr->tid = trace_tid;
+	tr->pad = 0;
+
+	__atomic_store_n(&tr->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* copy the records in the ring into buf, oldest first */
+
+int copy_trace(char *buf, int buf_len)
+{
+	struct sanlk_trace *tr, *out;
+	uint64_t pos, end, seq;
+	int len = 0;
+
+	end = __atomic_load_n(&trace_pos, __ATOMIC_ACQUIRE);
+	pos = (end > TRACE_ENTRIES) ? end - TRACE_ENTRIES : 0;
+
+	for (; pos < end; pos++) {
+		if (len + (int)sizeof(struct sanlk_trace) > buf_len)
+			break;
+
+		tr = &trace_ring[pos & (TRACE_ENTRIES - 1)];
+		out = (struct sanlk_trace *)(buf + len);
+
+		seq = __atomic_load_n(&tr->seq, __ATOMIC_ACQUIRE);
+		if (seq != pos + 1)
+			continue;
+
+		memcpy(out, tr, sizeof(struct sanlk_trace));
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (__atomic_load_n(&tr->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+
+		out->seq = seq;
+		len += sizeof(struct sanlk_trace);
+	}
+
+	return len;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <time.h>
+
+/*
+ * Binary trace of lease operations, see struct sanlk_trace in
+ * sanlock_sock.h.  There is no text formatting when recording, it's
+ * decoded by "sanlock client trace".
+ */
+
+#define TRACE_ENTRIES 16384 /* power of 2, * sizeof(struct sanlk_trace) fits LOG_DUMP_SIZE */
+
+static inline uint64_t trace_begin(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/*
+ * A cmd with a TIMES flag (SANLK_ACQUIRE_TIMES etc) points task->op_times
+ * at the struct sanlk_op_times that is returned to the client, and each
+ * part of the cmd adds the time since its begin to a field.  The tasks of
+ * a parallel acquire share the cmd's op_times.
+ */
+
+#define OP_TIME_ADD(task, field, begin) \
+do { \
+	if ((task) && (task)->op_times) \
+		__atomic_add_fetch(&(task)->op_times->field, trace_begin() - (begin), \
+				   __ATOMIC_RELAXED); \
+} while (0)
+
+#define OP_COUNT_ADD(task, field) \
+do { \
+	if ((task) && (task)->op_times) \
+		__atomic_add_fetch(&(task)->op_times->field, 1, __ATOMIC_RELAXED); \
+} while (0)
+
+/* latency is measured from begin, returned by trace_begin */
+
+void trace_event(uint32_t op, uint32_t space_id, uint32_t res_id, uint64_t lver,
+		 uint32_t disk, uint64_t offset, uint64_t begin, int result);
+
+int copy_trace(char *buf, int buf_len);
+
+#endif
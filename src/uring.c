@@ -0,0 +1,306 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+/*
+ * io_uring engine for disk i/o (use_aio = 2), using the io_uring
+ * syscalls directly so there's no dependency on liburing.
+ *
+ * An i/o is described by the iocb in its struct aicb in the same way it
+ * is for libaio, and the aicb pointer is the sqe user_data, so the aicb
+ * callback slot handling in diskio.c (timeouts, reaping later) is the
+ * same for both engines.
+ */
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "sanlock_internal.h"
+#include "log.h"
+#include "uring.h"
+
+struct uring {
+	int fd;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_entries;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_len;
+	size_t cq_ring_len;
+	size_t sqes_len;
+};
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+			      unsigned int flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static void uring_unmap(struct uring *ur)
+{
+	if (ur->sqes && ur->sqes != MAP_FAILED)
+		munmap(ur->sqes, ur->sqes_len);
+	if (ur->cq_ring && ur->cq_ring != MAP_FAILED && ur->cq_ring != ur->sq_ring)
+		munmap(ur->cq_ring, ur->cq_ring_len);
+	if (ur->sq_ring && ur->sq_ring != MAP_FAILED)
+		munmap(ur->sq_ring, ur->sq_ring_len);
+}
+
+int uring_setup(struct task *task, int entries)
+{
+	struct io_uring_params p;
+	struct uring *ur;
+	int rv;
+
+	ur = malloc(sizeof(struct uring));
+	if (!ur)
+		return -ENOMEM;
+	memset(ur, 0, sizeof(struct uring));
+
+	memset(&p, 0, sizeof(p));
+
+	ur->fd = sys_io_uring_setup(entries, &p);
+	if (ur->fd < 0) {
+		rv = -errno;
+		log_taske(task, "io_uring_setup error %d", rv);
+		free(ur);
+		return rv;
+	}
+
+	/* a timeout on waiting for completions requires EXT_ARG */
+
+	if (!(p.features & IORING_FEAT_EXT_ARG)) {
+		log_taske(task, "io_uring lacks ext_arg features 0x%x", p.features);
+		rv = -EOPNOTSUPP;
+		goto fail;
+	}
+
+	ur->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ur->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ur->cq_ring_len > ur->sq_ring_len)
+			ur->sq_ring_len = ur->cq_ring_len;
+		ur->cq_ring_len = ur->sq_ring_len;
+	}
+
+	ur->sq_ring = mmap(NULL, ur->sq_ring_len, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+	if (ur->sq_ring == MAP_FAILED) {
+		rv = -errno;
+		goto fail;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->cq_ring = ur->sq_ring;
+	} else {
+		ur->cq_ring = mmap(NULL, ur->cq_ring_len, PROT_READ | PROT_WRITE,
+				   MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_CQ_RING);
+		if (ur->cq_ring == MAP_FAILED) {
+			rv = -errno;
+			goto fail;
+		}
+	}
+
+	ur->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ur->sqes = mmap(NULL, ur->sqes_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+	if (ur->sqes == MAP_FAILED) {
+		rv = -errno;
+		goto fail;
+	}
+
+	ur->sq_head = (unsigned int *)((char *)ur->sq_ring + p.sq_off.head);
+	ur->sq_tail = (unsigned int *)((char *)ur->sq_ring + p.sq_off.tail);
+	ur->sq_mask = (unsigned int *)((char *)ur->sq_ring + p.sq_off.ring_mask);
+	ur->sq_entries = (unsigned int *)((char *)ur->sq_ring + p.sq_off.ring_entries);
+	ur->sq_array = (unsigned int *)((char *)ur->sq_ring + p.sq_off.array);
+	ur->cq_head = (unsigned int *)((char *)ur->cq_ring + p.cq_off.head);
+	ur->cq_tail = (unsigned int *)((char *)ur->cq_ring + p.cq_off.tail);
+	ur->cq_mask = (unsigned int *)((char *)ur->cq_ring + p.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe *)((char *)ur->cq_ring + p.cq_off.cqes);
+
+	task->uring = ur;
+	return 0;
+
+ fail:
+	log_taske(task, "io_uring mmap error %d", rv);
+	uring_unmap(ur);
+	close(ur->fd);
+	free(ur);
+	return rv;
+}
+
+void uring_destroy(struct task *task)
+{
+	struct uring *ur = task->uring;
+
+	if (!ur)
+		return;
+
+	uring_unmap(ur);
+	close(ur->fd);
+	free(ur);
+	task->uring = NULL;
+}
+
+/*
+ * Same return values as io_submit: the number of the first aicbs that
+ * were submitted, which can be fewer than nr, or an error if none were.
+ * The kernel takes sqes from the ring only in io_uring_enter (there's no
+ * SQPOLL), so the sqes it did not take are removed from the ring again
+ * before returning, and are never submitted after the caller has given
+ * up on them and reused the aicbs and buffers.
+ */
+
+int uring_submit(struct task *task, int nr, struct aicb **aicbs)
+{
+	struct uring *ur = task->uring;
+	struct io_uring_sqe *sqe;
+	struct iocb *iocb;
+	unsigned int head, tail, start, space, idx;
+	int i, rv, done, error = 0;
+
+	head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+	tail = *ur->sq_tail;
+	space = *ur->sq_entries - (tail - head);
+
+	if (!space)
+		return -EAGAIN;
+	if (nr > space)
+		nr = space;
+
+	start = tail;
+
+	for (i = 0; i < nr; i++) {
+		iocb = &aicbs[i]->iocb;
+		idx = tail & *ur->sq_mask;
+		sqe = &ur->sqes[idx];
+
+		memset(sqe, 0, sizeof(struct io_uring_sqe));
+		if (iocb->aio_lio_opcode == IO_CMD_PREAD)
+			sqe->opcode = IORING_OP_READ;
+		else
+			sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = iocb->aio_fildes;
+		sqe->addr = (uint64_t)(uintptr_t)iocb->u.c.buf;
+		sqe->len = iocb->u.c.nbytes;
+		sqe->off = iocb->u.c.offset;
+		sqe->user_data = (uint64_t)(uintptr_t)aicbs[i];
+
+		ur->sq_array[idx] = idx;
+		tail++;
+	}
+
+	__atomic_store_n(ur->sq_tail, tail, __ATOMIC_RELEASE);
+
+	done = 0;
+
+	while (done < nr) {
+		rv = sys_io_uring_enter(ur->fd, nr - done, 0, 0, NULL, 0);
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv < 0) {
+			error = -errno;
+			break;
+		}
+		done = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE) - start;
+		if (!rv)
+			break;
+	}
+
+	done = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE) - start;
+
+	if (done < nr) {
+		log_taske(task, "io_uring submit %d of %d error %d", done, nr, error);
+		__atomic_store_n(ur->sq_tail, start + done, __ATOMIC_RELEASE);
+	}
+
+	if (!done)
+		return error ? error : -EAGAIN;
+	return done;
+}
+
+static int uring_reap(struct uring *ur, int nr, struct aio_done *done)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head, tail;
+	int count = 0;
+
+	head = *ur->cq_head;
+	tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail && count < nr) {
+		cqe = &ur->cqes[head & *ur->cq_mask];
+		done[count].aicb = (struct aicb *)(uintptr_t)cqe->user_data;
+		done[count].res = cqe->res;
+		done[count].res2 = 0;
+		count++;
+		head++;
+	}
+
+	__atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+	return count;
+}
+
+/* same return values as io_getevents */
+
+int uring_getevents(struct task *task, int min_nr, int nr,
+		    struct aio_done *done, struct timespec *ts)
+{
+	struct uring *ur = task->uring;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec kts;
+	int count, rv;
+
+	count = uring_reap(ur, nr, done);
+	if (count >= min_nr)
+		return count;
+
+	memset(&arg, 0, sizeof(arg));
+	arg.sigmask_sz = _NSIG / 8;
+	if (ts) {
+		kts.tv_sec = ts->tv_sec;
+		kts.tv_nsec = ts->tv_nsec;
+		arg.ts = (uint64_t)(uintptr_t)&kts;
+	}
+
+	rv = sys_io_uring_enter(ur->fd, 0, min_nr - count,
+				IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+				&arg, sizeof(arg));
+	if (rv < 0 && errno != ETIME) {
+		if (count)
+			return count;
+		return -errno;
+	}
+
+	return count + uring_reap(ur, nr - count, done + count);
+}
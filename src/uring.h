@@ -0,0 +1,18 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+#ifndef __URING_H__
+#define __URING_H__
+
+int uring_setup(struct task *task, int entries);
+void uring_destroy(struct task *task);
+int uring_submit(struct task *task, int nr, struct aicb **aicbs);
+int uring_getevents(struct task *task, int min_nr, int nr,
+		    struct aio_done *done, struct timespec *ts);
+
+#endif
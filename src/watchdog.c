@@ -39,6 +39,248 @@
 
 #include "../wdmd/wdmd.h"
 
+/*
+ * Batched test_live: each lockspace keeps its own wdmd connection, with
+ * its refcount and expire time, but after a renewal the new times are
+ * queued and sent by the wd_batch thread in a single message on its own
+ * connection, which wdmd applies to each lockspace's connection by id.
+ * The thread sends when every batched lockspace has queued an update, or
+ * watchdog_batch_ms after the first one, so lockspaces renewing in the
+ * same round (see renewal_coalesce) share one message.
+ *
+ * The times queued for a lockspace are dropped when it is deactivated,
+ * and wdmd ignores times that arrive after the lockspace disabled its
+ * connection.  If a batch cannot be sent, batching is stopped and the
+ * updates are sent on each connection as before.
+ */
+
+struct wd_pending {
+	struct wdmd_test_live tl;
+	int fd;
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int state;			/* WD_BATCH_ */
+	int con;
+	int members;
+	int count;
+	struct wd_pending pending[WDMD_TEST_LIVE_MAX];
+} wd_batch = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.con = -1,
+};
+
+#define WD_BATCH_NONE   0
+#define WD_BATCH_ON     1
+#define WD_BATCH_OFF    2
+
+static void *wd_batch_thread(void *arg GNUC_UNUSED)
+{
+	struct wdmd_test_live tl[WDMD_TEST_LIVE_MAX];
+	int fds[WDMD_TEST_LIVE_MAX];
+	struct timespec ts;
+	int i, count, rv;
+
+	pthread_mutex_lock(&wd_batch.mutex);
+
+	while (1) {
+		while (!wd_batch.count)
+			pthread_cond_wait(&wd_batch.cond, &wd_batch.mutex);
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += com.watchdog_batch_ms / 1000;
+		ts.tv_nsec += (com.watchdog_batch_ms % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+
+		while (wd_batch.count && wd_batch.count < wd_batch.members) {
+			rv = pthread_cond_timedwait(&wd_batch.cond, &wd_batch.mutex, &ts);
+			if (rv == ETIMEDOUT)
+				break;
+		}
+
+		count = wd_batch.count;
+		for (i = 0; i < count; i++) {
+			tl[i] = wd_batch.pending[i].tl;
+			fds[i] = wd_batch.pending[i].fd;
+		}
+		wd_batch.count = 0;
+
+		if (!count)
+			continue;
+
+		/*
+		 * The mutex is held while sending so that a lockspace
+		 * cannot be deactivated and close its connection before
+		 * the fallback below uses it.
+		 */
+
+		rv = wdmd_test_live_many(wd_batch.con, tl, count);
+		if (rv < 0) {
+			log_error("wdmd_test_live_many %d failed %d", count, rv);
+
+			/* the lockspace connections are still open */
+			for (i = 0; i < count; i++)
+				wdmd_test_live(fds[i], tl[i].renewal_time,
+					       tl[i].expire_time);
+			wd_batch.state = WD_BATCH_OFF;
+			break;
+		}
+
+		log_debug("wdmd_test_live_many %d", count);
+	}
+
+	pthread_mutex_unlock(&wd_batch.mutex);
+	return NULL;
+}
+
+/* called with wd_batch.mutex held */
+
+static int wd_batch_start(void)
+{
+	pthread_attr_t attr;
+	pthread_t th;
+	char name[WDMD_NAME_SIZE];
+	int con, rv;
+
+	con = wdmd_connect();
+	if (con < 0) {
+		log_error("wdmd_connect for batch failed %d", con);
+		return -1;
+	}
+
+	memset(name, 0, sizeof(name));
+	snprintf(name, WDMD_NAME_SIZE - 1, "sanlock_batch");
+
+	rv = wdmd_register(con, name);
+	if (rv < 0) {
+		log_error("wdmd_register for batch failed %d", rv);
+		goto fail;
+	}
+
+	wd_batch.con = con;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rv = pthread_create(&th, &attr, wd_batch_thread, NULL);
+	pthread_attr_destroy(&attr);
+	if (rv) {
+		log_error("wdmd batch thread create failed %d", rv);
+		wd_batch.con = -1;
+		goto fail;
+	}
+
+	return 0;
+ fail:
+	close(con);
+	return -1;
+}
+
+static void wd_batch_join(struct space *sp, int con, uint32_t status_flags)
+{
+	uint64_t client_id;
+	int rv;
+
+	sp->wd_client_id = 0;
+
+	if (!com.watchdog_batch_ms || !(status_flags & WDMD_STATUS_TEST_LIVE_MANY))
+		return;
+
+	pthread_mutex_lock(&wd_batch.mutex);
+
+	if (wd_batch.state == WD_BATCH_NONE)
+		wd_batch.state = wd_batch_start() ? WD_BATCH_OFF : WD_BATCH_ON;
+
+	if (wd_batch.state != WD_BATCH_ON || wd_batch.members >= WDMD_TEST_LIVE_MAX)
+		goto out;
+
+	rv = wdmd_client_id(con, &client_id);
+	if (rv < 0) {
+		log_erros(sp, "wdmd_client_id failed %d", rv);
+		goto out;
+	}
+
+	sp->wd_client_id = client_id;
+	wd_batch.members++;
+ out:
+	pthread_mutex_unlock(&wd_batch.mutex);
+}
+
+static void wd_batch_leave(struct space *sp)
+{
+	int i;
+
+	if (!sp->wd_client_id)
+		return;
+
+	pthread_mutex_lock(&wd_batch.mutex);
+	for (i = 0; i < wd_batch.count; i++) {
+		if (wd_batch.pending[i].tl.client_id == sp->wd_client_id) {
+			wd_batch.pending[i] = wd_batch.pending[--wd_batch.count];
+			break;
+		}
+	}
+	wd_batch.members--;
+	sp->wd_client_id = 0;
+	pthread_mutex_unlock(&wd_batch.mutex);
+}
+
+static int wd_batch_queue(struct space *sp, uint64_t renewal_time, uint64_t expire_time)
+{
+	struct wd_pending *wp = NULL;
+	int i, rv = -1;
+
+	pthread_mutex_lock(&wd_batch.mutex);
+	if (wd_batch.state != WD_BATCH_ON)
+		goto out;
+
+	for (i = 0; i < wd_batch.count; i++) {
+		if (wd_batch.pending[i].tl.client_id == sp->wd_client_id) {
+			wp = &wd_batch.pending[i];
+			break;
+		}
+	}
+	if (!wp)
+		wp = &wd_batch.pending[wd_batch.count++];
+
+	wp->tl.client_id = sp->wd_client_id;
+	wp->tl.renewal_time = renewal_time;
+	wp->tl.expire_time = expire_time;
+	wp->fd = sp->wd_fd;
+
+	pthread_cond_signal(&wd_batch.cond);
+	rv = 0;
+ out:
+	pthread_mutex_unlock(&wd_batch.mutex);
+	return rv;
+}
+
+/*
+ * With watchdog_shm, the renewal times are stored in a slot that wdmd
+ * reads, and the lockspace is not in the batch.
+ */
+
+static void wd_shm_open(struct space *sp, int con, uint32_t status_flags)
+{
+	int rv;
+
+	sp->wd_shm = NULL;
+
+	if (!com.watchdog_shm || !(status_flags & WDMD_STATUS_SHM))
+		return;
+
+	rv = wdmd_shm_open(con, &sp->wd_shm);
+	if (rv < 0) {
+		log_erros(sp, "wdmd_shm_open failed %d", rv);
+		sp->wd_shm = NULL;
+	}
+}
+
 void update_watchdog(struct space *sp, uint64_t timestamp,
 		     int id_renewal_fail_seconds)
 {
@@ -47,6 +289,15 @@ void update_watchdog(struct space *sp, uint64_t timestamp,
 	if (!com.use_watchdog)
 		return;
 
+	if (sp->wd_shm) {
+		wdmd_shm_test_live(sp->wd_shm, timestamp, timestamp + id_renewal_fail_seconds);
+		return;
+	}
+
+	if (sp->wd_client_id &&
+	    !wd_batch_queue(sp, timestamp, timestamp + id_renewal_fail_seconds))
+		return;
+
 	rv = wdmd_test_live(sp->wd_fd, timestamp, timestamp + id_renewal_fail_seconds);
 	if (rv < 0)
 		log_erros(sp, "wdmd_test_live %llu failed %d",
@@ -75,6 +326,7 @@ int activate_watchdog(struct space *sp, uint64_t timestamp,
 	char name[WDMD_NAME_SIZE];
 	int test_interval, fire_timeout;
 	uint64_t last_keepalive;
+	uint32_t status_flags;
 	int rv;
 
 	if (!com.use_watchdog)
@@ -99,7 +351,8 @@ int activate_watchdog(struct space *sp, uint64_t timestamp,
 		goto fail_close;
 	}
 
-	rv = wdmd_status(con, &test_interval, &fire_timeout, &last_keepalive);
+	rv = wdmd_status_flags(con, &test_interval, &fire_timeout, &last_keepalive,
+			       &status_flags);
 	if (rv < 0) {
 		log_erros(sp, "wdmd_status failed %d", rv);
 		goto fail_clear;
@@ -118,6 +371,10 @@ int activate_watchdog(struct space *sp, uint64_t timestamp,
 	}
 
 	sp->wd_fd = con;
+
+	wd_shm_open(sp, con, status_flags);
+	if (!sp->wd_shm)
+		wd_batch_join(sp, con, status_flags);
 	return 0;
 
  fail_clear:
@@ -134,6 +391,8 @@ void deactivate_watchdog(struct space *sp)
 	if (!com.use_watchdog)
 		return;
 
+	wd_batch_leave(sp);
+
 	log_space(sp, "wdmd_test_live 0 0 to disable");
 
 	rv = wdmd_test_live(sp->wd_fd, 0, 0);
@@ -158,6 +417,11 @@ void close_watchdog(struct space *sp)
 	if (!com.use_watchdog)
 		return;
 
+	if (sp->wd_shm) {
+		wdmd_shm_close(sp->wd_shm);
+		sp->wd_shm = NULL;
+	}
+
 	close(sp->wd_fd);
 }
 
@@ -21,3 +21,45 @@ def sanlock_daemon():
         # which takes about 3 seconds, slowing down the tests.
         p.kill()
         p.wait()
+
+
+@pytest.fixture
+def sanlock_daemon_other(tmpdir):
+    """
+    Run another sanlock daemon during a test, with its own run dir, e.g.
+    to join a lockspace as a second host.  Return the run dir to pass to
+    util.sanlock() for talking to it.
+    """
+    run_dir = str(tmpdir.mkdir("run_other"))
+    p = util.start_daemon(run_dir=run_dir)
+    try:
+        util.wait_for_daemon(0.5, run_dir=run_dir)
+        yield run_dir
+    finally:
+        p.kill()
+        p.wait()
+
+
+@pytest.fixture
+def sanlock_daemon_conf(tmpdir):
+    """
+    Return a function starting sanlock daemon with the given sanlock.conf
+    lines, running during a test, and returning the daemon process.
+    """
+    procs = []
+
+    def start(*lines):
+        conf = tmpdir.join("sanlock.conf")
+        conf.write("".join(line + "\n" for line in lines))
+        procs.append(util.start_daemon(conf=str(conf)))
+        util.wait_for_daemon(0.5)
+        return procs[-1]
+
+    try:
+        yield start
+    finally:
+        for p in procs:
+            # a test may have stopped the daemon to restart it
+            if p.poll() is None:
+                p.kill()
+                p.wait()
@@ -8,9 +8,31 @@ PAXOS_DISK_MAGIC = 0x06152010
 PAXOS_DISK_CLEAR = 0x11282016
 DELTA_DISK_MAGIC = 0x12212010
 
+LFL_HANDOFF = 0x00000002
+
+# src/sanlock_admin.h
+
+SANLK_HOST_EVENT_REQUEST = 0xFFFFFFFF52455155
+
 # src/rindex_disk.h
 
 RINDEX_DISK_MAGIC = 0x01042018
+RINDEX_DISK_VERSION_MAJOR = 0x00010000
+RINDEX_DISK_VERSION_MAJOR_V2 = 0x00020000
+RHF_HASHED = 0x00000100
+RXB_OVERFLOW = 0x00000001
+
+# src/sanlock_sock.h
+
+SM_MAGIC = 0x04282010
+SM_PROTO = 0x00000001
+SM_CMD_INQ_LOCKSPACE = 16
+SM_CMD_READ_RESOURCE_OWNERS = 24
+SM_CMD_PIPELINE = 45
+
+# src/sanlock_rv.h
+
+SANLK_RINDEX_VERSION = -275
 
 # src/rindex_disk.h
 # Copied from the docs module comment.
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+/*
+ * Check that every crc32c implementation this cpu supports gives the same
+ * result as the byte table for all lengths and alignments, then time each
+ * one over the buffer sizes sanlock checksums: leader and dblock records,
+ * a 4K sector, and a lockspace of 2000 512 byte leases.
+ *
+ * crc32c_bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc32c.h"
+
+#define BUF_LEN (2000 * 512)
+
+static uint8_t buf[BUF_LEN + 64];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int check_impl(struct crc32c_impl *ref, struct crc32c_impl *impl)
+{
+	uint32_t seed, a, b;
+	int off, len;
+
+	for (off = 0; off < 16; off++) {
+		for (len = 0; len <= 1024; len++) {
+			seed = (len & 1) ? (uint32_t)~1 : (uint32_t)len * 2654435761U;
+			a = ref->fn(seed, buf + off, len);
+			b = impl->fn(seed, buf + off, len);
+			if (a != b) {
+				printf("%s mismatch off %d len %d %08x %08x\n",
+				       impl->name, off, len, a, b);
+				return -1;
+			}
+		}
+	}
+
+	a = ref->fn((uint32_t)~1, buf, BUF_LEN);
+	b = impl->fn((uint32_t)~1, buf, BUF_LEN);
+	if (a != b) {
+		printf("%s mismatch len %d %08x %08x\n", impl->name, BUF_LEN, a, b);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void bench_impl(struct crc32c_impl *impl, int iterations)
+{
+	static const int sizes[] = { 72, 144, 4096, BUF_LEN };
+	uint64_t begin, ns, bytes;
+	uint32_t crc = 0;
+	int i, s, n;
+
+	printf("%-8s", impl->name);
+
+	for (s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+		/* the same number of bytes for each size */
+		n = iterations * (BUF_LEN / sizes[s]);
+		bytes = (uint64_t)n * sizes[s];
+
+		begin = now_ns();
+		for (i = 0; i < n; i++)
+			crc = impl->fn(crc, buf, sizes[s]);
+		ns = now_ns() - begin;
+
+		printf(" %8d: %7.2f MB/s", sizes[s],
+		       ns ? (double)bytes * 1000.0 / ns : 0.0);
+	}
+
+	printf("  (%08x)\n", crc);
+}
+
+int main(int argc, char *argv[])
+{
+	struct crc32c_impl *impls, *ref;
+	int i, count, iterations = 20;
+	int rv = 0;
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+
+	srandom(1);
+	for (i = 0; i < (int)sizeof(buf); i++)
+		buf[i] = random();
+
+	count = crc32c_get_impls(&impls);
+	ref = &impls[count - 1];
+
+	printf("crc32c uses %s\n", crc32c_name());
+
+	for (i = 0; i < count; i++) {
+		if (!impls[i].supported) {
+			printf("%-8s not supported\n", impls[i].name);
+			continue;
+		}
+		if (check_impl(ref, &impls[i]) < 0)
+			rv = 1;
+		else
+			printf("%-8s matches %s\n", impls[i].name, ref->name);
+	}
+
+	if (rv)
+		return rv;
+
+	for (i = 0; i < count; i++) {
+		if (impls[i].supported)
+			bench_impl(&impls[i], iterations);
+	}
+
+	return 0;
+}
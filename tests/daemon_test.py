@@ -3,8 +3,10 @@ Test sanlock client operations.
 """
 
 import io
+import re
 import signal
 import struct
+import time
 
 import pytest
 
@@ -76,13 +78,66 @@ def test_init_resource(tmpdir, sanlock_daemon):
     util.check_guard(str(path), size)
 
 
-def test_format(tmpdir, sanlock_daemon):
+def test_sim_disk(tmpdir, sanlock_daemon):
+    # A "sim:" path is kept in a file, and its i/o is delayed or failed as
+    # described by the parameter file next to it.
+    path = tmpdir.join("lockspace")
+    size = 1024**2
+    util.create_file(str(path), size)
+    params = tmpdir.join("lockspace.sim")
+    params.write("latency_us = 1000\n")
+
+    lockspace = "name:1:sim\\:%s:0" % path
+    util.sanlock("client", "init", "-s", lockspace)
+
+    with io.open(str(path), "rb") as f:
+        magic, = struct.unpack("< I", f.read(4))
+        assert magic == DELTA_DISK_MAGIC
+
+    util.check_guard(str(path), size)
+
+    params.write("error_pct = 100\n")
+    time.sleep(0.2)
+
+    with pytest.raises(util.CommandError):
+        util.sanlock("client", "init", "-s", lockspace)
+
+
+@pytest.mark.parametrize("option, fmt, magic", [
+    ("-s", "name:1:sim\\:%s:1M", DELTA_DISK_MAGIC),
+    ("-r", "name:res:sim\\:%s:1M", PAXOS_DISK_MAGIC),
+])
+def test_sim_disk_offset_suffix(tmpdir, sanlock_daemon, option, fmt, magic):
+    # The escaped colon of a "sim:" path does not end the path, even with
+    # an 'M' in it, and the offset can still use the 'M' suffix.
+    path = tmpdir.mkdir("Mdir").join("lease")
+    util.create_file(str(path), 2 * 1024**2)
+
+    util.sanlock("client", "init", option, fmt % path)
+
+    with io.open(str(path), "rb") as f:
+        f.seek(1024**2)
+        assert struct.unpack("< I", f.read(4))[0] == magic
+
+
+# Version 2 is the hashed rindex.
+RINDEX_VERSIONS = [
+    pytest.param(1, id="v1"),
+    pytest.param(2, id="v2"),
+]
+
+
+@pytest.mark.parametrize("version", RINDEX_VERSIONS)
+def test_format(tmpdir, sanlock_daemon, version):
     path = tmpdir.join("rindex")
     size = 1024**2 * 3
     util.create_file(str(path), size)
 
     rindex = "ls_name:%s:1M" % path
-    util.sanlock("client", "format", "-x", rindex)
+    util.sanlock("client", "format", "-x", rindex, "-X", str(version))
+
+    if version == 2:
+        util.check_hashed_rindex(str(path), 1024**2, {})
 
     with io.open(str(path), "rb") as f:
         # The first slot should contain the rindex header sector.
@@ -104,7 +159,8 @@ def test_format(tmpdir, sanlock_daemon):
     util.check_guard(str(path), size)
 
 
-def test_create(tmpdir, sanlock_daemon):
+@pytest.mark.parametrize("version", RINDEX_VERSIONS)
+def test_create(tmpdir, sanlock_daemon, version):
     path = tmpdir.join("rindex")
     # Slots: lockspace rindex master-lease user-lease-1
     size = 1024**2 * 4
@@ -115,21 +171,25 @@ def test_create(tmpdir, sanlock_daemon):
     util.sanlock("client", "init", "-s", lockspace, "-o", "1")
 
     rindex = "ls_name:%s:1M" % path
-    util.sanlock("client", "format", "-x", rindex)
+    util.sanlock("client", "format", "-x", rindex, "-X", str(version))
 
     util.sanlock("client", "add_lockspace", "-s", lockspace, "-o", "1")
     util.sanlock("client", "create", "-x", rindex, "-e", "res")
 
+    if version == 2:
+        util.check_hashed_rindex(str(path), 1024**2, {b"res": 1024**2 * 3})
+
     with io.open(str(path), "rb") as f:
-        # New entry should be created at the first slot
-        # The first rindex sector is used by the rindex header.
-        f.seek(1024**2 + 512)
-        util.check_rindex_entry(f.read(RINDEX_ENTRY_SIZE),
-                                b"res", 1024**2 * 3, 0)
+        if version == 1:
+            # New entry should be created at the first slot
+            # The first rindex sector is used by the rindex header.
+            f.seek(1024**2 + 512)
+            util.check_rindex_entry(f.read(RINDEX_ENTRY_SIZE),
+                                    b"res", 1024**2 * 3, 0)
 
-        # The rest of the entries should not be modified.
-        rest = 512 * RINDEX_ENTRIES_SECTORS - RINDEX_ENTRY_SIZE
-        assert f.read(rest) == b"\0" * rest
+            # The rest of the entries should not be modified.
+            rest = 512 * RINDEX_ENTRIES_SECTORS - RINDEX_ENTRY_SIZE
+            assert f.read(rest) == b"\0" * rest
 
         # The next slot should contain the internal lease.
         f.seek(1024**2 * 3)
@@ -139,7 +199,8 @@ def test_create(tmpdir, sanlock_daemon):
     util.check_guard(str(path), size)
 
 
-def test_delete(tmpdir, sanlock_daemon):
+@pytest.mark.parametrize("version", RINDEX_VERSIONS)
+def test_delete(tmpdir, sanlock_daemon, version):
     path = tmpdir.join("rindex")
     # Slots: lockspace rindex master-lease user-lease-1
     size = 1024**2 * 4
@@ -150,20 +211,24 @@ def test_delete(tmpdir, sanlock_daemon):
     util.sanlock("client", "init", "-s", lockspace, "-o", "1")
 
     rindex = "ls_name:%s:1M" % path
-    util.sanlock("client", "format", "-x", rindex)
+    util.sanlock("client", "format", "-x", rindex, "-X", str(version))
 
     util.sanlock("client", "add_lockspace", "-s", lockspace, "-o", "1")
     util.sanlock("client", "create", "-x", rindex, "-e", "res")
     util.sanlock("client", "delete", "-x", rindex, "-e", "res")
 
+    if version == 2:
+        util.check_hashed_rindex(str(path), 1024**2, {})
+
     with io.open(str(path), "rb") as f:
-        # First entry should be cleared.
-        f.seek(1024**2 + 512)
-        util.check_rindex_entry(f.read(RINDEX_ENTRY_SIZE), b"", 0, 0)
+        if version == 1:
+            # First entry should be cleared.
+            f.seek(1024**2 + 512)
+            util.check_rindex_entry(f.read(RINDEX_ENTRY_SIZE), b"", 0, 0)
 
-        # Rest of entires should not be modified.
-        rest = 512 * RINDEX_ENTRIES_SECTORS - RINDEX_ENTRY_SIZE
-        assert f.read(rest) == b"\0" * rest
+            # Rest of entires should not be modified.
+            rest = 512 * RINDEX_ENTRIES_SECTORS - RINDEX_ENTRY_SIZE
+            assert f.read(rest) == b"\0" * rest
 
         # The next slot should contain a cleared lease.
         f.seek(1024**2 * 3)
@@ -173,7 +238,83 @@ def test_delete(tmpdir, sanlock_daemon):
     util.check_guard(str(path), size)
 
 
-def test_lookup(tmpdir, sanlock_daemon):
+@pytest.mark.parametrize("version", RINDEX_VERSIONS)
+def test_create_delete_many(tmpdir, sanlock_daemon, version):
+    path = tmpdir.join("rindex")
+    # Slots: lockspace rindex master-lease user-lease-1 ... user-lease-3
+    size = 1024**2 * 6
+    util.create_file(str(path), size)
+
+    # Note: using 1 second io timeout (-o 1) for quicker tests.
+    lockspace = "ls_name:1:%s:0" % path
+    util.sanlock("client", "init", "-s", lockspace, "-o", "1")
+
+    rindex = "ls_name:%s:1M" % path
+    util.sanlock("client", "format", "-x", rindex, "-X", str(version))
+
+    util.sanlock("client", "add_lockspace", "-s", lockspace, "-o", "1")
+    create = util.sanlock("client", "create", "-x", rindex,
+                          "-e", "res1", "-e", "res2", "-e", "res3")
+
+    assert create == (
+        "create_resources done 0\n"
+        "name res1 offset 3145728\n"
+        "name res2 offset 4194304\n"
+        "name res3 offset 5242880\n")
+
+    if version == 2:
+        util.check_hashed_rindex(str(path), 1024**2, {
+            b"res1": 1024**2 * 3,
+            b"res2": 1024**2 * 4,
+            b"res3": 1024**2 * 5,
+        })
+
+    with io.open(str(path), "rb") as f:
+        if version == 1:
+            # New entries should be created in the first slots.
+            f.seek(1024**2 + 512)
+            util.check_rindex_entry(f.read(RINDEX_ENTRY_SIZE),
+                                    b"res1", 1024**2 * 3, 0)
+            util.check_rindex_entry(f.read(RINDEX_ENTRY_SIZE),
+                                    b"res2", 1024**2 * 4, 0)
+            util.check_rindex_entry(f.read(RINDEX_ENTRY_SIZE),
+                                    b"res3", 1024**2 * 5, 0)
+
+        for i in range(3, 6):
+            f.seek(1024**2 * i)
+            magic, = struct.unpack("< I", f.read(4))
+            assert magic == PAXOS_DISK_MAGIC
+
+    # Nothing is deleted if one of the entries is not found.
+    with pytest.raises(util.CommandError):
+        util.sanlock("client", "delete", "-x", rindex,
+                     "-e", "res1", "-e", "missing")
+
+    util.sanlock("client", "delete", "-x", rindex, "-e", "res3", "-e", "res1")
+
+    if version == 2:
+        util.check_hashed_rindex(str(path), 1024**2, {b"res2": 1024**2 * 4})
+
+    with io.open(str(path), "rb") as f:
+        if version == 1:
+            f.seek(1024**2 + 512)
+            util.check_rindex_entry(f.read(RINDEX_ENTRY_SIZE), b"", 0, 0)
+            util.check_rindex_entry(f.read(RINDEX_ENTRY_SIZE),
+                                    b"res2", 1024**2 * 4, 0)
+            util.check_rindex_entry(f.read(RINDEX_ENTRY_SIZE), b"", 0, 0)
+
+        for i, expected in ((3, PAXOS_DISK_CLEAR),
+                            (4, PAXOS_DISK_MAGIC),
+                            (5, PAXOS_DISK_CLEAR)):
+            f.seek(1024**2 * i)
+            magic, = struct.unpack("< I", f.read(4))
+            assert magic == expected
+
+    util.check_guard(str(path), size)
+
+
+@pytest.mark.parametrize("version", RINDEX_VERSIONS)
+def test_lookup(tmpdir, sanlock_daemon, version):
     path = tmpdir.join("rindex")
     # Slots: lockspace rindex master-lease user-lease-1 ... user-lease-7
     size = 1024**2 * 10
@@ -184,7 +325,7 @@ def test_lookup(tmpdir, sanlock_daemon):
     util.sanlock("client", "init", "-s", lockspace, "-o", "1")
 
     rindex = "ls_name:%s:1M" % path
-    util.sanlock("client", "format", "-x", rindex)
+    util.sanlock("client", "format", "-x", rindex, "-X", str(version))
 
     util.sanlock("client", "add_lockspace", "-s", lockspace, "-o", "1")
     util.sanlock("client", "create", "-x", rindex, "-e", "res")
@@ -193,6 +334,55 @@ def test_lookup(tmpdir, sanlock_daemon):
     assert lookup == "lookup done 0\nname res offset 3145728\n"
 
 
+def test_lookup_cache(tmpdir, sanlock_daemon, sanlock_daemon_other):
+    # The cache is used for an unhashed rindex, a hashed one reads only
+    # the bucket sector for a lookup.
+    path = tmpdir.join("rindex")
+    # Slots: lockspace rindex master-lease user-lease-1 ... user-lease-7
+    size = 1024**2 * 10
+    util.create_file(str(path), size)
+
+    lockspace = "ls_name:1:%s:0" % path
+    util.sanlock("client", "init", "-s", lockspace, "-o", "1")
+
+    rindex = "ls_name:%s:1M" % path
+    util.sanlock("client", "format", "-x", rindex)
+
+    util.sanlock("client", "add_lockspace", "-s", lockspace, "-o", "1")
+    run_dir = sanlock_daemon_other
+    util.sanlock("client", "add_lockspace", "-s", "ls_name:2:%s:0" % path,
+                 "-o", "1", run_dir=run_dir)
+
+    util.sanlock("client", "create", "-x", rindex, "-e", "res1")
+    util.sanlock("client", "lookup", "-x", rindex, "-e", "res1")
+
+    # While the rindex lease is unchanged, a lookup reads only its leader
+    # and searches the cached rindex.
+    before = util.io_stats()
+    for i in range(5):
+        lookup = util.sanlock("client", "lookup", "-x", rindex, "-e", "res1")
+        assert lookup == "lookup done 0\nname res1 offset 3145728\n"
+    after = util.io_stats()
+
+    key = str(path)
+    assert after[(key, "other_read")] == before[(key, "other_read")]
+    assert after[(key, "leader_read")] == before[(key, "leader_read")] + 5
+
+    # Changes made by another host under the rindex lease are seen.
+    util.sanlock("client", "create", "-x", rindex, "-e", "res2",
+                 run_dir=run_dir)
+    util.sanlock("client", "delete", "-x", rindex, "-e", "res1",
+                 run_dir=run_dir)
+
+    lookup = util.sanlock("client", "lookup", "-x", rindex, "-e", "res2")
+    assert lookup == "lookup done 0\nname res2 offset 4194304\n"
+    assert util.io_stats()[(key, "other_read")] > after[(key, "other_read")]
+
+    with pytest.raises(util.CommandError) as e:
+        util.sanlock("client", "lookup", "-x", rindex, "-e", "res1")
+    assert e.value.stdout == "lookup done -2\n"
+
+
 def test_lookup_uninitialized(tmpdir, sanlock_daemon):
     path = tmpdir.join("rindex")
     util.create_file(str(path), 1024**2)
@@ -206,7 +396,8 @@ def test_lookup_uninitialized(tmpdir, sanlock_daemon):
     assert e.value.stderr == ""
 
 
-def test_lookup_missing(tmpdir, sanlock_daemon):
+@pytest.mark.parametrize("version", RINDEX_VERSIONS)
+def test_lookup_missing(tmpdir, sanlock_daemon, version):
     path = tmpdir.join("rindex")
     # Slots: lockspace rindex master-lease user-lease-1 ... user-lease-7
     size = 1024**2 * 10
@@ -217,7 +408,7 @@ def test_lookup_missing(tmpdir, sanlock_daemon):
     util.sanlock("client", "init", "-s", lockspace, "-o", "1")
 
     rindex = "ls_name:%s:1M" % path
-    util.sanlock("client", "format", "-x", rindex)
+    util.sanlock("client", "format", "-x", rindex, "-X", str(version))
 
     util.sanlock("client", "add_lockspace", "-s", lockspace, "-o", "1")
     with pytest.raises(util.CommandError) as e:
@@ -226,3 +417,383 @@ def test_lookup_missing(tmpdir, sanlock_daemon):
     assert e.value.returncode == 1
     assert e.value.stdout == "lookup done -2\n"
     assert e.value.stderr == ""
+
+
+def hashed_names(bucket, buckets, count):
+    """
+    Return count resource names that hash to bucket.
+    """
+    names = []
+    i = 0
+    while len(names) < count:
+        name = b"res%d" % i
+        if util.name_hash(name) % buckets == bucket:
+            names.append(name)
+        i += 1
+    return names
+
+
+def test_hashed_overflow(tmpdir, sanlock_daemon):
+    path = tmpdir.join("rindex")
+    # Slots: lockspace rindex master-lease user-lease-1 ... user-lease-9
+    size = 1024**2 * 12
+    util.create_file(str(path), size)
+
+    # Note: using 1 second io timeout (-o 1) for quicker tests.
+    lockspace = "ls_name:1:%s:0" % path
+    util.sanlock("client", "init", "-s", lockspace, "-o", "1")
+
+    rindex = "ls_name:%s:1M" % path
+    util.sanlock("client", "format", "-x", rindex, "-X", "2")
+    util.sanlock("client", "add_lockspace", "-s", lockspace, "-o", "1")
+
+    # One more name than fits in the last bucket, so the last one wraps
+    # around to the first bucket.
+    buckets = util.read_rindex_header(str(path), 1024**2)["buckets"]
+    per_bucket = 512 // RINDEX_ENTRY_SIZE - 1
+    names = hashed_names(buckets - 1, buckets, per_bucket + 2)
+    last = names[per_bucket]
+    spare = names[per_bucket + 1]
+
+    args = []
+    for name in names[:per_bucket + 1]:
+        args.extend(("-e", name.decode()))
+    util.sanlock("client", "create", "-x", rindex, *args)
+
+    entries = {name: 1024**2 * (3 + i)
+               for i, name in enumerate(names[:per_bucket + 1])}
+    found, flags = util.check_hashed_rindex(str(path), 1024**2, entries)
+    assert found[last] == (0, 1)
+    assert flags[buckets - 1] & RXB_OVERFLOW
+    assert not flags[0] & RXB_OVERFLOW
+
+    # The lookup continues past the overflowed bucket, also once it is no
+    # longer full.
+    lookup = util.sanlock("client", "lookup", "-x", rindex, "-e", last.decode())
+    assert lookup == "lookup done 0\nname %s offset %d\n" % (
+        last.decode(), entries[last])
+
+    util.sanlock("client", "delete", "-x", rindex, "-e", names[0].decode())
+    del entries[names[0]]
+    found, flags = util.check_hashed_rindex(str(path), 1024**2, entries)
+    assert flags[buckets - 1] & RXB_OVERFLOW
+
+    lookup = util.sanlock("client", "lookup", "-x", rindex, "-e", last.decode())
+    assert lookup == "lookup done 0\nname %s offset %d\n" % (
+        last.decode(), entries[last])
+
+    # A new name for the bucket takes the free slot, and the first lease.
+    util.sanlock("client", "create", "-x", rindex, "-e", spare.decode())
+    entries[spare] = 1024**2 * 3
+    found, _ = util.check_hashed_rindex(str(path), 1024**2, entries)
+    assert found[spare] == (buckets - 1, 1)
+
+    util.sanlock("client", "delete", "-x", rindex, "-e", last.decode())
+    del entries[last]
+    util.check_hashed_rindex(str(path), 1024**2, entries)
+
+    with pytest.raises(util.CommandError) as e:
+        util.sanlock("client", "lookup", "-x", rindex, "-e", last.decode())
+    assert e.value.stdout == "lookup done -2\n"
+
+    util.check_guard(str(path), size)
+
+
+def test_convert(tmpdir, sanlock_daemon):
+    path = tmpdir.join("rindex")
+    # Slots: lockspace rindex master-lease user-lease-1 ... user-lease-4
+    size = 1024**2 * 7
+    util.create_file(str(path), size)
+
+    # Note: using 1 second io timeout (-o 1) for quicker tests.
+    lockspace = "ls_name:1:%s:0" % path
+    util.sanlock("client", "init", "-s", lockspace, "-o", "1")
+
+    rindex = "ls_name:%s:1M" % path
+    util.sanlock("client", "format", "-x", rindex, "-X", "1")
+    util.sanlock("client", "add_lockspace", "-s", lockspace, "-o", "1")
+    util.sanlock("client", "create", "-x", rindex,
+                 "-e", "res1", "-e", "res2", "-e", "res3")
+    util.sanlock("client", "delete", "-x", rindex, "-e", "res2")
+
+    entries = {b"res1": 1024**2 * 3, b"res3": 1024**2 * 5}
+
+    def check_lookup():
+        for name, offset in entries.items():
+            lookup = util.sanlock("client", "lookup", "-x", rindex,
+                                  "-e", name.decode())
+            assert lookup == "lookup done 0\nname %s offset %d\n" % (
+                name.decode(), offset)
+
+    # The entries keep their resource leases through both conversions.
+    util.sanlock("direct", "convert", "-x", rindex, "-X", "2")
+    util.check_hashed_rindex(str(path), 1024**2, entries)
+    check_lookup()
+
+    util.sanlock("direct", "convert", "-x", rindex, "-X", "1")
+    header = util.read_rindex_header(str(path), 1024**2)
+    assert header["version"] & 0xffff0000 == RINDEX_DISK_VERSION_MAJOR
+    assert not header["flags"] & RHF_HASHED
+    check_lookup()
+
+    with io.open(str(path), "rb") as f:
+        # The entries are back in the slots of their leases.
+        f.seek(1024**2 + 512)
+        util.check_rindex_entry(f.read(RINDEX_ENTRY_SIZE),
+                                b"res1", 1024**2 * 3, 0)
+        util.check_rindex_entry(f.read(RINDEX_ENTRY_SIZE), b"", 0, 0)
+        util.check_rindex_entry(f.read(RINDEX_ENTRY_SIZE),
+                                b"res3", 1024**2 * 5, 0)
+        rest = 512 * RINDEX_ENTRIES_SECTORS - 3 * RINDEX_ENTRY_SIZE
+        assert f.read(rest) == b"\0" * rest
+
+    # The free lease is used again.
+    create = util.sanlock("client", "create", "-x", rindex, "-e", "res4")
+    assert create == "create_resource done 0\noffset %d\n" % (1024**2 * 4)
+
+    util.check_guard(str(path), size)
+
+
+def test_hashed_version(tmpdir, sanlock_daemon):
+    path = tmpdir.join("rindex")
+    size = 1024**2 * 3
+    util.create_file(str(path), size)
+
+    rindex = "ls_name:%s:1M" % path
+    util.sanlock("client", "format", "-x", rindex, "-X", "2")
+
+    # sanlock versions without the hashed rindex only accept major version
+    # 1 (see rindex_header_check), so they reject the hashed rindex.
+    header = util.read_rindex_header(str(path), 1024**2)
+    assert header["version"] & 0xffff0000 == RINDEX_DISK_VERSION_MAJOR_V2
+
+    def set_header(version, flags):
+        with io.open(str(path), "r+b") as f:
+            f.seek(1024**2 + 4)
+            f.write(struct.pack("< L L", version, flags))
+
+    def check_rejected():
+        with pytest.raises(util.CommandError) as e:
+            util.sanlock("direct", "lookup", "-x", rindex, "-e", "res")
+        assert e.value.stdout == "lookup done %d\n" % SANLK_RINDEX_VERSION
+
+    # The same check rejects a major version this sanlock doesn't know,
+    # and a version 2 header that is not hashed.
+    set_header(0x00030000, header["flags"])
+    check_rejected()
+
+    set_header(header["version"], header["flags"] & ~RHF_HASHED)
+    check_rejected()
+
+    set_header(header["version"], header["flags"])
+    with pytest.raises(util.CommandError) as e:
+        util.sanlock("direct", "lookup", "-x", rindex, "-e", "res")
+    assert e.value.stdout == "lookup done -2\n"
+
+
+def test_add_rem_lockspaces(tmpdir, sanlock_daemon):
+    lockspaces = []
+    for name in ("ls1", "ls2", "ls3"):
+        path = tmpdir.join(name)
+        util.create_file(str(path), 1024**2)
+        # Note: using 1 second io timeout (-o 1) for quicker tests.
+        lockspace = "%s:1:%s:0" % (name, path)
+        util.sanlock("client", "init", "-s", lockspace, "-o", "1")
+        lockspaces.extend(("-s", lockspace))
+
+    add = util.sanlock("client", "add_lockspace", "-o", "1", *lockspaces)
+
+    assert add == (
+        "add_lockspaces 3\n"
+        "add_lockspaces done 0\n"
+        "ls1 0\n"
+        "ls2 0\n"
+        "ls3 0\n")
+
+    # The lockspaces that exist fail with -EEXIST, the others are added.
+    path = tmpdir.join("ls4")
+    util.create_file(str(path), 1024**2)
+    lockspace = "ls4:1:%s:0" % path
+    util.sanlock("client", "init", "-s", lockspace, "-o", "1")
+
+    with pytest.raises(util.CommandError) as e:
+        util.sanlock("client", "add_lockspace", "-o", "1",
+                     "-s", lockspaces[1], "-s", lockspace)
+
+    assert e.value.stdout == (
+        "add_lockspaces 2\n"
+        "add_lockspaces done 0\n"
+        "ls1 -17\n"
+        "ls4 0\n")
+
+    lockspaces.extend(("-s", lockspace))
+    rem = util.sanlock("client", "rem_lockspace", *lockspaces)
+
+    assert rem == (
+        "rem_lockspaces 4\n"
+        "rem_lockspaces done 0\n"
+        "ls1 0\n"
+        "ls2 0\n"
+        "ls3 0\n"
+        "ls4 0\n")
+
+
+def test_pipeline(tmpdir, sanlock_daemon):
+    ls_path = str(tmpdir.join("ls"))
+    util.create_file(ls_path, 1024**2)
+    lockspace = "ls:1:%s:0" % ls_path
+    util.sanlock("client", "init", "-s", lockspace, "-o", "1")
+    util.sanlock("client", "add_lockspace", "-s", lockspace, "-o", "1")
+
+    fast_path = str(tmpdir.join("fast"))
+    util.create_file(fast_path, 1024**2)
+    util.sanlock("client", "init", "-r", "ls:fast:%s:0" % fast_path)
+
+    slow_path = str(tmpdir.join("slow"))
+    util.create_file(slow_path, 1024**2)
+    util.sanlock("client", "init", "-r", "ls:slow:sim\\:%s:0" % slow_path)
+    tmpdir.join("slow.sim").write("stall_pct = 100\nstall_ms = 2000\n")
+    # The sim disk rereads its params every 100 milliseconds.
+    time.sleep(0.5)
+
+    s = util.pipeline_open()
+    try:
+        start = time.time()
+        # Two slow requests run concurrently, and the fast ones queued
+        # behind them on the connection are not held up.
+        for seq in (1, 2):
+            util.pipeline_send(
+                s, SM_CMD_READ_RESOURCE_OWNERS, seq,
+                util.pack_resource("ls", "slow", "sim:" + slow_path))
+        util.pipeline_send(
+            s, SM_CMD_INQ_LOCKSPACE, 3,
+            util.pack_lockspace("ls", 1, ls_path))
+        util.pipeline_send(
+            s, SM_CMD_READ_RESOURCE_OWNERS, 4,
+            util.pack_resource("ls", "fast", fast_path))
+
+        replies = {}
+        order = []
+        while len(replies) < 4:
+            seq, result, data2, body = util.pipeline_recv(s)
+            order.append(seq)
+            replies[seq] = (result, data2, body)
+        elapsed = time.time() - start
+    finally:
+        s.close()
+
+    # Replies are sent as each request completes, not in order.
+    assert sorted(order[:2]) == [3, 4]
+    assert sorted(order[2:]) == [1, 2]
+    assert elapsed < 4
+
+    assert replies[3][0] == 0
+    for seq in (1, 2, 4):
+        result, data2, body = replies[seq]
+        assert result == 0
+        # No owners, the reply is the resource with no hosts.
+        assert data2 == 0
+        assert len(body) == util.SANLK_RESOURCE.size
+
+
+def test_worker_growth(tmpdir, sanlock_daemon_conf):
+    sanlock_daemon_conf("metrics = 1")
+
+    # Each lockspace allows two more workers than the default 8.
+    lockspaces = []
+    for i in range(6):
+        path = str(tmpdir.join("ls%d" % i))
+        util.create_file(path, 1024**2)
+        lockspace = "ls%d:1:%s:0" % (i, path)
+        util.sanlock("client", "init", "-s", lockspace, "-o", "1")
+        lockspaces.extend(("-s", lockspace))
+    util.sanlock("client", "add_lockspace", "-o", "1", *lockspaces)
+
+    slow_path = str(tmpdir.join("slow"))
+    util.create_file(slow_path, 1024**2)
+    util.sanlock("client", "init", "-r", "ls0:slow:sim\\:%s:0" % slow_path)
+    tmpdir.join("slow.sim").write("stall_pct = 100\nstall_ms = 2000\n")
+    time.sleep(0.5)
+
+    # Twelve reads stalled together need more workers than the default
+    # 8, or the last ones wait for a second stall.
+    count = 12
+    s = util.pipeline_open()
+    try:
+        start = time.time()
+        for seq in range(1, count + 1):
+            util.pipeline_send(
+                s, SM_CMD_READ_RESOURCE_OWNERS, seq,
+                util.pack_resource("ls0", "slow", "sim:" + slow_path))
+        results = {}
+        while len(results) < count:
+            seq, result, _, _ = util.pipeline_recv(s)
+            results[seq] = result
+        elapsed = time.time() - start
+    finally:
+        s.close()
+
+    assert results == {seq: 0 for seq in range(1, count + 1)}
+    assert elapsed < 3.5
+
+    metrics = util.metrics()
+    assert metrics["sanlock_thread_pool_workers"] >= count
+    assert metrics["sanlock_thread_pool_queue_depth"] == 0
+    assert metrics["sanlock_thread_pool_busy_total"] == 0
+
+
+# See src/log.c format_log_rec()
+LOG_LINE = re.compile(r"^\d{4}-\d\d-\d\d \d\d:\d\d:\d\d (\d+) \[(\d+)\]: (.*)$")
+
+
+def test_log_dump_threads(tmpdir, sanlock_daemon):
+    ls_path = str(tmpdir.join("ls"))
+    util.create_file(ls_path, 1024**2)
+    lockspace = "ls:1:%s:0" % ls_path
+    util.sanlock("client", "init", "-s", lockspace, "-o", "1")
+    util.sanlock("client", "add_lockspace", "-s", lockspace, "-o", "1")
+
+    res_path = str(tmpdir.join("res"))
+    util.create_file(res_path, 1024**2)
+    util.sanlock("client", "init", "-r", "ls:res:%s:0" % res_path)
+
+    # Keep the workers logging at the same time.
+    count = 50
+    s = util.pipeline_open()
+    try:
+        for seq in range(1, count + 1):
+            util.pipeline_send(s, SM_CMD_READ_RESOURCE_OWNERS, seq,
+                               util.pack_resource("ls", "res", res_path))
+        for seq in range(count):
+            util.pipeline_recv(s)
+    finally:
+        s.close()
+
+    # The records logged by each thread into its own ring are merged
+    # whole, and each thread's records keep their order.
+    running = {}
+    tids = set()
+    reads = 0
+    last_mono = 0
+    for line in util.log_dump().splitlines():
+        m = LOG_LINE.match(line)
+        assert m, line
+        mono, tid, msg = int(m.group(1)), m.group(2), m.group(3)
+        tids.add(tid)
+        # Records are merged in the order they were logged, and a thread
+        # may read the time just before another one that logs first.
+        assert mono >= last_mono - 1
+        last_mono = max(mono, last_mono)
+        if not msg.startswith("cmd_read_resource_owners"):
+            continue
+        if msg.endswith(" done 0"):
+            assert running.pop(tid) == res_path
+        else:
+            assert tid not in running
+            running[tid] = msg.split()[2].rsplit(":", 1)[0]
+            reads += 1
+
+    assert reads == count
+    assert not running
+    # The main loop, the lockspace thread and at least two workers.
+    assert len(tids) >= 4
@@ -4,7 +4,9 @@ Test sanlock python binding with sanlock daemon.
 
 import errno
 import io
+import os
 import struct
+import subprocess
 import time
 
 import pytest
@@ -181,6 +183,69 @@ def test_add_rem_lockspace_async(tmpdir, sanlock_daemon):
     assert acquired is False
 
 
+def test_get_stats(tmpdir, sanlock_daemon):
+    path = str(tmpdir.join("ls_name"))
+    util.create_file(path, LOCKSPACE_SIZE)
+
+    sanlock.write_lockspace("ls_name", path, iotimeout=1)
+    sanlock.add_lockspace("ls_name", 1, path, iotimeout=1)
+
+    stats = {st["op"]: st for st in sanlock.get_stats()
+             if st["path"] == path}
+
+    # Adding the lockspace reads and writes our delta lease.
+    for op in (sanlock.IO_DELTA_READ, sanlock.IO_DELTA_WRITE):
+        st = stats[op]
+        assert st["count"] > 0
+        assert st["errors"] == 0
+        assert st["p50_us"] <= st["p99_us"] <= st["p999_us"] <= st["max_us"]
+
+    sanlock.rem_lockspace("ls_name", 1, path)
+
+
+def test_get_state(tmpdir, sanlock_daemon):
+    ls_path = str(tmpdir.join("ls_name"))
+    util.create_file(ls_path, LOCKSPACE_SIZE)
+
+    res_path = str(tmpdir.join("res_name"))
+    util.create_file(res_path, MIN_RES_SIZE)
+
+    sanlock.write_lockspace("ls_name", ls_path, iotimeout=1)
+    sanlock.add_lockspace("ls_name", 1, ls_path, iotimeout=1)
+
+    disks = [(res_path, 0)]
+    sanlock.write_resource("ls_name", "res_name", disks)
+
+    fd = sanlock.register()
+    sanlock.acquire("ls_name", "res_name", disks, slkfd=fd)
+
+    # The snapshot is updated by the daemon shortly after the acquire.
+    time.sleep(1)
+    state = sanlock.get_state()
+
+    ls = state["lockspaces"][0]
+    assert ls["lockspace"] == "ls_name"
+    assert ls["host_id"] == 1
+    assert ls["path"] == ls_path
+    assert ls["hosts"][0]["host_id"] == 1
+    assert ls["hosts"][0]["flags"] == sanlock.HOST_LIVE
+
+    assert state["resources"] == [{
+        "lockspace": "ls_name",
+        "resource": "res_name",
+        "version": 1,
+        "pid": os.getpid(),
+        "shared": False,
+    }]
+
+    sanlock.release("ls_name", "res_name", disks, slkfd=fd)
+
+    time.sleep(1)
+    assert sanlock.get_state()["resources"] == []
+
+    sanlock.rem_lockspace("ls_name", 1, ls_path)
+
+
 @pytest.mark.parametrize("size,offset", [
     # Smallest offset.
     (MIN_RES_SIZE, 0),
@@ -197,13 +262,17 @@ def test_acquire_release_resource(tmpdir, sanlock_daemon, size, offset):
     sanlock.write_lockspace("ls_name", ls_path, offset=offset, iotimeout=1)
     sanlock.add_lockspace("ls_name", 1, ls_path, offset=offset, iotimeout=1)
 
-    # Host status is not available until the first renewal.
-    with pytest.raises(sanlock.SanlockException) as e:
-        sanlock.get_hosts("ls_name", 1)
-    assert e.value.errno == errno.EAGAIN
-
-    time.sleep(1)
-    host = sanlock.get_hosts("ls_name", 1)[0]
+    # Host status is not available until main_loop first checks the
+    # lockspace, which it is woken to do when the lockspace is added.
+    deadline = time.time() + 0.5
+    while True:
+        try:
+            host = sanlock.get_hosts("ls_name", 1)[0]
+            break
+        except sanlock.SanlockException as e:
+            assert e.errno == errno.EAGAIN
+            assert time.time() < deadline
+            time.sleep(0.05)
     assert host["flags"] == sanlock.HOST_LIVE
 
     disks = [(res_path, offset)]
@@ -254,6 +323,159 @@ def test_acquire_release_resource(tmpdir, sanlock_daemon, size, offset):
     assert owners == []
 
 
+def unpack_records(fmt, buf):
+    # struct.iter_unpack is not available on python 2.
+    size = struct.calcsize(fmt)
+    return [struct.unpack_from(fmt, buf, off)
+            for off in range(0, len(buf), size)]
+
+
+def test_bulk_hosts_and_owners(tmpdir, sanlock_daemon):
+    ls_path = str(tmpdir.join("ls_name"))
+    util.create_file(ls_path, LOCKSPACE_SIZE)
+
+    res_path = str(tmpdir.join("res_name"))
+    util.create_file(res_path, MIN_RES_SIZE * 2)
+
+    sanlock.write_lockspace("ls_name", ls_path, iotimeout=1)
+    sanlock.add_lockspace("ls_name", 1, ls_path, iotimeout=1)
+
+    disks1 = [(res_path, 0)]
+    disks2 = [(res_path, MIN_RES_SIZE)]
+    sanlock.write_resource("ls_name", "res1", disks1)
+    sanlock.write_resource("ls_name", "res2", disks2)
+
+    # Host status is not available until the first renewal.
+    time.sleep(1)
+
+    records, counts = sanlock.get_hosts_bulk(["ls_name", "no_such_ls"])
+    counts = [c for c, in unpack_records(sanlock.HOST_COUNT_FORMAT, counts)]
+    assert counts == [1, -errno.ENOENT]
+
+    keys = ("host_id", "generation", "timestamp", "io_timeout", "flags")
+    hosts = [dict(zip(keys, r)) for r in
+             unpack_records(sanlock.HOST_RECORD_FORMAT, records)]
+    assert hosts[0]["host_id"] == 1
+    assert hosts[0]["flags"] == sanlock.HOST_LIVE
+
+    fd = sanlock.register()
+    sanlock.acquire("ls_name", "res2", disks2, slkfd=fd)
+
+    resources = [
+        ("ls_name", "res1", disks1),
+        ("ls_name", "res2", disks2),
+        ("ls_name", "res3", [(str(tmpdir.join("no_such_file")), 0)]),
+    ]
+    records, counts = sanlock.read_resource_owners_bulk(resources)
+    counts = [c for c, in unpack_records(sanlock.HOST_COUNT_FORMAT, counts)]
+    assert counts[:2] == [0, 1]
+    assert counts[2] < 0
+
+    owners = [dict(zip(keys, r)) for r in
+              unpack_records(sanlock.HOST_RECORD_FORMAT, records)]
+    assert owners == sanlock.read_resource_owners("ls_name", "res2", disks2)
+
+    sanlock.release("ls_name", "res2", disks2, slkfd=fd)
+
+
+def test_resource_object(tmpdir, sanlock_daemon):
+    ls_path = str(tmpdir.join("ls_name"))
+    util.create_file(ls_path, LOCKSPACE_SIZE)
+
+    res_path = str(tmpdir.join("res_name"))
+    util.create_file(res_path, MIN_RES_SIZE)
+
+    sanlock.write_lockspace("ls_name", ls_path, iotimeout=1)
+    sanlock.add_lockspace("ls_name", 1, ls_path, iotimeout=1)
+
+    disks = [(res_path, 0)]
+    sanlock.write_resource("ls_name", "res_name", disks)
+
+    res = sanlock.Resource("ls_name", "res_name", disks)
+    assert res.lockspace == "ls_name"
+    assert res.resource == "res_name"
+    assert res.disks == disks
+    assert not res.shared
+
+    with pytest.raises(ValueError):
+        sanlock.Resource("ls_name", "x" * 49, disks)
+
+    fd = sanlock.register()
+    res.acquire(slkfd=fd)
+    assert sanlock.read_resource(res_path)["version"] == 1
+    res.release(slkfd=fd)
+
+    # The version is only used by this acquire, not kept in res.
+    res.acquire(slkfd=fd, version=1)
+    res.release(slkfd=fd)
+
+    with pytest.raises(sanlock.SanlockException):
+        res.acquire(slkfd=fd, version=1)
+
+    res.acquire(slkfd=fd)
+    owner = sanlock.read_resource_owners("ls_name", "res_name", disks)[0]
+    assert owner["host_id"] == 1
+    res.release(slkfd=fd)
+
+
+def test_aio_acquire_release_resource(tmpdir, sanlock_daemon):
+    # sanlock_aio uses asyncio and is installed only for python 3.
+    asyncio = pytest.importorskip("asyncio")
+    sanlock_aio = pytest.importorskip("sanlock_aio")
+
+    ls_path = str(tmpdir.join("ls_name"))
+    util.create_file(ls_path, LOCKSPACE_SIZE)
+
+    res_path = str(tmpdir.join("res_name"))
+    util.create_file(res_path, MIN_RES_SIZE * 2)
+
+    sanlock.write_lockspace("ls_name", ls_path, iotimeout=1)
+
+    disks1 = [(res_path, 0)]
+    disks2 = [(res_path, MIN_RES_SIZE)]
+    sanlock.write_resource("ls_name", "res1", disks1)
+    sanlock.write_resource("ls_name", "res2", disks2)
+
+    loop = asyncio.new_event_loop()
+    pipeline = sanlock_aio.Pipeline(loop=loop)
+    client = sanlock_aio.Client(loop=loop)
+
+    try:
+        loop.run_until_complete(pipeline.add_lockspace(
+            "ls_name", 1, ls_path, iotimeout=1, interval=0.1))
+        inq = pipeline.inq_lockspace("ls_name", 1, ls_path)
+        assert loop.run_until_complete(inq) is True
+
+        # Both acquires are outstanding at once.
+        versions = loop.run_until_complete(asyncio.gather(
+            client.acquire("ls_name", "res1", disks1),
+            client.acquire("ls_name", "res2", disks2, shared=True)))
+        assert versions == [[1], [0]]
+
+        owners = sanlock.read_resource_owners("ls_name", "res1", disks1)
+        assert owners[0]["host_id"] == 1
+
+        with pytest.raises(sanlock.SanlockException) as e:
+            loop.run_until_complete(client.acquire("ls_name", "res1", disks1))
+        assert e.value.errno == errno.EEXIST
+
+        loop.run_until_complete(asyncio.gather(
+            client.release("ls_name", "res1", disks1),
+            client.release("ls_name", "res2", disks2)))
+
+        owners = sanlock.read_resource_owners("ls_name", "res1", disks1)
+        assert owners == []
+
+        loop.run_until_complete(pipeline.rem_lockspace(
+            "ls_name", 1, ls_path, interval=0.1))
+        inq = pipeline.inq_lockspace("ls_name", 1, ls_path)
+        assert loop.run_until_complete(inq) is False
+    finally:
+        client.close()
+        pipeline.close()
+        loop.close()
+
+
 @pytest.mark.parametrize("align, sector", [
     # Invalid alignment
     (1024, sanlock.SECTOR_SIZE[0]),
@@ -284,3 +506,724 @@ def test_write_resource_invalid_align_sector(
     with pytest.raises(ValueError):
         sanlock.write_resource(
             "ls_name", "res_name", disks, align=align, sector=sector)
+
+
+@pytest.mark.parametrize("lvb", [4096, 8192, 16384])
+def test_write_resource_lvb(tmpdir, sanlock_daemon, lvb):
+    path = str(tmpdir.join("resources"))
+    util.create_file(path, MIN_RES_SIZE)
+    disks = [(path, 0)]
+
+    sanlock.write_resource("ls_name", "res_name", disks, lvb=lvb)
+
+    res = sanlock.read_resource(path)
+    assert res == {
+        "lockspace": "ls_name",
+        "resource": "res_name",
+        "version": 0
+    }
+
+
+def test_write_resource_invalid_lvb(tmpdir, sanlock_daemon):
+    path = str(tmpdir.join("resources"))
+    util.create_file(path, MIN_RES_SIZE)
+    disks = [(path, 0)]
+
+    with pytest.raises(ValueError):
+        sanlock.write_resource("ls_name", "res_name", disks, lvb=1000)
+
+
+# The mbal of the first ballot of host_id 1 on a new lease, and of the next
+# full ballot, which uses the next multiple of max_hosts.
+FIRST_MBAL = 1
+NEXT_MBAL = 2000 + 1
+
+
+def setup_ex_lease(tmpdir):
+    ls_path = str(tmpdir.join("ls_name"))
+    util.create_file(ls_path, LOCKSPACE_SIZE)
+
+    res_path = str(tmpdir.join("res_name"))
+    util.create_file(res_path, MIN_RES_SIZE)
+
+    sanlock.write_lockspace("ls_name", ls_path, iotimeout=1)
+    sanlock.add_lockspace("ls_name", 1, ls_path, iotimeout=1)
+
+    disks = [(res_path, 0)]
+    sanlock.write_resource("ls_name", "res_name", disks)
+    return ls_path, res_path, disks
+
+
+def acquire_release(disks, shared=False):
+    fd = sanlock.register()
+    sanlock.acquire("ls_name", "res_name", disks, slkfd=fd, shared=shared)
+    sanlock.release("ls_name", "res_name", disks, slkfd=fd)
+    os.close(fd)
+
+
+@pytest.mark.parametrize("conf, mbal", [
+    # The fast ballot is off by default.
+    ([], NEXT_MBAL),
+    (["paxos_fast_ballot = 0"], NEXT_MBAL),
+    # The last owner reuses its mbal and skips phase 1.
+    (["paxos_fast_ballot = 1"], FIRST_MBAL),
+])
+def test_fast_ballot(tmpdir, sanlock_daemon_conf, conf, mbal):
+    sanlock_daemon_conf(*conf)
+    _, res_path, disks = setup_ex_lease(tmpdir)
+
+    acquire_release(disks)
+    assert util.read_dblock(res_path, 1)["mbal"] == FIRST_MBAL
+
+    acquire_release(disks)
+    dblock = util.read_dblock(res_path, 1)
+    assert dblock["mbal"] == mbal
+    assert dblock["bal"] == mbal
+    assert dblock["lver"] == 2
+    assert dblock["inp"] == 1
+
+    assert sanlock.read_resource(res_path)["version"] == 2
+
+
+def test_fast_ballot_abort(tmpdir, sanlock_daemon_conf):
+    sanlock_daemon_conf("paxos_fast_ballot = 1")
+    _, res_path, disks = setup_ex_lease(tmpdir)
+
+    acquire_release(disks)
+
+    # Host 2 has started phase 1 for the next lver with an mbal that is not
+    # larger than ours.  The fast ballot cannot tell what host 2 may have
+    # chosen, so it must abort and run a full ballot.
+    util.write_dblock(res_path, 2, mbal=FIRST_MBAL, lver=2)
+
+    acquire_release(disks)
+    dblock = util.read_dblock(res_path, 1)
+    assert dblock["mbal"] == NEXT_MBAL
+    assert dblock["lver"] == 2
+
+    assert sanlock.read_resource(res_path)["version"] == 2
+
+
+def test_fast_ballot_abort_other_inp(tmpdir, sanlock_daemon_conf):
+    sanlock_daemon_conf("paxos_fast_ballot = 1")
+    _, res_path, disks = setup_ex_lease(tmpdir)
+
+    acquire_release(disks)
+
+    # Host 2 has completed phase 2 for the next lver with an mbal that is
+    # not larger than ours, so its inp may have been committed.  The full
+    # ballot run after the fast one aborts must commit host 2.
+    util.write_dblock(res_path, 2, mbal=FIRST_MBAL, bal=FIRST_MBAL,
+                      inp=2, inp2=1, inp3=1, lver=2)
+
+    fd = sanlock.register()
+    with pytest.raises(sanlock.SanlockException):
+        sanlock.acquire("ls_name", "res_name", disks, slkfd=fd)
+    os.close(fd)
+
+    assert util.read_dblock(res_path, 1)["mbal"] == NEXT_MBAL
+
+    owner = sanlock.read_resource_owners("ls_name", "res_name", disks)[0]
+    assert owner["host_id"] == 2
+    assert owner["generation"] == 1
+    assert sanlock.read_resource(res_path)["version"] == 2
+
+
+def test_fast_ballot_generation(tmpdir, sanlock_daemon_conf):
+    sanlock_daemon_conf("paxos_fast_ballot = 1")
+    ls_path, res_path, disks = setup_ex_lease(tmpdir)
+
+    acquire_release(disks)
+
+    # Our dblock is from the previous generation of our host_id.
+    sanlock.rem_lockspace("ls_name", 1, ls_path)
+    sanlock.add_lockspace("ls_name", 1, ls_path, iotimeout=1)
+
+    fd = sanlock.register()
+    sanlock.acquire("ls_name", "res_name", disks, slkfd=fd)
+
+    dblock = util.read_dblock(res_path, 1)
+    assert dblock["mbal"] == NEXT_MBAL
+    assert dblock["inp2"] == 2
+
+    owner = sanlock.read_resource_owners("ls_name", "res_name", disks)[0]
+    assert owner["host_id"] == 1
+    assert owner["generation"] == 2
+
+    sanlock.release("ls_name", "res_name", disks, slkfd=fd)
+    os.close(fd)
+
+
+def test_fast_ballot_handoff(tmpdir, sanlock_daemon_conf):
+    sanlock_daemon_conf("paxos_fast_ballot = 1")
+    _, res_path, disks = setup_ex_lease(tmpdir)
+
+    acquire_release(disks)
+
+    # The leader was handed to us, not committed by our last ballot.
+    res = "ls_name:res_name:%s:0" % res_path
+    flags = util.read_leader(res)["flags"]
+    util.write_leader(res, str(tmpdir.join("leader")),
+                      flags=flags | constants.LFL_HANDOFF)
+
+    # A shared acquire runs a ballot rather than taking the handoff.
+    acquire_release(disks, shared=True)
+    dblock = util.read_dblock(res_path, 1)
+    assert dblock["mbal"] == NEXT_MBAL
+    assert dblock["lver"] == 2
+
+
+def test_handoff(tmpdir, sanlock_daemon, sanlock_daemon_other):
+    ls_path, res_path, disks = setup_ex_lease(tmpdir)
+    run_dir = sanlock_daemon_other
+    util.sanlock("client", "add_lockspace", "-s", "ls_name:2:%s:0" % ls_path,
+                 "-o", "1", run_dir=run_dir)
+
+    fd = sanlock.register()
+    sanlock.acquire("ls_name", "res_name", disks, slkfd=fd)
+    res = "ls_name:res_name:%s:0" % res_path
+    lver = util.read_leader(res)["lver"]
+
+    # Host 2 asks for the lease, and we remember it when examining.
+    util.sanlock("client", "request", "-r", "%s:%d" % (res, lver + 1),
+                 "-f", str(sanlock.REQ_HANDOFF), run_dir=run_dir)
+    util.sanlock("client", "examine", "-r", res)
+    wait_for_log("do_handoff")
+
+    # Our release commits host 2 as the owner of the next lver.
+    sanlock.release("ls_name", "res_name", disks, slkfd=fd)
+    os.close(fd)
+    leader = util.read_leader(res)
+    assert leader["lver"] == lver + 1
+    assert leader["owner_id"] == 2
+    assert leader["write_id"] == 2
+    assert leader["flags"] & constants.LFL_HANDOFF
+
+    # Host 2 takes the lease without a ballot, keeping the lver.
+    util.sanlock("client", "command", "-r", res, "-c", "/bin/true",
+                 run_dir=run_dir)
+    assert "handoff owner" in util.log_dump(run_dir=run_dir)
+    leader = util.read_leader(res)
+    assert leader["lver"] == lver + 1
+    assert leader["owner_id"] == 2
+    assert not leader["flags"] & constants.LFL_HANDOFF
+    assert util.read_dblock(res_path, 2)["mbal"] == 0
+
+
+def test_many_clients(tmpdir, sanlock_daemon):
+    _, res_path, disks = setup_ex_lease(tmpdir)
+    res = "ls_name:res_name:%s:0" % res_path
+
+    # Most of the client slots are used by registered connections.
+    fds = [sanlock.register() for _ in range(900)]
+    try:
+        # A connection handed to a worker for acquire or release is
+        # watched again when the worker is done with it.
+        for fd in fds[::100]:
+            sanlock.acquire("ls_name", "res_name", disks, slkfd=fd)
+            sanlock.release("ls_name", "res_name", disks, slkfd=fd)
+
+        # A connection that closes while holding a lease is noticed, and
+        # the lease is released.
+        sanlock.acquire("ls_name", "res_name", disks, slkfd=fds[-1])
+        os.close(fds.pop())
+        deadline = time.time() + 5
+        while util.read_leader(res)["timestamp"] != 0:
+            assert time.time() < deadline
+            time.sleep(0.1)
+    finally:
+        for fd in fds:
+            os.close(fd)
+
+    # The slots of closed connections are reused.
+    time.sleep(0.5)
+    fds = [sanlock.register() for _ in range(900)]
+    try:
+        sanlock.acquire("ls_name", "res_name", disks, slkfd=fds[-1])
+        sanlock.release("ls_name", "res_name", disks, slkfd=fds[-1])
+    finally:
+        for fd in fds:
+            os.close(fd)
+
+
+def test_many_lockspaces_and_resources(tmpdir, sanlock_daemon):
+    # Names using all SANLK_NAME_LEN characters, differing only in the
+    # last one.
+    lockspaces = ["l" * 47 + c for c in "abcd"]
+    resources = ["r" * 47 + c for c in "abcdefghij"]
+
+    ls_paths = {}
+    for ls in lockspaces:
+        ls_paths[ls] = str(tmpdir.join(ls[-1] + "_ls"))
+        util.create_file(ls_paths[ls], LOCKSPACE_SIZE)
+        sanlock.write_lockspace(ls, ls_paths[ls], iotimeout=1)
+        sanlock.add_lockspace(ls, 1, ls_paths[ls], iotimeout=1,
+                              **{"async": True})
+    for ls in lockspaces:
+        assert sanlock.inq_lockspace(ls, 1, ls_paths[ls], wait=True)
+
+    # Removing one lockspace leaves the others found.
+    removed = lockspaces[1]
+    sanlock.rem_lockspace(removed, 1, ls_paths[removed])
+    for ls in lockspaces:
+        acquired = sanlock.inq_lockspace(ls, 1, ls_paths[ls], wait=False)
+        assert acquired is (ls != removed)
+    sanlock.add_lockspace(removed, 1, ls_paths[removed], iotimeout=1)
+    assert sanlock.inq_lockspace(removed, 1, ls_paths[removed])
+
+    # The same resource names in two lockspaces are different resources.
+    disks = {}
+    for ls in lockspaces[:2]:
+        path = str(tmpdir.join(ls[-1] + "_res"))
+        util.create_file(path, len(resources) * MIN_RES_SIZE)
+        for i, res in enumerate(resources):
+            disks[ls, res] = [(path, i * MIN_RES_SIZE)]
+            sanlock.write_resource(ls, res, disks[ls, res])
+
+    fds = [sanlock.register() for _ in range(2)]
+    try:
+        for (ls, res), d in sorted(disks.items()):
+            fd = fds[lockspaces.index(ls)]
+            sanlock.acquire(ls, res, d, slkfd=fd)
+
+        # A resource held by one client is found busy by the other.
+        ls, res = lockspaces[0], resources[5]
+        with pytest.raises(sanlock.SanlockException) as e:
+            sanlock.acquire(ls, res, disks[ls, res], slkfd=fds[1])
+        assert e.value.errno == errno.EEXIST
+
+        # Once released, the other client can acquire it, and the other
+        # resources are still held by their owners.
+        sanlock.release(ls, res, disks[ls, res], slkfd=fds[0])
+        sanlock.acquire(ls, res, disks[ls, res], slkfd=fds[1])
+        for (ls, res), d in disks.items():
+            owners = sanlock.read_resource_owners(ls, res, d)
+            assert len(owners) == 1
+            assert owners[0]["host_id"] == 1
+        for (ls, res), d in sorted(disks.items()):
+            fd = fds[1] if res == resources[5] else fds[lockspaces.index(ls)]
+            sanlock.release(ls, res, d, slkfd=fd)
+    finally:
+        for fd in fds:
+            os.close(fd)
+
+    for (ls, res), d in disks.items():
+        assert sanlock.read_resource_owners(ls, res, d) == []
+
+
+def other_host_acquire(tmpdir, res_path):
+    """
+    Write the leader that host 2 commits when it acquires the lease after
+    our release, and return its lease string.
+    """
+    res = "ls_name:res_name:%s:0" % res_path
+    util.write_leader(res, str(tmpdir.join("leader")),
+                      lver=2, owner_id=2, owner_generation=1, timestamp=1,
+                      write_id=2, write_generation=1, write_timestamp=1)
+    return res
+
+
+def check_other_host_owner(res):
+    leader = util.read_leader(res)
+    assert leader["lver"] == 2
+    assert leader["owner_id"] == 2
+    assert leader["write_id"] == 2
+    assert leader["timestamp"] != 0
+
+
+@pytest.mark.parametrize("conf", [
+    # The leader is read before it is freed by default.
+    [],
+    ["release_verify = 1"],
+    # The leader we wrote is freed without reading it.
+    ["release_verify = 0"],
+])
+def test_release_verify(tmpdir, sanlock_daemon_conf, conf):
+    sanlock_daemon_conf(*conf)
+    _, res_path, disks = setup_ex_lease(tmpdir)
+
+    acquire_release(disks)
+    acquire_release(disks)
+
+    leader = util.read_leader("ls_name:res_name:%s:0" % res_path)
+    assert leader["lver"] == 2
+    assert leader["owner_id"] == 1
+    assert leader["write_id"] == 1
+    assert leader["timestamp"] == 0
+
+
+def test_release_verify_other_owner(tmpdir, sanlock_daemon_conf):
+    sanlock_daemon_conf()
+    _, res_path, disks = setup_ex_lease(tmpdir)
+
+    fd = sanlock.register()
+    sanlock.acquire("ls_name", "res_name", disks, slkfd=fd)
+
+    # The leader on disk is no longer the one we wrote; the release must
+    # not free it.
+    res = other_host_acquire(tmpdir, res_path)
+
+    try:
+        sanlock.release("ls_name", "res_name", disks, slkfd=fd)
+    except sanlock.SanlockException:
+        pass
+    os.close(fd)
+
+    check_other_host_owner(res)
+
+
+@pytest.mark.parametrize("conf", [
+    ["release_verify = 1"],
+    ["release_verify = 0"],
+])
+def test_release_retry_other_acquire(tmpdir, sanlock_daemon_conf, conf):
+    sanlock_daemon_conf(*conf)
+
+    ls_path = str(tmpdir.join("ls_name"))
+    util.create_file(ls_path, LOCKSPACE_SIZE)
+    sanlock.write_lockspace("ls_name", ls_path, iotimeout=1)
+    sanlock.add_lockspace("ls_name", 1, ls_path, iotimeout=1)
+
+    # The resource is on a sim disk so that its i/o can be stalled.
+    res_path = str(tmpdir.join("res_name"))
+    util.create_file(res_path, MIN_RES_SIZE)
+    params = tmpdir.join("res_name.sim")
+    params.write("")
+    disks = [("sim:" + res_path, 0)]
+    sanlock.write_resource("ls_name", "res_name", disks)
+
+    fd = sanlock.register()
+    sanlock.acquire("ls_name", "res_name", disks, slkfd=fd)
+
+    # The release writes stall past the io timeout, so the release is
+    # retried by the daemon (R_RELEASE_RETRY).  The stalled writes of the
+    # first attempt still reach the disk.
+    params.write("stall_pct = 100\nstall_ms = 2000\n")
+    time.sleep(0.3)
+
+    try:
+        sanlock.release("ls_name", "res_name", disks, slkfd=fd)
+    except sanlock.SanlockException:
+        pass
+    os.close(fd)
+
+    # Wait for the stalled writes, then host 2 acquires the lease freed by
+    # them while our release is still being retried.
+    time.sleep(3)
+    res = other_host_acquire(tmpdir, res_path)
+    params.write("")
+
+    # The retry must find host 2 as the writer and leave its leader.
+    time.sleep(5)
+    check_other_host_owner(res)
+
+
+def test_detached_write_order(tmpdir, sanlock_daemon):
+    ls_path = str(tmpdir.join("ls_name"))
+    util.create_file(ls_path, LOCKSPACE_SIZE)
+    sanlock.write_lockspace("ls_name", ls_path, iotimeout=1)
+    sanlock.add_lockspace("ls_name", 1, ls_path, iotimeout=1)
+
+    ls2_path = str(tmpdir.join("ls2_name"))
+    util.create_file(ls2_path, LOCKSPACE_SIZE)
+    sanlock.write_lockspace("ls2_name", ls2_path, iotimeout=1)
+
+    # Two fast disks and one slow sim disk.
+    paths = []
+    for i in range(3):
+        path = str(tmpdir.join("res_name%d" % i))
+        util.create_file(path, MIN_RES_SIZE)
+        paths.append(path)
+    params = tmpdir.join("res_name2.sim")
+    params.write("")
+    disks = [(paths[0], 0), (paths[1], 0), ("sim:" + paths[2], 0)]
+    sanlock.write_resource("ls_name", "res_name", disks)
+
+    # The first ballot's dblock write to the slow disk is left outstanding
+    # once the fast disks complete it, and is still outstanding when the
+    # acquire returns.
+    params.write("stall_pct = 100\nstall_ms = 1800\nstall_op = write\n")
+    time.sleep(0.3)
+    fd = sanlock.register()
+    sanlock.acquire("ls_name", "res_name", disks, slkfd=fd)
+
+    params.write("")
+    time.sleep(0.2)
+    sanlock.release("ls_name", "res_name", disks, slkfd=fd)
+
+    # Keep a worker busy, so that the next ballot is likely run by another
+    # worker than the first one.
+    add = subprocess.Popen(
+        [util.SANLOCK, "client", "add_lockspace", "-o", "1",
+         "-s", "ls2_name:1:%s:0" % ls2_path],
+        stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    time.sleep(0.1)
+
+    # The next ballot's dblock write to the slow disk must wait for the
+    # outstanding one instead of being overwritten by it.
+    sanlock.acquire("ls_name", "res_name", disks, slkfd=fd)
+    sanlock.release("ls_name", "res_name", disks, slkfd=fd)
+    os.close(fd)
+    add.communicate()
+
+    time.sleep(2)
+    latest = util.read_dblock(paths[0], 1)
+    assert latest["lver"] == 2
+    assert util.read_dblock(paths[2], 1) == latest
+
+
+def host_status(ls_name, host_id):
+    """
+    Return the host_status values that "sanlock client host_status -D"
+    prints for host_id.
+    """
+    out = util.sanlock("client", "host_status", "-s", ls_name, "-D")
+    hs = {}
+    host = None
+    for line in out.decode().splitlines():
+        words = line.split()
+        if len(words) == 3 and words[1] == "timestamp":
+            host = int(words[0])
+        elif host == host_id and "=" in line:
+            key, val = line.strip().split("=", 1)
+            hs[key] = val
+    return hs
+
+
+def wait_for_last_live(ls_name, host_id, timeout=10):
+    start = time.time()
+    while time.time() - start < timeout:
+        last_live = int(host_status(ls_name, host_id).get("last_live", 0))
+        if last_live:
+            return last_live
+        time.sleep(0.5)
+    raise RuntimeError("host_id %d not checked" % host_id)
+
+
+def test_host_state_cache(tmpdir, sanlock_daemon_conf):
+    conf = ("host_state_cache = 1", "our_host_name = host1")
+    p = sanlock_daemon_conf(*conf)
+
+    ls_path = str(tmpdir.join("ls_name"))
+    util.create_file(ls_path, LOCKSPACE_SIZE)
+    sanlock.write_lockspace("ls_name", ls_path, iotimeout=1)
+
+    # Host 2 holds its host_id lease, and stops renewing it.
+    util.write_leader("ls_name:2:%s:0" % ls_path, str(tmpdir.join("leader")),
+                      lockspace=True, owner_id=2, owner_generation=1,
+                      timestamp=1000)
+
+    sanlock.add_lockspace("ls_name", 1, ls_path, iotimeout=1)
+    last_live = wait_for_last_live("ls_name", 2)
+
+    # Let the host state be saved by a later check.
+    time.sleep(2)
+
+    # Restart the daemon; our host name lets it reacquire host_id 1 at once.
+    p.kill()
+    p.wait()
+    sanlock_daemon_conf(*conf)
+    sanlock.add_lockspace("ls_name", 1, ls_path, iotimeout=1)
+
+    # The saved state is reported instead of EAGAIN.
+    assert "host state restored 1 hosts" in util.log_dump()
+    host = sanlock.get_hosts("ls_name", 2)[0]
+    assert host["generation"] == 1
+    assert host["timestamp"] == 1000
+
+    # But host 2 is watched from the restart, not from its saved last_live,
+    # so it cannot be judged dead sooner than host_dead_seconds from now.
+    assert wait_for_last_live("ls_name", 2) > last_live
+
+
+def wait_for_log(text, timeout=10):
+    start = time.time()
+    while time.time() - start < timeout:
+        if text in util.log_dump():
+            return
+        time.sleep(0.5)
+    raise RuntimeError("%r not logged" % text)
+
+
+def aio_engines(pid):
+    """
+    Return the aio engines that process pid has set up: "libaio" if it
+    has a libaio context, and "io_uring" if it has an io_uring instance.
+    """
+    engines = set()
+    with io.open("/proc/%d/maps" % pid) as f:
+        if "/[aio]" in f.read():
+            engines.add("libaio")
+    fd_dir = "/proc/%d/fd" % pid
+    for fd in os.listdir(fd_dir):
+        try:
+            if os.readlink(os.path.join(fd_dir, fd)) == "anon_inode:[io_uring]":
+                engines.add("io_uring")
+        except OSError:
+            pass
+    return engines
+
+
+@pytest.mark.parametrize("use_aio", [0, 1, 2])
+def test_aio_engine(tmpdir, sanlock_daemon_conf, use_aio):
+    daemon = sanlock_daemon_conf("use_aio = %d" % use_aio)
+    _, _, disks = setup_ex_lease(tmpdir)
+
+    acquire_release(disks)
+    acquire_release(disks, shared=True)
+
+    engines = aio_engines(daemon.pid)
+    if use_aio == 0:
+        assert engines == set()
+    elif use_aio == 1:
+        assert engines == {"libaio"}
+    elif "io_uring unavailable" in util.log_dump():
+        # The kernel has no usable io_uring, libaio is used instead.
+        assert engines == {"libaio"}
+    else:
+        assert engines == {"io_uring"}
+
+    if use_aio == 0:
+        return
+
+    # A renewal read that times out is reaped by the next renewal, and
+    # the lockspace keeps its lease.
+    path = str(tmpdir.join("slow_ls"))
+    util.create_file(path, LOCKSPACE_SIZE)
+    params = tmpdir.join("slow_ls.sim")
+    params.write("")
+    lockspace = "slow_ls:1:sim\\:%s:0" % path
+    util.sanlock("client", "init", "-s", lockspace, "-o", "1")
+    util.sanlock("client", "add_lockspace", "-s", lockspace, "-o", "1")
+
+    params.write("stall_pct = 100\nstall_ms = 1500\n")
+    wait_for_log("aio timeout")
+    params.write("")
+    wait_for_log("delta_renew reap 0")
+
+    time.sleep(3)
+    status = lockspace_status()["slow_ls"]
+    assert status["renewal_last_result"] == "1"
+    assert status["renew_fail"] == "0"
+    acquire_release(disks)
+
+
+def lockspace_status():
+    """
+    Return the lockspace values that "sanlock client status -D" prints, by
+    lockspace name.
+    """
+    out = util.sanlock("client", "status", "-D")
+    status = {}
+    values = None
+    for line in out.decode().splitlines():
+        words = line.split()
+        if words and words[0] == "s":
+            values = status.setdefault(words[1].split(":")[0], {})
+            values["rem"] = "REM" in words[2:]
+        elif values is not None and line.startswith("    ") and "=" in line:
+            key, val = line.strip().split("=", 1)
+            values[key] = val
+        else:
+            values = None
+    return status
+
+
+def test_renewal_threads_stalled(tmpdir, sanlock_daemon_conf):
+    # More lockspaces than renewal threads, three of them on disks that
+    # stall.
+    sanlock_daemon_conf("renewal_threads = 2")
+
+    fast = ["ls%d" % i for i in range(4)]
+    slow = ["slow%d" % i for i in range(3)]
+    args = []
+    for name in fast + slow:
+        path = str(tmpdir.join(name))
+        util.create_file(path, LOCKSPACE_SIZE)
+        if name in slow:
+            tmpdir.join(name + ".sim").write("")
+            path = "sim\\:" + path
+        lockspace = "%s:1:%s:0" % (name, path)
+        util.sanlock("client", "init", "-s", lockspace, "-o", "1")
+        args.extend(("-s", lockspace))
+    util.sanlock("client", "add_lockspace", "-o", "1", *args[:2 * len(fast)])
+    util.sanlock("client", "add_lockspace", "-o", "3", *args[2 * len(fast):])
+
+    for name in slow:
+        tmpdir.join(name + ".sim").write("stall_pct = 100\nstall_ms = 60000\n")
+
+    # With io_timeout 1 the fast lockspaces renew every 2 seconds.  Each
+    # stalled renewal holds a thread for io_timeout 3, and must not delay
+    # the others until the stalled lockspaces fail after 24 seconds.
+    last = {}
+    changed = {}
+    start = time.time()
+    while True:
+        status = lockspace_status()
+        now = time.time()
+        for name in fast:
+            success = status[name]["renewal_last_success"]
+            if last.get(name) != success:
+                last[name] = success
+                changed[name] = now
+            assert now - changed[name] < 4, "%s not renewed" % name
+            assert status[name]["renew_fail"] == "0"
+        if all(status[name]["renew_fail"] == "1" for name in slow):
+            break
+        assert now - start < 40, "stalled lockspaces not failed"
+        time.sleep(0.5)
+
+
+def test_request_renewal_rate(tmpdir, sanlock_daemon_conf):
+    sanlock_daemon_conf()
+    _, res_path, disks = setup_ex_lease(tmpdir)
+    other_host_acquire(tmpdir, res_path)
+
+    # Each request for the lease of host 2 wakes our renewal to send it,
+    # but no more than once per io_timeout (1 second).
+    start = time.time()
+    count = 0
+    while time.time() - start < 3:
+        sanlock.request("ls_name", "res_name", disks)
+        count += 1
+
+    assert count > 10
+    assert util.log_dump().count("renewal wake") <= 4
+
+
+@pytest.mark.parametrize("event, data", [
+    # A request for more than one resource.
+    (constants.SANLK_HOST_EVENT_REQUEST, 0),
+    # An application event.
+    (1, 2),
+])
+def test_request_event_replaced(tmpdir, sanlock_daemon_conf, event, data):
+    sanlock_daemon_conf()
+
+    ls_path = str(tmpdir.join("ls_name"))
+    util.create_file(ls_path, LOCKSPACE_SIZE)
+    sanlock.write_lockspace("ls_name", ls_path, iotimeout=1)
+    util.write_delta_lease(ls_path, 2, 1000)
+    sanlock.add_lockspace("ls_name", 1, ls_path, iotimeout=1)
+
+    res_path = str(tmpdir.join("res_name"))
+    util.create_file(res_path, MIN_RES_SIZE)
+    disks = [(res_path, 0)]
+    sanlock.write_resource("ls_name", "res_name", disks)
+    fd = sanlock.register()
+    sanlock.acquire("ls_name", "res_name", disks, slkfd=fd)
+
+    # Host 2 requests one of our resources, we examine only that one.
+    util.write_delta_lease(ls_path, 2, 1001, bitmap=[1],
+                           event=constants.SANLK_HOST_EVENT_REQUEST,
+                           data=0x1234)
+    wait_for_log("request event from host_id 2 data 1234")
+
+    # The request event is replaced while the bit is still set, so the
+    # resource it was for is not known; we examine all.
+    util.write_delta_lease(ls_path, 2, 1002, bitmap=[1], event=event,
+                           data=data)
+    wait_for_log("request from host_id 2")
+
+    sanlock.release("ls_name", "res_name", disks, slkfd=fd)
+    os.close(fd)
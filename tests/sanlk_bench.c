@@ -0,0 +1,520 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+/*
+ * Microbenchmarks of the code sanlock runs most often: crc32c, leader
+ * and dblock checksums, the ondisk codecs, check_other_leases over a
+ * lockspace of 2000 hosts, search_entries over a full rindex, and the
+ * host_id bitmap helpers.
+ *
+ * The number of iterations of each benchmark is chosen so that a run
+ * takes about the given time, then the run is repeated and the median
+ * and minimum ns per op of the runs are reported, with bytes/s for those
+ * that process a buffer.
+ *
+ * lockspace.c and rindex.c are built into this program so their static
+ * functions can be called.  The disk and lease code they use is linked
+ * from the daemon sources (see the Makefile), and the rest of the daemon
+ * is stubbed, as in direct_lib.c.
+ *
+ * sanlk_bench [-t ms] [-r runs] [name ...]
+ */
+
+#define EXTERN
+#include "../src/lockspace.c"
+#include "../src/rindex.c"
+
+#include "crc32c.h"
+#include "ondisk.h"
+
+#define BENCH_HOSTS 2000
+#define BENCH_RUNS_MAX 31
+
+/* stubs for the daemon functions used by lockspace.c and the linked sources */
+
+void log_level(uint32_t space_id GNUC_UNUSED, uint32_t res_id GNUC_UNUSED,
+	       char *name GNUC_UNUSED, int level GNUC_UNUSED,
+	       const char *fmt GNUC_UNUSED, ...) { }
+void metrics_add(uint32_t space_id GNUC_UNUSED, int counter GNUC_UNUSED,
+		 uint64_t val GNUC_UNUSED) { }
+void check_mode_block(struct token *token GNUC_UNUSED, uint64_t next_lver GNUC_UNUSED,
+		      int q GNUC_UNUSED, struct mode_block *mb GNUC_UNUSED) { }
+int get_rand(int a, int b) { return a + (int)(((float)(b - a + 1)) * random() / (RAND_MAX + 1.0)); }
+void update_watchdog(struct space *sp GNUC_UNUSED, uint64_t timestamp GNUC_UNUSED,
+		     int id_renewal_fail_seconds GNUC_UNUSED) { }
+int connect_watchdog(struct space *sp GNUC_UNUSED) { return 0; }
+int activate_watchdog(struct space *sp GNUC_UNUSED, uint64_t timestamp GNUC_UNUSED,
+		      int id_renewal_fail_seconds GNUC_UNUSED, int con GNUC_UNUSED) { return 0; }
+void deactivate_watchdog(struct space *sp GNUC_UNUSED) { }
+void close_watchdog(struct space *sp GNUC_UNUSED) { }
+void host_state_load(struct space *sp GNUC_UNUSED) { }
+int host_state_get(struct space *sp GNUC_UNUSED, int i GNUC_UNUSED,
+		   struct host_status *hs GNUC_UNUSED) { return 0; }
+void host_state_save(struct space *sp GNUC_UNUSED) { }
+void host_state_close(struct space *sp GNUC_UNUSED) { }
+void main_loop_wake(void) { }
+void metrics_add_space(uint32_t space_id GNUC_UNUSED) { }
+void purge_resource_orphans(char *space_name GNUC_UNUSED) { }
+void purge_resource_lazy(char *space_name GNUC_UNUSED) { }
+void purge_resource_free(char *space_name GNUC_UNUSED) { }
+int set_resource_examine(char *space_name GNUC_UNUSED, char *res_name GNUC_UNUSED) { return 0; }
+int set_resource_examine_hash(char *space_name GNUC_UNUSED, uint32_t hash GNUC_UNUSED) { return 0; }
+void add_host_event(uint32_t space_id GNUC_UNUSED, struct sanlk_host_event *he GNUC_UNUSED,
+		    uint64_t from_host_id GNUC_UNUSED, uint64_t from_generation GNUC_UNUSED) { }
+void thread_class_setup(int class GNUC_UNUSED) { }
+void thread_class_wake(int class GNUC_UNUSED, uint64_t due GNUC_UNUSED, uint64_t now GNUC_UNUSED) { }
+
+struct bench {
+	const char *name;
+	uint64_t bytes;			/* per op, 0 if not a buffer */
+	void (*fn)(uint64_t n);
+};
+
+static volatile uint64_t sink;
+
+static uint8_t *crc_buf;
+static struct leader_record bench_leader;
+static struct paxos_dblock bench_dblock;
+static struct leader_record leader_disk;
+static struct paxos_dblock dblock_disk;
+static struct space *bench_sp;
+static char *lease_buf;
+static struct rindex_info bench_rx;
+static struct rindex_cache *bench_rc;
+static struct sanlk_rindex bench_ri;
+static char rindex_names[1024][NAME_ID_SIZE + 1];
+static char bench_bitmap[HOSTID_BITMAP_SIZE];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_crc32c_72(uint64_t n)
+{
+	uint32_t crc = 0;
+
+	while (n--)
+		crc = crc32c(crc, crc_buf, 72);
+	sink = crc;
+}
+
+static void bench_crc32c_512(uint64_t n)
+{
+	uint32_t crc = 0;
+
+	while (n--)
+		crc = crc32c(crc, crc_buf, 512);
+	sink = crc;
+}
+
+static void bench_crc32c_4k(uint64_t n)
+{
+	uint32_t crc = 0;
+
+	while (n--)
+		crc = crc32c(crc, crc_buf, 4096);
+	sink = crc;
+}
+
+static void bench_crc32c_1m(uint64_t n)
+{
+	uint32_t crc = 0;
+
+	while (n--)
+		crc = crc32c(crc, crc_buf, BENCH_HOSTS * 512);
+	sink = crc;
+}
+
+static void bench_leader_checksum(uint64_t n)
+{
+	uint32_t sum = 0;
+
+	while (n--) {
+		sum += leader_checksum(&leader_disk);
+		leader_disk.timestamp++;
+	}
+	sink = sum;
+}
+
+static void bench_dblock_checksum(uint64_t n)
+{
+	uint32_t sum = 0;
+
+	while (n--) {
+		sum += dblock_checksum(&dblock_disk);
+		dblock_disk.lver++;
+	}
+	sink = sum;
+}
+
+static void bench_leader_record_in(uint64_t n)
+{
+	struct leader_record lr;
+	uint64_t sum = 0;
+
+	while (n--) {
+		leader_record_in(&leader_disk, &lr);
+		sum += lr.timestamp;
+	}
+	sink = sum;
+}
+
+static void bench_leader_record_out(uint64_t n)
+{
+	uint64_t sum = 0;
+
+	while (n--) {
+		leader_record_out(&bench_leader, &leader_disk);
+		sum += leader_disk.timestamp;
+	}
+	sink = sum;
+}
+
+static void bench_paxos_dblock_in(uint64_t n)
+{
+	struct paxos_dblock pd;
+	uint64_t sum = 0;
+
+	while (n--) {
+		paxos_dblock_in(&dblock_disk, &pd);
+		sum += pd.mbal;
+	}
+	sink = sum;
+}
+
+static void bench_paxos_dblock_out(uint64_t n)
+{
+	uint64_t sum = 0;
+
+	while (n--) {
+		paxos_dblock_out(&bench_dblock, &dblock_disk);
+		sum += dblock_disk.mbal;
+	}
+	sink = sum;
+}
+
+/* a renewal read in which no other host has renewed */
+
+static void bench_check_leases_same(uint64_t n)
+{
+	while (n--)
+		check_other_leases(bench_sp, lease_buf, NULL);
+	sink = bench_sp->host_status[1].timestamp;
+}
+
+/* a renewal read in which every other host has renewed, includes the timestamp updates */
+
+static void bench_check_leases_renewed(uint64_t n)
+{
+	struct leader_record *end;
+	uint64_t ts;
+	int i;
+
+	while (n--) {
+		for (i = 0; i < BENCH_HOSTS; i++) {
+			end = (struct leader_record *)(lease_buf + (i * 512));
+			ts = le64_to_cpu(end->timestamp);
+			end->timestamp = cpu_to_le64(ts + 1);
+		}
+		check_other_leases(bench_sp, lease_buf, NULL);
+	}
+	sink = bench_sp->host_status[1].timestamp;
+}
+
+static void bench_search_name(uint64_t n)
+{
+	uint64_t ent_offset, res_offset, sum = 0;
+	uint64_t i = 0;
+
+	while (n--) {
+		if (!search_entries(&bench_rx, bench_rc, &ent_offset, &res_offset, 0,
+				    rindex_names[i++ & 1023]))
+			sum += res_offset;
+	}
+	sink = sum;
+}
+
+static void bench_search_free(uint64_t n)
+{
+	uint64_t ent_offset, res_offset, sum = 0;
+
+	while (n--) {
+		if (!search_entries(&bench_rx, bench_rc, &ent_offset, &res_offset, 1, NULL))
+			sum += res_offset;
+	}
+	sink = sum;
+}
+
+static void bench_set_id_bit(uint64_t n)
+{
+	int id = 0;
+
+	while (n--) {
+		set_id_bit(id + 1, bench_bitmap, NULL);
+		id = (id + 1) % BENCH_HOSTS;
+	}
+	sink = bench_bitmap[0];
+}
+
+static void bench_test_id_bit(uint64_t n)
+{
+	uint64_t sum = 0;
+	int id = 0;
+
+	while (n--) {
+		sum += !!test_id_bit(id + 1, bench_bitmap);
+		id = (id + 1) % BENCH_HOSTS;
+	}
+	sink = sum;
+}
+
+static struct bench benches[] = {
+	{ "crc32c_72",              72,                 bench_crc32c_72 },
+	{ "crc32c_512",             512,                bench_crc32c_512 },
+	{ "crc32c_4k",              4096,               bench_crc32c_4k },
+	{ "crc32c_2000x512",        BENCH_HOSTS * 512,  bench_crc32c_1m },
+	{ "leader_checksum",        LEADER_CHECKSUM_LEN, bench_leader_checksum },
+	{ "dblock_checksum",        DBLOCK_CHECKSUM_LEN, bench_dblock_checksum },
+	{ "leader_record_in",       sizeof(struct leader_record), bench_leader_record_in },
+	{ "leader_record_out",      sizeof(struct leader_record), bench_leader_record_out },
+	{ "paxos_dblock_in",        sizeof(struct paxos_dblock), bench_paxos_dblock_in },
+	{ "paxos_dblock_out",       sizeof(struct paxos_dblock), bench_paxos_dblock_out },
+	{ "check_leases_same",      BENCH_HOSTS * 512,  bench_check_leases_same },
+	{ "check_leases_renewed",   BENCH_HOSTS * 512,  bench_check_leases_renewed },
+	{ "search_entries_name",    0,                  bench_search_name },
+	{ "search_entries_free",    0,                  bench_search_free },
+	{ "set_id_bit",             0,                  bench_set_id_bit },
+	{ "test_id_bit",            0,                  bench_test_id_bit },
+};
+
+static void setup_leases(void)
+{
+	struct leader_record lr;
+	int i;
+
+	memset(&lr, 0, sizeof(lr));
+	lr.magic = DELTA_DISK_MAGIC;
+	lr.version = DELTA_DISK_VERSION_MAJOR | DELTA_DISK_VERSION_MINOR;
+	lr.sector_size = 512;
+	lr.num_hosts = BENCH_HOSTS;
+	lr.max_hosts = BENCH_HOSTS;
+	lr.io_timeout = 10;
+	strcpy(lr.space_name, "bench");
+
+	lease_buf = aligned_alloc(4096, BENCH_HOSTS * 512);
+	memset(lease_buf, 0, BENCH_HOSTS * 512);
+
+	for (i = 0; i < BENCH_HOSTS; i++) {
+		lr.owner_id = i + 1;
+		lr.owner_generation = 1;
+		lr.timestamp = 1000 + i;
+		snprintf(lr.resource_name, NAME_ID_SIZE, "host%d", i + 1);
+		lr.checksum = 0;
+		leader_record_out(&lr, (struct leader_record *)(lease_buf + (i * 512)));
+		lr.checksum = leader_checksum((struct leader_record *)(lease_buf + (i * 512)));
+		leader_record_out(&lr, (struct leader_record *)(lease_buf + (i * 512)));
+	}
+
+	bench_sp = calloc(1, sizeof(struct space));
+	strcpy(bench_sp->space_name, "bench");
+	bench_sp->host_id = 1;
+	bench_sp->max_hosts = BENCH_HOSTS;
+	bench_sp->sector_size = 512;
+	bench_sp->host_status = calloc(BENCH_HOSTS, sizeof(struct host_status));
+	bench_sp->leader_keys = calloc(BENCH_HOSTS, sizeof(struct leader_key));
+	bench_sp->host_names = calloc(BENCH_HOSTS, NAME_ID_SIZE);
+	pthread_mutex_init(&bench_sp->mutex, NULL);
+
+	/* the first check records every host */
+	check_other_leases(bench_sp, lease_buf, NULL);
+
+	memcpy(&bench_leader, &lr, sizeof(lr));
+	leader_record_out(&bench_leader, &leader_disk);
+
+	memset(&bench_dblock, 0, sizeof(bench_dblock));
+	bench_dblock.mbal = 2001;
+	bench_dblock.bal = 2001;
+	bench_dblock.inp = 1;
+	bench_dblock.inp2 = 1;
+	bench_dblock.inp3 = 12345;
+	bench_dblock.lver = 7;
+	paxos_dblock_out(&bench_dblock, &dblock_disk);
+}
+
+/* an 8M aligned rindex with all 128000 entries used but the last */
+
+static void setup_rindex(void)
+{
+	struct rindex_header rh;
+	struct rindex_entry re;
+	char *buf;
+	int sector_size = 4096;
+	int align_size = 8 * 1024 * 1024;
+	uint32_t max = MAX_RINDEX_ENTRIES_8M;
+	uint32_t i;
+
+	buf = calloc(1, align_size);
+
+	memset(&rh, 0, sizeof(rh));
+	rh.magic = RINDEX_DISK_MAGIC;
+	rh.version = RINDEX_DISK_VERSION_MAJOR | RINDEX_DISK_VERSION_MINOR;
+	rh.flags = RHF_ALIGN_8M;
+	rh.sector_size = sector_size;
+	rh.max_resources = max;
+	strcpy(rh.lockspace_name, "bench");
+	rindex_header_out(&rh, (struct rindex_header *)buf);
+
+	for (i = 0; i < max - 1; i++) {
+		memset(&re, 0, sizeof(re));
+		snprintf(re.name, NAME_ID_SIZE, "resource%u", i);
+		re.res_offset = (2 * (uint64_t)align_size) + ((uint64_t)i * align_size);
+		rindex_entry_out(&re, (struct rindex_entry *)(buf + sector_size +
+							     (i * sizeof(struct rindex_entry))));
+	}
+
+	/* names spread over the rindex */
+	for (i = 0; i < 1024; i++)
+		snprintf(rindex_names[i], NAME_ID_SIZE, "resource%u",
+			 (uint32_t)(((uint64_t)i * 2654435761U) % (max - 1)));
+
+	memset(&bench_ri, 0, sizeof(bench_ri));
+	strcpy(bench_ri.lockspace_name, "bench");
+	strcpy(bench_ri.disk.path, "/dev/null");
+
+	bench_rx.ri = &bench_ri;
+	bench_rx.disk = (struct sync_disk *)&bench_ri.disk;
+	memcpy(&bench_rx.header, &rh, sizeof(rh));
+
+	bench_rc = rindex_cache_load(&bench_rx, buf);
+	free(buf);
+
+	memset(bench_bitmap, 0, sizeof(bench_bitmap));
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* double the iterations until a run takes a tenth of run_ms, then scale up */
+
+static uint64_t calibrate(struct bench *b, int run_ms)
+{
+	uint64_t n = 1, begin, ns;
+
+	while (1) {
+		begin = now_ns();
+		b->fn(n);
+		ns = now_ns() - begin;
+
+		if (ns >= (uint64_t)run_ms * 100000 || n >= (1ULL << 40))
+			break;
+		n *= 2;
+	}
+
+	if (!ns)
+		ns = 1;
+	n = n * ((uint64_t)run_ms * 1000000) / ns;
+	return n ? n : 1;
+}
+
+static void run_bench(struct bench *b, int run_ms, int runs)
+{
+	uint64_t ns[BENCH_RUNS_MAX];
+	uint64_t n, begin;
+	double med, min;
+	int r;
+
+	n = calibrate(b, run_ms);
+
+	for (r = 0; r < runs; r++) {
+		begin = now_ns();
+		b->fn(n);
+		ns[r] = now_ns() - begin;
+	}
+
+	qsort(ns, runs, sizeof(uint64_t), cmp_u64);
+
+	med = (double)ns[runs / 2] / n;
+	min = (double)ns[0] / n;
+
+	printf("%-22s %12llu %12.1f %12.1f", b->name, (unsigned long long)n, med, min);
+	if (b->bytes)
+		printf(" %12.1f", (double)b->bytes * 1000 / med);
+	printf("\n");
+}
+
+static void print_usage(void)
+{
+	unsigned int i;
+
+	printf("sanlk_bench [-t ms] [-r runs] [name ...]\n");
+	printf("  -t ms       time of each run (default 200)\n");
+	printf("  -r runs     runs of each benchmark, median reported (default 5, max %d)\n",
+	       BENCH_RUNS_MAX);
+	printf("  name        run benchmarks starting with name:\n");
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+		printf("              %s\n", benches[i].name);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+	int run_ms = 200, runs = 5;
+	int c, a, match;
+
+	while ((c = getopt(argc, argv, "t:r:h")) != -1) {
+		switch (c) {
+		case 't':
+			run_ms = atoi(optarg);
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		default:
+			print_usage();
+			return 0;
+		}
+	}
+
+	if (run_ms < 1 || runs < 1 || runs > BENCH_RUNS_MAX) {
+		print_usage();
+		return -1;
+	}
+
+	crc_buf = aligned_alloc(4096, BENCH_HOSTS * 512);
+	for (i = 0; i < BENCH_HOSTS * 512; i++)
+		crc_buf[i] = (uint8_t)(i * 31 + 7);
+
+	setup_leases();
+	setup_rindex();
+	if (!bench_rc) {
+		printf("rindex setup failed\n");
+		return -1;
+	}
+
+	printf("crc32c %s, %d runs of %d ms\n", crc32c_name(), runs, run_ms);
+	printf("%-22s %12s %12s %12s %12s\n", "benchmark", "ops/run", "ns/op", "min_ns/op", "MB/s");
+
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		match = (optind == argc);
+		for (a = optind; a < argc; a++) {
+			if (!strncmp(benches[i].name, argv[a], strlen(argv[a])))
+				match = 1;
+		}
+		if (match)
+			run_bench(&benches[i], run_ms, runs);
+	}
+	return 0;
+}
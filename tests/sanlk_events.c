@@ -32,13 +32,14 @@ int main(int argc, char *argv[])
 {
 	struct sigaction act;
 	struct sanlk_host_event he;
+	struct sanlk_event_filter ef;
+	struct sanlk_event_rec recs[16];
 	struct pollfd pollfd;
-	uint64_t from_host, from_gen;
 	char *ls_name;
-	int fd, rv;
+	int fd, rv, i, count;
 
 	if (argc < 2) {
-		 printf("sanlk_events <lockspace_name>\n");
+		 printf("sanlk_events <lockspace_name> [event_mask]\n");
 		 return -1;
 	}
 
@@ -48,9 +49,16 @@ int main(int argc, char *argv[])
 
 	ls_name = argv[1];
 
-	printf("reg_event %s\n", ls_name);
-
-	fd = sanlock_reg_event(ls_name, &he, 0);
+	if (argc > 2) {
+		memset(&ef, 0, sizeof(ef));
+		ef.event_mask = strtoull(argv[2], NULL, 0);
+		printf("reg_event %s mask 0x%llx\n", ls_name, (unsigned long long)ef.event_mask);
+		fd = sanlock_reg_event_filter(ls_name, &ef, 0);
+	} else {
+		memset(&he, 0, sizeof(he));
+		printf("reg_event %s\n", ls_name);
+		fd = sanlock_reg_event(ls_name, &he, 0);
+	}
 	if (fd < 0) {
 		 printf("reg error %d\n", fd);
 		 return -1;
@@ -75,7 +83,7 @@ int main(int argc, char *argv[])
 
 		 if (pollfd.revents & POLLIN) {
 			 while (1) {
-			 	rv = sanlock_get_event(fd, 0, &he, &from_host, &from_gen);
+			 	rv = sanlock_get_events(fd, 0, recs, 16, &count);
 			 	if (rv == -EAGAIN) {
 				 	/* no more events */
 					break;
@@ -85,13 +93,15 @@ int main(int argc, char *argv[])
 					break;
 			 	}
 
-				printf("get_event host_id %llu generation %llu event 0x%llx data 0x%llx from %llu %llu\n",
-					(unsigned long long)he.host_id,
-					(unsigned long long)he.generation,
-					(unsigned long long)he.event,
-					(unsigned long long)he.data,
-					(unsigned long long)from_host,
-					(unsigned long long)from_gen);
+				for (i = 0; i < count; i++) {
+					printf("get_event host_id %llu generation %llu event 0x%llx data 0x%llx from %llu %llu\n",
+						(unsigned long long)recs[i].he.host_id,
+						(unsigned long long)recs[i].he.generation,
+						(unsigned long long)recs[i].he.event,
+						(unsigned long long)recs[i].he.data,
+						(unsigned long long)recs[i].from_host_id,
+						(unsigned long long)recs[i].from_generation);
+				}
 			 }
 		 }
 
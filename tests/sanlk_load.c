@@ -3,6 +3,7 @@
 #include <sys/un.h>
 #include <sys/mount.h>
 #include <sys/signalfd.h>
+#include <sys/mman.h>
 #include <inttypes.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -55,6 +56,13 @@ int error_count;
 int error_range = 1;
 int acquire_rv[MAX_RV];
 int release_rv[MAX_RV];
+char *bench_mix_str = (char *)"ex:50,sh:50";
+char *bench_json_path;
+int bench_rate;
+int bench_host_count = 1;
+int bench_partition;
+int bench_lazy;
+time_t bench_start_time;
 
 
 #define log_debug(fmt, args...) \
@@ -687,6 +695,517 @@ int do_all_child(void)
 	return 0;
 }
 
+/*
+ * sanlk_load bench: each process runs a mix of operations on random
+ * resources and records the latency of each sanlock call in a histogram
+ * shared with the parent.  With an arrival rate (-a), operations are
+ * started on a fixed schedule (open loop), and latency is measured from
+ * the scheduled start, so time spent behind schedule is counted.  With
+ * no rate, each operation starts when the previous one is done.
+ *
+ * For multiple hosts, run it on each host with the same -w start time
+ * and -S seconds so the runs overlap.  All hosts use all resources,
+ * or with -P 1 host_id N uses only the resources r where
+ * r % host_count == (N - 1) % host_count.
+ */
+
+enum {
+	MIX_EX = 0,
+	MIX_SH,
+	MIX_CONVERT,
+	MIX_REQUEST,
+	MIX_LVB,
+	MIX_COUNT,
+};
+
+static const char *mix_names[MIX_COUNT] = {
+	"ex", "sh", "convert", "request", "lvb",
+};
+
+enum {
+	OP_ACQUIRE_EX = 0,
+	OP_ACQUIRE_SH,
+	OP_RELEASE,
+	OP_CONVERT,
+	OP_REQUEST,
+	OP_SET_LVB,
+	OP_GET_LVB,
+	OP_COUNT,
+};
+
+static const char *op_names[OP_COUNT] = {
+	"acquire_ex", "acquire_sh", "release", "convert", "request",
+	"set_lvb", "get_lvb",
+};
+
+/*
+ * Latency in usec, log-linear buckets: exact below 64, then 32 buckets
+ * for each power of two (within about 3%).
+ */
+
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_EXP 40
+#define HIST_BUCKETS (2 * HIST_SUB + (HIST_MAX_EXP - HIST_SUB_BITS) * HIST_SUB)
+
+struct bench_stats {
+	uint64_t count[OP_COUNT];
+	uint64_t busy[OP_COUNT];
+	uint64_t errors[OP_COUNT];
+	uint64_t max_us[OP_COUNT];
+	uint64_t hist[OP_COUNT][HIST_BUCKETS];
+};
+
+#define BENCH_MAX_HELD 8
+#define BENCH_LVB_LEN 32
+
+struct bench_held {
+	int s;
+	int r;
+};
+
+int mix_weight[MIX_COUNT];
+int mix_total;
+struct bench_stats *bench_stats;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int hist_index(uint64_t us)
+{
+	int e;
+
+	if (us < 2 * HIST_SUB)
+		return us;
+
+	e = 63 - __builtin_clzll(us);
+	if (e >= HIST_MAX_EXP)
+		return HIST_BUCKETS - 1;
+
+	return 2 * HIST_SUB + (e - HIST_SUB_BITS - 1) * HIST_SUB +
+	       (int)((us >> (e - HIST_SUB_BITS)) - HIST_SUB);
+}
+
+/* the largest value in the bucket */
+
+static uint64_t hist_value(int i)
+{
+	int e, sub;
+
+	if (i < 2 * HIST_SUB)
+		return i;
+
+	e = (i - 2 * HIST_SUB) / HIST_SUB + HIST_SUB_BITS + 1;
+	sub = (i - 2 * HIST_SUB) % HIST_SUB;
+
+	return ((uint64_t)(HIST_SUB + sub + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+static uint64_t hist_percentile(uint64_t *hist, uint64_t count, uint64_t max, double pct)
+{
+	uint64_t want, sum = 0;
+	int i;
+
+	if (!count)
+		return 0;
+
+	want = (uint64_t)(count * pct / 100.0);
+	if (want < 1)
+		want = 1;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		sum += hist[i];
+		if (sum >= want)
+			return hist_value(i) < max ? hist_value(i) : max;
+	}
+	return max;
+}
+
+/* results expected when other hosts hold the same resources */
+
+static int rv_is_busy(int rv)
+{
+	switch (rv) {
+	case -EAGAIN:
+	case -EBUSY:
+	case -EEXIST:
+	case -243:
+	case -244:
+	case -245:
+		return 1;
+	}
+	return 0;
+}
+
+static void bench_record(struct bench_stats *st, int op, int rv, uint64_t begin_ns)
+{
+	uint64_t us = (now_ns() - begin_ns) / 1000;
+
+	st->count[op]++;
+	if (rv < 0) {
+		if (rv_is_busy(rv))
+			st->busy[op]++;
+		else
+			st->errors[op]++;
+	}
+	if (us > st->max_us[op])
+		st->max_us[op] = us;
+	st->hist[op][hist_index(us)]++;
+}
+
+static int parse_mix(char *str)
+{
+	char buf[256];
+	char *tok, *save = NULL, *colon;
+	int i;
+
+	memset(mix_weight, 0, sizeof(mix_weight));
+	mix_total = 0;
+
+	snprintf(buf, sizeof(buf), "%s", str);
+
+	for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		colon = strchr(tok, ':');
+		if (!colon)
+			return -1;
+		*colon = '\0';
+
+		for (i = 0; i < MIX_COUNT; i++) {
+			if (!strcmp(tok, mix_names[i]))
+				break;
+		}
+		if (i == MIX_COUNT)
+			return -1;
+
+		mix_weight[i] = atoi(colon + 1);
+		if (mix_weight[i] < 0)
+			return -1;
+		mix_total += mix_weight[i];
+	}
+
+	return mix_total ? 0 : -1;
+}
+
+static int pick_mix(void)
+{
+	int n = get_rand(1, mix_total);
+	int i;
+
+	for (i = 0; i < MIX_COUNT; i++) {
+		n -= mix_weight[i];
+		if (n <= 0)
+			return i;
+	}
+	return MIX_EX;
+}
+
+static void set_res(struct sanlk_resource *res, int s, int r, int mode)
+{
+	memset(res, 0, sizeof(struct sanlk_resource) + sizeof(struct sanlk_disk));
+	snprintf(res->lockspace_name, sizeof(res->lockspace_name), "lockspace%d", s);
+	snprintf(res->name, sizeof(res->name), "resource%d", r);
+	if (snprintf(res->disks[0].path, sizeof(res->disks[0].path), "%s%d",
+		     lock_disk_base, s) >= sizeof(res->disks[0].path)) {
+		log_error("lock disk path too long");
+		exit(-1);
+	}
+	res->disks[0].offset = (r+1)*LEASE_SIZE;
+	res->num_disks = 1;
+	if (mode == SH)
+		res->flags |= SANLK_RES_SHARED;
+}
+
+static void pick_res(int *s, int *r)
+{
+	int n;
+
+	*s = get_rand(0, ls_count-1);
+
+	if (!bench_partition || bench_host_count < 2) {
+		*r = get_rand(0, res_count-1);
+		return;
+	}
+
+	/* only the resources of this host's partition */
+	n = (res_count - 1 - (our_hostid - 1) % bench_host_count) / bench_host_count;
+	*r = get_rand(0, n) * bench_host_count + (our_hostid - 1) % bench_host_count;
+}
+
+static void held_del(struct bench_held *held, int *held_count, int i)
+{
+	held[i] = held[*held_count - 1];
+	(*held_count)--;
+}
+
+static void bench_release_all(int fd, struct bench_held *held, int *held_count,
+			      struct bench_stats *st)
+{
+	uint64_t begin;
+	int rv;
+
+	if (!*held_count)
+		return;
+
+	begin = now_ns();
+	rv = sanlock_release(fd, -1, SANLK_REL_ALL, 0, NULL);
+	bench_record(st, OP_RELEASE, rv, begin);
+
+	while (*held_count) {
+		lock_state[held[0].s][held[0].r] = UN;
+		held_del(held, held_count, 0);
+	}
+}
+
+/*
+ * ex/sh: acquire a random resource in that mode, or release it if we hold it.
+ * convert, lvb: use a resource we hold, after acquiring one if we hold none.
+ * request: clear the request record of a random resource.
+ */
+
+static void bench_op(int fd, int mix, uint64_t begin, struct bench_held *held,
+		     int *held_count, struct bench_stats *st)
+{
+	char buf[sizeof(struct sanlk_resource) + sizeof(struct sanlk_disk)];
+	struct sanlk_resource *res = (struct sanlk_resource *)&buf;
+	char lvb[BENCH_LVB_LEN];
+	uint32_t flags = mix_weight[MIX_LVB] ? SANLK_ACQUIRE_LVB : 0;
+	int s, r, i, mode, rv;
+
+	if ((mix == MIX_CONVERT || mix == MIX_LVB) && *held_count) {
+		i = get_rand(0, *held_count - 1);
+		s = held[i].s;
+		r = held[i].r;
+	} else {
+		pick_res(&s, &r);
+	}
+
+	mode = lock_state[s][r];
+
+	if (mode == UN && mix == MIX_REQUEST) {
+		set_res(res, s, r, UN);
+		rv = sanlock_request(0, 0, res);
+		bench_record(st, OP_REQUEST, rv, begin);
+		return;
+	}
+
+	if (mode == UN) {
+		if (*held_count == BENCH_MAX_HELD) {
+			bench_release_all(fd, held, held_count, st);
+			begin = now_ns();
+		}
+
+		mode = (mix == MIX_SH) ? SH : EX;
+		set_res(res, s, r, mode);
+
+		rv = sanlock_acquire(fd, -1, flags, 1, &res, NULL);
+		bench_record(st, (mode == SH) ? OP_ACQUIRE_SH : OP_ACQUIRE_EX, rv, begin);
+		if (rv < 0)
+			return;
+
+		lock_state[s][r] = mode;
+		held[*held_count].s = s;
+		held[*held_count].r = r;
+		(*held_count)++;
+
+		/* ex/sh is done, convert/lvb continue with the new lock */
+		if (mix != MIX_CONVERT && mix != MIX_LVB)
+			return;
+		begin = now_ns();
+	}
+
+	switch (mix) {
+	case MIX_CONVERT:
+		mode = (mode == SH) ? EX : SH;
+		set_res(res, s, r, mode);
+		rv = sanlock_convert(fd, -1, 0, res);
+		bench_record(st, OP_CONVERT, rv, begin);
+		if (!rv)
+			lock_state[s][r] = mode;
+		break;
+
+	case MIX_LVB:
+		set_res(res, s, r, mode);
+		if (mode == EX && get_rand(0, 1)) {
+			memset(lvb, 0, sizeof(lvb));
+			snprintf(lvb, sizeof(lvb), "%d %llu", getpid(),
+				 (unsigned long long)begin);
+			rv = sanlock_set_lvb(0, res, lvb, sizeof(lvb));
+			bench_record(st, OP_SET_LVB, rv, begin);
+		} else {
+			rv = sanlock_get_lvb(0, res, lvb, sizeof(lvb));
+			bench_record(st, OP_GET_LVB, rv, begin);
+		}
+		break;
+
+	default:
+		/* ex, sh or request on a resource we hold */
+		set_res(res, s, r, mode);
+		rv = sanlock_release(fd, -1, (bench_lazy && mode == EX) ? SANLK_REL_LAZY : 0,
+				     1, &res);
+		bench_record(st, OP_RELEASE, rv, begin);
+		lock_state[s][r] = UN;
+		for (i = 0; i < *held_count; i++) {
+			if (held[i].s == s && held[i].r == r) {
+				held_del(held, held_count, i);
+				break;
+			}
+		}
+		break;
+	}
+}
+
+static int do_bench_child(int num)
+{
+	struct bench_held held[BENCH_MAX_HELD];
+	struct bench_stats *st = &bench_stats[num];
+	uint64_t start, end, next, interval = 0, begin, now;
+	struct timespec ts;
+	int held_count = 0;
+	int fd;
+	int pid = getpid();
+
+	srandom(pid);
+
+	memset(lock_state, 0, sizeof(lock_state));
+
+	fd = sanlock_register();
+	if (fd < 0) {
+		log_error("%d sanlock_register error %d", pid, fd);
+		exit(-1);
+	}
+
+	/* the rate is shared among the processes */
+	if (bench_rate)
+		interval = 1000000000ULL * pid_count / bench_rate;
+
+	start = now_ns();
+	end = start + (uint64_t)run_sec * 1000000000ULL;
+	next = start + (interval ? interval * num / pid_count : 0);
+
+	while (!prog_stop) {
+		now = now_ns();
+		if (now >= end)
+			break;
+
+		if (interval) {
+			if (next > now) {
+				ts.tv_sec = next / 1000000000ULL;
+				ts.tv_nsec = next % 1000000000ULL;
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+				if (next >= end)
+					break;
+			}
+			begin = next;
+			next += interval;
+		} else {
+			begin = now;
+		}
+
+		bench_op(fd, pick_mix(), begin, held, &held_count, st);
+	}
+
+	bench_release_all(fd, held, &held_count, st);
+
+	exit(EXIT_SUCCESS);
+}
+
+static void bench_report(double elapsed)
+{
+	struct bench_stats *sum;
+	FILE *file = NULL;
+	uint64_t total = 0;
+	int i, j, op, first = 1;
+
+	sum = calloc(1, sizeof(struct bench_stats));
+	if (!sum)
+		return;
+
+	for (i = 0; i < pid_count; i++) {
+		for (op = 0; op < OP_COUNT; op++) {
+			sum->count[op] += bench_stats[i].count[op];
+			sum->busy[op] += bench_stats[i].busy[op];
+			sum->errors[op] += bench_stats[i].errors[op];
+			if (bench_stats[i].max_us[op] > sum->max_us[op])
+				sum->max_us[op] = bench_stats[i].max_us[op];
+			for (j = 0; j < HIST_BUCKETS; j++)
+				sum->hist[op][j] += bench_stats[i].hist[op][j];
+		}
+	}
+
+	printf("%-11s %9s %7s %7s %9s %9s %9s %9s %9s\n",
+	       "op", "count", "busy", "errors", "ops/s",
+	       "p50_us", "p99_us", "p999_us", "max_us");
+
+	for (op = 0; op < OP_COUNT; op++) {
+		if (!sum->count[op])
+			continue;
+		total += sum->count[op];
+		printf("%-11s %9llu %7llu %7llu %9.1f %9llu %9llu %9llu %9llu\n",
+		       op_names[op],
+		       (unsigned long long)sum->count[op],
+		       (unsigned long long)sum->busy[op],
+		       (unsigned long long)sum->errors[op],
+		       sum->count[op] / elapsed,
+		       (unsigned long long)hist_percentile(sum->hist[op], sum->count[op], sum->max_us[op], 50.0),
+		       (unsigned long long)hist_percentile(sum->hist[op], sum->count[op], sum->max_us[op], 99.0),
+		       (unsigned long long)hist_percentile(sum->hist[op], sum->count[op], sum->max_us[op], 99.9),
+		       (unsigned long long)sum->max_us[op]);
+	}
+
+	printf("total %llu ops in %.2f sec, %.1f ops/s\n",
+	       (unsigned long long)total, elapsed, total / elapsed);
+
+	if (!bench_json_path)
+		goto out;
+
+	if (!strcmp(bench_json_path, "-"))
+		file = stdout;
+	else
+		file = fopen(bench_json_path, "w");
+	if (!file) {
+		log_error("open %s error %d", bench_json_path, errno);
+		goto out;
+	}
+
+	fprintf(file, "{\"host_id\": %d, \"host_count\": %d, \"partition\": %d, "
+		"\"processes\": %d, \"lockspaces\": %d, \"resources\": %d, "
+		"\"seconds\": %d, \"rate\": %d, \"lazy\": %d, \"mix\": \"%s\", "
+		"\"elapsed\": %.3f, \"ops_per_sec\": %.1f, \"ops\": {",
+		our_hostid, bench_host_count, bench_partition,
+		pid_count, ls_count, res_count, run_sec, bench_rate, bench_lazy, bench_mix_str,
+		elapsed, total / elapsed);
+
+	for (op = 0; op < OP_COUNT; op++) {
+		if (!sum->count[op])
+			continue;
+		fprintf(file, "%s\"%s\": {\"count\": %llu, \"busy\": %llu, \"errors\": %llu, "
+			"\"ops_per_sec\": %.1f, \"p50_us\": %llu, \"p99_us\": %llu, "
+			"\"p999_us\": %llu, \"max_us\": %llu}",
+			first ? "" : ", ", op_names[op],
+			(unsigned long long)sum->count[op],
+			(unsigned long long)sum->busy[op],
+			(unsigned long long)sum->errors[op],
+			sum->count[op] / elapsed,
+			(unsigned long long)hist_percentile(sum->hist[op], sum->count[op], sum->max_us[op], 50.0),
+			(unsigned long long)hist_percentile(sum->hist[op], sum->count[op], sum->max_us[op], 99.0),
+			(unsigned long long)hist_percentile(sum->hist[op], sum->count[op], sum->max_us[op], 99.9),
+			(unsigned long long)sum->max_us[op]);
+		first = 0;
+	}
+
+	fprintf(file, "}}\n");
+
+	if (file != stdout)
+		fclose(file);
+ out:
+	free(sum);
+}
+
 /*
  * sanlk_load rand <lock_disk_base> -i <host_id> [-D -s <ls_count> -r <res_count> -p <pid_count>]
  */
@@ -761,6 +1280,27 @@ void get_options(int argc, char *argv[])
 		case 'e':
 			error_range = atoi(optionarg);
 			break;
+		case 'x':
+			bench_mix_str = optionarg;
+			break;
+		case 'a':
+			bench_rate = atoi(optionarg);
+			break;
+		case 'H':
+			bench_host_count = atoi(optionarg);
+			break;
+		case 'P':
+			bench_partition = atoi(optionarg);
+			break;
+		case 'w':
+			bench_start_time = atol(optionarg);
+			break;
+		case 'j':
+			bench_json_path = optionarg;
+			break;
+		case 'l':
+			bench_lazy = atoi(optionarg);
+			break;
 		default:
 			log_error("unknown option: %c", optchar);
 			exit(EXIT_FAILURE);
@@ -1003,6 +1543,105 @@ int do_all(int argc, char *argv[])
 	return 0;
 }
 
+int do_bench(int argc, char *argv[])
+{
+	struct sigaction act;
+	int children[MAX_PID_COUNT];
+	int run_count = 0;
+	uint64_t begin;
+	time_t now;
+	int i, rv, pid, status;
+
+	if (argc < 5)
+		return -1;
+
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = sigterm_handler;
+	sigaction(SIGTERM, &act, NULL);
+
+	strcpy(lock_disk_base, argv[2]);
+
+	run_sec = 10;
+
+	get_options(argc, argv);
+
+	if (parse_mix(bench_mix_str) < 0) {
+		log_error("invalid mix %s", bench_mix_str);
+		return -1;
+	}
+
+	if (run_sec <= 0 || bench_host_count < 1 || !our_hostid) {
+		log_error("bench requires -i, and -S and -H greater than 0");
+		return -1;
+	}
+
+	bench_stats = mmap(NULL, pid_count * sizeof(struct bench_stats),
+			   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (bench_stats == MAP_FAILED) {
+		log_error("mmap error %d", errno);
+		return -1;
+	}
+
+	rv = add_lockspaces();
+	if (rv < 0)
+		return rv;
+
+	/* all hosts begin together */
+	if (bench_start_time) {
+		now = time(NULL);
+		if (now < bench_start_time) {
+			printf("waiting %ld sec to start\n", (long)(bench_start_time - now));
+			sleep(bench_start_time - now);
+		}
+	}
+
+	printf("forking %d pids for %d sec mix %s rate %d\n",
+	       pid_count, run_sec, bench_mix_str, bench_rate);
+	fflush(stdout);
+
+	begin = now_ns();
+
+	for (i = 0; i < pid_count; i++) {
+		pid = fork();
+
+		if (pid < 0) {
+			log_error("fork %d failed %d run_count %d", i, errno, run_count);
+			break;
+		}
+		if (!pid) {
+			do_bench_child(i);
+			exit(-1);
+		}
+		children[i] = pid;
+		run_count++;
+	}
+
+	while (run_count) {
+		status = 0;
+
+		pid = wait(&status);
+		if (pid > 0) {
+			run_count--;
+			if (!WIFEXITED(status) || WEXITSTATUS(status))
+				error_count++;
+		} else if (errno == EINTR) {
+			for (i = 0; i < pid_count; i++)
+				kill(children[i], SIGTERM);
+		} else {
+			break;
+		}
+	}
+
+	bench_report((now_ns() - begin) / 1000000000.0);
+
+	if (error_count) {
+		printf("child errors %d\n", error_count);
+		exit(EXIT_FAILURE);
+	}
+
+	return 0;
+}
+
 /*
  * sanlk_load init <lock_disk_base> [<ls_count> <res_count>]
  * lock_disk_base = /dev/vg/foo
@@ -1087,6 +1726,9 @@ int main(int argc, char *argv[])
 	else if (!strcmp(argv[1], "all"))
 		rv = do_all(argc, argv);
 
+	else if (!strcmp(argv[1], "bench"))
+		rv = do_bench(argc, argv);
+
 	if (!rv)
 		return 0;
 
@@ -1106,6 +1748,18 @@ int main(int argc, char *argv[])
 	printf("  -D        debug output\n");
 	printf("  -V        verbose debug output\n");
 	printf("\n");
+	printf("sanlk_load bench <disk_base> -i <host_id> [options]\n");
+	printf("  report the latency percentiles and rate of each operation\n");
+	printf("  -s, -r, -p as above\n");
+	printf("  -S <num>  seconds to run (default 10)\n");
+	printf("  -x <mix>  weights of ex,sh,convert,request,lvb (default ex:50,sh:50)\n");
+	printf("  -a <num>  operations per second started on schedule (0 closed loop)\n");
+	printf("  -H <num>  number of hosts running the bench together\n");
+	printf("  -P 0|1    each host uses its own part of the resources (with -H)\n");
+	printf("  -w <sec>  start at this unix time, the same on each host\n");
+	printf("  -j <file> write results as json (- for stdout)\n");
+	printf("  -l 0|1    release ex locks with SANLK_REL_LAZY (needs lazy_release_seconds)\n");
+	printf("\n");
 	return -1;
 }
 
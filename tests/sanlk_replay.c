@@ -0,0 +1,542 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+/*
+ * Print or replay a disk i/o capture written by the daemon with the
+ * io_capture_file setting (see capture.h).
+ *
+ * Replay issues the same reads and writes, with the same offsets and
+ * lengths, against the disks given by -d or -m, which can be a test
+ * device, a file, or a sim disk (sim:FILE).  The i/o of each daemon
+ * thread in the capture is replayed in order by one thread, starting
+ * each i/o at its captured time multiplied by the scale.  The data of
+ * captured writes is not in the capture, so replayed writes are filled
+ * with a pattern: don't replay writes to a disk in use.
+ *
+ * At the end the captured and replayed latencies are compared for each
+ * type of i/o.
+ *
+ * sanlk_replay -f FILE -p
+ * sanlk_replay -f FILE -d PATH [options]
+ * sanlk_replay -f FILE -m DISK=PATH [-m DISK=PATH ...] [options]
+ */
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "sanlock_internal.h"
+#include "sanlock_admin.h"
+#include "diskio.h"
+#include "task.h"
+#include "capture.h"
+
+#define MAX_REPLAY_THREADS 256
+#define HIST_BUCKETS 32
+
+struct hist {
+	uint64_t count;
+	uint64_t errors;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t bucket[HIST_BUCKETS];
+};
+
+/* captured and replayed latency of each CAPTURE_ op and SANLK_IO_ op */
+
+struct op_stats {
+	struct hist orig;
+	struct hist replay;
+	struct hist late;
+};
+
+struct replay_thread {
+	pthread_t th;
+	uint32_t tid;
+	int count;
+	int alloc;
+	struct capture_rec **recs;
+};
+
+static const char *io_op_names[SANLK_IO_OPS] = {
+	"none", "delta_read", "delta_write", "leader_read", "leader_write",
+	"dblock_read", "dblock_write", "mblock_write", "lvb_read", "lvb_write",
+	"other_read", "other_write",
+};
+
+static char *capture_path;
+static char *all_disks_path;
+static char *disk_paths[CAPTURE_DISKS];
+static char *captured_paths[CAPTURE_DISKS];
+static struct sync_disk disks[CAPTURE_DISKS];
+static int print_only;
+static int reads_only;
+static int engine = USE_AIO_LINUX;
+static int io_timeout = 10;
+static double scale = 1.0;
+
+static struct capture_header header;
+static struct capture_rec *recs;
+static int recs_count;
+static struct replay_thread threads[MAX_REPLAY_THREADS];
+static int threads_count;
+static struct op_stats stats[CAPTURE_WRITE + 1][SANLK_IO_OPS];
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t replay_start_us;
+static uint64_t skipped;
+static uint64_t timeouts;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static void hist_add(struct hist *h, uint64_t us, int error)
+{
+	int b = 0;
+
+	while ((us >> b) && b < HIST_BUCKETS - 1)
+		b++;
+
+	h->count++;
+	h->sum += us;
+	h->bucket[b]++;
+	if (error)
+		h->errors++;
+	if (us > h->max)
+		h->max = us;
+}
+
+/* the upper bound of the bucket holding the pct percentile, at most max */
+
+static uint64_t hist_pct(struct hist *h, int pct)
+{
+	uint64_t want, seen = 0;
+	int b;
+
+	if (!h->count)
+		return 0;
+
+	want = (h->count * pct + 99) / 100;
+
+	for (b = 0; b < HIST_BUCKETS; b++) {
+		seen += h->bucket[b];
+		if (seen >= want)
+			break;
+	}
+	if (!b)
+		return 0;
+	if (b == HIST_BUCKETS || (1ULL << b) - 1 > h->max)
+		return h->max;
+	return (1ULL << b) - 1;
+}
+
+static void print_hist(const char *name, struct hist *h)
+{
+	printf("    %-8s count %-8llu errors %-6llu mean_ms %-8.3f p50_ms <%-8.3f p99_ms <%-8.3f max_ms %.3f\n",
+	       name, (unsigned long long)h->count, (unsigned long long)h->errors,
+	       h->count ? (double)h->sum / h->count / 1000 : 0,
+	       (double)hist_pct(h, 50) / 1000,
+	       (double)hist_pct(h, 99) / 1000,
+	       (double)h->max / 1000);
+}
+
+static const char *op_str(int op)
+{
+	if (op == CAPTURE_READ)
+		return "RD";
+	if (op == CAPTURE_WRITE)
+		return "WR";
+	if (op == CAPTURE_DISK)
+		return "DISK";
+	return "?";
+}
+
+static const char *io_op_str(int io_op)
+{
+	if (io_op < 0 || io_op >= SANLK_IO_OPS)
+		return "?";
+	return io_op_names[io_op];
+}
+
+/* the capture is small enough to read into memory */
+
+static int read_capture(void)
+{
+	struct capture_rec *rec;
+	struct stat st;
+	char *buf = NULL;
+	int fd, len, pos, rv = -1;
+
+	fd = open(capture_path, O_RDONLY);
+	if (fd < 0) {
+		printf("open %s error %d\n", capture_path, errno);
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(header)) {
+		printf("%s is not a capture\n", capture_path);
+		goto out;
+	}
+
+	len = st.st_size;
+	buf = malloc(len);
+	if (!buf)
+		goto out;
+
+	for (pos = 0; pos < len; ) {
+		rv = read(fd, buf + pos, len - pos);
+		if (rv <= 0) {
+			printf("read %s error %d\n", capture_path, errno);
+			rv = -1;
+			goto out;
+		}
+		pos += rv;
+	}
+	rv = -1;
+
+	memcpy(&header, buf, sizeof(header));
+
+	if (header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION ||
+	    header.rec_size != sizeof(struct capture_rec)) {
+		printf("%s bad header magic %x version %u rec_size %u\n", capture_path,
+		       header.magic, header.version, header.rec_size);
+		goto out;
+	}
+
+	recs = calloc(len / sizeof(struct capture_rec) + 1, sizeof(struct capture_rec));
+	if (!recs)
+		goto out;
+
+	for (pos = sizeof(header); pos + (int)sizeof(struct capture_rec) <= len; ) {
+		rec = (struct capture_rec *)(buf + pos);
+		pos += sizeof(struct capture_rec);
+
+		if (rec->op == CAPTURE_DISK) {
+			if (pos + SANLK_PATH_LEN > len)
+				break;
+			if (rec->disk < CAPTURE_DISKS)
+				captured_paths[rec->disk] = strndup(buf + pos, SANLK_PATH_LEN - 1);
+			pos += SANLK_PATH_LEN;
+		}
+
+		memcpy(&recs[recs_count++], rec, sizeof(struct capture_rec));
+	}
+	rv = 0;
+ out:
+	free(buf);
+	close(fd);
+	return rv;
+}
+
+static void print_capture(void)
+{
+	struct capture_rec *rec;
+	int i;
+
+	printf("capture %s start %llu.%06llu records %d\n", capture_path,
+	       (unsigned long long)header.start_real_us / 1000000,
+	       (unsigned long long)header.start_real_us % 1000000, recs_count);
+
+	for (i = 0; i < recs_count; i++) {
+		rec = &recs[i];
+
+		if (rec->op == CAPTURE_DISK) {
+			printf("%10llu.%06llu %-7s disk %-3u %s\n",
+			       (unsigned long long)rec->time_us / 1000000,
+			       (unsigned long long)rec->time_us % 1000000,
+			       op_str(rec->op), rec->disk,
+			       (rec->disk < CAPTURE_DISKS && captured_paths[rec->disk]) ?
+			       captured_paths[rec->disk] : "");
+			continue;
+		}
+
+		printf("%10llu.%06llu %-7u %-4s disk %-3u offset %-12llu len %-8u us %-8u result %-4d %-12s hash %08x\n",
+		       (unsigned long long)rec->time_us / 1000000,
+		       (unsigned long long)rec->time_us % 1000000,
+		       rec->tid, op_str(rec->op), rec->disk,
+		       (unsigned long long)rec->offset, rec->len, rec->latency_us,
+		       rec->result, io_op_str(rec->io_op), rec->hash);
+	}
+}
+
+static struct replay_thread *get_thread(uint32_t tid)
+{
+	struct replay_thread *rt;
+	int i;
+
+	for (i = 0; i < threads_count; i++) {
+		if (threads[i].tid == tid)
+			return &threads[i];
+	}
+
+	/* more threads than we replay with share the last one */
+	if (threads_count == MAX_REPLAY_THREADS)
+		return &threads[MAX_REPLAY_THREADS - 1];
+
+	rt = &threads[threads_count++];
+	rt->tid = tid;
+	return rt;
+}
+
+/* sort the i/o records into the threads that did them, in order */
+
+static int assign_threads(void)
+{
+	struct replay_thread *rt;
+	struct capture_rec *rec;
+	int i;
+
+	for (i = 0; i < recs_count; i++) {
+		rec = &recs[i];
+
+		if (rec->op != CAPTURE_READ && rec->op != CAPTURE_WRITE)
+			continue;
+
+		if (rec->disk >= CAPTURE_DISKS || disks[rec->disk].fd == -1 ||
+		    (reads_only && rec->op == CAPTURE_WRITE) || !rec->len) {
+			skipped++;
+			continue;
+		}
+
+		if (rec->io_op >= SANLK_IO_OPS)
+			rec->io_op = 0;
+
+		rt = get_thread(rec->tid);
+
+		if (rt->count == rt->alloc) {
+			rt->alloc = rt->alloc ? rt->alloc * 2 : 64;
+			rt->recs = realloc(rt->recs, rt->alloc * sizeof(struct capture_rec *));
+			if (!rt->recs)
+				return -ENOMEM;
+		}
+		rt->recs[rt->count++] = rec;
+	}
+	return 0;
+}
+
+static int open_replay_disks(void)
+{
+	int i, rv, opened = 0;
+
+	for (i = 0; i < CAPTURE_DISKS; i++)
+		disks[i].fd = -1;
+
+	for (i = 0; i < CAPTURE_DISKS; i++) {
+		if (!captured_paths[i])
+			continue;
+
+		if (disk_paths[i])
+			snprintf(disks[i].path, SANLK_PATH_LEN, "%s", disk_paths[i]);
+		else if (all_disks_path)
+			snprintf(disks[i].path, SANLK_PATH_LEN, "%s", all_disks_path);
+		else
+			continue;
+
+		rv = open_disk(&disks[i]);
+		if (rv < 0) {
+			printf("open %s error %d\n", disks[i].path, rv);
+			return rv;
+		}
+
+		printf("disk %d %s replayed on %s\n", i, captured_paths[i], disks[i].path);
+		opened++;
+	}
+
+	if (!opened) {
+		printf("no captured disks are mapped to a replay disk\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void *replay_thread_main(void *arg)
+{
+	struct replay_thread *rt = arg;
+	struct capture_rec *rec;
+	struct task task;
+	char *iobuf = NULL;
+	uint64_t due, begin, end;
+	int iobuf_len = 0;
+	int i, rv;
+
+	memset(&task, 0, sizeof(struct task));
+	setup_task_aio(&task, engine, DIRECT_AIO_CB_SIZE);
+	snprintf(task.name, NAME_ID_SIZE, "replay");
+
+	for (i = 0; i < rt->count; i++) {
+		rec = rt->recs[i];
+
+		if (!iobuf || iobuf_len < (int)rec->len) {
+			free(iobuf);
+			iobuf_len = rec->len;
+			if (posix_memalign((void *)&iobuf, getpagesize(), iobuf_len)) {
+				iobuf = NULL;
+				break;
+			}
+		}
+
+		if (rec->op == CAPTURE_WRITE)
+			memset(iobuf, rec->hash & 0xff, rec->len);
+
+		due = replay_start_us + (uint64_t)(rec->time_us * scale);
+		begin = now_us();
+		if (due > begin) {
+			usleep(due - begin);
+			begin = now_us();
+		}
+
+		if (rec->op == CAPTURE_WRITE)
+			rv = write_iobuf(disks[rec->disk].fd, rec->offset, iobuf, rec->len,
+					 &task, io_timeout, NULL);
+		else
+			rv = read_iobuf(disks[rec->disk].fd, rec->offset, iobuf, rec->len,
+					&task, io_timeout, NULL);
+
+		end = now_us();
+
+		pthread_mutex_lock(&stats_mutex);
+		hist_add(&stats[rec->op][rec->io_op].orig, rec->latency_us, rec->result < 0);
+		hist_add(&stats[rec->op][rec->io_op].replay, end - begin, rv < 0);
+		hist_add(&stats[rec->op][rec->io_op].late, (begin > due) ? begin - due : 0, 0);
+
+		/* the buffer belongs to the unfinished aio */
+		if (rv == SANLK_AIO_TIMEOUT) {
+			timeouts++;
+			iobuf = NULL;
+		}
+		pthread_mutex_unlock(&stats_mutex);
+	}
+
+	free(iobuf);
+	close_task_aio(&task);
+	return NULL;
+}
+
+static void print_usage(void)
+{
+	printf("sanlk_replay -f FILE -p\n");
+	printf("sanlk_replay -f FILE -d PATH | -m DISK=PATH ... [options]\n");
+	printf("  -f file     capture file written by the daemon io_capture_file\n");
+	printf("  -p          print the capture\n");
+	printf("  -d path     replay the i/o of all captured disks on path\n");
+	printf("  -m n=path   replay the i/o of captured disk n on path\n");
+	printf("  -s scale    multiply captured times by scale, 0 for no waits (default 1)\n");
+	printf("  -e engine   0 sync, 1 libaio, 2 io_uring (default %d)\n", engine);
+	printf("  -o sec      io timeout (default %d)\n", io_timeout);
+	printf("  -r          replay reads only\n");
+}
+
+int main(int argc, char *argv[])
+{
+	char *eq;
+	uint64_t end;
+	int i, d, op, io_op, c;
+
+	while ((c = getopt(argc, argv, "f:pd:m:s:e:o:rh")) != -1) {
+		switch (c) {
+		case 'f':
+			capture_path = optarg;
+			break;
+		case 'p':
+			print_only = 1;
+			break;
+		case 'd':
+			all_disks_path = optarg;
+			break;
+		case 'm':
+			eq = strchr(optarg, '=');
+			d = atoi(optarg);
+			if (!eq || d < 0 || d >= CAPTURE_DISKS) {
+				print_usage();
+				return -1;
+			}
+			disk_paths[d] = eq + 1;
+			break;
+		case 's':
+			scale = atof(optarg);
+			break;
+		case 'e':
+			engine = atoi(optarg);
+			break;
+		case 'o':
+			io_timeout = atoi(optarg);
+			break;
+		case 'r':
+			reads_only = 1;
+			break;
+		default:
+			print_usage();
+			return 0;
+		}
+	}
+
+	if (!capture_path || scale < 0 || engine < 0 || engine > USE_AIO_URING ||
+	    io_timeout < 1) {
+		print_usage();
+		return -1;
+	}
+
+	if (read_capture() < 0)
+		return -1;
+
+	if (print_only) {
+		print_capture();
+		return 0;
+	}
+
+	if (open_replay_disks() < 0)
+		return -1;
+
+	if (assign_threads() < 0)
+		return -1;
+
+	printf("replay %d records with %d threads engine %d scale %.3f, skip %llu\n",
+	       recs_count, threads_count, engine, scale, (unsigned long long)skipped);
+
+	replay_start_us = now_us();
+
+	for (i = 0; i < threads_count; i++)
+		pthread_create(&threads[i].th, NULL, replay_thread_main, &threads[i]);
+	for (i = 0; i < threads_count; i++)
+		pthread_join(threads[i].th, NULL);
+
+	end = now_us();
+
+	printf("replay done in %.3f sec, timeouts %llu\n",
+	       (double)(end - replay_start_us) / 1000000, (unsigned long long)timeouts);
+
+	for (op = CAPTURE_READ; op <= CAPTURE_WRITE; op++) {
+		for (io_op = 0; io_op < SANLK_IO_OPS; io_op++) {
+			if (!stats[op][io_op].orig.count)
+				continue;
+			printf("  %s %s\n", op_str(op), io_op_str(io_op));
+			print_hist("captured", &stats[op][io_op].orig);
+			print_hist("replayed", &stats[op][io_op].replay);
+			print_hist("late", &stats[op][io_op].late);
+		}
+	}
+
+	for (i = 0; i < CAPTURE_DISKS; i++) {
+		if (disks[i].fd != -1)
+			close_disk_fd(disks[i].fd);
+	}
+	return 0;
+}
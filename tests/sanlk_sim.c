@@ -0,0 +1,579 @@
+/*
+ * Copyright 2026 Red Hat, Inc.
+ *
+ * This copyrighted material is made available to anyone wishing to use,
+ * modify, copy, or redistribute it subject to the terms and conditions
+ * of the GNU General Public License v2 or (at your option) any later version.
+ */
+
+/*
+ * Simulate many hosts in one process using the direct lease functions
+ * of libsanlock, without the daemon.  Each simulated host acquires its
+ * host_id in the lockspace, renews it every renewal interval, and now
+ * and then tries to acquire a random resource lease, which it holds for
+ * a while and releases.  A pool of worker threads runs the host events
+ * in the order they are due.  At the end it reports the renewal jitter
+ * (how late a renewal started) and latency, and the acquire results and
+ * latency, to compare behavior as host count and contention grow.
+ *
+ * The lockspace and resources can be on a file, a device, or a sim disk
+ * (sim:FILE, see simdisk.c) to add latency and faults.
+ *
+ * sanlk_sim -s LOCKSPACE_PATH -r RESOURCE_PATH [options]
+ */
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "sanlock_internal.h"
+#include "sanlock_rv.h"
+#include "direct.h"
+#include "task.h"
+
+#define MAX_SIM_HOSTS 2000
+#define MAX_SIM_RESOURCES 1024
+#define MAX_ACQUIRE_THREADS 128
+#define MAX_WORKERS 256
+#define HIST_BUCKETS 32
+
+enum {
+	EV_RENEW = 0,
+	EV_ACQUIRE,
+	EV_RELEASE,
+};
+
+struct sim_host {
+	uint64_t host_id;
+	uint64_t generation;
+	uint64_t renew_due;	/* usec */
+	uint64_t acquire_due;
+	uint64_t release_due;
+	int held;		/* resource index + 1 */
+	int busy;
+	int failed;
+};
+
+/* latencies in usec, log2 buckets for percentiles */
+struct hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t bucket[HIST_BUCKETS];
+};
+
+struct sim_stats {
+	struct hist renew_jitter;
+	struct hist renew_latency;
+	struct hist acquire_latency;
+	uint64_t renew_fail;
+	uint64_t acquire_ok;
+	uint64_t acquire_owned;
+	uint64_t acquire_abort;
+	uint64_t acquire_fail;
+	uint64_t release_ok;
+	uint64_t release_fail;
+};
+
+static char *ls_path;
+static char *res_path;
+static int num_hosts = 100;
+static int num_resources = 10;
+static int num_workers = 32;
+static int run_seconds = 30;
+static int io_timeout = 1;
+static int renewal_ms;
+static int acquire_ms = 5000;
+static int hold_ms = 1000;
+static int do_init;
+
+static struct sim_host hosts[MAX_SIM_HOSTS];
+static struct sim_stats stats;
+static pthread_mutex_t sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t end_us;
+static int align_size = 1024 * 1024;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static void hist_add(struct hist *h, uint64_t us)
+{
+	int b = 0;
+
+	while ((us >> b) && b < HIST_BUCKETS - 1)
+		b++;
+
+	h->count++;
+	h->sum += us;
+	h->bucket[b]++;
+	if (us > h->max)
+		h->max = us;
+}
+
+/* the upper bound of the bucket holding the pct percentile, at most max */
+
+static uint64_t hist_pct(struct hist *h, int pct)
+{
+	uint64_t want, seen = 0;
+	int b;
+
+	if (!h->count)
+		return 0;
+
+	want = (h->count * pct + 99) / 100;
+
+	for (b = 0; b < HIST_BUCKETS; b++) {
+		seen += h->bucket[b];
+		if (seen >= want)
+			break;
+	}
+	if (!b)
+		return 0;
+	if (b == HIST_BUCKETS || (1ULL << b) - 1 > h->max)
+		return h->max;
+	return (1ULL << b) - 1;
+}
+
+static void print_hist(const char *name, struct hist *h)
+{
+	printf("  %-16s count %-8llu mean_ms %-8.2f p50_ms <%-7.2f p99_ms <%-7.2f max_ms %.2f\n",
+	       name, (unsigned long long)h->count,
+	       h->count ? (double)h->sum / h->count / 1000 : 0,
+	       (double)hist_pct(h, 50) / 1000,
+	       (double)hist_pct(h, 99) / 1000,
+	       (double)h->max / 1000);
+}
+
+static void setup_task(struct task *task, const char *name)
+{
+	memset(task, 0, sizeof(struct task));
+	setup_task_aio(task, USE_AIO_LINUX, DIRECT_AIO_CB_SIZE * 2);
+	snprintf(task->name, NAME_ID_SIZE, "%s", name);
+}
+
+static void set_lockspace(struct sanlk_lockspace *ls, uint64_t host_id)
+{
+	memset(ls, 0, sizeof(struct sanlk_lockspace));
+	strcpy(ls->name, "SIM");
+	ls->host_id = host_id;
+	snprintf(ls->host_id_disk.path, SANLK_PATH_LEN, "%s", ls_path);
+}
+
+static void set_resource(struct sanlk_resource *res, int r)
+{
+	memset(res, 0, sizeof(struct sanlk_resource) + sizeof(struct sanlk_disk));
+	strcpy(res->lockspace_name, "SIM");
+	snprintf(res->name, SANLK_NAME_LEN, "R%d", r);
+	res->num_disks = 1;
+	snprintf(res->disks[0].path, SANLK_PATH_LEN, "%s", res_path);
+	res->disks[0].offset = (uint64_t)r * align_size;
+}
+
+static int init_leases(void)
+{
+	struct sanlk_resource *res;
+	struct sanlk_lockspace ls;
+	struct task task;
+	int r, rv;
+
+	res = calloc(1, sizeof(struct sanlk_resource) + sizeof(struct sanlk_disk));
+	if (!res)
+		return -ENOMEM;
+
+	setup_task(&task, "init");
+
+	set_lockspace(&ls, 0);
+	rv = direct_write_lockspace(&task, &ls, io_timeout);
+	if (rv < 0) {
+		printf("init lockspace %s error %d\n", ls_path, rv);
+		goto out;
+	}
+
+	for (r = 0; r < num_resources; r++) {
+		set_resource(res, r);
+		rv = direct_write_resource(&task, res, num_hosts, 0);
+		if (rv < 0) {
+			printf("init resource %d %s error %d\n", r, res_path, rv);
+			goto out;
+		}
+	}
+ out:
+	close_task_aio(&task);
+	free(res);
+	return rv;
+}
+
+/* acquire the host_id of each host, many at once since each waits */
+
+static void *acquire_id_thread(void *arg)
+{
+	struct sim_host *h = arg;
+	struct sanlk_lockspace ls;
+	struct leader_record leader;
+	struct task task;
+	char name[NAME_ID_SIZE + 1];
+	int rv;
+
+	setup_task(&task, "id");
+	set_lockspace(&ls, h->host_id);
+
+	memset(name, 0, sizeof(name));
+	snprintf(name, NAME_ID_SIZE, "sim%llu", (unsigned long long)h->host_id);
+
+	rv = direct_acquire_id(&task, io_timeout, &ls, name);
+	if (!rv)
+		rv = direct_read_leader(&task, io_timeout, &ls, NULL, &leader);
+	if (rv < 0) {
+		printf("host %llu acquire_id error %d\n", (unsigned long long)h->host_id, rv);
+		h->failed = 1;
+	} else {
+		h->generation = leader.owner_generation;
+	}
+
+	close_task_aio(&task);
+	return NULL;
+}
+
+static int acquire_ids(void)
+{
+	pthread_t th[MAX_ACQUIRE_THREADS];
+	int i, j, n, failed = 0;
+
+	for (i = 0; i < num_hosts; i += n) {
+		n = num_hosts - i;
+		if (n > MAX_ACQUIRE_THREADS)
+			n = MAX_ACQUIRE_THREADS;
+
+		for (j = 0; j < n; j++)
+			pthread_create(&th[j], NULL, acquire_id_thread, &hosts[i + j]);
+		for (j = 0; j < n; j++)
+			pthread_join(th[j], NULL);
+	}
+
+	for (i = 0; i < num_hosts; i++)
+		failed += hosts[i].failed;
+	return failed;
+}
+
+/* the next due event of a host that is not busy, called with sim_mutex */
+
+static struct sim_host *next_event(int *ev, uint64_t *due)
+{
+	struct sim_host *h, *best = NULL;
+	uint64_t best_due = 0, d;
+	int i, e, best_ev = 0;
+
+	for (i = 0; i < num_hosts; i++) {
+		h = &hosts[i];
+		if (h->busy || h->failed)
+			continue;
+
+		for (e = EV_RENEW; e <= EV_RELEASE; e++) {
+			if (e == EV_RENEW)
+				d = h->renew_due;
+			else if (e == EV_ACQUIRE)
+				d = h->held ? 0 : h->acquire_due;
+			else
+				d = h->held ? h->release_due : 0;
+
+			if (!d)
+				continue;
+			if (!best || d < best_due) {
+				best = h;
+				best_due = d;
+				best_ev = e;
+			}
+		}
+	}
+
+	*ev = best_ev;
+	*due = best_due;
+	return best;
+}
+
+static void run_event(struct task *task, struct sim_host *h, int ev, uint64_t due,
+		      struct sanlk_resource *res)
+{
+	struct sanlk_lockspace ls;
+	struct leader_record leader;
+	uint64_t begin, end;
+	int r = 0, rv;
+
+	begin = now_us();
+
+	if (ev == EV_RENEW) {
+		set_lockspace(&ls, h->host_id);
+		rv = direct_renew_id(task, io_timeout, &ls);
+	} else if (ev == EV_ACQUIRE) {
+		r = random() % num_resources;
+		set_resource(res, r);
+		rv = direct_acquire(task, io_timeout, res, num_hosts,
+				    h->host_id, h->generation, &leader);
+	} else {
+		set_resource(res, h->held - 1);
+		rv = direct_release(task, io_timeout, res, &leader);
+	}
+
+	end = now_us();
+
+	pthread_mutex_lock(&sim_mutex);
+	if (ev == EV_RENEW) {
+		hist_add(&stats.renew_jitter, begin - due);
+		hist_add(&stats.renew_latency, end - begin);
+		if (rv < 0)
+			stats.renew_fail++;
+		h->renew_due = due + ((uint64_t)renewal_ms * 1000);
+
+	} else if (ev == EV_ACQUIRE) {
+		hist_add(&stats.acquire_latency, end - begin);
+		if (!rv) {
+			stats.acquire_ok++;
+			h->held = r + 1;
+			h->release_due = end + ((uint64_t)hold_ms * 1000);
+		} else if (rv == SANLK_ACQUIRE_LOCKSPACE || rv == SANLK_ACQUIRE_IDLIVE ||
+			   rv == SANLK_ACQUIRE_OWNED || rv == SANLK_ACQUIRE_OTHER) {
+			/* owned by another host, whose liveness is not checked without
+			   the daemon's lockspace */
+			stats.acquire_owned++;
+		} else if (rv == SANLK_DBLOCK_MBAL || rv == SANLK_DBLOCK_LVER ||
+			   rv == SANLK_ACQUIRE_LVER) {
+			stats.acquire_abort++;
+		} else {
+			stats.acquire_fail++;
+		}
+		h->acquire_due = end + ((uint64_t)(random() % (2 * acquire_ms + 1)) * 1000);
+
+	} else {
+		if (rv < 0)
+			stats.release_fail++;
+		else
+			stats.release_ok++;
+		h->held = 0;
+	}
+	h->busy = 0;
+	pthread_cond_broadcast(&sim_cond);
+	pthread_mutex_unlock(&sim_mutex);
+}
+
+static void *worker_thread(void *arg)
+{
+	struct sanlk_resource *res;
+	struct sim_host *h;
+	struct timespec ts;
+	struct task task;
+	uint64_t due, now;
+	int ev;
+
+	res = calloc(1, sizeof(struct sanlk_resource) + sizeof(struct sanlk_disk));
+	if (!res)
+		return NULL;
+
+	setup_task(&task, "worker");
+
+	pthread_mutex_lock(&sim_mutex);
+	while (1) {
+		now = now_us();
+		if (now >= end_us)
+			break;
+
+		h = next_event(&ev, &due);
+		if (!h || due > now) {
+			if (!h || due > end_us)
+				due = end_us;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += (due - now) / 1000000;
+			ts.tv_nsec += ((due - now) % 1000000) * 1000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&sim_cond, &sim_mutex, &ts);
+			continue;
+		}
+
+		h->busy = 1;
+		pthread_mutex_unlock(&sim_mutex);
+
+		run_event(&task, h, ev, due, res);
+
+		pthread_mutex_lock(&sim_mutex);
+	}
+	pthread_mutex_unlock(&sim_mutex);
+
+	close_task_aio(&task);
+	free(res);
+	return arg;
+}
+
+static void release_all(void)
+{
+	struct sanlk_resource *res;
+	struct sanlk_lockspace ls;
+	struct leader_record leader;
+	struct task task;
+	int i;
+
+	res = calloc(1, sizeof(struct sanlk_resource) + sizeof(struct sanlk_disk));
+	if (!res)
+		return;
+
+	setup_task(&task, "release");
+
+	for (i = 0; i < num_hosts; i++) {
+		if (hosts[i].failed)
+			continue;
+		if (hosts[i].held) {
+			set_resource(res, hosts[i].held - 1);
+			direct_release(&task, io_timeout, res, &leader);
+		}
+		set_lockspace(&ls, hosts[i].host_id);
+		direct_release_id(&task, io_timeout, &ls);
+	}
+
+	close_task_aio(&task);
+	free(res);
+}
+
+static void print_usage(void)
+{
+	printf("sanlk_sim -s LOCKSPACE_PATH -r RESOURCE_PATH [options]\n");
+	printf("  -i          initialize the lockspace and resources\n");
+	printf("  -n num      number of hosts (default %d, max %d)\n", num_hosts, MAX_SIM_HOSTS);
+	printf("  -R num      number of resources (default %d)\n", num_resources);
+	printf("  -w num      number of worker threads (default %d)\n", num_workers);
+	printf("  -t sec      seconds to run (default %d)\n", run_seconds);
+	printf("  -o sec      io timeout (default %d)\n", io_timeout);
+	printf("  -I ms       renewal interval (default 2 * io timeout)\n");
+	printf("  -a ms       mean time between acquires by a host (default %d)\n", acquire_ms);
+	printf("  -H ms       time a resource is held (default %d)\n", hold_ms);
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t *th;
+	uint64_t begin, now;
+	int i, c, failed;
+
+	while ((c = getopt(argc, argv, "s:r:in:R:w:t:o:I:a:H:h")) != -1) {
+		switch (c) {
+		case 's':
+			ls_path = optarg;
+			break;
+		case 'r':
+			res_path = optarg;
+			break;
+		case 'i':
+			do_init = 1;
+			break;
+		case 'n':
+			num_hosts = atoi(optarg);
+			break;
+		case 'R':
+			num_resources = atoi(optarg);
+			break;
+		case 'w':
+			num_workers = atoi(optarg);
+			break;
+		case 't':
+			run_seconds = atoi(optarg);
+			break;
+		case 'o':
+			io_timeout = atoi(optarg);
+			break;
+		case 'I':
+			renewal_ms = atoi(optarg);
+			break;
+		case 'a':
+			acquire_ms = atoi(optarg);
+			break;
+		case 'H':
+			hold_ms = atoi(optarg);
+			break;
+		default:
+			print_usage();
+			return 0;
+		}
+	}
+
+	if (!ls_path || !res_path || num_hosts < 1 || num_hosts > MAX_SIM_HOSTS ||
+	    num_resources < 1 || num_resources > MAX_SIM_RESOURCES ||
+	    num_workers < 1 || num_workers > MAX_WORKERS || io_timeout < 1 || acquire_ms < 1) {
+		print_usage();
+		return -1;
+	}
+
+	if (!renewal_ms)
+		renewal_ms = 2000 * io_timeout;
+
+	srandom(getpid());
+
+	if (do_init && init_leases() < 0)
+		return -1;
+
+	for (i = 0; i < num_hosts; i++)
+		hosts[i].host_id = i + 1;
+
+	printf("hosts %d resources %d workers %d seconds %d io_timeout %d renewal_ms %d acquire_ms %d hold_ms %d\n",
+	       num_hosts, num_resources, num_workers, run_seconds, io_timeout,
+	       renewal_ms, acquire_ms, hold_ms);
+
+	begin = now_us();
+	failed = acquire_ids();
+	now = now_us();
+	printf("acquired %d host_ids in %.1f sec, %d failed\n",
+	       num_hosts - failed, (double)(now - begin) / 1000000, failed);
+
+	/* spread the first renewals and acquires over their intervals */
+	for (i = 0; i < num_hosts; i++) {
+		hosts[i].renew_due = now + ((uint64_t)(random() % renewal_ms) * 1000);
+		hosts[i].acquire_due = now + ((uint64_t)(random() % acquire_ms) * 1000);
+	}
+	end_us = now + ((uint64_t)run_seconds * 1000000);
+
+	th = calloc(num_workers, sizeof(pthread_t));
+	if (!th)
+		return -1;
+
+	for (i = 0; i < num_workers; i++)
+		pthread_create(&th[i], NULL, worker_thread, NULL);
+	for (i = 0; i < num_workers; i++)
+		pthread_join(th[i], NULL);
+
+	release_all();
+
+	printf("renewals %llu failed %llu\n",
+	       (unsigned long long)stats.renew_jitter.count,
+	       (unsigned long long)stats.renew_fail);
+	print_hist("renew_jitter", &stats.renew_jitter);
+	print_hist("renew_latency", &stats.renew_latency);
+
+	printf("acquires %llu ok %llu owned %llu aborted %llu failed %llu abort_rate %.2f%%\n",
+	       (unsigned long long)stats.acquire_latency.count,
+	       (unsigned long long)stats.acquire_ok,
+	       (unsigned long long)stats.acquire_owned,
+	       (unsigned long long)stats.acquire_abort,
+	       (unsigned long long)stats.acquire_fail,
+	       stats.acquire_latency.count ?
+	       100.0 * stats.acquire_abort / stats.acquire_latency.count : 0);
+	print_hist("acquire_latency", &stats.acquire_latency);
+
+	printf("releases %llu failed %llu\n",
+	       (unsigned long long)stats.release_ok,
+	       (unsigned long long)stats.release_fail);
+
+	free(th);
+	return 0;
+}
@@ -28,7 +28,8 @@ int main(int argc, char *argv[])
 	struct sanlk_lockspace ls;
 	struct sanlk_resource *res;
 	struct sanlk_resource **res_args = NULL;
-	char *state;
+	struct sanlk_resource **inq_args = NULL;
+	char *state, *inq = NULL;
 	int res_count;
 	int rv, i;
 
@@ -97,6 +98,34 @@ int main(int argc, char *argv[])
 	printf("--------------------------------------------------------------------------------\n");
 	printf("\"%s\"\n", state);
 
+	rv = sanlock_state_to_inquire(state, &inq);
+
+	printf("\n");
+	printf("sanlock_state_to_inquire %d\n", rv);
+	printf("--------------------------------------------------------------------------------\n");
+	if (rv < 0)
+		return rv;
+
+	free(state);
+	state = NULL;
+
+	rv = sanlock_inquire_to_args(inq, &res_count, &inq_args);
+
+	printf("\n");
+	printf("sanlock_inquire_to_args %d res_count %d\n", rv, res_count);
+	printf("--------------------------------------------------------------------------------\n");
+	for (i = 0; i < res_count; i++)
+		print_res(inq_args[i]);
+
+	rv = sanlock_inquire_to_state(inq, &state);
+
+	printf("\n");
+	printf("sanlock_inquire_to_state %d\n", rv);
+	printf("--------------------------------------------------------------------------------\n");
+	printf("\"%s\"\n", state);
+
+	free(inq_args);
+	free(inq);
 	return 0;
 }
 
@@ -10,6 +10,8 @@ import struct
 import subprocess
 import time
 
+from . import constants
+
 TESTDIR = os.path.dirname(__file__)
 SANLOCK = os.path.join(TESTDIR, os.pardir, "src", "sanlock")
 
@@ -32,7 +34,29 @@ class CommandError(Exception):
         return self.msg.format(self=self)
 
 
-def start_daemon():
+def _env(run_dir=None, conf=None):
+    """
+    Return the environment for running sanlock with run_dir instead of
+    $SANLOCK_RUN_DIR and with sanlock.conf file conf, or None if neither
+    is set.
+    """
+    if run_dir is None and conf is None:
+        return None
+    env = dict(os.environ)
+    if run_dir is not None:
+        env["SANLOCK_RUN_DIR"] = run_dir
+    if conf is not None:
+        env["SANLOCK_CONF"] = conf
+    return env
+
+
+def start_daemon(conf=None, run_dir=None):
+    """
+    Start sanlock daemon, reading the sanlock.conf file conf instead of
+    /etc/sanlock/sanlock.conf if it is set.  A daemon started with run_dir
+    uses it instead of $SANLOCK_RUN_DIR, so it can run next to the default
+    one, e.g. as another host.
+    """
     cmd = [SANLOCK, "daemon",
            # no fork and print all logging to stderr
            "-D",
@@ -45,15 +69,17 @@ def start_daemon():
            # run as current user instead of "sanlock"
            "-U", os.environ["USER"],
            "-G", os.environ["USER"]]
-    return subprocess.Popen(cmd)
+    return subprocess.Popen(cmd, env=_env(run_dir, conf))
 
 
-def wait_for_daemon(timeout):
+def wait_for_daemon(timeout, run_dir=None):
     """
     Wait until deamon is accepting connections
     """
     deadline = time.time() + timeout
-    path = os.path.join(os.environ["SANLOCK_RUN_DIR"], "sanlock.sock")
+    if run_dir is None:
+        run_dir = os.environ["SANLOCK_RUN_DIR"]
+    path = os.path.join(run_dir, "sanlock.sock")
     s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
     try:
         while True:
@@ -70,14 +96,129 @@ def wait_for_daemon(timeout):
         s.close()
 
 
-def sanlock(*args):
+# See src/sanlock_sock.h struct sm_header
+SM_HEADER = struct.Struct("< 8L")
+
+
+def pipeline_open():
+    """
+    Return a socket connected to the daemon after SM_CMD_PIPELINE, so many
+    requests can be outstanding on it at once.
+    """
+    path = os.path.join(os.environ["SANLOCK_RUN_DIR"], "sanlock.sock")
+    s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    s.connect(path)
+    pipeline_send(s, constants.SM_CMD_PIPELINE, 0)
+    _, result, _, _ = pipeline_recv(s)
+    assert result == 0
+    return s
+
+
+def pipeline_send(s, cmd, seq, body=b"", data=0, data2=0):
+    """
+    Send request cmd with body as a whole, identified by seq.
+    """
+    header = SM_HEADER.pack(constants.SM_MAGIC, constants.SM_PROTO, cmd, 0,
+                            SM_HEADER.size + len(body), seq, data, data2)
+    s.sendall(header + body)
+
+
+def pipeline_recv(s):
+    """
+    Receive the next reply, returning (seq, result, data2, body).
+    """
+    header = _recv_all(s, SM_HEADER.size)
+    magic, _, _, _, length, seq, data, data2 = SM_HEADER.unpack(header)
+    assert magic == constants.SM_MAGIC
+    body = _recv_all(s, length - SM_HEADER.size)
+    result = struct.unpack("< l", struct.pack("< L", data))[0]
+    return seq, result, data2, body
+
+
+def _recv_all(s, size):
+    buf = b""
+    while len(buf) < size:
+        chunk = s.recv(size - len(buf))
+        if not chunk:
+            raise EOFError("connection closed")
+        buf += chunk
+    return buf
+
+
+def io_stats():
+    """
+    Return the i/o counts from "sanlock client stats", by (path, op).
+    """
+    out = sanlock("client", "stats")
+    stats = {}
+    for line in out.decode().splitlines():
+        if line.startswith("#"):
+            continue
+        path, op, count = line.split()[:3]
+        stats[(path, op)] = int(count)
+    return stats
+
+
+def metrics():
+    """
+    Return the samples served on the metrics socket of a daemon started
+    with "metrics = 1", as a dict of values by metric name and labels.
+    """
+    path = os.path.join(os.environ["SANLOCK_RUN_DIR"], "sanlock_metrics.sock")
+    s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        s.connect(path)
+        s.sendall(b"GET /metrics HTTP/1.0\r\n\r\n")
+        buf = b""
+        while True:
+            chunk = s.recv(65536)
+            if not chunk:
+                break
+            buf += chunk
+    finally:
+        s.close()
+    _, _, body = buf.decode().partition("\r\n\r\n")
+    samples = {}
+    for line in body.splitlines():
+        if line and not line.startswith("#"):
+            name, _, val = line.rpartition(" ")
+            samples[name] = int(val)
+    return samples
+
+
+# See src/sanlock.h
+SANLK_DISK = struct.Struct("< 1024s Q 8x")
+SANLK_LOCKSPACE = struct.Struct("< 48s Q L 4x")
+SANLK_RESOURCE = struct.Struct("< 48s 48s Q Q L L L L")
+
+
+def pack_lockspace(name, host_id, path, offset=0):
+    """
+    Return struct sanlk_lockspace.
+    """
+    return (SANLK_LOCKSPACE.pack(name.encode(), host_id, 0) +
+            SANLK_DISK.pack(path.encode(), offset))
+
+
+def pack_resource(lockspace, name, path, offset=0):
+    """
+    Return struct sanlk_resource with one disk.
+    """
+    return (SANLK_RESOURCE.pack(lockspace.encode(), name.encode(),
+                                0, 0, 0, 0, 0, 1) +
+            SANLK_DISK.pack(path.encode(), offset))
+
+
+def sanlock(*args, **kwargs):
     """
     Run sanlock returning the process stdout, or raising
-    util.CommandError on failures.
+    util.CommandError on failures.  With run_dir=path, the command talks
+    to the daemon started with that run_dir.
     """
     cmd = [SANLOCK]
     cmd.extend(args)
-    p = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    p = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                         env=_env(kwargs.get("run_dir")))
     out, err = p.communicate()
     if p.returncode:
         raise CommandError(cmd, p.returncode, out, err)
@@ -133,3 +274,221 @@ def check_rindex_entry(entry, name, offset=None, flags=None):
 
     if flags is not None:
         assert e_flags == flags
+
+
+def name_hash(name):
+    """
+    Return the hash that places a name in a bucket of a hashed rindex.
+    """
+    # See src/hash.h name_hash()
+    h = 2166136261
+    for c in bytearray(name[:48]):
+        if not c:
+            break
+        h = ((h ^ c) * 16777619) & 0xffffffff
+    return h
+
+
+def read_rindex_header(path, offset):
+    # See src/ondisk.c rindex_header_out()
+    with io.open(path, "rb") as f:
+        f.seek(offset)
+        values = struct.unpack("< 6L Q 48s", f.read(80))
+    keys = ("magic", "version", "flags", "sector_size", "max_resources",
+            "buckets", "rx_offset", "lockspace_name")
+    return dict(zip(keys, values))
+
+
+def check_hashed_rindex(path, offset, entries, align_size=1024**2):
+    """
+    Assert that the hashed rindex at offset holds the given entries, a
+    dict of name: resource lease offset, that each can be found from the
+    bucket of its name, and that the bucket counts and the lease bitmap
+    match them.  Return a dict of name: (bucket, slot) and a list of the
+    bucket flags.
+    """
+    header = read_rindex_header(path, offset)
+    assert header["version"] & 0xffff0000 == constants.RINDEX_DISK_VERSION_MAJOR_V2
+    assert header["flags"] & constants.RHF_HASHED
+
+    sector_size = header["sector_size"]
+    buckets = header["buckets"]
+    per_bucket = sector_size // 64 - 1
+
+    with io.open(path, "rb") as f:
+        f.seek(offset)
+        area = f.read(align_size)
+
+    found = {}
+    offsets = {}
+    flags = []
+    for b in range(buckets):
+        sector = area[(1 + b) * sector_size:(2 + b) * sector_size]
+        count, b_flags = struct.unpack("< L L", sector[:8])
+        assert sector[8:64] == b"\0" * 56
+        used = 0
+        for slot in range(1, per_bucket + 1):
+            entry = sector[slot * 64:(slot + 1) * 64]
+            e_offset, _, _, e_name = struct.unpack("< Q L L 48s", entry)
+            e_name = e_name.rstrip(b"\0")
+            if e_name:
+                found[e_name] = (b, slot)
+                offsets[e_name] = e_offset
+                used += 1
+            else:
+                assert entry == b"\0" * 64
+        assert count == used
+        flags.append(b_flags)
+
+    assert offsets == entries
+
+    # A name is in its own bucket, or after buckets that overflowed.
+    for name, (bucket, _) in found.items():
+        b = name_hash(name) % buckets
+        while b != bucket:
+            assert flags[b] & constants.RXB_OVERFLOW
+            b = (b + 1) % buckets
+
+    leases_start = offset + 2 * align_size
+    bitmap = bytearray((header["max_resources"] + 7) // 8)
+    for res_offset in entries.values():
+        num = (res_offset - leases_start) // align_size
+        bitmap[num // 8] |= 1 << (num % 8)
+    start = (1 + buckets) * sector_size
+    assert area[start:start + len(bitmap)] == bytes(bitmap)
+    assert area[start + len(bitmap):] == b"\0" * (align_size - start - len(bitmap))
+
+    return found, flags
+
+
+def read_leader(res, lockspace=False):
+    """
+    Return the leader record of lease res, or of the host_id lease if
+    lockspace is set, as a dict of the values printed by "sanlock direct
+    read_leader".
+    """
+    out = sanlock("direct", "read_leader", "-s" if lockspace else "-r", res)
+    leader = {}
+    # The first line is "read_leader done <rv>".
+    for line in out.decode().splitlines()[1:]:
+        key, _, val = line.partition(" ")
+        if key in ("space_name", "resource_name"):
+            leader[key] = val
+        else:
+            leader[key] = int(val, 0)
+    return leader
+
+
+def write_leader(res, leader_file, lockspace=False, **values):
+    """
+    Change the given values in the leader record of lease res, or of the
+    host_id lease if lockspace is set, using leader_file for "sanlock
+    direct write_leader -F".
+    """
+    with io.open(leader_file, "w") as f:
+        for key, val in values.items():
+            # See src/main.c read_file_leader()
+            fmt = u"%s 0x%x\n" if key == "flags" else u"%s %d\n"
+            f.write(fmt % (key, val))
+    sanlock("direct", "write_leader", "-s" if lockspace else "-r", res,
+            "-F", leader_file)
+
+
+# See src/leader.h struct leader_record
+LEADER_CHECKSUM_LEN = 168
+LEADER_CHECKSUM_OFFSET = 168
+HOSTID_BITMAP_OFFSET = 256
+HOSTID_BITMAP_SIZE = 256
+
+
+def write_delta_lease(path, host_id, timestamp, owner_generation=1, offset=0,
+                      sector_size=512, bitmap=(), generation=0, event=0,
+                      data=0):
+    """
+    Write the host_id lease of a lockspace as the host renewing it would,
+    setting the bits of the host_ids in bitmap and sending the host event
+    (generation, event, data) to them.
+    """
+    pos = offset + (host_id - 1) * sector_size
+    with io.open(path, "r+b") as f:
+        f.seek(pos)
+        sector = bytearray(f.read(sector_size))
+        struct.pack_into("< Q Q", sector, 32, host_id, owner_generation)
+        struct.pack_into("< Q", sector, 152, timestamp)
+        # write_id, write_generation and write_timestamp carry the event
+        struct.pack_into("< Q Q Q", sector, 176, generation, event, data)
+        bits = bytearray(HOSTID_BITMAP_SIZE)
+        for i in bitmap:
+            bits[(i - 1) // 8] |= 1 << ((i - 1) % 8)
+        sector[HOSTID_BITMAP_OFFSET:HOSTID_BITMAP_OFFSET + HOSTID_BITMAP_SIZE] = bits
+        # See src/paxos_lease.c leader_checksum()
+        struct.pack_into("< L", sector, LEADER_CHECKSUM_OFFSET, 0)
+        checksum = crc32c(0xfffffffe, bytes(sector[:LEADER_CHECKSUM_LEN]))
+        struct.pack_into("< L", sector, LEADER_CHECKSUM_OFFSET, checksum)
+        f.seek(pos)
+        f.write(bytes(sector))
+
+
+def log_dump(run_dir=None):
+    """
+    Return the daemon log buffer.  "sanlock client log_dump" exits with
+    the size of the dump, so its returncode is not checked.
+    """
+    p = subprocess.Popen([SANLOCK, "client", "log_dump"],
+                         stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                         env=_env(run_dir))
+    out, _ = p.communicate()
+    return out.decode()
+
+
+def _crc32c_table():
+    table = []
+    for i in range(256):
+        crc = i
+        for _ in range(8):
+            crc = (crc >> 1) ^ (0x82F63B78 if crc & 1 else 0)
+        table.append(crc)
+    return table
+
+
+CRC32C_TABLE = _crc32c_table()
+
+
+def crc32c(crc, data):
+    # See src/crc32c.c crc32c_bytes()
+    for b in bytearray(data):
+        crc = CRC32C_TABLE[(crc ^ b) & 0xff] ^ (crc >> 8)
+    return crc
+
+
+# See src/paxos_dblock.h struct paxos_dblock
+DBLOCK_FIELDS = ("mbal", "bal", "inp", "inp2", "inp3", "lver")
+DBLOCK_CHECKSUM_LEN = 48
+
+
+def dblock_offset(host_id, offset, sector_size):
+    # The dblock of host_id 1 is in the third sector of a paxos lease.
+    return offset + (host_id + 1) * sector_size
+
+
+def read_dblock(path, host_id, offset=0, sector_size=512):
+    with io.open(path, "rb") as f:
+        f.seek(dblock_offset(host_id, offset, sector_size))
+        values = struct.unpack("< 6Q L L", f.read(DBLOCK_CHECKSUM_LEN + 8))
+    dblock = dict(zip(DBLOCK_FIELDS, values[:6]))
+    dblock["flags"] = values[7]
+    return dblock
+
+
+def write_dblock(path, host_id, offset=0, sector_size=512, flags=0,
+                 **values):
+    """
+    Write the dblock of host_id as another host running a ballot would,
+    with the given values and a zero value for the others.
+    """
+    data = struct.pack("< 6Q", *[values.get(f, 0) for f in DBLOCK_FIELDS])
+    # See src/paxos_lease.c dblock_checksum()
+    checksum = crc32c(0xfffffffe, data)
+    with io.open(path, "r+b") as f:
+        f.seek(dblock_offset(host_id, offset, sector_size))
+        f.write(data + struct.pack("< L L", checksum, flags))
@@ -17,7 +17,9 @@
 #include <errno.h>
 #include <limits.h>
 #include <time.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
 #include "wdmd.h"
@@ -123,3 +125,168 @@ int wdmd_status(int con, int *test_interval, int *fire_timeout,
 	return 0;
 }
 
+
+int wdmd_status_flags(int con, int *test_interval, int *fire_timeout,
+		      uint64_t *last_keepalive, uint32_t *flags)
+{
+	struct wdmd_header h;
+	int rv;
+
+	rv = send_header(con, CMD_STATUS);
+	if (rv < 0)
+		return rv;
+
+	rv = recv(con, &h, sizeof(h), MSG_WAITALL);
+	if (rv < 0)
+		return -errno;
+	if (rv != sizeof(h))
+		return -EIO;
+
+	*test_interval = h.test_interval;
+	*fire_timeout = h.fire_timeout;
+	*last_keepalive = h.last_keepalive;
+	*flags = h.flags;
+	return 0;
+}
+
+int wdmd_client_id(int con, uint64_t *client_id)
+{
+	struct {
+		struct wdmd_header h;
+		uint64_t id;
+	} reply;
+	int rv;
+
+	rv = send_header(con, CMD_CLIENT_ID);
+	if (rv < 0)
+		return rv;
+
+	rv = recv(con, &reply, sizeof(reply), MSG_WAITALL);
+	if (rv < 0)
+		return -errno;
+	if (rv != sizeof(reply) || reply.h.len != sizeof(uint64_t))
+		return -EIO;
+
+	*client_id = reply.id;
+	return 0;
+}
+
+int wdmd_test_live_many(int con, struct wdmd_test_live *tl, int count)
+{
+	struct wdmd_header h;
+	struct iovec iov[2];
+	struct msghdr msg;
+	ssize_t len;
+	int rv;
+
+	if (count < 0 || count > WDMD_TEST_LIVE_MAX)
+		return -EINVAL;
+
+	memset(&h, 0, sizeof(h));
+	h.cmd = CMD_TEST_LIVE_MANY;
+	h.len = count * sizeof(struct wdmd_test_live);
+
+	iov[0].iov_base = &h;
+	iov[0].iov_len = sizeof(h);
+	iov[1].iov_base = tl;
+	iov[1].iov_len = h.len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	len = sizeof(h) + h.len;
+
+	rv = sendmsg(con, &msg, MSG_NOSIGNAL);
+	if (rv < 0)
+		return -errno;
+	if (rv != len)
+		return -EIO;
+	return 0;
+}
+
+int wdmd_shm_open(int con, struct wdmd_shm_slot **slot)
+{
+	struct {
+		struct wdmd_header h;
+		struct wdmd_shm_reply r;
+	} reply;
+	char cmsgbuf[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	long page_size = sysconf(_SC_PAGESIZE);
+	off_t offset, page_offset;
+	char *map;
+	int rv, fd = -1;
+
+	rv = send_header(con, CMD_SHM_SLOT);
+	if (rv < 0)
+		return rv;
+
+	memset(&reply, 0, sizeof(reply));
+
+	iov.iov_base = &reply;
+	iov.iov_len = sizeof(reply);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf;
+	msg.msg_controllen = sizeof(cmsgbuf);
+
+	/* a failure reply is only the header */
+	rv = recvmsg(con, &msg, MSG_CMSG_CLOEXEC);
+	if (rv < 0)
+		return -errno;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	if (rv != sizeof(reply) || reply.h.len != sizeof(struct wdmd_shm_reply) ||
+	    reply.r.slot_size != sizeof(struct wdmd_shm_slot) ||
+	    reply.r.slot >= WDMD_SHM_SLOTS || fd < 0) {
+		rv = -EIO;
+		goto out;
+	}
+
+	/* map only the page with this slot */
+
+	offset = (off_t)reply.r.slot * sizeof(struct wdmd_shm_slot);
+	page_offset = offset - (offset % page_size);
+
+	map = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, page_offset);
+	if (map == MAP_FAILED) {
+		rv = -errno;
+		goto out;
+	}
+
+	*slot = (struct wdmd_shm_slot *)(map + (offset - page_offset));
+	rv = 0;
+ out:
+	if (fd >= 0)
+		close(fd);
+	return rv;
+}
+
+void wdmd_shm_test_live(struct wdmd_shm_slot *slot, uint64_t renewal_time,
+			uint64_t expire_time)
+{
+	uint64_t seq = slot->seq;
+
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&slot->renewal_time, renewal_time, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->expire_time, expire_time, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void wdmd_shm_close(struct wdmd_shm_slot *slot)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	uintptr_t addr = (uintptr_t)slot;
+
+	munmap((void *)(addr - (addr % page_size)), page_size);
+}
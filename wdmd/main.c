@@ -97,6 +97,9 @@ struct client {
 	int pid;
 	int pid_dead;
 	int refcount;
+	int heap_pos;		/* index + 1 in expire_heap, 0 if not there */
+	int shm_slot;		/* index + 1 in shm_table, 0 if none */
+	uint32_t gen;
 	uint64_t renewal;
 	uint64_t expire;
 	void *workfn;
@@ -109,6 +112,21 @@ static int client_maxi;
 static int client_size = 0;
 static struct client *client = NULL;
 static struct pollfd *pollfd = NULL;
+static uint32_t client_gen;
+
+/*
+ * A min-heap of the indexes of clients with an expire time, ordered by
+ * expire, so test_clients only looks at the clients near expiring.
+ */
+static int *expire_heap = NULL;
+static int expire_heap_count;
+
+/*
+ * The /wdmd shm object is a table of struct wdmd_shm_slot, which clients
+ * write renewal and expire times into (see wdmd_shm_test_live).
+ */
+static struct wdmd_shm_slot *shm_table = NULL;
+static size_t shm_table_size;
 
 
 #define log_debug(fmt, args...) \
@@ -152,6 +170,7 @@ static void client_alloc(void)
 	if (!client) {
 		client = malloc(CLIENT_NALLOC * sizeof(struct client));
 		pollfd = malloc(CLIENT_NALLOC * sizeof(struct pollfd));
+		expire_heap = malloc(CLIENT_NALLOC * sizeof(int));
 	} else {
 		client = realloc(client, (client_size + CLIENT_NALLOC) *
 				 sizeof(struct client));
@@ -159,8 +178,10 @@ static void client_alloc(void)
 				 sizeof(struct pollfd));
 		if (!pollfd)
 			log_error("can't alloc for pollfd");
+		expire_heap = realloc(expire_heap, (client_size + CLIENT_NALLOC) *
+				      sizeof(int));
 	}
-	if (!client || !pollfd)
+	if (!client || !pollfd || !expire_heap)
 		log_error("can't alloc for client array");
 
 	for (i = client_size; i < client_size + CLIENT_NALLOC; i++) {
@@ -185,6 +206,7 @@ static int client_add(int fd, void (*workfn)(int ci), void (*deadfn)(int ci))
 			client[i].workfn = workfn;
 			client[i].deadfn = deadfn;
 			client[i].fd = fd;
+			client[i].gen = ++client_gen;
 			pollfd[i].fd = fd;
 			pollfd[i].events = POLLIN;
 			if (i > client_maxi)
@@ -197,6 +219,121 @@ static int client_add(int fd, void (*workfn)(int ci), void (*deadfn)(int ci))
 	goto again;
 }
 
+static int expire_heap_less(int a, int b)
+{
+	return client[expire_heap[a]].expire < client[expire_heap[b]].expire;
+}
+
+static void expire_heap_swap(int a, int b)
+{
+	int ci = expire_heap[a];
+
+	expire_heap[a] = expire_heap[b];
+	expire_heap[b] = ci;
+	client[expire_heap[a]].heap_pos = a + 1;
+	client[expire_heap[b]].heap_pos = b + 1;
+}
+
+static void expire_heap_up(int i)
+{
+	while (i && expire_heap_less(i, (i - 1) / 2)) {
+		expire_heap_swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void expire_heap_down(int i)
+{
+	int min, c;
+
+	while (1) {
+		min = i;
+		c = 2 * i + 1;
+		if (c < expire_heap_count && expire_heap_less(c, min))
+			min = c;
+		if (c + 1 < expire_heap_count && expire_heap_less(c + 1, min))
+			min = c + 1;
+		if (min == i)
+			break;
+		expire_heap_swap(i, min);
+		i = min;
+	}
+}
+
+/* called after client[ci].expire is changed */
+
+static void expire_heap_update(int ci)
+{
+	int i;
+
+	if (!client[ci].heap_pos) {
+		if (!client[ci].expire)
+			return;
+		i = expire_heap_count++;
+		expire_heap[i] = ci;
+		client[ci].heap_pos = i + 1;
+		expire_heap_up(i);
+		return;
+	}
+
+	i = client[ci].heap_pos - 1;
+
+	if (!client[ci].expire) {
+		client[ci].heap_pos = 0;
+		expire_heap_count--;
+		if (i == expire_heap_count)
+			return;
+		expire_heap[i] = expire_heap[expire_heap_count];
+		client[expire_heap[i]].heap_pos = i + 1;
+	}
+
+	/* the client at i is either moved up or it stays to be moved down */
+	expire_heap_up(i);
+	expire_heap_down(i);
+}
+
+/*
+ * Copy the times from the client's shm slot.  The times are used only if
+ * they are newer than the ones from test_live, so an older slot write
+ * does not come after a test_live on the socket, or re-enable a client
+ * that has been disabled.  Returns 1 if the expire time was changed.
+ */
+
+static int shm_refresh(int ci)
+{
+	struct wdmd_shm_slot *slot;
+	uint64_t seq, renewal, expire;
+	int tries = 0;
+
+	if (!client[ci].shm_slot || !client[ci].expire)
+		return 0;
+
+	slot = &shm_table[client[ci].shm_slot - 1];
+
+	while (1) {
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		renewal = __atomic_load_n(&slot->renewal_time, __ATOMIC_RELAXED);
+		expire = __atomic_load_n(&slot->expire_time, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (!(seq & 1) && seq == __atomic_load_n(&slot->seq, __ATOMIC_RELAXED))
+			break;
+
+		/* the client is writing it now, or stopped while writing */
+		if (++tries > 100)
+			return 0;
+		sched_yield();
+	}
+
+	if (renewal <= client[ci].renewal || expire < client[ci].expire)
+		return 0;
+
+	client[ci].renewal = renewal;
+	client[ci].expire = expire;
+	expire_heap_update(ci);
+	return 1;
+}
+
 static void client_pid_dead(int ci)
 {
 	if (!client[ci].expire) {
@@ -207,6 +344,10 @@ static void client_pid_dead(int ci)
 		/* refcount automatically dropped if a client with
 		   no expiration is closed */
 
+		if (client[ci].shm_slot)
+			memset(&shm_table[client[ci].shm_slot - 1], 0,
+			       sizeof(struct wdmd_shm_slot));
+
 		client[ci].used = 0;
 		memset(&client[ci], 0, sizeof(struct client));
 
@@ -315,6 +456,7 @@ static void dump_debug(int fd)
 	for (i = 0; i < client_size; i++) {
 		if (!client[i].used)
 			continue;
+		shm_refresh(i);
 		memset(line, 0, sizeof(line));
 		snprintf(line, 255, "client %d name %.64s pid %d fd %d dead %d ref %d now %llu renewal %llu expire %llu\n",
 			 i, client[i].name, client[i].pid, client[i].fd, client[i].pid_dead, client[i].refcount,
@@ -334,10 +476,133 @@ static void dump_debug(int fd)
 	send(fd, debug_buf, debug_len, MSG_NOSIGNAL);
 }
 
+/*
+ * A client updates the renewal and expire times of other connections from
+ * the same process, identified by the id returned for CMD_CLIENT_ID.  A
+ * connection that has been disabled (expire 0) or closed is not updated,
+ * and neither are times older than the last ones it sent itself, since a
+ * batch may be read after a later test_live on the connection itself.
+ */
+
+static int process_test_live_many(int ci, struct wdmd_header *h)
+{
+	static struct wdmd_test_live tl[WDMD_TEST_LIVE_MAX];
+	int count, skip = 0;
+	int i, ti, rv;
+
+	if (h->len % sizeof(struct wdmd_test_live) ||
+	    h->len > sizeof(tl)) {
+		log_error("ci %d test_live_many len %u", ci, h->len);
+		return -1;
+	}
+
+	count = h->len / sizeof(struct wdmd_test_live);
+	if (!count)
+		return 0;
+
+	rv = recv(client[ci].fd, tl, h->len, MSG_WAITALL);
+	if (rv != (int)h->len) {
+		log_error("ci %d test_live_many recv %d %d", ci, rv, errno);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		ti = (int)(tl[i].client_id & 0xFFFFFFFF);
+
+		if (ti >= client_size || !client[ti].used || client[ti].pid_dead ||
+		    client[ti].gen != (uint32_t)(tl[i].client_id >> 32) ||
+		    !client[ci].pid || client[ti].pid != client[ci].pid ||
+		    !client[ti].expire || tl[i].renewal_time < client[ti].renewal) {
+			skip++;
+			continue;
+		}
+
+		client[ti].renewal = tl[i].renewal_time;
+		client[ti].expire = tl[i].expire_time;
+		expire_heap_update(ti);
+	}
+
+	log_debug("test_live_many ci %d count %d skip %d", ci, count, skip);
+	return 0;
+}
+
+static void process_shm_slot(int ci, struct wdmd_header *h)
+{
+	struct {
+		struct wdmd_header h;
+		struct wdmd_shm_reply r;
+	} reply;
+	char cmsgbuf[CMSG_SPACE(sizeof(int))];
+	struct wdmd_shm_slot *slot;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	int i, rv;
+
+	memset(&reply, 0, sizeof(reply));
+	memcpy(&reply.h, h, sizeof(struct wdmd_header));
+	reply.h.len = sizeof(struct wdmd_shm_reply);
+
+	if (!shm_table) {
+		/* the reply with len 0 and no fd is a failure */
+		reply.h.len = 0;
+		send(client[ci].fd, &reply.h, sizeof(struct wdmd_header), MSG_NOSIGNAL);
+		return;
+	}
+
+	if (!client[ci].shm_slot) {
+		for (i = 0; i < WDMD_SHM_SLOTS; i++) {
+			if (!shm_table[i].client_id)
+				break;
+		}
+		if (i == WDMD_SHM_SLOTS) {
+			log_error("ci %d no free shm slot", ci);
+			reply.h.len = 0;
+			send(client[ci].fd, &reply.h, sizeof(struct wdmd_header), MSG_NOSIGNAL);
+			return;
+		}
+
+		slot = &shm_table[i];
+		slot->seq = 0;
+		slot->renewal_time = client[ci].renewal;
+		slot->expire_time = client[ci].expire;
+		slot->client_id = ((uint64_t)client[ci].gen << 32) | (uint32_t)ci;
+		client[ci].shm_slot = i + 1;
+	}
+
+	reply.r.slot = client[ci].shm_slot - 1;
+	reply.r.slot_size = sizeof(struct wdmd_shm_slot);
+
+	iov.iov_base = &reply;
+	iov.iov_len = sizeof(reply);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf;
+	msg.msg_controllen = sizeof(cmsgbuf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &shm_fd, sizeof(int));
+
+	rv = sendmsg(client[ci].fd, &msg, MSG_NOSIGNAL);
+	if (rv < 0)
+		log_error("ci %d shm slot send error %d", ci, errno);
+
+	log_debug("shm_slot ci %d slot %u", ci, reply.r.slot);
+}
+
 static void process_connection(int ci)
 {
 	struct wdmd_header h;
 	struct wdmd_header h_ret;
+	struct {
+		struct wdmd_header h;
+		uint64_t id;
+	} id_ret;
 	void (*deadfn)(int ci);
 	int rv, pid;
 
@@ -381,6 +646,7 @@ static void process_connection(int ci)
 	case CMD_TEST_LIVE:
 		client[ci].renewal = h.renewal_time;
 		client[ci].expire = h.expire_time;
+		expire_heap_update(ci);
 		log_debug("test_live ci %d renewal %llu expire %llu", ci,
 			  (unsigned long long)client[ci].renewal,
 			  (unsigned long long)client[ci].expire);
@@ -391,9 +657,28 @@ static void process_connection(int ci)
 		h_ret.test_interval = test_interval;
 		h_ret.fire_timeout = fire_timeout;
 		h_ret.last_keepalive = last_keepalive;
+		h_ret.flags = WDMD_STATUS_TEST_LIVE_MANY;
+		if (shm_table)
+			h_ret.flags |= WDMD_STATUS_SHM;
 		send(client[ci].fd, &h_ret, sizeof(h_ret), MSG_NOSIGNAL);
 		break;
 
+	case CMD_CLIENT_ID:
+		memcpy(&id_ret.h, &h, sizeof(h));
+		id_ret.h.len = sizeof(uint64_t);
+		id_ret.id = ((uint64_t)client[ci].gen << 32) | (uint32_t)ci;
+		send(client[ci].fd, &id_ret, sizeof(id_ret), MSG_NOSIGNAL);
+		break;
+
+	case CMD_TEST_LIVE_MANY:
+		if (process_test_live_many(ci, &h) < 0)
+			goto dead;
+		break;
+
+	case CMD_SHM_SLOT:
+		process_shm_slot(ci, &h);
+		break;
+
 	case CMD_DUMP_DEBUG:
 		strncpy(client[ci].name, "dump", WDMD_NAME_SIZE);
 		dump_debug(client[ci].fd);
@@ -487,39 +772,36 @@ static int setup_clients(void)
 	return 0;
 }
 
-static int test_clients(void)
+/*
+ * Check the clients in the subtree of the expire heap rooted at i.  The
+ * descendants of a client expire no sooner than it does, so a subtree is
+ * skipped once its root is further than TEST_INTERVAL from expiring.
+ */
+
+static int test_clients_heap(int i, uint64_t t, time_t last_ping)
 {
-	uint64_t t;
-	time_t last_ping;
 	int fail_count = 0;
-	int i;
+	int ci;
 
-	t = monotime();
+	if (i >= expire_heap_count)
+		return 0;
 
-	for (i = 0; i < client_size; i++) {
-		if (!client[i].used)
-		       continue;
-		if (!client[i].expire)
-			continue;
+	ci = expire_heap[i];
 
-		if (last_keepalive > last_closeunclean)
-			last_ping = last_keepalive;
-		else
-			last_ping = last_closeunclean;
-
-		if (t >= client[i].expire) {
-			log_error("test failed rem %d now %llu ping %llu close %llu renewal %llu expire %llu client %d %s",
-				  DEFAULT_FIRE_TIMEOUT - (int)(t - last_ping),
-				  (unsigned long long)t,
-				  (unsigned long long)last_keepalive,
-				  (unsigned long long)last_closeunclean,
-				  (unsigned long long)client[i].renewal,
-				  (unsigned long long)client[i].expire,
-				  client[i].pid, client[i].name);
-			fail_count++;
-			continue;
-		}
+	if (client[ci].expire > t + DEFAULT_TEST_INTERVAL)
+		return 0;
 
+	if (t >= client[ci].expire) {
+		log_error("test failed rem %d now %llu ping %llu close %llu renewal %llu expire %llu client %d %s",
+			  DEFAULT_FIRE_TIMEOUT - (int)(t - last_ping),
+			  (unsigned long long)t,
+			  (unsigned long long)last_keepalive,
+			  (unsigned long long)last_closeunclean,
+			  (unsigned long long)client[ci].renewal,
+			  (unsigned long long)client[ci].expire,
+			  client[ci].pid, client[ci].name);
+		fail_count++;
+	} else {
 		/*
 		 * If we can patch the kernel to avoid a close-ping,
 		 * then we can remove this early/preemptive fail/close
@@ -540,22 +822,84 @@ static int test_clients(void)
 		 * expiration time.
 		 */
 
-		if (t >= client[i].expire - DEFAULT_TEST_INTERVAL) {
-			log_error("test warning now %llu ping %llu close %llu renewal %llu expire %llu client %d %s",
-				  (unsigned long long)t,
-				  (unsigned long long)last_keepalive,
-				  (unsigned long long)last_closeunclean,
-				  (unsigned long long)client[i].renewal,
-				  (unsigned long long)client[i].expire,
-				  client[i].pid, client[i].name);
-			fail_count++;
-			continue;
-		}
+		log_error("test warning now %llu ping %llu close %llu renewal %llu expire %llu client %d %s",
+			  (unsigned long long)t,
+			  (unsigned long long)last_keepalive,
+			  (unsigned long long)last_closeunclean,
+			  (unsigned long long)client[ci].renewal,
+			  (unsigned long long)client[ci].expire,
+			  client[ci].pid, client[ci].name);
+		fail_count++;
 	}
 
+	fail_count += test_clients_heap(2 * i + 1, t, last_ping);
+	fail_count += test_clients_heap(2 * i + 2, t, last_ping);
 	return fail_count;
 }
 
+/*
+ * The expire times of clients using shm slots are only updated here, so
+ * those in the heap may be older than the ones in the slots, but not
+ * newer.  Before the heap is checked, the clients that it has within
+ * TEST_INTERVAL of expiring are refreshed from their slots, which moves
+ * the ones that have renewed out of that part of the heap.
+ */
+
+static void shm_refresh_expiring(uint64_t t)
+{
+	static int *ci_list;
+	static int ci_list_size;
+	int count = 0, sp = 0;
+	int i, n;
+
+	if (!shm_table || !expire_heap_count)
+		return;
+
+	if (ci_list_size < client_size) {
+		free(ci_list);
+		ci_list_size = 0;
+		ci_list = malloc((2 * client_size + 1) * sizeof(int));
+		if (!ci_list)
+			return;
+		ci_list_size = client_size;
+	}
+
+	/*
+	 * The first client_size entries of ci_list are the client indexes
+	 * found, the second half is the stack of heap positions to visit.
+	 */
+
+	ci_list[ci_list_size + sp++] = 0;
+
+	while (sp) {
+		i = ci_list[ci_list_size + --sp];
+		if (i >= expire_heap_count)
+			continue;
+		if (client[expire_heap[i]].expire > t + DEFAULT_TEST_INTERVAL)
+			continue;
+		ci_list[count++] = expire_heap[i];
+		ci_list[ci_list_size + sp++] = 2 * i + 1;
+		ci_list[ci_list_size + sp++] = 2 * i + 2;
+	}
+
+	for (n = 0; n < count; n++)
+		shm_refresh(ci_list[n]);
+}
+
+static int test_clients(void)
+{
+	time_t last_ping;
+
+	shm_refresh_expiring(monotime());
+
+	if (last_keepalive > last_closeunclean)
+		last_ping = last_keepalive;
+	else
+		last_ping = last_closeunclean;
+
+	return test_clients_heap(0, monotime(), last_ping);
+}
+
 static int active_clients(void)
 {
 	int i;
@@ -1280,7 +1624,7 @@ static int setup_shm(void)
 {
 	int rv;
 
-	rv = shm_open("/wdmd", O_RDWR|O_CREAT|O_EXCL, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+	rv = shm_open(WDMD_SHM_NAME, O_RDWR|O_CREAT|O_EXCL, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
 	if (rv < 0) {
 		log_error("other wdmd not cleanly stopped, shm_open error %d", errno);
 		return rv;
@@ -1289,9 +1633,38 @@ static int setup_shm(void)
 	return 0;
 }
 
+/*
+ * Clients get the shm fd with their slot (CMD_SHM_SLOT), so the mode of
+ * the object does not need to let them open it.  Without the table,
+ * clients use test_live messages.
+ */
+
+static void setup_shm_table(void)
+{
+	void *table;
+	size_t size = WDMD_SHM_SLOTS * sizeof(struct wdmd_shm_slot);
+
+	if (ftruncate(shm_fd, size) < 0) {
+		log_error("shm table truncate error %d", errno);
+		return;
+	}
+
+	table = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+	if (table == MAP_FAILED) {
+		log_error("shm table mmap error %d", errno);
+		return;
+	}
+
+	memset(table, 0, size);
+	shm_table = table;
+	shm_table_size = size;
+}
+
 static void close_shm(void)
 {
-	shm_unlink("/wdmd");
+	if (shm_table)
+		munmap(shm_table, shm_table_size);
+	shm_unlink(WDMD_SHM_NAME);
 	close(shm_fd);
 }
 
@@ -1645,6 +2018,8 @@ int main(int argc, char *argv[])
 	rv = setup_shm();
 	if (rv < 0)
 		goto out_lockfile;
+
+	setup_shm_table();
 		  
 	rv = setup_signals();
 	if (rv < 0)
@@ -19,4 +19,51 @@ int wdmd_refcount_clear(int con);
 int wdmd_test_live(int con, uint64_t renewal_time, uint64_t expire_time);
 int wdmd_status(int con, int *test_interval, int *fire_timeout, uint64_t *last_keepalive);
 
+/*
+ * wdmd_test_live_many() sets the renewal and expire times of a number of
+ * connections from this process in one message.  Each connection is
+ * identified by the id that wdmd_client_id() returned for it, and must
+ * already have an expire time set by wdmd_test_live().  Supported when
+ * wdmd_status_flags() returns WDMD_STATUS_TEST_LIVE_MANY.
+ */
+
+#define WDMD_TEST_LIVE_MAX 1024
+
+#define WDMD_STATUS_TEST_LIVE_MANY 0x00000001
+
+struct wdmd_test_live {
+	uint64_t client_id;
+	uint64_t renewal_time;
+	uint64_t expire_time;
+};
+
+/*
+ * wdmd_shm_open() gives the connection a slot in a table that wdmd
+ * shares with its clients, after which wdmd_shm_test_live() sets the
+ * renewal and expire times of the connection without sending a message.
+ * wdmd reads the slot when it checks the expire time.  wdmd_test_live()
+ * on the connection still works, and is the way to disable it (0, 0).
+ * A slot is only for increasing times, from one thread at a time.
+ * Supported when wdmd_status_flags() returns WDMD_STATUS_SHM.
+ */
+
+#define WDMD_STATUS_SHM 0x00000002
+
+struct wdmd_shm_slot {
+	uint64_t seq;			/* odd while being written */
+	uint64_t renewal_time;
+	uint64_t expire_time;
+	uint64_t client_id;
+};
+
+int wdmd_shm_open(int con, struct wdmd_shm_slot **slot);
+void wdmd_shm_test_live(struct wdmd_shm_slot *slot, uint64_t renewal_time,
+			uint64_t expire_time);
+void wdmd_shm_close(struct wdmd_shm_slot *slot);
+
+int wdmd_status_flags(int con, int *test_interval, int *fire_timeout,
+		      uint64_t *last_keepalive, uint32_t *flags);
+int wdmd_client_id(int con, uint64_t *client_id);
+int wdmd_test_live_many(int con, struct wdmd_test_live *tl, int count);
+
 #endif
@@ -20,8 +20,20 @@ enum {
 	CMD_TEST_LIVE,
 	CMD_STATUS,
 	CMD_DUMP_DEBUG,
+	CMD_CLIENT_ID,
+	CMD_TEST_LIVE_MANY,
+	CMD_SHM_SLOT,
 };
 
+/*
+ * The CMD_CLIENT_ID reply header is followed by a uint64_t id, and the
+ * CMD_TEST_LIVE_MANY header by len bytes of struct wdmd_test_live.
+ * The CMD_SHM_SLOT reply header is followed by struct wdmd_shm_reply,
+ * and carries the fd of the shm table.
+ * The CMD_STATUS reply has WDMD_STATUS_ flags; an older daemon returns
+ * the flags that were sent, which are zero.
+ */
+
 struct wdmd_header {
 	uint32_t magic;
 	uint32_t cmd;
@@ -35,6 +47,14 @@ struct wdmd_header {
 	char name[WDMD_NAME_SIZE];
 };
 
+#define WDMD_SHM_NAME "/wdmd"
+#define WDMD_SHM_SLOTS 4096
+
+struct wdmd_shm_reply {
+	uint32_t slot;
+	uint32_t slot_size;
+};
+
 int wdmd_socket_address(struct sockaddr_un *addr);
 
 #endif